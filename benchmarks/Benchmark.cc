@@ -139,14 +139,18 @@ int main(int argc, char** argv) {
     printf("Flushing the log statements to disk took an additional %0.2lf secs\r\n",
             time);
 
-    uint64_t totalEvents = NanoLogInternal::RuntimeLogger::nanoLogSingleton.logsProcessed;
+    uint64_t totalEvents = 0;
+    uint64_t cyclesCompressing = 0;
+    for (auto *worker : NanoLogInternal::RuntimeLogger::nanoLogSingleton.workers) {
+        totalEvents += worker->logsProcessed;
+        cyclesCompressing += worker->cyclesCompressing;
+    }
     double totalTime = PerfUtils::Cycles::toSeconds(stop - start);
     double recordTimeEstimated = PerfUtils::Cycles::toSeconds(stop - start
                                     - NanoLogInternal::RuntimeLogger::stagingBuffer->cyclesProducerBlocked);
     double recordNsEstimated = recordTimeEstimated*1.0e9
                                 / NanoLogInternal::RuntimeLogger::stagingBuffer->numAllocations;
-    double compressionTime = PerfUtils::Cycles::toSeconds(
-                    NanoLogInternal::RuntimeLogger::nanoLogSingleton.cyclesCompressing);
+    double compressionTime = PerfUtils::Cycles::toSeconds(cyclesCompressing);
     printf("Took %0.2lf seconds to log %lu operations\r\nThroughput: %0.2lf op/s (%0.2lf Mop/s)\r\n",
                 totalTime, totalEvents,
                 totalEvents/totalTime,
@@ -0,0 +1,77 @@
+#! /usr/bin/python
+
+"""Compares the results of two decoder benchmark runs
+
+Reads the JSON results written by decoder/decoderBenchmark (see
+run_decoderBench.sh) for a baseline and a new run, prints the change of the
+throughput, heap allocations and peak memory of each decoder API on each
+corpus and flags the throughputs that dropped and the peak memory that grew
+by more than a threshold.
+
+Usage:
+    compareDecoderBench.py [-h] [--threshold=PCT] BASELINE_JSON NEW_JSON
+
+Options:
+  -h --help             Show this help messages
+  --threshold=PCT       Percentage by which a throughput may drop or the peak
+                        memory may grow before it's reported as a regression
+                        [default: 10]
+
+Arguments:
+  BASELINE_JSON         Results to compare against
+  NEW_JSON              Results to compare
+"""
+
+import json
+import os
+import sys
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             "..", "preprocessor"))
+from docopt import docopt
+
+# Metrics to compare, as (JSON key, column name, sign of a regression)
+METRICS = [("megabytesPerSecond", "MB/s", -1),
+           ("allocations", "Allocs", 0),
+           ("peakRssKb", "RSS KB", 1)]
+
+def loadRuns(filename):
+    with open(filename, 'r') as jsonFile:
+        results = json.load(jsonFile)
+    return results, dict(((run["corpus"], run["method"]), run)
+                            for run in results["runs"])
+
+if __name__ == "__main__":
+    arguments = docopt(__doc__)
+    threshold = float(arguments["--threshold"])
+
+    baseline, baselineRuns = loadRuns(arguments["BASELINE_JSON"])
+    new, newRuns = loadRuns(arguments["NEW_JSON"])
+
+    if baseline["config"] != new["config"]:
+        print("# Warning: the runs were made with different configurations")
+
+    print("# %s -> %s" % (baseline["label"], new["label"]))
+    print("# %-18s %-24s %7s %12s %12s %8s" % ("Corpus", "Method", "Metric",
+                                               "Baseline", "New", "Change"))
+
+    regressions = 0
+    for key in [run for run in sorted(baselineRuns) if run in newRuns]:
+        for metric, name, regressionSign in METRICS:
+            before = baselineRuns[key][metric]
+            after = newRuns[key][metric]
+            change = 100.0*(after - before)/before if before else 0.0
+
+            flag = ""
+            if regressionSign and regressionSign*change > threshold:
+                flag = "REGRESSION"
+                regressions += 1
+
+            line = "%-20s %-24s %7s %12.1f %12.1f %+7.1f%% %s" % (key[0],
+                        key[1], name, before, after, change, flag)
+            print(line.rstrip())
+
+    if regressions:
+        print("# %d metrics regressed by more than %.1f%%" % (regressions,
+                                                              threshold))
+        sys.exit(1)
@@ -0,0 +1,75 @@
+#! /usr/bin/python
+
+"""Compares the results of two continuous-load benchmark runs
+
+Reads the JSON results written by load/loadBenchmark (see run_loadBench.sh)
+for a baseline and a new run, prints the change of each latency percentile
+for every number of producer threads and flags the ones that got worse by
+more than a threshold.
+
+Usage:
+    compareLoadBench.py [-h] [--threshold=PCT] BASELINE_JSON NEW_JSON
+
+Options:
+  -h --help             Show this help messages
+  --threshold=PCT       Percentage by which a latency may increase before it's
+                        reported as a regression [default: 10]
+
+Arguments:
+  BASELINE_JSON         Results to compare against
+  NEW_JSON              Results to compare
+"""
+
+import json
+import os
+import sys
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             "..", "preprocessor"))
+from docopt import docopt
+
+# Latencies to compare, as (kind, percentile) keys of the JSON results
+LATENCIES = [(kind, percentile)
+                for kind in ["service", "response"]
+                for percentile in ["p50Ns", "p99Ns", "p999Ns", "maxNs"]]
+
+def loadRuns(filename):
+    with open(filename, 'r') as jsonFile:
+        results = json.load(jsonFile)
+    return results, dict((run["threads"], run) for run in results["runs"])
+
+if __name__ == "__main__":
+    arguments = docopt(__doc__)
+    threshold = float(arguments["--threshold"])
+
+    baseline, baselineRuns = loadRuns(arguments["BASELINE_JSON"])
+    new, newRuns = loadRuns(arguments["NEW_JSON"])
+
+    if baseline["config"] != new["config"]:
+        print("# Warning: the runs were made with different configurations")
+
+    print("# %s (%s) -> %s (%s)" % (baseline["label"], baseline["system"],
+                                    new["label"], new["system"]))
+    print("# %7s %9s %7s %12s %12s %8s" % ("Threads", "Latency", "", "Baseline",
+                                           "New", "Change"))
+
+    regressions = 0
+    for threads in sorted(set(baselineRuns) & set(newRuns)):
+        for kind, percentile in LATENCIES:
+            before = baselineRuns[threads][kind][percentile]
+            after = newRuns[threads][kind][percentile]
+            change = 100.0*(after - before)/before if before else 0.0
+
+            flag = ""
+            if change > threshold:
+                flag = "REGRESSION"
+                regressions += 1
+
+            line = "%9d %9s %7s %12.1f %12.1f %+7.1f%% %s" % (threads, kind,
+                        percentile[:-2], before, after, change, flag)
+            print(line.rstrip())
+
+    if regressions:
+        print("# %d latencies regressed by more than %.1f%%" % (regressions,
+                                                                threshold))
+        sys.exit(1)
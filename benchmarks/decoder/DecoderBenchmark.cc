@@ -0,0 +1,763 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * This file implements a benchmark of the throughput of the log decoder
+ * (Log::Decoder). It generates synthetic log files with Log::Encoder, so the
+ * corpora are reproducible and independent of the runtime's scheduling:
+ *   - numeric: integer and floating point arguments from one thread
+ *   - strings: string arguments of varying lengths from one thread
+ *   - mixed: both kinds of log messages interleaved from many threads, which
+ *     is the worst case for the sorted merge of decompressTo()
+ *
+ * Each corpus is then decoded by every decoder API separately:
+ *   - decompressTo: sorted, formatted output with one thread
+ *   - decompressTo-<N>threads: the same with N formatting threads
+ *   - decompressUnordered: formatted output in file order
+ *   - getNextLogStatement: sorted iteration without formatting
+ *   - aggregate: getNextArgumentBatch() of one integer argument summed
+ *     with the Aggregation kernels
+ *
+ * For each it reports the throughput in MB of the compressed log and log
+ * messages per second, the number of heap allocations made and the peak
+ * resident set size. The results are printed as a table and optionally
+ * written as JSON to be compared across commits (see
+ * ../compareDecoderBench.py).
+ */
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Aggregation.h"
+#include "Config.h"
+#include "Cycles.h"
+#include "Log.h"
+#include "NanoLogCpp17.h"
+
+using namespace NanoLogInternal;
+using PerfUtils::Cycles;
+
+/**
+ * The heap allocations made by the decoder are counted by interposing on
+ * glibc's malloc() family, which also catches the ones made through
+ * operator new. The counters are reset before each measurement.
+ */
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> allocatedBytes(0);
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(count*size, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *ptr, size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+/**
+ * Resets the peak resident set size of the process (VmHWM) to its current
+ * resident set size so that the peak of each measurement can be reported.
+ *
+ * \return
+ *      True if successful; the kernel must be Linux 4.0 or newer.
+ */
+static bool
+resetPeakRss()
+{
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == NULL)
+        return false;
+
+    bool success = (fputs("5", clearRefs) >= 0);
+    success &= (fclose(clearRefs) == 0);
+    return success;
+}
+
+/**
+ * Returns the peak resident set size of the process in KB since it started
+ * or since the last resetPeakRss(), or 0 if it can't be determined.
+ */
+static uint64_t
+getPeakRssKb()
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return 0;
+
+    char line[256];
+    uint64_t peakKb = 0;
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            peakKb = strtoull(line + 6, NULL, 10);
+            break;
+        }
+    }
+
+    fclose(status);
+    return peakKb;
+}
+
+// Format strings of the log messages in the corpora
+static constexpr char NUMERIC_FORMAT[] =
+                        "Request %d completed in %lu cycles with load %0.3lf";
+static constexpr char STRING_FORMAT[] =
+                        "User %s fetched %s from %s in %d us";
+
+static constexpr auto NUMERIC_PARAMS =
+        analyzeFormatString<countFmtParams(NUMERIC_FORMAT)>(NUMERIC_FORMAT);
+static constexpr auto STRING_PARAMS =
+        analyzeFormatString<countFmtParams(STRING_FORMAT)>(STRING_FORMAT);
+
+// Dictionary of the log messages; their logIds are the indexes
+enum LogId : uint32_t { NUMERIC_LOG_ID = 0, STRING_LOG_ID = 1 };
+static const std::vector<StaticLogInfo> DICTIONARY = {
+    StaticLogInfo(&compressArgs<getStringArgMask(NUMERIC_PARAMS),
+                                int, uint64_t, double>,
+                  "DecoderBenchmark.cc", 1, NanoLog::NOTICE, NUMERIC_FORMAT,
+                  countFmtParams(NUMERIC_FORMAT),
+                  getNumNibblesNeeded(NUMERIC_FORMAT),
+                  NUMERIC_PARAMS.data()),
+    StaticLogInfo(&compressArgs<getStringArgMask(STRING_PARAMS),
+                                const char*, const char*, const char*, int>,
+                  "DecoderBenchmark.cc", 2, NanoLog::NOTICE, STRING_FORMAT,
+                  countFmtParams(STRING_FORMAT),
+                  getNumNibblesNeeded(STRING_FORMAT),
+                  STRING_PARAMS.data()),
+};
+
+// Values of the string arguments, of varying lengths
+static const char *USERS[] = {"alice", "bob", "carol-from-accounting",
+                              "dave", "eve.the.eavesdropper", "mallory"};
+static const char *RESOURCES[] = {"/", "/index.html",
+                                  "/api/v2/orders/8812734/items?expand=all",
+                                  "/static/js/app.bundle.min.js",
+                                  "/images/logo.png"};
+static const char *HOSTS[] = {"10.0.0.1", "cache-07.us-west.example.com",
+                              "db-primary", "storage-node-1138.local"};
+
+// Largest number of bytes a log message occupies in a StagingBuffer
+static const size_t MAX_MESSAGE_BYTES = 256;
+
+// Number of log messages each thread contributes to a pass over the
+// StagingBuffers in the generated log (i.e. per BufferExtent)
+static const uint32_t MESSAGES_PER_EXTENT = 256;
+
+/**
+ * Parameters of the benchmark
+ */
+struct Options {
+    // Number of log messages in each corpus
+    uint64_t messages = 2000000;
+
+    // Number of runtime threads of the mixed corpus
+    int threads = 64;
+
+    // Number of threads of the parallel decompressTo() measurement
+    uint32_t decodeThreads = 4;
+
+    // Number of times each measurement is repeated; the fastest is reported
+    int repeat = 3;
+
+    // Whether the corpora are generated with delta encoded arguments
+    bool deltaEncoding = false;
+
+    // Size of the output buffers the corpora are encoded in. It defaults to
+    // a lot less than the library's default so that the decoder goes
+    // through many of them.
+    size_t outputBufferSize = 1 << 22;
+
+    // Log file the corpora are written to
+    const char *logFile = "/tmp/decoderBenchLog";
+
+    // File to write the results to as JSON; none if nullptr
+    const char *jsonFile = nullptr;
+
+    // Free-form label for the results (i.e. the git commit)
+    const char *label = "";
+};
+
+/**
+ * Kinds of log messages a corpus is made of (see top of file)
+ */
+enum CorpusKind { NUMERIC, STRINGS, MIXED };
+
+/**
+ * Synthetic log file to decode
+ */
+struct Corpus {
+    std::string name;
+    CorpusKind kind;
+
+    // Number of runtime threads (StagingBuffers) the log messages are from
+    int threads;
+
+    // Size of the log file in bytes
+    uint64_t fileBytes;
+
+    // Number of log messages in the file
+    uint64_t messages;
+
+    // Log message and argument aggregated by the aggregate measurement
+    uint32_t aggregatedLogId;
+    uint32_t aggregatedArgIndex;
+};
+
+/**
+ * Measurements of one decoder API on one corpus
+ */
+struct RunResult {
+    std::string corpus;
+    std::string method;
+    uint64_t compressedBytes;
+    uint64_t messages;
+    double seconds;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t peakRssKb;
+};
+
+/**
+ * Appends a log message to a buffer in the format of the StagingBuffers.
+ *
+ * \param[in/out] buffer
+ *      Where to write the log message; advanced past it
+ * \param logId
+ *      Index of the log message in DICTIONARY
+ * \param paramTypes
+ *      Types of the format parameters of the log message
+ * \param timestamp
+ *      rdtsc() timestamp of the log message
+ * \param args
+ *      Arguments of the log message
+ */
+template<unsigned long N, typename... Ts>
+static void
+appendMessage(char **buffer, uint32_t logId,
+              const std::array<ParamType, N> &paramTypes,
+              uint64_t timestamp, Ts... args)
+{
+    size_t stringSizes[N] = {};
+    uint64_t previousPrecision = -1;
+    size_t argBytes = getArgSizes(paramTypes, previousPrecision, stringSizes,
+                                  args...);
+
+    auto *entry = reinterpret_cast<Log::UncompressedEntry*>(*buffer);
+    entry->fmtId = logId;
+    entry->timestamp = timestamp;
+    entry->entrySize = static_cast<uint32_t>(sizeof(Log::UncompressedEntry)
+                                                + argBytes);
+
+    *buffer += sizeof(Log::UncompressedEntry);
+    store_arguments(paramTypes, stringSizes, buffer, args...);
+}
+
+/**
+ * Appends the i-th log message of a corpus to a buffer (see appendMessage)
+ */
+static void
+appendCorpusMessage(char **buffer, CorpusKind kind, uint64_t i,
+                    uint64_t timestamp)
+{
+    // Cheap deterministic pseudo-random values
+    uint64_t hash = (i + 1)*0x9E3779B97F4A7C15UL;
+    hash ^= hash >> 29;
+
+    bool numeric = (kind == NUMERIC) || (kind == MIXED && (hash & 1));
+    if (numeric) {
+        appendMessage(buffer, NUMERIC_LOG_ID, NUMERIC_PARAMS, timestamp,
+                      static_cast<int>(hash % 100000),
+                      static_cast<uint64_t>(1000 + (hash >> 40)),
+                      static_cast<double>(hash % 1000)/1000.0);
+    } else {
+        appendMessage(buffer, STRING_LOG_ID, STRING_PARAMS, timestamp,
+                      USERS[hash % Util::arraySize(USERS)],
+                      RESOURCES[(hash >> 8) % Util::arraySize(RESOURCES)],
+                      HOSTS[(hash >> 16) % Util::arraySize(HOSTS)],
+                      static_cast<int>(hash % 5000));
+    }
+}
+
+/**
+ * Writes the compressed log in an Encoder's output buffer to a file and
+ * resets the Encoder to encode into the buffer again.
+ */
+static void
+flushEncoder(Log::Encoder &encoder, char *outputBuffer, size_t size,
+             FILE *out)
+{
+    char *buffer = nullptr;
+    size_t length = 0;
+    encoder.swapBuffer(outputBuffer, size, &buffer, &length);
+    if (fwrite(buffer, 1, length, out) != length) {
+        fprintf(stderr, "Unable to write the corpus: %s\r\n", strerror(errno));
+        exit(1);
+    }
+}
+
+/**
+ * Generates a corpus in options.logFile. Its log messages are encoded the
+ * way the RuntimeLogger encodes them: in passes over the threads' buffers
+ * that each encode a BufferExtent of up to MESSAGES_PER_EXTENT log messages
+ * per thread, with the timestamps of the threads interleaved.
+ *
+ * \param options
+ *      Parameters of the benchmark
+ * \param[in/out] corpus
+ *      Corpus to generate; its size and number of log messages are filled in
+ */
+static void
+generateCorpus(const Options &options, Corpus &corpus)
+{
+    FILE *out = fopen(options.logFile, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Unable to open '%s' to write the corpus to: %s\r\n",
+                options.logFile, strerror(errno));
+        exit(1);
+    }
+
+    std::unique_ptr<char[]> outputBuffer(new char[options.outputBufferSize]);
+    std::unique_ptr<char[]> stagingBuffer(
+                            new char[MESSAGES_PER_EXTENT*MAX_MESSAGE_BYTES]);
+
+    Log::Encoder encoder(outputBuffer.get(), options.outputBufferSize, false,
+                         false, options.deltaEncoding);
+    uint32_t nextDictionaryEntry = 0;
+    encoder.encodeNewDictionaryEntries(nextDictionaryEntry, DICTIONARY);
+
+    uint64_t baseTimestamp = Cycles::rdtsc();
+    uint64_t messages = 0;
+    uint64_t encoded = 0;
+    for (uint64_t pass = 0; messages < options.messages; ++pass) {
+        for (int thread = 0; thread < corpus.threads &&
+                                        messages < options.messages; ++thread) {
+            char *end = stagingBuffer.get();
+            for (uint32_t i = 0; i < MESSAGES_PER_EXTENT &&
+                                        messages < options.messages; ++i) {
+                uint64_t order = (pass*MESSAGES_PER_EXTENT + i)*corpus.threads
+                                                                    + thread;
+                appendCorpusMessage(&end, corpus.kind, messages,
+                                    baseTimestamp + 100*order);
+                ++messages;
+            }
+
+            char *from = stagingBuffer.get();
+            bool wrapAround = (thread == 0 && pass > 0);
+            bool flushed = false;
+            while (from < end) {
+                long bytesRead = encoder.encodeLogMsgs(from, end - from,
+                                        thread, wrapAround, DICTIONARY,
+                                        &encoded);
+                if (bytesRead == 0) {
+                    if (flushed) {
+                        fprintf(stderr, "The output buffer is too small to "
+                                        "generate the corpus\r\n");
+                        exit(1);
+                    }
+
+                    flushEncoder(encoder, outputBuffer.get(),
+                                 options.outputBufferSize, out);
+                    flushed = true;
+                    continue;
+                }
+
+                from += bytesRead;
+                wrapAround = false;
+                flushed = false;
+            }
+        }
+    }
+
+    flushEncoder(encoder, outputBuffer.get(), options.outputBufferSize, out);
+    fclose(out);
+
+    struct stat st;
+    if (stat(options.logFile, &st) != 0) {
+        fprintf(stderr, "Unable to stat '%s': %s\r\n", options.logFile,
+                strerror(errno));
+        exit(1);
+    }
+
+    corpus.fileBytes = static_cast<uint64_t>(st.st_size);
+    corpus.messages = encoded;
+}
+
+/**
+ * Opens the corpus in a Decoder or exits on failure
+ */
+static void
+openCorpus(Log::Decoder &decoder, const Options &options)
+{
+    if (!decoder.open(options.logFile)) {
+        fprintf(stderr, "Unable to open the corpus '%s'\r\n", options.logFile);
+        exit(1);
+    }
+}
+
+/**
+ * Measures a decoder API on the corpus in options.logFile. The measurement
+ * is repeated options.repeat times and the fastest is returned.
+ *
+ * \param options
+ *      Parameters of the benchmark
+ * \param corpus
+ *      Corpus that is decoded
+ * \param method
+ *      Name of the measurement
+ * \param decode
+ *      Decodes the corpus (including opening it) and returns the number of
+ *      log messages decoded
+ */
+static RunResult
+measure(const Options &options, const Corpus &corpus, const char *method,
+        std::function<uint64_t()> decode)
+{
+    RunResult best = {};
+    best.seconds = -1;
+    for (int i = 0; i < options.repeat; ++i) {
+        bool rssReset = resetPeakRss();
+        allocations = 0;
+        allocatedBytes = 0;
+
+        uint64_t start = Cycles::rdtsc();
+        uint64_t messages = decode();
+        uint64_t stop = Cycles::rdtsc();
+
+        RunResult run;
+        run.corpus = corpus.name;
+        run.method = method;
+        run.compressedBytes = corpus.fileBytes;
+        run.messages = messages;
+        run.seconds = Cycles::toSeconds(stop - start);
+        run.allocations = allocations;
+        run.allocatedBytes = allocatedBytes;
+        run.peakRssKb = rssReset ? getPeakRssKb() : 0;
+
+        if (best.seconds < 0 || run.seconds < best.seconds)
+            best = run;
+    }
+
+    return best;
+}
+
+/**
+ * Measures every decoder API on a corpus (see top of file)
+ *
+ * \param options
+ *      Parameters of the benchmark
+ * \param corpus
+ *      Corpus in options.logFile
+ * \param devNull
+ *      Where the formatted log messages are output to
+ * \param[out] runs
+ *      Results to append the measurements to
+ */
+static void
+runBenchmark(const Options &options, const Corpus &corpus, FILE *devNull,
+             std::vector<RunResult> &runs)
+{
+    auto decompressTo = [&](uint32_t numThreads) {
+        return [&, numThreads]() {
+            Log::Decoder decoder;
+            openCorpus(decoder, options);
+            int64_t messages = decoder.decompressTo(devNull, numThreads);
+            if (messages < 0) {
+                fprintf(stderr, "decompressTo() failed\r\n");
+                exit(1);
+            }
+            return static_cast<uint64_t>(messages);
+        };
+    };
+
+    runs.push_back(measure(options, corpus, "decompressTo", decompressTo(1)));
+
+    if (options.decodeThreads > 1) {
+        std::string method = "decompressTo-" +
+                        std::to_string(options.decodeThreads) + "threads";
+        runs.push_back(measure(options, corpus, method.c_str(),
+                               decompressTo(options.decodeThreads)));
+    }
+
+    runs.push_back(measure(options, corpus, "decompressUnordered", [&]() {
+        Log::Decoder decoder;
+        openCorpus(decoder, options);
+        int64_t messages = decoder.decompressUnordered(devNull);
+        if (messages < 0) {
+            fprintf(stderr, "decompressUnordered() failed\r\n");
+            exit(1);
+        }
+        return static_cast<uint64_t>(messages);
+    }));
+
+    runs.push_back(measure(options, corpus, "getNextLogStatement", [&]() {
+        Log::Decoder decoder;
+        Log::LogMessage logMsg;
+        openCorpus(decoder, options);
+
+        uint64_t messages = 0;
+        while (decoder.getNextLogStatement(logMsg))
+            ++messages;
+        return messages;
+    }));
+
+    // Keeps the compiler from optimizing the aggregation away
+    static volatile int64_t aggregate;
+    runs.push_back(measure(options, corpus, "aggregate", [&]() {
+        Log::Decoder decoder;
+        std::unique_ptr<Log::ArgumentBatch> batch(new Log::ArgumentBatch());
+        openCorpus(decoder, options);
+
+        uint64_t messages = 0;
+        int64_t sum = 0;
+        while (decoder.getNextArgumentBatch(corpus.aggregatedLogId,
+                                            corpus.aggregatedArgIndex,
+                                            *batch)) {
+            sum += Aggregation::sum(batch->ints, batch->size);
+            messages += batch->size;
+        }
+
+        aggregate = sum;
+        return messages;
+    }));
+}
+
+/**
+ * Prints the results of a measurement as a row of the results table
+ */
+static void
+printRun(const RunResult &run)
+{
+    printf("%-20s %-24s %10.1lf %12.0lf %12lu %10.1lf\r\n",
+            run.corpus.c_str(), run.method.c_str(),
+            static_cast<double>(run.compressedBytes)/1e6/run.seconds,
+            static_cast<double>(run.messages)/run.seconds,
+            run.allocations,
+            static_cast<double>(run.peakRssKb)/1024.0);
+}
+
+/**
+ * Writes the parameters and results of the benchmark as JSON
+ *
+ * \param filename
+ *      File to write to
+ * \param options
+ *      Parameters of the benchmark
+ * \param corpora
+ *      Corpora decoded
+ * \param runs
+ *      Results of the measurements
+ */
+static void
+writeJson(const char *filename, const Options &options,
+          const std::vector<Corpus> &corpora,
+          const std::vector<RunResult> &runs)
+{
+    FILE *out = fopen(filename, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Unable to open '%s' to write the results to: %s\r\n",
+                filename, strerror(errno));
+        exit(1);
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"decoder\",\n");
+    fprintf(out, "  \"label\": \"%s\",\n", options.label);
+    fprintf(out, "  \"system\": \"C++17\",\n");
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"messages\": %lu,\n", options.messages);
+    fprintf(out, "    \"threads\": %d,\n", options.threads);
+    fprintf(out, "    \"decodeThreads\": %u,\n", options.decodeThreads);
+    fprintf(out, "    \"repeat\": %d,\n", options.repeat);
+    fprintf(out, "    \"deltaEncoding\": %s,\n",
+            options.deltaEncoding ? "true" : "false");
+    fprintf(out, "    \"outputBufferSize\": %lu,\n", options.outputBufferSize);
+    fprintf(out, "    \"cyclesPerSecond\": %.0lf\n", Cycles::perSecond());
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"corpora\": [\n");
+    for (size_t i = 0; i < corpora.size(); ++i) {
+        const Corpus &corpus = corpora[i];
+        fprintf(out, "    {\"name\": \"%s\", \"threads\": %d, "
+                     "\"messages\": %lu, \"fileBytes\": %lu}%s\n",
+                corpus.name.c_str(), corpus.threads, corpus.messages,
+                corpus.fileBytes, (i + 1 < corpora.size()) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"runs\": [\n");
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const RunResult &run = runs[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"corpus\": \"%s\",\n", run.corpus.c_str());
+        fprintf(out, "      \"method\": \"%s\",\n", run.method.c_str());
+        fprintf(out, "      \"messages\": %lu,\n", run.messages);
+        fprintf(out, "      \"seconds\": %.6lf,\n", run.seconds);
+        fprintf(out, "      \"megabytesPerSecond\": %.1lf,\n",
+                static_cast<double>(run.compressedBytes)/1e6/run.seconds);
+        fprintf(out, "      \"messagesPerSecond\": %.0lf,\n",
+                static_cast<double>(run.messages)/run.seconds);
+        fprintf(out, "      \"allocations\": %lu,\n", run.allocations);
+        fprintf(out, "      \"allocatedBytes\": %lu,\n", run.allocatedBytes);
+        fprintf(out, "      \"peakRssKb\": %lu\n", run.peakRssKb);
+        fprintf(out, "    }%s\n", (i + 1 < runs.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+static void
+printHelp(const char *exe)
+{
+    printf("Generates synthetic log files and reports the throughput, heap "
+           "allocations and peak memory of the decoder's APIs.\r\n\r\n");
+    printf("Usage:\r\n");
+    printf("\t%s [options]\r\n\r\n", exe);
+    printf("Options:\r\n");
+    printf("\t--messages <N>            Log messages per corpus "
+           "(default 2000000)\r\n");
+    printf("\t--threads <N>             Runtime threads of the mixed corpus "
+           "(default 64)\r\n");
+    printf("\t--decodeThreads <N>       Threads of the parallel "
+           "decompressTo (default 4)\r\n");
+    printf("\t--repeat <N>              Repetitions of each measurement; the "
+           "fastest is reported (default 3)\r\n");
+    printf("\t--delta <0|1>             Delta encodes the arguments "
+           "(default 0)\r\n");
+    printf("\t--outputBufferSize <B>    Output buffer size (default %u)\r\n",
+           1 << 22);
+    printf("\t--logFile <file>          Log file (default "
+           "/tmp/decoderBenchLog)\r\n");
+    printf("\t--json <file>             Writes the results as JSON\r\n");
+    printf("\t--label <label>           Label for the JSON results\r\n");
+}
+
+int
+main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printHelp(argv[0]);
+            exit(1);
+        }
+
+        const char *option = argv[i];
+        const char *value = argv[i + 1];
+        if (strcmp(option, "--messages") == 0) {
+            options.messages = strtoull(value, NULL, 0);
+        } else if (strcmp(option, "--threads") == 0) {
+            options.threads = atoi(value);
+        } else if (strcmp(option, "--decodeThreads") == 0) {
+            options.decodeThreads = static_cast<uint32_t>(atoi(value));
+        } else if (strcmp(option, "--repeat") == 0) {
+            options.repeat = atoi(value);
+        } else if (strcmp(option, "--delta") == 0) {
+            options.deltaEncoding = (atoi(value) != 0);
+        } else if (strcmp(option, "--outputBufferSize") == 0) {
+            options.outputBufferSize = strtoul(value, NULL, 0);
+        } else if (strcmp(option, "--logFile") == 0) {
+            options.logFile = value;
+        } else if (strcmp(option, "--json") == 0) {
+            options.jsonFile = value;
+        } else if (strcmp(option, "--label") == 0) {
+            options.label = value;
+        } else {
+            printHelp(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (options.messages < 1 || options.threads < 1 ||
+            options.decodeThreads < 1 || options.repeat < 1 ||
+            options.outputBufferSize < NanoLogConfig::MIN_OUTPUT_BUFFER_SIZE) {
+        printHelp(argv[0]);
+        exit(1);
+    }
+
+    std::vector<Corpus> corpora(3);
+    corpora[0].name = "numeric";
+    corpora[0].kind = NUMERIC;
+    corpora[0].threads = 1;
+    corpora[1].name = "strings";
+    corpora[1].kind = STRINGS;
+    corpora[1].threads = 1;
+    corpora[2].name = "mixed-" + std::to_string(options.threads) + "threads";
+    corpora[2].kind = MIXED;
+    corpora[2].threads = options.threads;
+
+    FILE *devNull = fopen("/dev/null", "w");
+    if (devNull == NULL) {
+        fprintf(stderr, "Unable to open /dev/null: %s\r\n", strerror(errno));
+        exit(1);
+    }
+
+    printf("# Throughput in MB of compressed log per second; peak RSS in MB "
+           "(0 if it can't be reset)\r\n");
+    printf("# %-18s %-24s %10s %12s %12s %10s\r\n",
+            "Corpus", "Method", "MB/s", "Msgs/s", "Allocs", "Peak RSS");
+
+    std::vector<RunResult> runs;
+    for (Corpus &corpus : corpora) {
+        // The integer argument of the numeric log message is aggregated;
+        // the string log message only has one
+        bool numeric = (corpus.kind != STRINGS);
+        corpus.aggregatedLogId = numeric ? NUMERIC_LOG_ID : STRING_LOG_ID;
+        corpus.aggregatedArgIndex = numeric ? 1 : 3;
+
+        generateCorpus(options, corpus);
+
+        size_t firstRun = runs.size();
+        runBenchmark(options, corpus, devNull, runs);
+        for (size_t i = firstRun; i < runs.size(); ++i)
+            printRun(runs[i]);
+    }
+
+    fclose(devNull);
+    std::remove(options.logFile);
+
+    if (options.jsonFile)
+        writeJson(options.jsonFile, options, corpora, runs);
+
+    return 0;
+}
@@ -0,0 +1,576 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * This file implements a continuous-load benchmark for NanoLog. Unlike
+ * ../Benchmark.cc, which reports the average cost of a log statement in a
+ * tight loop, it logs at a fixed rate per producer thread (open loop) for a
+ * sustained period and records the latency of every NANO_LOG invocation in
+ * a histogram to report its distribution. The run is repeated for 1 to N
+ * producer threads and the results are printed as a table and optionally
+ * written as JSON to be compared across commits (see ../compareLoadBench.py).
+ *
+ * Two latencies are reported for each run:
+ *   - service: the time spent in NANO_LOG, from invocation to return.
+ *   - response: the time from when the message was scheduled to be logged
+ *     until NANO_LOG returned. When a producer falls behind its schedule
+ *     (i.e. it was blocked on a full StagingBuffer), the messages it logs to
+ *     catch up include the delay, which avoids coordinated omission.
+ */
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "Cycles.h"
+#include "Log.h"
+
+#ifdef PREPROCESSOR_NANOLOG
+#include "NanoLog.h"
+#else
+#include "NanoLogCpp17.h"
+#endif
+
+using namespace NanoLog::LogLevels;
+using PerfUtils::Cycles;
+
+// Number of bytes each benchmark log message occupies in the StagingBuffer:
+// the entry header followed by an int and a uint64_t argument.
+static const size_t MESSAGE_BYTES = sizeof(NanoLogInternal::Log::UncompressedEntry)
+                                        + sizeof(int) + sizeof(uint64_t);
+
+/**
+ * Log-linear histogram of latencies in cycles. Each power of two range is
+ * divided into 2^SUB_BUCKET_BITS equally sized buckets, so percentiles are
+ * reported with a relative error of at most 2^-SUB_BUCKET_BITS while
+ * recording a value costs a few instructions and the memory is bounded.
+ */
+class LatencyHistogram {
+  public:
+    LatencyHistogram()
+        : counts(size_t(NUM_BUCKETS), 0)
+        , count(0)
+        , sum(0)
+        , max(0)
+    {
+    }
+
+    /**
+     * Records one latency
+     *
+     * \param cycles
+     *      Latency in cycles
+     */
+    inline void
+    record(uint64_t cycles)
+    {
+        ++counts[getIndex(cycles)];
+        ++count;
+        sum += cycles;
+        max = std::max(max, cycles);
+    }
+
+    /**
+     * Adds the latencies recorded in another histogram to this one
+     */
+    void
+    merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] += other.counts[i];
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    /**
+     * Returns the latency (in cycles) that the given fraction of the
+     * recorded latencies are less than or equal to; the upper bound of the
+     * bucket the percentile falls into.
+     *
+     * \param fraction
+     *      Percentile as a fraction (i.e. 0.999 for p99.9)
+     */
+    uint64_t
+    getPercentile(double fraction) const
+    {
+        uint64_t target = static_cast<uint64_t>(fraction*count + 0.5);
+        target = std::max<uint64_t>(1, std::min(target, count));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target)
+                return std::min(getUpperBound(i), max);
+        }
+        return max;
+    }
+
+    // Number of buckets each power of two range is divided into, as a power
+    // of two
+    static const int SUB_BUCKET_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1UL << SUB_BUCKET_BITS;
+    static const size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1)*SUB_BUCKETS;
+
+    /**
+     * Returns the index of the bucket that a latency is counted in. Values
+     * below SUB_BUCKETS have a bucket each.
+     */
+    static inline size_t
+    getIndex(uint64_t cycles)
+    {
+        if (cycles < SUB_BUCKETS)
+            return cycles;
+
+        int shift = 63 - __builtin_clzll(cycles) - SUB_BUCKET_BITS;
+        return (shift + 1)*SUB_BUCKETS + ((cycles >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    /**
+     * Returns the largest latency that's counted in a bucket
+     */
+    static uint64_t
+    getUpperBound(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+
+        int shift = static_cast<int>(index/SUB_BUCKETS) - 1;
+        uint64_t lowerBound = (SUB_BUCKETS + index%SUB_BUCKETS) << shift;
+        return lowerBound + (1UL << shift) - 1;
+    }
+
+    // Number of latencies recorded per bucket
+    std::vector<uint64_t> counts;
+
+    // Number of latencies recorded
+    uint64_t count;
+
+    // Sum of the latencies recorded, in cycles
+    uint64_t sum;
+
+    // Largest latency recorded, in cycles
+    uint64_t max;
+};
+
+/**
+ * Parameters of the benchmark, set from the command line
+ */
+struct Options {
+    // Largest number of producer threads to run with; the benchmark runs
+    // with powers of two up to it and then with this number of threads
+    int maxThreads = 1;
+
+    // Number of log messages each producer thread logs per second; 0 logs
+    // as fast as possible (closed loop)
+    double ratePerThread = 1e6;
+
+    // Duration of the run for each number of producer threads in seconds
+    double seconds = 10;
+
+    // Size of the producers' StagingBuffers in bytes
+    size_t stagingBufferSize = NanoLogConfig::STAGING_BUFFER_SIZE;
+
+    // Size of the output buffers in bytes. It defaults to a lot less than
+    // the library's default so that a sustained run cycles through them.
+    size_t outputBufferSize = 1 << 22;
+
+    // Log file to output to
+    const char *logFile = "/tmp/logFile";
+
+    // File to write the results to as JSON; none if nullptr
+    const char *jsonFile = nullptr;
+
+    // Free-form label for the results (i.e. the git commit)
+    const char *label = "";
+};
+
+/**
+ * Measurements of one producer thread
+ */
+struct ProducerResult {
+    // Latencies of the NANO_LOG invocations (see top of file)
+    LatencyHistogram service;
+    LatencyHistogram response;
+
+    // Number of log messages logged
+    uint64_t messages = 0;
+
+    // rdtsc() at which the producer started and stopped logging
+    uint64_t startCycles = 0;
+    uint64_t stopCycles = 0;
+};
+
+/**
+ * Measurements of a run of the benchmark with a number of producer threads
+ */
+struct RunResult {
+    int threads;
+    LatencyHistogram service;
+    LatencyHistogram response;
+    uint64_t messages;
+    double seconds;
+
+    // Minimum number of log messages logged by a producer thread
+    uint64_t minMessagesPerThread;
+
+    // Number of bytes the compressed log grew by
+    uint64_t outputBytes;
+};
+
+/**
+ * Logs at a fixed rate for the duration of the run and records the latency
+ * of every log message.
+ *
+ * \param id
+ *      Identifies the producer thread within the run
+ * \param options
+ *      Parameters of the benchmark
+ * \param barrier
+ *      Barrier to start all the producer threads at the same time
+ * \param[out] result
+ *      Measurements of the producer
+ */
+static void
+runProducer(int id, const Options &options, pthread_barrier_t *barrier,
+            ProducerResult *result)
+{
+    double cyclesPerMessage = 0;
+    if (options.ratePerThread > 0)
+        cyclesPerMessage = Cycles::perSecond()/options.ratePerThread;
+
+    NanoLog::preallocate();
+    pthread_barrier_wait(barrier);
+
+    uint64_t start = Cycles::rdtsc();
+    uint64_t stop = start + Cycles::fromSeconds(options.seconds);
+    uint64_t messages = 0;
+    while (true) {
+        uint64_t scheduled = start +
+                static_cast<uint64_t>(static_cast<double>(messages)*
+                                      cyclesPerMessage);
+        uint64_t before = Cycles::rdtsc();
+        if (std::max(before, scheduled) >= stop)
+            break;
+
+        while (before < scheduled)
+            before = Cycles::rdtsc();
+        if (cyclesPerMessage == 0)
+            scheduled = before;
+
+        NANO_LOG(NOTICE, "Load benchmark producer %d at %lu", id, before);
+        uint64_t after = Cycles::rdtsc();
+
+        result->service.record(after - before);
+        result->response.record(after - scheduled);
+        ++messages;
+    }
+
+    result->messages = messages;
+    result->startCycles = start;
+    result->stopCycles = Cycles::rdtsc();
+}
+
+/**
+ * Returns the size of a file in bytes, or 0 if it doesn't exist
+ */
+static uint64_t
+getFileSize(const char *filename)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return 0;
+    return static_cast<uint64_t>(st.st_size);
+}
+
+/**
+ * Runs the benchmark with a number of producer threads and waits for their
+ * log messages to be output.
+ *
+ * \param options
+ *      Parameters of the benchmark
+ * \param threads
+ *      Number of producer threads
+ */
+static RunResult
+runBenchmark(const Options &options, int threads)
+{
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, threads)) {
+        fprintf(stderr, "Unable to initialize the pthread barrier\r\n");
+        exit(1);
+    }
+
+    uint64_t outputBytesBefore = getFileSize(options.logFile);
+    std::vector<ProducerResult> producers(threads);
+    std::vector<std::thread> producerThreads;
+    for (int i = 1; i < threads; ++i)
+        producerThreads.emplace_back(runProducer, i, std::cref(options),
+                                     &barrier, &producers[i]);
+    runProducer(0, options, &barrier, &producers[0]);
+    for (std::thread &thread : producerThreads)
+        thread.join();
+    pthread_barrier_destroy(&barrier);
+
+    NanoLog::sync();
+
+    RunResult run;
+    run.threads = threads;
+    run.messages = 0;
+    run.minMessagesPerThread = UINT64_MAX;
+    uint64_t start = UINT64_MAX;
+    uint64_t stop = 0;
+    for (ProducerResult &producer : producers) {
+        run.service.merge(producer.service);
+        run.response.merge(producer.response);
+        run.messages += producer.messages;
+        run.minMessagesPerThread = std::min(run.minMessagesPerThread,
+                                            producer.messages);
+        start = std::min(start, producer.startCycles);
+        stop = std::max(stop, producer.stopCycles);
+    }
+    run.seconds = Cycles::toSeconds(stop - start);
+    run.outputBytes = getFileSize(options.logFile) - outputBytesBefore;
+    return run;
+}
+
+/**
+ * Returns the cost of reading the cycle counter in nanoseconds, which is
+ * included in the latencies measured.
+ */
+static double
+getTimerOverheadNs()
+{
+    uint64_t minCycles = UINT64_MAX;
+    for (int i = 0; i < 10000; ++i) {
+        uint64_t start = Cycles::rdtsc();
+        uint64_t stop = Cycles::rdtsc();
+        minCycles = std::min(minCycles, stop - start);
+    }
+    return Cycles::toSeconds(minCycles)*1e9;
+}
+
+/**
+ * Converts a latency in cycles to nanoseconds
+ */
+static double
+toNs(uint64_t cycles)
+{
+    return Cycles::toSeconds(cycles)*1e9;
+}
+
+/**
+ * Prints the results of a run as a row of the results table
+ */
+static void
+printRun(const RunResult &run)
+{
+    const LatencyHistogram &r = run.response;
+    printf("%8d %12.0lf %10.0lf %10.0lf %10.0lf %10.0lf %10.0lf %10.0lf\r\n",
+            run.threads,
+            static_cast<double>(run.messages)/run.seconds,
+            toNs(run.service.getPercentile(0.5)),
+            toNs(run.service.getPercentile(0.99)),
+            toNs(r.getPercentile(0.5)),
+            toNs(r.getPercentile(0.99)),
+            toNs(r.getPercentile(0.999)),
+            toNs(r.max));
+}
+
+/**
+ * Writes the latency distribution of a histogram as a JSON object
+ */
+static void
+writeLatencies(FILE *out, const char *name, const LatencyHistogram &h)
+{
+    fprintf(out, "      \"%s\": {\"meanNs\": %.1lf, \"p50Ns\": %.1lf, "
+                 "\"p99Ns\": %.1lf, \"p999Ns\": %.1lf, \"maxNs\": %.1lf}",
+            name,
+            h.count ? toNs(h.sum)/static_cast<double>(h.count) : 0.0,
+            toNs(h.getPercentile(0.5)),
+            toNs(h.getPercentile(0.99)),
+            toNs(h.getPercentile(0.999)),
+            toNs(h.max));
+}
+
+/**
+ * Writes the parameters and results of the benchmark as JSON
+ *
+ * \param filename
+ *      File to write to
+ * \param options
+ *      Parameters of the benchmark
+ * \param runs
+ *      Results of the runs
+ */
+static void
+writeJson(const char *filename, const Options &options,
+          const std::vector<RunResult> &runs)
+{
+    FILE *out = fopen(filename, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Unable to open '%s' to write the results to: %s\r\n",
+                filename, strerror(errno));
+        exit(1);
+    }
+
+#ifdef PREPROCESSOR_NANOLOG
+    const char *system = "PreProc";
+#else
+    const char *system = "C++17";
+#endif
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"load\",\n");
+    fprintf(out, "  \"label\": \"%s\",\n", options.label);
+    fprintf(out, "  \"system\": \"%s\",\n", system);
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"ratePerThread\": %.0lf,\n", options.ratePerThread);
+    fprintf(out, "    \"seconds\": %.3lf,\n", options.seconds);
+    fprintf(out, "    \"stagingBufferSize\": %lu,\n", options.stagingBufferSize);
+    fprintf(out, "    \"outputBufferSize\": %lu,\n", options.outputBufferSize);
+    fprintf(out, "    \"messageBytes\": %lu,\n", MESSAGE_BYTES);
+    fprintf(out, "    \"cyclesPerSecond\": %.0lf,\n", Cycles::perSecond());
+    fprintf(out, "    \"timerOverheadNs\": %.1lf\n", getTimerOverheadNs());
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"runs\": [\n");
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const RunResult &run = runs[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"threads\": %d,\n", run.threads);
+        fprintf(out, "      \"messages\": %lu,\n", run.messages);
+        fprintf(out, "      \"seconds\": %.3lf,\n", run.seconds);
+        fprintf(out, "      \"messagesPerSecond\": %.0lf,\n",
+                static_cast<double>(run.messages)/run.seconds);
+        fprintf(out, "      \"stagingBufferWraps\": %lu,\n",
+                run.minMessagesPerThread*MESSAGE_BYTES/
+                                                options.stagingBufferSize);
+        fprintf(out, "      \"outputBytes\": %lu,\n", run.outputBytes);
+        fprintf(out, "      \"outputBufferFills\": %lu,\n",
+                run.outputBytes/options.outputBufferSize);
+        writeLatencies(out, "service", run.service);
+        fprintf(out, ",\n");
+        writeLatencies(out, "response", run.response);
+        fprintf(out, "\n    }%s\n", (i + 1 < runs.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+static void
+printHelp(const char *exe)
+{
+    printf("Logs at a fixed rate from 1 to N threads and reports the latency "
+           "distribution of NANO_LOG.\r\n\r\n");
+    printf("Usage:\r\n");
+    printf("\t%s [options]\r\n\r\n", exe);
+    printf("Options:\r\n");
+    printf("\t--threads <N>             Largest number of producer threads "
+           "(default 1)\r\n");
+    printf("\t--rate <msgs/s>           Log messages per second per thread; "
+           "0 for as fast as possible (default 1000000)\r\n");
+    printf("\t--seconds <s>             Duration of each run (default 10)\r\n");
+    printf("\t--stagingBufferSize <B>   StagingBuffer size (default %u)\r\n",
+           NanoLogConfig::STAGING_BUFFER_SIZE);
+    printf("\t--outputBufferSize <B>    Output buffer size (default %u)\r\n",
+           1 << 22);
+    printf("\t--logFile <file>          Log file (default /tmp/logFile)\r\n");
+    printf("\t--json <file>             Writes the results as JSON\r\n");
+    printf("\t--label <label>           Label for the JSON results\r\n");
+}
+
+int
+main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printHelp(argv[0]);
+            exit(1);
+        }
+
+        const char *option = argv[i];
+        const char *value = argv[i + 1];
+        if (strcmp(option, "--threads") == 0) {
+            options.maxThreads = atoi(value);
+        } else if (strcmp(option, "--rate") == 0) {
+            options.ratePerThread = atof(value);
+        } else if (strcmp(option, "--seconds") == 0) {
+            options.seconds = atof(value);
+        } else if (strcmp(option, "--stagingBufferSize") == 0) {
+            options.stagingBufferSize = strtoul(value, NULL, 0);
+        } else if (strcmp(option, "--outputBufferSize") == 0) {
+            options.outputBufferSize = strtoul(value, NULL, 0);
+        } else if (strcmp(option, "--logFile") == 0) {
+            options.logFile = value;
+        } else if (strcmp(option, "--json") == 0) {
+            options.jsonFile = value;
+        } else if (strcmp(option, "--label") == 0) {
+            options.label = value;
+        } else {
+            printHelp(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (options.maxThreads < 1 || options.ratePerThread < 0 ||
+            options.seconds <= 0) {
+        printHelp(argv[0]);
+        exit(1);
+    }
+
+    NanoLog::setLogFile(options.logFile);
+    NanoLog::setOutputBufferSize(options.outputBufferSize);
+    NanoLog::setStagingBufferSize(options.stagingBufferSize);
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < options.maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(options.maxThreads);
+
+    printf("# Latencies in ns; service is the time spent in NANO_LOG and "
+           "response is measured from when the message was scheduled\r\n");
+    printf("# %6s %12s %10s %10s %10s %10s %10s %10s\r\n",
+            "Threads", "Msgs/s", "Svc p50", "Svc p99",
+            "Resp p50", "Resp p99", "Resp p99.9", "Resp max");
+
+    std::vector<RunResult> runs;
+    for (int threads : threadCounts) {
+        runs.push_back(runBenchmark(options, threads));
+        printRun(runs.back());
+
+        if (runs.back().minMessagesPerThread*MESSAGE_BYTES <
+                options.stagingBufferSize ||
+                runs.back().outputBytes < options.outputBufferSize) {
+            printf("# Note: the run was too short to cycle through the "
+                   "StagingBuffers and output buffers\r\n");
+        }
+    }
+
+    if (options.jsonFile)
+        writeJson(options.jsonFile, options, runs);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#! /bin/bash -e
+
+#####
+# Decoder benchmark. Runs decoder/decoderBenchmark, which generates synthetic
+# numeric, string-heavy and many-thread log files and reports the throughput,
+# heap allocations and peak memory of decompressTo(), decompressUnordered(),
+# getNextLogStatement() and the aggregation of getNextArgumentBatch(). The
+# results are stored as JSON in a subdirectory of results/, labeled with the
+# git commit, so that they can be compared across commits with
+# compareDecoderBench.py.
+#
+# Any options after the test name are passed to decoderBenchmark (see
+# decoder/decoderBenchmark --help), i.e.
+#     ./run_decoderBench.sh large --messages 20000000 --decodeThreads 8
+#####
+
+if [ $# -eq 0 ]
+  then
+    echo "Usage $0 <testname> [decoderBenchmark options]"
+    exit 1
+fi
+
+TEST_NAME="$1"
+shift
+TEST_DIR="results/$(date +%Y%m%d%H%M%S)_${TEST_NAME}"
+LABEL="$(git describe --always --dirty)"
+
+mkdir -p $TEST_DIR
+cp ${0} ${TEST_DIR}
+
+make -C decoder clean-all    > /dev/null
+make -C decoder clean        > /dev/null
+make -C decoder -j10         > /dev/null
+
+./decoder/decoderBenchmark --json "${TEST_DIR}/${TEST_NAME}.json" \
+    --label "$LABEL" "$@" | tee "${TEST_DIR}/${TEST_NAME}.log"
+
+echo "# Results are in ${TEST_DIR}"
@@ -0,0 +1,47 @@
+#! /bin/bash -e
+
+#####
+# Continuous-load benchmark for the Preprocessor and C++17 versions of
+# NanoLog. Each runs load/loadBenchmark, which logs at a fixed rate from 1 to
+# N threads and reports the latency percentiles of NANO_LOG. The results are
+# stored as JSON in a subdirectory of results/, labeled with the git commit,
+# so that they can be compared across commits with compareLoadBench.py.
+#
+# Any options after the test name are passed to loadBenchmark (see
+# load/loadBenchmark --help), i.e.
+#     ./run_loadBench.sh 4threads --threads 4 --rate 500000 --seconds 30
+#####
+
+if [ $# -eq 0 ]
+  then
+    echo "Usage $0 <testname> [loadBenchmark options]"
+    exit 1
+fi
+
+TEST_NAME="$1"
+shift
+TEST_DIR="results/$(date +%Y%m%d%H%M%S)_${TEST_NAME}"
+LABEL="$(git describe --always --dirty)"
+
+declare -a MAKE_OPTIONS=(
+                "PREPROCESSOR_NANOLOG=yes"
+                "PREPROCESSOR_NANOLOG=no"
+                )
+
+mkdir -p $TEST_DIR
+cp ${0} ${TEST_DIR}
+
+for MAKE_OPTION in "${MAKE_OPTIONS[@]}"
+do
+    echo "# Make Option: ${MAKE_OPTION}"
+    make -C load $MAKE_OPTION clean-all    > /dev/null
+    make -C load $MAKE_OPTION clean        > /dev/null
+    make -C load $MAKE_OPTION -j10         > /dev/null
+
+    JSON_FILE="${TEST_DIR}/${TEST_NAME}_${MAKE_OPTION##*=}.json"
+    rm -f /tmp/logFile
+    ./load/loadBenchmark --json $JSON_FILE --label "$LABEL" "$@" \
+        | tee "${TEST_DIR}/${TEST_NAME}_${MAKE_OPTION##*=}.log"
+done
+
+echo "# Results are in ${TEST_DIR}"
@@ -1,7 +1,7 @@
 #! /bin/bash -e
 
 function runCommonTests() {
-  rm -f ./testLog
+  rm -f ./testLog ./testLog.idx
   ./testApp > /dev/null
   chmod 666 ./testLog
 
@@ -16,6 +16,26 @@ function runCommonTests() {
   diff -w expected/regularRun.txt output.txt
   printf " OK!\r\n"
 
+  # Run the decompressor over a time range spanning the entire log (via the index)
+  printf "Checking time ranged decompression..."
+  ./decompressor decompress ./testLog --from "2000-01-01 00:00:00" --to "2100-01-01 00:00:00" | cut -d':' -f5- > ranged_output.txt
+  diff -w expected/regularRun.txt ranged_output.txt
+  printf " OK!\r\n"
+
+  # Run the decompressor filtering by log level (via the index)
+  printf "Checking filtered decompression..."
+  ./decompressor decompress ./testLog | grep -E " (ERROR|WARNING)\[" > filtered_expected.txt
+  ./decompressor decompress ./testLog --level WARNING | grep -E "^[0-9]{4}-" > filtered_output.txt
+  diff -w filtered_expected.txt filtered_output.txt
+  printf " OK!\r\n"
+
+  # Export the log as columns and check that every log message made it
+  printf "Checking columnar export..."
+  ./decompressor decompressUnordered ./testLog | grep "Decompression Complete" | sed -E 's/.* printing ([0-9]+) log.*/\1/' > export_expected.txt
+  ./decompressor export ./testLog ./testLog.cols | sed -E 's/# Exported ([0-9]+) log.*/\1/' > export_output.txt
+  diff -w export_expected.txt export_output.txt
+  printf " OK!\r\n"
+
   # Run the unordered decompressor without embedded functions and cut the timestamps before the ':'
   printf "Checking unordered decompression..."
   ./basic_decompressor decompressUnordered ./testLog | cut -d':' -f5- > basic_unordered.txt
@@ -46,7 +66,7 @@ function runCommonTests() {
   printf " OK!\r\n"
 
   # clean up
-  rm -f ./testLog basic_output.txt output.txt appended_output.txt dictionary_lookup.txt basic_unordered.txt expected.txt emptyFile
+  rm -f ./testLog ./testLog.idx ranged_output.txt filtered_expected.txt filtered_output.txt ./testLog.cols export_expected.txt export_output.txt basic_output.txt output.txt appended_output.txt dictionary_lookup.txt basic_unordered.txt expected.txt emptyFile
 }
 
 ## Actual Test Runner
@@ -17,6 +17,7 @@
 # routines for log messages using the NanoLog system.
 
 import errno
+import filecmp
 import json
 import os.path
 import re
@@ -124,22 +125,15 @@ class FunctionGenerator(object):
     # \param filename
     #           file to persist the state to
     def outputMappingFile(self, filename):
-        dirname = os.path.dirname(filename)
-        if dirname and not os.path.exists(dirname):
-            try:
-                os.makedirs(dirname)
-            except OSError as exc:
-                if exc.errno != errno.EEXIST:
-                    raise
-
-        with open(filename, 'w') as json_file:
-            outputJSON = {
-                "argLists2Cnt":self.argLists2Cnt,
-                "logId2Code":self.logId2Code
-            }
+        makeDirectories(os.path.dirname(filename))
+        outputJSON = {
+            "argLists2Cnt":self.argLists2Cnt,
+            "logId2Code":self.logId2Code
+        }
 
-            json_file.write(json.dumps(outputJSON, sort_keys=True,
-                                            indent=4, separators=(',', ': ')))
+        writeFileIfChanged(filename, json.dumps(outputJSON, sort_keys=True,
+                                                indent=4,
+                                                separators=(',', ': ')))
 
     # Output the C++ header needed by the runtime library to perform the log
     # compression and decompression routines. The file shall contain the
@@ -150,21 +144,28 @@ class FunctionGenerator(object):
     #       - The supporting compression/decompression functions
     #       - The record function that should have been injected (for debugging)
     #
-    # \param filename
+    # The file is only replaced if its contents change, so that the C++ file
+    # isn't recompiled when the log statements stay the same.
+    #
+    # \param outputFileName
     #               The C++ file to emit
+    # \param inputFiles
+    #               The map files to aggregate (see outputMappingFile())
+    # \param mergeCacheFile
+    #               Optional cache of the map files' contents from the last
+    #               invocation (see mergeMappingFiles())
     @staticmethod
-    def outputCompilationFiles(outputFileName="BufferStuffer.h", inputFiles=[]):
+    def outputCompilationFiles(outputFileName="BufferStuffer.h", inputFiles=[],
+                               mergeCacheFile=None):
         # Merge all the intermediate compilations
-        mergedCode = {}
-        for filename in inputFiles:
-            with open(filename, 'r') as iFile:
-                loaded_json = json.load(iFile)
-                mergedCode.update(loaded_json["logId2Code"])
+        mergedCode = FunctionGenerator.mergeMappingFiles(inputFiles,
+                                                         mergeCacheFile)
 
         # Output the C++ code. It may be a bit hard to read admist the static
         # C++ code, but all the code immediately before/after a triple quote
         # sections are in the same indention.
-        with open(outputFileName, 'w') as oFile:
+        tmpFileName = getTemporaryFileName(outputFileName)
+        with open(tmpFileName, 'w') as oFile:
             oFile.write("""
 #ifndef BUFFER_STUFFER
 #define BUFFER_STUFFER
@@ -294,6 +295,54 @@ size_t numLogIds = {count};
            namespace=GENERATED_CODE_NAMESPACE
 ))
 
+        replaceFileIfChanged(tmpFileName, outputFileName)
+
+    # Merge the logId2Code mappings of the map files output by
+    # outputMappingFile(). With a merge cache, only the map files that changed
+    # since the last merge (by size and modification time) are read again;
+    # the mappings of the others are taken from the cache, which is a single
+    # file rather than one per compilation unit.
+    #
+    # \param inputFiles
+    #               The map files to merge
+    # \param mergeCacheFile
+    #               File caching the mappings between invocations; it's
+    #               created if it doesn't exist. None disables the cache.
+    #
+    # \return
+    #               The merged logId2Code mappings
+    @staticmethod
+    def mergeMappingFiles(inputFiles, mergeCacheFile=None):
+        cache = {}
+        if mergeCacheFile:
+            try:
+                with open(mergeCacheFile, 'r') as cFile:
+                    cache = json.load(cFile)
+            except (IOError, ValueError):
+                cache = {}
+
+        fragments = {}
+        mergedCode = {}
+        for filename in inputFiles:
+            fileStat = os.stat(filename)
+            stamp = [fileStat.st_size, fileStat.st_mtime]
+
+            fragment = cache.get(filename)
+            if fragment is None or fragment["stamp"] != stamp:
+                with open(filename, 'r') as iFile:
+                    fragment = {
+                        "stamp":stamp,
+                        "logId2Code":json.load(iFile)["logId2Code"]
+                    }
+
+            fragments[filename] = fragment
+            mergedCode.update(fragment["logId2Code"])
+
+        if mergeCacheFile and fragments != cache:
+            writeFileIfChanged(mergeCacheFile, json.dumps(fragments))
+
+        return mergedCode
+
     # Given a compilation unit via filename, return all the record functions
     # that were generated for that file.
     #
@@ -462,7 +511,7 @@ size_t numLogIds = {count};
 inline {function_declaration} {{
     extern const uint32_t {idVariableName};
 
-    if (level > {getLogLevelFn}())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > {getLogLevelFn}())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -516,11 +565,9 @@ inline {function_declaration} {{
 
         packNonStringArgsCode = ""
         for i, idx in enumerate(nonStringArgsIdx):
-            mem = "first" if (i % 2 == 0) else "second"
-            arrIndex = i / 2
             packNonStringArgsCode += \
-                "\tnib[%d].%s = 0x0f & static_cast<uint8_t>(%s(&out, arg%d));\n" \
-                    % (arrIndex, mem, PACK_FN, idx)
+                "\tBufferUtils::setNibble(nib, %d, %s(&out, arg%d));\n" \
+                    % (i, PACK_FN, idx)
 
         compressFnName = "compressArgs" + logId
         compressionCode = \
@@ -896,3 +943,58 @@ def generateLogIdStr(fmtString, filename, linenum):
         return "".join([c if c.isalnum() else str(ord(c)) for c in string])
 
     return "__%s__%s__%d__" % (encode(fmtString), encode(filename), linenum)
+
+# Create a directory and its parents unless it already exists
+#
+# \param dirname
+#           Directory to create; the empty string denotes the current one
+def makeDirectories(dirname):
+    if dirname and not os.path.exists(dirname):
+        try:
+            os.makedirs(dirname)
+        except OSError as exc:
+            if exc.errno != errno.EEXIST:
+                raise
+
+# Returns a name for a temporary file next to filename, which is unique to
+# the process so that concurrent invocations (i.e. make -j) don't collide.
+def getTemporaryFileName(filename):
+    return "%s.%d.tmp" % (filename, os.getpid())
+
+# Replace a file with a temporary file unless they have the same contents,
+# in which case the temporary file is removed instead. This leaves the
+# modification time of the file, and thus anything make rebuilds from it,
+# untouched when it wouldn't change. The replacement is atomic.
+#
+# \param tmpFileName
+#           File with the new contents
+# \param fileName
+#           File to replace
+#
+# \return
+#           True if the file was replaced
+def replaceFileIfChanged(tmpFileName, fileName):
+    if os.path.isfile(fileName) and filecmp.cmp(tmpFileName, fileName,
+                                                shallow=False):
+        os.remove(tmpFileName)
+        return False
+
+    os.rename(tmpFileName, fileName)
+    return True
+
+# Write a string to a file unless the file already contains it; see
+# replaceFileIfChanged().
+#
+# \param fileName
+#           File to write
+# \param contents
+#           String to write to the file
+#
+# \return
+#           True if the file was written
+def writeFileIfChanged(fileName, contents):
+    tmpFileName = getTemporaryFileName(fileName)
+    with open(tmpFileName, 'w') as tmpFile:
+        tmpFile.write(contents)
+
+    return replaceFileIfChanged(tmpFileName, fileName)
@@ -15,6 +15,7 @@
 import filecmp
 import unittest
 import os
+import shutil
 from parser import *
 
 from FunctionGenerator import *
@@ -261,6 +262,35 @@ class PreprocesorTestCase(unittest.TestCase):
         os.remove("testi")
         os.remove("test.map")
 
+    def test_processFileCached(self):
+        src = """main() {}"""
+
+        with open("test", "w") as testFile:
+            testFile.write(src)
+
+        shutil.rmtree("testCache", ignore_errors=True)
+        self.assertFalse(processFileCached("test", "test.map", "testCache"))
+        with open("test.map", 'r') as mapFile:
+            mapContents = mapFile.read()
+        os.remove("testi")
+        os.remove("test.map")
+
+        self.assertTrue(processFileCached("test", "test.map", "testCache"))
+        with open("testi", 'r') as iFile:
+            self.assertEqual(src, iFile.read())
+        with open("test.map", 'r') as mapFile:
+            self.assertEqual(mapContents, mapFile.read())
+
+        # Changing the source invalidates its entry
+        with open("test", "w") as testFile:
+            testFile.write(src + "\n")
+        self.assertFalse(processFileCached("test", "test.map", "testCache"))
+
+        os.remove("test")
+        os.remove("testi")
+        os.remove("test.map")
+        shutil.rmtree("testCache")
+
     ###### NOTE #######
     # parser.py:processFile is left for an integration test since it an entire
     # C++ source file and outputs generated code.
@@ -551,7 +581,7 @@ class FunctionGeneratorTestCase(unittest.TestCase):
 inline void __syang0__fl{logId}(NanoLog::LogLevel level, const char* fmtStr ) {{
     extern const uint32_t __fmtId{logId};
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -674,6 +704,58 @@ inline void __syang0__fl{logId}(NanoLog::LogLevel level, const char* fmtStr ) {{
         os.remove("map2.map")
         os.remove("test.h")
 
+    def test_mergeMappingFiles(self):
+        fg = FunctionGenerator()
+        fg.generateLogFunctions("DEBUG", "A", "mar.cc", "mar.cc", 293)
+        fg.outputMappingFile("map1.map")
+
+        fg2 = FunctionGenerator()
+        fg2.generateLogFunctions("DEBUG", "E", "del.cc", "del.cc", 199)
+        fg2.outputMappingFile("map2.map")
+
+        merged = FunctionGenerator.mergeMappingFiles(["map1.map", "map2.map"],
+                                                     "test.cache")
+        expected = dict(fg.logId2Code)
+        expected.update(fg2.logId2Code)
+        self.assertEqual(expected, merged)
+
+        # Unchanged map files are taken from the cache
+        with open("test.cache", 'r') as cFile:
+            cache = json.load(cFile)
+        cache["map1.map"]["logId2Code"] = {}
+        with open("test.cache", 'w') as cFile:
+            json.dump(cache, cFile)
+
+        merged = FunctionGenerator.mergeMappingFiles(["map1.map", "map2.map"],
+                                                     "test.cache")
+        self.assertEqual(fg2.logId2Code, merged)
+
+        # Changed ones are read again
+        fg2.generateLogFunctions("DEBUG", "F", "del.cc", "del.cc", 200)
+        fg2.outputMappingFile("map2.map")
+        merged = FunctionGenerator.mergeMappingFiles(["map2.map"],
+                                                     "test.cache")
+        self.assertEqual(fg2.logId2Code, merged)
+
+        os.remove("map1.map")
+        os.remove("map2.map")
+        os.remove("test.cache")
+
+    def test_writeFileIfChanged(self):
+        self.assertTrue(writeFileIfChanged("test.txt", "abc"))
+        os.utime("test.txt", (0, 0))
+
+        self.assertFalse(writeFileIfChanged("test.txt", "abc"))
+        self.assertEqual(0, os.stat("test.txt").st_mtime)
+
+        self.assertTrue(writeFileIfChanged("test.txt", "abcd"))
+        with open("test.txt", 'r') as f:
+            self.assertEqual("abcd", f.read())
+
+        self.assertEqual(["test.txt"],
+                         [f for f in os.listdir(".") if f.startswith("test.")])
+        os.remove("test.txt")
+
     def test_isStringType(self):
         self.assertTrue(isStringType("char*"))
         self.assertTrue(isStringType("wchar_t*"))
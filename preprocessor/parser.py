@@ -35,9 +35,20 @@ per compiled user source) should be passed into this script in combinedOutput
 mode. This will aggregate all the log metadata in the map files and produce
 a supporting C++ header file used in the Runtime and Decompression components.
 
+The first stage can be sped up for incremental builds with a parse cache
+(--cacheDir), which stores the outputs for a preprocessed source keyed by a
+hash of its contents, so that sources whose preprocessed form didn't change
+aren't parsed again. Build systems that preprocess all sources up front can
+also process them in parallel in mapDir mode. The map files are only
+rewritten if they change, and the second stage can keep the contents of the
+map files in a merge cache (--mergeCache) to only read the ones that changed
+since its last invocation. Like the map files, the C++ file output by the
+second stage is only rewritten if it changes.
+
 Usage:
-    parser.py [-h] --mapOutput=MAP PREPROCESSED_SRC
-    parser.py [-h] --combinedOutput=HEADER [MAP_FILES...]
+    parser.py [-h] [--cacheDir=DIR] --mapOutput=MAP PREPROCESSED_SRC
+    parser.py [-h] [--cacheDir=DIR] [--jobs=N] --mapDir=DIR PREPROCESSED_SRCS...
+    parser.py [-h] [--mergeCache=FILE] --combinedOutput=HEADER [MAP_FILES...]
 
 Options:
   -h --help             Show this help messages
@@ -51,17 +62,37 @@ Options:
                         (ex test.i ->test.ii), will contain injected code,
                         and can be compiled directly with g++
 
+  --cacheDir=DIR        Directory of the parse cache; it can be shared between
+                        builds and deleted at any time
+
+  --mapDir=DIR          Directory to output the map files of multiple
+                        preprocessed sources to; the map file of a source is
+                        named after it with the ".i" extension replaced by
+                        ".map" (ex test.cc.i -> DIR/test.cc.map)
+
+  --jobs=N              Number of preprocessed sources to process in parallel
+                        in mapDir mode [default: 1]
+
+  PREPROCESSED_SRCS     GNU-preprocessed C/C++ files to process; see
+                        PREPROCESSED_SRC
+
   --combinedOutput=HEADER
                         Output destination for the final C++ header file that
                         aggregates all the map files for use with the
                         other NanoLog components [default:BufferStuffer.h]
 
+  --mergeCache=FILE     File to keep the contents of the map files in between
+                        invocations in combinedOutput mode
+
   MAP_FILES             List of map files to combine into the final header;
                         There should be one map file per preprocessed source
 """
 
 from docopt import docopt
 from collections import namedtuple
+import hashlib
+import multiprocessing
+import shutil
 import sys
 
 from FunctionGenerator import *
@@ -574,13 +605,129 @@ def processFile(inputFile, mapOutputFilename):
     output.close()
     functionGenerator.outputMappingFile(mapOutputFilename)
 
+# Returns the key of a preprocessed source in the parse cache, which is a hash
+# of its name, its contents and the sources of the preprocessor itself (so
+# that changes to the preprocessor invalidate the cache).
+#
+# \param inputFile
+#           g++ preprocessed C/C++ file
+def getParseCacheKey(inputFile):
+  sha = hashlib.sha1()
+  for filename in [__file__, sys.modules[FunctionGenerator.__module__].__file__]:
+    with open(os.path.splitext(filename)[0] + ".py", 'rb') as f:
+      sha.update(f.read())
+
+  sha.update(inputFile.encode('utf-8'))
+  with open(inputFile, 'rb') as f:
+    sha.update(f.read())
+
+  return sha.hexdigest()
+
+# Same as processFile(), except that the outputs are taken from the parse
+# cache if the preprocessed source was processed before, and are added to
+# it otherwise. Cache entries are added atomically so that concurrent
+# invocations can share a cache directory.
+#
+# \param inputFile
+#           g++ preprocessed C/C++ file to analyze
+# \param mapOutputFilename
+#           map file to output
+# \param cacheDir
+#           directory of the parse cache; None to disable it
+#
+# \return
+#           True if the outputs were taken from the parse cache
+def processFileCached(inputFile, mapOutputFilename, cacheDir):
+  if not cacheDir:
+    processFile(inputFile, mapOutputFilename)
+    return False
+
+  key = getParseCacheKey(inputFile)
+  entryDir = os.path.join(cacheDir, key[:2])
+  cachedSource = os.path.join(entryDir, key + ".ii")
+  cachedMap = os.path.join(entryDir, key + ".json")
+
+  if os.path.isfile(cachedSource) and os.path.isfile(cachedMap):
+    shutil.copyfile(cachedSource, inputFile + "i")
+
+    makeDirectories(os.path.dirname(mapOutputFilename))
+    tmpMapFilename = getTemporaryFileName(mapOutputFilename)
+    shutil.copyfile(cachedMap, tmpMapFilename)
+    replaceFileIfChanged(tmpMapFilename, mapOutputFilename)
+    return True
+
+  processFile(inputFile, mapOutputFilename)
+
+  makeDirectories(entryDir)
+  # The map is added last since it marks the entry as complete
+  for src, dst in [(inputFile + "i", cachedSource),
+                   (mapOutputFilename, cachedMap)]:
+    tmpFilename = getTemporaryFileName(dst)
+    shutil.copyfile(src, tmpFilename)
+    os.rename(tmpFilename, dst)
+
+  return False
+
+# Processes a preprocessed source in a worker process of mapDir mode
+#
+# \param args
+#           tuple of processFileCached() arguments
+#
+# \return
+#           exit status of processing the source
+def processFileWorker(args):
+  try:
+    processFileCached(*args)
+  except SystemExit as e:
+    return e.code
+  return 0
+
+# Processes multiple preprocessed sources in parallel (see processFile())
+#
+# \param inputFiles
+#           list of g++ preprocessed C/C++ files to analyze
+# \param mapDir
+#           directory to output the map files to
+# \param cacheDir
+#           directory of the parse cache; None to disable it
+# \param jobs
+#           number of worker processes
+#
+# \return
+#           0 if all the sources were processed successfully, nonzero otherwise
+def processFiles(inputFiles, mapDir, cacheDir=None, jobs=1):
+  work = []
+  for inputFile in inputFiles:
+    name = inputFile[:-2] if inputFile.endswith(".i") else inputFile
+    mapFilename = os.path.join(mapDir, name.lstrip(os.sep) + ".map")
+    work.append((inputFile, mapFilename, cacheDir))
+
+  if jobs <= 1:
+    results = [processFileWorker(args) for args in work]
+  else:
+    pool = multiprocessing.Pool(jobs)
+    try:
+      results = pool.map(processFileWorker, work)
+    finally:
+      pool.close()
+      pool.join()
+
+  return 1 if any(results) else 0
+
 if __name__ == "__main__":
   arguments = docopt(__doc__, version='NanoLog Preprocesor v1.0')
 
   if arguments['--mapOutput']:
-    processFile(inputFile=arguments['PREPROCESSED_SRC'],
-                mapOutputFilename=arguments['--mapOutput'])
+    processFileCached(inputFile=arguments['PREPROCESSED_SRC'],
+                      mapOutputFilename=arguments['--mapOutput'],
+                      cacheDir=arguments['--cacheDir'])
+  elif arguments['--mapDir']:
+    sys.exit(processFiles(inputFiles=arguments['PREPROCESSED_SRCS'],
+                          mapDir=arguments['--mapDir'],
+                          cacheDir=arguments['--cacheDir'],
+                          jobs=int(arguments['--jobs'])))
   else:
     FunctionGenerator.outputCompilationFiles(
                                   outputFileName=arguments['--combinedOutput'],
-                                  inputFiles=arguments['MAP_FILES'])
+                                  inputFiles=arguments['MAP_FILES'],
+                                  mergeCacheFile=arguments['--mergeCache'])
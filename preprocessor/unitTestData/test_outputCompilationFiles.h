@@ -34,7 +34,7 @@ using namespace NanoLog::LogLevels;
 inline void __syang0__fl__A__mar46cc__293__(NanoLog::LogLevel level, const char* fmtStr ) {
     extern const uint32_t __fmtId__A__mar46cc__293__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -119,7 +119,7 @@ decompressPrintArgs__A__mar46cc__293__ (const char **in,
 inline void __syang0__fl__A__mar46h__1__(NanoLog::LogLevel level, const char* fmtStr ) {
     extern const uint32_t __fmtId__A__mar46h__1__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -204,7 +204,7 @@ decompressPrintArgs__A__mar46h__1__ (const char **in,
 inline void __syang0__fl__B__mar46cc__294__(NanoLog::LogLevel level, const char* fmtStr ) {
     extern const uint32_t __fmtId__B__mar46cc__294__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -289,7 +289,7 @@ decompressPrintArgs__B__mar46cc__294__ (const char **in,
 inline void __syang0__fl__C__mar46cc__200__(NanoLog::LogLevel level, const char* fmtStr ) {
     extern const uint32_t __fmtId__C__mar46cc__200__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -374,7 +374,7 @@ decompressPrintArgs__C__mar46cc__200__ (const char **in,
 inline void __syang0__fl__D3237d__s46cc__100__(NanoLog::LogLevel level, const char* fmtStr , int arg0) {
     extern const uint32_t __fmtId__D3237d__s46cc__100__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -415,7 +415,7 @@ compressArgs__D3237d__s46cc__100__(NanoLogInternal::Log::UncompressedEntry *re,
 
 
     // Pack all the primitives
-    	nib[0].first = 0x0f & static_cast<uint8_t>(BufferUtils::pack(&out, arg0));
+    	BufferUtils::setNibble(nib, 0, BufferUtils::pack(&out, arg0));
 
 
     if (false) {
@@ -463,7 +463,7 @@ decompressPrintArgs__D3237d__s46cc__100__ (const char **in,
 inline void __syang0__fl__E32374s3237424642lf__s46cc__100__(NanoLog::LogLevel level, const char* fmtStr , const char* arg0, int arg1, int arg2, double arg3) {
     extern const uint32_t __fmtId__E32374s3237424642lf__s46cc__100__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -508,9 +508,9 @@ compressArgs__E32374s3237424642lf__s46cc__100__(NanoLogInternal::Log::Uncompress
 
 
     // Pack all the primitives
-    	nib[0].first = 0x0f & static_cast<uint8_t>(BufferUtils::pack(&out, arg1));
-	nib[0].second = 0x0f & static_cast<uint8_t>(BufferUtils::pack(&out, arg2));
-	nib[1].first = 0x0f & static_cast<uint8_t>(BufferUtils::pack(&out, arg3));
+    	BufferUtils::setNibble(nib, 0, BufferUtils::pack(&out, arg1));
+	BufferUtils::setNibble(nib, 1, BufferUtils::pack(&out, arg2));
+	BufferUtils::setNibble(nib, 2, BufferUtils::pack(&out, arg3));
 
 
     if (true) {
@@ -563,7 +563,7 @@ decompressPrintArgs__E32374s3237424642lf__s46cc__100__ (const char **in,
 inline void __syang0__fl__E__del46cc__199__(NanoLog::LogLevel level, const char* fmtStr ) {
     extern const uint32_t __fmtId__E__del46cc__199__;
 
-    if (level > NanoLog::getLogLevel())
+    if (level > NanoLog::MIN_LOG_LEVEL || level > NanoLog::getLogLevel())
         return;
 
     uint64_t timestamp = PerfUtils::Cycles::rdtsc();
@@ -0,0 +1,441 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "Aggregation.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define NANOLOG_AGGREGATION_AVX2 1
+#define NANOLOG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace NanoLogInternal {
+namespace Aggregation {
+
+#ifdef NANOLOG_AGGREGATION_AVX2
+/**
+ * Returns true if the processor supports the AVX2 kernels.
+ */
+static bool
+hasAvx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+/**
+ * Returns the sum of the 4 lanes of an AVX2 register of int64_t's.
+ */
+NANOLOG_TARGET_AVX2 static inline int64_t
+reduceSum(__m256i v)
+{
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+NANOLOG_TARGET_AVX2 static int64_t
+sumAvx2(const int64_t *values, size_t count)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i *in = reinterpret_cast<const __m256i*>(values + i);
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256(in));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256(in + 1));
+    }
+
+    int64_t result = reduceSum(_mm256_add_epi64(acc0, acc1));
+    for (; i < count; ++i)
+        result += values[i];
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static double
+sumAvx2(const double *values, size_t count)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(values + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(values + i + 4));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; ++i)
+        result += values[i];
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static int64_t
+minAvx2(const int64_t *values, size_t count)
+{
+    __m256i acc = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(values + i));
+        acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(acc, v));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    int64_t result = lanes[0];
+    for (int lane = 1; lane < 4; ++lane)
+        result = (lanes[lane] < result) ? lanes[lane] : result;
+
+    for (; i < count; ++i)
+        result = (values[i] < result) ? values[i] : result;
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static int64_t
+maxAvx2(const int64_t *values, size_t count)
+{
+    __m256i acc = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(values + i));
+        acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(v, acc));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    int64_t result = lanes[0];
+    for (int lane = 1; lane < 4; ++lane)
+        result = (lanes[lane] > result) ? lanes[lane] : result;
+
+    for (; i < count; ++i)
+        result = (values[i] > result) ? values[i] : result;
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static double
+minAvx2(const double *values, size_t count)
+{
+    __m256d acc = _mm256_set1_pd(std::numeric_limits<double>::max());
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        acc = _mm256_min_pd(_mm256_loadu_pd(values + i), acc);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double result = lanes[0];
+    for (int lane = 1; lane < 4; ++lane)
+        result = (lanes[lane] < result) ? lanes[lane] : result;
+
+    for (; i < count; ++i)
+        result = (values[i] < result) ? values[i] : result;
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static double
+maxAvx2(const double *values, size_t count)
+{
+    __m256d acc = _mm256_set1_pd(std::numeric_limits<double>::lowest());
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        acc = _mm256_max_pd(_mm256_loadu_pd(values + i), acc);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double result = lanes[0];
+    for (int lane = 1; lane < 4; ++lane)
+        result = (lanes[lane] > result) ? lanes[lane] : result;
+
+    for (; i < count; ++i)
+        result = (values[i] > result) ? values[i] : result;
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static size_t
+countInRangeAvx2(const int64_t *values, size_t count,
+                 int64_t lowerBound, int64_t upperBound)
+{
+    __m256i lower = _mm256_set1_epi64x(lowerBound);
+    __m256i upper = _mm256_set1_epi64x(upperBound);
+
+    // Counts the values out of range, whose comparison masks are -1
+    __m256i outside = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(values + i));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(lower, v),
+                                      _mm256_cmpgt_epi64(v, upper));
+        outside = _mm256_sub_epi64(outside, out);
+    }
+
+    size_t result = i - static_cast<size_t>(reduceSum(outside));
+    for (; i < count; ++i)
+        result += (values[i] >= lowerBound && values[i] <= upperBound);
+
+    return result;
+}
+
+NANOLOG_TARGET_AVX2 static size_t
+countInRangeAvx2(const double *values, size_t count,
+                 double lowerBound, double upperBound)
+{
+    __m256d lower = _mm256_set1_pd(lowerBound);
+    __m256d upper = _mm256_set1_pd(upperBound);
+
+    size_t result = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        __m256d in = _mm256_and_pd(_mm256_cmp_pd(v, lower, _CMP_GE_OQ),
+                                   _mm256_cmp_pd(v, upper, _CMP_LE_OQ));
+        result += static_cast<size_t>(
+                        __builtin_popcount(_mm256_movemask_pd(in)));
+    }
+
+    for (; i < count; ++i)
+        result += (values[i] >= lowerBound && values[i] <= upperBound);
+
+    return result;
+}
+#endif // NANOLOG_AGGREGATION_AVX2
+
+/**
+ * Returns the sum of an array of values. Integer sums wrap around on
+ * overflow.
+ *
+ * \param values
+ *      Values to sum
+ * \param count
+ *      Number of values
+ */
+int64_t
+sum(const int64_t *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return sumAvx2(values, count);
+#endif
+
+    uint64_t result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result += static_cast<uint64_t>(values[i]);
+
+    return static_cast<int64_t>(result);
+}
+
+double
+sum(const double *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return sumAvx2(values, count);
+#endif
+
+    double result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result += values[i];
+
+    return result;
+}
+
+/**
+ * Returns the smallest of an array of values, or the largest representable
+ * value if the array is empty. NaNs are ignored.
+ *
+ * \param values
+ *      Values to find the minimum of
+ * \param count
+ *      Number of values
+ */
+int64_t
+min(const int64_t *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return minAvx2(values, count);
+#endif
+
+    int64_t result = std::numeric_limits<int64_t>::max();
+    for (size_t i = 0; i < count; ++i)
+        result = (values[i] < result) ? values[i] : result;
+
+    return result;
+}
+
+double
+min(const double *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return minAvx2(values, count);
+#endif
+
+    double result = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < count; ++i)
+        result = (values[i] < result) ? values[i] : result;
+
+    return result;
+}
+
+/**
+ * Returns the largest of an array of values, or the lowest representable
+ * value if the array is empty. NaNs are ignored.
+ *
+ * \param values
+ *      Values to find the maximum of
+ * \param count
+ *      Number of values
+ */
+int64_t
+max(const int64_t *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return maxAvx2(values, count);
+#endif
+
+    int64_t result = std::numeric_limits<int64_t>::min();
+    for (size_t i = 0; i < count; ++i)
+        result = (values[i] > result) ? values[i] : result;
+
+    return result;
+}
+
+double
+max(const double *values, size_t count)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return maxAvx2(values, count);
+#endif
+
+    double result = std::numeric_limits<double>::lowest();
+    for (size_t i = 0; i < count; ++i)
+        result = (values[i] > result) ? values[i] : result;
+
+    return result;
+}
+
+/**
+ * Returns the number of values within a range, inclusive.
+ *
+ * \param values
+ *      Values to count
+ * \param count
+ *      Number of values
+ * \param lowerBound
+ *      Smallest value counted
+ * \param upperBound
+ *      Largest value counted
+ */
+size_t
+countInRange(const int64_t *values, size_t count,
+             int64_t lowerBound, int64_t upperBound)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return countInRangeAvx2(values, count, lowerBound, upperBound);
+#endif
+
+    size_t result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result += (values[i] >= lowerBound && values[i] <= upperBound);
+
+    return result;
+}
+
+size_t
+countInRange(const double *values, size_t count,
+             double lowerBound, double upperBound)
+{
+#ifdef NANOLOG_AGGREGATION_AVX2
+    if (hasAvx2())
+        return countInRangeAvx2(values, count, lowerBound, upperBound);
+#endif
+
+    size_t result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result += (values[i] >= lowerBound && values[i] <= upperBound);
+
+    return result;
+}
+
+/**
+ * Adds an array of values to a histogram of equal width buckets where the
+ * i-th bucket counts the values in [lowerBound + i*bucketWidth,
+ * lowerBound + (i + 1)*bucketWidth). Values below the first bucket are
+ * counted in the first bucket and values beyond the last bucket are counted
+ * in the last one.
+ *
+ * \param values
+ *      Values to add to the histogram
+ * \param count
+ *      Number of values
+ * \param lowerBound
+ *      Smallest value of the first bucket
+ * \param bucketWidth
+ *      Range of values counted by each bucket; must be positive
+ * \param numBuckets
+ *      Number of buckets; must be positive
+ * \param[in/out] buckets
+ *      Counts of the histogram's buckets that are incremented
+ */
+void
+histogram(const int64_t *values, size_t count, int64_t lowerBound,
+          int64_t bucketWidth, uint32_t numBuckets, uint64_t *buckets)
+{
+    uint64_t width = static_cast<uint64_t>(bucketWidth);
+    uint64_t lastBucket = numBuckets - 1;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t offset = static_cast<uint64_t>(values[i])
+                                - static_cast<uint64_t>(lowerBound);
+        uint64_t bucket = (values[i] < lowerBound) ? 0 : offset/width;
+        ++buckets[(bucket < lastBucket) ? bucket : lastBucket];
+    }
+}
+
+void
+histogram(const double *values, size_t count, double lowerBound,
+          double bucketWidth, uint32_t numBuckets, uint64_t *buckets)
+{
+    double lastBucket = static_cast<double>(numBuckets - 1);
+    for (size_t i = 0; i < count; ++i) {
+        double bucket = std::floor((values[i] - lowerBound)/bucketWidth);
+
+        // Written so that NaNs end up in the first bucket
+        bucket = (bucket >= 0.0) ? bucket : 0.0;
+        bucket = (bucket < lastBucket) ? bucket : lastBucket;
+        ++buckets[static_cast<uint32_t>(bucket)];
+    }
+}
+
+}; // namespace Aggregation
+}; // namespace NanoLogInternal
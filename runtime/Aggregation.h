@@ -0,0 +1,148 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NANOLOG_AGGREGATION_H
+#define NANOLOG_AGGREGATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * The Aggregation namespace contains kernels that aggregate arrays of values,
+ * such as the columns of an ArgumentBatch filled in by
+ * Decoder::getNextArgumentBatch(). The kernels use AVX2 when the processor
+ * supports it and fall back to scalar loops otherwise. Note that the
+ * vectorized floating point sums add the values in a different order than a
+ * sequential loop, so they may differ from it by rounding.
+ */
+namespace NanoLogInternal {
+namespace Aggregation {
+
+int64_t sum(const int64_t *values, size_t count);
+double sum(const double *values, size_t count);
+
+int64_t min(const int64_t *values, size_t count);
+double min(const double *values, size_t count);
+
+int64_t max(const int64_t *values, size_t count);
+double max(const double *values, size_t count);
+
+size_t countInRange(const int64_t *values, size_t count,
+                    int64_t lowerBound, int64_t upperBound);
+size_t countInRange(const double *values, size_t count,
+                    double lowerBound, double upperBound);
+
+void histogram(const int64_t *values, size_t count, int64_t lowerBound,
+               int64_t bucketWidth, uint32_t numBuckets, uint64_t *buckets);
+void histogram(const double *values, size_t count, double lowerBound,
+               double bucketWidth, uint32_t numBuckets, uint64_t *buckets);
+
+/**
+ * Returns the value at a percentile of the values using the nearest-rank
+ * method (i.e. the smallest value that's greater or equal to the given
+ * fraction of the values). The values are partially reordered.
+ *
+ * \param values
+ *      Values to find the percentile of
+ * \param fraction
+ *      The percentile as a fraction between 0 and 1 (i.e. 0.99)
+ *
+ * \return
+ *      The value at the percentile, or 0 if there are no values
+ */
+template<typename T>
+T
+percentile(std::vector<T> &values, double fraction)
+{
+    if (values.empty())
+        return 0;
+
+    double rank = std::ceil(fraction*static_cast<double>(values.size()));
+    size_t index = (rank < 1.0) ? 0 : static_cast<size_t>(rank) - 1;
+    if (index >= values.size())
+        index = values.size() - 1;
+
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+/**
+ * Running count, minimum, maximum and sum over arrays of values.
+ *
+ * \tparam T
+ *      Type of the values (int64_t or double)
+ */
+template<typename T>
+struct Summary {
+    // Number of values added
+    uint64_t count;
+
+    // Smallest and largest value added; only valid if count > 0
+    T min;
+    T max;
+
+    // Sum of the values added
+    T sum;
+
+    Summary()
+        : count(0)
+        , min(std::numeric_limits<T>::max())
+        , max(std::numeric_limits<T>::lowest())
+        , sum(0)
+    {}
+
+    /**
+     * Adds an array of values to the summary.
+     *
+     * \param values
+     *      Values to add
+     * \param n
+     *      Number of values to add
+     */
+    void
+    add(const T *values, size_t n) {
+        if (n == 0)
+            return;
+
+        T batchMin = Aggregation::min(values, n);
+        T batchMax = Aggregation::max(values, n);
+        if (batchMin < min)
+            min = batchMin;
+
+        if (batchMax > max)
+            max = batchMax;
+
+        sum += Aggregation::sum(values, n);
+        count += n;
+    }
+
+    /**
+     * Returns the mean of the values added, or 0 if there are none.
+     */
+    double
+    mean() const {
+        return (count == 0) ? 0.0 : static_cast<double>(sum)
+                                            / static_cast<double>(count);
+    }
+};
+
+}; // namespace Aggregation
+}; // namespace NanoLogInternal
+
+#endif /* NANOLOG_AGGREGATION_H */
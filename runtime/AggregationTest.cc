@@ -0,0 +1,171 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "TestUtil.h"
+#include "Aggregation.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace NanoLogInternal;
+
+class AggregationTest : public ::testing::Test {
+protected:
+    // Enough values to exercise both the vectorized loops and their tails
+    std::vector<int64_t> ints;
+    std::vector<double> doubles;
+
+    AggregationTest()
+        : ints()
+        , doubles()
+    {
+        for (int i = 0; i < 23; ++i) {
+            ints.push_back((i*37) % 23 - 11);
+            doubles.push_back(0.25*((i*37) % 23 - 11));
+        }
+    }
+};
+
+TEST_F(AggregationTest, sum) {
+    int64_t expected = 0;
+    double expectedDouble = 0;
+    for (size_t n = 0; n <= ints.size(); ++n) {
+        EXPECT_EQ(expected, Aggregation::sum(ints.data(), n));
+        EXPECT_EQ(expectedDouble, Aggregation::sum(doubles.data(), n));
+        if (n < ints.size()) {
+            expected += ints[n];
+            expectedDouble += doubles[n];
+        }
+    }
+
+    // Integer sums wrap around
+    int64_t big[] = {std::numeric_limits<int64_t>::max(), 2};
+    EXPECT_EQ(std::numeric_limits<int64_t>::min() + 1,
+              Aggregation::sum(big, 2));
+}
+
+TEST_F(AggregationTest, minMax) {
+    EXPECT_EQ(-11, Aggregation::min(ints.data(), ints.size()));
+    EXPECT_EQ(11, Aggregation::max(ints.data(), ints.size()));
+    EXPECT_EQ(-2.75, Aggregation::min(doubles.data(), doubles.size()));
+    EXPECT_EQ(2.75, Aggregation::max(doubles.data(), doubles.size()));
+
+    // The extremes in the scalar tail
+    ints.push_back(-100);
+    ints.push_back(100);
+    EXPECT_EQ(-100, Aggregation::min(ints.data(), ints.size()));
+    EXPECT_EQ(100, Aggregation::max(ints.data(), ints.size()));
+
+    EXPECT_EQ(std::numeric_limits<int64_t>::max(),
+              Aggregation::min(ints.data(), 0));
+    EXPECT_EQ(std::numeric_limits<int64_t>::min(),
+              Aggregation::max(ints.data(), 0));
+
+    int64_t extremes[] = {std::numeric_limits<int64_t>::min(), 0, 0,
+                          std::numeric_limits<int64_t>::max()};
+    EXPECT_EQ(extremes[0], Aggregation::min(extremes, 4));
+    EXPECT_EQ(extremes[3], Aggregation::max(extremes, 4));
+
+    double nans[] = {NAN, 1.0, NAN, -1.0, NAN};
+    EXPECT_EQ(-1.0, Aggregation::min(nans, 5));
+    EXPECT_EQ(1.0, Aggregation::max(nans, 5));
+}
+
+TEST_F(AggregationTest, countInRange) {
+    EXPECT_EQ(11U, Aggregation::countInRange(ints.data(), ints.size(), 1, 11));
+    EXPECT_EQ(1U, Aggregation::countInRange(ints.data(), ints.size(), 0, 0));
+    EXPECT_EQ(0U, Aggregation::countInRange(ints.data(), ints.size(), 12, 20));
+    EXPECT_EQ(23U, Aggregation::countInRange(ints.data(), ints.size(),
+                                std::numeric_limits<int64_t>::min(),
+                                std::numeric_limits<int64_t>::max()));
+
+    EXPECT_EQ(11U, Aggregation::countInRange(doubles.data(), doubles.size(),
+                                             0.25, 2.75));
+    EXPECT_EQ(3U, Aggregation::countInRange(doubles.data(), doubles.size(),
+                                            -0.25, 0.25));
+
+    double nans[] = {NAN, 1.0, NAN, -1.0, NAN};
+    EXPECT_EQ(2U, Aggregation::countInRange(nans, 5, -1.0, 1.0));
+}
+
+TEST_F(AggregationTest, histogram) {
+    uint64_t buckets[4] = {};
+    Aggregation::histogram(ints.data(), ints.size(), -10, 5, 4, buckets);
+
+    // The values below -10 and at or above 5 are clamped into the ends
+    EXPECT_EQ(6U, buckets[0]);
+    EXPECT_EQ(5U, buckets[1]);
+    EXPECT_EQ(5U, buckets[2]);
+    EXPECT_EQ(7U, buckets[3]);
+
+    int64_t extremes[] = {std::numeric_limits<int64_t>::min(),
+                          std::numeric_limits<int64_t>::max()};
+    Aggregation::histogram(extremes, 2, -10, 5, 4, buckets);
+    EXPECT_EQ(7U, buckets[0]);
+    EXPECT_EQ(8U, buckets[3]);
+
+    uint64_t doubleBuckets[2] = {};
+    double values[] = {-1.0, 0.0, 0.49, 0.5, 0.99, 7.0, NAN};
+    Aggregation::histogram(values, 7, 0.0, 0.5, 2, doubleBuckets);
+    EXPECT_EQ(4U, doubleBuckets[0]);
+    EXPECT_EQ(3U, doubleBuckets[1]);
+}
+
+TEST_F(AggregationTest, percentile) {
+    std::vector<int64_t> values;
+    EXPECT_EQ(0, Aggregation::percentile(values, 0.5));
+
+    for (int i = 100; i >= 1; --i)
+        values.push_back(i);
+
+    EXPECT_EQ(1, Aggregation::percentile(values, 0.0));
+    EXPECT_EQ(50, Aggregation::percentile(values, 0.5));
+    EXPECT_EQ(90, Aggregation::percentile(values, 0.9));
+    EXPECT_EQ(99, Aggregation::percentile(values, 0.99));
+    EXPECT_EQ(100, Aggregation::percentile(values, 1.0));
+    EXPECT_EQ(100, Aggregation::percentile(values, 2.0));
+
+    EXPECT_EQ(-1.5, Aggregation::percentile(doubles, 0.25));
+}
+
+TEST_F(AggregationTest, Summary) {
+    Aggregation::Summary<int64_t> summary;
+    EXPECT_EQ(0.0, summary.mean());
+
+    summary.add(ints.data(), 0);
+    EXPECT_EQ(0U, summary.count);
+
+    summary.add(ints.data(), 10);
+    summary.add(ints.data() + 10, ints.size() - 10);
+    EXPECT_EQ(23U, summary.count);
+    EXPECT_EQ(-11, summary.min);
+    EXPECT_EQ(11, summary.max);
+    EXPECT_EQ(0, summary.sum);
+    EXPECT_EQ(0.0, summary.mean());
+
+    Aggregation::Summary<double> doubleSummary;
+    double values[] = {1.0, 2.0, 4.5};
+    doubleSummary.add(values, 3);
+    EXPECT_EQ(3U, doubleSummary.count);
+    EXPECT_EQ(1.0, doubleSummary.min);
+    EXPECT_EQ(4.5, doubleSummary.max);
+    EXPECT_EQ(2.5, doubleSummary.mean());
+}
+
+}; // namespace
@@ -0,0 +1,357 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstring>
+
+#include "BlockCompressor.h"
+
+namespace NanoLogInternal {
+namespace BlockCompressor {
+
+/**
+ * The compressed data is a series of sequences, each of which is made up of
+ *      (1 byte)   token; the high nibble is the number of literals and the
+ *                 low nibble is the match length minus MIN_MATCH
+ *      (0-n bytes) remainder of the number of literals if the nibble is 15
+ *      (0-n bytes) the literals, copied verbatim
+ *      (2 bytes)  little endian offset of the match behind the output
+ *      (0-n bytes) remainder of the match length if the nibble is 15
+ * The last sequence consists of only the token and literals. Remainders are
+ * encoded as a run of 255's terminated by a byte less than 255.
+ */
+
+// Shortest match that's worth encoding
+static const size_t MIN_MATCH = 4;
+
+// The last LAST_LITERALS bytes of the input are always stored as literals and
+// no match may start in the last MATCH_FIND_LIMIT bytes. These are required
+// by the LZ4 block format so that decoders may copy in wide words.
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_FIND_LIMIT = 12;
+
+// Farthest a match can be behind the position it's copied to
+static const size_t MAX_OFFSET = 65535;
+
+// Base 2 logarithm of the number of positions remembered by the compressor
+static const int HASH_LOG = 12;
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t
+hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/**
+ * Returns the number of bytes that match between two positions in the input,
+ * up to a limit.
+ *
+ * \param in
+ *      Position to compare against the earlier match position
+ * \param match
+ *      Earlier position in the input
+ * \param limit
+ *      First byte past in that may not be part of the match
+ */
+static inline size_t
+countMatch(const uint8_t *in, const uint8_t *match, const uint8_t *limit)
+{
+    const uint8_t *start = in;
+    while (in + sizeof(uint64_t) <= limit) {
+        uint64_t diff = read64(in) ^ read64(match);
+        if (diff != 0)
+            return (in - start) + (__builtin_ctzll(diff) >> 3);
+
+        in += sizeof(uint64_t);
+        match += sizeof(uint64_t);
+    }
+
+    while (in < limit && *in == *match) {
+        ++in;
+        ++match;
+    }
+
+    return in - start;
+}
+
+/**
+ * Encodes the remainder of a literal or match length that didn't fit in its
+ * nibble of the token.
+ *
+ * \param out
+ *      Output to write the remainder to
+ * \param length
+ *      The length, which must be at least 15
+ *
+ * \return
+ *      The output position after the remainder
+ */
+static inline uint8_t *
+writeLength(uint8_t *out, size_t length)
+{
+    length -= 15;
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+/**
+ * Encodes a sequence.
+ *
+ * \param out
+ *      Output to write the sequence to
+ * \param literals
+ *      The bytes to be copied verbatim before the match
+ * \param numLiterals
+ *      Number of bytes in literals
+ * \param offset
+ *      Distance of the match behind the end of the literals
+ * \param matchLength
+ *      Number of bytes to copy from the match; 0 for the last sequence
+ *
+ * \return
+ *      The output position after the sequence
+ */
+static inline uint8_t *
+writeSequence(uint8_t *out, const uint8_t *literals, size_t numLiterals,
+              size_t offset, size_t matchLength)
+{
+    uint8_t *token = out++;
+    *token = static_cast<uint8_t>(((numLiterals < 15) ? numLiterals : 15) << 4);
+    if (numLiterals >= 15)
+        out = writeLength(out, numLiterals);
+
+    std::memcpy(out, literals, numLiterals);
+    out += numLiterals;
+
+    if (matchLength == 0)
+        return out;
+
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+
+    size_t length = matchLength - MIN_MATCH;
+    *token = static_cast<uint8_t>(*token | ((length < 15) ? length : 15));
+    if (length >= 15)
+        out = writeLength(out, length);
+
+    return out;
+}
+
+/**
+ * Decodes the remainder of a literal or match length.
+ *
+ * \param[in/out] in
+ *      Position of the remainder; it's advanced past it
+ * \param end
+ *      End of the compressed data
+ * \param[in/out] length
+ *      The length from the token nibble, to which the remainder is added
+ *
+ * \return
+ *      false if the remainder runs past the end of the compressed data
+ */
+static inline bool
+readLength(const uint8_t **in, const uint8_t *end, size_t *length)
+{
+    uint8_t byte;
+    do {
+        if (*in >= end)
+            return false;
+
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+/**
+ * Returns the maximum number of bytes compress() can produce for an input
+ * (i.e. when the input is incompressible).
+ *
+ * \param nbytes
+ *      Number of bytes in the input
+ */
+size_t
+maxCompressedSize(size_t nbytes)
+{
+    return nbytes + nbytes/255 + 16;
+}
+
+/**
+ * Compresses a buffer.
+ *
+ * \param in
+ *      The bytes to compress
+ * \param nbytes
+ *      Number of bytes in the input; less than 4GB
+ * \param out
+ *      Output buffer with at least maxCompressedSize(nbytes) bytes of space
+ *
+ * \return
+ *      Number of bytes written to out
+ */
+size_t
+compress(const char *in, size_t nbytes, char *out)
+{
+    const uint8_t *start = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t *end = start + nbytes;
+    const uint8_t *pos = start;
+    const uint8_t *anchor = start;
+    uint8_t *outPos = reinterpret_cast<uint8_t*>(out);
+
+    if (nbytes > MATCH_FIND_LIMIT) {
+        const uint8_t *matchFindLimit = end - MATCH_FIND_LIMIT;
+        const uint8_t *matchLimit = end - LAST_LITERALS;
+
+        // Last position in the input (relative to start) at which each hash
+        // of 4 bytes was seen
+        uint32_t positions[1 << HASH_LOG];
+        std::memset(positions, 0, sizeof(positions));
+
+        while (pos < matchFindLimit) {
+            uint32_t sequence = read32(pos);
+            uint32_t h = hash(sequence);
+            const uint8_t *match = start + positions[h];
+            positions[h] = static_cast<uint32_t>(pos - start);
+
+            // Skip ahead faster the longer we go without finding a match,
+            // since the data is likely incompressible.
+            if (match >= pos || size_t(pos - match) > MAX_OFFSET
+                             || read32(match) != sequence) {
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            // Extend the match backwards over the pending literals
+            while (pos > anchor && match > start && pos[-1] == match[-1]) {
+                --pos;
+                --match;
+            }
+
+            size_t length = MIN_MATCH + countMatch(pos + MIN_MATCH,
+                                                   match + MIN_MATCH,
+                                                   matchLimit);
+            outPos = writeSequence(outPos, anchor, pos - anchor, pos - match,
+                                   length);
+            pos += length;
+            anchor = pos;
+
+            // Remember a position within the match for the next one
+            positions[hash(read32(pos - 2))] =
+                                    static_cast<uint32_t>(pos - 2 - start);
+        }
+    }
+
+    outPos = writeSequence(outPos, anchor, end - anchor, 0, 0);
+    return outPos - reinterpret_cast<uint8_t*>(out);
+}
+
+/**
+ * Decompresses a buffer produced by compress() (or any LZ4 block compressor).
+ *
+ * \param in
+ *      The compressed bytes
+ * \param nbytes
+ *      Number of compressed bytes
+ * \param out
+ *      Buffer to decompress into
+ * \param outSize
+ *      Exact number of bytes the input decompresses into
+ *
+ * \return
+ *      true if successful; false if the input is corrupt or doesn't decompress
+ *      into exactly outSize bytes
+ */
+bool
+decompress(const char *in, size_t nbytes, char *out, size_t outSize)
+{
+    const uint8_t *pos = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t *end = pos + nbytes;
+    uint8_t *outStart = reinterpret_cast<uint8_t*>(out);
+    uint8_t *outPos = outStart;
+    uint8_t *outEnd = outStart + outSize;
+
+    while (pos < end) {
+        uint8_t token = *pos++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(&pos, end, &numLiterals))
+            return false;
+
+        if (numLiterals > size_t(end - pos) ||
+                numLiterals > size_t(outEnd - outPos))
+            return false;
+
+        std::memcpy(outPos, pos, numLiterals);
+        pos += numLiterals;
+        outPos += numLiterals;
+
+        // The last sequence has no match
+        if (pos == end)
+            break;
+
+        if (end - pos < 2)
+            return false;
+
+        size_t offset = pos[0] | (size_t(pos[1]) << 8);
+        pos += 2;
+        if (offset == 0 || offset > size_t(outPos - outStart))
+            return false;
+
+        size_t length = token & 0xf;
+        if (length == 15 && !readLength(&pos, end, &length))
+            return false;
+
+        length += MIN_MATCH;
+        if (length > size_t(outEnd - outPos))
+            return false;
+
+        // Overlapping matches repeat the bytes just output
+        const uint8_t *match = outPos - offset;
+        if (offset >= length) {
+            std::memcpy(outPos, match, length);
+            outPos += length;
+        } else {
+            for (size_t i = 0; i < length; ++i)
+                *outPos++ = *match++;
+        }
+    }
+
+    return outPos == outEnd;
+}
+
+}; /* namespace BlockCompressor */
+}; /* namespace NanoLogInternal */
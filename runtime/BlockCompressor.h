@@ -0,0 +1,45 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NANOLOG_BLOCKCOMPRESSOR_H
+#define NANOLOG_BLOCKCOMPRESSOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace NanoLogInternal {
+
+/**
+ * A general purpose compressor that the background compression threads can
+ * optionally run over their output buffers before writing them out (see
+ * NanoLog::setBlockCompression()). NanoLog's own encoding already removes the
+ * static text of the log messages, but the arguments (especially strings)
+ * are stored more or less verbatim, so there's typically redundancy left
+ * across log messages.
+ *
+ * The compressed data is in the LZ4 block format, so it can be inspected
+ * with standard LZ4 tools, but the compressor favors speed over ratio: it's
+ * a single pass, greedy matcher over a small hash table of recent positions.
+ */
+namespace BlockCompressor {
+
+size_t maxCompressedSize(size_t nbytes);
+size_t compress(const char *in, size_t nbytes, char *out);
+bool decompress(const char *in, size_t nbytes, char *out, size_t outSize);
+
+}; /* namespace BlockCompressor */
+}; /* namespace NanoLogInternal */
+
+#endif /* NANOLOG_BLOCKCOMPRESSOR_H */
@@ -0,0 +1,131 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TestUtil.h"
+#include "BlockCompressor.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace NanoLogInternal;
+
+class BlockCompressorTest : public ::testing::Test {
+protected:
+    // Compresses the input, checks that it decompresses back into the input
+    // and returns the compressed bytes.
+    std::string roundTrip(const std::string &input) {
+        std::vector<char> compressed(
+                            BlockCompressor::maxCompressedSize(input.size()));
+        size_t compressedBytes = BlockCompressor::compress(input.data(),
+                                                           input.size(),
+                                                           compressed.data());
+        EXPECT_LE(compressedBytes, compressed.size());
+
+        std::string output(input.size(), '\0');
+        EXPECT_TRUE(BlockCompressor::decompress(compressed.data(),
+                                                compressedBytes,
+                                                &output[0],
+                                                output.size()));
+        EXPECT_EQ(input, output);
+        return std::string(compressed.data(), compressedBytes);
+    }
+};
+
+TEST_F(BlockCompressorTest, compress_short) {
+    // Inputs too short to hold a match are stored as literals
+    EXPECT_EQ(std::string(1, '\0'), roundTrip(""));
+    EXPECT_EQ("\x50hello", roundTrip("hello"));
+    EXPECT_EQ(1 + 12U, roundTrip("aaaaaaaaaaaa").size());
+}
+
+TEST_F(BlockCompressorTest, compress_repetitive) {
+    std::string input;
+    for (int i = 0; i < 1000; ++i)
+        input += "host=web-server-042.example.com symbol=AAPL ";
+
+    std::string compressed = roundTrip(input);
+    EXPECT_LT(compressed.size(), input.size()/20);
+
+    // Runs shorter than the match offset overlap the output
+    EXPECT_GT(100U, roundTrip(std::string(10000, 'x')).size());
+}
+
+TEST_F(BlockCompressorTest, compress_incompressible) {
+    std::mt19937 rng(42);
+    std::string input(100000, '\0');
+    for (char &c : input)
+        c = static_cast<char>(rng());
+
+    std::string compressed = roundTrip(input);
+    EXPECT_LE(compressed.size(), BlockCompressor::maxCompressedSize(
+                                                            input.size()));
+}
+
+TEST_F(BlockCompressorTest, compress_mixed) {
+    // Matches farther back than the maximum offset can't be referenced
+    std::mt19937 rng(7);
+    std::string input;
+    for (int i = 0; i < 5000; ++i) {
+        input += "seq=" + std::to_string(i) + " ";
+        for (int j = 0; j < static_cast<int>(rng() % 20); ++j)
+            input += static_cast<char>('a' + rng() % 26);
+    }
+
+    roundTrip(input);
+}
+
+TEST_F(BlockCompressorTest, decompress_corrupt) {
+    std::string input;
+    for (int i = 0; i < 100; ++i)
+        input += "0123456789";
+
+    std::vector<char> compressed(
+                            BlockCompressor::maxCompressedSize(input.size()));
+    size_t compressedBytes = BlockCompressor::compress(input.data(),
+                                                       input.size(),
+                                                       compressed.data());
+    std::string output(input.size(), '\0');
+
+    // Truncated input
+    EXPECT_FALSE(BlockCompressor::decompress(compressed.data(),
+                                             compressedBytes - 3,
+                                             &output[0], output.size()));
+
+    // Output size doesn't match
+    EXPECT_FALSE(BlockCompressor::decompress(compressed.data(),
+                                             compressedBytes,
+                                             &output[0], output.size() - 1));
+    output.resize(input.size() + 1);
+    EXPECT_FALSE(BlockCompressor::decompress(compressed.data(),
+                                             compressedBytes,
+                                             &output[0], output.size()));
+
+    // Match referring back past the start of the output
+    const char badOffset[] = {'\x14', 'a', '\x05', '\0', '\0', 'b'};
+    output.resize(10);
+    EXPECT_FALSE(BlockCompressor::decompress(badOffset, sizeof(badOffset),
+                                             &output[0], output.size()));
+
+    // Literal length running past the end of the input
+    const char badLength[] = {'\xf0', '\xff'};
+    EXPECT_FALSE(BlockCompressor::decompress(badLength, sizeof(badLength),
+                                             &output[0], output.size()));
+}
+
+}  // namespace
@@ -0,0 +1,451 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <cwchar>
+
+#include "ColumnarWriter.h"
+
+namespace NanoLogInternal {
+namespace Log {
+
+/**
+ * Returns the ColumnType that the values of a LOG argument are stored as.
+ *
+ * \param argType
+ *      FormatType of the argument
+ */
+static ColumnType
+toColumnType(FormatType argType)
+{
+    switch (argType) {
+        case signed_char_t:
+        case short_int_t:
+        case int_t:
+        case long_int_t:
+        case long_long_int_t:
+        case intmax_t_t:
+        case ptrdiff_t_t:
+            return INT64_COLUMN;
+
+        case double_t:
+        case long_double_t:
+            return DOUBLE_COLUMN;
+
+        // User-defined types are exported as their formatted text
+        case const_char_ptr_t:
+        case const_wchar_t_ptr_t:
+        case custom_t:
+        case static_str_t:
+            return STRING_COLUMN;
+
+        default:
+            return UINT64_COLUMN;
+    }
+}
+
+/**
+ * Appends a wide string to a string encoded as UTF-8.
+ *
+ * \param wstr
+ *      Null-terminated wide string to encode
+ * \param[out] out
+ *      String to append to
+ */
+static void
+appendUtf8(const wchar_t *wstr, std::string &out)
+{
+    for (; *wstr != L'\0'; ++wstr) {
+        uint32_t c = static_cast<uint32_t>(*wstr);
+        if (c < 0x80) {
+            out.push_back(static_cast<char>(c));
+        } else if (c < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        } else if (c < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | ((c >> 18) & 0x07)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+    }
+}
+
+/**
+ * Returns the bit pattern of the value of a numeric LOG argument widened to
+ * its ColumnType.
+ *
+ * \param logMsg
+ *      Log message containing the argument
+ * \param argNum
+ *      Index of the argument in the log message
+ * \param argType
+ *      FormatType of the argument
+ */
+static uint64_t
+getNumericArg(LogMessage &logMsg, int argNum, FormatType argType)
+{
+    double d;
+    uint64_t bits;
+
+    switch (argType) {
+        case unsigned_char_t:
+            return logMsg.get<unsigned char>(argNum);
+        case unsigned_short_int_t:
+            return logMsg.get<unsigned short int>(argNum);
+        case unsigned_int_t:
+            return logMsg.get<unsigned int>(argNum);
+        case unsigned_long_int_t:
+            return logMsg.get<unsigned long int>(argNum);
+        case unsigned_long_long_int_t:
+            return logMsg.get<unsigned long long int>(argNum);
+        case uintmax_t_t:
+            return logMsg.get<uintmax_t>(argNum);
+        case size_t_t:
+            return logMsg.get<size_t>(argNum);
+        case wint_t_t:
+            return logMsg.get<wint_t>(argNum);
+
+        case signed_char_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<signed char>(argNum)));
+        case short_int_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<short int>(argNum)));
+        case int_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<int>(argNum)));
+        case long_int_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<long int>(argNum)));
+        case long_long_int_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<long long int>(argNum)));
+        case intmax_t_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<intmax_t>(argNum)));
+        case ptrdiff_t_t:
+            return static_cast<uint64_t>(
+                    static_cast<int64_t>(logMsg.get<ptrdiff_t>(argNum)));
+
+        case double_t:
+            d = logMsg.get<double>(argNum);
+            break;
+
+        case long_double_t:
+            d = static_cast<double>(logMsg.get<long double>(argNum));
+            break;
+
+        case const_void_ptr_t:
+            return reinterpret_cast<uintptr_t>(
+                    logMsg.get<const void*>(argNum));
+
+        default:
+            return 0;
+    }
+
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+/**
+ * ColumnarWriter constructor; writes the ColumnarFileHeader to the output.
+ *
+ * \param outputFd
+ *      File to write the batches to
+ * \param rowsPerBatch
+ *      Number of rows at which a batch is written out
+ */
+ColumnarWriter::ColumnarWriter(FILE *outputFd, uint32_t rowsPerBatch)
+    : outputFd(outputFd)
+    , rowsPerBatch(rowsPerBatch == 0 ? 1 : rowsPerBatch)
+    , execution(0)
+    , batches()
+    , numRowsWritten(0)
+    , good(true)
+{
+    ColumnarFileHeader header;
+    memcpy(header.magic, COLUMNAR_MAGIC, sizeof(header.magic));
+    header.version = COLUMNAR_VERSION;
+    write(&header, sizeof(header));
+}
+
+// ColumnarWriter destructor; writes out the batches still buffered
+ColumnarWriter::~ColumnarWriter()
+{
+    flush();
+}
+
+/**
+ * Adds a decompressed log message to its logId's batch, writing the batch
+ * out if it is full.
+ *
+ * \param logId
+ *      Identifier of the LOG statement that produced the log message
+ * \param metadata
+ *      Static information of the LOG statement (see Decoder)
+ * \param formatString
+ *      Format string of the LOG statement
+ * \param timestamp
+ *      Wall time of the log message in nanoseconds since the Unix epoch
+ * \param runtimeId
+ *      Identifier of the thread that logged the message
+ * \param logMsg
+ *      The decompressed log message containing the arguments
+ *
+ * \return
+ *      true if successful; false if a write failed (an error will have been
+ *      printed)
+ */
+bool
+ColumnarWriter::append(uint32_t logId, const FormatMetadata *metadata,
+                       const char *formatString, int64_t timestamp,
+                       uint32_t runtimeId, LogMessage &logMsg)
+{
+    if (logId >= batches.size())
+        batches.resize(logId + 1);
+
+    Batch &batch = batches[logId];
+    if (!batch.initialized)
+        initBatch(batch, metadata, formatString);
+
+    batch.columns[0].values.push_back(static_cast<uint64_t>(timestamp));
+    batch.columns[1].values.push_back(runtimeId);
+
+    int numArgs = logMsg.getNumArgs();
+    for (size_t i = 2; i < batch.columns.size(); ++i) {
+        Column &column = batch.columns[i];
+        int argNum = static_cast<int>(i - 2);
+
+        if (column.type != STRING_COLUMN) {
+            column.values.push_back((argNum < numArgs)
+                    ? getNumericArg(logMsg, argNum, column.argType) : 0);
+            continue;
+        }
+
+        if (argNum < numArgs) {
+            if (column.argType == const_wchar_t_ptr_t) {
+                const wchar_t *wstr = logMsg.get<const wchar_t*>(argNum);
+                if (wstr != nullptr)
+                    appendUtf8(wstr, column.contents);
+            } else {
+                const char *str = logMsg.get<const char*>(argNum);
+                if (str != nullptr)
+                    column.contents.append(str);
+            }
+        }
+        column.offsets.push_back(column.contents.size());
+    }
+
+    if (++batch.numRows >= rowsPerBatch)
+        return writeBatch(logId, batch);
+
+    return good;
+}
+
+/**
+ * Writes out all the buffered batches.
+ *
+ * \return
+ *      true if successful; false if a write failed (an error will have been
+ *      printed)
+ */
+bool
+ColumnarWriter::flush()
+{
+    for (uint32_t logId = 0; logId < batches.size(); ++logId) {
+        if (batches[logId].numRows > 0)
+            writeBatch(logId, batches[logId]);
+    }
+
+    if (good && outputFd != nullptr && fflush(outputFd) != 0) {
+        fprintf(stderr, "Columnar export failed to flush: %s\r\n",
+                strerror(errno));
+        good = false;
+    }
+
+    return good;
+}
+
+/**
+ * Writes out the buffered batches and starts accumulating the log messages
+ * of the next execution in the log file. This must be invoked whenever the
+ * log file's dictionary is replaced since the logIds may be reassigned.
+ *
+ * \return
+ *      true if successful; false if a write failed (an error will have been
+ *      printed)
+ */
+bool
+ColumnarWriter::startExecution()
+{
+    flush();
+    batches.clear();
+    ++execution;
+    return good;
+}
+
+/**
+ * Sets up the columns of a batch for the arguments of a LOG statement.
+ *
+ * \param batch
+ *      Batch to initialize
+ * \param metadata
+ *      Static information of the LOG statement
+ * \param formatString
+ *      Format string of the LOG statement
+ */
+void
+ColumnarWriter::initBatch(Batch &batch, const FormatMetadata *metadata,
+                          const char *formatString)
+{
+    batch.initialized = true;
+    batch.filename = metadata->filename;
+    batch.formatString = (formatString) ? formatString : "";
+    batch.lineNumber = metadata->lineNumber;
+    batch.logLevel = metadata->logLevel;
+    batch.numRows = 0;
+    batch.columns.clear();
+    batch.columns.emplace_back(INT64_COLUMN, NONE);
+    batch.columns.emplace_back(UINT64_COLUMN, NONE);
+
+    const char *nextFragment = reinterpret_cast<const char*>(metadata)
+                                        + sizeof(FormatMetadata)
+                                        + metadata->filenameLength;
+    for (int i = 0; i < metadata->numPrintFragments; ++i) {
+        auto *pf = reinterpret_cast<const PrintFragment*>(nextFragment);
+        nextFragment += sizeof(PrintFragment) + pf->fragmentLength;
+
+        FormatType argType = static_cast<FormatType>(pf->argType);
+        if (argType == NONE)
+            continue;
+
+        batch.columns.emplace_back(toColumnType(argType), argType);
+        if (batch.columns.back().type == STRING_COLUMN)
+            batch.columns.back().offsets.push_back(0);
+    }
+}
+
+/**
+ * Discards the rows buffered in a batch while keeping its columns.
+ *
+ * \param batch
+ *      Batch to clear
+ */
+void
+ColumnarWriter::clearBatch(Batch &batch)
+{
+    batch.numRows = 0;
+    for (Column &column : batch.columns) {
+        column.values.clear();
+        column.contents.clear();
+        if (column.type == STRING_COLUMN)
+            column.offsets.assign(1, 0);
+    }
+}
+
+/**
+ * Writes a batch to the output and clears it.
+ *
+ * \param logId
+ *      Identifier of the LOG statement whose log messages are in the batch
+ * \param batch
+ *      Batch to write
+ *
+ * \return
+ *      true if successful; false if a write failed (an error will have been
+ *      printed)
+ */
+bool
+ColumnarWriter::writeBatch(uint32_t logId, Batch &batch)
+{
+    ColumnarBatchHeader header;
+    header.logId = logId;
+    header.execution = execution;
+    header.numRows = batch.numRows;
+    header.numColumns = static_cast<uint32_t>(batch.columns.size());
+    header.lineNumber = batch.lineNumber;
+    header.logLevel = batch.logLevel;
+    header.filenameLength = static_cast<uint16_t>(batch.filename.size() + 1);
+    header.formatStringLength =
+                static_cast<uint32_t>(batch.formatString.size() + 1);
+
+    write(&header, sizeof(header));
+    write(batch.filename.c_str(), header.filenameLength);
+    write(batch.formatString.c_str(), header.formatStringLength);
+
+    for (Column &column : batch.columns) {
+        ColumnHeader ch;
+        ch.type = column.type;
+        ch.argType = column.argType;
+        if (column.type == STRING_COLUMN)
+            ch.numBytes = column.offsets.size()*sizeof(uint64_t)
+                                + column.contents.size();
+        else
+            ch.numBytes = column.values.size()*sizeof(uint64_t);
+        write(&ch, sizeof(ch));
+    }
+
+    for (Column &column : batch.columns) {
+        if (column.type == STRING_COLUMN) {
+            write(column.offsets.data(),
+                  column.offsets.size()*sizeof(uint64_t));
+            write(column.contents.data(), column.contents.size());
+        } else {
+            write(column.values.data(), column.values.size()*sizeof(uint64_t));
+        }
+    }
+
+    if (good)
+        numRowsWritten += batch.numRows;
+
+    clearBatch(batch);
+    return good;
+}
+
+/**
+ * Writes bytes to the output unless a previous write has failed.
+ *
+ * \param data
+ *      Bytes to write
+ * \param nbytes
+ *      Number of bytes to write
+ *
+ * \return
+ *      true if successful; false if this or a previous write failed (an
+ *      error will have been printed)
+ */
+bool
+ColumnarWriter::write(const void *data, size_t nbytes)
+{
+    if (!good || nbytes == 0)
+        return good;
+
+    if (outputFd == nullptr || fwrite(data, 1, nbytes, outputFd) != nbytes) {
+        fprintf(stderr, "Columnar export failed to write %lu bytes: %s\r\n",
+                nbytes, strerror(errno));
+        good = false;
+    }
+
+    return good;
+}
+
+}; // namespace Log
+}; // namespace NanoLogInternal
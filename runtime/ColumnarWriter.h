@@ -0,0 +1,253 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NANOLOG_COLUMNARWRITER_H
+#define NANOLOG_COLUMNARWRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Log.h"
+#include "Portability.h"
+
+namespace NanoLogInternal {
+namespace Log {
+
+/**
+ * The columnar export format written by ColumnarWriter (see
+ * Decoder::exportColumns()) is intended to be loaded by analytics tools
+ * without rendering and re-parsing the log messages as text. All integers are
+ * little-endian and the file consists of a ColumnarFileHeader followed by
+ * any number of batches, each of which is laid out as
+ *
+ *      ColumnarBatchHeader
+ *      filename            (filenameLength bytes, including the '\0')
+ *      format string       (formatStringLength bytes, including the '\0')
+ *      ColumnHeader        (numColumns of them)
+ *      column data         (each column's numBytes, in column order)
+ *
+ * A batch holds the log messages of a single LOG statement (logId) of a
+ * single execution. Column 0 is the wall time of the messages in nanoseconds
+ * since the Unix epoch, column 1 is the runtimeId of the thread that logged
+ * them and the rest are the log statement's arguments in the order they
+ * appear in the format string. Numeric columns are arrays of numRows 8-byte
+ * values; STRING columns are an array of numRows + 1 uint64_t offsets
+ * followed by the concatenated contents of the strings, so that the i-th
+ * string spans [offsets[i], offsets[i + 1]) of the contents. A logId may be
+ * split across several batches.
+ */
+static const char COLUMNAR_MAGIC[8] = {'N', 'L', 'C', 'O', 'L', 'S', '\0',
+                                       '\0'};
+static const uint32_t COLUMNAR_VERSION = 1;
+
+/**
+ * Encoding of the values in a column of the columnar export.
+ */
+enum ColumnType : uint8_t {
+    // int64_t values
+    INT64_COLUMN = 0,
+
+    // uint64_t values
+    UINT64_COLUMN = 1,
+
+    // IEEE 754 double values
+    DOUBLE_COLUMN = 2,
+
+    // UTF-8 strings (see the layout above)
+    STRING_COLUMN = 3,
+};
+
+NANOLOG_PACK_PUSH
+/**
+ * Starts a file produced by the ColumnarWriter.
+ */
+struct ColumnarFileHeader {
+    // Identifies the file type; equal to COLUMNAR_MAGIC
+    char magic[8];
+
+    // Version of the layout; equal to COLUMNAR_VERSION
+    uint32_t version;
+};
+
+/**
+ * Describes a batch of log messages produced by the same LOG statement.
+ */
+struct ColumnarBatchHeader {
+    // Identifier of the LOG statement in the log file's dictionary
+    uint32_t logId;
+
+    // Index of the execution (i.e. the number of times the application was
+    // restarted and appended to the log file before this one) that the logId
+    // belongs to; logIds are only unique within an execution.
+    uint32_t execution;
+
+    // Number of log messages (rows) in the batch
+    uint32_t numRows;
+
+    // Number of ColumnHeaders following the format string
+    uint32_t numColumns;
+
+    // Line number of the LOG statement
+    uint32_t lineNumber;
+
+    // LogLevel of the LOG statement
+    uint8_t logLevel;
+
+    // Length of the source file name of the LOG statement, including '\0'
+    uint16_t filenameLength;
+
+    // Length of the format string of the LOG statement, including '\0'
+    uint32_t formatStringLength;
+};
+
+/**
+ * Describes one column of a batch.
+ */
+struct ColumnHeader {
+    // Encoding of the values (see ColumnType)
+    uint8_t type;
+
+    // FormatType of the LOG argument the column holds or NONE for the
+    // timestamp and runtimeId columns. Narrower integers, pointers and wide
+    // strings are widened to the ColumnType.
+    uint8_t argType;
+
+    // Number of bytes of column data
+    uint64_t numBytes;
+};
+NANOLOG_PACK_POP
+
+/**
+ * ColumnarWriter accumulates decompressed log messages into per-logId column
+ * batches and writes them to a file in the columnar export format described
+ * above. Batches are written once they reach a fixed number of rows or when
+ * flush() is invoked.
+ */
+class ColumnarWriter {
+public:
+    // Default number of rows at which a batch is written out
+    static const uint32_t DEFAULT_ROWS_PER_BATCH = 1 << 16;
+
+    explicit ColumnarWriter(FILE *outputFd,
+                            uint32_t rowsPerBatch=DEFAULT_ROWS_PER_BATCH);
+    ~ColumnarWriter();
+
+    bool append(uint32_t logId, const FormatMetadata *metadata,
+                const char *formatString, int64_t timestamp,
+                uint32_t runtimeId, LogMessage &logMsg);
+    bool flush();
+    bool startExecution();
+
+    /**
+     * Returns the number of rows written to the output so far.
+     */
+    inline uint64_t
+    getNumRowsWritten() {
+        return numRowsWritten;
+    }
+
+PRIVATE:
+    /**
+     * Column values buffered for a batch.
+     */
+    struct Column {
+        // Encoding of the values (see ColumnType)
+        ColumnType type;
+
+        // FormatType of the LOG argument stored in the column
+        FormatType argType;
+
+        // Bit patterns of the values in a numeric column
+        std::vector<uint64_t> values;
+
+        // End offsets of the strings in a STRING_COLUMN within contents
+        std::vector<uint64_t> offsets;
+
+        // Concatenated strings of a STRING_COLUMN
+        std::string contents;
+
+        Column(ColumnType type, FormatType argType)
+            : type(type)
+            , argType(argType)
+            , values()
+            , offsets()
+            , contents()
+        {}
+    };
+
+    /**
+     * Log messages buffered for a single logId.
+     */
+    struct Batch {
+        // Indicates that the batch has been set up for its LOG statement
+        bool initialized;
+
+        // Static information of the LOG statement. It's copied out of the
+        // FormatMetadata since the Decoder may relocate the dictionary.
+        std::string filename;
+        std::string formatString;
+        uint32_t lineNumber;
+        uint8_t logLevel;
+
+        // Number of log messages buffered
+        uint32_t numRows;
+
+        // The timestamp, runtimeId and then argument columns
+        std::vector<Column> columns;
+
+        Batch()
+            : initialized(false)
+            , filename()
+            , formatString()
+            , lineNumber(0)
+            , logLevel(0)
+            , numRows(0)
+            , columns()
+        {}
+    };
+
+    void initBatch(Batch &batch, const FormatMetadata *metadata,
+                   const char *formatString);
+    void clearBatch(Batch &batch);
+    bool writeBatch(uint32_t logId, Batch &batch);
+    bool write(const void *data, size_t nbytes);
+
+    // File the batches are written to
+    FILE *outputFd;
+
+    // Number of rows at which a batch is written out
+    uint32_t rowsPerBatch;
+
+    // Index of the execution whose log messages are currently accumulated
+    uint32_t execution;
+
+    // Batches of the current execution indexed by logId
+    std::vector<Batch> batches;
+
+    // Number of rows written to outputFd so far
+    uint64_t numRowsWritten;
+
+    // Indicates that no write to outputFd has failed
+    bool good;
+
+    DISALLOW_COPY_AND_ASSIGN(ColumnarWriter);
+};
+
+}; // namespace Log
+}; // namespace NanoLogInternal
+
+#endif /* NANOLOG_COLUMNARWRITER_H */
@@ -0,0 +1,247 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "TestUtil.h"
+#include "ColumnarWriter.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace NanoLogInternal::Log;
+
+class ColumnarWriterTest : public ::testing::Test {
+protected:
+    char *buffer;
+    size_t bufferSize;
+    FILE *fd;
+
+    char microCode[1024];
+
+    ColumnarWriterTest()
+        : buffer(nullptr)
+        , bufferSize(0)
+        , fd(nullptr)
+        , microCode()
+    {
+    }
+
+    virtual void SetUp() {
+        fd = open_memstream(&buffer, &bufferSize);
+        ASSERT_NE(nullptr, fd);
+    }
+
+    virtual void TearDown() {
+        if (fd)
+            fclose(fd);
+        free(buffer);
+    }
+
+    FormatMetadata *
+    makeMetadata(const char *format, uint32_t lineNumber) {
+        char *pos = microCode;
+        EXPECT_TRUE(Decoder::createMicroCode(&pos, format, "file.cc",
+                                             lineNumber, 2));
+        return reinterpret_cast<FormatMetadata*>(microCode);
+    }
+
+    template<typename T>
+    T
+    read(const char **pos) {
+        T value;
+        memcpy(&value, *pos, sizeof(T));
+        *pos += sizeof(T);
+        return value;
+    }
+
+    template<typename T>
+    T
+    readColumnValue(const char *columnData, uint32_t row) {
+        T value;
+        memcpy(&value, columnData + row*sizeof(uint64_t), sizeof(T));
+        return value;
+    }
+};
+
+TEST_F(ColumnarWriterTest, append_flush) {
+    ColumnarWriter writer(fd, 2);
+    LogMessage logMsg;
+
+    const char *format = "int %d double %lf str %s hex %hhx";
+    FormatMetadata *fm = makeMetadata(format, 42);
+    logMsg.reset(fm, 3, 0);
+    logMsg.push(-7);
+    logMsg.push(2.5);
+    logMsg.push("hello");
+    logMsg.push(static_cast<unsigned char>(0xff));
+    EXPECT_TRUE(writer.append(3, fm, format, 1000, 1, logMsg));
+
+    logMsg.reset(fm, 3, 0);
+    logMsg.push(8);
+    logMsg.push(-1.0);
+    logMsg.push("");
+    logMsg.push(static_cast<unsigned char>(1));
+    EXPECT_TRUE(writer.append(3, fm, format, 2000, 2, logMsg));
+
+    // The batch filled up and was written out
+    EXPECT_EQ(2U, writer.getNumRowsWritten());
+
+    logMsg.reset(fm, 3, 0);
+    logMsg.push(9);
+    logMsg.push(0.0);
+    logMsg.push("x");
+    logMsg.push(static_cast<unsigned char>(2));
+    EXPECT_TRUE(writer.append(3, fm, format, 3000, 1, logMsg));
+    EXPECT_EQ(2U, writer.getNumRowsWritten());
+
+    EXPECT_TRUE(writer.flush());
+    EXPECT_EQ(3U, writer.getNumRowsWritten());
+
+    const char *pos = buffer;
+    ColumnarFileHeader fileHeader = read<ColumnarFileHeader>(&pos);
+    EXPECT_EQ(0, memcmp(COLUMNAR_MAGIC, fileHeader.magic, 8));
+    EXPECT_EQ(COLUMNAR_VERSION, fileHeader.version);
+
+    ColumnarBatchHeader batch = read<ColumnarBatchHeader>(&pos);
+    EXPECT_EQ(3U, batch.logId);
+    EXPECT_EQ(0U, batch.execution);
+    EXPECT_EQ(2U, batch.numRows);
+    EXPECT_EQ(6U, batch.numColumns);
+    EXPECT_EQ(42U, batch.lineNumber);
+    EXPECT_EQ(2U, batch.logLevel);
+    ASSERT_EQ(strlen("file.cc") + 1, batch.filenameLength);
+    EXPECT_STREQ("file.cc", pos);
+    pos += batch.filenameLength;
+    ASSERT_EQ(strlen(format) + 1, batch.formatStringLength);
+    EXPECT_STREQ(format, pos);
+    pos += batch.formatStringLength;
+
+    ColumnHeader columns[6];
+    for (ColumnHeader &column : columns)
+        column = read<ColumnHeader>(&pos);
+
+    EXPECT_EQ(INT64_COLUMN, columns[0].type);
+    EXPECT_EQ(NONE, columns[0].argType);
+    EXPECT_EQ(UINT64_COLUMN, columns[1].type);
+    EXPECT_EQ(INT64_COLUMN, columns[2].type);
+    EXPECT_EQ(int_t, columns[2].argType);
+    EXPECT_EQ(DOUBLE_COLUMN, columns[3].type);
+    EXPECT_EQ(STRING_COLUMN, columns[4].type);
+    EXPECT_EQ(UINT64_COLUMN, columns[5].type);
+    EXPECT_EQ(unsigned_char_t, columns[5].argType);
+    for (int i = 0; i < 6; ++i) {
+        if (i != 4)
+            EXPECT_EQ(2*sizeof(uint64_t), columns[i].numBytes);
+    }
+    EXPECT_EQ(3*sizeof(uint64_t) + strlen("hello"), columns[4].numBytes);
+
+    const char *data[6];
+    for (int i = 0; i < 6; ++i) {
+        data[i] = pos;
+        pos += columns[i].numBytes;
+    }
+
+    EXPECT_EQ(1000, readColumnValue<int64_t>(data[0], 0));
+    EXPECT_EQ(2000, readColumnValue<int64_t>(data[0], 1));
+    EXPECT_EQ(1U, readColumnValue<uint64_t>(data[1], 0));
+    EXPECT_EQ(2U, readColumnValue<uint64_t>(data[1], 1));
+    EXPECT_EQ(-7, readColumnValue<int64_t>(data[2], 0));
+    EXPECT_EQ(8, readColumnValue<int64_t>(data[2], 1));
+    EXPECT_EQ(2.5, readColumnValue<double>(data[3], 0));
+    EXPECT_EQ(-1.0, readColumnValue<double>(data[3], 1));
+    EXPECT_EQ(0xffU, readColumnValue<uint64_t>(data[5], 0));
+    EXPECT_EQ(1U, readColumnValue<uint64_t>(data[5], 1));
+
+    EXPECT_EQ(0U, readColumnValue<uint64_t>(data[4], 0));
+    EXPECT_EQ(5U, readColumnValue<uint64_t>(data[4], 1));
+    EXPECT_EQ(5U, readColumnValue<uint64_t>(data[4], 2));
+    EXPECT_EQ("hello", std::string(data[4] + 3*sizeof(uint64_t), 5));
+
+    // The remaining row was written by flush()
+    batch = read<ColumnarBatchHeader>(&pos);
+    EXPECT_EQ(3U, batch.logId);
+    EXPECT_EQ(1U, batch.numRows);
+    pos += batch.filenameLength + batch.formatStringLength;
+    for (ColumnHeader &column : columns)
+        column = read<ColumnHeader>(&pos);
+    EXPECT_EQ(2*sizeof(uint64_t) + 1, columns[4].numBytes);
+    for (int i = 0; i < 6; ++i) {
+        data[i] = pos;
+        pos += columns[i].numBytes;
+    }
+    EXPECT_EQ(3000, readColumnValue<int64_t>(data[0], 0));
+    EXPECT_EQ(9, readColumnValue<int64_t>(data[2], 0));
+    EXPECT_EQ("x", std::string(data[4] + 2*sizeof(uint64_t), 1));
+
+    EXPECT_EQ(buffer + bufferSize, pos);
+}
+
+TEST_F(ColumnarWriterTest, startExecution) {
+    ColumnarWriter writer(fd);
+    LogMessage logMsg;
+
+    FormatMetadata *fm = makeMetadata("no arguments", 1);
+    logMsg.reset(fm, 0, 0);
+    EXPECT_TRUE(writer.append(0, fm, "no arguments", 5, 0, logMsg));
+    EXPECT_EQ(0U, writer.getNumRowsWritten());
+
+    EXPECT_TRUE(writer.startExecution());
+    EXPECT_EQ(1U, writer.getNumRowsWritten());
+    EXPECT_EQ(0U, writer.batches.size());
+
+    // The same logId may be a different LOG statement in the next execution
+    const char *format = "now %d";
+    fm = makeMetadata(format, 2);
+    logMsg.reset(fm, 0, 0);
+    logMsg.push(1);
+    EXPECT_TRUE(writer.append(0, fm, format, 6, 0, logMsg));
+    EXPECT_TRUE(writer.flush());
+    EXPECT_EQ(2U, writer.getNumRowsWritten());
+
+    const char *pos = buffer + sizeof(ColumnarFileHeader);
+    ColumnarBatchHeader batch = read<ColumnarBatchHeader>(&pos);
+    EXPECT_EQ(0U, batch.execution);
+    EXPECT_EQ(2U, batch.numColumns);
+    pos += batch.filenameLength + batch.formatStringLength
+                + 2*sizeof(ColumnHeader) + 2*sizeof(uint64_t);
+
+    batch = read<ColumnarBatchHeader>(&pos);
+    EXPECT_EQ(1U, batch.execution);
+    EXPECT_EQ(3U, batch.numColumns);
+    EXPECT_EQ(2U, batch.lineNumber);
+}
+
+TEST_F(ColumnarWriterTest, writeFailure) {
+    FILE *full = fopen("/dev/full", "w");
+    ASSERT_NE(nullptr, full);
+    setvbuf(full, nullptr, _IONBF, 0);
+
+    testing::internal::CaptureStderr();
+    {
+        ColumnarWriter writer(full);
+        EXPECT_FALSE(writer.good);
+        EXPECT_FALSE(writer.flush());
+    }
+    std::string output = testing::internal::GetCapturedStderr();
+    EXPECT_EQ("Columnar export failed to write 12 bytes: "
+              "No space left on device\r\n", output);
+    fclose(full);
+}
+
+}; // namespace
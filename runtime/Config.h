@@ -24,22 +24,75 @@
  */
 
 namespace NanoLogConfig {
-    // Controls in what mode the compressed log file will be opened
-    static const int FILE_PARAMS = O_APPEND|O_RDWR|O_CREAT|O_NOATIME|O_DSYNC;
+    // Controls in what mode the compressed log file will be opened. The
+    // flags for the durability mode (see NanoLog::setDurability()) are
+    // added on top of these.
+    static const int FILE_PARAMS = O_APPEND|O_RDWR|O_CREAT|O_NOATIME;
+
+    // Flush interval of the DURABILITY_PERIODIC mode when none is specified
+    // in NanoLog::setDurability()
+    static const uint32_t DEFAULT_SYNC_INTERVAL_MS = 100;
+
+    // Alignment of the writes (in size and file offset) and the buffers
+    // written from in the DURABILITY_DIRECT mode
+    static const uint32_t DIRECT_IO_ALIGNMENT = 512;
 
     // Location of the initial log file
     static const char DEFAULT_LOG_FILE[] = "./compressedLog";
 
-    // Determines the byte size of the per-thread StagingBuffer that decouples
-    // the producer logging thread from the consumer background compression
-    // thread. This value should be large enough to handle bursts of activity.
+    // Number of background threads that compress and output the log
+    // messages when the application starts. More threads can be configured
+    // at runtime via NanoLog::setCompressionThreads().
+    static const uint32_t DEFAULT_COMPRESSION_THREADS = 1;
+
+    // Upper bound on the number of background compression threads
+    static const uint32_t MAX_COMPRESSION_THREADS = 64;
+
+    // Upper bound on the number of log channels, including the default log
+    // (see NanoLog::createChannel()). Each channel has a compression thread
+    // of its own and every logging thread keeps a StagingBuffer pointer per
+    // channel.
+    static const uint32_t MAX_LOG_CHANNELS = 8;
+
+    // Determines the default byte size of the per-thread StagingBuffer that
+    // decouples the producer logging thread from the consumer background
+    // compression thread. This value should be large enough to handle bursts
+    // of activity. The size can be changed at runtime for all threads via
+    // NanoLog::setStagingBufferSize() or per thread via
+    // NanoLog::preallocate(size_t).
     static const uint32_t STAGING_BUFFER_SIZE = 1<<20;
 
-    // Determines the size of the output buffer used to store compressed log
-    // messages. It should be at least 8MB large to amortize disk seeks and
-    // shall not be smaller than STAGING_BUFFER_SIZE.
+    // Lower bound on the size of a StagingBuffer configured at runtime.
+    static const uint32_t MIN_STAGING_BUFFER_SIZE = 1<<12;
+
+    // Used by the opt-in adaptive StagingBuffer mode (see
+    // NanoLog::setAdaptiveStagingBufferLimit()). A thread's StagingBuffer is
+    // doubled in size once its producer has been blocked for a cumulative
+    // ADAPTIVE_GROWTH_BLOCKED_US waiting for space in it, and is returned to
+    // its original size once the producer has not been blocked for
+    // ADAPTIVE_SHRINK_QUIET_MS.
+    static const uint32_t ADAPTIVE_GROWTH_BLOCKED_US = 100;
+    static const uint32_t ADAPTIVE_SHRINK_QUIET_MS = 1000;
+
+    // Determines the default size of the output buffer used to store
+    // compressed log messages. It should be at least 8MB large to amortize
+    // disk seeks and shall not be smaller than the StagingBuffers. This can be
+    // changed at runtime via NanoLog::setOutputBufferSize().
     static const uint32_t OUTPUT_BUFFER_SIZE = 1<<26;
 
+    // Bounds on the size of an output buffer configured at runtime. Sizes
+    // are also rounded down to a multiple of OUTPUT_BUFFER_ALIGNMENT so
+    // that the buffers can be padded for O_DIRECT writes.
+    static const uint32_t MIN_OUTPUT_BUFFER_SIZE = 1<<20;
+    static const uint32_t MAX_OUTPUT_BUFFER_SIZE = 1<<30;
+    static const uint32_t OUTPUT_BUFFER_ALIGNMENT = 4096;
+
+    // Default number of output buffers in each compression thread's output
+    // ring. One buffer is compressed into while the rest can be in flight to
+    // the disk. This can be changed at runtime via
+    // NanoLog::setNumOutputBuffers().
+    static const uint32_t DEFAULT_NUM_OUTPUT_BUFFERS = 2;
+
     // This invariant must be true so that we can output at least one full
     // StagingBuffer per output buffer.
     static_assert(STAGING_BUFFER_SIZE <= OUTPUT_BUFFER_SIZE,
@@ -54,16 +107,51 @@ namespace NanoLogConfig {
     static const uint32_t RELEASE_THRESHOLD = STAGING_BUFFER_SIZE>>1;
 
     // How often should the background compression thread wake up to check
-    // for more log messages in the StagingBuffers to compress and output.
-    // Due to overheads in the kernel, this number will a lower bound and
-    // the actual time spent sleeping may be significantly higher.
+    // for more log messages in the StagingBuffers to compress and output
+    // while it still has output I/O in flight. Due to overheads in the
+    // kernel, this number will a lower bound and the actual time spent
+    // sleeping may be significantly higher.
     static const uint32_t POLL_INTERVAL_NO_WORK_US = 1;
 
+    // How long the background compression thread keeps polling the
+    // StagingBuffers after it runs out of work before it blocks on a futex
+    // until a producer wakes it up. Spinning for a bit keeps the thread
+    // responsive to bursts of log messages.
+    static const uint32_t IDLE_SPIN_US = 50;
+
+    // Upper bound on how long an idle background compression thread stays
+    // blocked before it checks the StagingBuffers again. Producers only wake
+    // the thread from their slow path, so this bounds the delay for a trickle
+    // of log messages that never leaves the fast path.
+    static const uint32_t IDLE_WAIT_TIMEOUT_US = 1000;
+
+    // Producers take the allocation slow path (where they wake up blocked
+    // compression threads) at least once every 1/WAKEUP_THRESHOLD_DIVISOR of
+    // their StagingBuffer's capacity.
+    static const uint32_t WAKEUP_THRESHOLD_DIVISOR = 16;
+
     // How often should the background compression thread wake up and
     // check for more log messages when it's stalled waiting for an IO
     // to complete. Due to overheads in the kernel, this number will
     // be a lower bound and the actual time spent sleeping may be higher.
     static const uint32_t POLL_INTERVAL_DURING_IO_US = 1;
+
+    // How long the sidecar of a shared memory sink sleeps when it finds no
+    // log messages in the StagingBuffers. Unlike the compression threads, it
+    // can't be woken up by the producers in another process.
+    static const uint32_t SIDECAR_POLL_INTERVAL_US = 100;
+
+    // Number of log invocation sites whose producer costs and compressed
+    // bytes are tracked individually when NanoLog is compiled with
+    // -DRECORD_LOG_SITE_STATS (see NanoLog::getLogSiteMetrics()). The sites
+    // with larger log identifiers are counted together.
+    static const uint32_t MAX_LOG_SITE_STATS = 4096;
+
+    // How often the background compression thread re-correlates the
+    // timestamp counter with the wall clock by writing a clock sync
+    // checkpoint to the log. This bounds how far the decompressor has to
+    // extrapolate wall time from rdtsc() in long running applications.
+    static const uint32_t CLOCK_SYNC_INTERVAL_SECONDS = 60;
 }
 
 #endif /* CONFIG_H */
@@ -13,8 +13,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <cpuid.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <string>
 #include <string.h>
 #include <stdio.h>
@@ -32,18 +35,204 @@ uint64_t Cycles::mockTscValue = 0;
 double Cycles::mockCyclesPerSec = 0;
 static Initialize _(Cycles::init);
 
+/**
+ * Returns the frequency of the timestamp counter reported by the processor
+ * in CPUID leaf 0x15 (or by the hypervisor in leaf 0x40000010), or 0 if it
+ * doesn't report one.
+ */
+static double
+readCpuidFrequency()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    // Leaf 0x15: TSC frequency = crystal frequency * ebx / eax
+    if (__get_cpuid_max(0, nullptr) >= 0x15) {
+        __cpuid(0x15, eax, ebx, ecx, edx);
+        if (eax != 0 && ebx != 0 && ecx != 0)
+            return static_cast<double>(ecx)*ebx/eax;
+    }
+
+    // Hypervisors (i.e. KVM and VMware) may report the frequency of the
+    // virtual TSC in kHz in leaf 0x40000010.
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (ecx & (1U << 31)) {
+        __cpuid(0x40000000, eax, ebx, ecx, edx);
+        if (eax >= 0x40000010) {
+            __cpuid(0x40000010, eax, ebx, ecx, edx);
+            if (eax != 0)
+                return 1000.0*eax;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the frequency of the timestamp counter the kernel calibrated at
+ * boot (exported by some kernels as tsc_freq_khz), or 0 if it's unavailable.
+ */
+static double
+readKernelFrequency()
+{
+    FILE *fd = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+    if (fd == NULL)
+        return 0;
+
+    unsigned long khz = 0;
+    if (fscanf(fd, "%lu", &khz) != 1)
+        khz = 0;
+    fclose(fd);
+    return 1000.0*static_cast<double>(khz);
+}
+
+/**
+ * Indicates whether the timestamp counter ticks at a constant rate regardless
+ * of the power state of the processor (CPUID 0x80000007 EDX bit 8), i.e. a
+ * calibration remains valid until the machine reboots.
+ */
+static bool
+isTscInvariant()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+        return false;
+
+    __cpuid(0x80000007, eax, ebx, ecx, edx);
+    return edx & (1U << 8);
+}
+
+/**
+ * Returns the identifier of the current boot of the machine, which a cached
+ * calibration has to match, or an empty string if it's unavailable.
+ */
+static std::string
+readBootId()
+{
+    char bootId[64] = {};
+    FILE *fd = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (fd == NULL)
+        return "";
+
+    if (fscanf(fd, "%63s", bootId) != 1)
+        bootId[0] = '\0';
+    fclose(fd);
+    return bootId;
+}
+
+/**
+ * Returns the file the calibration is cached in between executions.
+ */
+static std::string
+getCacheFile()
+{
+    return "/tmp/nanolog.cyclesPerSec." + std::to_string(getuid());
+}
+
+/**
+ * Indicates whether a frequency is plausible for a timestamp counter, which
+ * protects against corrupt sources.
+ */
+static bool
+isSane(double cyclesPerSec)
+{
+    return cyclesPerSec >= 1e8 && cyclesPerSec <= 1e11;
+}
+
+/**
+ * Returns the calibration cached by a previous execution during the current
+ * boot of the machine, or 0 if there's none.
+ */
+static double
+readCachedFrequency(const std::string &bootId)
+{
+    FILE *fd = fopen(getCacheFile().c_str(), "r");
+    if (fd == NULL)
+        return 0;
+
+    // Only trust a file written by this user
+    struct stat st;
+    char cachedBootId[64] = {};
+    double cyclesPerSec = 0;
+    if (fstat(fileno(fd), &st) != 0 || st.st_uid != getuid() ||
+            fscanf(fd, "%63s %lf", cachedBootId, &cyclesPerSec) != 2 ||
+            bootId != cachedBootId || !isSane(cyclesPerSec))
+        cyclesPerSec = 0;
+
+    fclose(fd);
+    return cyclesPerSec;
+}
+
+/**
+ * Caches a calibration for the following executions during the current
+ * boot of the machine. The file is replaced atomically so that concurrent
+ * executions never read a partially written one.
+ */
+static void
+writeCachedFrequency(const std::string &bootId, double cyclesPerSec)
+{
+    std::string file = getCacheFile();
+    std::string tmpFile = file + "." + std::to_string(getpid());
+    FILE *fd = fopen(tmpFile.c_str(), "w");
+    if (fd == NULL)
+        return;
+
+    bool ok = fprintf(fd, "%s %.3f\n", bootId.c_str(), cyclesPerSec) > 0;
+    ok &= (fclose(fd) == 0);
+    if (!ok || rename(tmpFile.c_str(), file.c_str()) != 0)
+        unlink(tmpFile.c_str());
+}
+
 /**
  * Perform once-only overall initialization for the Cycles class, such
  * as calibrating the clock frequency.  This method is invoked automatically
  * during initialization, but it may be invoked explicitly by other modules
  * to ensure that initialization occurs before those modules initialize
  * themselves.
+ *
+ * Calibrating the clock takes tens of milliseconds, so the frequency is
+ * taken from the processor (CPUID) or the kernel when they report it. Failing
+ * that, the calibration of an invariant timestamp counter is cached on disk
+ * and reused by later executions until the machine reboots.
  */
 void
 Cycles::init() {
     if (cyclesPerSec != 0)
         return;
 
+    double reported = readCpuidFrequency();
+    if (!isSane(reported))
+        reported = readKernelFrequency();
+
+    if (isSane(reported)) {
+        cyclesPerSec = reported;
+        return;
+    }
+
+    std::string bootId;
+    bool cacheable = isTscInvariant();
+    if (cacheable) {
+        bootId = readBootId();
+        cacheable = !bootId.empty();
+    }
+
+    if (cacheable) {
+        cyclesPerSec = readCachedFrequency(bootId);
+        if (cyclesPerSec != 0)
+            return;
+    }
+
+    calibrate();
+
+    if (cacheable && isSane(cyclesPerSec))
+        writeCachedFrequency(bootId, cyclesPerSec);
+}
+
+/**
+ * Measures the frequency of the fine-grained CPU timer against the system
+ * clock and stores it in cyclesPerSec.
+ */
+void
+Cycles::calibrate() {
     // Compute the frequency of the fine-grained CPU timer: to do this,
     // take parallel time readings using both rdtsc and gettimeofday.
     // After 10ms have elapsed, take the ratio between these readings.
@@ -63,6 +63,7 @@ class Cycles {
 
   private:
     Cycles();
+    static void calibrate();
 
     /// Conversion factor between cycles and the seconds; computed by
     /// Cycles::init.
@@ -13,13 +13,29 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <type_traits>
+#include <unordered_map>
 
 #include <bits/algorithmfwd.h>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include "Log.h"
+#include "BlockCompressor.h"
+#include "ColumnarWriter.h"
 #include "GeneratedCode.h"
 
 namespace NanoLogInternal {
@@ -39,23 +55,50 @@ static const char* logLevelNames[] = {"(none)", "ERROR", "WARNING",
  *      Output array to insert the checkpoint into
  * \param outLimit
  *      Pointer to the end of out (i.e. first invalid byte to write to)
+ * \param writeDictionary
+ *      Indicates whether the dictionary should follow the checkpoint
+ * \param outputBufferSize
+ *      Size of the output buffers the log following the checkpoint will be
+ *      encoded into (i.e. upper bound on the size of a BufferExtent)
+ * \param flags
+ *      Bitwise-or of the CheckpointFlags the log following the checkpoint
+ *      will be encoded with
  *
  * \return
  *      True if operation succeed, false if there's not enough space
  */
 bool
-Log::insertCheckpoint(char **out, char *outLimit, bool writeDictionary) {
+Log::insertCheckpoint(char **out, char *outLimit, bool writeDictionary,
+                      uint32_t outputBufferSize, uint32_t flags) {
     if (static_cast<uint64_t>(outLimit - *out) < sizeof(Checkpoint))
         return false;
 
     Checkpoint *ck = reinterpret_cast<Checkpoint*>(*out);
     *out += sizeof(Checkpoint);
 
+    // Bracket the wall time with two rdtsc()'s and keep the tightest of a
+    // few attempts, so that a preemption in between doesn't skew the
+    // correlation of the two clocks.
+    uint64_t bestSpan = UINT64_MAX;
+    for (int i = 0; i < 3; ++i) {
+        struct timespec now;
+        uint64_t before = PerfUtils::Cycles::rdtsc();
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t after = PerfUtils::Cycles::rdtsc();
+
+        if (after - before < bestSpan) {
+            bestSpan = after - before;
+            ck->rdtsc = before + bestSpan/2;
+            ck->unixTime = now.tv_sec;
+            ck->unixTimeNanos = now.tv_nsec;
+        }
+    }
+
     ck->entryType = Log::EntryType::CHECKPOINT;
-    ck->rdtsc = PerfUtils::Cycles::rdtsc();
-    ck->unixTime = std::time(nullptr);
     ck->cyclesPerSecond = PerfUtils::Cycles::getCyclesPerSec();
     ck->newMetadataBytes = ck->totalMetadataEntries = 0;
+    ck->outputBufferSize = outputBufferSize;
+    ck->flags = flags | PRECISE_TIME;
 
     if (!writeDictionary)
         return true;
@@ -77,6 +120,57 @@ Log::insertCheckpoint(char **out, char *outLimit, bool writeDictionary) {
 
     return true;
 }
+
+/**
+ * Returns the maximum number of bytes compressBlock() can produce for an
+ * input.
+ *
+ * \param nbytes
+ *      Number of bytes to compress
+ */
+size_t
+Log::maxCompressedBlockSize(size_t nbytes)
+{
+    return sizeof(CompressedBlock) + std::max(nbytes,
+                                    BlockCompressor::maxCompressedSize(nbytes));
+}
+
+/**
+ * Compresses the contents of an output buffer into a CompressedBlock. If the
+ * contents don't compress, they're stored as is.
+ *
+ * \param in
+ *      Contents of the output buffer (i.e. dictionary fragments and
+ *      BufferExtents) to compress
+ * \param nbytes
+ *      Number of bytes in the contents
+ * \param out
+ *      Buffer with at least maxCompressedBlockSize(nbytes) bytes of space to
+ *      write the CompressedBlock to
+ *
+ * \return
+ *      Number of bytes written to out
+ */
+size_t
+Log::compressBlock(const char *in, size_t nbytes, char *out)
+{
+    CompressedBlock *block = reinterpret_cast<CompressedBlock*>(out);
+    block->entryType = EntryType::LOG_MSGS_OR_DIC;
+    block->codec = LZ4_BLOCK;
+    block->uncompressedLength = downCast<uint32_t>(nbytes);
+
+    char *contents = out + sizeof(CompressedBlock);
+    size_t compressedBytes = BlockCompressor::compress(in, nbytes, contents);
+    if (compressedBytes >= nbytes) {
+        block->codec = STORED_BLOCK;
+        std::memcpy(contents, in, nbytes);
+        compressedBytes = nbytes;
+    }
+
+    block->compressedLength = downCast<uint32_t>(compressedBytes);
+    return sizeof(CompressedBlock) + compressedBytes;
+}
+
 /**
  * Encoder constructor. The construction of an Encoder should logically
  * correlate with the start of a new log file as it will embed unique metadata
@@ -90,11 +184,25 @@ Log::insertCheckpoint(char **out, char *outLimit, bool writeDictionary) {
  *      Optional parameter to skip embedding metadata information at the
  *      beginning of the buffer. This parameter should never bet set except
  *      in unit tests.
+ * \param forceDictionaryOutput
+ *      Write the dictionary after the checkpoint even when it's not that of
+ *      Preprocessor NanoLog
+ * \param deltaEncoding
+ *      Encode the arguments of log messages relative to the previous message
+ *      from the same log site (see BufferUtils::ArgumentHistory). The
+ *      functions generated by the preprocessor don't support this, so it
+ *      requires the version of encodeLogMsgs() that takes a dictionary.
+ * \param blockCompressed
+ *      Mark the log as BLOCK_COMPRESSED in the checkpoint; the caller is
+ *      responsible for splitting the encoded bytes following it into
+ *      CompressedBlocks (see compressBlock()).
  */
 Log::Encoder::Encoder(char *buffer,
                                 size_t bufferSize,
                                 bool skipCheckpoint,
-                                bool forceDictionaryOutput)
+                                bool forceDictionaryOutput,
+                                bool deltaEncoding,
+                                bool blockCompressed)
     : backing_buffer(buffer)
     , writePos(buffer)
     , endOfBuffer(buffer + bufferSize)
@@ -102,27 +210,132 @@ Log::Encoder::Encoder(char *buffer,
     , currentExtentSize(nullptr)
     , encodeMissDueToMetadata(0)
     , consecutiveEncodeMissesDueToMetadata(0)
+    , minTimestampEncoded(UINT64_MAX)
+    , maxTimestampEncoded(0)
+    , metadataEncoded(false)
+    , logIdsEncoded()
+    , wrapAroundsEncoded(0)
+    , deltaEncoding(deltaEncoding)
+    , argumentHistories()
+    , extentsEncoded(0)
+    , staticStrings()
+    , dictionaryEntriesEncoded(0)
+    , compressedBytesPerLogId(nullptr)
+#ifdef PREPROCESSOR_NANOLOG
+    , checkpointDictionary(true)
+#else
+    , checkpointDictionary(forceDictionaryOutput)
+#endif
+    , checkpointFlags(0)
+    , lastClockSyncCycles(0)
+    , lastClockSyncTime(0)
 {
     assert(buffer);
 
+    if (deltaEncoding)
+        checkpointFlags |= DELTA_ENCODED_ARGUMENTS;
+
+    if (blockCompressed)
+        checkpointFlags |= BLOCK_COMPRESSED;
+
     // Start the buffer off with a checkpoint
     if (skipCheckpoint && !forceDictionaryOutput)
         return;
 
-#ifdef PREPROCESSOR_NANOLOG
-    bool writeDictionary = true;
-#else
-    bool writeDictionary = forceDictionaryOutput;
-#endif
+    encodeCheckpoint();
+}
+
+/**
+ * Encodes a Checkpoint (followed by the dictionary for Preprocessor NanoLog)
+ * at the current position in the buffer.
+ */
+void
+Log::Encoder::encodeCheckpoint()
+{
+    Checkpoint *ck = reinterpret_cast<Checkpoint*>(writePos);
 
     // In virtually all cases, our output buffer should have enough
     // space to store the dictionary. If not, we fail in place.
-    if (!insertCheckpoint(&writePos, endOfBuffer, writeDictionary)) {
+    if (!insertCheckpoint(&writePos, endOfBuffer, checkpointDictionary,
+                          downCast<uint32_t>(endOfBuffer - backing_buffer),
+                          checkpointFlags)) {
         fprintf(stderr, "Internal Error: Not enough space allocated for "
                         "dictionary file.\r\n");
 
         exit(-1);
     }
+
+    // The Decoder starts over with an empty dictionary after a Checkpoint
+    staticStrings.clear();
+    dictionaryEntriesEncoded = 0;
+
+    lastClockSyncCycles = ck->rdtsc;
+    lastClockSyncTime = getCheckpointTime(*ck);
+    metadataEncoded = true;
+}
+
+/**
+ * Encodes a CLOCK_SYNC Checkpoint, which refreshes the correlation between
+ * rdtsc() and the wall time for the log messages that follow it without
+ * starting a new log. The Decoder converts the timestamps of log messages
+ * relative to the latest Checkpoint, so encoding these periodically bounds
+ * the error that accumulates from a cyclesPerSecond that's slightly off or
+ * from the timestamp counter drifting against the system clock over a long
+ * running application.
+ *
+ * The Checkpoint records the rate of rdtsc() measured against the wall time
+ * since the last Checkpoint, unless it deviates from the calibrated
+ * cyclesPerSecond by more than 0.1% (i.e. the system clock was stepped in
+ * between), in which case the calibrated rate is kept.
+ *
+ * 
+eturn
+ *      True if the Checkpoint was encoded, false if there's not enough
+ *      space in the buffer
+ */
+bool
+Log::Encoder::encodeClockSync()
+{
+    Checkpoint *ck = reinterpret_cast<Checkpoint*>(writePos);
+    if (!insertCheckpoint(&writePos, endOfBuffer, false,
+                          downCast<uint32_t>(endOfBuffer - backing_buffer),
+                          checkpointFlags | CLOCK_SYNC))
+        return false;
+
+    int64_t elapsedNs = getCheckpointTime(*ck) - lastClockSyncTime;
+    if (lastClockSyncCycles != 0 && elapsedNs > 0 &&
+            ck->rdtsc > lastClockSyncCycles) {
+        double measured = 1e9*static_cast<double>(
+                            ck->rdtsc - lastClockSyncCycles)/elapsedNs;
+        if (std::fabs(measured - ck->cyclesPerSecond) <
+                                                1e-3*ck->cyclesPerSecond)
+            ck->cyclesPerSecond = measured;
+    }
+
+    lastClockSyncCycles = ck->rdtsc;
+    lastClockSyncTime = getCheckpointTime(*ck);
+
+    // The next log message has to start a new BufferExtent, since the
+    // Checkpoint separates it from the current one.
+    lastBufferIdEncoded = -1;
+    currentExtentSize = nullptr;
+    metadataEncoded = true;
+    return true;
+}
+
+/**
+ * Starts a new log in the current (empty) buffer, as if the Encoder were just
+ * constructed on it; the buffer starts off with a Checkpoint so that the
+ * output from here on can be decoded on its own. This is used to start a new
+ * log file without tearing down the Encoder (see log rotation in the
+ * RuntimeLogger). Note that it's up to the caller to encode the dictionary
+ * entries again for C++17 NanoLog.
+ */
+void
+Log::Encoder::startNewLog()
+{
+    assert(writePos == backing_buffer);
+    encodeCheckpoint();
 }
 
 /**
@@ -139,7 +352,7 @@ Log::Encoder::Encoder(char *buffer,
  */
 uint32_t
 Log::Encoder::encodeNewDictionaryEntries(uint32_t& currentPosition,
-                                        std::vector<StaticLogInfo> allMetadata)
+                                const std::vector<StaticLogInfo>& allMetadata)
 {
     char *bufferStart = writePos;
 
@@ -152,7 +365,7 @@ Log::Encoder::encodeNewDictionaryEntries(uint32_t& currentPosition,
     df->entryType = EntryType::LOG_MSGS_OR_DIC;
 
     while (currentPosition < allMetadata.size()) {
-        StaticLogInfo &curr = allMetadata.at(currentPosition);
+        const StaticLogInfo &curr = allMetadata.at(currentPosition);
         size_t filenameLength = strlen(curr.filename) + 1;
         size_t formatLength = strlen(curr.formatString) + 1;
         size_t nextDictSize = sizeof(CompressedLogInfo)
@@ -180,9 +393,72 @@ Log::Encoder::encodeNewDictionaryEntries(uint32_t& currentPosition,
     df->newMetadataBytes = 0x3FFFFFFF & static_cast<uint32_t>(
                                                         writePos - bufferStart);
     df->totalMetadataEntries = currentPosition;
+    dictionaryEntriesEncoded = currentPosition;
+    metadataEncoded = true;
     return df->newMetadataBytes;
 }
 
+/**
+ * Encodes the strings logged via NanoLog::StaticStr that have yet to be
+ * written to the log into a dictionary fragment (see STATIC_STRING_ENTRY).
+ * The log messages refer to the strings by identifier, so the strings have to
+ * precede them in the log. Strings longer than a format string can be
+ * (i.e. 64KB) are truncated.
+ *
+ * 
+eturn
+ *      True if all the strings were encoded, false if the buffer ran out of
+ *      space first
+ */
+bool
+Log::Encoder::encodeStaticStrings()
+{
+    char *bufferStart = writePos;
+    if (sizeof(DictionaryFragment) >=
+                                static_cast<uint32_t>(endOfBuffer - writePos))
+        return false;
+
+    // The dictionary fragment ends the current BufferExtent
+    lastBufferIdEncoded = -1;
+    currentExtentSize = nullptr;
+
+    DictionaryFragment *df = reinterpret_cast<DictionaryFragment*>(writePos);
+    writePos += sizeof(DictionaryFragment);
+    df->entryType = EntryType::LOG_MSGS_OR_DIC;
+
+    while (staticStrings.hasUnpersisted()) {
+        uint32_t id = staticStrings.numPersisted;
+        const char *str = staticStrings.strings[id];
+        if (str == nullptr)
+            str = "(null)";
+
+        size_t length = strnlen(str, UINT16_MAX - 1);
+        size_t nextDictSize = sizeof(CompressedLogInfo) + length + 1;
+
+        if (nextDictSize >= static_cast<uint32_t>(endOfBuffer - writePos))
+            break;
+
+        CompressedLogInfo *cli = reinterpret_cast<CompressedLogInfo*>(writePos);
+        writePos += sizeof(CompressedLogInfo);
+
+        cli->severity = STATIC_STRING_ENTRY;
+        cli->linenum = id;
+        cli->filenameLength = 0;
+        cli->formatStringLength = static_cast<uint16_t>(length + 1);
+
+        memcpy(writePos, str, length);
+        writePos[length] = '\0';
+        writePos += length + 1;
+        ++staticStrings.numPersisted;
+    }
+
+    df->newMetadataBytes = 0x3FFFFFFF & static_cast<uint32_t>(
+                                                        writePos - bufferStart);
+    df->totalMetadataEntries = dictionaryEntriesEncoded;
+    metadataEncoded = true;
+    return !staticStrings.hasUnpersisted();
+}
+
 #ifdef PREPROCESSOR_NANOLOG
 /**
  * Interprets the uncompressed log messages (created by the compile-time
@@ -206,7 +482,9 @@ Log::Encoder::encodeNewDictionaryEntries(uint32_t& currentPosition,
  *
  * \return
  *      The number of bytes read from *from. A value of 0 indicates there is
- *      insufficient space in the internal buffer to fit the compressed message.
+ *      insufficient space in the internal buffer to fit the compressed message
+ *      or that the Encoder was asked to delta encode, which the generated
+ *      code doesn't support.
  */
 long
 Log::Encoder::encodeLogMsgs(char *from,
@@ -215,6 +493,12 @@ Log::Encoder::encodeLogMsgs(char *from,
                                     bool newPass,
                                     uint64_t *numEventsCompressed)
 {
+    if (deltaEncoding) {
+        fprintf(stderr, "NanoLog Error: Preprocessor NanoLog doesn't support "
+                        "delta encoding\r\n");
+        return 0;
+    }
+
     if (!encodeBufferExtentStart(bufferId, newPass))
         return 0;
 
@@ -248,13 +532,23 @@ Log::Encoder::encodeLogMsgs(char *from,
         if (maxCompressedSize > (endOfBuffer - writePos))
             break;
 
+        char *messageStart = writePos;
         compressLogHeader(entry, &writePos, lastTimestamp);
         lastTimestamp = entry->timestamp;
+        minTimestampEncoded = std::min(minTimestampEncoded, lastTimestamp);
+        maxTimestampEncoded = std::max(maxTimestampEncoded, lastTimestamp);
+        setLogIdBit(logIdsEncoded, entry->fmtId);
 
         size_t argBytesWritten =
             GeneratedFunctions::compressFnArray[entry->fmtId](entry, writePos);
         writePos += argBytesWritten;
 
+        if (compressedBytesPerLogId != nullptr) {
+            compressedBytesPerLogId[std::min(entry->fmtId,
+                    NanoLogConfig::MAX_LOG_SITE_STATS)] +=
+                                                    writePos - messageStart;
+        }
+
         remaining -= entry->entrySize;
         from += entry->entrySize;
 
@@ -308,7 +602,7 @@ Log::Encoder::encodeLogMsgs(char *from,
                             uint64_t nbytes,
                             uint32_t bufferId,
                             bool newPass,
-                            std::vector<StaticLogInfo> dictionary,
+                            const std::vector<StaticLogInfo>& dictionary,
                             uint64_t *numEventsCompressed)
 {
     if (!encodeBufferExtentStart(bufferId, newPass))
@@ -319,6 +613,16 @@ Log::Encoder::encodeLogMsgs(char *from,
     long numEventsProcessed = 0;
     char *bufferStart = writePos;
 
+    // Adds the log messages encoded since bufferStart to the length of the
+    // current BufferExtent
+    auto finishExtent = [&]() {
+        uint32_t currentSize;
+        std::memcpy(&currentSize, currentExtentSize, sizeof(uint32_t));
+        currentSize += downCast<uint32_t>(writePos - bufferStart);
+        std::memcpy(currentExtentSize, &currentSize, sizeof(uint32_t));
+        bufferStart = writePos;
+    };
+
     while (remaining > 0) {
         auto *entry = reinterpret_cast<UncompressedEntry*>(from);
 
@@ -353,7 +657,7 @@ Log::Encoder::encodeLogMsgs(char *from,
             if (entry->entrySize < (NanoLogConfig::STAGING_BUFFER_SIZE/2))
                 break;
 
-            StaticLogInfo &info = dictionary.at(entry->fmtId);
+            const StaticLogInfo &info = dictionary.at(entry->fmtId);
             fprintf(stderr, "NanoLog ERROR: Attempting to log a message that "
                             "is %u bytes while the maximum allowable size is "
                             "%u.\r\n This occurs for the log message %s:%u '%s'"
@@ -371,17 +675,52 @@ Log::Encoder::encodeLogMsgs(char *from,
         if (maxCompressedSize > (endOfBuffer - writePos))
             break;
 
+        char *messageStart = writePos;
         compressLogHeader(entry, &writePos, lastTimestamp);
         lastTimestamp = entry->timestamp;
+        minTimestampEncoded = std::min(minTimestampEncoded, lastTimestamp);
+        maxTimestampEncoded = std::max(maxTimestampEncoded, lastTimestamp);
+        setLogIdBit(logIdsEncoded, entry->fmtId);
 
-        StaticLogInfo &info = dictionary.at(entry->fmtId);
+        const StaticLogInfo &info = dictionary.at(entry->fmtId);
 #ifdef ENABLE_DEBUG_PRINTING
         printf("\r\nCompressing \'%s\' with info.id=%d\r\n",
                 info.formatString, entry->fmtId);
 #endif
+        BufferUtils::ArgumentHistory *history = nullptr;
+        if (deltaEncoding) {
+            if (argumentHistories.size() <= entry->fmtId)
+                argumentHistories.resize(dictionary.size());
+
+            history = &argumentHistories[entry->fmtId];
+            history->begin(extentsEncoded, info.numNibbles);
+        }
+
         char *argData = entry->argData;
         info.compressionFunction(info.numNibbles, info.paramTypes,
-                                        &argData, &writePos);
+                                        &argData, &writePos, history,
+                                        &staticStrings);
+
+        // The log message refers to static strings that have yet to be
+        // written to the dictionary, which has to precede it. The message is
+        // discarded and encoded again in a new BufferExtent after them.
+        if (staticStrings.hasUnpersisted()) {
+            writePos = messageStart;
+            finishExtent();
+            if (!encodeStaticStrings() ||
+                    !encodeBufferExtentStart(bufferId, false))
+                break;
+
+            bufferStart = writePos;
+            lastTimestamp = 0;
+            continue;
+        }
+
+        if (compressedBytesPerLogId != nullptr) {
+            compressedBytesPerLogId[std::min(entry->fmtId,
+                    NanoLogConfig::MAX_LOG_SITE_STATS)] +=
+                                                    writePos - messageStart;
+        }
 
         remaining -= entry->entrySize;
         from += entry->entrySize;
@@ -389,11 +728,10 @@ Log::Encoder::encodeLogMsgs(char *from,
         ++numEventsProcessed;
     }
 
-    assert(currentExtentSize);
-    uint32_t currentSize;
-    std::memcpy(&currentSize, currentExtentSize, sizeof(uint32_t));
-    currentSize += downCast<uint32_t>(writePos - bufferStart);
-    std::memcpy(currentExtentSize, &currentSize, sizeof(uint32_t));
+    // The BufferExtent is already finished if the static strings filled up
+    // the buffer
+    if (currentExtentSize != nullptr)
+        finishExtent();
 
     if (numEventsCompressed)
         *numEventsCompressed += numEventsProcessed;
@@ -430,6 +768,8 @@ Log::Encoder::encodeBufferExtentStart(uint32_t bufferId, bool newPass)
 
     tc->entryType = EntryType::BUFFER_EXTENT;
     tc->wrapAround = newPass;
+    if (newPass)
+        ++wrapAroundsEncoded;
 
     if (bufferId < (1<<4)) {
         tc->isShort = true;
@@ -443,6 +783,7 @@ Log::Encoder::encodeBufferExtentStart(uint32_t bufferId, bool newPass)
     tc->length = downCast<uint32_t>(writePos - writePosStart);
     currentExtentSize = &(tc->length);
     lastBufferIdEncoded = bufferId;
+    ++extentsEncoded;
 
     return true;
 }
@@ -458,6 +799,52 @@ Log::Encoder::getEncodedBytes() {
     return writePos - backing_buffer;
 }
 
+/**
+ * Retrieve the smallest and largest timestamps of the log messages encoded
+ * in the internal buffer. If there are none, *minTimestamp > *maxTimestamp.
+ *
+ * \param[out] minTimestamp
+ *      Smallest timestamp encoded in the internal buffer
+ * \param[out] maxTimestamp
+ *      Largest timestamp encoded in the internal buffer
+ */
+void
+Log::Encoder::getEncodedTimestampRange(uint64_t *minTimestamp,
+                                       uint64_t *maxTimestamp) {
+    *minTimestamp = minTimestampEncoded;
+    *maxTimestamp = maxTimestampEncoded;
+}
+
+/**
+ * Indicates whether a Checkpoint or dictionary fragment has been encoded in
+ * the internal buffer.
+ */
+bool
+Log::Encoder::hasEncodedMetadata() {
+    return metadataEncoded;
+}
+
+/**
+ * Retrieve a bitmap of the logIds of the log messages encoded in the
+ * internal buffer (see setLogIdBit()).
+ *
+ * \param[out] bitmap
+ *      Bitmap to copy the encoded logIds into
+ */
+void
+Log::Encoder::getEncodedLogIds(uint64_t (&bitmap)[INDEX_LOGID_WORDS]) {
+    memcpy(bitmap, logIdsEncoded, sizeof(logIdsEncoded));
+}
+
+/**
+ * Returns the number of BufferExtents marking a new pass through the
+ * StagingBuffers that have been encoded in the internal buffer.
+ */
+uint32_t
+Log::Encoder::getEncodedWrapArounds() {
+    return wrapAroundsEncoded;
+}
+
 /**
  * Releases the internal buffer and replaces it with a different one.
  *
@@ -483,6 +870,11 @@ Log::Encoder::swapBuffer(char *inBuffer, size_t inSize, char **outBuffer,
     endOfBuffer = inBuffer + inSize;
     lastBufferIdEncoded = -1;
     currentExtentSize = nullptr;
+    minTimestampEncoded = UINT64_MAX;
+    maxTimestampEncoded = 0;
+    metadataEncoded = false;
+    memset(logIdsEncoded, 0, sizeof(logIdsEncoded));
+    wrapAroundsEncoded = 0;
 
     if (outBuffer)
         *outBuffer = ret;
@@ -503,6 +895,8 @@ Log::LogMessage::LogMessage()
         , totalCapacity(sizeof(rawArgs)/sizeof(uint64_t))
         , rawArgs()
         , rawArgsExtension(nullptr)
+        , longDoubleArgs()
+        , textArgs()
 {}
 
 // Destructor for LogMessage
@@ -570,6 +964,9 @@ Log::LogMessage::reset(FormatMetadata *meta, uint32_t logId, uint64_t rdtsc)
     this->rdtsc = rdtsc;
     this->logId = logId;
     numArgs = 0;
+
+    longDoubleArgs.clear();
+    textArgs.clear();
 }
 
 // Indicates whether the structure stores a valid log statement or not
@@ -595,12 +992,22 @@ uint64_t Log::LogMessage::getTimestamp() {
 /**
  * Decoder constructor.
  *
- * Due to the large amount of memory needed to buffer log statements, the
- * decoder is intended to be constructed once and then re-used via open().
+ * The decoder is intended to be constructed once and then re-used via open()
+ * since the buffers it grows to hold the log metadata and BufferExtents are
+ * kept across files.
  */
 Log::Decoder::Decoder()
     : filename()
     , inputFd(nullptr)
+    , mappedLog(nullptr)
+    , mappedLogSize(0)
+    , compressedLogFd(-1)
+    , compressedLogOffset(0)
+    , inCompressedBlocks(false)
+    , maxBlockSize(0)
+    , inflatedLogSize(0)
+    , compressedEntry()
+    , inflatedEntry()
     , logMsgsPrinted(0)
     , bufferFragment(nullptr)
     , good(false)
@@ -608,24 +1015,31 @@ Log::Decoder::Decoder()
     , freeBuffers()
     , fmtId2metadata()
     , fmtId2fmtString()
+    , fmtId2formatOps()
+    , staticStrings()
     , rawMetadata(nullptr)
     , endOfRawMetadata(nullptr)
+    , rawMetadataSize(0)
     , numBufferFragmentsRead(0)
     , numCheckpointsRead(0)
+    , timeRangeStart(0)
+    , timeRangeEnd(UINT64_MAX)
+    , cyclesRangeStart(0)
+    , cyclesRangeEnd(UINT64_MAX)
+    , inputLimit(UINT64_MAX)
+    , logFilterSet(false)
+    , logFilterId(-1)
+    , logFilterLevel(-1)
+    , logFilterFilename()
+    , logIdSelected()
+    , selectedLogIds()
+    , index()
+    , nextIndexEntry(0)
+    , numOutputBuffersSkipped(0)
+    , follow(false)
+    , followIdleTimeoutMs(-1)
+    , inotifyFd(-1)
 {
-    // Take advantage of virtual memory an allocate an insanely large (1GB)
-    // buffer to store log metadata read from the logFile. Such a large buffer
-    // is used so that we don't have to explicitly manage the buffer and instead
-    // leave it up to the virtual memory system.
-    rawMetadata = static_cast<char*>(malloc(1024*1024*1024));
-
-    if (rawMetadata == nullptr) {
-        fprintf(stderr, "Could not allocate an internal 1GB buffer to store log"
-                " metadata");
-        exit(-1);
-    }
-
-    endOfRawMetadata = rawMetadata;
     fmtId2metadata.reserve(1000);
     fmtId2fmtString.reserve(1000);
     bufferFragment = allocateBufferFragment();
@@ -651,17 +1065,37 @@ Log::Decoder::readDictionary(FILE *fd, bool flushOldDictionary) {
         return false;
     }
 
+    updateTimeRangeCycles();
+
+    // A clock sync only refreshes the checkpoint; the dictionary and the
+    // execution carry on.
+    if (checkpoint.flags & CLOCK_SYNC)
+        return true;
+
+    // Restored on failure, though a flushed dictionary may be clobbered
+    uint64_t oldBytes = endOfRawMetadata - rawMetadata;
+    if (flushOldDictionary)
+        endOfRawMetadata = rawMetadata;
+
+    if (!reserveMetadataSpace(checkpoint.newMetadataBytes)) {
+        endOfRawMetadata = rawMetadata + oldBytes;
+        return false;
+    }
+
     size_t bytesRead = fread(endOfRawMetadata, 1, checkpoint.newMetadataBytes,
                              fd);
     if (bytesRead != checkpoint.newMetadataBytes) {
         fprintf(stderr, "Error couldn't read metadata header in log file.\r\n");
+        endOfRawMetadata = rawMetadata + oldBytes;
         return false;
     }
 
     if (flushOldDictionary) {
-        endOfRawMetadata = rawMetadata;
         fmtId2metadata.clear();
         fmtId2fmtString.clear();
+        fmtId2formatOps.clear();
+        staticStrings.clear();
+        logIdSelected.clear();
     }
 
     // Build an index of format id to metadata
@@ -684,6 +1118,9 @@ Log::Decoder::readDictionary(FILE *fd, bool flushOldDictionary) {
         }
 
         fmtId2fmtString.push_back(fmtString);
+        fmtId2formatOps.emplace_back();
+        if (newEnd >= endOfRawMetadata)
+            compileFormat(fm, fmtId2formatOps.back());
     }
 
     if (newEnd != endOfRawMetadata) {
@@ -706,6 +1143,41 @@ Log::Decoder::readDictionary(FILE *fd, bool flushOldDictionary) {
     return true;
 }
 
+/**
+ * Ensures that rawMetadata has room for nbytes more bytes past
+ * endOfRawMetadata, growing it if necessary. Growing the buffer moves it, so
+ * the pointers in fmtId2metadata are rebased and any other FormatMetadata
+ * pointers into it are invalidated.
+ *
+ * \param nbytes
+ *      Number of bytes needed
+ * \return
+ *      true if successful, false if the memory could not be allocated
+ */
+bool
+Log::Decoder::reserveMetadataSpace(uint64_t nbytes) {
+    uint64_t used = endOfRawMetadata - rawMetadata;
+    if (used + nbytes <= rawMetadataSize)
+        return true;
+
+    uint64_t newSize = std::max(used + nbytes, 2*rawMetadataSize);
+    newSize = std::max<uint64_t>(newSize, 64*1024);
+    char *newMetadata = static_cast<char*>(realloc(rawMetadata, newSize));
+    if (newMetadata == nullptr) {
+        fprintf(stderr, "Error: Could not allocate %lu bytes to store the log "
+                        "metadata\r\n", newSize);
+        return false;
+    }
+
+    for (void *&fm : fmtId2metadata)
+        fm = newMetadata + (static_cast<char*>(fm) - rawMetadata);
+
+    rawMetadata = newMetadata;
+    endOfRawMetadata = rawMetadata + used;
+    rawMetadataSize = newSize;
+    return true;
+}
+
 /**
  * Parses the <length> and <specifier> components of a printf format sub-string
  * according to http://www.cplusplus.com/reference/cstdio/printf/ and returns
@@ -845,11 +1317,12 @@ Log::Decoder::createMicroCode(char **microCode,
     fm->numPrintFragments = 0;
 
     std::regex regex("^%"
-                     "([-+ #0]+)?" // Flags (Position 1)
-                     "([\\d]+|\\*)?" // Width (Position 2)
-                     "(\\.(\\d+|\\*))?"// Precision (Position 4; 3 includes '.')
-                     "(hh|h|l|ll|j|z|Z|t|L)?" // Length (Position 5)
-                     "([diuoxXfFeEgGaAcspn])"// Specifier (Position 6)
+                     "(\\{[^}%]*\\})?" // User-defined type (Position 1)
+                     "([-+ #0]+)?" // Flags (Position 2)
+                     "([\\d]+|\\*)?" // Width (Position 3)
+                     "(\\.(\\d+|\\*))?"// Precision (Position 5; 4 includes '.')
+                     "(hh|h|l|ll|j|z|Z|t|L)?" // Length (Position 6)
+                     "([diuoxXfFeEgGaAcspn])"// Specifier (Position 7)
                      );
 
     size_t i = 0;
@@ -894,12 +1367,22 @@ Log::Decoder::createMicroCode(char **microCode,
         pf = reinterpret_cast<PrintFragment*>(*microCode);
         *microCode += sizeof(PrintFragment);
 
-        std::string width = match[2].str();
-        std::string precision = match[4].str();
-        std::string length = match[5].str();
-        char specifier = match[6].str()[0];
+        bool isCustom = match[1].matched;
+        std::string width = match[3].str();
+        std::string precision = match[5].str();
+        std::string length = match[6].str();
+        char specifier = match[7].str()[0];
 
+        // Arguments of user-defined types are tagged with their type name,
+        // i.e. "%{Price}s" (see NanoLog::Serializer)
         FormatType type = getFormatType(length, specifier);
+        if (isCustom && (specifier != 's' || !length.empty()))
+            type = MAX_FORMAT_TYPE;
+        else if (isCustom)
+            type = (match[1].str() == std::string("{")
+                                      + STATIC_STRING_TYPE_NAME + "}")
+                        ? static_str_t : custom_t;
+
         if (type == MAX_FORMAT_TYPE) {
             fprintf(stderr, "Error: Couldn't process this: %s\r\n",
                     match.str().c_str());
@@ -921,8 +1404,9 @@ Log::Decoder::createMicroCode(char **microCode,
         *microCode += pf->fragmentLength;
         *(*microCode - 1) = '\0';
 
-        // Non-strings and dynamic widths need nibbles!
-        if (specifier != 's')
+        // Non-strings, the sizes of user-defined types, the identifiers of
+        // static strings and dynamic widths need nibbles!
+        if (specifier != 's' || isCustom)
             ++fm->numNibbles;
 
         if (pf->hasDynamicWidth)
@@ -978,6 +1462,250 @@ Log::Decoder::createMicroCode(char **microCode,
     return true;
 }
 
+/**
+ * Resolves "%%" escapes in a part of a PrintFragment without a specifier.
+ *
+ * \param[in/out] c
+ *      Position in the format fragment to start at; it's advanced to the end
+ *      of the fragment or to the first '%' that starts a specifier.
+ * \param[out] text
+ *      String to append the text to
+ */
+static void
+appendFormatText(const char **c, std::string &text)
+{
+    while (**c != '\0') {
+        if ((*c)[0] == '%' && (*c)[1] == '%') {
+            text.push_back('%');
+            *c += 2;
+        } else if ((*c)[0] == '%') {
+            return;
+        } else {
+            text.push_back(*(*c)++);
+        }
+    }
+}
+
+/**
+ * Compiles the PrintFragments of a FormatMetadata (see createMicroCode())
+ * into FormatOps so that decompressNextLogStatement() can render the log
+ * messages without parsing the fragments at runtime. Conversions that aren't
+ * rendered natively (i.e. %p, %a and wide characters) are marked to fall
+ * back to snprintf.
+ *
+ * \param metadata
+ *      FormatMetadata to compile
+ * \param[out] ops
+ *      The FormatOps, one per PrintFragment
+ */
+void
+Log::Decoder::compileFormat(const FormatMetadata *metadata,
+                            std::vector<FormatOp> &ops)
+{
+    ops.clear();
+    ops.resize(metadata->numPrintFragments);
+
+    const char *nextFragment = reinterpret_cast<const char*>(metadata)
+                                        + sizeof(FormatMetadata)
+                                        + metadata->filenameLength;
+    for (FormatOp &op : ops) {
+        auto *pf = reinterpret_cast<const PrintFragment*>(nextFragment);
+        nextFragment += sizeof(PrintFragment) + pf->fragmentLength;
+
+        const char *c = pf->formatFragment;
+        appendFormatText(&c, op.literal);
+        if (*c == '\0')
+            continue;
+
+        // Fragments without arguments shouldn't contain a specifier; it's
+        // passed through as is.
+        const char *specifierStart = c;
+        if (pf->argType == NONE) {
+            op.specifier = specifierStart;
+            op.useSnprintf = true;
+            continue;
+        }
+
+        // Skip the type name of an argument of a user-defined type (it's
+        // looked up when the argument is formatted, see formatCustomArg())
+        // or of a static string
+        ++c;
+        if ((pf->argType == custom_t || pf->argType == static_str_t) &&
+                *c == '{')
+            c = strchr(c, '}') + 1;
+
+        for (; ; ++c) {
+            if (*c == '-')
+                op.leftAlign = true;
+            else if (*c == '+')
+                op.forceSign = true;
+            else if (*c == ' ')
+                op.spaceSign = true;
+            else if (*c == '#')
+                op.alternateForm = true;
+            else if (*c == '0')
+                op.zeroPad = true;
+            else
+                break;
+        }
+
+        if (*c == '*') {
+            op.dynamicWidth = true;
+            ++c;
+        } else if (isdigit(*c)) {
+            op.width = 0;
+            while (isdigit(*c))
+                op.width = 10*op.width + (*c++ - '0');
+        }
+
+        if (*c == '.') {
+            ++c;
+            if (*c == '*') {
+                op.dynamicPrecision = true;
+                ++c;
+            } else {
+                op.precision = 0;
+                while (isdigit(*c))
+                    op.precision = 10*op.precision + (*c++ - '0');
+            }
+        }
+
+        while (*c != '\0' && strchr("hlLjzZt", *c) != nullptr)
+            ++c;
+
+        op.conversion = *c;
+        if (*c != '\0')
+            ++c;
+
+        op.specifier.assign(specifierStart, c);
+        appendFormatText(&c, op.suffix);
+
+        // Another specifier follows; let snprintf deal with the whole thing
+        if (*c != '\0') {
+            op.specifier = specifierStart;
+            op.suffix.clear();
+            op.useSnprintf = true;
+            continue;
+        }
+
+        switch (op.conversion) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+                op.useSnprintf = (pf->argType == double_t ||
+                                  pf->argType == long_double_t ||
+                                  pf->argType == const_void_ptr_t ||
+                                  pf->argType == const_char_ptr_t ||
+                                  pf->argType == const_wchar_t_ptr_t);
+                break;
+            case 'c':
+                op.useSnprintf = (pf->argType != int_t || op.zeroPad);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+                op.useSnprintf = (pf->argType != double_t &&
+                                  pf->argType != long_double_t) ||
+                                 op.alternateForm;
+                break;
+            case 's':
+                op.useSnprintf = (pf->argType != const_char_ptr_t ||
+                                  op.zeroPad) && pf->argType != custom_t &&
+                                 pf->argType != static_str_t;
+                break;
+            default:
+                op.useSnprintf = true;
+                break;
+        }
+    }
+}
+
+/**
+ * Returns the ArgumentFormatters registered with
+ * Decoder::registerArgumentFormatter(), indexed by type name.
+ */
+static std::unordered_map<std::string, Log::Decoder::ArgumentFormatter> &
+getArgumentFormatters()
+{
+    static std::unordered_map<std::string, Log::Decoder::ArgumentFormatter>
+                                                                formatters;
+    return formatters;
+}
+
+/**
+ * Registers a function to format the arguments of a user-defined type (see
+ * NanoLog::Serializer) in the log messages decompressed by all Decoders from
+ * now on. This is not thread safe and must be invoked before the
+ * decompression starts.
+ *
+ * \param typeName
+ *      Name the type is logged with (i.e. NanoLog::Serializer<T>::name)
+ * \param formatter
+ *      Function to format the arguments with, or nullptr to print their bytes
+ *      in hexadecimal again
+ */
+void
+Log::Decoder::registerArgumentFormatter(const char *typeName,
+                                        ArgumentFormatter formatter)
+{
+    if (formatter == nullptr)
+        getArgumentFormatters().erase(typeName);
+    else
+        getArgumentFormatters()[typeName] = formatter;
+}
+
+/**
+ * Appends the human-readable form of an argument of a user-defined type to a
+ * string with the ArgumentFormatter registered for the type, or its bytes in
+ * hexadecimal if there's none (see formatBytes()).
+ *
+ * \param typeName
+ *      Name the type is logged with (i.e. NanoLog::Serializer<T>::name)
+ * \param data
+ *      Bytes of the argument
+ * \param size
+ *      Number of bytes in data
+ * \param[out] out
+ *      String to append to
+ */
+void
+Log::Decoder::formatArgument(const std::string &typeName, const void *data,
+                             uint32_t size, std::string &out)
+{
+    auto &formatters = getArgumentFormatters();
+    auto it = formatters.find(typeName);
+    if (it == formatters.end())
+        formatBytes(typeName, data, size, out);
+    else
+        it->second(data, size, out);
+}
+
+/**
+ * Appends the bytes of an argument of a user-defined type to a string in
+ * hexadecimal, in the order they're stored in memory, after the type's name
+ * (i.e. "Price{2a00000000000000fe}").
+ *
+ * \param typeName
+ *      Name the type is logged with
+ * \param data
+ *      Bytes of the argument
+ * \param size
+ *      Number of bytes in data
+ * \param[out] out
+ *      String to append to
+ */
+void
+Log::Decoder::formatBytes(const std::string &typeName, const void *data,
+                          uint32_t size, std::string &out)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    auto *bytes = static_cast<const uint8_t*>(data);
+
+    out.append(typeName);
+    out.push_back('{');
+    for (uint32_t i = 0; i < size; ++i) {
+        out.push_back(hexDigits[bytes[i] >> 4]);
+        out.push_back(hexDigits[bytes[i] & 0xF]);
+    }
+    out.push_back('}');
+}
+
 /**
  * Reads a partial dictionary from the log file and adds it to the global
  * mapping of log identifiers to static log information.
@@ -1057,6 +1785,33 @@ Log::Decoder::readDictionaryFragment(FILE *fd) {
             return false;
         }
 
+        // The strings logged via NanoLog::StaticStr are numbered in order
+        if (cli.severity == STATIC_STRING_ENTRY) {
+            if (cli.linenum != staticStrings.size() ||
+                    cli.formatStringLength == 0) {
+                fprintf(stderr, "Error: Corrupt static string #%u in the "
+                                "dictionary\r\n", cli.linenum);
+                return false;
+            }
+
+            staticStrings.emplace_back(format, cli.formatStringLength - 1);
+            continue;
+        }
+
+        // Upper bound on the size of the micro code: each PrintFragment
+        // holds at least 2 characters of the format string (a specifier)
+        // plus a null terminator.
+        uint64_t maxMicroCodeBytes = sizeof(FormatMetadata)
+                    + cli.filenameLength + 1
+                    + (cli.formatStringLength + 1)*(sizeof(PrintFragment) + 2);
+        if (!reserveMetadataSpace(maxMicroCodeBytes)) {
+            if (newBuffersAllocated) {
+                free(filename);
+                free(format);
+            }
+            return false;
+        }
+
         fmtId2metadata.push_back(endOfRawMetadata);
         fmtId2fmtString.push_back(format);
         createMicroCode(&endOfRawMetadata,
@@ -1064,6 +1819,9 @@ Log::Decoder::readDictionaryFragment(FILE *fd) {
                             filename,
                             cli.linenum,
                             cli.severity);
+        fmtId2formatOps.emplace_back();
+        compileFormat(reinterpret_cast<FormatMetadata*>(fmtId2metadata.back()),
+                      fmtId2formatOps.back());
     }
 
     if (newBuffersAllocated) {
@@ -1084,18 +1842,61 @@ Log::Decoder::readDictionaryFragment(FILE *fd) {
  */
 bool
 Log::Decoder::open(const char *filename) {
+    close();
     inputFd = fopen(filename, "rb");
     good = false;
 
     if (!inputFd)
         return false;
 
-    if(!readDictionary(inputFd, true)) {
+    // A BLOCK_COMPRESSED log is decompressed into a scratch file, which is
+    // then read in place of the log
+    if (isBlockCompressed()) {
+        compressedLogFd = dup(fileno(inputFd));
         fclose(inputFd);
-        inputFd = nullptr;
-        return false;
-    }
-
+        inputFd = tmpfile();
+        if (compressedLogFd < 0 || inputFd == nullptr) {
+            perror("Error: Could not set up the decompression of the block "
+                   "compressed log");
+            close();
+            return false;
+        }
+
+        compressedLogOffset = 0;
+        inCompressedBlocks = false;
+        maxBlockSize = 0;
+        inflatedLogSize = 0;
+        inflateLog();
+    }
+
+    timeRangeStart = 0;
+    timeRangeEnd = UINT64_MAX;
+    inputLimit = UINT64_MAX;
+    logFilterSet = false;
+    logIdSelected.clear();
+    index.clear();
+    nextIndexEntry = 0;
+    numOutputBuffersSkipped = 0;
+
+    // Map the log so that BufferExtents can be decompressed without copying
+    // them out; if it can't be mapped (i.e. it's a pipe), they're read in.
+    struct stat st;
+    if (fstat(fileno(inputFd), &st) == 0 && S_ISREG(st.st_mode)
+                                         && st.st_size > 0) {
+        void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                         fileno(inputFd), 0);
+        if (mem != MAP_FAILED) {
+            madvise(mem, st.st_size, MADV_SEQUENTIAL);
+            mappedLog = static_cast<const char*>(mem);
+            mappedLogSize = st.st_size;
+        }
+    }
+
+    if(!readDictionary(inputFd, true)) {
+        close();
+        return false;
+    }
+
     this->filename = std::string(filename);
     numBufferFragmentsRead = 0;
     numCheckpointsRead = 1;
@@ -1103,21 +1904,843 @@ Log::Decoder::open(const char *filename) {
     good = true;
     return true;
 }
+
 /**
- * Decoder destructor
+ * Restricts the log messages output by decompressTo(), decompressUnordered()
+ * and getNextLogStatement() to the ones logged within a wall time range.
+ * This should be invoked after open() and before decompressing anything.
+ *
+ * If the log is accompanied by an index file (see IndexEntry), the Decoder
+ * seeks directly to the first output buffer that could contain messages in
+ * the range and stops after the last one, so only that portion of the log
+ * (and the dictionary entries preceding it) is read. Otherwise, the entire
+ * log is decompressed and the messages outside of the range are discarded.
+ *
+ * \param startTime
+ *      Start of the range in nanoseconds since the Unix epoch (inclusive)
+ * \param endTime
+ *      End of the range in nanoseconds since the Unix epoch (inclusive)
+ *
+ * \return
+ *      true if successful; false if no log is open or the log is corrupt
  */
-Log::Decoder::~Decoder() {
+bool
+Log::Decoder::setTimeRange(uint64_t startTime, uint64_t endTime)
+{
+    if (filename.empty() || !inputFd || !good)
+        return false;
+
+    timeRangeStart = startTime;
+    timeRangeEnd = endTime;
+    inputLimit = UINT64_MAX;
+    updateTimeRangeCycles();
+
+    if (index.empty() && !readIndex(index))
+        return true;
+
+    // Find the range of output buffers that overlap the time range. The
+    // checkpoint (and thus the translation to rdtsc()) changes with each
+    // execution appended to the log.
+    Checkpoint savedCheckpoint = checkpoint;
+    uint64_t lastCheckpointOffset = UINT64_MAX;
+    size_t first = index.size(), last = 0;
+    for (size_t i = 0; i < index.size(); ++i) {
+        const IndexEntry &ie = index[i];
+        if (ie.checkpointOffset != lastCheckpointOffset) {
+            std::memcpy(&checkpoint, mappedLog + ie.checkpointOffset,
+                        sizeof(Checkpoint));
+            updateTimeRangeCycles();
+            lastCheckpointOffset = ie.checkpointOffset;
+        }
+
+        if (ie.minTimestamp > ie.maxTimestamp ||
+                ie.maxTimestamp < cyclesRangeStart ||
+                ie.minTimestamp > cyclesRangeEnd)
+            continue;
+
+        if (first == index.size())
+            first = i;
+        last = i;
+    }
+
+    checkpoint = savedCheckpoint;
+    updateTimeRangeCycles();
+
+    // Nothing in the log falls within the range
+    uint64_t position = ftell(inputFd);
+    if (first == index.size()) {
+        inputLimit = position;
+        return true;
+    }
+
+    // Load the checkpoint and dictionary entries that the first output buffer
+    // in the range depends on before seeking to it.
+    const IndexEntry &start = index[first];
+    if (start.offset > position) {
+        for (size_t i = 0; i < first; ++i) {
+            const IndexEntry &ie = index[i];
+            if (ie.checkpointOffset != start.checkpointOffset
+                                                    || !ie.hasMetadata)
+                continue;
+
+            good = readMetadataBetween(ie.offset, ie.offset + ie.length);
+            if (!good)
+                return false;
+        }
+
+        fseek(inputFd, start.offset, SEEK_SET);
+    }
+
+    inputLimit = index[last].offset + index[last].length;
+    return true;
+}
+
+/**
+ * Restricts the log messages output by decompressTo(), decompressUnordered()
+ * and getNextLogStatement() to the ones whose LOG statement matches all of
+ * the given criteria. This should be invoked after open() and before
+ * decompressing anything; it can be combined with setTimeRange().
+ *
+ * If the log is accompanied by an index file (see IndexEntry), the output
+ * buffers that contain no matching log messages are skipped over without
+ * being decompressed. Otherwise, the entire log is decompressed and the
+ * messages that don't match are discarded.
+ *
+ * \param logId
+ *      Only select the log messages with this logId; -1 selects any
+ * \param logLevel
+ *      Only select the log messages at this LogLevel or a more severe one
+ *      (i.e. ERROR only selects ERROR messages); -1 selects any
+ * \param sourceFile
+ *      Only select the log messages from source files whose name contains
+ *      this string; nullptr selects any
+ *
+ * \return
+ *      true if successful; false if no log is open
+ */
+bool
+Log::Decoder::setLogFilter(long logId, int logLevel, const char *sourceFile)
+{
+    if (filename.empty() || !inputFd || !good)
+        return false;
+
+    logFilterId = logId;
+    logFilterLevel = logLevel;
+    logFilterFilename = (sourceFile) ? sourceFile : "";
+    logFilterSet = (logId >= 0 || logLevel >= 0 || !logFilterFilename.empty());
+    updateLogFilter();
+
+    if (index.empty())
+        readIndex(index);
+
+    return true;
+}
+
+/**
+ * Puts getNextLogStatement() into (or takes it out of) follow mode, similar
+ * to "tail -f". In follow mode, reaching the end of the log file doesn't end
+ * the decompression; instead, getNextLogStatement() flushes its output and
+ * blocks until the application logging to the file appends more entries
+ * (BufferExtents, dictionary fragments or the Checkpoint of a new execution).
+ * Entries that have only been partially written are left alone until they
+ * have been written in their entirety. Since the log keeps growing, the end
+ * of a time range set with setTimeRange() only filters the log messages
+ * rather than ending the decompression.
+ *
+ * \param follow
+ *      Enables (true) or disables (false) follow mode
+ * \param idleTimeoutMs
+ *      Number of milliseconds to wait for the log file to grow before
+ *      getNextLogStatement() gives up and returns false; -1 waits forever
+ */
+void
+Log::Decoder::setFollow(bool follow, int idleTimeoutMs)
+{
+    this->follow = follow;
+    followIdleTimeoutMs = idleTimeoutMs;
+}
+
+/**
+ * Rebuilds logIdSelected and selectedLogIds by matching the LOG statements
+ * in the current dictionary against the setLogFilter() criteria.
+ */
+void
+Log::Decoder::updateLogFilter()
+{
+    size_t numLogIds = fmtId2metadata.size();
+#ifdef PREPROCESSOR_NANOLOG
+    if (fmtId2metadata.empty())
+        numLogIds = GeneratedFunctions::numLogIds;
+#endif
+
+    logIdSelected.assign(numLogIds, false);
+    memset(selectedLogIds, 0, sizeof(selectedLogIds));
+    for (uint32_t id = 0; id < numLogIds; ++id) {
+        int logLevel;
+        const char *sourceFile;
+#ifdef PREPROCESSOR_NANOLOG
+        if (fmtId2metadata.empty()) {
+            const auto &meta = GeneratedFunctions::logId2Metadata[id];
+            logLevel = meta.logLevel;
+            sourceFile = meta.fileName;
+        } else
+#endif
+        {
+            auto *fm = reinterpret_cast<FormatMetadata*>(fmtId2metadata[id]);
+            logLevel = fm->logLevel;
+            sourceFile = fm->filename;
+        }
+
+        if ((logFilterId < 0 || logFilterId == id) &&
+                (logFilterLevel < 0 || logLevel <= logFilterLevel) &&
+                strstr(sourceFile, logFilterFilename.c_str()) != nullptr) {
+            logIdSelected[id] = true;
+            setLogIdBit(selectedLogIds, id);
+        }
+    }
+}
+
+/**
+ * Indicates whether the log messages with a given logId match the
+ * setLogFilter() criteria.
+ *
+ * \param logId
+ *      logId to check
+ */
+bool
+Log::Decoder::isLogIdSelected(uint32_t logId)
+{
+    if (logId >= logIdSelected.size())
+        updateLogFilter();
+
+    return logId < logIdSelected.size() && logIdSelected[logId];
+}
+
+/**
+ * Seeks past the output buffers at the current position in the log that,
+ * according to the index, contain no log messages selected by setTimeRange()
+ * and setLogFilter(). Output buffers with metadata are never skipped as
+ * the buffers after them depend on it.
+ *
+ * \param requiredLogId
+ *      If non-negative, output buffers that don't contain log messages with
+ *      this logId are skipped as well
+ *
+ * \return
+ *      The number of BufferExtents marking a new pass through the
+ *      StagingBuffers (see BufferExtent::wrapAround) that were skipped
+ */
+uint32_t
+Log::Decoder::skipUnselectedBuffers(long requiredLogId)
+{
+    bool filterTime = (timeRangeStart != 0 || timeRangeEnd != UINT64_MAX);
+    if (index.empty() || (!filterTime && !logFilterSet && requiredLogId < 0))
+        return 0;
+
+    // Pick up the logIds added to the dictionary since the last update
+    if (logFilterSet && logIdSelected.size() < fmtId2metadata.size())
+        updateLogFilter();
+
+    uint64_t requiredLogIds[INDEX_LOGID_WORDS] = {};
+    if (requiredLogId >= 0)
+        setLogIdBit(requiredLogIds, downCast<uint32_t>(requiredLogId));
+
+    uint32_t wrapArounds = 0;
+    uint64_t position = ftell(inputFd);
+    uint64_t newPosition = position;
+    while (nextIndexEntry < index.size()) {
+        const IndexEntry &ie = index[nextIndexEntry];
+
+        // Passed or in the middle of this output buffer
+        if (ie.offset < newPosition) {
+            ++nextIndexEntry;
+            continue;
+        }
+
+        if (ie.offset > newPosition || ie.hasMetadata)
+            break;
+
+        bool mayBeSelected = ie.minTimestamp <= ie.maxTimestamp &&
+                             ie.maxTimestamp >= cyclesRangeStart &&
+                             ie.minTimestamp <= cyclesRangeEnd;
+        bool hasSelectedId = !logFilterSet;
+        bool hasRequiredId = (requiredLogId < 0);
+        for (uint32_t i = 0; i < INDEX_LOGID_WORDS; ++i) {
+            hasSelectedId |= (ie.logIds[i] & selectedLogIds[i]) != 0;
+            hasRequiredId |= (ie.logIds[i] & requiredLogIds[i]) != 0;
+        }
+
+        if (mayBeSelected && hasSelectedId && hasRequiredId)
+            break;
+
+        newPosition = ie.offset + ie.length;
+        wrapArounds += ie.numWrapArounds;
+        ++numOutputBuffersSkipped;
+        ++nextIndexEntry;
+    }
+
+    if (newPosition != position)
+        fseek(inputFd, newPosition, SEEK_SET);
+
+    return wrapArounds;
+}
+
+/**
+ * Reads the index file accompanying the log that's open()-ed, if any.
+ *
+ * \param[out] index
+ *      The entries of the index file
+ *
+ * \return
+ *      true if the index was read and is consistent with the log; false if
+ *      there's no usable index.
+ */
+bool
+Log::Decoder::readIndex(std::vector<IndexEntry> &index)
+{
+    // The index refers to the log by offset, so we need it to be mapped
+    // (and not be decompressed into a scratch file)
+    if (mappedLog == nullptr || compressedLogFd >= 0)
+        return false;
+
+    std::string indexFile = filename + INDEX_FILE_SUFFIX;
+    FILE *fd = fopen(indexFile.c_str(), "rb");
+    if (fd == nullptr)
+        return false;
+
+    IndexEntry ie;
+    index.clear();
+    while (fread(&ie, sizeof(IndexEntry), 1, fd) == 1) {
+        // The index may be written ahead of the log and a trailing entry
+        // could refer to data that has yet to (or never will) reach the log.
+        if (ie.offset + ie.length > mappedLogSize)
+            break;
+
+        if (ie.checkpointOffset + sizeof(Checkpoint) > mappedLogSize ||
+                peekEntryType(mappedLog + ie.checkpointOffset) != CHECKPOINT) {
+            fprintf(stderr, "Warning: Ignoring index file %s since it does not "
+                            "match the log\r\n", indexFile.c_str());
+            index.clear();
+            break;
+        }
+
+        index.push_back(ie);
+    }
+
+    fclose(fd);
+    return !index.empty();
+}
+
+/**
+ * Indicates whether any portion of the log in inputFd is BLOCK_COMPRESSED.
+ * Since a log may switch to block compression part way through (i.e. when it's
+ * appended to or the runtime's setting changes after the log is started),
+ * this skips from entry to entry until it finds a Checkpoint flagged as such.
+ * Only the headers of the entries are read.
+ */
+bool
+Log::Decoder::isBlockCompressed()
+{
+    union {
+        BufferExtent bufferExtent;
+        Checkpoint checkpoint;
+        DictionaryFragment dictionaryFragment;
+        char bytes[1];
+    } header;
+
+    uint64_t offset = 0;
+    while (true) {
+        ssize_t bytesRead = pread(fileno(inputFd), &header, sizeof(header),
+                                  offset);
+        if (bytesRead <= 0)
+            return false;
+
+        uint64_t headerLength, entryLength;
+        switch (peekEntryType(header.bytes)) {
+            case EntryType::CHECKPOINT:
+                headerLength = sizeof(Checkpoint);
+                entryLength = sizeof(Checkpoint)
+                                + header.checkpoint.newMetadataBytes;
+                if (uint64_t(bytesRead) >= headerLength &&
+                        (header.checkpoint.flags & BLOCK_COMPRESSED))
+                    return true;
+                break;
+
+            case EntryType::LOG_MSGS_OR_DIC:
+                headerLength = sizeof(DictionaryFragment);
+                entryLength = header.dictionaryFragment.newMetadataBytes;
+                break;
+
+            case EntryType::BUFFER_EXTENT:
+                headerLength = sizeof(BufferExtent);
+                entryLength = header.bufferExtent.length;
+                break;
+
+            default:
+                headerLength = entryLength = 1;
+                break;
+        }
+
+        if (uint64_t(bytesRead) < headerLength || entryLength < headerLength)
+            return false;
+
+        offset += entryLength;
+    }
+}
+
+/**
+ * Decompresses the entries appended to a BLOCK_COMPRESSED log since the last
+ * invocation into the scratch file inputFd, which the rest of the Decoder
+ * reads as if it were the log. CompressedBlocks are replaced by their
+ * contents and all the other entries (i.e. Checkpoints and the entries
+ * following a Checkpoint that isn't BLOCK_COMPRESSED) are copied over as is.
+ * An entry that has yet to be written out in its entirety is left for the
+ * next invocation (see setFollow()).
+ *
+ * \return
+ *      true if successful; false if the log is corrupt, in which case only
+ *      the entries preceding the corruption are decompressed
+ */
+bool
+Log::Decoder::inflateLog()
+{
+    if (compressedLogOffset == UINT64_MAX)
+        return false;
+
+    struct stat st;
+    if (fstat(compressedLogFd, &st) != 0)
+        return false;
+
+    uint64_t fileSize = st.st_size;
+    while (compressedLogOffset < fileSize) {
+        uint64_t available = fileSize - compressedLogOffset;
+
+        union {
+            BufferExtent bufferExtent;
+            Checkpoint checkpoint;
+            CompressedBlock compressedBlock;
+            DictionaryFragment dictionaryFragment;
+            char bytes[1];
+        } header;
+
+        ssize_t bytesRead = pread(compressedLogFd, &header,
+                                  std::min<uint64_t>(sizeof(header), available),
+                                  compressedLogOffset);
+        if (bytesRead <= 0)
+            return true;
+
+        uint64_t headerLength, entryLength;
+        bool isBlock = false;
+        bool corrupt = false;
+        switch (peekEntryType(header.bytes)) {
+            case EntryType::CHECKPOINT:
+                headerLength = sizeof(Checkpoint);
+                entryLength = sizeof(Checkpoint);
+                if (!(header.checkpoint.flags & BLOCK_COMPRESSED))
+                    entryLength += header.checkpoint.newMetadataBytes;
+                break;
+
+            case EntryType::LOG_MSGS_OR_DIC:
+                if (inCompressedBlocks) {
+                    isBlock = true;
+                    headerLength = sizeof(CompressedBlock);
+                    entryLength = sizeof(CompressedBlock)
+                                    + header.compressedBlock.compressedLength;
+                } else {
+                    headerLength = sizeof(DictionaryFragment);
+                    entryLength = header.dictionaryFragment.newMetadataBytes;
+                }
+                break;
+
+            case EntryType::BUFFER_EXTENT:
+                // BufferExtents only appear within the CompressedBlocks
+                corrupt = inCompressedBlocks;
+                headerLength = sizeof(BufferExtent);
+                entryLength = header.bufferExtent.length;
+                break;
+
+            default:
+                // Padding is copied over a byte at a time
+                headerLength = entryLength = 1;
+                break;
+        }
+
+        if (uint64_t(bytesRead) < headerLength)
+            return true;
+
+        if (isBlock) {
+            const CompressedBlock &block = header.compressedBlock;
+            corrupt = block.uncompressedLength > maxBlockSize ||
+                    block.compressedLength > maxCompressedBlockSize(
+                                                        maxBlockSize);
+        }
+
+        // Wait for the rest of the entry to be written out, unless it's
+        // corrupt and may never be
+        if (!corrupt && entryLength > available)
+            return true;
+
+        corrupt |= entryLength < headerLength;
+
+        if (!corrupt) {
+            compressedEntry.resize(entryLength);
+            corrupt = pread(compressedLogFd, compressedEntry.data(),
+                            entryLength, compressedLogOffset)
+                                                != ssize_t(entryLength);
+        }
+
+        const char *data = compressedEntry.data();
+        uint64_t nbytes = entryLength;
+        if (!corrupt && isBlock) {
+            const CompressedBlock &block = header.compressedBlock;
+            data += sizeof(CompressedBlock);
+            nbytes = block.uncompressedLength;
+
+            if (block.codec == LZ4_BLOCK) {
+                inflatedEntry.resize(nbytes);
+                corrupt = !BlockCompressor::decompress(data,
+                                                       block.compressedLength,
+                                                       inflatedEntry.data(),
+                                                       nbytes);
+                data = inflatedEntry.data();
+            } else {
+                corrupt = (block.codec != STORED_BLOCK ||
+                           block.compressedLength != nbytes);
+            }
+        }
+
+        if (corrupt) {
+            fprintf(stderr, "Error: Corrupt entry at offset %lu of the block "
+                            "compressed log; the log past it is ignored\r\n",
+                            compressedLogOffset);
+            compressedLogOffset = UINT64_MAX;
+            return false;
+        }
+
+        if (!appendInflated(data, nbytes))
+            return false;
+
+        if (peekEntryType(header.bytes) == EntryType::CHECKPOINT) {
+            inCompressedBlocks = header.checkpoint.flags & BLOCK_COMPRESSED;
+            maxBlockSize = header.checkpoint.outputBufferSize;
+        }
+
+        compressedLogOffset += entryLength;
+    }
+
+    return true;
+}
+
+/**
+ * Appends decompressed bytes to the scratch file inputFd (see inflateLog()).
+ *
+ * \param data
+ *      Bytes to append
+ * \param nbytes
+ *      Number of bytes to append
+ *
+ * \return
+ *      true if successful; false if the scratch file couldn't be written to
+ */
+bool
+Log::Decoder::appendInflated(const char *data, uint64_t nbytes)
+{
+    // pwrite() leaves the file position of the reads untouched
+    while (nbytes > 0) {
+        ssize_t bytesWritten = pwrite(fileno(inputFd), data, nbytes,
+                                      inflatedLogSize);
+        if (bytesWritten <= 0) {
+            perror("Error: Could not decompress the block compressed log");
+            compressedLogOffset = UINT64_MAX;
+            return false;
+        }
+
+        data += bytesWritten;
+        nbytes -= bytesWritten;
+        inflatedLogSize += bytesWritten;
+    }
+
+    return true;
+}
+
+/**
+ * Reads the checkpoints and dictionary fragments between two offsets in the
+ * log that's open()-ed while skipping over the log messages.
+ *
+ * \param start
+ *      Offset in the log to start reading from
+ * \param end
+ *      Offset in the log to stop reading at
+ *
+ * \return
+ *      true if successful; false if the log is corrupt
+ */
+bool
+Log::Decoder::readMetadataBetween(uint64_t start, uint64_t end)
+{
+    if (fseek(inputFd, start, SEEK_SET) != 0)
+        return false;
+
+    bool success = true;
+    BufferFragment *bf = allocateBufferFragment();
+    while (success && !feof(inputFd) && uint64_t(ftell(inputFd)) < end) {
+        switch (peekEntryType(inputFd)) {
+            case EntryType::BUFFER_EXTENT:
+                success = bf->readBufferExtent(inputFd, nullptr,
+                                               checkpoint.outputBufferSize,
+                                               mappedLog, mappedLogSize);
+                bf->reset();
+                break;
+
+            case EntryType::CHECKPOINT:
+                success = readDictionary(inputFd, true);
+                break;
+
+            case EntryType::LOG_MSGS_OR_DIC:
+                success = readDictionaryFragment(inputFd);
+                break;
+
+            case EntryType::INVALID:
+                // Consume padding
+                while (!feof(inputFd) && peekEntryType(inputFd) == INVALID)
+                    fgetc(inputFd);
+                break;
+        }
+    }
+
+    freeBufferFragment(bf);
+    return success;
+}
+
+/**
+ * Translates the wall time range set by setTimeRange() into rdtsc()
+ * timestamps using the current checkpoint.
+ */
+void
+Log::Decoder::updateTimeRangeCycles()
+{
+    auto toCycles = [this](uint64_t time) {
+        int64_t nanosSinceCheckpoint = static_cast<int64_t>(time)
+                - getCheckpointTime(checkpoint);
+        double cycles = static_cast<double>(checkpoint.rdtsc)
+                + 1.0e-9*static_cast<double>(nanosSinceCheckpoint)
+                                        *checkpoint.cyclesPerSecond;
+
+        if (cycles <= 0)
+            return uint64_t(0);
+        if (cycles >= static_cast<double>(UINT64_MAX))
+            return UINT64_MAX;
+        return static_cast<uint64_t>(cycles);
+    };
+
+    cyclesRangeStart = (timeRangeStart == 0) ? 0 : toCycles(timeRangeStart);
+    cyclesRangeEnd = (timeRangeEnd == UINT64_MAX) ? UINT64_MAX
+                                                  : toCycles(timeRangeEnd);
+}
+
+/**
+ * Indicates whether the decompression has reached the end of the log file
+ * or the end of the portion being decompressed (see setTimeRange()).
+ */
+bool
+Log::Decoder::endOfInput()
+{
+    if (feof(inputFd))
+        return true;
+
+    return inputLimit != UINT64_MAX && uint64_t(ftell(inputFd)) >= inputLimit;
+}
+
+/**
+ * Returns true if the log file entry starting at an offset has been written
+ * out in its entirety, so that reading it won't run into the end of a log
+ * file that's still being written to. Corrupt entries are deemed complete so
+ * that reading them reports the corruption.
+ *
+ * \param offset
+ *      Offset of the entry in the log file
+ */
+bool
+Log::Decoder::isEntryComplete(long offset)
+{
+    struct stat st;
+    int fd = fileno(inputFd);
+    if (offset < 0 || fstat(fd, &st) != 0 || offset >= st.st_size)
+        return false;
+
+    union {
+        BufferExtent bufferExtent;
+        Checkpoint checkpoint;
+        DictionaryFragment dictionaryFragment;
+        char bytes[1];
+    } header;
+
+    uint64_t available = st.st_size - offset;
+    ssize_t bytesRead = pread(fd, &header,
+                              std::min<uint64_t>(sizeof(header), available),
+                              offset);
+    if (bytesRead <= 0)
+        return false;
+
+    uint64_t headerLength, entryLength;
+    switch (peekEntryType(header.bytes)) {
+        case EntryType::BUFFER_EXTENT:
+            headerLength = sizeof(BufferExtent);
+            entryLength = header.bufferExtent.length;
+            if (entryLength > checkpoint.outputBufferSize)
+                return true;
+            break;
+
+        case EntryType::CHECKPOINT:
+            headerLength = sizeof(Checkpoint);
+            entryLength = sizeof(Checkpoint)
+                                + header.checkpoint.newMetadataBytes;
+            break;
+
+        case EntryType::LOG_MSGS_OR_DIC:
+            headerLength = sizeof(DictionaryFragment);
+            entryLength = header.dictionaryFragment.newMetadataBytes;
+            break;
+
+        default:
+            // Padding is consumed a byte at a time
+            return true;
+    }
+
+    return uint64_t(bytesRead) >= headerLength && entryLength <= available;
+}
+
+/**
+ * Waits in follow mode (see setFollow()) until the log file entry at the
+ * current position has been written out in its entirety and readies inputFd
+ * to read it.
+ *
+ * \param outputFd
+ *      File the log messages are output to; it's flushed before blocking.
+ *      nullptr indicates there is none.
+ *
+ * \return
+ *      true if the next entry can be read; false if the log file didn't grow
+ *      within the idle timeout
+ */
+bool
+Log::Decoder::waitForNextEntry(FILE *outputFd)
+{
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        if (compressedLogFd >= 0)
+            inflateLog();
+
+        long offset = ftell(inputFd);
+        if (isEntryComplete(offset)) {
+            // Discards the end of file condition and any stale buffered data
+            clearerr(inputFd);
+            fseek(inputFd, offset, SEEK_SET);
+            return true;
+        }
+
+        if (outputFd)
+            fflush(outputFd);
+
+        int waitMs = FOLLOW_POLL_INTERVAL_MS;
+        if (followIdleTimeoutMs >= 0) {
+            int64_t idleMs = std::chrono::duration_cast<
+                    std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+            if (idleMs >= followIdleTimeoutMs)
+                return false;
+
+            waitMs = static_cast<int>(std::min<int64_t>(waitMs,
+                                            followIdleTimeoutMs - idleMs));
+        }
+
+        waitForGrowth(waitMs);
+    }
+}
+
+/**
+ * Blocks until the log file is modified or a timeout elapses. The file is
+ * watched with inotify when it is available; otherwise this just sleeps.
+ *
+ * \param timeoutMs
+ *      Maximum number of milliseconds to block
+ */
+void
+Log::Decoder::waitForGrowth(int timeoutMs)
+{
+    if (inotifyFd == -1) {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, filename.c_str(),
+                                                IN_MODIFY) < 0) {
+            ::close(inotifyFd);
+            inotifyFd = -1;
+        }
+
+        if (inotifyFd < 0)
+            inotifyFd = -2;
+    }
+
+    if (inotifyFd < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        return;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = inotifyFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+        return;
+
+    // Drain the events; the file's size is checked by the caller
+    char events[4096];
+    while (read(inotifyFd, events, sizeof(events)) > 0);
+}
+
+/**
+ * Closes the log file currently being operated on, if any.
+ */
+void
+Log::Decoder::close() {
+    if (mappedLog)
+        munmap(const_cast<char*>(mappedLog), mappedLogSize);
+
     if (inputFd)
         fclose(inputFd);
 
+    if (inotifyFd >= 0)
+        ::close(inotifyFd);
+
+    if (compressedLogFd >= 0)
+        ::close(compressedLogFd);
+
+    // The unsorted decompression state may be viewing the mapping
+    if (bufferFragment)
+        bufferFragment->reset();
+
+    mappedLog = nullptr;
+    mappedLogSize = 0;
     filename.clear();
     inputFd = nullptr;
+    inotifyFd = -1;
+    compressedLogFd = -1;
     good = false;
+}
+
+/**
+ * Decoder destructor
+ */
+Log::Decoder::~Decoder() {
+    close();
 
     for (BufferFragment *bf : freeBuffers)
         delete bf;
 
     freeBuffers.clear();
+
+    free(rawMetadata);
+    rawMetadata = endOfRawMetadata = nullptr;
+    rawMetadataSize = 0;
 }
 
 /**
@@ -1135,7 +2758,7 @@ Log::Decoder::allocateBufferFragment()
         return ret;
     }
 
-    return new BufferFragment();
+    return new BufferFragment(&fmtId2formatOps, &staticStrings);
 }
 
 /**
@@ -1152,8 +2775,11 @@ Log::Decoder::freeBufferFragment(BufferFragment *bf)
 }
 
 // BufferFragment constructor
-Log::Decoder::BufferFragment::BufferFragment()
-    : storage()
+Log::Decoder::BufferFragment::BufferFragment(
+                const std::vector<std::vector<FormatOp>> *fmtId2formatOps,
+                const std::deque<std::string> *staticStrings)
+    : storage(nullptr)
+    , storageSize(0)
     , validBytes(0)
     , runtimeId(-1)
     , readPos(nullptr)
@@ -1161,9 +2787,33 @@ Log::Decoder::BufferFragment::BufferFragment()
     , hasMoreLogs(false)
     , nextLogId(-1)
     , nextLogTimestamp(0)
+    , renderedOutput(nullptr)
+    , renderedOutputSize(0)
+    , renderedLogs()
+    , nextRenderedLog(0)
+    , fmtId2formatOps(fmtId2formatOps)
+    , lineBuffer()
+    , lastSecondFormatted(INT64_MIN)
+    , lastSecondString()
+    , extentsRead(0)
+    , argumentHistories()
+    , expandedArguments()
+    , customArgSizes()
+    , staticStrings(staticStrings)
 {
 }
 
+// BufferFragment destructor
+Log::Decoder::BufferFragment::~BufferFragment()
+{
+    free(storage);
+    storage = nullptr;
+    storageSize = 0;
+
+    free(renderedOutput);
+    renderedOutput = nullptr;
+}
+
 /**
  * Resets the state of the BufferFragment so that the data cannot be reused
  */
@@ -1175,6 +2825,12 @@ Log::Decoder::BufferFragment::reset()
     readPos = nullptr;
     endOfBuffer = nullptr;
     hasMoreLogs = false;
+
+    free(renderedOutput);
+    renderedOutput = nullptr;
+    renderedOutputSize = 0;
+    renderedLogs.clear();
+    nextRenderedLog = 0;
 }
 /**
  * Read in the next buffer fragment from the compressed log. If an error occurs
@@ -1184,43 +2840,97 @@ Log::Decoder::BufferFragment::reset()
  *      File stream to read it from
  * \param[out] wrapAround
  *      Indicates whether a wrap around was indicated in the log or not.
+ * \param maxLength
+ *      Maximum valid size of a BufferExtent (i.e. the output buffer size
+ *      recorded in the last Checkpoint); larger extents are deemed corrupt.
+ * \param mappedLog
+ *      Memory mapping of the file behind fd, if any. If the BufferExtent lies
+ *      entirely within the mapping, the BufferFragment views it in place and
+ *      fd is merely advanced past it.
+ * \param mappedLogSize
+ *      Number of bytes in mappedLog
  *
  * \return
  *      indicates whether the operation succeeded (true) or failed due to
  *      a malformed log data.
  */
 bool
-Log::Decoder::BufferFragment::readBufferExtent(FILE *fd, bool *wrapAround) {
-    validBytes = fread(storage, 1, sizeof(BufferExtent), fd);
-    BufferExtent *be = reinterpret_cast<BufferExtent*>(storage);
-
-    if (be->entryType != EntryType::BUFFER_EXTENT ||
-            validBytes < sizeof(BufferExtent) ||
-            be->length > sizeof(storage)) {
-        reset();
-        return false;
+Log::Decoder::BufferFragment::readBufferExtent(FILE *fd, bool *wrapAround,
+                                               uint32_t maxLength,
+                                               const char *mappedLog,
+                                               uint64_t mappedLogSize) {
+    BufferExtent header;
+    header.entryType = EntryType::INVALID;
+    bool isMapped = false;
+
+    long offset = (mappedLog != nullptr) ? ftell(fd) : -1;
+    if (offset >= 0 && offset + sizeof(BufferExtent) <= mappedLogSize) {
+        const char *start = mappedLog + offset;
+        memcpy(&header, start, sizeof(BufferExtent));
+
+        // Otherwise fall through and read it in to detect the errors
+        if (header.entryType == EntryType::BUFFER_EXTENT &&
+                header.length >= sizeof(BufferExtent) &&
+                header.length <= maxLength &&
+                uint64_t(offset) + header.length <= mappedLogSize &&
+                fseek(fd, offset + header.length, SEEK_SET) == 0) {
+            validBytes = header.length;
+            readPos = start + sizeof(BufferExtent);
+            endOfBuffer = start + validBytes;
+            isMapped = true;
+        }
     }
 
-    assert(be->length >= validBytes);
-    uint64_t remaining = be->length - validBytes;
-    validBytes += fread(storage + validBytes, 1, remaining, fd);
+    if (!isMapped) {
+        header.entryType = EntryType::INVALID;
+        validBytes = fread(&header, 1, sizeof(BufferExtent), fd);
 
-    if (validBytes != be->length) {
-        reset();
-        return false;
-    }
+        if (header.entryType != EntryType::BUFFER_EXTENT ||
+                validBytes < sizeof(BufferExtent) ||
+                header.length < sizeof(BufferExtent) ||
+                header.length > maxLength) {
+            reset();
+            return false;
+        }
+
+        if (header.length > storageSize) {
+            char *newStorage = static_cast<char*>(realloc(storage,
+                                                          header.length));
+            if (newStorage == nullptr) {
+                fprintf(stderr, "Error: Could not allocate %u bytes to read "
+                                "a BufferExtent\r\n", header.length);
+                reset();
+                return false;
+            }
+
+            storage = newStorage;
+            storageSize = header.length;
+        }
 
-    readPos = storage + sizeof(BufferExtent);
-    endOfBuffer = storage + validBytes;
+        memcpy(storage, &header, sizeof(BufferExtent));
+        uint64_t remaining = header.length - validBytes;
+        validBytes += fread(storage + validBytes, 1, remaining, fd);
 
-    if (be->isShort)
-        runtimeId = be->threadIdOrPackNibble;
+        if (validBytes != header.length) {
+            reset();
+            return false;
+        }
+
+        readPos = storage + sizeof(BufferExtent);
+        endOfBuffer = storage + validBytes;
+    }
+
+    if (header.isShort)
+        runtimeId = header.threadIdOrPackNibble;
     else
         runtimeId = BufferUtils::unpack<uint32_t>(
-                                            &readPos, be->threadIdOrPackNibble);
+                                        &readPos, header.threadIdOrPackNibble);
+
+    // Delta encoding starts over with every BufferExtent
+    ++extentsRead;
 
     if (wrapAround)
-        *wrapAround = be->wrapAround;
+        *wrapAround = header.wrapAround;
 
     // The buffer has no log messages, skip it (this may be possible in cases
     // where we want to mark wrapArounds or the output buffer ran out of space).
@@ -1237,50 +2947,569 @@ Log::Decoder::BufferFragment::readBufferExtent(FILE *fd, bool *wrapAround) {
 }
 
 /**
- * Helper to decompressNextLogStatement to print a single PrintFragment
- * given an argument and optional width/precision specifiers.
+ * Appends a field to a string and pads it to a minimum width the way printf
+ * would.
+ *
+ * \param out
+ *      String to append to
+ * \param prefix
+ *      Sign and/or radix prefix of the field (i.e. "-" or "0x")
+ * \param prefixLength
+ *      Number of characters in prefix
+ * \param body
+ *      Digits or text of the field
+ * \param bodyLength
+ *      Number of characters in body
+ * \param leadingZeros
+ *      Number of zeros to insert between the prefix and the body
+ * \param width
+ *      Minimum width of the field, -1 specifies none
+ * \param leftAlign
+ *      Pad the field with spaces on the right rather than the left
+ * \param zeroPad
+ *      Pad the field with zeros between the prefix and the body rather than
+ *      with spaces on the left
+ */
+static void
+appendField(std::string &out,
+            const char *prefix, size_t prefixLength,
+            const char *body, size_t bodyLength,
+            size_t leadingZeros,
+            int width,
+            bool leftAlign,
+            bool zeroPad)
+{
+    size_t length = prefixLength + leadingZeros + bodyLength;
+    size_t padding = 0;
+    if (width > 0 && static_cast<size_t>(width) > length)
+        padding = static_cast<size_t>(width) - length;
+
+    if (!leftAlign && !zeroPad)
+        out.append(padding, ' ');
+
+    out.append(prefix, prefixLength);
+    out.append(leadingZeros + ((zeroPad && !leftAlign) ? padding : 0), '0');
+    out.append(body, bodyLength);
+
+    if (leftAlign)
+        out.append(padding, ' ');
+}
+
+/**
+ * Appends an integer to a string formatted according to a FormatOp with one
+ * of the d, i, u, o, x or X conversions.
+ *
+ * \param out
+ *      String to append to
+ * \param op
+ *      Describes how to format the integer
+ * \param negative
+ *      Indicates that the integer is negative
+ * \param magnitude
+ *      Absolute value of the integer
+ * \param width
+ *      Minimum width of the field, -1 specifies none
+ * \param precision
+ *      Minimum number of digits, -1 specifies none
+ * \param leftAlign
+ *      Pad the field on the right
+ */
+static void
+appendInteger(std::string &out,
+              const Log::FormatOp &op,
+              bool negative,
+              uint64_t magnitude,
+              int width,
+              int precision,
+              bool leftAlign)
+{
+    char conversion = op.conversion;
+    int base = 10;
+    if (conversion == 'o')
+        base = 8;
+    else if (conversion == 'x' || conversion == 'X')
+        base = 16;
+
+    // An explicit precision of 0 prints no digits for 0
+    char digits[24];
+    size_t numDigits = 0;
+    if (magnitude != 0 || precision != 0) {
+        numDigits = std::to_chars(digits, digits + sizeof(digits),
+                                  magnitude, base).ptr - digits;
+        if (conversion == 'X') {
+            for (size_t i = 0; i < numDigits; ++i)
+                digits[i] = static_cast<char>(toupper(digits[i]));
+        }
+    }
+
+    char prefix[2];
+    size_t prefixLength = 0;
+    bool isSigned = (conversion == 'd' || conversion == 'i');
+    if (negative)
+        prefix[prefixLength++] = '-';
+    else if (isSigned && op.forceSign)
+        prefix[prefixLength++] = '+';
+    else if (isSigned && op.spaceSign)
+        prefix[prefixLength++] = ' ';
+
+    if (op.alternateForm && base == 16 && magnitude != 0) {
+        prefix[prefixLength++] = '0';
+        prefix[prefixLength++] = conversion;
+    }
+
+    size_t leadingZeros = 0;
+    if (precision > 0 && static_cast<size_t>(precision) > numDigits)
+        leadingZeros = static_cast<size_t>(precision) - numDigits;
+
+    // The alternate form of octal always starts with a 0
+    if (op.alternateForm && base == 8 && leadingZeros == 0 &&
+            (numDigits == 0 || digits[0] != '0'))
+        leadingZeros = 1;
+
+    appendField(out, prefix, prefixLength, digits, numDigits, leadingZeros,
+                width, leftAlign, op.zeroPad && precision < 0);
+}
+
+/**
+ * Appends a floating point number to a string formatted according to a
+ * FormatOp with one of the f, F, e, E, g or G conversions.
+ *
+ * \param out
+ *      String to append to
+ * \param op
+ *      Describes how to format the number
+ * \param value
+ *      Number to format
+ * \param width
+ *      Minimum width of the field, -1 specifies none
+ * \param precision
+ *      Precision of the conversion, -1 specifies the default (6)
+ * \param leftAlign
+ *      Pad the field on the right
+ *
+ * \return
+ *      true if the number was appended; false if it's too long to be
+ *      formatted natively.
+ */
+template<typename T>
+static bool
+appendFloat(std::string &out,
+            const Log::FormatOp &op,
+            T value,
+            int width,
+            int precision,
+            bool leftAlign)
+{
+    std::chars_format format = std::chars_format::general;
+    char conversion = static_cast<char>(tolower(op.conversion));
+    if (conversion == 'f')
+        format = std::chars_format::fixed;
+    else if (conversion == 'e')
+        format = std::chars_format::scientific;
+
+    bool negative = std::signbit(value);
+    char digits[128];
+    std::to_chars_result result = std::to_chars(digits,
+                                                digits + sizeof(digits),
+                                                negative ? -value : value,
+                                                format,
+                                                precision < 0 ? 6 : precision);
+    if (result.ec != std::errc())
+        return false;
+
+    size_t numDigits = result.ptr - digits;
+    if (isupper(op.conversion)) {
+        for (size_t i = 0; i < numDigits; ++i)
+            digits[i] = static_cast<char>(toupper(digits[i]));
+    }
+
+    char prefix = '\0';
+    if (negative)
+        prefix = '-';
+    else if (op.forceSign)
+        prefix = '+';
+    else if (op.spaceSign)
+        prefix = ' ';
+
+    // Infinities and NaNs are padded with spaces
+    appendField(out, &prefix, (prefix == '\0') ? 0 : 1, digits, numDigits, 0,
+                width, leftAlign, op.zeroPad && std::isfinite(value));
+    return true;
+}
+
+/**
+ * Appends the output of snprintf to a string.
+ *
+ * \param out
+ *      String to append to
+ * \param format
+ *      printf format string
+ * \param args
+ *      Arguments to the format string
+ */
+template<typename... Args>
+static void
+appendPrintf(std::string &out, const char *format, Args... args)
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-security"
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    char buffer[256];
+    int length = snprintf(buffer, sizeof(buffer), format, args...);
+    if (length < 0)
+        return;
+
+    if (static_cast<size_t>(length) < sizeof(buffer)) {
+        out.append(buffer, length);
+        return;
+    }
+
+    size_t start = out.size();
+    out.resize(start + length + 1);
+    snprintf(&out[start], length + 1, format, args...);
+    out.resize(start + length);
+#pragma GCC diagnostic pop
+}
+
+/**
+ * Appends a PrintFragment's format specifier rendered by snprintf to a
+ * string.
+ *
+ * \param out
+ *      String to append to
+ * \param op
+ *      Compiled form of the PrintFragment
+ * \param arg
+ *      Argument to format
+ * \param width
+ *      Dynamic width argument of the specifier, if the fragment has one
+ * \param precision
+ *      Dynamic precision argument of the specifier, if the fragment has one
+ */
+template<typename T>
+static void
+appendWithSnprintf(std::string &out,
+                   const Log::FormatOp &op,
+                   T arg,
+                   int width,
+                   int precision)
+{
+    const char *format = op.specifier.c_str();
+    if (op.dynamicWidth && op.dynamicPrecision)
+        appendPrintf(out, format, width, precision, arg);
+    else if (op.dynamicWidth)
+        appendPrintf(out, format, width, arg);
+    else if (op.dynamicPrecision)
+        appendPrintf(out, format, precision, arg);
+    else
+        appendPrintf(out, format, arg);
+}
+
+/**
+ * Helper to decompressNextLogStatement to format a single PrintFragment
+ * given an argument and optional dynamic width/precision specifiers.
  *
  * \tparam T
  *      Type of the argument (automatically inferred)
- * \param outputFd
- *      Where to output the statement
- * \param formatString
- *      Partial format string containing exactly 1 format specifier
+ * \param out
+ *      String to append the formatted fragment to, or nullptr if it's not
+ *      going to be output
+ * \param logArguments
+ *      LogMessage to save the argument into
+ * \param op
+ *      Compiled form of the PrintFragment (see Decoder::compileFormat())
  * \param arg
- *      Argument to pass in with the format string
+ *      Argument to format
  * \param width
- *      Width parameter of a printf-specifier, a value of -1 specifies none
+ *      Dynamic width argument of the specifier, if the fragment has one
  * \param precision
- *      precision parameter of a printf-specifier, a value of -1 specifies none
+ *      Dynamic precision argument of the specifier, if the fragment has one
  */
 template<typename T>
 static inline void
-printSingleArg(FILE *outputFd,
-               NanoLogInternal::Log::LogMessage &logArguments,
-               const char* formatString,
-               T arg,
-               int width = -1,
-               int precision = -1)
+formatSingleArg(std::string *out,
+                NanoLogInternal::Log::LogMessage &logArguments,
+                const Log::FormatOp *op,
+                T arg,
+                int width = -1,
+                int precision = -1)
 {
     logArguments.push(arg);
 
-    if (outputFd == nullptr)
+    if (out == nullptr)
         return;
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-security"
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    out->append(op->literal);
 
-    if (width < 0 && precision < 0) {
-        fprintf(outputFd, formatString, arg);
-    } else if (width >= 0 && precision < 0)
-        fprintf(outputFd, formatString, width, arg);
-    else if (width >= 0 && precision >= 0)
-        fprintf(outputFd, formatString, width, precision, arg);
-    else
-        fprintf(outputFd, formatString, precision, arg);
+    if (op->useSnprintf) {
+        appendWithSnprintf(*out, *op, arg, width, precision);
+        out->append(op->suffix);
+        return;
+    }
+
+    // A negative dynamic width is a '-' flag; a negative precision is none
+    int dynamicWidth = width;
+    int dynamicPrecision = precision;
+    bool leftAlign = op->leftAlign;
+    if (!op->dynamicWidth) {
+        width = op->width;
+    } else if (width < 0) {
+        leftAlign = true;
+        width = (width == INT_MIN) ? INT_MAX : -width;
+    }
+
+    if (!op->dynamicPrecision)
+        precision = op->precision;
+    else if (precision < 0)
+        precision = -1;
+
+    if constexpr (std::is_integral<T>::value) {
+        if (op->conversion == 'c') {
+            char c = static_cast<char>(arg);
+            appendField(*out, "", 0, &c, 1, 0, width, leftAlign, false);
+        } else if (op->conversion == 'd' || op->conversion == 'i') {
+            int64_t value = static_cast<int64_t>(
+                    static_cast<typename std::make_signed<T>::type>(arg));
+            uint64_t magnitude = (value < 0) ? 0 - static_cast<uint64_t>(value)
+                                             : static_cast<uint64_t>(value);
+            appendInteger(*out, *op, value < 0, magnitude, width, precision,
+                          leftAlign);
+        } else {
+            uint64_t value = static_cast<typename std::make_unsigned<T>::type>(
+                                                                        arg);
+            appendInteger(*out, *op, false, value, width, precision,
+                          leftAlign);
+        }
+    } else if constexpr (std::is_floating_point<T>::value) {
+        if (!appendFloat(*out, *op, arg, width, precision, leftAlign))
+            appendWithSnprintf(*out, *op, arg, dynamicWidth, dynamicPrecision);
+    } else if constexpr (std::is_same<T, const char*>::value) {
+        size_t length = (precision >= 0) ? strnlen(arg, precision)
+                                         : strlen(arg);
+        appendField(*out, "", 0, arg, length, 0, width, leftAlign, false);
+    }
+
+    out->append(op->suffix);
+}
+
+/**
+ * Returns the name of the user-defined type that a PrintFragment's argument
+ * is tagged with (i.e. "Price" for "%{Price}s"), or an empty string if
+ * there's none.
+ *
+ * \param pf
+ *      PrintFragment of a custom_t argument
+ */
+static std::string
+getCustomTypeName(const Log::PrintFragment *pf)
+{
+    for (const char *c = pf->formatFragment; *c != '\0'; ++c) {
+        if (*c != '%')
+            continue;
+
+        if (c[1] == '{') {
+            const char *end = strchr(c, '}');
+            if (end != nullptr)
+                return std::string(c + 2, end);
+        }
+
+        // Skip the second '%' of an escaped "%%"
+        if (c[1] == '%')
+            ++c;
+    }
+
+    return std::string();
+}
+
+/**
+ * Formats an argument of a user-defined type (see NanoLog::Serializer)
+ * like a string with its text, which is also saved into a LogMessage.
+ *
+ * \param out
+ *      String to append the formatted fragment to, or nullptr if it's not
+ *      going to be output
+ * \param logArguments
+ *      LogMessage to save the argument's text into
+ * \param op
+ *      Compiled form of the PrintFragment (see Decoder::compileFormat())
+ * \param pf
+ *      The PrintFragment, which names the argument's type
+ * \param data
+ *      Bytes of the argument
+ * \param size
+ *      Number of bytes in data
+ * \param width
+ *      Dynamic width argument of the specifier, if the fragment has one
+ * \param precision
+ *      Dynamic precision argument of the specifier, if the fragment has one
+ */
+static void
+formatCustomArg(std::string *out,
+                NanoLogInternal::Log::LogMessage &logArguments,
+                const Log::FormatOp *op,
+                const Log::PrintFragment *pf,
+                const char *data,
+                uint32_t size,
+                int width,
+                int precision)
+{
+    std::string text;
+    Log::Decoder::formatArgument(getCustomTypeName(pf), data, size, text);
+    formatSingleArg(out, logArguments, op, logArguments.copyString(text),
+                    width, precision);
+}
+
+/**
+ * Converts the arguments of the next log message in a delta encoded
+ * BufferFragment back into the encoding used without it (i.e. nibbles,
+ * pack()-ed values and null-terminated strings) and advances the read
+ * position past them. See BufferUtils::ArgumentHistory for the encoding.
+ *
+ * \param metadata
+ *      Describes the arguments of the next log message
+ *
+ * \return
+ *      The converted arguments, which remain valid until the next call, or
+ *      nullptr if the arguments are corrupt
+ */
+const char *
+Log::Decoder::BufferFragment::expandArguments(const FormatMetadata *metadata)
+{
+    using namespace BufferUtils;
+
+    if (argumentHistories.size() <= nextLogId)
+        argumentHistories.resize(nextLogId + 1);
+
+    ArgumentHistory &history = argumentHistories[nextLogId];
+    int numNibbles = metadata->numNibbles;
+    history.begin(extentsRead, numNibbles);
+
+    // Leave room for the largest pack()-ed values and pack()'s full-width
+    // stores beyond them
+    size_t nibbleBytes = (numNibbles + 1)/2;
+    expandedArguments.resize(nibbleBytes + 16*numNibbles + sizeof(uint64_t));
+
+    auto *outNibbles = reinterpret_cast<TwoNibbles*>(&expandedArguments[0]);
+    auto *inNibbles = reinterpret_cast<const TwoNibbles*>(readPos);
+    char *out = &expandedArguments[nibbleBytes];
+    const char *in = readPos + nibbleBytes;
+    int n = 0;
+
+    auto expandNext = [&](bool isInteger) {
+        if (n >= numNibbles)
+            return false;
+
+        uint8_t nibble = (n & 0x1) ? inNibbles[n/2].second
+                                   : inNibbles[n/2].first;
+        if (isInteger) {
+            uint64_t delta = static_cast<uint64_t>(unpack<int64_t>(&in,
+                                                                   nibble));
+            setNibble(outNibbles, n, pack(&out, static_cast<int64_t>(
+                                        history.decodeInteger(n, delta))));
+        } else {
+            uint32_t size = getPackedSize(nibble);
+            memcpy(out, in, size);
+            in += size;
+            out += size;
+            setNibble(outNibbles, n, nibble);
+        }
+
+        ++n;
+        return true;
+    };
+
+    const PrintFragment *firstFragment = reinterpret_cast<const PrintFragment*>(
+            reinterpret_cast<const char*>(metadata)
+            + sizeof(FormatMetadata)
+            + metadata->filenameLength);
+
+    customArgSizes.clear();
+    const PrintFragment *pf = firstFragment;
+    for (int i = 0; i < metadata->numPrintFragments; ++i) {
+        bool good = true;
+        if (pf->hasDynamicWidth)
+            good &= expandNext(true);
+
+        if (pf->hasDynamicPrecision)
+            good &= expandNext(true);
+
+        // Floating point arguments and the identifiers of static strings
+        // aren't delta encoded
+        FormatType argType = static_cast<FormatType>(pf->argType);
+        if (argType == double_t || argType == long_double_t ||
+                argType == static_str_t) {
+            good &= expandNext(false);
+        } else if (argType == custom_t) {
+            // The size of a user-defined argument isn't delta encoded
+            const char *size = in;
+            good &= expandNext(false);
+            if (good) {
+                uint8_t nibble = ((n - 1) & 0x1) ? inNibbles[(n - 1)/2].second
+                                                 : inNibbles[(n - 1)/2].first;
+                customArgSizes.push_back(unpack<uint32_t>(&size, nibble));
+            }
+        } else if (argType != NONE && argType != const_char_ptr_t &&
+                    argType != const_wchar_t_ptr_t) {
+            good &= expandNext(true);
+        }
+
+        if (!good || in > endOfBuffer)
+            return nullptr;
+
+        pf = reinterpret_cast<const PrintFragment*>(
+                reinterpret_cast<const char*>(pf)
+                + pf->fragmentLength
+                + sizeof(PrintFragment));
+    }
+
+    // The strings and user-defined arguments follow all the other arguments
+    expandedArguments.resize(out - expandedArguments.data());
+    pf = firstFragment;
+    size_t customArgs = 0;
+    for (int i = 0; i < metadata->numPrintFragments; ++i) {
+        FormatType argType = static_cast<FormatType>(pf->argType);
+        if (argType == custom_t) {
+            uint32_t size = customArgSizes[customArgs++];
+            if (size > static_cast<size_t>(endOfBuffer - in))
+                return nullptr;
+
+            expandedArguments.append(in, size);
+            in += size;
+        } else if (argType == const_char_ptr_t ||
+                    argType == const_wchar_t_ptr_t) {
+            if (in >= endOfBuffer)
+                return nullptr;
+
+            uint8_t tag = static_cast<uint8_t>(*in++);
+            size_t terminatorBytes = (argType == const_char_ptr_t)
+                                                    ? 1 : sizeof(wchar_t);
+            if (tag == 0) {
+                size_t length = (argType == const_char_ptr_t)
+                        ? strlen(in)
+                        : wcslen(reinterpret_cast<const wchar_t*>(in))
+                                                            *sizeof(wchar_t);
+                history.addString(in, downCast<uint32_t>(length));
+                expandedArguments.append(in, length + terminatorBytes);
+                in += length + terminatorBytes;
+            } else if (tag <= ArgumentHistory::NUM_STRINGS) {
+                expandedArguments.append(history.strings[tag - 1]);
+                expandedArguments.append(terminatorBytes, '\0');
+            } else {
+                return nullptr;
+            }
+        }
+
+        pf = reinterpret_cast<const PrintFragment*>(
+                reinterpret_cast<const char*>(pf)
+                + pf->fragmentLength
+                + sizeof(PrintFragment));
+    }
+
+    if (in > endOfBuffer)
+        return nullptr;
 
-#pragma GCC diagnostic pop
+    readPos = in;
+    return expandedArguments.data();
 }
 
 /**
@@ -1322,7 +3551,7 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
                                         void (*aggregationFn)(const char*, ...))
 {
     double secondsSinceCheckpoint, nanos = 0.0;
-    char timeString[32];
+    const char *timeString = lastSecondString;
 
     if (readPos > endOfBuffer || !hasMoreLogs) {
         hasMoreLogs = false;
@@ -1350,6 +3579,8 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
         secondsSinceCheckpoint = PerfUtils::Cycles::toSeconds(
                                             nextLogTimestamp - checkpoint.rdtsc,
                                             checkpoint.cyclesPerSecond);
+        if (checkpoint.flags & PRECISE_TIME)
+            secondsSinceCheckpoint += 1.0e-9*checkpoint.unixTimeNanos;
         int64_t wholeSeconds = static_cast<int64_t>(secondsSinceCheckpoint);
         nanos = 1.0e9 * (secondsSinceCheckpoint
                                 - static_cast<double>(wholeSeconds));
@@ -1362,8 +3593,13 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
         }
 
         std::time_t absTime = wholeSeconds + checkpoint.unixTime;
-        std::tm *tm = localtime(&absTime);
-        strftime(timeString, sizeof(timeString), "%Y-%m-%d %H:%M:%S", tm);
+        if (absTime != lastSecondFormatted) {
+            std::tm tm;
+            localtime_r(&absTime, &tm);
+            strftime(lastSecondString, sizeof(lastSecondString),
+                     "%Y-%m-%d %H:%M:%S", &tm);
+            lastSecondFormatted = absTime;
+        }
     }
 
 #ifdef PREPROCESSOR_NANOLOG
@@ -1411,15 +3647,47 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
 
         logArgs.reset(metadata, nextLogId, nextLogTimestamp);
 
-        // Output the context
+        // The log message is formatted into lineBuffer and output at once
+        std::string *out = nullptr;
+        std::vector<FormatOp> compiledOps;
+        const std::vector<FormatOp> *ops = nullptr;
         if (outputFd) {
-            fprintf(outputFd,"%s.%09.0lf %s:%u %s[%u]: "
-                    , timeString
-                    , nanos
-                    , filename
-                    , metadata->lineNumber
-                    , logLevel
-                    , runtimeId);
+            out = &lineBuffer;
+            if (fmtId2formatOps && nextLogId < fmtId2formatOps->size() &&
+                    (*fmtId2formatOps)[nextLogId].size()
+                                            == metadata->numPrintFragments) {
+                ops = &(*fmtId2formatOps)[nextLogId];
+            } else {
+                compileFormat(metadata, compiledOps);
+                ops = &compiledOps;
+            }
+
+            // Output the context, equivalent to "%s.%09.0lf %s:%u %s[%u]: "
+            static const FormatOp nanosOp = [] {
+                FormatOp op;
+                op.conversion = 'f';
+                op.zeroPad = true;
+                return op;
+            }();
+
+            char number[16];
+            lineBuffer.assign(timeString);
+            lineBuffer.push_back('.');
+            if (!appendFloat(lineBuffer, nanosOp, nanos, 9, 0, false))
+                appendPrintf(lineBuffer, "%09.0lf", nanos);
+            lineBuffer.push_back(' ');
+            lineBuffer.append(filename);
+            lineBuffer.push_back(':');
+            lineBuffer.append(number, std::to_chars(number,
+                                    number + sizeof(number),
+                                    metadata->lineNumber).ptr);
+            lineBuffer.push_back(' ');
+            lineBuffer.append(logLevel);
+            lineBuffer.push_back('[');
+            lineBuffer.append(number, std::to_chars(number,
+                                    number + sizeof(number),
+                                    runtimeId).ptr);
+            lineBuffer.append("]: ");
         }
 
         // Print out the actual log message, piece by piece
@@ -1428,13 +3696,27 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
                 + sizeof(FormatMetadata)
                 + metadata->filenameLength);
 
-        Nibbler nb(readPos, metadata->numNibbles);
+        // Delta encoded arguments are converted back before they're read
+        const char *args = readPos;
+        bool deltaEncoded = (checkpoint.flags & DELTA_ENCODED_ARGUMENTS);
+        if (deltaEncoded) {
+            args = expandArguments(metadata);
+            if (args == nullptr) {
+                fprintf(stderr, "Error: Corrupt delta encoded arguments for "
+                                "logId=%u\r\n", nextLogId);
+                hasMoreLogs = false;
+                return false;
+            }
+        }
+
+        Nibbler nb(args, metadata->numNibbles);
         const char *nextStringArg = nb.getEndOfPackedArguments();
 
         // TODO(syang0) We can probably skip processing the log message at
         // if we (a) aren't printing and (b) aren't aggregating
         for (int i = 0; i < metadata->numPrintFragments; ++i) {
             const wchar_t *wstrArg;
+            const FormatOp *op = (ops) ? &(*ops)[i] : nullptr;
 
             int width = -1;
             if (pf->hasDynamicWidth)
@@ -1446,164 +3728,162 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
 
             switch(pf->argType) {
                 case NONE:
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-security"
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-                    if (outputFd)
-                        fprintf(outputFd, pf->formatFragment);
-#pragma GCC diagnostic pop
+                    if (out) {
+                        out->append(op->literal);
+                        if (op->useSnprintf)
+                            appendPrintf(*out, op->specifier.c_str());
+                    }
                     break;
 
                 case unsigned_char_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<unsigned char>(),
                                    width, precision);
                     break;
 
                 case unsigned_short_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<unsigned short int>(),
                                    width, precision);
                     break;
 
                 case unsigned_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<unsigned int>(),
                                    width, precision);
                     break;
 
                 case unsigned_long_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<unsigned long int>(),
                                    width, precision);
                     break;
 
                 case unsigned_long_long_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<unsigned long long int>(),
                                    width, precision);
                     break;
 
                 case uintmax_t_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<uintmax_t>(),
                                    width, precision);
                     break;
 
                 case size_t_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<size_t>(),
                                    width, precision);
                     break;
 
                 case wint_t_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<wint_t>(),
                                    width, precision);
                     break;
 
                 case signed_char_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<signed char>(),
                                    width, precision);
                     break;
 
                 case short_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<short int>(),
                                    width, precision);
                     break;
 
                 case int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<int>(),
                                    width, precision);
                     break;
 
                 case long_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<long int>(),
                                    width, precision);
                     break;
 
                 case long_long_int_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<long long int>(),
                                    width, precision);
                     break;
 
                 case intmax_t_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<intmax_t>(),
                                    width, precision);
                     break;
 
                 case ptrdiff_t_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<ptrdiff_t>(),
                                    width, precision);
                     break;
 
                 case double_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<double>(),
                                    width, precision);
                     break;
 
                 case long_double_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<long double>(),
                                    width, precision);
                     break;
 
                 case const_void_ptr_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nb.getNext<const void *>(),
                                    width, precision);
                     break;
 
                 // The next two are strings, so handle it accordingly.
                 case const_char_ptr_t:
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    nextStringArg,
                                    width, precision);
 
@@ -1640,15 +3920,47 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
                      * passing it to printf.
                      */
                     wstrArg = reinterpret_cast<const wchar_t *>(nextStringArg);
-                    printSingleArg(outputFd,
+                    formatSingleArg(out,
                                    logArgs,
-                                   pf->formatFragment,
+                                   op,
                                    wstrArg,
                                    width, precision);
                     // +1 for NULL
                     nextStringArg += (wcslen(wstrArg) + 1) * sizeof(wchar_t);
                     break;
 
+                // User-defined types are stored as is with the strings
+                case custom_t:
+                {
+                    uint32_t size = nb.getNext<uint32_t>();
+                    formatCustomArg(out,
+                                    logArgs,
+                                    op,
+                                    pf,
+                                    nextStringArg,
+                                    size,
+                                    width, precision);
+                    nextStringArg += size;
+                    break;
+                }
+
+                // Static strings are looked up in the dictionary
+                case static_str_t:
+                {
+                    uint32_t id = nb.getNext<uint32_t>();
+                    const char *str = "(unknown static string)";
+                    if (staticStrings != nullptr &&
+                            id < staticStrings->size())
+                        str = (*staticStrings)[id].c_str();
+
+                    formatSingleArg(out,
+                                   logArgs,
+                                   op,
+                                   str,
+                                   width, precision);
+                    break;
+                }
+
                 case MAX_FORMAT_TYPE:
                 default:
                     fprintf(outputFd,
@@ -1662,10 +3974,14 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
                     + sizeof(PrintFragment));
         }
 
-        if (outputFd)
-            fprintf(outputFd, "\r\n");
+        if (out) {
+            out->append("\r\n");
+            fwrite_unlocked(out->data(), 1, out->size(), outputFd);
+        }
+
         // We're done, advance the pointer to the end of the last string
-        readPos = nextStringArg;
+        if (!deltaEncoded)
+            readPos = nextStringArg;
     }
 
     logMsgsProcessed++;
@@ -1679,6 +3995,200 @@ Log::Decoder::BufferFragment::decompressNextLogStatement(FILE *outputFd,
     return true;
 }
 
+/**
+ * Consume the next log message in the BufferFragment without formatting it
+ * or unpacking it into a LogMessage, optionally extracting one of its
+ * arguments into an ArgumentBatch. The other arguments are skipped over
+ * without being decoded. It is the responsibility of the caller to ensure
+ * that the BufferFragment contains a next log message (i.e. via hasNext()).
+ *
+ * \param checkpoint
+ *      The checkpoint describing how the log messages were encoded
+ * \param fmtId2metadata
+ *      The dictionary describing the log messages' arguments
+ * \param argIndex
+ *      Index of the argument to extract (0-based, not counting dynamic widths
+ *      and precisions), or -1 to only skip over the log message
+ * \param batch
+ *      ArgumentBatch to append the log message's timestamp and argument to
+ *      when argIndex is non-negative
+ *
+ * \return
+ *      true if successful; false indicates that the log message isn't in the
+ *      dictionary or that the argument can't be extracted
+ */
+bool
+Log::Decoder::BufferFragment::extractNextArgument(
+                                        const Checkpoint &checkpoint,
+                                        std::vector<void*>& fmtId2metadata,
+                                        int argIndex,
+                                        ArgumentBatch *batch)
+{
+    using namespace BufferUtils;
+
+    if (nextLogId >= fmtId2metadata.size()) {
+        fprintf(stderr, "Extracting arguments requires the dictionary in the "
+                        "log file, but logId=%u isn't in it\r\n", nextLogId);
+        return false;
+    }
+
+    auto *metadata = reinterpret_cast<FormatMetadata*>(
+                                            fmtId2metadata[nextLogId]);
+    PrintFragment *pf = reinterpret_cast<PrintFragment*>(
+            reinterpret_cast<char*>(metadata)
+            + sizeof(FormatMetadata)
+            + metadata->filenameLength);
+
+    const char *args = readPos;
+    bool deltaEncoded = (checkpoint.flags & DELTA_ENCODED_ARGUMENTS);
+    if (deltaEncoded) {
+        args = expandArguments(metadata);
+        if (args == nullptr) {
+            fprintf(stderr, "Error: Corrupt delta encoded arguments for "
+                            "logId=%u\r\n", nextLogId);
+            return false;
+        }
+    }
+
+    Nibbler nb(args, metadata->numNibbles);
+    const char *nextStringArg = nb.getEndOfPackedArguments();
+    bool extracted = (argIndex < 0);
+    int arg = 0;
+
+    for (int i = 0; i < metadata->numPrintFragments; ++i) {
+        if (pf->hasDynamicWidth)
+            nb.skipNext();
+
+        if (pf->hasDynamicPrecision)
+            nb.skipNext();
+
+        FormatType argType = static_cast<FormatType>(pf->argType);
+        bool isString = (argType == const_char_ptr_t ||
+                         argType == const_wchar_t_ptr_t ||
+                         argType == static_str_t);
+        if (isString && arg == argIndex) {
+            fprintf(stderr, "Argument %d of logId=%u is a string, which "
+                            "can't be extracted\r\n", argIndex, nextLogId);
+            return false;
+        }
+
+        if (argType == custom_t && arg == argIndex) {
+            fprintf(stderr, "Argument %d of logId=%u has a user-defined type, "
+                            "which can't be extracted\r\n", argIndex,
+                            nextLogId);
+            return false;
+        }
+
+        if (argType == custom_t) {
+            nextStringArg += nb.getNext<uint32_t>();
+        } else if (argType == const_char_ptr_t) {
+            nextStringArg += strlen(nextStringArg) + 1;
+        } else if (argType == const_wchar_t_ptr_t) {
+            nextStringArg += (wcslen(reinterpret_cast<const wchar_t*>(
+                                        nextStringArg)) + 1)*sizeof(wchar_t);
+        } else if (argType != NONE && arg != argIndex) {
+            nb.skipNext();
+        } else if (argType != NONE) {
+            int64_t *intValue = &batch->ints[batch->size];
+            double *doubleValue = &batch->doubles[batch->size];
+
+            switch (argType) {
+                case unsigned_char_t:
+                    *intValue = nb.getNext<unsigned char>();
+                    break;
+                case unsigned_short_int_t:
+                    *intValue = nb.getNext<unsigned short int>();
+                    break;
+                case unsigned_int_t:
+                    *intValue = nb.getNext<unsigned int>();
+                    break;
+                case unsigned_long_int_t:
+                    *intValue = static_cast<int64_t>(
+                                        nb.getNext<unsigned long int>());
+                    break;
+                case unsigned_long_long_int_t:
+                    *intValue = static_cast<int64_t>(
+                                        nb.getNext<unsigned long long int>());
+                    break;
+                case uintmax_t_t:
+                    *intValue = static_cast<int64_t>(nb.getNext<uintmax_t>());
+                    break;
+                case size_t_t:
+                    *intValue = static_cast<int64_t>(nb.getNext<size_t>());
+                    break;
+                case wint_t_t:
+                    *intValue = nb.getNext<wint_t>();
+                    break;
+                case signed_char_t:
+                    *intValue = nb.getNext<signed char>();
+                    break;
+                case short_int_t:
+                    *intValue = nb.getNext<short int>();
+                    break;
+                case int_t:
+                    *intValue = nb.getNext<int>();
+                    break;
+                case long_int_t:
+                    *intValue = nb.getNext<long int>();
+                    break;
+                case long_long_int_t:
+                    *intValue = nb.getNext<long long int>();
+                    break;
+                case intmax_t_t:
+                    *intValue = nb.getNext<intmax_t>();
+                    break;
+                case ptrdiff_t_t:
+                    *intValue = nb.getNext<ptrdiff_t>();
+                    break;
+                case const_void_ptr_t:
+                    *intValue = static_cast<int64_t>(nb.getNext<uint64_t>());
+                    break;
+                case double_t:
+                    *doubleValue = nb.getNext<double>();
+                    break;
+                case long_double_t:
+                    *doubleValue = static_cast<double>(
+                                        nb.getNext<long double>());
+                    break;
+                default:
+                    fprintf(stderr, "Error: Corrupt log header in header "
+                                    "file\r\n");
+                    return false;
+            }
+
+            batch->timestamps[batch->size] = nextLogTimestamp;
+            batch->argType = argType;
+            ++batch->size;
+            extracted = true;
+        }
+
+        if (argType != NONE)
+            ++arg;
+
+        pf = reinterpret_cast<PrintFragment*>(
+                reinterpret_cast<char*>(pf)
+                + pf->fragmentLength
+                + sizeof(PrintFragment));
+    }
+
+    if (!extracted) {
+        fprintf(stderr, "LogId=%u has only %d arguments, so argument %d "
+                        "can't be extracted\r\n", nextLogId, arg, argIndex);
+        return false;
+    }
+
+    if (!deltaEncoded)
+        readPos = nextStringArg;
+
+    if (readPos >= endOfBuffer)
+        hasMoreLogs = false;
+    else
+        hasMoreLogs = decompressLogHeader(&readPos, nextLogTimestamp,
+                                          nextLogId, nextLogTimestamp);
+
+    return true;
+}
+
 /**
  * Whether one can invoke decompressNextLogStatement or not
  */
@@ -1699,6 +4209,103 @@ Log::Decoder::BufferFragment::getNextLogTimestamp() const
     return nextLogTimestamp;
 }
 
+/**
+ * Decompress and format all the log messages in the BufferFragment ahead of
+ * time into an in-memory buffer which can later be output message by message
+ * via outputNextRenderedLog(). This allows the expensive formatting of
+ * multiple BufferFragments to be performed in parallel, while the relatively
+ * cheap task of ordering the messages by time remains serial.
+ *
+ * The function touches no state outside of the BufferFragment, so it's safe
+ * to invoke on different BufferFragments concurrently so long as the
+ * checkpoint and dictionary are not modified in the meantime.
+ *
+ * \param checkpoint
+ *      The checkpoint containing rdtsc-to-time mapping this function should use
+ * \param fmtId2metadata
+ *      Mapping of format ids to the dictionary entries to decompress with
+ *
+ * \return
+ *      true if the log messages were successfully rendered; false if the
+ *      in-memory buffer could not be created, in which case the
+ *      BufferFragment is untouched and can be still decompressed on demand.
+ */
+bool
+Log::Decoder::BufferFragment::render(const Checkpoint &checkpoint,
+                                     std::vector<void*>& fmtId2metadata)
+{
+    FILE *memFd = open_memstream(&renderedOutput, &renderedOutputSize);
+    if (memFd == nullptr)
+        return false;
+
+    LogMessage logArgs;
+    uint64_t logMsgsRendered = 0;
+    renderedLogs.clear();
+    nextRenderedLog = 0;
+
+    while (hasMoreLogs) {
+        RenderedLog log;
+        log.timestamp = nextLogTimestamp;
+        log.logId = nextLogId;
+        if (!decompressNextLogStatement(memFd, logMsgsRendered, logArgs,
+                                        checkpoint, fmtId2metadata))
+            break;
+
+        log.endOffset = ftell(memFd);
+        renderedLogs.push_back(log);
+    }
+
+    fclose(memFd);
+
+    hasMoreLogs = !renderedLogs.empty();
+    if (hasMoreLogs) {
+        nextLogTimestamp = renderedLogs.front().timestamp;
+        nextLogId = renderedLogs.front().logId;
+    }
+
+    return true;
+}
+
+/**
+ * Output the next log message formatted by render() and advance to the
+ * following one.
+ *
+ * \param outputFd
+ *      File descriptor to output the log message to
+ * \param[in/out] logMsgsProccessed
+ *      The number of log messages processed
+ *
+ * \return
+ *      true if a log message was output; false if there are no more rendered
+ *      log messages.
+ */
+bool
+Log::Decoder::BufferFragment::outputNextRenderedLog(FILE *outputFd,
+                                                uint64_t &logMsgsProcessed)
+{
+    if (!hasMoreLogs || nextRenderedLog >= renderedLogs.size()) {
+        hasMoreLogs = false;
+        return false;
+    }
+
+    size_t start = (nextRenderedLog == 0) ? 0
+                                : renderedLogs[nextRenderedLog - 1].endOffset;
+    size_t end = renderedLogs[nextRenderedLog].endOffset;
+    if (outputFd)
+        fwrite(renderedOutput + start, 1, end - start, outputFd);
+
+    ++logMsgsProcessed;
+    ++nextRenderedLog;
+
+    hasMoreLogs = (nextRenderedLog < renderedLogs.size());
+    if (hasMoreLogs) {
+        nextLogTimestamp = renderedLogs[nextRenderedLog].timestamp;
+        nextLogId = renderedLogs[nextRenderedLog].logId;
+    }
+
+    return true;
+}
+
 /**
  * Decompress the log file that was open()-ed and print the message out in
  * an arbitrary order (i.e. dependent on runtime implementation and not
@@ -1729,16 +4336,31 @@ Log::Decoder::internalDecompressUnordered(FILE* outputFd,
     if (filename.empty() || !inputFd)
        return false;
 
+    // Number of log messages discarded for not being selected for output
+    uint64_t logMsgsSkipped = 0;
+
+    // When only aggregating, output buffers without the target can be skipped
+    long requiredLogId = -1;
+    if (aggregationFn != nullptr && outputFd == nullptr &&
+            aggregationTargetId != static_cast<uint32_t>(-1)) {
+        requiredLogId = aggregationTargetId;
+        if (index.empty())
+            readIndex(index);
+    }
+
     LogMessage logArguments;
     BufferFragment *bf = allocateBufferFragment();
-    while(!feof(inputFd) && good) {
+    while(!endOfInput() && good) {
         bool wrapAround = false;
 
+        skipUnselectedBuffers(requiredLogId);
         EntryType entry = peekEntryType(inputFd);
         switch (entry) {
             case EntryType::BUFFER_EXTENT:
             {
-                if (!bf->readBufferExtent(inputFd, &wrapAround)){
+                if (!bf->readBufferExtent(inputFd, &wrapAround,
+                                          checkpoint.outputBufferSize,
+                                          mappedLog, mappedLogSize)) {
                     fprintf(stderr,
                             "Internal Error: Corrupted BufferExtent\r\n");
                     break;
@@ -1746,6 +4368,15 @@ Log::Decoder::internalDecompressUnordered(FILE* outputFd,
 
                 ++numBufferFragmentsRead;
                 while (bf->hasNext()) {
+                    if (!isSelected(bf)) {
+                        bf->decompressNextLogStatement(nullptr,
+                                                       logMsgsSkipped,
+                                                       logArguments,
+                                                       checkpoint,
+                                                       fmtId2metadata);
+                        continue;
+                    }
+
                     bf->decompressNextLogStatement(outputFd,
                                                     logMsgsPrinted,
                                                     logArguments,
@@ -1759,7 +4390,7 @@ Log::Decoder::internalDecompressUnordered(FILE* outputFd,
             case EntryType::CHECKPOINT:
                 if (!readDictionary(inputFd, true))
                     good = false;
-                else if (outputFd)
+                else if (outputFd && !(checkpoint.flags & CLOCK_SYNC))
                     fprintf(outputFd, "\r\n# New execution started\r\n");
 
                 break;
@@ -1803,18 +4434,65 @@ Log::Decoder::compareBufferFragments(const BufferFragment *a,
     return a->getNextLogTimestamp() > b->getNextLogTimestamp();
 };
 
+/**
+ * Render (see BufferFragment::render()) a list of BufferFragments with a pool
+ * of worker threads. The function returns once all the fragments have been
+ * processed.
+ *
+ * \param fragments
+ *      BufferFragments to render
+ * \param numThreads
+ *      Maximum number of worker threads to render with
+ * \param checkpoint
+ *      The checkpoint containing rdtsc-to-time mapping to render with
+ * \param fmtId2metadata
+ *      Mapping of format ids to the dictionary entries to render with
+ */
+void
+Log::Decoder::renderBufferFragments(std::vector<BufferFragment*> &fragments,
+                                    uint32_t numThreads,
+                                    const Checkpoint &checkpoint,
+                                    std::vector<void*>& fmtId2metadata)
+{
+    std::atomic<size_t> nextFragment(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nextFragment.fetch_add(1)) < fragments.size())
+            fragments[i]->render(checkpoint, fmtId2metadata);
+    };
+
+    // localtime_r() is not required to initialize the timezone information,
+    // so ensure it's done (once) before the workers need it.
+    tzset();
+
+    size_t numWorkers = std::min<size_t>(numThreads, fragments.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < numWorkers; ++i)
+        workers.emplace_back(worker);
+
+    // The calling thread participates as the last worker
+    worker();
+
+    for (auto &thread : workers)
+        thread.join();
+}
+
 /**
  * Decompress the log file that was open()-ed and print the log messages out
  * in chronological order.
  *
  * \param outputFd
  *      The file descriptor to print the log messages to
+ * \param numThreads
+ *      Number of threads to decompress the log with. With more than one
+ *      thread, the BufferExtents buffered are decompressed and formatted in
+ *      parallel and only the ordered merge of their log messages is serial.
  *
  * \return
  *      The number of log messages encountered. A negative value indicates error
  */
 int64_t
-Log::Decoder::decompressTo(FILE* outputFd)
+Log::Decoder::decompressTo(FILE* outputFd, uint32_t numThreads)
 {
     if (filename.empty() || !inputFd)
         return -1;
@@ -1828,8 +4506,19 @@ Log::Decoder::decompressTo(FILE* outputFd)
     // implementation detail in StagingBuffer whereby one peek() does not
     // return all the data and at least 2 peek()'s are needed to deplete a
     // buffer.
-    static const uint32_t stagesToBuffer = 3;
-    std::vector<BufferFragment*> stages[stagesToBuffer];
+    //
+    // More generally, a stage can be depleted so long as the 2 stages after it
+    // are buffered. When decompressing in parallel, we buffer an additional
+    // stage per thread so that each round has enough BufferFragments to keep
+    // all the threads busy.
+    static const uint32_t stagesLookahead = 2;
+    numThreads = std::max(1U, numThreads);
+    const uint32_t stagesToBuffer = stagesLookahead + numThreads;
+    std::vector<std::vector<BufferFragment*>> stages(stagesToBuffer);
+
+    // BufferFragments read in the current round that have yet to be rendered
+    // by the worker threads (only used when numThreads > 1).
+    std::vector<BufferFragment*> fragmentsToRender;
 
     // Running number of stages being kept in stages
     uint32_t stagesBuffered = 0;
@@ -1840,32 +4529,51 @@ Log::Decoder::decompressTo(FILE* outputFd)
     // reached the end of the current file
     bool mustDepleteAllStages = false;
 
+    // Number of log messages discarded for not being selected for output
+    uint64_t logMsgsSkipped = 0;
+
     LogMessage logArguments;
-    while (!feof(inputFd) && good) {
+    while (!endOfInput() && good) {
 
         // Step 1: Read in up to a certain number of "stages" of BufferFragments
         mustDepleteAllStages = false;
-        while (!feof(inputFd) && good && !mustDepleteAllStages) {
+        while (!endOfInput() && good && !mustDepleteAllStages) {
+            // Skipped output buffers still delimit stages
+            bool newStage = (skipUnselectedBuffers() > 0);
             EntryType entry = peekEntryType(inputFd);
-            bool newStage = false;
 
             switch (entry) {
                 case EntryType::BUFFER_EXTENT:
                 {
                     BufferFragment *bf = allocateBufferFragment();
-                    good = bf->readBufferExtent(inputFd, &newStage);
+                    good = bf->readBufferExtent(inputFd, &newStage,
+                                                checkpoint.outputBufferSize,
+                                                mappedLog, mappedLogSize);
                     ++numBufferFragmentsRead;
 
-                    if (good)
+                    if (good) {
                         stages[stagesBuffered].push_back(bf);
+                        if (numThreads > 1)
+                            fragmentsToRender.push_back(bf);
+                    }
 
                     break;
                 }
                 case EntryType::CHECKPOINT:
+                {
+                    // Clock syncs only refresh the checkpoint, so the log
+                    // messages buffered so far can be sorted along with the
+                    // ones that follow.
+                    Checkpoint next;
+                    long checkpointOffset = ftell(inputFd);
+                    bool clockSync = readCheckpoint(next, inputFd) &&
+                                     (next.flags & CLOCK_SYNC);
+                    fseek(inputFd, checkpointOffset, SEEK_SET);
+
                     // New logical start to the logs detected, at this point
                     // we should make sure we've printed all the buffered logs
                     // before continuing to parse the next logical start.
-                    if (!stages[0].empty()) {
+                    if (!clockSync && !stages[0].empty()) {
                         mustDepleteAllStages = true;
                         break;
                     }
@@ -1873,10 +4581,11 @@ Log::Decoder::decompressTo(FILE* outputFd)
                     // We're safe, all the stages are empty
                     good = readDictionary(inputFd, true);
 
-                    if (good)
+                    if (good && !clockSync)
                         fprintf(outputFd,"\r\n# New execution started\r\n");
 
                     break;
+                }
 
                 case EntryType::LOG_MSGS_OR_DIC:
                     good = readDictionaryFragment(inputFd);
@@ -1889,7 +4598,7 @@ Log::Decoder::decompressTo(FILE* outputFd)
                     break;
             }
 
-            if (feof(inputFd))
+            if (endOfInput())
                 mustDepleteAllStages = true;
 
             // If we reach a logical end to the current stage,
@@ -1902,6 +4611,15 @@ Log::Decoder::decompressTo(FILE* outputFd)
                 break;
         }
 
+        // Step 1b: Decompress the newly read BufferFragments in parallel. This
+        // must occur after all the reads for the round since reading may
+        // modify the dictionary the fragments are decompressed with.
+        if (!fragmentsToRender.empty()) {
+            renderBufferFragments(fragmentsToRender, numThreads, checkpoint,
+                                  fmtId2metadata);
+            fragmentsToRender.clear();
+        }
+
         // Step 2: Heapify all BufferFragments within the stages from
         // front=max to back=min
         for (auto &stage : stages) {
@@ -1931,9 +4649,15 @@ Log::Decoder::decompressTo(FILE* outputFd)
 
             // Step 3b: Output the log message
             BufferFragment *bf = minStage->front();
-            bf->decompressNextLogStatement(outputFd, logMsgsPrinted,
-                                           logArguments, checkpoint,
-                                           fmtId2metadata);
+            bool selected = isSelected(bf);
+            FILE *fd = (selected) ? outputFd : nullptr;
+            uint64_t &counter = (selected) ? logMsgsPrinted : logMsgsSkipped;
+            if (bf->renderedOutput) {
+                bf->outputNextRenderedLog(fd, counter);
+            } else {
+                bf->decompressNextLogStatement(fd, counter, logArguments,
+                                               checkpoint, fmtId2metadata);
+            }
 
             // Moves the minimum element to the end of the array
             std::pop_heap(minStage->begin(), minStage->end(),
@@ -1957,7 +4681,7 @@ Log::Decoder::decompressTo(FILE* outputFd)
                 stages[stagesBuffered - 1].clear();
 
                 --stagesBuffered;
-                if (!mustDepleteAllStages)
+                if (!mustDepleteAllStages && stagesBuffered <= stagesLookahead)
                     break;
             }
         }
@@ -1970,7 +4694,8 @@ Log::Decoder::decompressTo(FILE* outputFd)
  * Iterative interface to decompress the next log statement (if there are any)
  * in the log file and optionally prints it via outputFd. The log statements
  * are output in the order in which they appear in the log which may not be
- * in chronological order.
+ * in chronological order. In follow mode (see setFollow()), this waits for
+ * the log file to grow once the end of it has been reached.
  *
  * \param[out] logMsg
  *          Log message that's decompressed; the contents are valid until
@@ -1987,47 +4712,94 @@ Log::Decoder::decompressTo(FILE* outputFd)
 bool
 Log::Decoder::getNextLogStatement(LogMessage &logMsg,
                                   FILE *outputFd) {
-    if (bufferFragment->hasNext()) {
-        bufferFragment->decompressNextLogStatement(outputFd,
-                                                        logMsgsPrinted,
-                                                        logMsg,
-                                                        checkpoint,
-                                                        fmtId2metadata,
-                                                        -1,
-                                                        nullptr);
-        return true;
-    }
+    // Number of log messages discarded for not being selected for output
+    uint64_t logMsgsSkipped = 0;
+
+    while (true) {
+        while (bufferFragment->hasNext()) {
+            if (!isSelected(bufferFragment)) {
+                bufferFragment->decompressNextLogStatement(nullptr,
+                                                           logMsgsSkipped,
+                                                           logMsg,
+                                                           checkpoint,
+                                                           fmtId2metadata);
+                continue;
+            }
+
+            bufferFragment->decompressNextLogStatement(outputFd,
+                                                            logMsgsPrinted,
+                                                            logMsg,
+                                                            checkpoint,
+                                                            fmtId2metadata,
+                                                            -1,
+                                                            nullptr);
+            return true;
+        }
+
+        logMsg.reset();
 
-    logMsg.reset();
+        if (!readNextBufferFragment(outputFd))
+            return false;
+    }
+}
 
+/**
+ * Reads the log file up to and including the next BufferExtent into
+ * bufferFragment once the log messages of the current one have been
+ * consumed, processing the Checkpoints and dictionary fragments along the
+ * way. In follow mode (see setFollow()), this waits for the log file to grow
+ * once the end of it has been reached.
+ *
+ * \param outputFd
+ *      File descriptor that log messages are output to (used to announce new
+ *      executions), or nullptr
+ * \param requiredLogId
+ *      If non-negative, output buffers that according to the index contain no
+ *      log messages with this logId are skipped (see skipUnselectedBuffers())
+ *
+ * \return
+ *      true if bufferFragment has log messages that can be decompressed;
+ *      false indicates the end of the log was reached or there's an error
+ */
+bool
+Log::Decoder::readNextBufferFragment(FILE *outputFd, long requiredLogId)
+{
     // Decoder was never 'opened' properly
     if (filename.empty() || !inputFd)
         return false;
 
     // We've read the end of the file or an error
-    if (feof(inputFd) || !good)
+    if ((!follow && endOfInput()) || !good)
         return false;
 
-    while(!bufferFragment->hasNext() && !feof(inputFd) && good) {
+    while(!bufferFragment->hasNext() && (follow || !endOfInput()) && good) {
+        skipUnselectedBuffers(requiredLogId);
+        if (follow && !waitForNextEntry(outputFd))
+            break;
+
         EntryType entry = peekEntryType(inputFd);
         bool wrapAround;
 
         switch (entry) {
             case EntryType::BUFFER_EXTENT:
-                if (bufferFragment->readBufferExtent(inputFd, &wrapAround)) {
+                if (bufferFragment->readBufferExtent(inputFd, &wrapAround,
+                                        checkpoint.outputBufferSize,
+                                        mappedLog, mappedLogSize)) {
                     ++numBufferFragmentsRead;
                     break;
                 }
 
-                fprintf(stderr, "Internal Error: Corrupted BufferExtent\r\n");
+                fprintf(stderr,
+                        "Internal Error: Corrupted BufferExtent\r\n");
                 good = false;
                 return false;
 
             case EntryType::CHECKPOINT:
                 if (readDictionary(inputFd, true)) {
 
-                    if (outputFd)
-                        fprintf(outputFd, "\r\n# New execution started\r\n");
+                    if (outputFd && !(checkpoint.flags & CLOCK_SYNC))
+                        fprintf(outputFd,
+                                "\r\n# New execution started\r\n");
 
                     break;
                 }
@@ -2047,13 +4819,75 @@ Log::Decoder::getNextLogStatement(LogMessage &logMsg,
         }
     }
 
-    return bufferFragment->decompressNextLogStatement(outputFd,
-                                                            logMsgsPrinted,
-                                                            logMsg,
-                                                            checkpoint,
-                                                            fmtId2metadata,
-                                                            -1,
-                                                            nullptr);
+    return bufferFragment->hasNext();
+}
+
+/**
+ * Iterative interface to aggregate over an argument of a LOG statement. It
+ * decompresses the next log messages produced by the LOG statement that are
+ * selected by setTimeRange() and setLogFilter() and stores their timestamps
+ * and the argument into an ArgumentBatch, up to ArgumentBatch::CAPACITY
+ * log messages at a time. Compared to getNextLogStatement(), the log messages
+ * aren't unpacked into LogMessages and the arguments of the other log
+ * messages are skipped over without being decoded, and output buffers that
+ * don't contain the LOG statement are skipped with the log's index.
+ *
+ * This relies on the argument types recorded in the log file's dictionary
+ * and a batch never spans two executions since they may assign the logId to
+ * different LOG statements.
+ *
+ * \param logId
+ *      Identifier of the LOG statement to extract the argument of
+ * \param argIndex
+ *      Index of the argument (0-based, in the order they appear in the format
+ *      string and not counting dynamic widths and precisions) to extract; it
+ *      must be an integer, pointer or floating point argument
+ * \param[out] batch
+ *      Filled in with the next log messages' timestamps and argument
+ *
+ * \return
+ *      true if the batch contains log messages; false indicates there are no
+ *      more log messages or there's an error
+ */
+bool
+Log::Decoder::getNextArgumentBatch(uint32_t logId, uint32_t argIndex,
+                                   ArgumentBatch &batch)
+{
+    uint32_t executionsSeen = numCheckpointsRead;
+    batch.size = 0;
+    batch.argType = NONE;
+
+    // Output buffers without the logId can be skipped
+    if (index.empty())
+        readIndex(index);
+
+    while (true) {
+        while (bufferFragment->hasNext()) {
+            if (batch.size == ArgumentBatch::CAPACITY)
+                return true;
+
+            bool extract = bufferFragment->nextLogId == logId &&
+                                isSelected(bufferFragment);
+            if (!bufferFragment->extractNextArgument(checkpoint,
+                                        fmtId2metadata,
+                                        (extract) ? argIndex : -1,
+                                        (extract) ? &batch : nullptr)) {
+                good = false;
+                return false;
+            }
+        }
+
+        if (!readNextBufferFragment(nullptr, logId))
+            return batch.size > 0;
+
+        // Leave the log messages of the new execution to the next batch
+        if (numCheckpointsRead != executionsSeen) {
+            if (batch.size > 0)
+                return true;
+
+            executionsSeen = numCheckpointsRead;
+        }
+    }
 }
 
 /**
@@ -2074,4 +4908,66 @@ Log::Decoder::decompressUnordered(FILE* outputFd) {
     return (success) ? logMsgsPrinted : -1;
 }
 
+/**
+ * Decompress the file open()-ed and export the log messages selected by
+ * setTimeRange() and setLogFilter() as typed columns rather than text (see
+ * ColumnarWriter.h for the format). Each LOG statement's messages are
+ * exported in batches containing their wall times, runtimeIds and arguments,
+ * which allows analytics to scan the arguments without formatting and
+ * re-parsing the log messages.
+ *
+ * This relies on the argument types recorded in the log file's dictionary;
+ * logs that don't contain one can't be exported.
+ *
+ * \param outputFd
+ *      File descriptor to write the columnar export to
+ * \return
+ *      The number of log messages exported; a negative value indicates error
+ */
+int64_t
+Log::Decoder::exportColumns(FILE *outputFd) {
+    ColumnarWriter writer(outputFd);
+    LogMessage logMsg;
+    uint32_t executionsSeen = numCheckpointsRead;
+    int64_t logMsgsExported = 0;
+
+    while (getNextLogStatement(logMsg, nullptr)) {
+        // A new dictionary means that the logIds may have been reassigned
+        if (numCheckpointsRead != executionsSeen) {
+            executionsSeen = numCheckpointsRead;
+            if (!writer.startExecution())
+                return -1;
+        }
+
+        uint32_t logId = logMsg.getLogId();
+        if (logId >= fmtId2metadata.size()) {
+            fprintf(stderr, "Columnar export requires the dictionary in the "
+                            "log file, but logId=%u isn't in it\r\n", logId);
+            return -1;
+        }
+
+        double secondsSinceCheckpoint = PerfUtils::Cycles::toSeconds(
+                        static_cast<int64_t>(logMsg.getTimestamp()
+                                                        - checkpoint.rdtsc),
+                        checkpoint.cyclesPerSecond);
+        int64_t timestamp = getCheckpointTime(checkpoint)
+                        + std::llround(1.0e9*secondsSinceCheckpoint);
+
+        if (!writer.append(logId,
+                    static_cast<FormatMetadata*>(fmtId2metadata[logId]),
+                    fmtId2fmtString[logId].c_str(),
+                    timestamp,
+                    bufferFragment->runtimeId,
+                    logMsg))
+            return -1;
+
+        ++logMsgsExported;
+    }
+
+    if (!good || !writer.flush())
+        return -1;
+
+    return logMsgsExported;
+}
+
 }; /* NanoLogInternal */
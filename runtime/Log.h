@@ -14,6 +14,8 @@
  */
 
 #include <ctime>
+#include <deque>
+#include <string>
 #include <vector>
 
 #include <cassert>
@@ -29,6 +31,13 @@
 
 #ifndef LOG_H
 #define LOG_H
+
+// Defined in NanoLog.h; see Log::Decoder::registerSerializer()
+namespace NanoLog {
+template<typename T>
+struct Serializer;
+}
+
 /**
  * The Log namespace contains a collection of data structures and functions
  * to manage the metadata in the various buffers of the NanoLog system.
@@ -114,6 +123,24 @@ enum ParamType : int32_t {
 // invocation sites.
 static constexpr int UNASSIGNED_LOGID = -1;
 
+// Transient value for log identifiers indicating that a thread is in the
+// middle of registering the invocation site. Other threads encountering this
+// value should wait for a non-negative identifier to be published.
+static constexpr int REGISTERING_LOGID = -2;
+
+/**
+ * States of the runtime enable flag of a C++17 NANO_LOG invocation site (see
+ * NanoLog::setLogSiteEnabled()). Sites are unregistered until they're first
+ * executed and then either follow the log level or have been explicitly
+ * enabled or disabled.
+ */
+enum LogSiteState : uint8_t {
+    LOG_SITE_UNREGISTERED = 0,
+    LOG_SITE_DEFAULT,
+    LOG_SITE_ENABLED,
+    LOG_SITE_DISABLED
+};
+
 /**
  * Stores the static log information associated with a log invocation site
  * (i.e. filename/line/fmtString combination).
@@ -122,7 +149,9 @@ struct StaticLogInfo {
 
     // Function signature of the compression function used in the
     // non-preprocessor version of NanoLog
-    typedef void (*CompressionFn)(int, const ParamType*, char**, char**);
+    typedef void (*CompressionFn)(int, const ParamType*, char**, char**,
+                                  BufferUtils::ArgumentHistory*,
+                                  BufferUtils::StaticStringTable*);
 
     // Constructor
     constexpr StaticLogInfo(CompressionFn compress,
@@ -303,13 +332,18 @@ namespace Log {
      * runtime machine's rdtsc() with a wall time and the translation between
      * the two in the compressed log. This entry should typically only appear
      * once at the beginning of a new log. If multiple exist in the log file,
-     * that means the file has been appended to.
+     * that means the file has been appended to, unless they're flagged as
+     * CLOCK_SYNC.
      */
     NANOLOG_PACK_PUSH
     struct Checkpoint {
         // Byte representation of an EntryType::CHECKPOINT
         uint64_t entryType:2;
 
+        // Nanoseconds past the unixTime below; only valid if flagged as
+        // PRECISE_TIME (see getCheckpointTime())
+        uint64_t unixTimeNanos:30;
+
         // rdtsc() time that corresponds with the unixTime below
         uint64_t rdtsc;
 
@@ -330,6 +364,138 @@ namespace Log {
         // in the log file.
         uint32_t totalMetadataEntries;
 
+        // Size of the runtime output buffer that the log following this
+        // checkpoint was encoded into. Encoded BufferExtents can be no larger
+        // than this, so the decoder can use it to size its buffers and to
+        // detect corrupted extents.
+        uint32_t outputBufferSize;
+
+        // Bitwise-or of the CheckpointFlags describing how the log following
+        // this checkpoint was encoded
+        uint32_t flags;
+    };
+    NANOLOG_PACK_POP
+
+    /**
+     * Options the log following a Checkpoint may have been encoded with.
+     */
+    enum CheckpointFlags : uint32_t {
+        // The arguments of log messages are delta encoded against the
+        // previous log message from the same log site in the BufferExtent
+        // (see BufferUtils::ArgumentHistory).
+        DELTA_ENCODED_ARGUMENTS = 1,
+
+        // Everything up to the next Checkpoint is split into CompressedBlocks
+        // (see NanoLog::setBlockCompression()). This Checkpoint itself is
+        // stored as is, but the dictionary following it is compressed.
+        BLOCK_COMPRESSED = 2,
+
+        // The Checkpoint's unixTimeNanos is valid, i.e. the wall time was read
+        // with nanosecond resolution right next to the rdtsc()
+        PRECISE_TIME = 4,
+
+        // The Checkpoint only refreshes the correlation of rdtsc() with the
+        // wall time part way through a log (see Encoder::encodeClockSync());
+        // it carries no dictionary and the log continues as before.
+        CLOCK_SYNC = 8
+    };
+
+    /**
+     * Returns the wall time of a Checkpoint in nanoseconds since the epoch
+     */
+    inline int64_t
+    getCheckpointTime(const Checkpoint &cp) {
+        int64_t ns = static_cast<int64_t>(cp.unixTime)*1000000000;
+        if (cp.flags & PRECISE_TIME)
+            ns += cp.unixTimeNanos;
+        return ns;
+    }
+
+    /**
+     * Algorithms the contents of a CompressedBlock may be compressed with.
+     */
+    enum BlockCodec : uint8_t {
+        // The contents are stored as is since they didn't compress
+        STORED_BLOCK = 0,
+
+        // The contents are in the LZ4 block format (see BlockCompressor)
+        LZ4_BLOCK = 1
+    };
+
+    /**
+     * Holds the contents of one runtime output buffer (i.e. dictionary
+     * fragments and BufferExtents) compressed as a whole when the log is
+     * BLOCK_COMPRESSED. The compressed bytes follow this header.
+     */
+    NANOLOG_PACK_PUSH
+    struct CompressedBlock {
+        // Byte representation of EntryType::LOG_MSGS_OR_DIC; the other
+        // entries only appear within the blocks, so there's no ambiguity.
+        uint8_t entryType:2;
+
+        // BlockCodec the contents were compressed with
+        uint8_t codec:6;
+
+        // Number of bytes following this header
+        uint32_t compressedLength;
+
+        // Number of bytes the contents decompress into
+        uint32_t uncompressedLength;
+    };
+    NANOLOG_PACK_POP
+
+    // Suffix appended to a compressed log's file name to form the name of its
+    // index file (see IndexEntry).
+    static const char INDEX_FILE_SUFFIX[] = ".idx";
+
+    // Number of 64-bit words in the IndexEntry bitmap of logIds
+    static const uint32_t INDEX_LOGID_WORDS = 4;
+
+    /**
+     * Sets the bit representing a logId in an IndexEntry bitmap of logIds.
+     * logIds share bits modulo the size of the bitmap, so a set bit only
+     * indicates that a logId *may* be present.
+     */
+    static inline void
+    setLogIdBit(uint64_t (&bitmap)[INDEX_LOGID_WORDS], uint32_t logId) {
+        bitmap[(logId/64) % INDEX_LOGID_WORDS] |= 1ULL << (logId % 64);
+    }
+
+    /**
+     * Entry in the index file that accompanies a compressed log. The runtime
+     * appends one entry per output buffer it writes to the log, which allows
+     * the Decoder to locate the portion of a log covering a time range
+     * without decompressing the entire file.
+     */
+    NANOLOG_PACK_PUSH
+    struct IndexEntry {
+        // Byte offset in the log of the Checkpoint that relates the rdtsc()
+        // timestamps in the output buffer to wall time
+        uint64_t checkpointOffset;
+
+        // Byte offset in the log of the output buffer
+        uint64_t offset;
+
+        // Number of bytes in the output buffer
+        uint32_t length;
+
+        // Indicates that the output buffer contains a Checkpoint and/or
+        // dictionary fragments that are needed to decode the buffers after it
+        uint32_t hasMetadata;
+
+        // Smallest and largest rdtsc() timestamps of the log messages in the
+        // output buffer. minTimestamp > maxTimestamp if there are none.
+        uint64_t minTimestamp;
+        uint64_t maxTimestamp;
+
+        // Bitmap of the logIds of the log messages in the output buffer
+        // (see setLogIdBit()); used to skip buffers that can't contain the
+        // log messages selected by Decoder::setLogFilter().
+        uint64_t logIds[INDEX_LOGID_WORDS];
+
+        // Number of BufferExtents in the output buffer that mark a new pass
+        // through the StagingBuffers (see BufferExtent::wrapAround)
+        uint32_t numWrapArounds;
     };
     NANOLOG_PACK_POP
 
@@ -376,6 +542,19 @@ namespace Log {
     };
     NANOLOG_PACK_POP
 
+    /**
+     * Severity of a CompressedLogInfo that adds a string logged via
+     * NanoLog::StaticStr to the dictionary rather than describing a log
+     * invocation site, so it doesn't take up a logId. Its linenum is the
+     * string's identifier, it has no filename and the string takes the place
+     * of the format string.
+     */
+    static const uint8_t STATIC_STRING_ENTRY = 0xFF;
+
+    // Type name with which the format strings tag the arguments logged via
+    // NanoLog::StaticStr, i.e. "%{NanoLog::StaticStr}s"
+    static const char STATIC_STRING_TYPE_NAME[] = "NanoLog::StaticStr";
+
     /**
      * Describes a unique log message within the user sources. The order in
      * which this structure appears in the log file determines the associated
@@ -429,6 +608,62 @@ namespace Log {
     };
     NANOLOG_PACK_POP
 
+    /**
+     * A PrintFragment resolved ahead of time by Decoder::compileFormat() so
+     * that decompressNextLogStatement() can render it without parsing the
+     * format fragment and going through printf for each log message.
+     */
+    struct FormatOp {
+        // Text preceding the format specifier, with "%%" resolved to '%'
+        std::string literal;
+
+        // The format specifier of the fragment (i.e. "%-8.3lf"); this is
+        // handed to snprintf when the conversion isn't rendered natively.
+        std::string specifier;
+
+        // Text following the format specifier, with "%%" resolved to '%'
+        std::string suffix;
+
+        // printf conversion character of the specifier (i.e. 'd' or 's'),
+        // or '\0' if the fragment has no specifier
+        char conversion;
+
+        // printf flags of the specifier
+        bool leftAlign;
+        bool forceSign;
+        bool spaceSign;
+        bool alternateForm;
+        bool zeroPad;
+
+        // Static field width and precision; -1 if unspecified or dynamic
+        int width;
+        int precision;
+
+        // Indicates that the width/precision are passed as arguments ('*')
+        bool dynamicWidth;
+        bool dynamicPrecision;
+
+        // Indicates that the fragment must be rendered with snprintf
+        bool useSnprintf;
+
+        FormatOp()
+            : literal()
+            , specifier()
+            , suffix()
+            , conversion('\0')
+            , leftAlign(false)
+            , forceSign(false)
+            , spaceSign(false)
+            , alternateForm(false)
+            , zeroPad(false)
+            , width(-1)
+            , precision(-1)
+            , dynamicWidth(false)
+            , dynamicPrecision(false)
+            , useSnprintf(false)
+        {}
+    };
+
 
     /**
      * These enums help encode LOG parameter types in the dynamic paramter
@@ -462,6 +697,13 @@ namespace Log {
         const_char_ptr_t,
         const_wchar_t_ptr_t,
 
+        // An argument of a user-defined type (see NanoLog::Serializer)
+        custom_t,
+
+        // A string logged via NanoLog::StaticStr, which is stored in the
+        // dictionary and referred to by its identifier
+        static_str_t,
+
         MAX_FORMAT_TYPE
     };
 
@@ -586,7 +828,12 @@ namespace Log {
 
     bool insertCheckpoint(char** out,
                           char *outLimit,
-                          bool writeDictionary);
+                          bool writeDictionary,
+                          uint32_t outputBufferSize,
+                          uint32_t flags=0);
+
+    size_t maxCompressedBlockSize(size_t nbytes);
+    size_t compressBlock(const char *in, size_t nbytes, char *out);
 
     /**
      * Extracts a checkpoint from a file descriptor.
@@ -653,7 +900,9 @@ namespace Log {
     PUBLIC:
         Encoder(char *buffer, size_t bufferSize,
                 bool skipCheckpoint=false,
-                bool forceDictionaryOutput=false);
+                bool forceDictionaryOutput=false,
+                bool deltaEncoding=false,
+                bool blockCompressed=false);
 
 #ifdef PREPROCESSOR_NANOLOG
         long encodeLogMsgs(char *from, uint64_t nbytes,
@@ -665,18 +914,50 @@ namespace Log {
         long encodeLogMsgs(char *from, uint64_t nbytes,
                                     uint32_t bufferId,
                                     bool wrapAround,
-                                    std::vector<StaticLogInfo> dictionary,
+                                    const std::vector<StaticLogInfo>& dictionary,
                                     uint64_t *numEventsCompressed);
         uint32_t encodeNewDictionaryEntries(uint32_t& currentPosition,
-                                            std::vector<StaticLogInfo> allMetadata);
+                                const std::vector<StaticLogInfo>& allMetadata);
 
         size_t getEncodedBytes();
+        void getEncodedTimestampRange(uint64_t *minTimestamp,
+                                      uint64_t *maxTimestamp);
+        bool hasEncodedMetadata();
+        void getEncodedLogIds(uint64_t (&bitmap)[INDEX_LOGID_WORDS]);
+        uint32_t getEncodedWrapArounds();
         void swapBuffer(char *inBuffer, size_t inSize,
                         char **outBuffer=nullptr, size_t *outLength=nullptr,
                         size_t *outSize=nullptr);
+        void startNewLog();
+        bool encodeClockSync();
+
+        /**
+         * Returns the rdtsc() of the last Checkpoint encoded (including the
+         * ones of encodeClockSync())
+         */
+        uint64_t getLastClockSync() {
+            return lastClockSyncCycles;
+        }
+
+        /**
+         * Makes encodeLogMsgs() add the compressed size of each log message
+         * to a counter of its log identifier, which is how the compressed
+         * output is attributed to the log invocation sites with
+         * -DRECORD_LOG_SITE_STATS.
+         *
+         * \param counters
+         *      NanoLogConfig::MAX_LOG_SITE_STATS + 1 counters indexed by log
+         *      identifier; the last counts all the larger identifiers. The
+         *      Encoder stops counting if nullptr.
+         */
+        void setCompressedBytesPerLogId(uint64_t *counters) {
+            compressedBytesPerLogId = counters;
+        }
 
     PRIVATE:
+        void encodeCheckpoint();
         bool encodeBufferExtentStart(uint32_t bufferId, bool wrapAround);
+        bool encodeStaticStrings();
 
         // Used to store the compressed log messages and related metadata
         char *backing_buffer;
@@ -704,6 +985,61 @@ namespace Log {
         // Metric: Number of consecutive encode failures due to missing metadata
         // Used to detect cases where the dictionary isn't persisted due to bugs
         uint32_t consecutiveEncodeMissesDueToMetadata;
+
+        // Smallest and largest timestamps of the log messages encoded into
+        // the current backing_buffer (used to build IndexEntry's)
+        uint64_t minTimestampEncoded;
+        uint64_t maxTimestampEncoded;
+
+        // Indicates that a Checkpoint or dictionary fragment was encoded into
+        // the current backing_buffer
+        bool metadataEncoded;
+
+        // Bitmap of the logIds encoded into the current backing_buffer
+        // (see setLogIdBit())
+        uint64_t logIdsEncoded[INDEX_LOGID_WORDS];
+
+        // Number of BufferExtents marked wrapAround encoded into the current
+        // backing_buffer
+        uint32_t wrapAroundsEncoded;
+
+        // Indicates that the arguments of log messages are delta encoded
+        // against the previous message from the same log site (see
+        // BufferUtils::ArgumentHistory), as recorded in the Checkpoint
+        bool deltaEncoding;
+
+        // The arguments each log site (indexed by logId) encoded last, valid
+        // only for the BufferExtent numbered extentsEncoded
+        std::vector<BufferUtils::ArgumentHistory> argumentHistories;
+
+        // Number of BufferExtents started by the Encoder
+        uint64_t extentsEncoded;
+
+        // The strings logged via NanoLog::StaticStr encountered since the
+        // last Checkpoint
+        BufferUtils::StaticStringTable staticStrings;
+
+        // Number of log invocation sites in the dictionary encoded since the
+        // last Checkpoint (see encodeNewDictionaryEntries())
+        uint32_t dictionaryEntriesEncoded;
+
+        // Counters of the compressed bytes encoded per log identifier; not
+        // counted if nullptr (see setCompressedBytesPerLogId())
+        uint64_t *compressedBytesPerLogId;
+
+        // Indicates that the dictionary is written out after each Checkpoint
+        bool checkpointDictionary;
+
+        // Bitwise-or of the CheckpointFlags recorded in each Checkpoint
+        uint32_t checkpointFlags;
+
+        // rdtsc() and wall time (see getCheckpointTime()) of the last
+        // Checkpoint encoded; encodeClockSync() measures the rate of rdtsc()
+        // against the wall time since then.
+        uint64_t lastClockSyncCycles;
+        int64_t lastClockSyncTime;
+
+        DISALLOW_COPY_AND_ASSIGN(Encoder);
     };
 
     /**
@@ -713,8 +1049,9 @@ namespace Log {
      * missing is the type information for the dynamic arguments. Users of this
      * class must know the dynamic arguments' types to push() and get() them.
      *
-     * Also, this class stores all the arguments as 8-byte parameters, so
-     * 16-byte dynamic arguments (i.e. long long double) are not supported.
+     * Also, this class stores the arguments as 8-byte parameters, so
+     * 16-byte dynamic arguments (i.e. long double) are kept on the side and
+     * arguments of user-defined types are stored as their formatted text.
      */
     class LogMessage {
     PRIVATE:
@@ -746,6 +1083,12 @@ namespace Log {
         // Extension for the arguments if we run out of space above
         uint64_t *rawArgsExtension;
 
+        // Arguments that don't fit in the 8-byte slots above: long doubles
+        // and the formatted text of user-defined types. The slots point to
+        // them instead; deques keep them in place as they grow.
+        std::deque<long double> longDoubleArgs;
+        std::deque<std::string> textArgs;
+
         void reserve(int nparams);
 
     PUBLIC:
@@ -762,8 +1105,8 @@ namespace Log {
         /**
          * Add a dynamic log argument into the structure.
          *
-         * Note: only 8-byte arguments are supported; this means that the
-         * "long double" type is not supported.
+         * Note: only arguments of at most 8 bytes are stored inline; see
+         * the "long double" overload below.
          *
          * \tparam T
          *      Type of the argument to be added to the structure (deduced)
@@ -813,47 +1156,104 @@ namespace Log {
         }
 
         /**
-         * Overload for push() that does nothing for the "long double" type
-         * since it's too wide. Attempting to access this parameter as a long
-         * double will result in an error.
+         * Overload for push() for the "long double" type, which is too wide
+         * for a slot; it's kept aside and the slot points to it.
          *
-         * \param phony
+         * \param in
          *      long double argument
          */
         inline void
-        push(long double phony) {
-            push<int>(-1);
+        push(long double in) {
+            longDoubleArgs.push_back(in);
+            push<const long double*>(&longDoubleArgs.back());
         }
 
         /**
-        * Specialization for get() that will raise an error when accessing
-        * an argument as a "long double". We do not support this currently
-        * since LogStatement is built with the assumption that types are at
-        * most 8-bytes wide.
-        *
-        * \tparam T
-        *      Type of the argument to return (long double).
-        * \param argNum
-        *      The n-th argument to return (0-based)
-        *
-        * \return
-        *      The argument (but really an error).
-        */
+         * Specialization for get() that returns a "long double" argument
+         * stored with the overload of push() above.
+         *
+         * \tparam T
+         *      Type of the argument to return (long double).
+         * \param argNum
+         *      The n-th argument to return (0-based)
+         *
+         * \return
+         *      The argument
+         */
         template<typename T>
         inline typename std::enable_if<std::is_same<T, long double>::value,
                                         T>::type
         get(int argNum) {
-            fprintf(stderr, "**ERROR** Aggregating on Long Doubles is "
-                            "currently unsupported\r\n");
-#ifndef TESTUTIL_H
-            exit(2);
-#endif
-            return -1.0;
+            return *get<const long double*>(argNum);
+        }
+
+        /**
+         * Keeps a copy of a string for the lifetime of the log message,
+         * i.e. the formatted text of an argument of a user-defined type,
+         * so that it can be push()-ed as a "const char*".
+         *
+         * \param text
+         *      String to copy
+         *
+         * \return
+         *      The copy, which remains valid until the next reset()
+         */
+        inline const char *
+        copyString(const std::string &text) {
+            textArgs.push_back(text);
+            return textArgs.back().c_str();
         }
 
         DISALLOW_COPY_AND_ASSIGN(LogMessage);
     };
 
+    /**
+     * Holds one argument of a batch of log messages produced by the same LOG
+     * statement in fixed-size column buffers. It's filled in by
+     * Decoder::getNextArgumentBatch() so that aggregations can scan the
+     * values in tight loops (see Aggregation.h) instead of pulling them out of
+     * a LogMessage one log message at a time.
+     */
+    struct ArgumentBatch {
+        // Maximum number of log messages in a batch
+        static const uint32_t CAPACITY = 4096;
+
+        // Number of log messages in the batch
+        uint32_t size;
+
+        // Type of the argument. Integer and pointer arguments are stored in
+        // ints (unsigned values above INT64_MAX wrap around) and floating
+        // point arguments are stored in doubles.
+        FormatType argType;
+
+        // rdtsc() timestamps of the log messages
+        uint64_t timestamps[CAPACITY];
+
+        // Values of an integer or pointer argument
+        int64_t ints[CAPACITY];
+
+        // Values of a floating point argument
+        double doubles[CAPACITY];
+
+        ArgumentBatch()
+            : size(0)
+            , argType(NONE)
+            , timestamps()
+            , ints()
+            , doubles()
+        {}
+
+        /**
+         * Returns true if the values are stored in doubles rather than ints.
+         */
+        inline bool
+        isFloatingPoint() const {
+            return argType == double_t || argType == long_double_t;
+        }
+
+        DISALLOW_COPY_AND_ASSIGN(ArgumentBatch);
+    };
+
     /**
      * Encapsulates the knowledge for interpreting a compressed file produced
      * by an Encoder and producing a human-readable representation of the log
@@ -866,39 +1266,99 @@ namespace Log {
         ~Decoder();
 
         bool open(const char *filename);
+        bool setTimeRange(uint64_t startTime, uint64_t endTime);
+        bool setLogFilter(long logId=-1, int logLevel=-1,
+                          const char *sourceFile=nullptr);
+        void setFollow(bool follow, int idleTimeoutMs=-1);
 
         int64_t decompressUnordered(FILE *outputFd);
-        int64_t decompressTo(FILE *outputFd);
+        int64_t decompressTo(FILE *outputFd, uint32_t numThreads=1);
+        int64_t exportColumns(FILE *outputFd);
 
         bool getNextLogStatement(LogMessage &logMsg,
                                  FILE *outputFd= nullptr);
+        bool getNextArgumentBatch(uint32_t logId, uint32_t argIndex,
+                                  ArgumentBatch &batch);
+
+        /**
+         * Appends the human-readable form of an argument of a user-defined
+         * type (see NanoLog::Serializer) to a string, given its bytes.
+         */
+        typedef void (*ArgumentFormatter)(const void *data, uint32_t size,
+                                          std::string &out);
+
+        static void registerArgumentFormatter(const char *typeName,
+                                              ArgumentFormatter formatter);
+        static void formatArgument(const std::string &typeName,
+                                   const void *data, uint32_t size,
+                                   std::string &out);
+
+        /**
+         * Registers NanoLog::Serializer<T>::format() to format the
+         * arguments of type T in the log messages decompressed by all
+         * Decoders from now on. This must be invoked before the decompression
+         * starts.
+         *
+         * \tparam T
+         *      Type with a NanoLog::Serializer specialization
+         */
+        template<typename T>
+        static void
+        registerSerializer() {
+            registerArgumentFormatter(NanoLog::Serializer<T>::name,
+                                      &formatSerialized<T>);
+        }
 
     PRIVATE:
+        /**
+         * ArgumentFormatter that invokes NanoLog::Serializer<T>::format().
+         */
+        template<typename T>
+        static void
+        formatSerialized(const void *data, uint32_t size, std::string &out) {
+            // The bytes in the log are unaligned
+            alignas(T) char value[sizeof(T)];
+            if (size != sizeof(T)) {
+                formatBytes(NanoLog::Serializer<T>::name, data, size, out);
+                return;
+            }
+
+            std::memcpy(value, data, sizeof(T));
+            NanoLog::Serializer<T>::format(*reinterpret_cast<T*>(value), out);
+        }
+
+        static void formatBytes(const std::string &typeName, const void *data,
+                                uint32_t size, std::string &out);
+
         /**
          * Reads and stores a BufferExtent from the compressed log and
          * facilitates the interpretation of the log messages contained in the
          * extent.
          */
         struct BufferFragment {
-            // Stores the bytes in a compressed log BufferExtent. The size is
-            // chosen to be a little bigger than the size of a runtime
-            // StagingBuffer to account for any other entries that may be
-            // inserted at runtime.
-            char storage[NanoLogConfig::STAGING_BUFFER_SIZE
-                                             + BufferExtent::maxSizeOfHeader()];
-
-            // Number of valid bytes in storage.
+            // Stores the bytes in a compressed log BufferExtent when it can't
+            // be viewed directly in the memory mapped log (i.e. the input is
+            // not a regular file or has grown since it was mapped). It's grown
+            // as needed to fit the largest BufferExtent read so far, which is
+            // bounded by the runtime output buffer size recorded in the
+            // Checkpoint.
+            char *storage;
+
+            // Number of bytes allocated for storage
+            uint64_t storageSize;
+
+            // Number of valid bytes in the BufferExtent.
             uint64_t validBytes;
 
             // The runtime StagingBuffer id associated with this extent.
             uint32_t runtimeId;
 
-            // For efficient IO, we read the entire fragment in once and then
-            // keep track of a read position within the buffer
+            // For efficient IO, we read (or map) the entire fragment in once
+            // and then keep track of a read position within the buffer
             const char *readPos;
 
-            // Marks the first invalid byte in storage
-            char *endOfBuffer;
+            // Marks the first invalid byte in the BufferExtent
+            const char *endOfBuffer;
 
             // Indicates if there are more log messages that can be decompressed
             bool hasMoreLogs;
@@ -908,10 +1368,78 @@ namespace Log {
             uint32_t nextLogId;
             uint64_t nextLogTimestamp;
 
-            BufferFragment();
+            // Human-readable output of all the log messages in the fragment
+            // when they've been formatted ahead of time by render(), or
+            // nullptr if the fragment is being decompressed on demand.
+            char *renderedOutput;
+
+            // Number of bytes allocated to renderedOutput
+            size_t renderedOutputSize;
+
+            // Describes a log message formatted by render()
+            struct RenderedLog {
+                // rdtsc() timestamp of the log message
+                uint64_t timestamp;
+
+                // Identifier of the log message's format
+                uint32_t logId;
+
+                // End offset of the log message in renderedOutput
+                size_t endOffset;
+            };
+
+            // The log messages rendered, in the order they appear in the
+            // fragment.
+            std::vector<RenderedLog> renderedLogs;
+
+            // Index in renderedLogs of the next log message to output
+            size_t nextRenderedLog;
+
+            // The compiled formats of the Decoder's dictionary, indexed by
+            // logId (see Decoder::compileFormat()), or nullptr to compile
+            // them on demand.
+            const std::vector<std::vector<FormatOp>> *fmtId2formatOps;
+
+            // Scratch buffer in which a log message is formatted before it's
+            // written to the output with a single fwrite()
+            std::string lineBuffer;
+
+            // The whole second (since the Unix epoch) and its local time
+            // representation last formatted, since strftime() is expensive
+            int64_t lastSecondFormatted;
+            char lastSecondString[32];
+
+            // Number of BufferExtents read into the fragment, which identifies
+            // the current one to the argumentHistories
+            uint64_t extentsRead;
+
+            // The arguments each log site (indexed by logId) logged last in
+            // the current BufferExtent, when the log is delta encoded
+            std::vector<BufferUtils::ArgumentHistory> argumentHistories;
+
+            // The arguments of the log message being decompressed, converted
+            // back from their delta encoding by expandArguments()
+            std::string expandedArguments;
+
+            // Byte lengths of the user-defined arguments found by
+            // expandArguments() in the log message being expanded
+            std::vector<uint32_t> customArgSizes;
+
+            // The Decoder's strings logged via NanoLog::StaticStr, indexed by
+            // their identifier, or nullptr if there are none
+            const std::deque<std::string> *staticStrings;
+
+            explicit BufferFragment(
+                const std::vector<std::vector<FormatOp>> *fmtId2formatOps
+                                                                = nullptr,
+                const std::deque<std::string> *staticStrings = nullptr);
+            ~BufferFragment();
             void reset();
             bool hasNext();
-            bool readBufferExtent(FILE *fd, bool *wrapAround=nullptr);
+            bool readBufferExtent(FILE *fd, bool *wrapAround=nullptr,
+                        uint32_t maxLength=NanoLogConfig::OUTPUT_BUFFER_SIZE,
+                        const char *mappedLog=nullptr,
+                        uint64_t mappedLogSize=0);
             bool decompressNextLogStatement(FILE *outputFd,
                                  uint64_t &logMsgsProcessed,
                                  LogMessage &logArguments,
@@ -919,7 +1447,18 @@ namespace Log {
                                  std::vector<void*>& fmtId2metadata,
                                  long aggregationFilterId=-1,
                                  void (*aggregationFn)(const char*, ...)=NULL);
+            const char *expandArguments(const FormatMetadata *metadata);
+            bool extractNextArgument(const Checkpoint &checkpoint,
+                                     std::vector<void*>& fmtId2metadata,
+                                     int argIndex=-1,
+                                     ArgumentBatch *batch=nullptr);
+            bool render(const Checkpoint &checkpoint,
+                        std::vector<void*>& fmtId2metadata);
+            bool outputNextRenderedLog(FILE *outputFd,
+                                       uint64_t &logMsgsProcessed);
             uint64_t getNextLogTimestamp() const;
+
+            DISALLOW_COPY_AND_ASSIGN(BufferFragment);
         };
 
         static bool compareBufferFragments(const BufferFragment *a,
@@ -927,9 +1466,54 @@ namespace Log {
 
         bool readDictionary(FILE *fd, bool flushOldDictionary);
         bool readDictionaryFragment(FILE *fd);
+        bool readNextBufferFragment(FILE *outputFd, long requiredLogId=-1);
+        bool readIndex(std::vector<IndexEntry> &index);
+        bool isBlockCompressed();
+        bool inflateLog();
+        bool appendInflated(const char *data, uint64_t nbytes);
+        bool readMetadataBetween(uint64_t start, uint64_t end);
+        void updateTimeRangeCycles();
+        bool endOfInput();
+        bool isEntryComplete(long offset);
+        bool waitForNextEntry(FILE *outputFd);
+        void waitForGrowth(int timeoutMs);
+
+        /**
+         * Returns true if a log message with the given rdtsc() timestamp
+         * falls within the time range set by setTimeRange().
+         */
+        inline bool
+        inTimeRange(uint64_t timestamp) {
+            return timestamp >= cyclesRangeStart && timestamp <= cyclesRangeEnd;
+        }
+
+        /**
+         * Returns true if the next log message in a BufferFragment is
+         * selected by setTimeRange() and setLogFilter() for output.
+         */
+        inline bool
+        isSelected(const BufferFragment *bf) {
+            if (!inTimeRange(bf->getNextLogTimestamp()))
+                return false;
+
+            return !logFilterSet || isLogIdSelected(bf->nextLogId);
+        }
+        bool isLogIdSelected(uint32_t logId);
+        void updateLogFilter();
+        uint32_t skipUnselectedBuffers(long requiredLogId=-1);
+        bool reserveMetadataSpace(uint64_t nbytes);
+        void close();
+
+        static void compileFormat(const FormatMetadata *metadata,
+                                  std::vector<FormatOp> &ops);
 
         BufferFragment *allocateBufferFragment();
         void freeBufferFragment(BufferFragment *bf);
+        static void renderBufferFragments(
+                                    std::vector<BufferFragment*> &fragments,
+                                    uint32_t numThreads,
+                                    const Checkpoint &checkpoint,
+                                    std::vector<void*>& fmtId2metadata);
         bool internalDecompressUnordered(FILE *outputFd,
                                 uint32_t aggregationTargetId=-1,
                                 void (*aggregationFn)(const char*,...)=nullptr);
@@ -947,6 +1531,37 @@ namespace Log {
         // The handle for the log file currently being operated on
         FILE *inputFd;
 
+        // Read-only memory mapping of the log file currently being operated
+        // on, or nullptr if it couldn't be mapped. BufferExtents within the
+        // mapping are decompressed in place rather than copied out.
+        const char *mappedLog;
+
+        // Number of bytes in mappedLog
+        uint64_t mappedLogSize;
+
+        // Descriptor of the log file when it's BLOCK_COMPRESSED, in which
+        // case inputFd is a scratch file its contents are decompressed into
+        // (see inflateLog()); -1 otherwise.
+        int compressedLogFd;
+
+        // Offset in compressedLogFd of the next entry to decompress, or
+        // UINT64_MAX if the log turned out to be corrupt
+        uint64_t compressedLogOffset;
+
+        // Indicates that the entries at compressedLogOffset are
+        // CompressedBlocks, and the largest block they may decompress into
+        // (i.e. the output buffer size in the last Checkpoint).
+        bool inCompressedBlocks;
+        uint32_t maxBlockSize;
+
+        // Number of bytes decompressed into inputFd
+        uint64_t inflatedLogSize;
+
+        // Scratch space for the entries read from compressedLogFd and the
+        // contents of CompressedBlocks
+        std::vector<char> compressedEntry;
+        std::vector<char> inflatedEntry;
+
         // The number of log messages that has been outputted from the
         // current file
         uint64_t logMsgsPrinted;
@@ -966,26 +1581,96 @@ namespace Log {
         // will be freed upon destruction of the Decoder object.
         std::vector<BufferFragment*> freeBuffers;
 
-        // Mapping of id to FormatMetadata*'s within the rawMetadata buffer
+        // Mapping of id to FormatMetadata*'s within the rawMetadata buffer.
+        // The pointers are rebased whenever rawMetadata is reallocated.
         std::vector<void*> fmtId2metadata;
 
         // Mapping of fmtId to format strings; this is an auxiliary structure
         // built from FormatMetadata's.
         std::vector<std::string> fmtId2fmtString;
 
+        // Mapping of fmtId to the compiled form of its PrintFragments; this
+        // is an auxiliary structure built from FormatMetadata's.
+        std::vector<std::vector<FormatOp>> fmtId2formatOps;
+
+        // The strings logged via NanoLog::StaticStr that were read from the
+        // dictionary, indexed by their identifier. The strings don't move as
+        // more are appended, so the LogMessages can refer to them.
+        std::deque<std::string> staticStrings;
+
         // Contains the raw metadata to interpret log messages,
-        // directly read from the log file
+        // directly read from the log file. It's grown as needed to fit the
+        // dictionaries encountered (see reserveMetadataSpace()).
         char *rawMetadata;
 
         // End of the valid bytes in rawMetadata
         char *endOfRawMetadata;
 
+        // Number of bytes allocated for rawMetadata
+        uint64_t rawMetadataSize;
+
         // Metric: Number of BufferFragment's read in the decompression
         uint32_t numBufferFragmentsRead;
 
         // Metric: Number of Checkpoint's read in the decompression
         uint32_t numCheckpointsRead;
 
+        // Wall time range (in nanoseconds since the Unix epoch, inclusive)
+        // of the log messages to output; see setTimeRange().
+        uint64_t timeRangeStart;
+        uint64_t timeRangeEnd;
+
+        // timeRangeStart/End translated to rdtsc() timestamps with the
+        // current checkpoint.
+        uint64_t cyclesRangeStart;
+        uint64_t cyclesRangeEnd;
+
+        // Byte offset in inputFd at which to stop decompressing; this is
+        // the end of the last output buffer containing log messages in the
+        // time range when the log has an index, else it's UINT64_MAX.
+        uint64_t inputLimit;
+
+        // Criteria set by setLogFilter() that log messages must match to be
+        // output; a negative logFilterId/logFilterLevel or empty
+        // logFilterFilename matches any log message.
+        bool logFilterSet;
+        long logFilterId;
+        int logFilterLevel;
+        std::string logFilterFilename;
+
+        // Indicates, for each logId in the current dictionary, whether its
+        // log messages match the setLogFilter() criteria. It's rebuilt by
+        // updateLogFilter() as the dictionary grows.
+        std::vector<bool> logIdSelected;
+
+        // Bitmap of the logIds in logIdSelected (see setLogIdBit()); output
+        // buffers whose IndexEntry shares no bits with it are skipped.
+        uint64_t selectedLogIds[INDEX_LOGID_WORDS];
+
+        // The index accompanying the log (see readIndex()), if any, and the
+        // position in it of the next output buffer to be read
+        std::vector<IndexEntry> index;
+        size_t nextIndexEntry;
+
+        // Metric: Number of output buffers skipped with the index
+        uint32_t numOutputBuffersSkipped;
+
+        // Indicates that getNextLogStatement() should wait for the log file
+        // to grow at its end rather than stop (see setFollow()).
+        bool follow;
+
+        // Number of milliseconds getNextLogStatement() waits for the log file
+        // to grow in follow mode before giving up; -1 means forever.
+        int followIdleTimeoutMs;
+
+        // inotify instance watching the log file for growth in follow mode;
+        // -1 if it hasn't been set up, -2 if inotify is unavailable.
+        int inotifyFd;
+
+        // Longest time to block on inotify (or to sleep if it's unavailable)
+        // before checking the log file's size again in follow mode.
+        static const int FOLLOW_POLL_INTERVAL_MS = 100;
+
         DISALLOW_COPY_AND_ASSIGN(Decoder);
     };
 }; /* namespace Log */
@@ -15,12 +15,18 @@
 
 #include <algorithm>
 #include <fstream>
+#include <memory>
 #include <vector>
 
+#include <cctype>
+#include <cerrno>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <strings.h>
 
+#include "Aggregation.h"
 #include "Log.h"
 #include "Cycles.h"
 
@@ -112,6 +118,72 @@ void runRCDF(std::vector<uint64_t> timeDeltas, double cyclesPerSecond) {
            1e9*PerfUtils::Cycles::toSeconds(sum/timeDeltas.size(), cyclesPerSecond));
 }
 
+/**
+ * Parses a local time formatted as "YYYY-MM-DD HH:MM:SS[.nnnnnnnnn]" (i.e.
+ * the way the decompressor prints the log message times).
+ *
+ * \param str
+ *      String to parse
+ * \param[out] nanos
+ *      The time in nanoseconds since the Unix epoch
+ *
+ * \return
+ *      true if successful; false if str is malformed
+ */
+static bool
+parseTime(const char *str, uint64_t *nanos) {
+    struct tm tm = {};
+    const char *rest = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+    if (rest == nullptr)
+        return false;
+
+    tm.tm_isdst = -1;
+    time_t seconds = mktime(&tm);
+    if (seconds < 0)
+        return false;
+
+    uint64_t fraction = 0;
+    if (*rest == '.') {
+        int digits = 0;
+        for (++rest; isdigit(*rest) && digits < 9; ++rest, ++digits)
+            fraction = 10*fraction + (*rest - '0');
+
+        for (; digits < 9; ++digits)
+            fraction *= 10;
+    }
+
+    if (*rest != '\0')
+        return false;
+
+    *nanos = static_cast<uint64_t>(seconds)*1000000000 + fraction;
+    return true;
+}
+
+/**
+ * Parses the name of a LogLevel (i.e. "ERROR") as printed by the
+ * decompressor.
+ *
+ * \param str
+ *      String to parse (case insensitive)
+ * \param[out] logLevel
+ *      The LogLevel parsed
+ *
+ * \return
+ *      true if successful; false if the string doesn't name a LogLevel
+ */
+static bool
+parseLogLevel(const char *str, int *logLevel) {
+    static const char *names[] = {"ERROR", "WARNING", "NOTICE", "DEBUG"};
+    for (size_t i = 0; i < sizeof(names)/sizeof(names[0]); ++i) {
+        if (strcasecmp(str, names[i]) == 0) {
+            *logLevel = static_cast<int>(NanoLog::ERROR + i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
  * Prints the usage information to stdout.
  *
@@ -123,26 +195,48 @@ void printHelp(const char *exe) {
                 "the NanoLog System\r\n\r\n");
 
     printf("Decompress the log file into a human-readable format:\r\n");
-    printf("\t%s decompress <logFile>\r\n\r\n", exe);
+    printf("\t%s decompress <logFile> [-j <numThreads>] [<filters>]\r\n\r\n",
+           exe);
 
     printf("Decompress the log file into a sorted human-readable format \r\n"
            "without sorting the messages by time:\r\n");
-    printf("\t%s decompressUnordered <logFile>\r\n\r\n", exe);
+    printf("\t%s decompressUnordered <logFile> [--follow] [<filters>]\r\n"
+           "\t\t--follow waits for more log messages to be appended to\r\n"
+           "\t\tthe log file once its end is reached (like tail -f)\r\n\r\n",
+           exe);
+
+    printf("Export the log messages' wall times, runtimeIds and arguments\r\n"
+           "as typed columns, one batch per LOG statement, for analytics\r\n"
+           "(see ColumnarWriter.h for the format):\r\n");
+    printf("\t%s export <logFile> <outputFile> [<filters>]\r\n\r\n", exe);
+
+    printf("The <filters> restrict the output to the log messages matching\r\n"
+           "all of the following options:\r\n"
+           "\t--from <time> --to <time>\r\n"
+           "\t\tLogged within a (local) time range, inclusive, where <time>\r\n"
+           "\t\tis formatted as \"YYYY-MM-DD HH:MM:SS[.nnnnnnnnn]\"\r\n"
+           "\t--logId <logId>\r\n"
+           "\t\tLogged by the LOG statement with the logId (integer)\r\n"
+           "\t--level <ERROR|WARNING|NOTICE|DEBUG>\r\n"
+           "\t\tLogged at the level or a more severe one\r\n"
+           "\t--file <substring>\r\n"
+           "\t\tLogged from a source file whose name contains the substring\r\n"
+           "\r\n");
 
     printf("Create an RCDF of the inter-log invocation times. Only works\r\n");
     printf("when there is one runtime logging thread:\r\n");
     printf("\t%s rcdfTime <logFile>\r\n\r\n", exe);
 
+    printf("Run a minMaxMean aggregation on the first argument of a\r\n"
+           "specific logId (integer), which must be a number:\r\n");
+    printf("\t%s minMaxMean <logFile> <logId>\r\n\r\n", exe);
+
 #ifdef PREPROCESSOR_NANOLOG
     printf("== Note ==\r\n");
-    printf("The following 2 commands only work with logs produced by the\r\n");
+    printf("The following command only works with logs produced by the\r\n");
     printf("preprocessor version of NanoLog\r\n");
     printf("==========\r\n\r\n");
 
-    printf("Run a minMaxMean aggregation on a specific logId (integer)"
-            " and interpret the first argument as an int:\r\n");
-    printf("\t%s minMaxMean <logFile> <logId>\r\n\r\n", exe);
-
     printf("Get the logIds with static log format messages "
             "matching a substring (case sensitive)\r\n");
     printf("\t%s find <logFile> <substring>\r\n\r\n", exe);
@@ -167,17 +261,88 @@ int main(int argc, char** argv) {
     bool doRCDF = false;
     FILE *outputFd = NULL;
     int filterId = -1;
+    uint32_t numThreads = 1;
+    uint64_t fromTime = 0;
+    uint64_t toTime = UINT64_MAX;
+    long logIdFilter = -1;
+    int logLevelFilter = -1;
+    const char *fileFilter = nullptr;
+    const char *exportFile = nullptr;
+    bool follow = false;
+
+    if (strcmp(command, "decompress") == 0 ||
+            strcmp(command, "decompressUnordered") == 0 ||
+            strcmp(command, "export") == 0) {
+        int firstOption = 3;
+        if (strcmp(command, "export") == 0) {
+            if (argc < 4) {
+                printHelp(argv[0]);
+                exit(1);
+            }
 
-    if (strcmp(command, "decompress") == 0) {
-        outputFd = stdout;
-        sorted = true;
-    } else if (strcmp(command, "decompressUnordered") == 0) {
-        outputFd = stdout;
+            exportFile = argv[3];
+            firstOption = 4;
+        } else {
+            outputFd = stdout;
+            sorted = (strcmp(command, "decompress") == 0);
+        }
+
+        for (int i = firstOption; i < argc; i += 2) {
+            // The only option without a value
+            if (!sorted && !exportFile && strcmp(argv[i], "--follow") == 0) {
+                follow = true;
+                --i;
+                continue;
+            }
+
+            if (i + 1 >= argc) {
+                printHelp(argv[0]);
+                exit(1);
+            }
+
+            if (sorted && strcmp(argv[i], "-j") == 0) {
+                int threads = atoi(argv[i + 1]);
+                if (threads <= 0) {
+                    printf("The number of threads must be positive: %s\r\n",
+                            argv[i + 1]);
+                    exit(-1);
+                }
+
+                numThreads = threads;
+            } else if (strcmp(argv[i], "--from") == 0 ||
+                        strcmp(argv[i], "--to") == 0) {
+                uint64_t *time = (strcmp(argv[i], "--from") == 0) ? &fromTime
+                                                                   : &toTime;
+                if (!parseTime(argv[i + 1], time)) {
+                    printf("Invalid time, please enter it as "
+                           "\"YYYY-MM-DD HH:MM:SS[.nnnnnnnnn]\": %s\r\n",
+                           argv[i + 1]);
+                    exit(-1);
+                }
+            } else if (strcmp(argv[i], "--logId") == 0) {
+                char *end;
+                logIdFilter = strtol(argv[i + 1], &end, 10);
+                if (*end != '\0' || logIdFilter < 0) {
+                    printf("Invalid logId, please enter a non-negative "
+                           "number: %s\r\n", argv[i + 1]);
+                    exit(-1);
+                }
+            } else if (strcmp(argv[i], "--level") == 0) {
+                if (!parseLogLevel(argv[i + 1], &logLevelFilter)) {
+                    printf("Invalid log level, please enter one of ERROR, "
+                           "WARNING, NOTICE or DEBUG: %s\r\n", argv[i + 1]);
+                    exit(-1);
+                }
+            } else if (strcmp(argv[i], "--file") == 0) {
+                fileFilter = argv[i + 1];
+            } else {
+                printHelp(argv[0]);
+                exit(1);
+            }
+        }
     }  else if (strcmp(command, "rcdfTime") == 0) {
         doRCDF = true;
-    } 
-#ifdef PREPROCESSOR_NANOLOG
-    else if (strcmp(command, "minMaxMean") == 0) {
+    } else if (strcmp(command, "minMaxMean") == 0) {
         if (argc < 4) {
             printHelp(argv[0]);
             exit(1);
@@ -197,7 +362,9 @@ int main(int argc, char** argv) {
             printf("The logId must be positive: %s\r\n", argv[3]);
             exit(-1);
         }
-    } else if (strcmp(command, "find") == 0) {
+    }
+#ifdef PREPROCESSOR_NANOLOG
+    else if (strcmp(command, "find") == 0) {
         if (argc < 4) {
             printHelp(argv[0]);
             exit(1);
@@ -217,6 +384,25 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
+    if (follow)
+        decoder.setFollow(true);
+
+    if ((fromTime != 0 || toTime != UINT64_MAX) &&
+            !decoder.setTimeRange(fromTime, toTime)) {
+        printf("Unable to seek to the time range in %s\r\n", logFileName);
+        exit(1);
+    }
+
+    // The aggregation only needs the log messages with the filterId
+    if (filterId >= 0)
+        logIdFilter = filterId;
+
+    if ((logIdFilter >= 0 || logLevelFilter >= 0 || fileFilter != nullptr) &&
+            !decoder.setLogFilter(logIdFilter, logLevelFilter, fileFilter)) {
+        printf("Unable to filter the log messages in %s\r\n", logFileName);
+        exit(1);
+    }
+
     if (find) {
 #ifdef PREPROCESSOR_NANOLOG
         printLogMetadataContainingSubstring(argv[3]);
@@ -265,8 +451,29 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    if (exportFile) {
+        FILE *exportFd = fopen(exportFile, "wb");
+        if (!exportFd) {
+            printf("Unable to open %s for writing: %s\r\n", exportFile,
+                   strerror(errno));
+            exit(1);
+        }
+
+        int64_t numLogMsgs = decoder.exportColumns(exportFd);
+        fclose(exportFd);
+        if (numLogMsgs < 0) {
+            printf("Unable to export the log messages in %s\r\n",
+                   logFileName);
+            exit(1);
+        }
+
+        printf("# Exported %ld log messages to %s\r\n", numLogMsgs,
+               exportFile);
+        return 0;
+    }
+
     if (sorted) {
-        int64_t numLogMsgs = decoder.decompressTo(outputFd);
+        int64_t numLogMsgs = decoder.decompressTo(outputFd, numThreads);
 
         if (outputFd)
             fprintf(outputFd, "\r\n\r\n# Decompression Complete after printing "
@@ -286,31 +493,16 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    // Perform unsorted aggregation
-    long total = 0;
-    long count = 0;
-    long max = 0;
-    long min = 0;
-    uint64_t numLogs = 0;
+    // Perform unsorted aggregation over the first argument in batches
+    std::unique_ptr<ArgumentBatch> batch(new ArgumentBatch());
+    NanoLogInternal::Aggregation::Summary<int64_t> ints;
+    NanoLogInternal::Aggregation::Summary<double> doubles;
     uint64_t start = PerfUtils::Cycles::rdtsc();
-    while(decoder.getNextLogStatement(args, nullptr)) {
-        ++numLogs;
-
-        if (static_cast<int>(args.getLogId()) != filterId)
-            continue;
-
-        int elem = args.get<int>(0);
-        if (count == 0)
-            max = min = elem;
-
-        if (max < elem)
-            max = elem;
-
-        if (min > elem)
-            min = elem;
-
-        total += elem;
-        ++count;
+    while (decoder.getNextArgumentBatch(filterId, 0, *batch)) {
+        if (batch->isFloatingPoint())
+            doubles.add(batch->doubles, batch->size);
+        else
+            ints.add(batch->ints, batch->size);
     }
 
     uint64_t stop = PerfUtils::Cycles::rdtsc();
@@ -321,16 +513,25 @@ int main(int argc, char** argv) {
                 GeneratedFunctions::logId2Metadata[filterId].fmtString,
                 filterId);
 #endif // PREPROCESSOR_NANOLOG
-    printf("Logs Encountered: %lu\r\n", numLogs);
-    printf("Matching Logs: %ld (%0.2lf%%)\r\n", count,
-            (100.0*(double)count)/(double)numLogs);
-    printf("Min: %ld\r\n", min);
-    printf("Max: %ld\r\n", max);
-    printf("Mean: %ld\r\n", total/count);
-    printf("Total: %ld\r\n", total);
+    uint64_t count = ints.count + doubles.count;
+    printf("Matching Logs: %lu\r\n", count);
+    if (count == 0)
+        return 0;
+
+    if (ints.count > 0) {
+        printf("Min: %ld\r\n", ints.min);
+        printf("Max: %ld\r\n", ints.max);
+        printf("Mean: %ld\r\n", ints.sum/static_cast<int64_t>(ints.count));
+        printf("Total: %ld\r\n", ints.sum);
+    } else {
+        printf("Min: %lf\r\n", doubles.min);
+        printf("Max: %lf\r\n", doubles.max);
+        printf("Mean: %lf\r\n", doubles.mean());
+        printf("Total: %lf\r\n", doubles.sum);
+    }
 
     printf("\r\nThe aggregation took %0.2lf seconds over "
-            "%ld elements (%0.2lf ns avg)\r\n",
+            "%lu elements (%0.2lf ns avg)\r\n",
             time,
             count, (1.0e9*time)/(double)count);
 
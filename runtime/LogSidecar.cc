@@ -0,0 +1,252 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Config.h"
+#include "Log.h"
+#include "SharedStagingBuffer.h"
+
+/**
+ * The sidecar compresses and outputs the log of an application that logs to
+ * a shared memory sink (see NanoLog::setSharedMemorySink()). It polls the
+ * application's StagingBuffers like a compression thread and writes a
+ * regular NanoLog log that the decompressor reads. It has to be built with
+ * the application's generated code, i.e. by NanoLogMakeFrag.
+ */
+
+using namespace NanoLogInternal;
+using namespace NanoLogInternal::SharedStagingBuffer;
+
+#ifdef PREPROCESSOR_NANOLOG
+/**
+ * A StagingBuffer published by the application
+ */
+struct SharedBuffer {
+    // Index of the buffer region in the registry
+    uint32_t index;
+
+    // Consumer side of the StagingBuffer
+    BufferReader reader;
+};
+
+/**
+ * Writes the log messages encoded so far to the log file and hands the
+ * encoder a new output buffer.
+ *
+ * \param encoder
+ *      Encoder to take the encoded log messages from
+ * \param fd
+ *      Log file to append to
+ * \param[in,out] spareBuffer
+ *      Output buffer to swap in; it's replaced with the encoder's old buffer
+ */
+static void
+outputEncodedBytes(Log::Encoder &encoder, int fd, char **spareBuffer)
+{
+    char *buffer = nullptr;
+    size_t length = 0;
+    encoder.swapBuffer(*spareBuffer, NanoLogConfig::OUTPUT_BUFFER_SIZE,
+                       &buffer, &length);
+    *spareBuffer = buffer;
+
+    for (size_t written = 0; written < length; ) {
+        ssize_t ret = write(fd, buffer + written, length - written);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("The sidecar was unable to write to the log file");
+            exit(1);
+        }
+        written += ret;
+    }
+}
+
+/**
+ * Returns true if the application has already moved on from the buffer
+ * region with the given index to a newer one, i.e. the StagingBuffer that
+ * replaces it can't be consumed yet.
+ */
+static bool
+isPending(const std::vector<std::unique_ptr<SharedBuffer>> &buffers,
+          uint32_t index)
+{
+    return index != NO_BUFFER &&
+           std::any_of(buffers.begin(), buffers.end(),
+                       [index](const std::unique_ptr<SharedBuffer> &b) {
+                           return b->index == index;
+                       });
+}
+
+void
+printHelp(const char *exe)
+{
+    printf("Compresses the log of an application logging to a shared memory "
+           "sink (see NanoLog::setSharedMemorySink()) until it exits.\r\n\r\n");
+    printf("Usage:\r\n");
+    printf("\t%s <sinkName> <logFile>\r\n", exe);
+}
+
+int
+main(int argc, char** argv)
+{
+    if (argc != 3) {
+        printHelp(argv[0]);
+        exit(1);
+    }
+
+    RegistryReader registry;
+    bool announced = false;
+    while (!registry.open(argv[1])) {
+        if (!announced) {
+            printf("Waiting for the shared memory sink '%s'...\r\n",
+                   getRegistryName(argv[1]).c_str());
+            fflush(stdout);
+            announced = true;
+        }
+        usleep(10000);
+    }
+
+    int fd = open(argv[2], NanoLogConfig::FILE_PARAMS, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open the log file '%s': %s\r\n",
+                argv[2], strerror(errno));
+        exit(1);
+    }
+
+    char *outputBuffers[2];
+    for (char *&buffer : outputBuffers)
+        buffer = static_cast<char*>(malloc(NanoLogConfig::OUTPUT_BUFFER_SIZE));
+    Log::Encoder encoder(outputBuffers[0], NanoLogConfig::OUTPUT_BUFFER_SIZE);
+    char *spareBuffer = outputBuffers[1];
+
+    std::vector<std::unique_ptr<SharedBuffer>> buffers;
+    uint32_t numBuffersOpened = 0;
+    uint64_t totalBytesRead = 0;
+    uint64_t logsProcessed = 0;
+    bool wrapAround = false;
+
+    while (true) {
+        // Sampled up front so that the final pass covers everything logged
+        bool closed = registry.isClosed();
+
+        uint32_t numBuffers = registry.getNumBuffers();
+        for (; numBuffersOpened < numBuffers; ++numBuffersOpened) {
+            std::unique_ptr<SharedBuffer> buffer(new SharedBuffer());
+            buffer->index = numBuffersOpened;
+            if (!buffer->reader.open(registry.getName(), buffer->index)) {
+                fprintf(stderr, "Unable to map StagingBuffer %u of the shared "
+                        "memory sink; its log messages are lost\r\n",
+                        buffer->index);
+                continue;
+            }
+            buffers.push_back(std::move(buffer));
+        }
+
+        uint64_t bytesConsumedThisIteration = 0;
+        for (size_t i = 0; i < buffers.size(); ) {
+            BufferReader &reader = buffers[i]->reader;
+            if (isPending(buffers, reader.getReplaces())) {
+                ++i;
+                continue;
+            }
+
+            uint64_t peekBytes = 0;
+            char *peekPosition = reader.peek(&peekBytes);
+            if (peekBytes == 0) {
+                if (reader.isAbandoned()) {
+                    shm_unlink(getBufferName(registry.getName(),
+                                             buffers[i]->index).c_str());
+                    buffers.erase(buffers.begin() + i);
+                    continue;
+                }
+
+                ++i;
+                continue;
+            }
+
+            // Encode the data in RELEASE_THRESHOLD chunks
+            uint64_t remaining = peekBytes;
+            while (remaining > 0) {
+                long bytesToEncode = std::min<uint64_t>(
+                        NanoLogConfig::RELEASE_THRESHOLD, remaining);
+                long bytesRead = encoder.encodeLogMsgs(
+                        peekPosition + (peekBytes - remaining),
+                        bytesToEncode,
+                        reader.getId(),
+                        wrapAround,
+                        &logsProcessed);
+
+                if (bytesRead == 0) {
+                    outputEncodedBytes(encoder, fd, &spareBuffer);
+                    continue;
+                }
+
+                wrapAround = false;
+                remaining -= bytesRead;
+                reader.consume(bytesRead);
+                totalBytesRead += bytesRead;
+                bytesConsumedThisIteration += bytesRead;
+            }
+            ++i;
+        }
+
+        wrapAround = true;
+        if (bytesConsumedThisIteration > 0)
+            continue;
+
+        if (encoder.getEncodedBytes() > 0)
+            outputEncodedBytes(encoder, fd, &spareBuffer);
+
+        if (closed)
+            break;
+
+        usleep(NanoLogConfig::SIDECAR_POLL_INTERVAL_US);
+    }
+
+    // The application is gone, so the remaining buffers can't be added to
+    for (std::unique_ptr<SharedBuffer> &buffer : buffers)
+        shm_unlink(getBufferName(registry.getName(), buffer->index).c_str());
+    shm_unlink(registry.getName().c_str());
+
+    fsync(fd);
+    close(fd);
+    for (char *buffer : outputBuffers)
+        free(buffer);
+
+    printf("Compressed %lu log messages (%lu bytes) from '%s'\r\n",
+           logsProcessed, totalBytesRead, registry.getName().c_str());
+    return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+    fprintf(stderr, "The sidecar has to be built with the generated code of "
+            "the Preprocessor version of NanoLog (see NanoLogMakeFrag)\r\n");
+    return 1;
+}
+#endif // PREPROCESSOR_NANOLOG
@@ -13,12 +13,17 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <iosfwd>
+#include <memory>
 #include <cstdio>
 #include <vector>
 #include <sstream>
+#include <thread>
 
 #include "gtest/gtest.h"
 
@@ -27,6 +32,7 @@
 #include "RuntimeLogger.h"
 #include "Packer.h"
 #include "Log.h"
+#include "ColumnarWriter.h"
 #include "GeneratedCode.h"
 
 
@@ -38,6 +44,9 @@ extern int __fmtId__I32have32a32uint6495t3237lu__testHelper47client46cc__29__; /
 extern int __fmtId__I32have32a32double3237lf__testHelper47client46cc__30__; // testHelper/client.cc:30 "I have a double %lf"
 extern int __fmtId__I32have32a32couple32of32things3237d443237f443237u443237s__testHelper47client46cc__31__; // testHelper/client.cc:31 "I have a couple of things %d, %f, %u, %s"
 
+extern const int __fmtId__Warning32Level__testHelper47client46cc__25__; // testHelper/client.cc:25 "Warning Level"
+extern const int __fmtId__Error32Level__testHelper47client46cc__26__; // testHelper/client.cc:26 "Error Level"
+
 
 namespace {
 
@@ -46,25 +55,15 @@ using namespace NanoLogInternal;
 using namespace Log;
 
 void stopCompressionThread() {
-    {
-        std::lock_guard<std::mutex> lock(
-                RuntimeLogger::nanoLogSingleton.condMutex);
-        RuntimeLogger::nanoLogSingleton.compressionThreadShouldExit = true;
-        RuntimeLogger::nanoLogSingleton.workAdded.notify_all();
-    }
-
-    if (RuntimeLogger::nanoLogSingleton.compressionThread.joinable()) {
-        RuntimeLogger::nanoLogSingleton.compressionThread.join();
-    }
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->stop();
 }
 
 void restartCompressionThread() {
     stopCompressionThread();
 
-    RuntimeLogger::nanoLogSingleton.compressionThreadShouldExit = false;
-    RuntimeLogger::nanoLogSingleton.compressionThread =
-            std::thread(&RuntimeLogger::compressionThreadMain,
-                        &RuntimeLogger::nanoLogSingleton);
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->start();
 }
 
 // The fixture for testing class Foo.
@@ -272,21 +271,21 @@ TEST_F(LogTest, insertCheckpoint) {
     Checkpoint *ck = reinterpret_cast<Checkpoint*>(backing_buffer);
 
     // out of space
-    EXPECT_FALSE(insertCheckpoint(&writePos, backing_buffer, false));
+    EXPECT_FALSE(insertCheckpoint(&writePos, backing_buffer, false, 1000));
     EXPECT_EQ(writePos, backing_buffer);
 
-    EXPECT_FALSE(insertCheckpoint(&writePos, backing_buffer, true));
+    EXPECT_FALSE(insertCheckpoint(&writePos, backing_buffer, true, 1000));
     EXPECT_EQ(writePos, backing_buffer);
 
     // Not out of space
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false, 1000));
     EXPECT_EQ(sizeof(Checkpoint), writePos - backing_buffer);
     EXPECT_EQ(0U, ck->newMetadataBytes);
     EXPECT_EQ(0U, ck->totalMetadataEntries);
-
+    EXPECT_EQ(1000U, ck->outputBufferSize);
 
     writePos = backing_buffer;
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true, 1000));
     ck = reinterpret_cast<Checkpoint*>(backing_buffer);
     EXPECT_EQ(sizeof(Checkpoint) + ck->newMetadataBytes,
               writePos - backing_buffer);
@@ -294,10 +293,10 @@ TEST_F(LogTest, insertCheckpoint) {
 
     // Out of space at the very end
     writePos = endOfBuffer - sizeof(Checkpoint) - 1;
-    EXPECT_FALSE(insertCheckpoint(&writePos, endOfBuffer, true));
+    EXPECT_FALSE(insertCheckpoint(&writePos, endOfBuffer, true, 1000));
 
     writePos = endOfBuffer - sizeof(Checkpoint) - 1;
-    EXPECT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false));
+    EXPECT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false, 1000));
 }
 
 TEST_F(LogTest, insertCheckpoint_end2end) {
@@ -317,9 +316,9 @@ TEST_F(LogTest, insertCheckpoint_end2end) {
     ASSERT_NE(nullptr, in);
     ASSERT_FALSE(readCheckpoint(cp1, in));
 
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false));
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true));
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false, 1000));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true, 1000));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false, 1000));
 
     // Write the buffer to a file and read it back
     fclose(in);
@@ -805,6 +804,162 @@ TEST_F(LogTest, swapBuffer) {
     EXPECT_EQ(nullptr, encoder.currentExtentSize);
 }
 
+TEST_F(LogTest, startNewLog) {
+    char buffer1[1000] = {}, buffer2[1000] = {};
+    Encoder encoder(buffer1, 1000, false, true, false, true);
+    size_t checkpointBytes = encoder.getEncodedBytes();
+
+    encoder.swapBuffer(buffer2, 1000);
+    EXPECT_EQ(0U, encoder.getEncodedBytes());
+    EXPECT_FALSE(encoder.hasEncodedMetadata());
+
+    // The new log starts off the same way as the first one
+    encoder.startNewLog();
+    EXPECT_EQ(checkpointBytes, encoder.getEncodedBytes());
+    EXPECT_TRUE(encoder.hasEncodedMetadata());
+    EXPECT_EQ(0, memcmp(buffer1 + sizeof(Checkpoint),
+                        buffer2 + sizeof(Checkpoint),
+                        checkpointBytes - sizeof(Checkpoint)));
+
+    Checkpoint *ck = reinterpret_cast<Checkpoint*>(buffer2);
+    EXPECT_EQ(EntryType::CHECKPOINT, ck->entryType);
+    EXPECT_EQ(uint32_t(BLOCK_COMPRESSED | PRECISE_TIME), ck->flags);
+    EXPECT_EQ(1000U, ck->outputBufferSize);
+}
+
+TEST_F(LogTest, encodeClockSync) {
+    char inputBuffer[100], buffer[1000];
+    Encoder encoder(buffer, 1000, false, true);
+    Checkpoint *first = reinterpret_cast<Checkpoint*>(buffer);
+    EXPECT_EQ(first->rdtsc, encoder.getLastClockSync());
+    EXPECT_EQ(uint32_t(PRECISE_TIME), first->flags);
+    EXPECT_GT(1000000000U, first->unixTimeNanos);
+
+    UncompressedEntry *ue = reinterpret_cast<UncompressedEntry*>(inputBuffer);
+    ue->timestamp = 1;
+    ue->fmtId = noParamsId;
+    ue->entrySize = sizeof(UncompressedEntry);
+    uint64_t logs = 0;
+    ASSERT_EQ(sizeof(UncompressedEntry),
+              encoder.encodeLogMsgs(inputBuffer, sizeof(UncompressedEntry),
+                                    1, false, &logs));
+
+    // A rate of rdtsc() that's slightly off the calibration is recorded
+    double cyclesPerSec = Cycles::getCyclesPerSec();
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    encoder.lastClockSyncCycles = Cycles::rdtsc()
+                            - static_cast<uint64_t>(1.0002*cyclesPerSec);
+    encoder.lastClockSyncTime = now.tv_sec*1000000000L + now.tv_nsec
+                            - 1000000000L;
+
+    Checkpoint *ck = reinterpret_cast<Checkpoint*>(encoder.writePos);
+    ASSERT_TRUE(encoder.encodeClockSync());
+    EXPECT_EQ(EntryType::CHECKPOINT, ck->entryType);
+    EXPECT_EQ(uint32_t(CLOCK_SYNC | PRECISE_TIME), ck->flags);
+    EXPECT_EQ(0U, ck->newMetadataBytes);
+    EXPECT_EQ(1000U, ck->outputBufferSize);
+    EXPECT_NEAR(1.0002*cyclesPerSec, ck->cyclesPerSecond, 1e-4*cyclesPerSec);
+    EXPECT_EQ(ck->rdtsc, encoder.getLastClockSync());
+    EXPECT_EQ(getCheckpointTime(*ck), encoder.lastClockSyncTime);
+    EXPECT_EQ(uint32_t(-1), encoder.lastBufferIdEncoded);
+    EXPECT_EQ(nullptr, encoder.currentExtentSize);
+
+    // One that's way off means the wall clock was stepped in between
+    clock_gettime(CLOCK_REALTIME, &now);
+    encoder.lastClockSyncCycles = Cycles::rdtsc()
+                            - static_cast<uint64_t>(1.01*cyclesPerSec);
+    encoder.lastClockSyncTime = now.tv_sec*1000000000L + now.tv_nsec
+                            - 1000000000L;
+
+    ck = reinterpret_cast<Checkpoint*>(encoder.writePos);
+    ASSERT_TRUE(encoder.encodeClockSync());
+    EXPECT_EQ(cyclesPerSec, ck->cyclesPerSecond);
+
+    // Out of space
+    encoder.endOfBuffer = encoder.writePos + sizeof(Checkpoint) - 1;
+    uint64_t lastClockSync = encoder.getLastClockSync();
+    EXPECT_FALSE(encoder.encodeClockSync());
+    EXPECT_EQ(lastClockSync, encoder.getLastClockSync());
+}
+
+TEST_F(LogTest, encoder_encodedTimestampRange) {
+    char inputBuffer[100], buffer1[1000], buffer2[1000];
+    uint64_t minTimestamp, maxTimestamp;
+    Encoder encoder(buffer1, sizeof(buffer1));
+
+    EXPECT_TRUE(encoder.hasEncodedMetadata());
+    encoder.getEncodedTimestampRange(&minTimestamp, &maxTimestamp);
+    EXPECT_GT(minTimestamp, maxTimestamp);
+
+    UncompressedEntry* ue = reinterpret_cast<UncompressedEntry*>(inputBuffer);
+    uint64_t timestamps[] = {50, 20, 90};
+    for (uint64_t timestamp : timestamps) {
+        ue->timestamp = timestamp;
+        ue->fmtId = noParamsId;
+        ue->entrySize = sizeof(UncompressedEntry);
+        ++ue;
+    }
+
+    uint64_t compressedLogs = 0;
+    EXPECT_EQ(3*sizeof(UncompressedEntry),
+              encoder.encodeLogMsgs(inputBuffer, 3*sizeof(UncompressedEntry),
+                                    1, false, &compressedLogs));
+    encoder.getEncodedTimestampRange(&minTimestamp, &maxTimestamp);
+    EXPECT_EQ(20U, minTimestamp);
+    EXPECT_EQ(90U, maxTimestamp);
+
+    encoder.swapBuffer(buffer2, sizeof(buffer2));
+    EXPECT_FALSE(encoder.hasEncodedMetadata());
+    encoder.getEncodedTimestampRange(&minTimestamp, &maxTimestamp);
+    EXPECT_GT(minTimestamp, maxTimestamp);
+
+    EXPECT_EQ(sizeof(UncompressedEntry),
+              encoder.encodeLogMsgs(inputBuffer, sizeof(UncompressedEntry),
+                                    1, false, &compressedLogs));
+    encoder.getEncodedTimestampRange(&minTimestamp, &maxTimestamp);
+    EXPECT_EQ(50U, minTimestamp);
+    EXPECT_EQ(50U, maxTimestamp);
+}
+
+TEST_F(LogTest, encoder_encodedLogIds) {
+    char inputBuffer[100], buffer1[1000], buffer2[1000];
+    uint64_t logIds[INDEX_LOGID_WORDS];
+    uint64_t expected[INDEX_LOGID_WORDS] = {};
+    Encoder encoder(buffer1, sizeof(buffer1));
+
+    encoder.getEncodedLogIds(logIds);
+    EXPECT_EQ(0, memcmp(expected, logIds, sizeof(logIds)));
+    EXPECT_EQ(0U, encoder.getEncodedWrapArounds());
+
+    UncompressedEntry* ue = reinterpret_cast<UncompressedEntry*>(inputBuffer);
+    ue->timestamp = 10;
+    ue->fmtId = noParamsId;
+    ue->entrySize = sizeof(UncompressedEntry);
+
+    uint64_t compressedLogs = 0;
+    EXPECT_EQ(sizeof(UncompressedEntry),
+              encoder.encodeLogMsgs(inputBuffer, sizeof(UncompressedEntry),
+                                    1, true, &compressedLogs));
+    EXPECT_EQ(1U, encoder.getEncodedWrapArounds());
+
+    setLogIdBit(expected, noParamsId);
+    encoder.getEncodedLogIds(logIds);
+    EXPECT_EQ(0, memcmp(expected, logIds, sizeof(logIds)));
+
+    encoder.swapBuffer(buffer2, sizeof(buffer2));
+    memset(expected, 0, sizeof(expected));
+    encoder.getEncodedLogIds(logIds);
+    EXPECT_EQ(0, memcmp(expected, logIds, sizeof(logIds)));
+    EXPECT_EQ(0U, encoder.getEncodedWrapArounds());
+
+    // logIds that are a multiple of the bitmap size apart share a bit
+    setLogIdBit(expected, 3);
+    setLogIdBit(expected, 3 + 64*INDEX_LOGID_WORDS);
+    EXPECT_EQ(1U << 3, expected[0]);
+    EXPECT_EQ(0U, expected[1]);
+}
+
 TEST_F(LogTest, Decoder_open) {
     char buffer[1000];
     const char *testFile = "/tmp/testFile";
@@ -862,7 +1017,7 @@ TEST_F(LogTest, decoder_insertCheckpoint) {
     uint32_t numEntries = GeneratedFunctions::numLogIds;
 
     // True Case
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, true, 1000));
     Checkpoint *ck = reinterpret_cast<Checkpoint*>(backing_buffer);
 
     EXPECT_EQ(Log::EntryType::CHECKPOINT, ck->entryType);
@@ -875,7 +1030,7 @@ TEST_F(LogTest, decoder_insertCheckpoint) {
 
     // False Case
     writePos = backing_buffer;
-    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false));
+    ASSERT_TRUE(insertCheckpoint(&writePos, endOfBuffer, false, 1000));
     EXPECT_EQ(Log::EntryType::CHECKPOINT, ck->entryType);
     EXPECT_LT(startCycles, ck->rdtsc);
     EXPECT_GT(PerfUtils::Cycles::rdtsc(), ck->rdtsc);
@@ -887,16 +1042,16 @@ TEST_F(LogTest, decoder_insertCheckpoint) {
     // Out of space case
     char *newEndOfSpace = backing_buffer + metadataBytes;
     writePos = backing_buffer;
-    ASSERT_FALSE(insertCheckpoint(&writePos, newEndOfSpace, true));
+    ASSERT_FALSE(insertCheckpoint(&writePos, newEndOfSpace, true, 1000));
     EXPECT_EQ(backing_buffer, writePos);
 
     writePos = backing_buffer;
-    ASSERT_TRUE(insertCheckpoint(&writePos, newEndOfSpace, false));
+    ASSERT_TRUE(insertCheckpoint(&writePos, newEndOfSpace, false, 1000));
     EXPECT_EQ(backing_buffer + sizeof(Checkpoint), writePos);
 
     writePos = backing_buffer;
     newEndOfSpace = backing_buffer + sizeof(Checkpoint) - 1;
-    ASSERT_FALSE(insertCheckpoint(&writePos, newEndOfSpace, false));
+    ASSERT_FALSE(insertCheckpoint(&writePos, newEndOfSpace, false, 1000));
     EXPECT_EQ(backing_buffer, writePos);
 }
 
@@ -911,7 +1066,7 @@ TEST_F(LogTest, decoder_readDictionary) {
     uint32_t fmOffset, fm2Offset;
 
     // The true case is tested in integration tests
-    insertCheckpoint(&writePos, endOfBuffer, false);
+    insertCheckpoint(&writePos, endOfBuffer, false, 1000);
     Checkpoint *ck = reinterpret_cast<Checkpoint*>(backing_buffer);
 
     // Basic Log that's from asdfasdfasdf:1234 -> "abab %*.*lfabab"
@@ -1204,11 +1359,13 @@ TEST_F(LogTest, decoder_destructor) {
 
     Decoder *dc = new Decoder();
     ASSERT_TRUE(dc->open(testFile));
+    EXPECT_NE(nullptr, dc->mappedLog);
     dc->freeBuffers.push_back(new Decoder::BufferFragment());
     dc->~Decoder();
 
     // I'm touching deallocated memory >=3
     EXPECT_EQ(nullptr, dc->inputFd);
+    EXPECT_EQ(nullptr, dc->mappedLog);
     EXPECT_TRUE(dc->freeBuffers.empty());
 
     free(dc);
@@ -1284,12 +1441,45 @@ TEST_F(LogTest, Decoder_readBufferExtent_end2end) {
     ASSERT_EQ(EntryType::BUFFER_EXTENT, peekEntryType(in));
     ASSERT_TRUE(bf->readBufferExtent(in, &wrapAround));
     EXPECT_EQ(e.getEncodedBytes(), bf->validBytes);
+    EXPECT_LE(bf->validBytes, bf->storageSize);
 
     EXPECT_EQ(5, bf->runtimeId);
     EXPECT_EQ(100UL, bf->nextLogTimestamp);
     EXPECT_EQ(noParamsId, bf->nextLogId);
     EXPECT_FALSE(wrapAround);
 
+    // An extent larger than the maximum length is treated as corrupted
+    rewind(in);
+    EXPECT_FALSE(bf->readBufferExtent(in, &wrapAround,
+                                      downCast<uint32_t>(bf->validBytes - 1)));
+
+    // With a mapping, the extent is viewed in place and the file skipped
+    uint64_t fileSize = e.getEncodedBytes();
+    char *mapped = static_cast<char*>(mmap(nullptr, fileSize, PROT_READ,
+                                           MAP_SHARED, fileno(in), 0));
+    ASSERT_NE(MAP_FAILED, mapped);
+    rewind(in);
+    ASSERT_TRUE(bf->readBufferExtent(in, &wrapAround,
+                                     NanoLogConfig::OUTPUT_BUFFER_SIZE,
+                                     mapped, fileSize));
+    EXPECT_EQ(fileSize, bf->validBytes);
+    EXPECT_EQ(mapped + fileSize, bf->endOfBuffer);
+    EXPECT_EQ(static_cast<long>(fileSize), ftell(in));
+    EXPECT_EQ(5, bf->runtimeId);
+    EXPECT_EQ(100UL, bf->nextLogTimestamp);
+    EXPECT_EQ(noParamsId, bf->nextLogId);
+
+    // An extent extending past the mapping (i.e. the file grew) is read in
+    rewind(in);
+    ASSERT_TRUE(bf->readBufferExtent(in, &wrapAround,
+                                     NanoLogConfig::OUTPUT_BUFFER_SIZE,
+                                     mapped, fileSize - 1));
+    EXPECT_EQ(bf->storage + fileSize, bf->endOfBuffer);
+    EXPECT_EQ(5, bf->runtimeId);
+
+    munmap(mapped, fileSize);
+    fclose(in);
+
     delete bf;
     std::remove(testFile);
 }
@@ -1349,7 +1539,7 @@ TEST_F(LogTest, Decoder_readBufferExtent_notEnoughSpace) {
     BufferExtent *be = reinterpret_cast<BufferExtent*>(badBuffer);
     be->entryType = EntryType::BUFFER_EXTENT;
     be->isShort = true;
-    be->length = sizeof(bf->storage) + 1;
+    be->length = NanoLogConfig::OUTPUT_BUFFER_SIZE + 1;
     be->threadIdOrPackNibble = 1;
     be->wrapAround = false;
 
@@ -1374,7 +1564,7 @@ TEST_F(LogTest, Decoder_readBufferExtent_notEnoughSpace) {
     be = reinterpret_cast<BufferExtent*>(badBuffer);
     be->entryType = EntryType::BUFFER_EXTENT;
     be->isShort = true;
-    be->length = sizeof(bf->storage) + 1;
+    be->length = NanoLogConfig::OUTPUT_BUFFER_SIZE + 1;
     be->threadIdOrPackNibble = 1;
     be->wrapAround = false;
     ++be;
@@ -1497,6 +1687,7 @@ TEST_F(LogTest, Decoder_internalDecompress_end2end) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 0;
     checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
 
     UncompressedEntry* ue = reinterpret_cast<UncompressedEntry*>(inputBuffer);
     ue->timestamp = 90;
@@ -1770,6 +1961,27 @@ TEST_F(LogTest, Decoder_internalDecompress_end2end) {
     EXPECT_FALSE(iFile.eof());
     iFile.close();
 
+    // The ordered case decompressed in parallel should yield the same output
+    for (uint32_t numThreads : {2, 3, 8}) {
+        dc.open(testFile);
+
+        outputFd = fopen(decomp, "w");
+        ASSERT_NE(nullptr, outputFd);
+        EXPECT_EQ(12, dc.decompressTo(outputFd, numThreads));
+        EXPECT_EQ(8, dc.numBufferFragmentsRead);
+        EXPECT_EQ(1, dc.numCheckpointsRead);
+        fclose(outputFd);
+
+        iFile.open(decomp);
+        for (const char *line : orderedLines) {
+            ASSERT_TRUE(iFile.good());
+            std::getline(iFile, iLine);
+            EXPECT_STREQ(line +  14, iLine.c_str() + 14);
+        }
+        EXPECT_FALSE(iFile.eof());
+        iFile.close();
+    }
+
     std::remove(testFile);
     std::remove(decomp);
 }
@@ -1799,6 +2011,7 @@ TEST_F(LogTest, Decoder_internalDecompress_fileBreaks) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 0;
     checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
 
     long bytesRead = encoder.encodeLogMsgs(inputBuffer,
                                                     5*sizeof(UncompressedEntry),
@@ -1819,6 +2032,7 @@ TEST_F(LogTest, Decoder_internalDecompress_fileBreaks) {
     checkpoint2->cyclesPerSecond = 1e9;
     checkpoint2->rdtsc = 0;
     checkpoint2->unixTime = 1;
+    checkpoint2->unixTimeNanos = 0;
 
     oFile.write(outputBuffer, encoder2.getEncodedBytes());
 
@@ -1829,6 +2043,7 @@ TEST_F(LogTest, Decoder_internalDecompress_fileBreaks) {
     checkpoint3->cyclesPerSecond = 1e9;
     checkpoint3->rdtsc = 0;
     checkpoint3->unixTime = 1;
+    checkpoint3->unixTimeNanos = 0;
 
     bytesRead = encoder3.encodeLogMsgs(inputBuffer,
                                                     5*sizeof(UncompressedEntry),
@@ -1955,6 +2170,7 @@ TEST_F(LogTest, Decoder_internalDecompress_fileBreaks2) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 0;
     checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
 
     long bytesRead = encoder.encodeLogMsgs(inputBuffer,
                                            1*sizeof(UncompressedEntry),
@@ -1992,6 +2208,7 @@ TEST_F(LogTest, Decoder_internalDecompress_fileBreaks2) {
     checkpoint3->cyclesPerSecond = 1e9;
     checkpoint3->rdtsc = 0;
     checkpoint3->unixTime = 1;
+    checkpoint3->unixTimeNanos = 0;
 
     bytesRead = encoder3.encodeLogMsgs(inputBuffer,
                                        1*sizeof(UncompressedEntry),
@@ -2064,6 +2281,7 @@ TEST_F(LogTest, Decoder_decompressNextLogStatement_timeTravel) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 20e9;
     checkpoint->unixTime = 30;
+    checkpoint->unixTimeNanos = 0;
 
     long bytesRead = encoder.encodeLogMsgs(inputBuffer,
                                                     sizeof(UncompressedEntry),
@@ -2152,6 +2370,347 @@ TEST_F(LogTest, Decoder_decompressNextLogStatement_timeTravel) {
     std::remove(decomp);
 }
 
+TEST_F(LogTest, Decoder_clockSync) {
+    char inputBuffer[1000], outputBuffer[1000];
+    const char *testFile = "/tmp/testFile";
+    const char *decomp = "/tmp/testFile2";
+
+    UncompressedEntry* ue = reinterpret_cast<UncompressedEntry*>(inputBuffer);
+    ue->fmtId = noParamsId;
+    ue->entrySize = sizeof(UncompressedEntry);
+
+    uint64_t compressedLogs = 0;
+    Encoder encoder(outputBuffer, 1000);
+
+    // Hack to load fake Checkpoint values to get a consistent time output
+    Checkpoint *checkpoint = (Checkpoint*)outputBuffer;
+    checkpoint->cyclesPerSecond = 1e9;
+    checkpoint->rdtsc = 0;
+    checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
+
+    ue->timestamp = 1e9 + 1;
+    encoder.encodeLogMsgs(inputBuffer, sizeof(UncompressedEntry), 1, false,
+                          &compressedLogs);
+
+    // The clock sync corrects the wall time by 500ns
+    Checkpoint *sync = reinterpret_cast<Checkpoint*>(encoder.writePos);
+    ASSERT_TRUE(encoder.encodeClockSync());
+    sync->cyclesPerSecond = 1e9;
+    sync->rdtsc = 2e9;
+    sync->unixTime = 3;
+    sync->unixTimeNanos = 500;
+
+    ue->timestamp = 3e9;
+    encoder.encodeLogMsgs(inputBuffer, sizeof(UncompressedEntry), 1, false,
+                          &compressedLogs);
+    EXPECT_EQ(2U, compressedLogs);
+
+    std::ofstream oFile;
+    oFile.open(testFile);
+    oFile.write(outputBuffer, encoder.getEncodedBytes());
+    oFile.close();
+
+    // The clock sync is neither a new execution nor drops the dictionary
+    Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    FILE *outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_TRUE(dc.internalDecompressUnordered(outputFd));
+    EXPECT_EQ(2, dc.logMsgsPrinted);
+    EXPECT_EQ(1, dc.numCheckpointsRead);
+    EXPECT_EQ(2e9, dc.checkpoint.rdtsc);
+    fclose(outputFd);
+
+    const char* expectedLines[] = {
+        "1969-12-31 16:00:02.000000001 testHelper/client.cc:20 NOTICE[1]: Simple log message with 0 parameters\r",
+        "1969-12-31 16:00:04.000000500 testHelper/client.cc:20 NOTICE[1]: Simple log message with 0 parameters\r"
+    };
+
+    std::ifstream iFile;
+    iFile.open(decomp);
+    std::string iLine;
+    for (const char *line : expectedLines) {
+        ASSERT_TRUE(iFile.good());
+        std::getline(iFile, iLine);
+        if (iLine.size() >= 14)
+            EXPECT_STREQ(line + 14, iLine.c_str() + 14);// +14 skips date + hour
+    }
+    while (std::getline(iFile, iLine))
+        EXPECT_EQ(std::string::npos, iLine.find("New execution"));
+    iFile.close();
+
+    // The ordered case sorts the log messages across the clock sync
+    dc.open(testFile);
+    outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    dc.decompressTo(outputFd);
+    EXPECT_EQ(2, dc.logMsgsPrinted);
+    EXPECT_EQ(1, dc.numCheckpointsRead);
+    fclose(outputFd);
+
+    iFile.open(decomp);
+    int lines = 0;
+    while (std::getline(iFile, iLine)) {
+        EXPECT_EQ(std::string::npos, iLine.find("New execution"));
+        ++lines;
+    }
+    EXPECT_LE(2, lines);
+    iFile.close();
+
+    std::remove(testFile);
+    std::remove(decomp);
+}
+
+TEST_F(LogTest, Decoder_setTimeRange) {
+    const char *testFile = "/tmp/testFile";
+    const char *decomp = "/tmp/testFile2";
+    std::string indexFile = std::string(testFile) + INDEX_FILE_SUFFIX;
+    char inputBuffer[1000], buffers[3][1000];
+    Encoder encoder(buffers[0], 1000);
+
+    // Hack to load fake Checkpoint values to get a consistent time output
+    Checkpoint *checkpoint = (Checkpoint*)buffers[0];
+    checkpoint->cyclesPerSecond = 1e9;
+    checkpoint->rdtsc = 0;
+    checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
+
+    // Simulate the runtime writing out 3 output buffers with 2 log messages
+    // each and indexing them.
+    std::ofstream oFile(testFile);
+    std::ofstream oIndex(indexFile);
+    uint64_t offset = 0;
+    for (int i = 0; i < 3; ++i) {
+        UncompressedEntry* ue =
+                reinterpret_cast<UncompressedEntry*>(inputBuffer);
+        for (int j = 0; j < 2; ++j) {
+            ue->timestamp = 100*i + 10*j + 10;
+            ue->fmtId = noParamsId;
+            ue->entrySize = sizeof(UncompressedEntry);
+            ++ue;
+        }
+
+        uint64_t compressedLogs = 0;
+        encoder.encodeLogMsgs(inputBuffer, 2*sizeof(UncompressedEntry), 1,
+                              true, &compressedLogs);
+        EXPECT_EQ(2U, compressedLogs);
+
+        IndexEntry ie;
+        ie.checkpointOffset = 0;
+        ie.offset = offset;
+        ie.length = downCast<uint32_t>(encoder.getEncodedBytes());
+        ie.hasMetadata = encoder.hasEncodedMetadata();
+        encoder.getEncodedTimestampRange(&ie.minTimestamp, &ie.maxTimestamp);
+        encoder.getEncodedLogIds(ie.logIds);
+        ie.numWrapArounds = encoder.getEncodedWrapArounds();
+        oIndex.write(reinterpret_cast<char*>(&ie), sizeof(ie));
+        oFile.write(buffers[i], encoder.getEncodedBytes());
+        offset += encoder.getEncodedBytes();
+
+        if (i < 2)
+            encoder.swapBuffer(buffers[i + 1], 1000);
+    }
+    oFile.close();
+    oIndex.close();
+
+    const char* expectedLines[] = {
+        "1969-12-31 16:00:01.000000110 testHelper/client.cc:20 NOTICE[1]: Simple log message with 0 parameters\r",
+        "1969-12-31 16:00:01.000000120 testHelper/client.cc:20 NOTICE[1]: Simple log message with 0 parameters\r",
+        "1969-12-31 16:00:01.000000210 testHelper/client.cc:20 NOTICE[1]: Simple log message with 0 parameters\r",
+    };
+
+    Decoder dc;
+    FILE *outputFd;
+    std::ifstream iFile;
+    std::string iLine;
+
+    // Only the last 2 output buffers need to be read
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setTimeRange(1000000110, 1000000210));
+    EXPECT_EQ(offset, dc.inputLimit);
+    outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_EQ(3, dc.decompressTo(outputFd));
+    EXPECT_EQ(2U, dc.numBufferFragmentsRead);
+    fclose(outputFd);
+
+    iFile.open(decomp);
+    for (const char *line : expectedLines) {
+        ASSERT_TRUE(iFile.good());
+        std::getline(iFile, iLine);
+        EXPECT_STREQ(line + 14, iLine.c_str() + 14); // +14 skips date + hour
+    }
+    iFile.close();
+
+    // The same with the iterative interface, but only the middle buffer
+    LogMessage logMsg;
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setTimeRange(1000000101, 1000000199));
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(110U, logMsg.getTimestamp());
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(120U, logMsg.getTimestamp());
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(1U, dc.numBufferFragmentsRead);
+
+    // Nothing at all in range
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setTimeRange(1000000300, 1000000400));
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(0U, dc.numBufferFragmentsRead);
+
+    // Without the index, the entire log has to be scanned
+    std::remove(indexFile.c_str());
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setTimeRange(1000000110, 1000000210));
+    EXPECT_EQ(UINT64_MAX, dc.inputLimit);
+    outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_TRUE(dc.internalDecompressUnordered(outputFd));
+    EXPECT_EQ(3U, dc.logMsgsPrinted);
+    EXPECT_EQ(3U, dc.numBufferFragmentsRead);
+    fclose(outputFd);
+
+    iFile.open(decomp);
+    for (const char *line : expectedLines) {
+        ASSERT_TRUE(iFile.good());
+        std::getline(iFile, iLine);
+        EXPECT_STREQ(line + 14, iLine.c_str() + 14); // +14 skips date + hour
+    }
+    iFile.close();
+
+    std::remove(testFile);
+    std::remove(decomp);
+}
+
+TEST_F(LogTest, Decoder_setLogFilter) {
+    const char *testFile = "/tmp/testFile";
+    const char *decomp = "/tmp/testFile2";
+    std::string indexFile = std::string(testFile) + INDEX_FILE_SUFFIX;
+    char inputBuffer[1000], buffers[3][1000];
+    Encoder encoder(buffers[0], 1000);
+
+    uint32_t errorId = __fmtId__Error32Level__testHelper47client46cc__26__;
+    uint32_t warningId = __fmtId__Warning32Level__testHelper47client46cc__25__;
+
+    // Hack to load fake Checkpoint values to get a consistent time output
+    Checkpoint *checkpoint = (Checkpoint*)buffers[0];
+    checkpoint->cyclesPerSecond = 1e9;
+    checkpoint->rdtsc = 0;
+    checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
+
+    // The runtime writes out 3 output buffers; the first has the metadata
+    // plus 2 log messages without parameters, the second has an ERROR and
+    // a message without parameters, and the last has 2 WARNINGs.
+    uint32_t fmtIds[3][2] = {{uint32_t(noParamsId), uint32_t(noParamsId)},
+                             {errorId, uint32_t(noParamsId)},
+                             {warningId, warningId}};
+    std::ofstream oFile(testFile);
+    std::ofstream oIndex(indexFile);
+    uint64_t offset = 0;
+    for (int i = 0; i < 3; ++i) {
+        UncompressedEntry* ue =
+                reinterpret_cast<UncompressedEntry*>(inputBuffer);
+        for (int j = 0; j < 2; ++j) {
+            ue->timestamp = 100*i + 10*j + 10;
+            ue->fmtId = fmtIds[i][j];
+            ue->entrySize = sizeof(UncompressedEntry);
+            ++ue;
+        }
+
+        uint64_t compressedLogs = 0;
+        encoder.encodeLogMsgs(inputBuffer, 2*sizeof(UncompressedEntry), 1,
+                              true, &compressedLogs);
+        EXPECT_EQ(2U, compressedLogs);
+
+        IndexEntry ie;
+        ie.checkpointOffset = 0;
+        ie.offset = offset;
+        ie.length = downCast<uint32_t>(encoder.getEncodedBytes());
+        ie.hasMetadata = encoder.hasEncodedMetadata();
+        encoder.getEncodedTimestampRange(&ie.minTimestamp, &ie.maxTimestamp);
+        encoder.getEncodedLogIds(ie.logIds);
+        ie.numWrapArounds = encoder.getEncodedWrapArounds();
+        EXPECT_EQ(1U, ie.numWrapArounds);
+        oIndex.write(reinterpret_cast<char*>(&ie), sizeof(ie));
+        oFile.write(buffers[i], encoder.getEncodedBytes());
+        offset += encoder.getEncodedBytes();
+
+        if (i < 2)
+            encoder.swapBuffer(buffers[i + 1], 1000);
+    }
+    oFile.close();
+    oIndex.close();
+
+    Decoder dc;
+    FILE *outputFd;
+    LogMessage logMsg;
+
+    // Only ERRORs; the last output buffer can be skipped
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setLogFilter(-1, NanoLog::ERROR));
+    outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_EQ(1, dc.decompressTo(outputFd));
+    EXPECT_EQ(2U, dc.numBufferFragmentsRead);
+    EXPECT_EQ(1U, dc.numOutputBuffersSkipped);
+    fclose(outputFd);
+
+    // WARNINGs and above with the iterative interface
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setLogFilter(-1, NanoLog::WARNING));
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(errorId, logMsg.getLogId());
+    EXPECT_EQ(110U, logMsg.getTimestamp());
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(warningId, logMsg.getLogId());
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(warningId, logMsg.getLogId());
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(0U, dc.numOutputBuffersSkipped);
+
+    // By logId, combined with a time range
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setTimeRange(1000000020, 1000000300));
+    ASSERT_TRUE(dc.setLogFilter(noParamsId));
+    outputFd = fopen(decomp, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_TRUE(dc.internalDecompressUnordered(outputFd));
+    EXPECT_EQ(2U, dc.logMsgsPrinted);
+    EXPECT_EQ(1U, dc.numOutputBuffersSkipped);
+    fclose(outputFd);
+
+    // No source file matches
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setLogFilter(-1, -1, "server.cc"));
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(1U, dc.numBufferFragmentsRead);
+    EXPECT_EQ(2U, dc.numOutputBuffersSkipped);
+
+    // Aggregations without output only read the buffers with the target
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_TRUE(dc.internalDecompressUnordered(nullptr, warningId));
+    EXPECT_EQ(0U, dc.numOutputBuffersSkipped);
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_TRUE(dc.internalDecompressUnordered(nullptr, errorId, &aggregation));
+    EXPECT_EQ(1U, dc.numOutputBuffersSkipped);
+
+    // Without the index, the messages are still filtered
+    std::remove(indexFile.c_str());
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setLogFilter(-1, NanoLog::ERROR, "client.cc"));
+    ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(errorId, logMsg.getLogId());
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(3U, dc.numBufferFragmentsRead);
+    EXPECT_EQ(0U, dc.numOutputBuffersSkipped);
+
+    std::remove(testFile);
+    std::remove(decomp);
+}
+
 TEST_F(LogTest, Decoder_getNextLogStatement) {
     // First we have to create a log file with encoder.
     const char *testFile = "/tmp/testFile";
@@ -2164,6 +2723,7 @@ TEST_F(LogTest, Decoder_getNextLogStatement) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 0;
     checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
 
     char *writePos = inputBuffer;
     UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
@@ -2328,6 +2888,378 @@ TEST_F(LogTest, Decoder_getNextLogStatement) {
     std::remove(decomp);
 }
 
+TEST_F(LogTest, Decoder_exportColumns) {
+    const char *testFile = "/tmp/testFile";
+    const char *exportFile = "/tmp/testFile2";
+    char inputBuffer[1000], buffer[1000];
+    Encoder encoder(buffer, 1000, false, true);
+
+    Checkpoint *checkpoint = (Checkpoint *) encoder.backing_buffer;
+    checkpoint->cyclesPerSecond = 1e9;
+    checkpoint->rdtsc = 0;
+    checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
+
+    char *writePos = inputBuffer;
+    for (int i = 0; i < 2; ++i) {
+        UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
+        ue->timestamp = 10*(i + 1);
+        ue->fmtId = integerParamId;
+        ue->entrySize = sizeof(UncompressedEntry) + sizeof(int);
+        writePos += ue->entrySize;
+        *((int*)(ue->argData)) = (i == 0) ? 1 : -2;
+    }
+
+    UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
+    ue->timestamp = 30;
+    ue->fmtId = stringParamId;
+    ue->entrySize = sizeof(UncompressedEntry) + strlen("str") + 1;
+    writePos += sizeof(UncompressedEntry);
+    strcpy(writePos, "str");
+    writePos += strlen("str") + 1;
+
+    uint64_t compressedLogs = 0;
+    encoder.encodeLogMsgs(inputBuffer, writePos - inputBuffer, 1, false,
+                          &compressedLogs);
+    EXPECT_EQ(3, compressedLogs);
+
+    std::ofstream oFile;
+    oFile.open(testFile);
+    oFile.write(buffer, encoder.getEncodedBytes());
+    oFile.close();
+
+    Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    FILE *outputFd = fopen(exportFile, "w");
+    ASSERT_NE(nullptr, outputFd);
+    EXPECT_EQ(3, dc.exportColumns(outputFd));
+    fclose(outputFd);
+
+    std::ifstream iFile(exportFile, std::ifstream::binary);
+    std::stringstream contents;
+    contents << iFile.rdbuf();
+    std::string exported = contents.str();
+    const char *pos = exported.c_str() + sizeof(ColumnarFileHeader);
+
+    // Batches are written in logId order
+    int minId = std::min(integerParamId, stringParamId);
+    for (int batchNum = 0; batchNum < 2; ++batchNum) {
+        ColumnarBatchHeader batch;
+        memcpy(&batch, pos, sizeof(batch));
+        pos += sizeof(batch) + batch.filenameLength;
+
+        bool isInteger = (batchNum == 0) == (minId == integerParamId);
+        EXPECT_EQ(isInteger ? integerParamId : stringParamId,
+                  static_cast<int>(batch.logId));
+        EXPECT_EQ(0U, batch.execution);
+        EXPECT_EQ(isInteger ? 2U : 1U, batch.numRows);
+        ASSERT_EQ(3U, batch.numColumns);
+        EXPECT_STREQ(isInteger ? "I have an integer %d" : "This is a string %s",
+                     pos);
+        pos += batch.formatStringLength;
+
+        ColumnHeader columns[3];
+        memcpy(columns, pos, sizeof(columns));
+        pos += sizeof(columns);
+
+        uint64_t values[3];
+        memcpy(values, pos, sizeof(uint64_t)*batch.numRows);
+        EXPECT_EQ(1000000000U + (isInteger ? 10 : 30), values[0]);
+        if (isInteger)
+            EXPECT_EQ(1000000020U, values[1]);
+        pos += columns[0].numBytes;
+
+        memcpy(values, pos, sizeof(uint64_t)*batch.numRows);
+        EXPECT_EQ(1U, values[0]);
+        pos += columns[1].numBytes;
+
+        if (isInteger) {
+            EXPECT_EQ(INT64_COLUMN, columns[2].type);
+            memcpy(values, pos, sizeof(uint64_t)*batch.numRows);
+            EXPECT_EQ(1, static_cast<int64_t>(values[0]));
+            EXPECT_EQ(-2, static_cast<int64_t>(values[1]));
+        } else {
+            EXPECT_EQ(STRING_COLUMN, columns[2].type);
+            EXPECT_EQ("str", std::string(pos + 2*sizeof(uint64_t), 3));
+        }
+        pos += columns[2].numBytes;
+    }
+    EXPECT_EQ(exported.c_str() + exported.size(), pos);
+
+    std::remove(testFile);
+    std::remove(exportFile);
+}
+
+TEST_F(LogTest, Decoder_getNextArgumentBatch) {
+    const char *testFile = "/tmp/testFile";
+    char inputBuffer[1000], buffer[1000];
+    Encoder encoder(buffer, 1000, false, true);
+
+    const char *strParam = "str";
+    char *writePos = inputBuffer;
+    for (int i = 0; i < 3; ++i) {
+        UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
+        ue->timestamp = 10*(i + 1);
+        ue->fmtId = integerParamId;
+        ue->entrySize = sizeof(UncompressedEntry) + sizeof(int);
+        writePos += ue->entrySize;
+        *((int*)(ue->argData)) = (i == 1) ? -100000 : i;
+
+        // Interleave log messages whose arguments need to be skipped over
+        ue = reinterpret_cast<UncompressedEntry *>(writePos);
+        ue->timestamp = 10*(i + 1) + 5;
+        ue->fmtId = mixParamId;
+        ue->entrySize = sizeof(UncompressedEntry) + sizeof(int)
+                        + sizeof(double) + sizeof(uint32_t)
+                        + strlen(strParam) + 1;
+        writePos += sizeof(UncompressedEntry);
+
+        *(reinterpret_cast<int*>(writePos)) = -i;
+        writePos += sizeof(int);
+        *(reinterpret_cast<double*>(writePos)) = 0.5*i;
+        writePos += sizeof(double);
+        *(reinterpret_cast<uint32_t*>(writePos)) = 7;
+        writePos += sizeof(uint32_t);
+        strcpy(writePos, strParam);
+        writePos += strlen(strParam) + 1;
+    }
+
+    uint64_t compressedLogs = 0;
+    encoder.encodeLogMsgs(inputBuffer, writePos - inputBuffer, 1, false,
+                          &compressedLogs);
+    EXPECT_EQ(6, compressedLogs);
+
+    std::ofstream oFile;
+    oFile.open(testFile);
+    oFile.write(buffer, encoder.getEncodedBytes());
+    oFile.close();
+
+    std::unique_ptr<ArgumentBatch> batch(new ArgumentBatch());
+    Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.getNextArgumentBatch(integerParamId, 0, *batch));
+    EXPECT_EQ(int_t, batch->argType);
+    EXPECT_FALSE(batch->isFloatingPoint());
+    ASSERT_EQ(3U, batch->size);
+    EXPECT_EQ(0, batch->ints[0]);
+    EXPECT_EQ(-100000, batch->ints[1]);
+    EXPECT_EQ(2, batch->ints[2]);
+    EXPECT_EQ(10U, batch->timestamps[0]);
+    EXPECT_EQ(30U, batch->timestamps[2]);
+    EXPECT_FALSE(dc.getNextArgumentBatch(integerParamId, 0, *batch));
+    EXPECT_EQ(0U, batch->size);
+
+    // Arguments after a dynamic string
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.getNextArgumentBatch(mixParamId, 1, *batch));
+    EXPECT_TRUE(batch->isFloatingPoint());
+    ASSERT_EQ(3U, batch->size);
+    EXPECT_EQ(0.0, batch->doubles[0]);
+    EXPECT_EQ(1.0, batch->doubles[2]);
+    EXPECT_EQ(35U, batch->timestamps[2]);
+
+    // The filters apply to the batches as well
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.setLogFilter(mixParamId));
+    EXPECT_FALSE(dc.getNextArgumentBatch(integerParamId, 0, *batch));
+
+    testing::internal::CaptureStderr();
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_FALSE(dc.getNextArgumentBatch(mixParamId, 3, *batch));
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_FALSE(dc.getNextArgumentBatch(mixParamId, 4, *batch));
+    std::string output = testing::internal::GetCapturedStderr();
+    EXPECT_NE(std::string::npos, output.find("Argument 3 of logId="));
+    EXPECT_NE(std::string::npos, output.find("has only 4 arguments"));
+
+    std::remove(testFile);
+}
+
+TEST_F(LogTest, Decoder_follow) {
+    const char *testFile = "/tmp/testFile";
+    char inputBuffer[1000], buffer[1000];
+    Encoder encoder(buffer, 1000, false, true);
+
+    char *writePos = inputBuffer;
+    for (int i = 0; i < 3; ++i) {
+        UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
+        ue->timestamp = 10*(i + 1);
+        ue->fmtId = integerParamId;
+        ue->entrySize = sizeof(UncompressedEntry) + sizeof(int);
+        writePos += ue->entrySize;
+        *((int*)(ue->argData)) = i;
+    }
+
+    uint64_t compressedLogs = 0;
+    encoder.encodeLogMsgs(inputBuffer, writePos - inputBuffer, 1, false,
+                          &compressedLogs);
+    EXPECT_EQ(3, compressedLogs);
+
+    // Only part of the BufferExtent has made it to the file
+    uint32_t encodedBytes = encoder.getEncodedBytes();
+    uint32_t partialBytes = encodedBytes - 5;
+    FILE *out = fopen(testFile, "w");
+    ASSERT_NE(nullptr, out);
+    fwrite(buffer, 1, partialBytes, out);
+    fflush(out);
+
+    LogMessage logMsg;
+    Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+
+    // Without follow mode, the partial BufferExtent is corrupt
+    testing::internal::CaptureStderr();
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    testing::internal::GetCapturedStderr();
+
+    ASSERT_TRUE(dc.open(testFile));
+    dc.setFollow(true, 50);
+    EXPECT_FALSE(dc.isEntryComplete(ftell(dc.inputFd)));
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+
+    dc.setFollow(true, 5000);
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        fwrite(buffer + partialBytes, 1, encodedBytes - partialBytes, out);
+        fflush(out);
+    });
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+        EXPECT_EQ(integerParamId, logMsg.getLogId());
+        EXPECT_EQ(i, logMsg.get<int>(0));
+    }
+    writer.join();
+
+    dc.setFollow(true, 10);
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(1, dc.numBufferFragmentsRead);
+
+    fclose(out);
+    std::remove(testFile);
+}
+
+TEST_F(LogTest, compressBlock) {
+    char input[1000], output[1100];
+    for (size_t i = 0; i < sizeof(input); ++i)
+        input[i] = static_cast<char>('a' + i % 10);
+
+    ASSERT_LE(maxCompressedBlockSize(sizeof(input)), sizeof(output));
+    size_t bytes = compressBlock(input, sizeof(input), output);
+    CompressedBlock *block = reinterpret_cast<CompressedBlock*>(output);
+    EXPECT_EQ(LOG_MSGS_OR_DIC, peekEntryType(output));
+    EXPECT_EQ(LZ4_BLOCK, block->codec);
+    EXPECT_EQ(sizeof(input), block->uncompressedLength);
+    EXPECT_EQ(bytes, sizeof(CompressedBlock) + block->compressedLength);
+    EXPECT_GT(100U, bytes);
+
+    // Incompressible contents are stored as is
+    bytes = compressBlock("abc", 3, output);
+    EXPECT_EQ(STORED_BLOCK, block->codec);
+    EXPECT_EQ(3U, block->compressedLength);
+    EXPECT_EQ(sizeof(CompressedBlock) + 3, bytes);
+    EXPECT_EQ(0, memcmp("abc", output + sizeof(CompressedBlock), 3));
+}
+
+TEST_F(LogTest, Decoder_blockCompressed) {
+    const char *testFile = "/tmp/testFile";
+    char inputBuffer[1000], buffer[1000];
+    Encoder encoder(buffer, 1000, false, true, false, true);
+    EXPECT_EQ(BLOCK_COMPRESSED | PRECISE_TIME,
+              reinterpret_cast<Checkpoint*>(buffer)->flags);
+
+    char *writePos = inputBuffer;
+    for (int i = 0; i < 6; ++i) {
+        UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(writePos);
+        ue->timestamp = 10*(i + 1);
+        ue->fmtId = integerParamId;
+        ue->entrySize = sizeof(UncompressedEntry) + sizeof(int);
+        writePos += ue->entrySize;
+        *((int*)(ue->argData)) = i;
+    }
+
+    // The first output buffer holds the checkpoint and the first extent
+    uint64_t compressedLogs = 0;
+    long halfInput = (writePos - inputBuffer)/2;
+    encoder.encodeLogMsgs(inputBuffer, halfInput, 1, false, &compressedLogs);
+    uint32_t firstBytes = encoder.getEncodedBytes();
+
+    // The log switches to block compression after an ordinary Checkpoint
+    char file[2000];
+    char *filePos = file;
+    ASSERT_TRUE(insertCheckpoint(&filePos, file + sizeof(file), false, 1000));
+    memcpy(filePos, buffer, sizeof(Checkpoint));
+    size_t fileBytes = 2*sizeof(Checkpoint);
+    fileBytes += compressBlock(buffer + sizeof(Checkpoint),
+                               firstBytes - sizeof(Checkpoint),
+                               file + fileBytes);
+
+    char secondBuffer[1000];
+    encoder.swapBuffer(secondBuffer, sizeof(secondBuffer));
+    encoder.encodeLogMsgs(inputBuffer + halfInput, halfInput, 2, false,
+                          &compressedLogs);
+    EXPECT_EQ(6U, compressedLogs);
+    size_t firstBlockEnd = fileBytes;
+    fileBytes += compressBlock(secondBuffer, encoder.getEncodedBytes(),
+                               file + fileBytes);
+
+    // Only part of the second block has made it to the file
+    FILE *out = fopen(testFile, "w");
+    ASSERT_NE(nullptr, out);
+    fwrite(file, 1, firstBlockEnd + 5, out);
+    fflush(out);
+
+    LogMessage logMsg;
+    Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_LE(0, dc.compressedLogFd);
+    EXPECT_EQ(firstBlockEnd, dc.compressedLogOffset);
+    EXPECT_EQ(sizeof(Checkpoint) + firstBytes, dc.inflatedLogSize);
+
+    std::vector<IndexEntry> index;
+    EXPECT_FALSE(dc.readIndex(index));
+
+    dc.setFollow(true, 5000);
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        fwrite(file + firstBlockEnd + 5, 1, fileBytes - firstBlockEnd - 5, out);
+        fflush(out);
+    });
+
+    for (int i = 0; i < 6; ++i) {
+        ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+        EXPECT_EQ(integerParamId, logMsg.getLogId());
+        EXPECT_EQ(10*(i + 1), logMsg.getTimestamp());
+        EXPECT_EQ(i, logMsg.get<int>(0));
+    }
+    writer.join();
+    fclose(out);
+
+    dc.setFollow(false);
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_EQ(2, dc.numBufferFragmentsRead);
+
+    // A corrupt block stops the decompression
+    reinterpret_cast<CompressedBlock*>(file + firstBlockEnd)->codec = 0x3f;
+    std::ofstream oFile;
+    oFile.open(testFile);
+    oFile.write(file, fileBytes);
+    oFile.close();
+
+    testing::internal::CaptureStderr();
+    ASSERT_TRUE(dc.open(testFile));
+    EXPECT_EQ(UINT64_MAX, dc.compressedLogOffset);
+    EXPECT_EQ(sizeof(Checkpoint) + firstBytes, dc.inflatedLogSize);
+    for (int i = 0; i < 3; ++i)
+        ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+    EXPECT_NE(std::string::npos, testing::internal::GetCapturedStderr().find(
+                                "Corrupt entry"));
+
+    dc.close();
+    std::remove(testFile);
+}
+
 // Static helper functions to test when aggregation is run.
 static int numInvocations = 0;
 
@@ -2358,6 +3290,7 @@ TEST_F(LogTest, Decoder_internalDecompress_aggregationFn) {
     checkpoint->cyclesPerSecond = 1e9;
     checkpoint->rdtsc = 0;
     checkpoint->unixTime = 1;
+    checkpoint->unixTimeNanos = 0;
 
     UncompressedEntry *ue = reinterpret_cast<UncompressedEntry *>(inputBuffer);
     ue->timestamp = 90;
@@ -2565,13 +3498,15 @@ static int compressHelper0TimesRun = 0;
 static int compressHelper1TimesRun = 0;
 
 static void
-compressHelper0(int numNibbles, const ParamType*, char **in, char**out)
+compressHelper0(int numNibbles, const ParamType*, char **in, char**out,
+                BufferUtils::ArgumentHistory*, BufferUtils::StaticStringTable*)
 {
     ++compressHelper0TimesRun;
 }
 
 static void
-compressHelper1(int numNibbles, const ParamType*, char **in, char**out)
+compressHelper1(int numNibbles, const ParamType*, char **in, char**out,
+                BufferUtils::ArgumentHistory*, BufferUtils::StaticStringTable*)
 {
     ++compressHelper1TimesRun;
 }
@@ -2665,6 +3600,49 @@ TEST_F(LogTest, encodeLogMsgs_cpp17) {
     EXPECT_EQ(0, encoder.consecutiveEncodeMissesDueToMetadata);
 }
 
+TEST_F(LogTest, encodeLogMsgs_compressedBytesPerLogId) {
+    char inBuffer[1024];
+    char outBuffer[1024];
+
+    // Log identifiers past the ones counted individually share a counter
+    const uint32_t numCounters = NanoLogConfig::MAX_LOG_SITE_STATS + 1;
+    NanoLogInternal::ParamType paramTypes[10];
+    std::vector<StaticLogInfo> dictionary(numCounters + 1,
+            StaticLogInfo(&compressHelper0, "File", 123, 0, "Hello World", 0,
+                          0, paramTypes));
+
+    char *in = inBuffer;
+    uint32_t fmtIds[] = {0, 1, 0, numCounters};
+    for (uint32_t fmtId : fmtIds) {
+        UncompressedEntry *ue = push<UncompressedEntry>(in);
+        ue->entrySize = sizeof(UncompressedEntry);
+        ue->timestamp = 10*fmtId;
+        ue->fmtId = fmtId;
+    }
+
+    // Nothing is counted by default
+    std::vector<uint64_t> counters(numCounters, 0);
+    uint64_t numEventsCompressed = 0;
+    Encoder encoder(outBuffer, sizeof(outBuffer), true);
+    EXPECT_EQ(sizeof(UncompressedEntry), encoder.encodeLogMsgs(inBuffer,
+                sizeof(UncompressedEntry), 0, false, dictionary,
+                &numEventsCompressed));
+    EXPECT_EQ(0U, counters[0]);
+
+    // Every byte encoded besides the BufferExtent belongs to a log message
+    encoder.setCompressedBytesPerLogId(counters.data());
+    char *startPos = encoder.writePos;
+    EXPECT_EQ(in - inBuffer, encoder.encodeLogMsgs(inBuffer, in - inBuffer, 0,
+                                false, dictionary, &numEventsCompressed));
+    EXPECT_EQ(5U, numEventsCompressed);
+
+    EXPECT_EQ(2*sizeof(CompressedEntry) + 4, counters[0]);
+    EXPECT_LT(0U, counters[1]);
+    EXPECT_LT(0U, counters[numCounters - 1]);
+    EXPECT_EQ(encoder.writePos - startPos - sizeof(BufferExtent),
+              counters[0] + counters[1] + counters[numCounters - 1]);
+}
+
 TEST_F(LogTest, createMicroCode) {
     using namespace NanoLogInternal::Log;
     char backing_buffer[1024];
@@ -2829,6 +3807,68 @@ TEST_F(LogTest, createMicroCode_specifiersWithoutSpaces) {
     EXPECT_TRUE(pf->hasDynamicPrecision);
 }
 
+TEST_F(LogTest, compileFormat) {
+    using namespace NanoLogInternal::Log;
+    char backing_buffer[1024];
+    char *microCode = backing_buffer;
+    std::vector<FormatOp> ops;
+
+    EXPECT_TRUE(Decoder::createMicroCode(&microCode,
+                        "%% %*.4s %-+08.3lf %Lf %4.*ls %#x and %hhu%% done",
+                        "file", 4, 1));
+    Decoder::compileFormat(reinterpret_cast<FormatMetadata*>(backing_buffer),
+                           ops);
+    ASSERT_EQ(6U, ops.size());
+
+    EXPECT_EQ("% ", ops[0].literal);
+    EXPECT_EQ("%*.4s", ops[0].specifier);
+    EXPECT_EQ('s', ops[0].conversion);
+    EXPECT_TRUE(ops[0].dynamicWidth);
+    EXPECT_FALSE(ops[0].dynamicPrecision);
+    EXPECT_EQ(-1, ops[0].width);
+    EXPECT_EQ(4, ops[0].precision);
+    EXPECT_FALSE(ops[0].useSnprintf);
+
+    EXPECT_EQ(" ", ops[1].literal);
+    EXPECT_EQ('f', ops[1].conversion);
+    EXPECT_TRUE(ops[1].leftAlign);
+    EXPECT_TRUE(ops[1].forceSign);
+    EXPECT_TRUE(ops[1].zeroPad);
+    EXPECT_FALSE(ops[1].spaceSign);
+    EXPECT_FALSE(ops[1].alternateForm);
+    EXPECT_EQ(8, ops[1].width);
+    EXPECT_EQ(3, ops[1].precision);
+    EXPECT_FALSE(ops[1].useSnprintf);
+
+    EXPECT_EQ('f', ops[2].conversion);
+    EXPECT_FALSE(ops[2].useSnprintf);
+
+    // Wide strings are left to snprintf
+    EXPECT_EQ("%4.*ls", ops[3].specifier);
+    EXPECT_TRUE(ops[3].dynamicPrecision);
+    EXPECT_TRUE(ops[3].useSnprintf);
+
+    EXPECT_EQ('x', ops[4].conversion);
+    EXPECT_TRUE(ops[4].alternateForm);
+    EXPECT_FALSE(ops[4].useSnprintf);
+
+    EXPECT_EQ(" and ", ops[5].literal);
+    EXPECT_EQ('u', ops[5].conversion);
+    EXPECT_EQ("% done", ops[5].suffix);
+    EXPECT_FALSE(ops[5].useSnprintf);
+
+    // Fragments without specifiers are only literals
+    microCode = backing_buffer;
+    EXPECT_TRUE(Decoder::createMicroCode(&microCode, "100%% Nothing", "file",
+                                         4, 0));
+    Decoder::compileFormat(reinterpret_cast<FormatMetadata*>(backing_buffer),
+                           ops);
+    ASSERT_EQ(1U, ops.size());
+    EXPECT_EQ("100% Nothing", ops[0].literal);
+    EXPECT_EQ('\0', ops[0].conversion);
+    EXPECT_FALSE(ops[0].useSnprintf);
+}
+
 TEST_F(LogTest, readDictionaryFragment) {
     char testFile[] = "test.dic";
     char *buffer = static_cast<char*>(malloc(1024*1024));
@@ -3034,15 +4074,18 @@ TEST_F(LogTest, LogMessage_longDoubles) {
 
     EXPECT_TRUE(la.valid());
     EXPECT_EQ(1, la.get<int>(0));
-    EXPECT_EQ(-1, la.get<int>(1));
+    EXPECT_EQ(arg, la.get<long double>(1));
     EXPECT_EQ(2, la.get<int>(2));
 
-    // Check that we fail upon getting arg 2 as long double
-    testing::internal::CaptureStderr();
-    EXPECT_EQ(-1.0, la.get<long double>(1));
-    std::string errorMsg = testing::internal::GetCapturedStderr();
-    EXPECT_STREQ("**ERROR** Aggregating on Long Doubles is "
-                 "currently unsupported\r\n", errorMsg.c_str());
+    // The long doubles stay in place as more are pushed
+    const long double *first = la.get<const long double*>(1);
+    for (int i = 0; i < 1000; ++i)
+        la.push(static_cast<long double>(i));
+    EXPECT_EQ(first, la.get<const long double*>(1));
+    EXPECT_EQ(999.0L, la.get<long double>(1002));
+
+    la.reset(&fm);
+    EXPECT_EQ(0U, la.longDoubleArgs.size());
 }
 
 TEST_F(LogTest, LogMessage_reset) {
@@ -11,17 +11,64 @@ namespace NanoLog {
         return RuntimeLogger::getStats();
     }
 
+    void getMetrics(Metrics *metrics) {
+        RuntimeLogger::getMetrics(metrics);
+    }
+
+    uint32_t getThreadMetrics(ThreadMetrics *metrics, uint32_t maxThreads) {
+        return RuntimeLogger::getThreadMetrics(metrics, maxThreads);
+    }
+
+    uint32_t getLogSiteMetrics(LogSiteMetrics *metrics, uint32_t maxSites) {
+        return RuntimeLogger::getLogSiteMetrics(metrics, maxSites);
+    }
+
     void printConfig() {
         printf("==== NanoLog Configuration ====\r\n");
 
-        printf("StagingBuffer size: %u MB\r\n",
-               NanoLogConfig::STAGING_BUFFER_SIZE / 1000000);
+        printf("Compress Threads  : %u\r\n",
+               RuntimeLogger::getNumCompressionThreads());
+        printf("Output Backend    : %s\r\n",
+               RuntimeLogger::getOutputBackendName());
+        printf("Durability        : %s",
+               RuntimeLogger::getDurabilityName());
+        if (RuntimeLogger::getDurability() == DURABILITY_PERIODIC) {
+            printf(" (%u ms, %lu bytes)",
+                   RuntimeLogger::getSyncIntervalMs(),
+                   RuntimeLogger::getSyncIntervalBytes());
+        }
+        printf("\r\n");
+        printf("Delta Encoding    : %s\r\n",
+               RuntimeLogger::getDeltaEncoding() ? "on" : "off");
+        printf("Block Compression : %s\r\n",
+               RuntimeLogger::getBlockCompression() ? "on" : "off");
+        printf("Flight Recorder   : %s\r\n",
+               RuntimeLogger::getFlightRecorder() ? "on" : "off");
+        printf("Crash Handler     : %s\r\n",
+               *RuntimeLogger::getCrashLogFile()
+                       ? RuntimeLogger::getCrashLogFile() : "off");
+        printf("Log Rotation      : %lu bytes, %u seconds\r\n",
+               RuntimeLogger::getLogRotationMaxBytes(),
+               RuntimeLogger::getLogRotationMaxSeconds());
+        printf("Shared Memory Sink: %s\r\n",
+               *RuntimeLogger::getSharedMemorySinkName()
+                       ? RuntimeLogger::getSharedMemorySinkName() : "off");
+        printf("StagingBuffer size: %u KB\r\n",
+               RuntimeLogger::getStagingBufferSize() / 1000);
         printf("Output Buffer size: %u MB\r\n",
-               NanoLogConfig::OUTPUT_BUFFER_SIZE / 1000000);
+               RuntimeLogger::getOutputBufferSize() / 1000000);
+        printf("Output Buffers    : %u\r\n",
+               RuntimeLogger::getNumOutputBuffers());
+        printf("Huge Pages        : %s\r\n",
+               RuntimeLogger::getHugePagesName());
         printf("Release Threshold : %u MB\r\n",
                NanoLogConfig::RELEASE_THRESHOLD / 1000000);
         printf("Idle Poll Interval: %u µs\r\n",
                NanoLogConfig::POLL_INTERVAL_NO_WORK_US);
+        printf("Idle Spin Time    : %u µs\r\n",
+               NanoLogConfig::IDLE_SPIN_US);
+        printf("Idle Wait Timeout : %u µs\r\n",
+               NanoLogConfig::IDLE_WAIT_TIMEOUT_US);
         printf("IO Poll Interval  : %u µs\r\n",
                NanoLogConfig::POLL_INTERVAL_DURING_IO_US);
     }
@@ -30,10 +77,91 @@ namespace NanoLog {
         RuntimeLogger::preallocate();
     }
 
+    void preallocate(size_t bytes) {
+        RuntimeLogger::preallocate(bytes);
+    }
+
+    Batch::Batch(size_t bytesHint) {
+        RuntimeLogger::beginBatch(bytesHint);
+    }
+
+    Batch::~Batch() {
+        RuntimeLogger::endBatch();
+    }
+
+    void Batch::flush() {
+        RuntimeLogger::publishBatch();
+    }
+
+    void setStagingBufferSize(size_t bytes) {
+        RuntimeLogger::setStagingBufferSize(bytes);
+    }
+
+    void setAdaptiveStagingBufferLimit(size_t maxBytes) {
+        RuntimeLogger::setAdaptiveStagingBufferLimit(maxBytes);
+    }
+
+    void setDropOnFull(LogLevel level) {
+        RuntimeLogger::setDropOnFull(level);
+    }
+
+    void setFlightRecorder(bool enable) {
+        RuntimeLogger::setFlightRecorder(enable);
+    }
+
+    void installCrashHandler(const char *filename) {
+        RuntimeLogger::installCrashHandler(filename);
+    }
+
+    uint64_t crashFlush() {
+        return RuntimeLogger::crashFlush();
+    }
+
+    void setOutputBufferSize(size_t bytes) {
+        RuntimeLogger::setOutputBufferSize(bytes);
+    }
+
     void setLogFile(const char *filename) {
         RuntimeLogger::setLogFile(filename);
     }
 
+    void setCompressionThreads(uint32_t numThreads) {
+        RuntimeLogger::setCompressionThreads(numThreads);
+    }
+
+    void setNumOutputBuffers(uint32_t numBuffers) {
+        RuntimeLogger::setNumOutputBuffers(numBuffers);
+    }
+
+    void setOutputBackend(OutputBackendType type) {
+        RuntimeLogger::setOutputBackend(type);
+    }
+
+    void setHugePages(HugePageMode mode) {
+        RuntimeLogger::setHugePages(mode);
+    }
+
+    void setDeltaEncoding(bool enable) {
+        RuntimeLogger::setDeltaEncoding(enable);
+    }
+
+    void setDurability(DurabilityMode mode, uint32_t syncIntervalMs,
+                       uint64_t syncIntervalBytes) {
+        RuntimeLogger::setDurability(mode, syncIntervalMs, syncIntervalBytes);
+    }
+
+    void setBlockCompression(bool enable) {
+        RuntimeLogger::setBlockCompression(enable);
+    }
+
+    void setLogRotation(uint64_t maxBytes, uint32_t maxSeconds) {
+        RuntimeLogger::setLogRotation(maxBytes, maxSeconds);
+    }
+
+    void setSharedMemorySink(const char *name) {
+        RuntimeLogger::setSharedMemorySink(name);
+    }
+
     LogLevel getLogLevel() {
         return RuntimeLogger::getLogLevel();
     }
@@ -42,6 +170,45 @@ namespace NanoLog {
         RuntimeLogger::setLogLevel(logLevel);
     }
 
+    Channel createChannel(const char *name, const char *filename) {
+        return RuntimeLogger::createChannel(name, filename);
+    }
+
+    void setChannelDurability(Channel channel, DurabilityMode mode,
+                              uint32_t syncIntervalMs,
+                              uint64_t syncIntervalBytes) {
+        RuntimeLogger::setChannelDurability(channel, mode, syncIntervalMs,
+                                            syncIntervalBytes);
+    }
+
+    void setChannelLogLevel(Channel channel, LogLevel logLevel) {
+        RuntimeLogger::setChannelLogLevel(channel, logLevel);
+    }
+
+    LogLevel getChannelLogLevel(Channel channel) {
+        return RuntimeLogger::getLogLevel(channel);
+    }
+
+    void setChannelDropOnFull(Channel channel, LogLevel level) {
+        RuntimeLogger::setChannelDropOnFull(channel, level);
+    }
+
+    uint32_t setLogSiteEnabled(int fmtId, bool enabled) {
+        return RuntimeLogger::setLogSiteEnabled(fmtId, enabled);
+    }
+
+    uint32_t setLogSitesEnabledInFile(const char *filename, bool enabled) {
+        return RuntimeLogger::setLogSitesEnabledInFile(filename, enabled);
+    }
+
+    uint32_t setLogSitesEnabledContaining(const char *substring, bool enabled) {
+        return RuntimeLogger::setLogSitesEnabledContaining(substring, enabled);
+    }
+
+    void resetLogSites() {
+        RuntimeLogger::resetLogSites();
+    }
+
     void sync() {
         RuntimeLogger::sync();
     }
@@ -49,4 +216,12 @@ namespace NanoLog {
     int getCoreIdOfBackgroundThread() {
         return RuntimeLogger::getCoreIdOfBackgroundThread();
     }
+
+    void setBackgroundThreadAffinity(const std::vector<int> &coreIds) {
+        RuntimeLogger::setBackgroundThreadAffinity(coreIds);
+    }
+
+    void setBackgroundThreadScheduling(int policy, int priority) {
+        RuntimeLogger::setBackgroundThreadScheduling(policy, priority);
+    }
 };
\ No newline at end of file
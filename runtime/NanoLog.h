@@ -16,7 +16,10 @@
 #ifndef NANOLOG_H
 #define NANOLOG_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 /**
  * This header serves as the application and generated code interface into
@@ -60,6 +63,87 @@ namespace LogLevels {
 };
 using namespace LogLevels;
 
+/**
+ * The least severe LogLevel compiled into the application. NANO_LOG
+ * statements of a lower severity are removed at compile time, so they cost
+ * nothing at runtime and are never registered. It's overridden by defining
+ * the macro to a LogLevel when compiling the application (i.e.
+ * -DNANOLOG_MIN_LOG_LEVEL=NOTICE), and must be the same in every file.
+ */
+#ifndef NANOLOG_MIN_LOG_LEVEL
+#define NANOLOG_MIN_LOG_LEVEL DEBUG
+#endif
+
+// NANOLOG_MIN_LOG_LEVEL as a constant, for code that's compiled after the
+// macros are gone (i.e. the code injected by the preprocessor)
+constexpr LogLevel MIN_LOG_LEVEL = NANOLOG_MIN_LOG_LEVEL;
+
+/**
+ * Mechanisms the background compression thread(s) can use to asynchronously
+ * write the compressed log to disk (see setOutputBackend()).
+ */
+enum OutputBackendType {
+    // glibc's POSIX AIO library, which emulates asynchronous I/O with a pool
+    // of helper threads.
+    POSIX_AIO = 0,
+
+    // The Linux io_uring interface (default). Falls back to POSIX_AIO if the
+    // kernel does not support it.
+    IO_URING
+};
+
+/**
+ * Policies for when the background compression thread(s) make the compressed
+ * log durable on disk (see setDurability()).
+ */
+enum DurabilityMode {
+    // The log is written to the operating system's page cache and flushed to
+    // disk at the operating system's discretion.
+    DURABILITY_NONE = 0,
+
+    // The log is written to the page cache and flushed to disk with
+    // fdatasync() after a configurable amount of time or output.
+    DURABILITY_PERIODIC,
+
+    // Each write of an output buffer completes only once it's on disk
+    // (O_DSYNC). This is the default.
+    DURABILITY_PER_BUFFER,
+
+    // The log bypasses the page cache (O_DIRECT); writes are padded to
+    // NanoLogConfig::DIRECT_IO_ALIGNMENT bytes.
+    DURABILITY_DIRECT
+};
+
+/**
+ * Page sizes that can back the StagingBuffers and output buffers (see
+ * setHugePages()).
+ */
+enum HugePageMode {
+    // Regular pages (default)
+    HUGE_PAGES_NONE = 0,
+
+    // Transparent huge pages requested via madvise(MADV_HUGEPAGE), which the
+    // kernel backs the buffers with at its discretion
+    HUGE_PAGES_TRANSPARENT,
+
+    // Huge pages of 2 MB or 1 GB from the pool reserved by the administrator
+    // (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages). Fall back to
+    // HUGE_PAGES_TRANSPARENT if the pool is exhausted.
+    HUGE_PAGES_2MB,
+    HUGE_PAGES_1GB
+};
+
+/**
+ * Identifies a log channel, which is a log with its own output file,
+ * durability, log level and drop policy (see createChannel()). Log messages
+ * are routed to a channel with NANO_LOG_TO().
+ */
+typedef uint32_t Channel;
+
+// The channel of NANO_LOG(), which outputs to the log file (see setLogFile())
+// with the settings of the rest of this API
+static const Channel DEFAULT_CHANNEL = 0;
+
 // User API
 
 /**
@@ -70,6 +154,163 @@ using namespace LogLevels;
  */
 void preallocate();
 
+/**
+ * Preallocate the thread-local data structures for the current thread with a
+ * StagingBuffer of a specific size. Threads that log heavily can use a larger
+ * buffer to absorb bursts without blocking, while mostly idle threads can use
+ * a smaller one to save memory. If the thread already has a StagingBuffer of
+ * a different size, it is replaced once its pending log messages have been
+ * compressed.
+ *
+ * Log messages larger than the buffer will block the thread indefinitely.
+ *
+ * \param bytes
+ *      Size of the thread's StagingBuffer in bytes. The value is clamped to
+ *      be at least NanoLogConfig::MIN_STAGING_BUFFER_SIZE and at most the
+ *      output buffer size.
+ */
+void preallocate(size_t bytes);
+
+/**
+ * Groups the log messages that the current thread logs while the Batch is in
+ * scope. The log messages are appended to one reservation of bytesHint bytes
+ * in the thread's StagingBuffer and handed to the background compression
+ * thread together once the Batch goes out of scope (or the reservation is
+ * full), rather than one by one. This saves the per log message bookkeeping
+ * and fence of the StagingBuffer in loops that log many small messages in a
+ * burst (i.e. per network packet). Each log message keeps its own timestamp.
+ *
+ * Batches may be nested; only the outermost one publishes the log messages.
+ * The log messages are not visible to sync() until they're published, so
+ * batches should be kept short lived.
+ *
+ * Example:
+ *      for (Packet &p : packets) {
+ *          NanoLog::Batch batch(4096);
+ *          for (Order &o : p.orders)
+ *              NANO_LOG(NOTICE, "order %lu qty %d", o.id, o.qty);
+ *      }
+ */
+class Batch {
+public:
+    /**
+     * \param bytesHint
+     *      Number of bytes to reserve for the log messages up front; more
+     *      space is reserved as needed. It's capped at half the thread's
+     *      StagingBuffer size.
+     */
+    explicit Batch(size_t bytesHint);
+    ~Batch();
+
+    // Publishes the log messages logged in the Batch so far
+    void flush();
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+};
+
+/**
+ * Sets the size of the StagingBuffers allocated for threads that start to
+ * log after this call (default NanoLogConfig::STAGING_BUFFER_SIZE). Threads
+ * that have already allocated a StagingBuffer keep theirs.
+ *
+ * \param bytes
+ *      Default StagingBuffer size in bytes (see preallocate(size_t) for limits)
+ */
+void setStagingBufferSize(size_t bytes);
+
+/**
+ * Enables the adaptive StagingBuffer mode to absorb bursts of log messages
+ * (i.e. at startup or during error storms) without permanently paying for
+ * large buffers in every thread. In this mode, a thread's StagingBuffer is
+ * doubled in size whenever the thread has been blocked waiting on the
+ * background compression for too long, and is returned to its original size
+ * once the thread has not been blocked for a while (see
+ * NanoLogConfig::ADAPTIVE_GROWTH_BLOCKED_US and ADAPTIVE_SHRINK_QUIET_MS).
+ *
+ * \param maxBytes
+ *      Maximum size a thread's StagingBuffer may grow to (capped at the
+ *      output buffer size), or 0 to disable the adaptive mode (default).
+ */
+void setAdaptiveStagingBufferLimit(size_t maxBytes);
+
+/**
+ * Sets the LogLevel at which NANO_LOG drops log messages instead of blocking
+ * the logging thread when its StagingBuffer is full. Messages at the level or
+ * of lower severity (i.e. DEBUG for NOTICE) are dropped; the number dropped
+ * is reported in getStats() and by a "NanoLog dropped N log message(s)"
+ * message at the point of the gap in the log. By default, nothing is dropped.
+ * This only applies to the C++17 NANO_LOG.
+ *
+ * \param level
+ *      LogLevel at which messages are dropped; ERROR drops all messages and
+ *      NUM_LOG_LEVELS none.
+ */
+void setDropOnFull(LogLevel level);
+
+/**
+ * Switches NanoLog in or out of the flight recorder mode. In this mode, the
+ * background threads don't output the log; each thread's StagingBuffer acts
+ * as an in-memory ring that retains the thread's most recent log messages
+ * (at least the latest half of the buffer, see preallocate(size_t)) and the
+ * older ones are discarded without being compressed. sync() writes the
+ * retained log messages to the log file in the regular format, so that an
+ * application can log at full verbosity and only pay for I/O when something
+ * worth looking at happens. Switching the mode off outputs the retained log
+ * messages as usual. This function is thread safe and takes effect
+ * immediately.
+ *
+ * \param enable
+ *      True to retain the log messages until a sync(); false to output them
+ *      continuously (default)
+ */
+void setFlightRecorder(bool enable);
+
+/**
+ * Installs handlers for the fatal signals SIGSEGV, SIGBUS, SIGFPE, SIGILL and
+ * SIGABRT that dump the log messages the background threads haven't consumed
+ * yet (i.e. the last ones before the crash) to a crash log before the process
+ * dies; the signals are then passed on to the handlers installed before. The
+ * dump is a regular NanoLog log that the decompressor reads, and each crash
+ * appends one to the crash log. This should be invoked after the log file
+ * and output buffer size are configured. An exception will be thrown if the
+ * crash log cannot be opened/created.
+ *
+ * The dump is best effort: the log messages that were already compressed but
+ * not written out yet are not part of it, and it may repeat log messages that
+ * the background threads output while the dump was being written.
+ *
+ * \param filename
+ *      Crash log to append the dumps to; nullptr for the log file name with
+ *      ".crash" appended
+ */
+void installCrashHandler(const char *filename = nullptr);
+
+/**
+ * Performs the dump of installCrashHandler() on demand, so that applications
+ * with their own fatal signal handlers can invoke it from there. This function
+ * is async-signal-safe and does nothing if installCrashHandler() was not
+ * invoked.
+ *
+ * \return
+ *      Number of log messages dumped
+ */
+uint64_t crashFlush();
+
+/**
+ * Sets the size of each buffer used to stage the compressed log before it
+ * is output (default NanoLogConfig::OUTPUT_BUFFER_SIZE). Larger buffers
+ * amortize the I/O overhead at the cost of memory. The output buffers must
+ * not be smaller than any StagingBuffer. Like setLogFile(), this should be
+ * invoked before the first log message.
+ *
+ * \param bytes
+ *      Output buffer size in bytes. The value is clamped to
+ *      [NanoLogConfig::MIN_OUTPUT_BUFFER_SIZE,
+ *      NanoLogConfig::MAX_OUTPUT_BUFFER_SIZE].
+ */
+void setOutputBufferSize(size_t bytes);
+
 /**
  * Sets the file location for the NanoLog output. All NANO_LOG statements
  * invoked after this function returns are guaranteed to be in the new file
@@ -82,6 +323,161 @@ void preallocate();
  */
 void setLogFile(const char* filename);
 
+/**
+ * Sets the number of background threads that compress and output the log
+ * messages. Each thread handles a disjoint subset of the logging threads and
+ * writes to its own file: the first thread writes to the log file and the
+ * i-th additional thread writes to the log file name suffixed with ".i".
+ * Each file can be decompressed independently.
+ *
+ * Like setLogFile(), this should be invoked before the first log message.
+ * An exception will be thrown if the additional log files cannot be
+ * opened/created.
+ *
+ * \param numThreads
+ *      Number of compression threads to use (at least 1)
+ */
+void setCompressionThreads(uint32_t numThreads);
+
+/**
+ * Sets the number of output buffers (see setOutputBufferSize()) per
+ * compression thread. One buffer is compressed into while the
+ * others can be in flight to the disk, so a larger ring lets compression run
+ * further ahead of slow storage at the cost of memory. The default is two
+ * (double buffering). Like setLogFile(), this should be invoked before the
+ * first log message.
+ *
+ * \param numBuffers
+ *      Number of output buffers per compression thread (at least 2)
+ */
+void setNumOutputBuffers(uint32_t numBuffers);
+
+/**
+ * Selects the mechanism used to write out the compressed log. Like
+ * setLogFile(), this should be invoked before the first log message. By
+ * default, io_uring is used if the kernel supports it.
+ *
+ * \param type
+ *      Output backend to use
+ */
+void setOutputBackend(OutputBackendType type);
+
+/**
+ * Backs the StagingBuffers and the output buffers with huge pages, which
+ * spares the logging and compression threads the TLB misses of walking the
+ * buffers in 4 KB pages. Buffers smaller than half a huge page use
+ * transparent huge pages instead, so that at most half of each mapping is
+ * wasted. The StagingBuffers are faulted in when they're allocated (i.e. in
+ * preallocate()), so this should be invoked before the first log message;
+ * StagingBuffers that already exist keep their pages. Like setLogFile(), this
+ * is *not* thread safe.
+ *
+ * \param mode
+ *      Page size to back the buffers with (default HUGE_PAGES_NONE)
+ */
+void setHugePages(HugePageMode mode);
+
+/**
+ * Selects when the compressed log is made durable on disk. By default, every
+ * output buffer write waits for the disk (DURABILITY_PER_BUFFER), which caps
+ * the throughput of the compression threads at the disk's sync latency;
+ * DURABILITY_PERIODIC batches the flushes instead and DURABILITY_NONE leaves
+ * them to the operating system. Regardless of the mode, sync() returns once
+ * the log is durable, except with DURABILITY_NONE where it only waits for the
+ * log to be handed to the operating system. Like setLogFile(), this should
+ * be invoked before the first log message.
+ *
+ * \param mode
+ *      When to make the log durable
+ * \param syncIntervalMs
+ *      For DURABILITY_PERIODIC, flush the log after this many milliseconds;
+ *      0 for no time limit
+ * \param syncIntervalBytes
+ *      For DURABILITY_PERIODIC, flush the log after this many bytes of
+ *      output; 0 for no size limit. If both limits are 0,
+ *      NanoLogConfig::DEFAULT_SYNC_INTERVAL_MS is used.
+ */
+void setDurability(DurabilityMode mode, uint32_t syncIntervalMs = 0,
+                   uint64_t syncIntervalBytes = 0);
+
+/**
+ * Enables or disables the delta encoding of log message arguments. When it's
+ * enabled, integer arguments are stored as the difference from the value the
+ * same log statement logged previously and strings that repeat one of the
+ * log statement's last few strings are replaced by one-byte references. This
+ * shrinks the logs of sequence numbers, repeated identifiers and symbols at
+ * the cost of some compression time. Only the C++17 version of NanoLog
+ * supports it and it's disabled by default. Like setLogFile(), this should be
+ * invoked before the first log message.
+ *
+ * \param enable
+ *      True to delta encode the arguments; false to store them on their own
+ */
+void setDeltaEncoding(bool enable);
+
+/**
+ * Enables or disables the block compression of the log. When it's enabled,
+ * the background compression threads additionally compress each output
+ * buffer as a whole (in the LZ4 block format) before writing it out. This
+ * trades compression thread CPU time for less disk I/O, which pays off when
+ * the log arguments are repetitive (i.e. hostnames, symbols or long strings).
+ * The decompressor detects block compressed logs and decompresses them
+ * transparently, but they're not accompanied by an index for time range
+ * queries. It's disabled by default and like setLogFile(), this should be
+ * invoked before the first log message.
+ *
+ * \param enable
+ *      True to block compress the log; false to write it out as is
+ */
+void setBlockCompression(bool enable);
+
+/**
+ * Sets the policy for rotating the log files. Once a log file grows to
+ * maxBytes or has been logged to for maxSeconds, the background compression
+ * thread renames it (appending the local time of the rotation, i.e.
+ * "compressedLog.20200101-120000") and continues in a new file under the
+ * original name. Each file starts with its own dictionary, so the rotated
+ * files can be decompressed independently.
+ *
+ * The rotation happens in between output buffers, so logging threads are not
+ * held up by it the way they are by setLogFile(). As a consequence, files may
+ * exceed maxBytes by up to an output buffer and a file is only rotated past
+ * maxSeconds once there's more log to output. This may be invoked at any time;
+ * rotation is disabled by default.
+ *
+ * \param maxBytes
+ *      Size in bytes at which to rotate a log file; 0 for no size limit
+ * \param maxSeconds
+ *      Age in seconds at which to rotate a log file; 0 for no age limit
+ */
+void setLogRotation(uint64_t maxBytes, uint32_t maxSeconds);
+
+/**
+ * Hands the compression and output of the log off to another process (i.e.
+ * one running the "sidecar" built alongside the decompressor). The
+ * thread-local StagingBuffers are allocated in POSIX shared memory under the
+ * given name and the background compression threads are stopped, so the
+ * application only pays for staging its log messages. The sidecar maps the
+ * StagingBuffers, compresses them with the same generated code and writes the
+ * log file; it may run on a different core set (or cgroup) than the
+ * application and continues draining the StagingBuffers after the application
+ * exits. The other output settings (i.e. setLogFile()) have no effect with a
+ * shared memory sink and sync() doesn't wait for the sidecar.
+ *
+ * Only the Preprocessor version of NanoLog supports it, and it must be
+ * invoked before the first log message.
+ *
+ * \param name
+ *      Name of the POSIX shared memory objects (i.e. "nanolog" creates
+ *      "/dev/shm/nanolog" and "/dev/shm/nanolog.<i>" for each StagingBuffer)
+ *
+ * \throw logic_error
+ *      if invoked after the first log message or with the C++17 version
+ * \throw is_base::failure
+ *      if the shared memory cannot be created
+ */
+void setSharedMemorySink(const char *name);
+
 /**
  * Sets the minimum logging severity level in the system. All log statements
  * of a lower log severity will be dropped completely.
@@ -96,6 +492,160 @@ void setLogLevel(LogLevel logLevel);
  */
 LogLevel getLogLevel();
 
+/**
+ * Creates a log channel that outputs the log messages logged to it with
+ * NANO_LOG_TO() to a file of its own. Each channel has its own StagingBuffer
+ * in every logging thread and its own compression thread, so that a channel
+ * that must be durable (i.e. an audit log) doesn't slow down the high volume
+ * log messages of another channel and vice versa. The channel starts out
+ * with DURABILITY_PER_BUFFER, the log level NOTICE and never drops log
+ * messages; the other settings (i.e. setDeltaEncoding(), setLogRotation())
+ * are shared with the default log. The channel is not affected by the
+ * flight recorder. Channels exist until the application exits and there can
+ * be NanoLogConfig::MAX_LOG_CHANNELS of them, including the default one.
+ * This function is *not* thread safe and should be invoked before the
+ * channel is logged to; it only applies to the C++17 NANO_LOG.
+ *
+ * \param name
+ *      Name of the channel; creating a channel with the name of an existing
+ *      one returns the existing channel
+ * \param filename
+ *      File to output the channel's compressed log to; it shall be
+ *      different from the other channels' and the default log file
+ *
+ * \return
+ *      The channel to pass to NANO_LOG_TO()
+ *
+ * \throw logic_error
+ *      if there are too many channels
+ * \throw is_base::failure
+ *      if the file cannot be opened or created
+ */
+Channel createChannel(const char *name, const char *filename);
+
+/**
+ * Selects when a channel's log is made durable on disk; see setDurability().
+ * Like createChannel(), this function is *not* thread safe.
+ *
+ * \param channel
+ *      Channel returned by createChannel()
+ * \param mode
+ *      When to make the channel's log durable
+ * \param syncIntervalMs
+ *      For DURABILITY_PERIODIC, flush the log after this many milliseconds;
+ *      0 for no time limit
+ * \param syncIntervalBytes
+ *      For DURABILITY_PERIODIC, flush the log after this many bytes of
+ *      output; 0 for no size limit
+ *
+ * \throw logic_error
+ *      if the channel doesn't exist
+ * \throw is_base::failure
+ *      if the channel's log file cannot be reopened
+ */
+void setChannelDurability(Channel channel, DurabilityMode mode,
+                          uint32_t syncIntervalMs = 0,
+                          uint64_t syncIntervalBytes = 0);
+
+/**
+ * Sets the minimum severity of the log messages logged to a channel; see
+ * setLogLevel(). This function is thread safe.
+ *
+ * \param channel
+ *      Channel returned by createChannel()
+ * \param logLevel
+ *      New log level of the channel
+ *
+ * \throw logic_error
+ *      if the channel doesn't exist
+ */
+void setChannelLogLevel(Channel channel, LogLevel logLevel);
+
+/**
+ * Returns the minimum severity of the log messages logged to a channel, or
+ * the log level of the default log for the DEFAULT_CHANNEL and the channels
+ * that don't exist.
+ *
+ * \param channel
+ *      Channel returned by createChannel()
+ */
+LogLevel getChannelLogLevel(Channel channel);
+
+/**
+ * Sets the LogLevel at which the log messages logged to a channel are
+ * dropped instead of blocking the logging thread when the thread's
+ * StagingBuffer of the channel is full; see setDropOnFull(). This function
+ * is thread safe.
+ *
+ * \param channel
+ *      Channel returned by createChannel()
+ * \param level
+ *      LogLevel at which messages are dropped; ERROR drops all messages and
+ *      NUM_LOG_LEVELS none.
+ *
+ * \throw logic_error
+ *      if the channel doesn't exist
+ */
+void setChannelDropOnFull(Channel channel, LogLevel level);
+
+/**
+ * Enables or disables a single log invocation site regardless of the log
+ * level (see setLogLevel()). This allows DEBUG log statements to be switched
+ * on selectively during an incident while the rest stay off. Sites are
+ * identified by the format id they're logged with, as listed by the
+ * decompressor. This only applies to the C++17 NANO_LOG, the sites of which
+ * are assigned an id when they're first executed.
+ *
+ * \param fmtId
+ *      Format id of the log invocation site
+ * \param enabled
+ *      true to always log the site, false to never log it
+ *
+ * \return
+ *      Number of log invocation sites affected (0 or 1)
+ */
+uint32_t setLogSiteEnabled(int fmtId, bool enabled);
+
+/**
+ * Enables or disables all log invocation sites in a file regardless of the
+ * log level. Like the other log site settings, this also applies to the
+ * sites that haven't been executed yet and later settings take precedence
+ * over earlier ones. This only applies to the C++17 NANO_LOG.
+ *
+ * \param filename
+ *      Name of the file as passed to the compiler, or a suffix of it that
+ *      starts after a '/' (i.e. "Server.cc" for "src/Server.cc")
+ * \param enabled
+ *      true to always log the sites, false to never log them
+ *
+ * \return
+ *      Number of log invocation sites executed so far that were affected
+ */
+uint32_t setLogSitesEnabledInFile(const char *filename, bool enabled);
+
+/**
+ * Enables or disables all log invocation sites whose format string contains
+ * a substring regardless of the log level, matching the sites the
+ * decompressor's find command would list. This only applies to the C++17
+ * NANO_LOG.
+ *
+ * \param substring
+ *      Substring of the format strings to match
+ * \param enabled
+ *      true to always log the sites, false to never log them
+ *
+ * \return
+ *      Number of log invocation sites executed so far that were affected
+ */
+uint32_t setLogSitesEnabledContaining(const char *substring, bool enabled);
+
+/**
+ * Discards the settings of setLogSiteEnabled(), setLogSitesEnabledInFile()
+ * and setLogSitesEnabledContaining(), i.e. all log invocation sites follow
+ * the log level again.
+ */
+void resetLogSites();
+
 /**
  * Waits until all pending log statements are persisted to disk. Note that if
  * there is another logging thread continually adding new pending log
@@ -114,6 +664,164 @@ void sync();
  */
 std::string getStats();
 
+/**
+ * Snapshot of the NanoLog system's metrics summed over the compression
+ * threads (see getMetrics()). The counters are cumulative since the threads
+ * were started (i.e. they restart after setCompressionThreads()) and times are
+ * in nanoseconds, so rates can be derived from the difference between two
+ * snapshots.
+ */
+struct Metrics {
+    // Number of buckets in the latency distributions. Bucket 0 counts the
+    // operations that took less than 1 µs and bucket i > 0 the ones that took
+    // [2^(i-1), 2^i) µs; the last bucket also counts everything longer.
+    static constexpr uint32_t NUM_LATENCY_BUCKETS = 24;
+
+    // Number of compression threads and of the StagingBuffers they consume
+    uint32_t numCompressionThreads;
+    uint32_t numStagingBuffers;
+
+    // Log messages compressed and outputted, bytes consumed from the
+    // StagingBuffers and bytes written to the log file (including padding)
+    uint64_t logsProcessed;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t padBytesWritten;
+
+    // Log messages discarded unread by the flight recorder (see
+    // setFlightRecorder())
+    uint64_t logsDiscarded;
+
+    // Producer side: log statements made, log messages dropped (see
+    // setDropOnFull()) and the number of times and time the logging threads
+    // waited on a full StagingBuffer
+    uint64_t allocations;
+    uint64_t droppedMessages;
+    uint64_t producerWaits;
+    uint64_t producerWaitNs;
+
+    // Time the compression threads were awake, compressing, blocked on a full
+    // output buffer ring and waiting for work
+    uint64_t activeNs;
+    uint64_t compressingNs;
+    uint64_t outputRingStalls;
+    uint64_t outputRingStalledNs;
+    uint64_t idleWaits;
+    uint64_t idleWaitNs;
+
+    // Output writes completed and currently in flight, out of at most
+    // writeQueueDepth in flight, and the latency distribution of the writes
+    uint64_t writesCompleted;
+    uint32_t writesInFlight;
+    uint32_t writeQueueDepth;
+    uint64_t writeLatencyDist[NUM_LATENCY_BUCKETS];
+
+    // Flushes of the log file in the DURABILITY_PERIODIC mode, their total
+    // time and latency distribution, and the number of log file rotations
+    uint64_t syncs;
+    uint64_t syncNs;
+    uint64_t syncLatencyDist[NUM_LATENCY_BUCKETS];
+    uint64_t rotations;
+
+    // Distribution of the amount of data found in a StagingBuffer per visit
+    // in 5% increments of its capacity and of the fraction of the output
+    // buffer ring in flight in 10% increments (see getHistograms())
+    uint64_t stagingBufferPeekDist[20];
+    uint64_t outputRingOccupancyDist[10];
+};
+
+/**
+ * Metrics of a logging thread's StagingBuffer (see getThreadMetrics()). The
+ * counters restart when the StagingBuffer is replaced (i.e. resized).
+ */
+struct ThreadMetrics {
+    // Identifies the StagingBuffer in the log and getHistograms()
+    uint32_t id;
+
+    // Size of the StagingBuffer in bytes
+    uint32_t capacity;
+
+    // Log statements made, log messages dropped and the number of times and
+    // time the thread waited for the compression to free up space
+    uint64_t allocations;
+    uint64_t droppedMessages;
+    uint64_t waits;
+    uint64_t waitNs;
+};
+
+/**
+ * Costs of a log invocation site (see getLogSiteMetrics())
+ */
+struct LogSiteMetrics {
+    // Log identifier of the invocation site; UINT32_MAX for the sites
+    // counted together past NanoLogConfig::MAX_LOG_SITE_STATS
+    uint32_t logId;
+
+    // Location and format string of the invocation site; empty if unknown
+    const char *filename;
+    uint32_t line;
+    const char *format;
+
+    // Log messages staged and the bytes they took up in the StagingBuffers
+    uint64_t invocations;
+    uint64_t bytesStaged;
+
+    // Time spent reserving space for the log messages in the StagingBuffers
+    // (including the time blocked on a full StagingBuffer) and publishing
+    // them to the compression threads
+    uint64_t reserveNs;
+    uint64_t finishNs;
+
+    // Bytes of compressed log output
+    uint64_t compressedBytes;
+};
+
+/**
+ * Fills in a snapshot of the NanoLog system's metrics. Unlike getStats(),
+ * this neither formats strings nor waits for the log to be persisted, so it's
+ * cheap enough to be polled by a metrics exporter. The counters are read
+ * without stopping the compression, so they may be off by the work in
+ * progress. This function is thread safe.
+ *
+ * \param[out] metrics
+ *      Snapshot to fill in
+ */
+void getMetrics(Metrics *metrics);
+
+/**
+ * Fills in the metrics of the logging threads' StagingBuffers; see
+ * getMetrics(). This function is thread safe.
+ *
+ * \param[out] metrics
+ *      Array to fill in
+ * \param maxThreads
+ *      Number of entries in the array
+ *
+ * \return
+ *      Number of StagingBuffers, which may exceed maxThreads; only the first
+ *      maxThreads are filled in then.
+ */
+uint32_t getThreadMetrics(ThreadMetrics *metrics, uint32_t maxThreads);
+
+/**
+ * Fills in the costs of the log invocation sites, ordered by the bytes their
+ * log messages took up in the StagingBuffers (the "top talkers") first. The
+ * costs are only recorded if NanoLog is compiled with -DRECORD_LOG_SITE_STATS;
+ * the producer-side ones additionally require the log statements to be
+ * compiled with it, as it adds a few timestamp reads to each of them. This
+ * function is thread safe.
+ *
+ * \param[out] metrics
+ *      Array to fill in
+ * \param maxSites
+ *      Number of entries in the array
+ *
+ * \return
+ *      Number of log invocation sites that logged, which may exceed maxSites;
+ *      only the first maxSites are filled in then.
+ */
+uint32_t getLogSiteMetrics(LogSiteMetrics *metrics, uint32_t maxSites);
+
 /**
  * Prints the configuration parameters being used by NanoLog to stdout. This is
  * primarily used to keep track of configurations for benchmarking.
@@ -125,6 +833,86 @@ void printConfig();
  */
 int getCoreIdOfBackgroundThread();
 
+/**
+ * Pins the background compression threads to a set of cores. With multiple
+ * compression threads (see setCompressionThreads()), the i-th thread is
+ * pinned to coreIds[i % coreIds.size()]. Placing them on the same socket as
+ * the logging threads avoids moving every StagingBuffer cache line across the
+ * interconnect. This function is thread safe and takes effect immediately.
+ *
+ * \param coreIds
+ *      Cores to pin the threads to; an empty vector restores the affinity
+ *      the process started with (default).
+ */
+void setBackgroundThreadAffinity(const std::vector<int> &coreIds);
+
+/**
+ * Sets the scheduling policy and priority of the background compression
+ * threads (see sched_setscheduler(2)). Realtime policies typically require
+ * CAP_SYS_NICE; failures are reported to stderr and leave the threads
+ * unchanged. This function is thread safe and takes effect immediately.
+ *
+ * \param policy
+ *      SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR
+ * \param priority
+ *      Static priority for the realtime policies; must be 0 otherwise
+ */
+void setBackgroundThreadScheduling(int policy, int priority);
+
+/**
+ * Extension point for logging arguments of user-defined types with the C++17
+ * NANO_LOG(). A trivially copyable type T becomes loggable with a "%s"
+ * specifier by specializing this template with a
+ *
+ *      static constexpr const char *name;
+ *      static void format(const T &value, std::string &out);
+ *
+ * where name identifies the type in the log's dictionary and format()
+ * appends the human-readable form of a value to out. The logging thread
+ * copies the argument's bytes as is, which costs no more than logging an
+ * integer, and format() runs in the decompressor once the type has been
+ * registered with Log::Decoder::registerSerializer<T>(). Decompressors that
+ * don't know the type print its bytes in hexadecimal instead.
+ *
+ * Example:
+ *      struct Price { int64_t mantissa; int8_t exponent; };
+ *
+ *      template<>
+ *      struct NanoLog::Serializer<Price> {
+ *          static constexpr const char *name = "Price";
+ *          static void format(const Price &price, std::string &out);
+ *      };
+ *
+ *      NANO_LOG(NOTICE, "Filled at %s", price);
+ *
+ * \tparam T
+ *      Type of the log argument
+ */
+template<typename T>
+struct Serializer {};
+
+/**
+ * Marks a string argument of the C++17 NANO_LOG() that stays valid and
+ * unchanged for the rest of the execution (i.e. a string literal or an entry
+ * of a static table), which is logged with "%s" like any other string. The
+ * logging thread records only the string's address, so logging it costs as
+ * much as logging an integer regardless of its length. The background thread
+ * copies the string into the log's dictionary the first time it encounters
+ * it, and the log messages refer to it by an identifier from then on.
+ *
+ * Example:
+ *      static const char *states[] = {"IDLE", "RUNNING", "STOPPED"};
+ *      NANO_LOG(NOTICE, "Entered %s", NanoLog::StaticStr(states[state]));
+ */
+struct StaticStr {
+    explicit constexpr StaticStr(const char *str)
+        : str(str)
+    {}
+
+    // The string logged
+    const char *str;
+};
+
 }; // namespace NanoLog
 
 
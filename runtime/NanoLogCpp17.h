@@ -19,6 +19,8 @@
 #include <cstring>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
 #include <utility>
 
@@ -491,6 +493,83 @@ store_arguments(const std::array<ParamType, N>&,
     // No arguments, do nothing.
 }
 
+/**
+ * Indicates whether a log argument of type T may be stored as a string, i.e.
+ * whether its size is only known at runtime.
+ *
+ * \tparam T
+ *      Type of the log argument
+ */
+template<typename T>
+struct isStringArg : std::integral_constant<bool,
+                            std::is_same<T, const wchar_t*>::value
+                            || std::is_same<T, const char*>::value
+                            || std::is_same<T, wchar_t*>::value
+                            || std::is_same<T, char*>::value> {};
+
+/**
+ * Indicates whether a log argument has a user-defined type with a
+ * NanoLog::Serializer specialization. Such arguments are stored full-width
+ * like integers, but are placed with the strings in the compressed log since
+ * their size is only known to the decompressor at runtime.
+ *
+ * \tparam T
+ *      Type of the log argument
+ */
+template<typename T, typename = void>
+struct isSerializedArg : std::false_type {};
+
+template<typename T>
+struct isSerializedArg<T, std::void_t<decltype(NanoLog::Serializer<T>::name)>>
+        : std::true_type {};
+
+/**
+ * Indicates whether a log argument is a string logged via NanoLog::StaticStr.
+ * Such arguments are stored full-width (i.e. the string's address) and are
+ * compressed to the identifier of the string in the log's dictionary.
+ *
+ * \tparam T
+ *      Type of the log argument
+ */
+template<typename T>
+struct isStaticStrArg : std::is_same<T, NanoLog::StaticStr> {};
+
+/**
+ * Indicates whether all the arguments of a log message are stored full-width,
+ * in which case the size of the uncompressed log message is known at
+ * compile-time and the arguments can be stored without consulting the
+ * format string (see log()).
+ *
+ * \tparam Ts
+ *      Types of the log arguments
+ */
+template<typename... Ts>
+struct hasFixedSizeArgs : std::integral_constant<bool,
+                                    !(isStringArg<Ts>::value || ...)> {};
+
+/**
+ * Stores a log message's arguments back to back and full-width; this is the
+ * equivalent of store_arguments() for arguments that satisfy
+ * hasFixedSizeArgs. The sizes and offsets are all known at compile time, so
+ * this reduces to a fixed sequence of stores.
+ *
+ * \tparam Ts
+ *      Types of the log arguments (automatically deduced)
+ *
+ * \param storage
+ *      Buffer of at least (sizeof(Ts) + ...) bytes to store the arguments to
+ * \param args
+ *      Arguments to store
+ */
+template<typename... Ts>
+inline void
+store_fixed_arguments(char *storage, Ts... args)
+{
+    static_assert(hasFixedSizeArgs<Ts...>::value,
+                  "Strings must be stored with store_arguments()");
+    ((std::memcpy(storage, &args, sizeof(Ts)), storage += sizeof(Ts)), ...);
+}
+
 /**
  * Special templated function that takes in an argument T and attempts to
  * convert it to a uint64_t. If the type T is incompatible, than a value
@@ -720,6 +799,99 @@ getArgSizes(const std::array<ParamType, N>&, uint64_t &, size_t (&)[M])
     return 0;
 }
 
+/**
+ * Returns the width of a character of a string argument of type T in the
+ * compressed log, i.e. the width of its null terminator.
+ */
+template<typename T>
+constexpr uint32_t
+getCharacterWidth()
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-arith"
+    if constexpr(std::is_same_v<std::decay_t<std::remove_pointer_t<T>>, void>)
+        return sizeof(void *);
+    else
+        return sizeof(typename std::remove_pointer<T>::type);
+#pragma GCC diagnostic pop
+}
+
+/**
+ * Equivalent of compressSingle() for an argument of a user-defined type (see
+ * isSerializedArg): its bytes are stored as is with the strings and its size
+ * is stored with the non-strings, without delta encoding.
+ *
+ * \tparam T
+ *      Type of the argument
+ *
+ * \param[in/out] nibbles
+ *      Preallocated location for nibbles (used for the argument's size)
+ * \param[in/out] nibbleCnt
+ *      Number of nibbles used so far
+ * \param stringsOnly
+ *      Indicates that the compression function is storing strings only
+ * \param[in/out] in
+ *      Input buffer to read the argument back from
+ * \param[in/out] out
+ *      Output buffer to write the compressed results to
+ */
+template<typename T>
+inline void
+compressSerialized(BufferUtils::TwoNibbles* nibbles,
+                   int *nibbleCnt,
+                   bool stringsOnly,
+                   char **in,
+                   char **out)
+{
+    if (stringsOnly) {
+        std::memcpy(*out, *in, sizeof(T));
+        *out += sizeof(T);
+    } else {
+        BufferUtils::setNibble(nibbles, *nibbleCnt, BufferUtils::pack(out,
+                                        static_cast<uint32_t>(sizeof(T))));
+        ++(*nibbleCnt);
+    }
+
+    *in += sizeof(T);
+}
+
+/**
+ * Equivalent of compressSingle() for a string logged via NanoLog::StaticStr:
+ * the string's identifier is stored with the non-strings, without delta
+ * encoding.
+ *
+ * \param[in/out] nibbles
+ *      Preallocated location for nibbles (used for the identifier)
+ * \param[in/out] nibbleCnt
+ *      Number of nibbles used so far
+ * \param stringsOnly
+ *      Indicates that the compression function is storing strings only
+ * \param[in/out] in
+ *      Input buffer to read the argument back from
+ * \param[in/out] out
+ *      Output buffer to write the compressed results to
+ * \param staticStrings
+ *      Assigns the identifiers of the static strings
+ */
+inline void
+compressStaticStr(BufferUtils::TwoNibbles* nibbles,
+                  int *nibbleCnt,
+                  bool stringsOnly,
+                  char **in,
+                  char **out,
+                  BufferUtils::StaticStringTable *staticStrings)
+{
+    if (!stringsOnly) {
+        NanoLog::StaticStr arg(nullptr);
+        std::memcpy(&arg, *in, sizeof(NanoLog::StaticStr));
+        BufferUtils::setNibble(nibbles, *nibbleCnt, BufferUtils::pack(out,
+                                            staticStrings->getId(arg.str)));
+        ++(*nibbleCnt);
+    }
+
+    *in += sizeof(NanoLog::StaticStr);
+}
+
 /**
  * Takes a single argument and compresses into a format that's compatible with
  * the NanoLog Decompressor.
@@ -740,6 +912,9 @@ getArgSizes(const std::array<ParamType, N>&, uint64_t &, size_t (&)[M])
  *      Input buffer to read the arguments back from
  * \param[in/out out
  *      Output buffer to write the compressed results to
+ * \param history
+ *      The log site's previous arguments to delta encode the argument against,
+ *      or nullptr to store it on its own (see BufferUtils::ArgumentHistory)
  */
 template<typename T>
 inline void
@@ -748,7 +923,8 @@ compressSingle(BufferUtils::TwoNibbles* nibbles,
                 const ParamType paramType,
                 bool stringsOnly,
                 char **in,
-                char **out)
+                char **out,
+                BufferUtils::ArgumentHistory *history = nullptr)
 {
     if (paramType > ParamType::NON_STRING) {
         uint32_t stringBytes;
@@ -765,6 +941,17 @@ compressSingle(BufferUtils::TwoNibbles* nibbles,
         printf("\tCString [%p->%p-%u]\r\n", *in, *out, stringBytes);
 #endif
 
+        if (history) {
+            uint8_t tag = history->encodeString(*in, stringBytes);
+            **out = static_cast<char>(tag);
+            ++(*out);
+
+            if (tag != 0) {
+                *in += stringBytes;
+                return;
+            }
+        }
+
         memcpy(*out, *in, stringBytes);
         *in += stringBytes;
         *out += stringBytes;
@@ -773,20 +960,7 @@ compressSingle(BufferUtils::TwoNibbles* nibbles,
         // save space. The length was explicitly encoded previously in the
         // uncompressed format to allow the two-pass compression function
         // to quickly skip strings in the stringsOnly=false pass.
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wpointer-arith"
-        constexpr uint32_t characterWidth = [](){
-            if constexpr(std::is_same_v<std::decay_t<std::remove_pointer_t<T>>, void>)
-            {
-                return sizeof(void *);
-            }
-            else
-            {
-                return sizeof(typename std::remove_pointer<T>::type);
-            }
-        }();
-#pragma GCC diagnostic pop
-
+        constexpr uint32_t characterWidth = getCharacterWidth<T>();
         bzero(*out, characterWidth);
         *out += characterWidth;
         return;
@@ -805,10 +979,27 @@ compressSingle(BufferUtils::TwoNibbles* nibbles,
     printf("\tCBasic  [%p->%p]= ", *in, *out);
     std::cout << argument << "\r\n";
 #endif
-    if (*nibbleCnt & 0x1)
-        nibbles[*nibbleCnt/2].second = 0xf & BufferUtils::pack(out, argument);
-    else
-        nibbles[*nibbleCnt/2].first = 0xf & BufferUtils::pack(out, argument);
+    // The decoder delta decodes every argument that's not floating point
+    if constexpr (!std::is_floating_point<T>::value) {
+        if (history) {
+            uint64_t value;
+            if constexpr (std::is_pointer<T>::value)
+                value = reinterpret_cast<uintptr_t>(argument);
+            else
+                value = static_cast<uint64_t>(
+                                            static_cast<int64_t>(argument));
+
+            int64_t delta = static_cast<int64_t>(
+                                history->encodeInteger(*nibbleCnt, value));
+            BufferUtils::setNibble(nibbles, *nibbleCnt,
+                                   BufferUtils::pack(out, delta));
+            ++(*nibbleCnt);
+            *in += sizeof(T);
+            return;
+        }
+    }
+
+    BufferUtils::setNibble(nibbles, *nibbleCnt, BufferUtils::pack(out, argument));
 
     ++(*nibbleCnt);
     *in += sizeof(T);
@@ -854,6 +1045,10 @@ void compress_internal(BufferUtils::TwoNibbles*, int,
  *      Input buffer to read the arguments back from
  * \param[in/out out
  *      Output buffer to write the compressed results to
+ * \param history
+ *      The log site's previous arguments to delta encode against, or nullptr
+ * \param staticStrings
+ *      Assigns the identifiers of the static strings
  */
 template<typename T1, typename... Ts>
 NANOLOG_ALWAYS_INLINE
@@ -863,13 +1058,21 @@ void compressHelper(BufferUtils::TwoNibbles *nibbles,
                     bool stringsOnly,
                     int argNum,
                     char **in,
-                    char **out)
+                    char **out,
+                    BufferUtils::ArgumentHistory *history,
+                    BufferUtils::StaticStringTable *staticStrings)
 {
     // Peel off the first argument, and recursively process the rest
-    compressSingle<T1>(nibbles, &nibbleCnt, paramTypes[argNum], stringsOnly,
-                       in, out);
+    if constexpr (isSerializedArg<T1>::value)
+        compressSerialized<T1>(nibbles, &nibbleCnt, stringsOnly, in, out);
+    else if constexpr (isStaticStrArg<T1>::value)
+        compressStaticStr(nibbles, &nibbleCnt, stringsOnly, in, out,
+                          staticStrings);
+    else
+        compressSingle<T1>(nibbles, &nibbleCnt, paramTypes[argNum],
+                           stringsOnly, in, out, history);
     compress_internal<Ts...>(nibbles, nibbleCnt, paramTypes, stringsOnly,
-                                argNum + 1, in, out);
+                                argNum + 1, in, out, history, staticStrings);
 }
 
 
@@ -877,17 +1080,21 @@ template<typename... Ts>
 NANOLOG_ALWAYS_INLINE 
 void compress_internal(BufferUtils::TwoNibbles *nibbles, int nibbleCnt,
                        const ParamType *isArgString, bool stringsOnly, int argNum,
-                       char **in, char **out)
+                       char **in, char **out,
+                       BufferUtils::ArgumentHistory *history = nullptr,
+                       BufferUtils::StaticStringTable *staticStrings = nullptr)
 {
     compressHelper<Ts...>(nibbles, nibbleCnt, isArgString, stringsOnly,
-                                argNum, in, out);
+                                argNum, in, out, history, staticStrings);
 }
 
 template<>
 NANOLOG_ALWAYS_INLINE 
 void compress_internal(BufferUtils::TwoNibbles *nibbles, int nibbleCnt,
                        const ParamType *isArgString, bool stringsOnly, int argNum,
-                       char **in, char **out)
+                       char **in, char **out,
+                       BufferUtils::ArgumentHistory *history,
+                       BufferUtils::StaticStringTable *staticStrings)
 {
     // This is a catch for compress when the template arguments are empty,
     // in which case we do nothing. This is needed since the head/tail pack
@@ -914,10 +1121,19 @@ void compress_internal(BufferUtils::TwoNibbles *nibbles, int nibbleCnt,
  *      Input buffer to read the arguments back from
  * \param[in/out out
  *      Output buffer to write the compressed results to
+ * \param history
+ *      The log site's previous arguments to delta encode the arguments
+ *      against, or nullptr to store them on their own (see
+ *      BufferUtils::ArgumentHistory)
+ * \param staticStrings
+ *      Assigns the identifiers of the strings logged via NanoLog::StaticStr
+ *      (only needed if there are any)
  */
 template<typename... Ts>
 inline void
-compress(int numNibbles, const ParamType *paramTypes, char **input, char **output) {
+compress(int numNibbles, const ParamType *paramTypes, char **input, char **output,
+         BufferUtils::ArgumentHistory *history = nullptr,
+         BufferUtils::StaticStringTable *staticStrings = nullptr) {
     char *in = *input;
     char *out = *output;
 
@@ -943,29 +1159,378 @@ compress(int numNibbles, const ParamType *paramTypes, char **input, char **outpu
     // down the operation. My suspicion is that the compiler can more
     // aggressively optimize the compress_internal functions when it KNOWS
     // it has exclusive access to the indirection pointers.
-    compress_internal<Ts...>(nibbles, 0, paramTypes, false, 0,  &in, &out);
+    compress_internal<Ts...>(nibbles, 0, paramTypes, false, 0,  &in, &out,
+                             history, staticStrings);
     in = *input;
 
     // We make two passes through the arguments, once processing only the
     // non-string types and a second processing only strings. This produces
     // an encoding that keeps all the nibbles closely packed together and
     // is compatible with the legacy pre-processor based NanoLog system.
-    compress_internal<Ts...>(nibbles, 0, paramTypes, true, 0,  &in, &out);
+    compress_internal<Ts...>(nibbles, 0, paramTypes, true, 0,  &in, &out,
+                             history, staticStrings);
     *input = in;
     *output = out;
 }
 
 /**
- * Logs a log message in the NanoLog system given all the static and dynamic
- * information associated with the log message. This function is meant to work
- * in conjunction with the #define-d NANO_LOG() and expects the caller to
- * maintain a permanent mapping of logId to static information once it's
- * assigned by this function.
+ * Returns a bit mask of the arguments that are strings according to the
+ * format string, i.e. bit i is set if the i-th argument is a string. Only the
+ * first 64 arguments are covered.
+ *
+ * \param paramTypes
+ *      Types of the format parameters (see analyzeFormatString())
+ */
+template<size_t N>
+constexpr uint64_t
+getStringArgMask(const std::array<ParamType, N> &paramTypes)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < N && i < 64; ++i) {
+        if (paramTypes[i] > ParamType::NON_STRING)
+            mask |= uint64_t(1) << i;
+    }
+
+    return mask;
+}
+
+/**
+ * First pass of compressArgs(); packs a non-string argument or remembers
+ * where a string argument is so that it can be stored after all the
+ * non-string arguments in the second pass.
+ *
+ * \tparam IsString
+ *      Indicates that the argument is a string according to the format
+ * \tparam DeltaEncoded
+ *      Indicates that the argument is delta encoded against history
+ * \tparam T
+ *      Type of the argument
+ *
+ * \param nibbles
+ *      Nibbles of the compressed log message
+ * \param[in/out] nibbleCnt
+ *      Number of nibbles used so far
+ * \param[out] strings
+ *      Positions of the string arguments in the input buffer
+ * \param[in/out] stringCnt
+ *      Number of string arguments encountered so far
+ * \param[in/out] in
+ *      Input buffer to read the argument from
+ * \param[in/out] out
+ *      Output buffer to write the compressed argument to
+ * \param history
+ *      The log site's previous arguments (if DeltaEncoded)
+ * \param staticStrings
+ *      Assigns the identifiers of the static strings
+ */
+template<bool IsString, bool DeltaEncoded, typename T>
+NANOLOG_ALWAYS_INLINE void
+compressArgsFirstPass(BufferUtils::TwoNibbles *nibbles,
+                      int *nibbleCnt,
+                      char **strings,
+                      int *stringCnt,
+                      char **in,
+                      char **out,
+                      BufferUtils::ArgumentHistory *history,
+                      BufferUtils::StaticStringTable *staticStrings)
+{
+    if constexpr (isStaticStrArg<T>::value) {
+        compressStaticStr(nibbles, nibbleCnt, false, in, out, staticStrings);
+    } else if constexpr (isSerializedArg<T>::value) {
+        BufferUtils::setNibble(nibbles, *nibbleCnt, BufferUtils::pack(out,
+                                        static_cast<uint32_t>(sizeof(T))));
+        ++(*nibbleCnt);
+        strings[(*stringCnt)++] = *in;
+        *in += sizeof(T);
+    } else if constexpr (IsString) {
+        uint32_t stringBytes;
+        std::memcpy(&stringBytes, *in, sizeof(uint32_t));
+        strings[(*stringCnt)++] = *in;
+        *in += sizeof(uint32_t) + stringBytes;
+    } else {
+        T argument;
+        std::memcpy(&argument, *in, sizeof(T));
+        *in += sizeof(T);
+
+        // The decoder delta decodes every argument that's not floating point
+        if constexpr (DeltaEncoded && !std::is_floating_point<T>::value) {
+            uint64_t value;
+            if constexpr (std::is_pointer<T>::value)
+                value = reinterpret_cast<uintptr_t>(argument);
+            else
+                value = static_cast<uint64_t>(
+                                            static_cast<int64_t>(argument));
+
+            int64_t delta = static_cast<int64_t>(
+                                history->encodeInteger(*nibbleCnt, value));
+            BufferUtils::setNibble(nibbles, *nibbleCnt,
+                                   BufferUtils::pack(out, delta));
+        } else {
+            BufferUtils::setNibble(nibbles, *nibbleCnt,
+                                   BufferUtils::pack(out, argument));
+        }
+
+        ++(*nibbleCnt);
+    }
+}
+
+/**
+ * Second pass of compressArgs(); stores a string argument found in the first
+ * pass with a null terminator (or a reference to a recent string if it's
+ * delta encoded). Non-string arguments are skipped at compile time.
+ *
+ * \tparam IsString
+ *      Indicates that the argument is a string according to the format
+ * \tparam DeltaEncoded
+ *      Indicates that the argument is delta encoded against history
+ * \tparam T
+ *      Type of the argument
+ *
+ * \param strings
+ *      Positions of the string arguments in the input buffer
+ * \param[in/out] stringCnt
+ *      Number of string arguments stored so far
+ * \param[in/out] out
+ *      Output buffer to write the string to
+ * \param history
+ *      The log site's previous arguments (if DeltaEncoded)
+ */
+template<bool IsString, bool DeltaEncoded, typename T>
+NANOLOG_ALWAYS_INLINE void
+compressArgsSecondPass(char **strings,
+                       int *stringCnt,
+                       char **out,
+                       BufferUtils::ArgumentHistory *history)
+{
+    if constexpr (isStaticStrArg<T>::value) {
+        // Stored in the first pass
+    } else if constexpr (isSerializedArg<T>::value) {
+        std::memcpy(*out, strings[(*stringCnt)++], sizeof(T));
+        *out += sizeof(T);
+    } else if constexpr (IsString) {
+        char *in = strings[(*stringCnt)++];
+        uint32_t stringBytes;
+        std::memcpy(&stringBytes, in, sizeof(uint32_t));
+        in += sizeof(uint32_t);
+
+        if constexpr (DeltaEncoded) {
+            uint8_t tag = history->encodeString(in, stringBytes);
+            **out = static_cast<char>(tag);
+            ++(*out);
+
+            if (tag != 0)
+                return;
+        }
+
+        std::memcpy(*out, in, stringBytes);
+        *out += stringBytes;
+
+        constexpr uint32_t characterWidth = getCharacterWidth<T>();
+        bzero(*out, characterWidth);
+        *out += characterWidth;
+    }
+}
+
+/**
+ * Implements compressArgs() for a particular setting of delta encoding.
  *
+ * \tparam StringArgs
+ *      Bit mask of the arguments that are strings (see getStringArgMask())
+ * \tparam DeltaEncoded
+ *      Indicates that the arguments are delta encoded against history
+ * \tparam Ts
+ *      Types of the arguments
+ * \tparam Indices
+ *      0..sizeof...(Ts)-1 (automatically deduced)
+ */
+template<uint64_t StringArgs, bool DeltaEncoded, typename... Ts,
+         size_t... Indices>
+NANOLOG_ALWAYS_INLINE void
+compressArgs_internal(std::index_sequence<Indices...>,
+                      int numNibbles,
+                      char **input,
+                      char **output,
+                      BufferUtils::ArgumentHistory *history,
+                      BufferUtils::StaticStringTable *staticStrings)
+{
+    char *in = *input;
+    char *out = *output;
+
+    auto *nibbles = reinterpret_cast<BufferUtils::TwoNibbles*>(out);
+    out += (numNibbles + 1)/2;
+
+    int nibbleCnt = 0;
+    int stringCnt = 0;
+    char *strings[sizeof...(Ts) + 1]; // Zero length arrays are not allowed
+
+    (compressArgsFirstPass<((StringArgs >> Indices) & 1) != 0, DeltaEncoded,
+                           Ts>(nibbles, &nibbleCnt, strings, &stringCnt,
+                               &in, &out, history, staticStrings), ...);
+
+    stringCnt = 0;
+    (compressArgsSecondPass<((StringArgs >> Indices) & 1) != 0, DeltaEncoded,
+                            Ts>(strings, &stringCnt, &out, history), ...);
+
+    *input = in;
+    *output = out;
+}
+
+/**
+ * Equivalent of compress() that's specialized for the format string of the
+ * log invocation site at compile time, like the compression functions that
+ * the preprocessor generates: whether an argument is a string is known
+ * statically, so no parameter types are consulted at runtime and the
+ * non-string arguments are traversed only once. It produces the same output
+ * as compress() and is the compression function registered for C++17
+ * NANO_LOG invocation sites with up to 64 arguments.
+ *
+ * \tparam StringArgs
+ *      Bit mask of the arguments that are strings (see getStringArgMask())
+ * \tparam Ts
+ *      Types of the arguments encoded in the input buffer
+ *
+ * \param numNibbles
+ *      Number of nibbles required for the arguments
+ * \param paramTypes
+ *      Unused; kept for compatibility with StaticLogInfo::CompressionFn
+ * \param[in/out] input
+ *      Input buffer to read the arguments back from
+ * \param[in/out] output
+ *      Output buffer to write the compressed results to
+ * \param history
+ *      The log site's previous arguments to delta encode the arguments
+ *      against, or nullptr to store them on their own
+ * \param staticStrings
+ *      Assigns the identifiers of the strings logged via NanoLog::StaticStr
+ *      (only needed if there are any)
+ */
+template<uint64_t StringArgs, typename... Ts>
+inline void
+compressArgs(int numNibbles, const ParamType *paramTypes, char **input,
+             char **output, BufferUtils::ArgumentHistory *history = nullptr,
+             BufferUtils::StaticStringTable *staticStrings = nullptr)
+{
+    static_assert(sizeof...(Ts) <= 64, "StringArgs covers 64 arguments");
+    if (history)
+        compressArgs_internal<StringArgs, true, Ts...>(
+                std::index_sequence_for<Ts...>(), numNibbles, input, output,
+                history, staticStrings);
+    else
+        compressArgs_internal<StringArgs, false, Ts...>(
+                std::index_sequence_for<Ts...>(), numNibbles, input, output,
+                history, staticStrings);
+}
+
+/**
+ * Tags the types of a log invocation's arguments; only used in unevaluated
+ * contexts to deduce the argument types without evaluating the arguments
+ * (see #NANO_LOG()).
+ */
+template<typename... Ts>
+struct ArgTypes {};
+
+template<typename... Ts>
+ArgTypes<Ts...> getArgTypes(Ts...);
+
+/**
+ * Returns a copy of a format string in which the specifiers of the arguments
+ * of user-defined types are tagged with the types' names (i.e. "%{Price}s"
+ * for a Price logged with "%s"), which tells the decompressor how to format
+ * them. Static strings are tagged likewise (see STATIC_STRING_TYPE_NAME).
+ * The copy is made once per log invocation site and is never freed.
+ *
+ * \param format
+ *      printf format string of the log invocation site
+ * \param typeNames
+ *      Name of the n-th argument's type (see NanoLog::Serializer), or
+ *      nullptr if it's not a user-defined type
+ * \param numArgs
+ *      Number of entries in typeNames
+ */
+inline const char *
+tagSerializedArgs(const char *format, const char *const *typeNames,
+                  size_t numArgs)
+{
+    std::string tagged;
+    size_t arg = 0;
+    for (const char *c = format; *c != '\0'; ++c) {
+        tagged.push_back(*c);
+        if (*c != '%')
+            continue;
+
+        // Two %'s in a row => Comment
+        if (c[1] == '%') {
+            tagged.push_back(*++c);
+            continue;
+        }
+
+        // Dynamic widths and precisions are passed before the argument
+        const char *terminal = c + 1;
+        while (*terminal != '\0' && !isTerminal(*terminal)) {
+            if (*terminal == '*')
+                ++arg;
+            ++terminal;
+        }
+
+        if (arg < numArgs && typeNames[arg] != nullptr)
+            tagged.append("{").append(typeNames[arg]).append("}");
+        ++arg;
+    }
+
+    return strdup(tagged.c_str());
+}
+
+/**
+ * Returns the name of the user-defined type of a log argument for
+ * tagSerializedArgs() (or the name that tags static strings), or nullptr if
+ * it's not one.
+ *
+ * \tparam T
+ *      Type of the log argument
+ */
+template<typename T>
+constexpr const char *
+getSerializedTypeName()
+{
+    if constexpr (isSerializedArg<T>::value)
+        return NanoLog::Serializer<T>::name;
+    else if constexpr (isStaticStrArg<T>::value)
+        return Log::STATIC_STRING_TYPE_NAME;
+    else
+        return nullptr;
+}
+
+/**
+ * Returns true if the arguments of user-defined types and the static strings
+ * are logged with a "%s" specifier, which the printf checker of NANO_LOG()
+ * lets them pass as.
+ *
+ * \tparam StringArgs
+ *      Bit mask of the arguments that are strings (see getStringArgMask())
+ * \tparam Ts
+ *      Types of the log arguments
+ */
+template<uint64_t StringArgs, typename... Ts, size_t... Indices>
+constexpr bool
+areSerializedArgsStrings(std::index_sequence<Indices...>)
+{
+    return ((!(isSerializedArg<Ts>::value || isStaticStrArg<Ts>::value)
+                || Indices >= 64 || ((StringArgs >> Indices) & 1) != 0) && ...);
+}
+
+/**
+ * Registers a log invocation site with the NanoLog system upon its first
+ * execution, regardless of whether it's enabled, so that it can be enabled
+ * at runtime (see NanoLog::setLogSiteEnabled()). This function is meant to
+ * work in conjunction with the #define-d NANO_LOG() and is kept out of line
+ * since it's only invoked once per site.
+ *
+ * \tparam StringArgs
+ *      Bit mask of the arguments that are strings (see getStringArgMask())
  * \tparam N
- *      length of the format string (automatically deduced)
- * \tparam M
  *      length of the paramTypes array (automatically deduced)
+ * \tparam M
+ *      length of the format string (automatically deduced)
  * \tparam Ts
  *      Types of the arguments passed in for the log (automatically deduced)
  *
@@ -973,6 +1538,8 @@ compress(int numNibbles, const ParamType *paramTypes, char **input, char **outpu
  *      LogId that should be permanently associated with the static information.
  *      An input value of -1 indicates that NanoLog should persist the static
  *      log information and assign a new, globally unique identifier.
+ * \param siteState[out]
+ *      Runtime enable flag of the invocation site (a LogSiteState)
  * \param filename
  *      Name of the file containing the log invocation
  * \param linenum
@@ -988,44 +1555,148 @@ compress(int numNibbles, const ParamType *paramTypes, char **input, char **outpu
  *      An array indicating the type of the n-th format parameter associated
  *      with the format string to be processed.
  *      *** THIS VARIABLE MUST HAVE A STATIC LIFETIME AS PTRS WILL BE SAVED ***
+ */
+template<uint64_t StringArgs, long unsigned int N, int M, typename... Ts>
+NANOLOG_NOINLINE void
+registerLogSite(ArgTypes<Ts...>,
+                int &logId,
+                uint8_t &siteState,
+                const char *filename,
+                const int linenum,
+                const LogLevel severity,
+                const char (&format)[M],
+                const int numNibbles,
+                const std::array<ParamType, N>& paramTypes)
+{
+    StaticLogInfo::CompressionFn compressionFn = &compress<Ts...>;
+    if constexpr (sizeof...(Ts) <= 64)
+        compressionFn = &compressArgs<StringArgs, Ts...>;
+
+    // The sizes of arguments of user-defined types and the identifiers of
+    // static strings take a nibble each
+    const char *formatString = format;
+    int numSerializedArgs = (isSerializedArg<Ts>::value + ... + 0)
+                                + (isStaticStrArg<Ts>::value + ... + 0);
+    if constexpr (((isSerializedArg<Ts>::value || isStaticStrArg<Ts>::value)
+                                                                    || ...)) {
+        static_assert(((!isSerializedArg<Ts>::value
+                            || std::is_trivially_copyable<Ts>::value) && ...),
+                      "NanoLog::Serializer types must be trivially copyable");
+        static_assert(areSerializedArgsStrings<StringArgs, Ts...>(
+                                            std::index_sequence_for<Ts...>()),
+                      "NanoLog::Serializer types and NanoLog::StaticStr "
+                      "must be logged with %s");
+
+        const char *typeNames[] = {getSerializedTypeName<Ts>()...};
+        formatString = tagSerializedArgs(format, typeNames, sizeof...(Ts));
+    }
+
+    StaticLogInfo info(compressionFn,
+                    filename,
+                    linenum,
+                    severity,
+                    formatString,
+                    sizeof...(Ts),
+                    numNibbles + numSerializedArgs,
+                    paramTypes.data());
+
+    RuntimeLogger::registerInvocationSite(info, logId, &siteState);
+}
+
+/**
+ * Returns true if a log invocation site should log its messages, which
+ * depends on the log level of its log channel unless the site has been
+ * explicitly enabled or disabled at runtime. Unregistered sites are never
+ * enabled.
+ *
+ * \param siteState
+ *      Runtime enable flag of the invocation site (a LogSiteState)
+ * \param severity
+ *      LogLevel severity of the log invocation
+ * \param channel
+ *      Log channel the invocation site logs to
+ */
+inline bool
+isLogSiteEnabled(const uint8_t &siteState, const LogLevel severity,
+                 const NanoLog::Channel channel = NanoLog::DEFAULT_CHANNEL)
+{
+    uint8_t state = __atomic_load_n(&siteState, __ATOMIC_RELAXED);
+    if (state == LOG_SITE_DEFAULT) {
+        if (channel == NanoLog::DEFAULT_CHANNEL)
+            return severity <= NanoLog::getLogLevel();
+        return severity <= NanoLog::getChannelLogLevel(channel);
+    }
+
+    return state == LOG_SITE_ENABLED;
+}
+
+/**
+ * Logs a log message in the NanoLog system given all the static and dynamic
+ * information associated with the log message. This function is meant to work
+ * in conjunction with the #define-d NANO_LOG() and expects the invocation
+ * site to have been registered with registerLogSite() first.
+ *
+ * \tparam N
+ *      length of the paramTypes array (automatically deduced)
+ * \tparam Ts
+ *      Types of the arguments passed in for the log (automatically deduced)
+ *
+ * \param logId
+ *      LogId assigned to the invocation site by registerLogSite()
+ * \param severity
+ *      LogLevel severity of the log invocation
+ * \param channel
+ *      Log channel to log the message to (see NanoLog::createChannel())
+ * \param paramTypes
+ *      An array indicating the type of the n-th format parameter associated
+ *      with the format string to be processed.
  * \param args
  *      Argument pack for all the arguments for the log invocation
  */
-template<long unsigned int N, int M, typename... Ts>
+template<long unsigned int N, typename... Ts>
 inline void
-log(int &logId,
-    const char *filename,
-    const int linenum,
+log(const int logId,
     const LogLevel severity,
-    const char (&format)[M],
-    const int numNibbles,
+    const NanoLog::Channel channel,
     const std::array<ParamType, N>& paramTypes,
     Ts... args)
 {
     using namespace NanoLogInternal::Log;
     assert(N == static_cast<uint32_t>(sizeof...(Ts)));
+    assert(logId >= 0);
+
+    uint64_t timestamp = PerfUtils::Cycles::rdtsc();
+
+    // Without strings, the size of the log message is a constant and the
+    // format string need not be consulted to store the arguments.
+    if constexpr (hasFixedSizeArgs<Ts...>::value) {
+        constexpr size_t allocSize = sizeof(UncompressedEntry) +
+                                     (sizeof(Ts) + ... + 0);
+        char *writePos = NanoLogInternal::RuntimeLogger::reserveAlloc(
+                                            allocSize, severity, channel);
+        if (writePos == nullptr)
+            return;
+
+        UncompressedEntry *ue = reinterpret_cast<UncompressedEntry*>(writePos);
+        ue->fmtId = logId;
+        ue->entrySize = static_cast<uint32_t>(allocSize);
+        ue->timestamp = timestamp;
+        store_fixed_arguments(ue->argData, args...);
 
-    if (logId == UNASSIGNED_LOGID) {
-        const ParamType *array = paramTypes.data();
-        StaticLogInfo info(&compress<Ts...>,
-                        filename,
-                        linenum,
-                        severity,
-                        format,
-                        sizeof...(Ts),
-                        numNibbles,
-                        array);
-
-        RuntimeLogger::registerInvocationSite(info, logId);
+        NanoLogInternal::RuntimeLogger::finishAlloc(allocSize, channel);
+        return;
     }
 
     uint64_t previousPrecision = -1;
-    uint64_t timestamp = PerfUtils::Cycles::rdtsc();
     size_t stringSizes[N + 1] = {}; //HACK: Zero length arrays are not allowed
     size_t allocSize = getArgSizes(paramTypes, previousPrecision,
                             stringSizes, args...) + sizeof(UncompressedEntry);
 
-    char *writePos = NanoLogInternal::RuntimeLogger::reserveAlloc(allocSize);
+    char *writePos = NanoLogInternal::RuntimeLogger::reserveAlloc(allocSize,
+                                                        severity, channel);
+    if (writePos == nullptr)
+        return;
+
     auto originalWritePos = writePos;
 
     UncompressedEntry *ue = new(writePos) UncompressedEntry();
@@ -1038,12 +1709,11 @@ log(int &logId,
     ue->entrySize = downCast<uint32_t>(allocSize);
 
 #ifdef ENABLE_DEBUG_PRINTING
-    printf("\r\nRecording %d:'%s' of size %u\r\n",
-                        logId, info.formatString, ue->entrySize);
+    printf("\r\nRecording %d of size %u\r\n", logId, ue->entrySize);
 #endif
 
     assert(allocSize == downCast<uint32_t>((writePos - originalWritePos)));
-    NanoLogInternal::RuntimeLogger::finishAlloc(allocSize);
+    NanoLogInternal::RuntimeLogger::finishAlloc(allocSize, channel);
 }
 
 /**
@@ -1059,18 +1729,170 @@ static void
 NANOLOG_PRINTF_FORMAT_ATTR(1, 2)
 checkFormat(NANOLOG_PRINTF_FORMAT const char *, ...) {}
 
+/**
+ * Substitutes a string for an argument of a user-defined type or a
+ * NanoLog::StaticStr, which are logged with "%s", when the arguments are
+ * passed to checkFormat().
+ *
+ * \param arg
+ *      Log argument
+ */
+template<typename T>
+constexpr decltype(auto)
+toCheckedArg(const T &arg)
+{
+    if constexpr (isSerializedArg<T>::value)
+        return static_cast<const char*>(nullptr);
+    else if constexpr (isStaticStrArg<T>::value)
+        return arg.str;
+    else
+        return arg;
+}
+
+
+/**
+ * Limiter of the plain NANO_LOG(), which logs every message.
+ */
+struct NoLimiter {
+    static constexpr bool tryAcquire(uint64_t) { return true; }
+    static constexpr uint32_t takeNumSuppressed() { return 0; }
+};
 
 /**
- * NANO_LOG macro used for logging.
+ * Limiter of NANO_LOG_EVERY_N(), which logs the 1st, (n+1)-th, (2n+1)-th...
+ * message of an invocation site.
+ */
+struct EveryNLimiter {
+    // Number of messages seen by the invocation site so far
+    std::atomic<uint64_t> count;
+
+    bool tryAcquire(uint64_t n) {
+        return count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+
+    // The number of suppressed messages is implied by n
+    static constexpr uint32_t takeNumSuppressed() { return 0; }
+};
+
+/**
+ * Limiter of NANO_LOG_FIRST_N(), which logs the first n messages of an
+ * invocation site and suppresses the rest.
+ */
+struct FirstNLimiter {
+    // Number of messages logged so far (may overshoot n)
+    std::atomic<uint64_t> count;
+
+    bool tryAcquire(uint64_t n) {
+        // Stop bumping the shared counter once the site is exhausted
+        if (count.load(std::memory_order_relaxed) >= n)
+            return false;
+        return count.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+
+    // Nothing is logged after the suppressed messages to report them with
+    static constexpr uint32_t takeNumSuppressed() { return 0; }
+};
+
+/**
+ * Limiter of NANO_LOG_RATE_LIMITED(); a token bucket that holds up to a
+ * second's worth of messages and is refilled at maxPerSecond messages per
+ * second. It's implemented as the equivalent generic cell rate algorithm,
+ * which needs only a single timestamp to be updated atomically.
+ */
+struct RateLimiter {
+    // Time (in rdtsc cycles) at which the bucket would be full again
+    std::atomic<uint64_t> theoreticalArrival;
+
+    // Cycles between two tokens; computed upon the first use
+    std::atomic<uint64_t> interval;
+
+    // Number of messages suppressed since the last one logged
+    std::atomic<uint32_t> numSuppressed;
+
+    bool tryAcquire(uint64_t maxPerSecond) {
+        uint64_t cycles = interval.load(std::memory_order_relaxed);
+        if (cycles == 0) {
+            cycles = std::max<uint64_t>(1, PerfUtils::Cycles::fromSeconds(
+                                1.0/static_cast<double>(maxPerSecond)));
+            interval.store(cycles, std::memory_order_relaxed);
+        }
+
+        uint64_t now = PerfUtils::Cycles::rdtsc();
+        uint64_t burstTolerance = (maxPerSecond - 1)*cycles;
+        uint64_t tat = theoreticalArrival.load(std::memory_order_relaxed);
+        while (tat <= now + burstTolerance) {
+            uint64_t next = std::max(tat, now) + cycles;
+            if (theoreticalArrival.compare_exchange_weak(tat, next,
+                                                std::memory_order_relaxed))
+                return true;
+        }
+
+        numSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t takeNumSuppressed() {
+        if (numSuppressed.load(std::memory_order_relaxed) == 0)
+            return 0;
+        return numSuppressed.exchange(0, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Logs the number of messages a rate limited invocation site suppressed in
+ * front of its next message. The message is logged regardless of the log
+ * level since the site's message that follows it passed the checks already.
+ *
+ * \param numSuppressed
+ *      Number of messages suppressed
+ * \param filename
+ *      Name of the file containing the rate limited invocation site
+ * \param linenum
+ *      Line number within filename of the rate limited invocation site
+ * \param channel
+ *      Log channel of the rate limited invocation site
+ */
+NANOLOG_NOINLINE inline void
+logNumSuppressed(uint32_t numSuppressed, const char *filename, int linenum,
+                 NanoLog::Channel channel)
+{
+    static constexpr const char format[] = "NanoLog suppressed %u log "
+                            "message(s) at %s:%d because of its rate limit";
+    static constexpr std::array<ParamType, 3> paramTypes =
+                                            analyzeFormatString<3>(format);
+    static int logId = UNASSIGNED_LOGID;
+    static uint8_t siteState = LOG_SITE_UNREGISTERED;
+
+    if (siteState == LOG_SITE_UNREGISTERED)
+        registerLogSite<getStringArgMask(paramTypes)>(
+                        ArgTypes<uint32_t, const char*, int>(), logId,
+                        siteState, __FILE__, __LINE__, NanoLog::WARNING,
+                        format, getNumNibblesNeeded(format), paramTypes);
+
+    log(logId, NanoLog::WARNING, channel, paramTypes, numSuppressed, filename,
+        linenum);
+}
+
+/**
+ * Implements NANO_LOG() and its rate limited and channel variants.
  *
+ * \param channel
+ *      Log channel to log to (see NanoLog::createChannel()); evaluated
+ *      more than once
  * \param severity
  *      The LogLevel of the log invocation (must be constant)
+ * \param limiterType
+ *      Type of the invocation site's limiter (i.e. EveryNLimiter), which
+ *      decides whether an enabled message is logged or suppressed
+ * \param limit
+ *      Parameter of the limiter
  * \param format
  *      printf-like format string (must be literal)
- * \param ...UNASSIGNED_LOGID
+ * \param ...
  *      Log arguments associated with the printf-like string.
  */
-#define NANO_LOG(severity, format, ...) do { \
+#define NANO_LOG_LIMITED(channel, severity, limiterType, limit, format, ...) do { \
+    if constexpr (NanoLog::severity <= NanoLog::MIN_LOG_LEVEL) { \
     constexpr int numNibbles = NanoLogInternal::getNumNibblesNeeded(format); \
     constexpr int nParams = NanoLogInternal::countFmtParams(format); \
     \
@@ -1079,22 +1901,141 @@ checkFormat(NANOLOG_PRINTF_FORMAT const char *, ...) {}
      * The static logId is used to forever associate this local scope (tied
      * to an expansion of #NANO_LOG) with an id and the paramTypes array is
      * used by the compression function, which is invoked in another thread
-     * at a much later time. */ \
+     * at a much later time. The siteState is updated by the runtime when the
+     * site is enabled or disabled. */ \
     static constexpr std::array<NanoLogInternal::ParamType, nParams> paramTypes = \
                                 NanoLogInternal::analyzeFormatString<nParams>(format); \
     static int logId = NanoLogInternal::UNASSIGNED_LOGID; \
+    static uint8_t siteState = NanoLogInternal::LOG_SITE_UNREGISTERED; \
+    static limiterType limiter; \
+    \
+    if (!NanoLogInternal::isLogSiteEnabled(siteState, NanoLog::severity, \
+                                           channel)) { \
+        if (siteState != NanoLogInternal::LOG_SITE_UNREGISTERED) \
+            break; \
+        \
+        /* The argument types are deduced without evaluating the arguments */ \
+        NanoLogInternal::registerLogSite< \
+                NanoLogInternal::getStringArgMask(paramTypes)>( \
+                decltype(NanoLogInternal::getArgTypes(__VA_ARGS__))(), \
+                logId, siteState, __FILE__, __LINE__, NanoLog::severity, \
+                format, numNibbles, paramTypes); \
+        if (!NanoLogInternal::isLogSiteEnabled(siteState, NanoLog::severity, \
+                                               channel)) \
+            break; \
+    } \
     \
-    if (NanoLog::severity > NanoLog::getLogLevel()) \
+    if (!limiter.tryAcquire(limit)) \
         break; \
+    if (uint32_t numSuppressed = limiter.takeNumSuppressed()) \
+        NanoLogInternal::logNumSuppressed(numSuppressed, __FILE__, __LINE__, \
+                                          channel); \
     \
     /* Triggers the GNU printf checker by passing it into a no-op function.
      * Trick: This call is surrounded by an if false so that the VA_ARGS don't
-     * evaluate for cases like '++i'.*/ \
-    if (false) { NanoLogInternal::checkFormat(format, ##__VA_ARGS__); } /*NOLINT(cppcoreguidelines-pro-type-vararg, hicpp-vararg)*/\
+     * evaluate for cases like '++i'. The lambda lets arguments of
+     * user-defined types pass as strings (see toCheckedArg()).*/ \
+    if (false) { [&](auto... args) { NanoLogInternal::checkFormat(format, NanoLogInternal::toCheckedArg(args)...); }(__VA_ARGS__); } /*NOLINT(cppcoreguidelines-pro-type-vararg, hicpp-vararg)*/\
     \
-    NanoLogInternal::log(logId, __FILE__, __LINE__, NanoLog::severity, format, \
-                            numNibbles, paramTypes, ##__VA_ARGS__); \
+    NanoLogInternal::log(logId, NanoLog::severity, channel, paramTypes, \
+                         ##__VA_ARGS__); \
+    } \
 } while(0)
+
+/**
+ * NANO_LOG macro used for logging. Invocations of a lower severity than
+ * NANOLOG_MIN_LOG_LEVEL are compiled out entirely.
+ *
+ * \param severity
+ *      The LogLevel of the log invocation (must be constant)
+ * \param format
+ *      printf-like format string (must be literal)
+ * \param ...UNASSIGNED_LOGID
+ *      Log arguments associated with the printf-like string.
+ */
+#define NANO_LOG(severity, format, ...) \
+    NANO_LOG_LIMITED(NanoLog::DEFAULT_CHANNEL, severity, \
+                     NanoLogInternal::NoLimiter, 0, format, ##__VA_ARGS__)
+
+/**
+ * Variant of NANO_LOG() that logs to a log channel created by
+ * NanoLog::createChannel() rather than the default log. The log message is
+ * subject to the channel's log level, drop policy and durability and is
+ * output to the channel's log file, i.e.
+ *
+ *      static NanoLog::Channel audit = NanoLog::createChannel("audit",
+ *                                                             "./audit.log");
+ *      NANO_LOG_TO(audit, NOTICE, "User %s logged in", user);
+ *
+ * \param channel
+ *      Log channel to log to; evaluated more than once, so it should be a
+ *      variable
+ * \param severity
+ *      The LogLevel of the log invocation (must be constant)
+ * \param format
+ *      printf-like format string (must be literal)
+ * \param ...
+ *      Log arguments associated with the printf-like string.
+ */
+#define NANO_LOG_TO(channel, severity, format, ...) \
+    NANO_LOG_LIMITED(channel, severity, NanoLogInternal::NoLimiter, 0, \
+                     format, ##__VA_ARGS__)
+
+/**
+ * Variant of NANO_LOG() that logs only every n-th message of the invocation
+ * site (the 1st, (n+1)-th...), i.e. to sample a log statement in a hot loop.
+ * The arguments of the skipped messages are not evaluated.
+ *
+ * \param severity
+ *      The LogLevel of the log invocation (must be constant)
+ * \param n
+ *      Sampling period (at least 1)
+ * \param format
+ *      printf-like format string (must be literal)
+ * \param ...
+ *      Log arguments associated with the printf-like string.
+ */
+#define NANO_LOG_EVERY_N(severity, n, format, ...) \
+    NANO_LOG_LIMITED(NanoLog::DEFAULT_CHANNEL, severity, \
+                     NanoLogInternal::EveryNLimiter, n, format, ##__VA_ARGS__)
+
+/**
+ * Variant of NANO_LOG() that logs only the first n messages of the invocation
+ * site. The arguments of the skipped messages are not evaluated.
+ *
+ * \param severity
+ *      The LogLevel of the log invocation (must be constant)
+ * \param n
+ *      Number of messages to log
+ * \param format
+ *      printf-like format string (must be literal)
+ * \param ...
+ *      Log arguments associated with the printf-like string.
+ */
+#define NANO_LOG_FIRST_N(severity, n, format, ...) \
+    NANO_LOG_LIMITED(NanoLog::DEFAULT_CHANNEL, severity, \
+                     NanoLogInternal::FirstNLimiter, n, format, ##__VA_ARGS__)
+
+/**
+ * Variant of NANO_LOG() that logs at most maxPerSecond messages per second
+ * from the invocation site on average, with bursts of up to a second's worth
+ * of messages. The arguments of the suppressed messages are not evaluated;
+ * their number is logged in a separate message in front of the site's next
+ * message, so that it shows up in the decompressed log.
+ *
+ * \param severity
+ *      The LogLevel of the log invocation (must be constant)
+ * \param maxPerSecond
+ *      Rate limit in messages per second (at least 1)
+ * \param format
+ *      printf-like format string (must be literal)
+ * \param ...
+ *      Log arguments associated with the printf-like string.
+ */
+#define NANO_LOG_RATE_LIMITED(severity, maxPerSecond, format, ...) \
+    NANO_LOG_LIMITED(NanoLog::DEFAULT_CHANNEL, severity, \
+                     NanoLogInternal::RateLimiter, maxPerSecond, format, \
+                     ##__VA_ARGS__)
 } /* Namespace NanoLogInternal */
 
 #endif //NANOLOG_CPP17_H
@@ -13,6 +13,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <fstream>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "TestUtil.h"
@@ -20,6 +23,23 @@
 #include "RuntimeLogger.h"
 #include "NanoLogCpp17.h"
 
+// A user-defined type that's logged via NanoLog::Serializer
+struct TestPrice {
+    int32_t mantissa;
+    int8_t exponent;
+};
+
+template<>
+struct NanoLog::Serializer<TestPrice> {
+    static constexpr const char *name = "TestPrice";
+
+    static void
+    format(const TestPrice &price, std::string &out) {
+        out.append(std::to_string(price.mantissa)).append("e")
+           .append(std::to_string(price.exponent));
+    }
+};
+
 namespace {
 using namespace NanoLogInternal;
 using namespace PerfUtils;
@@ -379,6 +399,151 @@ TEST_F(NanoLogCpp17Test, store_arguments) {
                  buffer - backing_buffer);
 }
 
+TEST_F(NanoLogCpp17Test, hasFixedSizeArgs) {
+    EXPECT_TRUE(hasFixedSizeArgs<>::value);
+    EXPECT_TRUE((hasFixedSizeArgs<int, double, uint64_t>::value));
+    EXPECT_TRUE((hasFixedSizeArgs<int, const void*, char>::value));
+    EXPECT_FALSE((hasFixedSizeArgs<int, const char*>::value));
+    EXPECT_FALSE((hasFixedSizeArgs<wchar_t*, double>::value));
+}
+
+TEST_F(NanoLogCpp17Test, store_fixed_arguments) {
+    char expected[1024], actual[1024];
+    std::memset(expected, 0, sizeof(expected));
+    std::memset(actual, 0, sizeof(actual));
+
+    // Matches the layout of store_arguments()
+    constexpr std::array<ParamType, 4> paramTypes = analyzeFormatString<4>(
+            "%d %lf %p %hhd");
+    size_t stringSizes[4];
+    char *buffer = expected;
+    const void *pointer = expected;
+    store_arguments(paramTypes, stringSizes, &buffer,
+                    -5, 0.25, pointer, char(7));
+
+    store_fixed_arguments(actual, -5, 0.25, pointer, char(7));
+    EXPECT_EQ(sizeof(int) + sizeof(double) + sizeof(void*) + sizeof(char),
+              static_cast<size_t>(buffer - expected));
+    EXPECT_EQ(0, std::memcmp(expected, actual, sizeof(actual)));
+
+    // Nothing to store
+    store_fixed_arguments(actual);
+}
+
+TEST_F(NanoLogCpp17Test, registerLogSite) {
+    LogLevel previousLogLevel = RuntimeLogger::getLogLevel();
+    RuntimeLogger::setLogLevel(NanoLog::NOTICE);
+
+    static constexpr std::array<ParamType, 1> paramTypes =
+                                        analyzeFormatString<1>("Site %d");
+    static int debugId = UNASSIGNED_LOGID, noticeId = UNASSIGNED_LOGID;
+    static uint8_t debugState = LOG_SITE_UNREGISTERED;
+    static uint8_t noticeState = LOG_SITE_UNREGISTERED;
+
+    // Unregistered sites are never enabled
+    EXPECT_FALSE(isLogSiteEnabled(noticeState, NanoLog::NOTICE));
+
+    registerLogSite<0>(decltype(getArgTypes(1))(), debugId, debugState,
+                    "siteDir/LogSiteTest.cc", 10, NanoLog::DEBUG,
+                    "Debug site %d", 1, paramTypes);
+    registerLogSite<0>(decltype(getArgTypes(1))(), noticeId, noticeState,
+                    "siteDir/LogSiteTest.cc", 20, NanoLog::NOTICE,
+                    "Notice site %d", 1, paramTypes);
+    ASSERT_LE(0, debugId);
+    EXPECT_EQ(LOG_SITE_DEFAULT, debugState);
+    EXPECT_FALSE(isLogSiteEnabled(debugState, NanoLog::DEBUG));
+    EXPECT_TRUE(isLogSiteEnabled(noticeState, NanoLog::NOTICE));
+
+    const StaticLogInfo &info =
+            RuntimeLogger::nanoLogSingleton.invocationSites[debugId];
+    EXPECT_EQ((&compressArgs<0, int>), info.compressionFunction);
+    EXPECT_STREQ("Debug site %d", info.formatString);
+
+    // The rules override the log level
+    EXPECT_EQ(1U, RuntimeLogger::setLogSitesEnabledContaining("Debug site",
+                                                              true));
+    EXPECT_TRUE(isLogSiteEnabled(debugState, NanoLog::DEBUG));
+    EXPECT_EQ(1U, RuntimeLogger::setLogSiteEnabled(noticeId, false));
+    EXPECT_FALSE(isLogSiteEnabled(noticeState, NanoLog::NOTICE));
+
+    // File names match whole path components
+    EXPECT_EQ(0U, RuntimeLogger::setLogSitesEnabledInFile("SiteTest.cc",
+                                                           false));
+    EXPECT_EQ(2U, RuntimeLogger::setLogSitesEnabledInFile("LogSiteTest.cc",
+                                                          false));
+    EXPECT_EQ(LOG_SITE_DISABLED, debugState);
+    EXPECT_EQ(2U, RuntimeLogger::setLogSitesEnabledInFile(
+                                    "siteDir/LogSiteTest.cc", true));
+    EXPECT_EQ(LOG_SITE_ENABLED, noticeState);
+
+    // Sites registered later are subject to the rules so far
+    static int laterId = UNASSIGNED_LOGID;
+    static uint8_t laterState = LOG_SITE_UNREGISTERED;
+    RuntimeLogger::setLogSitesEnabledContaining("Later site", false);
+    registerLogSite<0>(decltype(getArgTypes(1))(), laterId, laterState,
+                    "siteDir/LogSiteTest.cc", 30, NanoLog::ERROR,
+                    "Later site %d", 1, paramTypes);
+    EXPECT_EQ(LOG_SITE_DISABLED, laterState);
+    EXPECT_FALSE(isLogSiteEnabled(laterState, NanoLog::ERROR));
+
+    RuntimeLogger::resetLogSites();
+    EXPECT_FALSE(isLogSiteEnabled(debugState, NanoLog::DEBUG));
+    EXPECT_TRUE(isLogSiteEnabled(noticeState, NanoLog::NOTICE));
+    EXPECT_TRUE(isLogSiteEnabled(laterState, NanoLog::ERROR));
+
+    RuntimeLogger::setLogLevel(previousLogLevel);
+}
+
+TEST_F(NanoLogCpp17Test, EveryNLimiter) {
+    EveryNLimiter limiter = {};
+    int numLogged = 0;
+    for (int i = 0; i < 10; ++i)
+        numLogged += limiter.tryAcquire(4);
+    EXPECT_EQ(3, numLogged);
+    EXPECT_EQ(0U, limiter.takeNumSuppressed());
+
+    EveryNLimiter everyOne = {};
+    EXPECT_TRUE(everyOne.tryAcquire(1));
+    EXPECT_TRUE(everyOne.tryAcquire(1));
+}
+
+TEST_F(NanoLogCpp17Test, FirstNLimiter) {
+    FirstNLimiter limiter = {};
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+
+    // The counter stops once the limit is reached
+    EXPECT_EQ(2U, limiter.count);
+}
+
+TEST_F(NanoLogCpp17Test, RateLimiter) {
+    RateLimiter limiter = {};
+    EXPECT_EQ(0U, limiter.takeNumSuppressed());
+
+    // Up to a second's worth of messages pass in a burst
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+    EXPECT_EQ(Cycles::fromSeconds(0.5), limiter.interval);
+
+    EXPECT_EQ(2U, limiter.takeNumSuppressed());
+    EXPECT_EQ(0U, limiter.takeNumSuppressed());
+
+    // The bucket refills over time
+    limiter.theoreticalArrival -= Cycles::fromSeconds(0.5);
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+
+    limiter.theoreticalArrival = 0;
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_TRUE(limiter.tryAcquire(2));
+    EXPECT_FALSE(limiter.tryAcquire(2));
+    EXPECT_EQ(2U, limiter.takeNumSuppressed());
+}
+
 template<int N>
 constexpr static int
 staticStrlen(const char (&)[N]) {
@@ -762,7 +927,7 @@ TEST_F(NanoLogCpp17Test, compressSingle) {
 }
 
 TEST_F(NanoLogCpp17Test, compress_internal) {
-    BufferUtils::TwoNibbles nibbles[10];
+    BufferUtils::TwoNibbles nibbles[10] = {};
     const ParamType isArgString[] = {NON_STRING,
                                      STRING_WITH_NO_PRECISION,
                                      STRING,
@@ -930,4 +1095,471 @@ TEST_F(NanoLogCpp17Test, compress) {
     EXPECT_EQ(0, *out); ++out;
 }
 
+/**
+ * Appends the arguments of a "%d %s %lf %lu" log message in the uncompressed
+ * format of the StagingBuffer to a buffer.
+ */
+static void
+pushDeltaTestArgs(char **in, int a, const char *s, double d, unsigned long u)
+{
+    uint32_t stringBytes = static_cast<uint32_t>(strlen(s));
+    memcpy(*in, &a, sizeof(a));
+    *in += sizeof(a);
+    memcpy(*in, &stringBytes, sizeof(stringBytes));
+    *in += sizeof(stringBytes);
+    memcpy(*in, s, stringBytes);
+    *in += stringBytes;
+    memcpy(*in, &d, sizeof(d));
+    *in += sizeof(d);
+    memcpy(*in, &u, sizeof(u));
+    *in += sizeof(u);
+}
+
+TEST_F(NanoLogCpp17Test, compress_deltaEncoded) {
+    const ParamType paramTypes[] = {NON_STRING,
+                                    STRING_WITH_NO_PRECISION,
+                                    NON_STRING,
+                                    NON_STRING};
+    char inBuffer[1024];
+    char outBuffer[1024];
+    char *in = inBuffer;
+    char *out = outBuffer;
+
+    pushDeltaTestArgs(&in, 1000, "sym", 0.5, 7);
+    pushDeltaTestArgs(&in, 1001, "sym", 0.5, 5);
+    char *endOfIn = in;
+
+    BufferUtils::ArgumentHistory history;
+    history.begin(0, 3);
+
+    // The first message is stored in full with a literal string
+    in = inBuffer;
+    compress<int, const char*, double, unsigned long>(3, paramTypes, &in, &out,
+                                                      &history);
+    EXPECT_EQ(2 + 2 + 8 + 1 + 1 + 4, out - outBuffer);
+    EXPECT_EQ(1000U, history.integers[0]);
+    EXPECT_EQ(7U, history.integers[2]);
+    EXPECT_EQ(0, outBuffer[13]);
+    EXPECT_STREQ("sym", outBuffer + 14);
+
+    // The second stores the small deltas and a reference to the string
+    char *secondMsg = out;
+    compress<int, const char*, double, unsigned long>(3, paramTypes, &in, &out,
+                                                      &history);
+    EXPECT_EQ(endOfIn, in);
+    ASSERT_EQ(2 + 1 + 8 + 1 + 1, out - secondMsg);
+
+    auto *nibbles = reinterpret_cast<BufferUtils::TwoNibbles*>(secondMsg);
+    EXPECT_EQ(1, nibbles[0].first);
+    EXPECT_EQ(8, nibbles[0].second);
+    EXPECT_EQ(1 + 8, nibbles[1].first);
+    EXPECT_EQ(1, secondMsg[2]);
+    EXPECT_EQ(2, secondMsg[11]);
+    EXPECT_EQ(1, secondMsg[12]);
+}
+
+TEST_F(NanoLogCpp17Test, getStringArgMask) {
+    EXPECT_EQ(0U, getStringArgMask(analyzeFormatString<0>("None")));
+    // The precision of %.*s is an argument of its own
+    EXPECT_EQ(0xAU, getStringArgMask(analyzeFormatString<5>(
+                                                "%d %s %.*s %p")));
+    EXPECT_EQ(0x2U, getStringArgMask(analyzeFormatString<3>("%d %.3s %lf")));
+}
+
+TEST_F(NanoLogCpp17Test, compressArgs) {
+    constexpr std::array<ParamType, 5> paramTypes =
+                            analyzeFormatString<5>("%d %s %ls %hu %s");
+    constexpr uint64_t stringArgs = getStringArgMask(paramTypes);
+    char inBuffer[1024];
+    char expectedBuffer[1024], outBuffer[1024];
+
+    // Empty, do nothing
+    char *in = inBuffer, *out = outBuffer;
+    compressArgs<0>(0, nullptr, &in, &out);
+    EXPECT_EQ(inBuffer, in);
+    EXPECT_EQ(outBuffer, out);
+
+    char aString[] = "Blah blah";
+    wchar_t wString[] = L"bleh";
+    int integers[] = {-2, 40000, 40001};
+    in = inBuffer;
+    for (int i = 0; i < 3; ++i) {
+        size_t stringSizes[6];
+        uint64_t previousPrecision = -1;
+        getArgSizes(paramTypes, previousPrecision, stringSizes, integers[i],
+                    aString, wString, uint16_t(99 + i), "sym");
+        store_arguments(paramTypes, stringSizes, &in, integers[i], aString,
+                        wString, uint16_t(99 + i), "sym");
+    }
+    char *endOfIn = in;
+
+    // The output matches compress() with and without delta encoding
+    for (int deltaEncoded = 0; deltaEncoded < 2; ++deltaEncoded) {
+        BufferUtils::ArgumentHistory expectedHistory, history;
+        expectedHistory.begin(0, 3);
+        history.begin(0, 3);
+
+        char *expectedIn = inBuffer, *expected = expectedBuffer;
+        in = inBuffer; out = outBuffer;
+        for (int i = 0; i < 3; ++i) {
+            compress<int, char*, wchar_t*, uint16_t, const char*>(
+                    2, paramTypes.data(), &expectedIn, &expected,
+                    deltaEncoded ? &expectedHistory : nullptr);
+            compressArgs<stringArgs, int, char*, wchar_t*, uint16_t,
+                         const char*>(2, nullptr, &in, &out,
+                                      deltaEncoded ? &history : nullptr);
+        }
+
+        EXPECT_EQ(endOfIn, expectedIn);
+        EXPECT_EQ(endOfIn, in);
+        ASSERT_EQ(expected - expectedBuffer, out - outBuffer);
+        EXPECT_EQ(0, memcmp(expectedBuffer, outBuffer, out - outBuffer));
+    }
+}
+
+TEST_F(NanoLogCpp17Test, deltaEncoding_end2end) {
+    const char *testFile = "/tmp/testFile";
+    const ParamType paramTypes[] = {NON_STRING,
+                                    STRING_WITH_NO_PRECISION,
+                                    NON_STRING,
+                                    NON_STRING};
+    std::vector<StaticLogInfo> dictionary;
+    dictionary.emplace_back(&compress<int, const char*, double, unsigned long>,
+                            "File", 10, NanoLog::NOTICE, "Seq %d %s %lf %lu", 4, 3,
+                            paramTypes);
+
+    struct Args { int a; const char *s; double d; unsigned long u; };
+    Args args[] = {{1000, "sym", 0.5, 7},
+                   {1001, "sym", 0.5, 5},
+                   {999, "other", 1.5, 5},
+                   {1002, "sym", 0.5, 7}};
+
+    char inBuffer[1024], buffer[1024];
+    Log::Encoder encoder(buffer, sizeof(buffer), true, false, true);
+
+    // The checkpoint is written by hand to leave out the dictionary of the
+    // preprocessor's generated functions that the unit tests link against
+    ASSERT_TRUE(Log::insertCheckpoint(&encoder.writePos, encoder.endOfBuffer,
+                                      false, sizeof(buffer),
+                                      Log::DELTA_ENCODED_ARGUMENTS));
+    EXPECT_EQ(Log::DELTA_ENCODED_ARGUMENTS | Log::PRECISE_TIME,
+              reinterpret_cast<Log::Checkpoint*>(buffer)->flags);
+
+    uint32_t currentPos = 0;
+    encoder.encodeNewDictionaryEntries(currentPos, dictionary);
+
+    // The last message goes into a separate BufferExtent, which must be
+    // decodable without the history built up by the first
+    uint64_t compressedLogs = 0;
+    for (int extent = 0; extent < 2; ++extent) {
+        char *in = inBuffer;
+        for (int i = 3*extent; i < 3 + extent; ++i) {
+            auto *ue = reinterpret_cast<Log::UncompressedEntry*>(in);
+            in += sizeof(Log::UncompressedEntry);
+            ue->fmtId = 0;
+            ue->timestamp = 10*(i + 1);
+            pushDeltaTestArgs(&in, args[i].a, args[i].s, args[i].d, args[i].u);
+            ue->entrySize = downCast<uint32_t>(in - reinterpret_cast<char*>(ue));
+        }
+
+        EXPECT_EQ(in - inBuffer, encoder.encodeLogMsgs(inBuffer, in - inBuffer,
+                        extent, false, dictionary, &compressedLogs));
+    }
+    EXPECT_EQ(4U, compressedLogs);
+
+    std::ofstream oFile;
+    oFile.open(testFile);
+    oFile.write(buffer, encoder.getEncodedBytes());
+    oFile.close();
+
+    Log::Decoder dc;
+    Log::LogMessage logMsg;
+    ASSERT_TRUE(dc.open(testFile));
+    for (const Args &expected : args) {
+        ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+        ASSERT_EQ(4, logMsg.getNumArgs());
+        EXPECT_EQ(expected.a, logMsg.get<int>(0));
+        EXPECT_STREQ(expected.s, logMsg.get<const char*>(1));
+        EXPECT_EQ(expected.d, logMsg.get<double>(2));
+        EXPECT_EQ(expected.u, logMsg.get<unsigned long>(3));
+    }
+    EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+
+    // Batches decode the deltas as well
+    Log::ArgumentBatch batch;
+    ASSERT_TRUE(dc.open(testFile));
+    ASSERT_TRUE(dc.getNextArgumentBatch(0, 3, batch));
+    ASSERT_EQ(4U, batch.size);
+    EXPECT_EQ(7, batch.ints[0]);
+    EXPECT_EQ(5, batch.ints[1]);
+    EXPECT_EQ(5, batch.ints[2]);
+    EXPECT_EQ(7, batch.ints[3]);
+
+    std::remove(testFile);
+}
+
+TEST_F(NanoLogCpp17Test, isSerializedArg) {
+    EXPECT_TRUE(isSerializedArg<TestPrice>::value);
+    EXPECT_FALSE(isSerializedArg<int>::value);
+    EXPECT_FALSE(isSerializedArg<const char*>::value);
+    EXPECT_TRUE((hasFixedSizeArgs<int, TestPrice>::value));
+    EXPECT_EQ(nullptr, toCheckedArg(TestPrice{1, 2}));
+    EXPECT_EQ(3, toCheckedArg(3));
+}
+
+TEST_F(NanoLogCpp17Test, tagSerializedArgs) {
+    const char *noNames[] = {nullptr, nullptr};
+    const char *names[] = {nullptr, "TestPrice", nullptr, "Id"};
+
+    EXPECT_STREQ("%d %s", tagSerializedArgs("%d %s", noNames, 2));
+    EXPECT_STREQ("%d %{TestPrice}-8s",
+                 tagSerializedArgs("%d %-8s", names, 2));
+
+    // Dynamic widths and precisions are arguments of their own
+    EXPECT_STREQ("%{TestPrice}*s 100%% %{Id}.*s",
+                 tagSerializedArgs("%*s 100%% %.*s", names, 4));
+
+    // Extra specifiers are left alone
+    EXPECT_STREQ("%d %{TestPrice}s %s",
+                 tagSerializedArgs("%d %s %s", names, 2));
+}
+
+TEST_F(NanoLogCpp17Test, serializedArgs_end2end) {
+    const char *testFile = "/tmp/testFile";
+    static constexpr std::array<ParamType, 3> paramTypes =
+                            analyzeFormatString<3>("%d [%-8s] %s");
+    constexpr uint64_t stringArgs = getStringArgMask(paramTypes);
+    const char *names[] = {nullptr, "TestPrice", nullptr};
+    const char *format = tagSerializedArgs("%d [%-8s] %s", names, 3);
+
+    struct Args { int a; TestPrice p; const char *s; };
+    Args args[] = {{1000, {125, -2}, "sym"},
+                   {1001, {-3, 4}, "sym"}};
+
+    // Every combination of compression function and delta encoding
+    for (int run = 0; run < 4; ++run) {
+        bool deltaEncoded = (run & 1);
+        StaticLogInfo::CompressionFn compressionFn =
+                                    &compress<int, TestPrice, const char*>;
+        if (run & 2)
+            compressionFn = &compressArgs<stringArgs, int, TestPrice,
+                                          const char*>;
+
+        // The argument's size takes a nibble
+        std::vector<StaticLogInfo> dictionary;
+        dictionary.emplace_back(compressionFn, "File", 10, NanoLog::NOTICE,
+                                format, 3, 2, paramTypes.data());
+
+        char inBuffer[1024], buffer[1024];
+        Log::Encoder encoder(buffer, sizeof(buffer), true, false,
+                             deltaEncoded);
+        ASSERT_TRUE(Log::insertCheckpoint(&encoder.writePos,
+                        encoder.endOfBuffer, false, sizeof(buffer),
+                        deltaEncoded ? Log::DELTA_ENCODED_ARGUMENTS : 0));
+
+        uint32_t currentPos = 0;
+        encoder.encodeNewDictionaryEntries(currentPos, dictionary);
+
+        char *in = inBuffer;
+        for (const Args &arg : args) {
+            auto *ue = reinterpret_cast<Log::UncompressedEntry*>(in);
+            in += sizeof(Log::UncompressedEntry);
+            ue->fmtId = 0;
+            ue->timestamp = 10;
+
+            size_t stringSizes[3];
+            uint64_t previousPrecision = -1;
+            getArgSizes(paramTypes, previousPrecision, stringSizes, arg.a,
+                        arg.p, arg.s);
+            store_arguments(paramTypes, stringSizes, &in, arg.a, arg.p,
+                            arg.s);
+            ue->entrySize = downCast<uint32_t>(
+                                    in - reinterpret_cast<char*>(ue));
+        }
+
+        uint64_t compressedLogs = 0;
+        EXPECT_EQ(in - inBuffer, encoder.encodeLogMsgs(inBuffer,
+                        in - inBuffer, 0, false, dictionary, &compressedLogs));
+        EXPECT_EQ(2U, compressedLogs);
+
+        std::ofstream oFile;
+        oFile.open(testFile);
+        oFile.write(buffer, encoder.getEncodedBytes());
+        oFile.close();
+
+        // Without a formatter, the bytes are printed in hexadecimal
+        Log::Decoder dc;
+        Log::LogMessage logMsg;
+        ASSERT_TRUE(dc.open(testFile));
+        ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+        ASSERT_EQ(3, logMsg.getNumArgs());
+        EXPECT_EQ(1000, logMsg.get<int>(0));
+        EXPECT_EQ(0, strncmp("TestPrice{7d000000fe",
+                             logMsg.get<const char*>(1), 20));
+        EXPECT_STREQ("sym", logMsg.get<const char*>(2));
+
+        Log::Decoder::registerSerializer<TestPrice>();
+        ASSERT_TRUE(dc.open(testFile));
+        for (const Args &expected : args) {
+            ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+            ASSERT_EQ(3, logMsg.getNumArgs());
+            EXPECT_EQ(expected.a, logMsg.get<int>(0));
+            EXPECT_EQ(std::to_string(expected.p.mantissa) + "e" +
+                            std::to_string(expected.p.exponent),
+                      logMsg.get<const char*>(1));
+            EXPECT_STREQ(expected.s, logMsg.get<const char*>(2));
+        }
+        EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+
+        // The text is formatted like a string
+        FILE *output = tmpfile();
+        ASSERT_TRUE(dc.open(testFile));
+        dc.decompressUnordered(output);
+        rewind(output);
+        char line[1024];
+        ASSERT_NE(nullptr, fgets(line, sizeof(line), output));
+        EXPECT_NE(nullptr, strstr(line, "1000 [125e-2  ] sym\r\n"));
+        fclose(output);
+
+        // User-defined arguments can't be aggregated
+        Log::ArgumentBatch batch;
+        ASSERT_TRUE(dc.open(testFile));
+        testing::internal::CaptureStderr();
+        EXPECT_FALSE(dc.getNextArgumentBatch(0, 1, batch));
+        EXPECT_NE(std::string::npos, testing::internal::GetCapturedStderr()
+                                            .find("user-defined type"));
+        ASSERT_TRUE(dc.open(testFile));
+        ASSERT_TRUE(dc.getNextArgumentBatch(0, 0, batch));
+        ASSERT_EQ(2U, batch.size);
+        EXPECT_EQ(1001, batch.ints[1]);
+
+        Log::Decoder::registerArgumentFormatter("TestPrice", nullptr);
+    }
+
+    std::remove(testFile);
+}
+
+TEST_F(NanoLogCpp17Test, staticStrArgs_end2end) {
+    const char *testFile = "/tmp/testFile";
+    static constexpr std::array<ParamType, 3> paramTypes =
+                            analyzeFormatString<3>("%d [%-8s] %s");
+    constexpr uint64_t stringArgs = getStringArgMask(paramTypes);
+    const char *names[] = {nullptr, getSerializedTypeName<NanoLog::StaticStr>(),
+                           nullptr};
+    const char *format = tagSerializedArgs("%d [%-8s] %s", names, 3);
+    EXPECT_STREQ("%d [%{NanoLog::StaticStr}-8s] %s", format);
+
+    static const char *states[] = {"IDLE", "RUNNING"};
+    struct Args { int a; NanoLog::StaticStr state; const char *s; };
+    Args args[] = {{1000, NanoLog::StaticStr(states[0]), "sym"},
+                   {1001, NanoLog::StaticStr(states[1]), "sym"},
+                   {1002, NanoLog::StaticStr(states[0]), "sym"}};
+
+    // Every combination of compression function and delta encoding
+    for (int run = 0; run < 4; ++run) {
+        bool deltaEncoded = (run & 1);
+        StaticLogInfo::CompressionFn compressionFn =
+                        &compress<int, NanoLog::StaticStr, const char*>;
+        if (run & 2)
+            compressionFn = &compressArgs<stringArgs, int, NanoLog::StaticStr,
+                                          const char*>;
+
+        // The string's identifier takes a nibble
+        std::vector<StaticLogInfo> dictionary;
+        dictionary.emplace_back(compressionFn, "File", 10, NanoLog::NOTICE,
+                                format, 3, 2, paramTypes.data());
+
+        char inBuffer[1024], buffer[1024];
+        Log::Encoder encoder(buffer, sizeof(buffer), true, false,
+                             deltaEncoded);
+        ASSERT_TRUE(Log::insertCheckpoint(&encoder.writePos,
+                        encoder.endOfBuffer, false, sizeof(buffer),
+                        deltaEncoded ? Log::DELTA_ENCODED_ARGUMENTS : 0));
+
+        uint32_t currentPos = 0;
+        encoder.encodeNewDictionaryEntries(currentPos, dictionary);
+
+        char *in = inBuffer;
+        for (const Args &arg : args) {
+            auto *ue = reinterpret_cast<Log::UncompressedEntry*>(in);
+            in += sizeof(Log::UncompressedEntry);
+            ue->fmtId = 0;
+            ue->timestamp = 10;
+
+            size_t stringSizes[3];
+            uint64_t previousPrecision = -1;
+            getArgSizes(paramTypes, previousPrecision, stringSizes, arg.a,
+                        arg.state, arg.s);
+            store_arguments(paramTypes, stringSizes, &in, arg.a, arg.state,
+                            arg.s);
+            ue->entrySize = downCast<uint32_t>(
+                                    in - reinterpret_cast<char*>(ue));
+        }
+
+        // Only the address of the string is logged
+        EXPECT_EQ(3*(sizeof(Log::UncompressedEntry) + sizeof(int)
+                        + sizeof(NanoLog::StaticStr) + sizeof(uint32_t) + 3),
+                  size_t(in - inBuffer));
+
+        // The strings are written out once, before the first log messages
+        // that refer to them
+        uint64_t compressedLogs = 0;
+        EXPECT_EQ(in - inBuffer, encoder.encodeLogMsgs(inBuffer,
+                        in - inBuffer, 0, false, dictionary, &compressedLogs));
+        EXPECT_EQ(3U, compressedLogs);
+        EXPECT_EQ(2U, encoder.staticStrings.numPersisted);
+        EXPECT_EQ(3U, encoder.extentsEncoded);
+
+        size_t encodedBytes = encoder.getEncodedBytes();
+        EXPECT_EQ(in - inBuffer, encoder.encodeLogMsgs(inBuffer,
+                        in - inBuffer, 1, false, dictionary, &compressedLogs));
+        EXPECT_EQ(4U, encoder.extentsEncoded);
+        EXPECT_GT(encodedBytes + 40, encoder.getEncodedBytes());
+
+        std::ofstream oFile;
+        oFile.open(testFile);
+        oFile.write(buffer, encoder.getEncodedBytes());
+        oFile.close();
+
+        Log::Decoder dc;
+        Log::LogMessage logMsg;
+        ASSERT_TRUE(dc.open(testFile));
+        for (int i = 0; i < 6; ++i) {
+            const Args &expected = args[i % 3];
+            ASSERT_TRUE(dc.getNextLogStatement(logMsg));
+            ASSERT_EQ(3, logMsg.getNumArgs());
+            EXPECT_EQ(expected.a, logMsg.get<int>(0));
+            EXPECT_STREQ(expected.state.str, logMsg.get<const char*>(1));
+            EXPECT_STREQ(expected.s, logMsg.get<const char*>(2));
+        }
+        EXPECT_FALSE(dc.getNextLogStatement(logMsg));
+        EXPECT_EQ(2U, dc.staticStrings.size());
+
+        // The text is formatted like a string
+        FILE *output = tmpfile();
+        ASSERT_TRUE(dc.open(testFile));
+        EXPECT_EQ(6, dc.decompressTo(output));
+        rewind(output);
+        char text[4096];
+        text[fread(text, 1, sizeof(text) - 1, output)] = '\0';
+        EXPECT_NE(nullptr, strstr(text, "1000 [IDLE    ] sym\r\n"));
+        EXPECT_NE(nullptr, strstr(text, "1001 [RUNNING ] sym\r\n"));
+        fclose(output);
+
+        // Static strings can't be aggregated
+        Log::ArgumentBatch batch;
+        ASSERT_TRUE(dc.open(testFile));
+        testing::internal::CaptureStderr();
+        EXPECT_FALSE(dc.getNextArgumentBatch(0, 1, batch));
+        EXPECT_NE(std::string::npos, testing::internal::GetCapturedStderr()
+                                            .find("is a string"));
+        ASSERT_TRUE(dc.open(testFile));
+        ASSERT_TRUE(dc.getNextArgumentBatch(0, 0, batch));
+        ASSERT_EQ(6U, batch.size);
+        EXPECT_EQ(1002, batch.ints[5]);
+    }
+
+    std::remove(testFile);
+}
+
 }; //namespace
\ No newline at end of file
@@ -13,12 +13,20 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
 #include "gtest/gtest.h"
 
 #include "TestUtil.h"
 
+#include "GeneratedCode.h"
 #include "RuntimeLogger.h"
 
+extern int __fmtId__Simple32log32message32with32032parameters__testHelper47client46cc__20__;
+
 namespace {
 using namespace NanoLogInternal;
 using namespace PerfUtils;
@@ -75,10 +83,12 @@ TEST_F(NanoLogTest, StagingBuffer_reserveProducerSpace)
     EXPECT_EQ(sb->storage, sb->reserveProducerSpace(100));
     EXPECT_EQ(sb->minFreeSpace, bufferSize);
 
-    // Mimic running out of minFreeSpace
+    // Mimic running out of minFreeSpace; the slow path caps the free space
+    // so that the producer returns to it after a fraction of the buffer.
     sb->minFreeSpace = 0;
     EXPECT_EQ(sb->storage, sb->reserveProducerSpace(100));
-    EXPECT_EQ(bufferSize, sb->minFreeSpace);
+    EXPECT_EQ(100 + bufferSize/NanoLogConfig::WAKEUP_THRESHOLD_DIVISOR,
+              sb->minFreeSpace);
 
     // Roll over tests are done in reserveSpaceInternal
 }
@@ -136,6 +146,44 @@ TEST_F(NanoLogTest, StagingBuffer_reserveSpaceInternal)
     EXPECT_EQ(101U, sb->minFreeSpace);
 }
 
+TEST_F(NanoLogTest, StagingBuffer_reserveSpaceInternal_waits)
+{
+    // No waiting when there's space
+    EXPECT_EQ(sb->storage, sb->reserveSpaceInternal(100));
+    EXPECT_EQ(0U, sb->numWaitsForSpace);
+
+    // Failed non-blocking reservations don't count either
+    sb->minFreeSpace = 0;
+    sb->producerPos = sb->storage + halfSize;
+    sb->consumerPos = sb->storage + halfSize + 50;
+    EXPECT_EQ(nullptr, sb->reserveSpaceInternal(100, false));
+    EXPECT_EQ(0U, sb->numWaitsForSpace);
+
+    // The producer waits until the consumer frees up space
+    std::thread consumer([this] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        sb->consume(100);
+    });
+    EXPECT_EQ(sb->producerPos, sb->reserveSpaceInternal(100));
+    consumer.join();
+    EXPECT_EQ(1U, sb->numWaitsForSpace);
+    EXPECT_LE(Cycles::fromNanoseconds(500000), sb->cyclesWaitingForSpace);
+}
+
+TEST_F(NanoLogTest, StagingBuffer_getBytesQueued)
+{
+    EXPECT_EQ(0U, sb->getBytesQueued());
+
+    sb->producerPos = sb->storage + 100;
+    EXPECT_EQ(100U, sb->getBytesQueued());
+
+    // Rolled over, but not consumed up to the end of the recorded space yet
+    sb->consumerPos = sb->storage + halfSize;
+    sb->endOfRecordedSpace = sb->storage + halfSize + 200;
+    sb->producerPos = sb->storage + 50;
+    EXPECT_EQ(250U, sb->getBytesQueued());
+}
+
 TEST_F(NanoLogTest, StagingBuffer_reserveSpaceInternal_rollover_prevention)
 {
     // Setup the situation where the consumer is at position 0 and the producer
@@ -197,7 +245,7 @@ TEST_F(NanoLogTest, StagingBuffer_finishReservation_asserts) {
 
     // Case 2: Don't fall of the end (indicates bug in library code)
     sb->minFreeSpace = 2*bufferSize;
-    EXPECT_DEATH(sb->finishReservation(bufferSize), "BUFFER_SIZE");
+    EXPECT_DEATH(sb->finishReservation(bufferSize), "capacity");
 
     // Case 3: The producer somehow passes the consumer location (library bug)
     sb->producerPos = sb->storage + halfSize - 50;
@@ -267,4 +315,846 @@ TEST_F(NanoLogTest, StagingBuffer_peek) {
     sb->peek(&bytesAvailable);
     EXPECT_EQ(10U, bytesAvailable);
 }
+
+TEST_F(NanoLogTest, InvocationSiteTable_append) {
+    static const ParamType noParams[1] = {};
+    RuntimeLogger::InvocationSiteTable *table =
+                                    new RuntimeLogger::InvocationSiteTable();
+    EXPECT_EQ(0U, table->size());
+
+    const uint32_t numEntries = 2500;  // Spans multiple chunks
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([table, numEntries]() {
+            for (uint32_t i = 0; i < numEntries/4 + (numEntries % 4); ++i) {
+                table->append(StaticLogInfo(nullptr, "file.cc", i, NOTICE,
+                                            "fmt", 0, 0, noParams));
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    ASSERT_EQ(4*(numEntries/4 + (numEntries % 4)), table->size());
+    uint32_t lineSum = 0;
+    for (uint32_t i = 0; i < table->size(); ++i) {
+        EXPECT_STREQ("file.cc", (*table)[i].filename);
+        lineSum += (*table)[i].lineNum;
+    }
+
+    uint32_t perThread = numEntries/4 + (numEntries % 4);
+    EXPECT_EQ(4*(perThread*(perThread - 1)/2), lineSum);
+    delete table;
+}
+
+TEST_F(NanoLogTest, InvocationSiteTable_appendReturnsIndex) {
+    static const ParamType noParams[1] = {};
+    RuntimeLogger::InvocationSiteTable table;
+
+    EXPECT_EQ(0U, table.append(StaticLogInfo(nullptr, "a.cc", 1, NOTICE,
+                                             "A", 0, 0, noParams)));
+    EXPECT_EQ(1U, table.append(StaticLogInfo(nullptr, "b.cc", 2, ERROR,
+                                             "B", 0, 0, noParams)));
+    EXPECT_EQ(2U, table.size());
+    EXPECT_STREQ("A", table[0].formatString);
+    EXPECT_STREQ("b.cc", table[1].filename);
+    EXPECT_EQ(ERROR, table[1].severity);
+}
+TEST_F(NanoLogTest, getOutputFileName) {
+    EXPECT_EQ("/tmp/log", RuntimeLogger::getOutputFileName("/tmp/log", 0));
+    EXPECT_EQ("/tmp/log.1", RuntimeLogger::getOutputFileName("/tmp/log", 1));
+    EXPECT_EQ("log.12", RuntimeLogger::getOutputFileName("log", 12));
+}
+
+TEST_F(NanoLogTest, openOutputFile) {
+    const char *testFile = "/tmp/NanoLogTest_openOutputFile";
+    std::remove(testFile);
+
+    int fd = RuntimeLogger::openOutputFile(testFile, DURABILITY_PER_BUFFER);
+    ASSERT_LE(0, fd);
+    EXPECT_EQ(O_DSYNC, fcntl(fd, F_GETFL) & (O_DSYNC|O_DIRECT));
+    ASSERT_EQ(5, write(fd, "hello", 5));
+    close(fd);
+
+    fd = RuntimeLogger::openOutputFile(testFile, DURABILITY_PERIODIC);
+    ASSERT_LE(0, fd);
+    EXPECT_EQ(0, fcntl(fd, F_GETFL) & (O_DSYNC|O_DIRECT));
+    close(fd);
+
+    // Some file systems (i.e. tmpfs) don't support O_DIRECT
+    fd = RuntimeLogger::openOutputFile(testFile, DURABILITY_DIRECT);
+    if (fd >= 0) {
+        EXPECT_EQ(O_DIRECT, fcntl(fd, F_GETFL) & (O_DSYNC|O_DIRECT));
+        EXPECT_EQ(NanoLogConfig::DIRECT_IO_ALIGNMENT,
+                  lseek(fd, 0, SEEK_END));
+        close(fd);
+    }
+
+    std::remove(testFile);
+}
+
+TEST_F(NanoLogTest, CompressionWorker_flushOutputFile) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    RuntimeLogger::setDurability(DURABILITY_PERIODIC, 10, 1000);
+    EXPECT_STREQ("periodic", RuntimeLogger::getDurabilityName());
+
+    auto *worker = logger.workers.at(0);
+    worker->stop();
+    uint32_t numSyncs = worker->numSyncs;
+
+    // The restarted worker may have written its checkpoint already
+    worker->bytesWrittenSinceSync = 0;
+    EXPECT_FALSE(worker->periodicSyncDue());
+
+    // Either limit makes the flush due
+    worker->bytesWrittenSinceSync = 999;
+    worker->cyclesAtUnsyncedWrite = Cycles::rdtsc();
+    EXPECT_FALSE(worker->periodicSyncDue());
+    worker->bytesWrittenSinceSync = 1000;
+    EXPECT_TRUE(worker->periodicSyncDue());
+
+    worker->bytesWrittenSinceSync = 1;
+    worker->cyclesAtUnsyncedWrite -= Cycles::fromSeconds(0.011);
+    EXPECT_TRUE(worker->periodicSyncDue());
+
+    worker->flushOutputFile();
+    EXPECT_EQ(numSyncs + 1, worker->numSyncs);
+    EXPECT_EQ(0U, worker->bytesWrittenSinceSync);
+    EXPECT_FALSE(worker->periodicSyncDue());
+
+    // Nothing to flush
+    worker->flushOutputFile();
+    EXPECT_EQ(numSyncs + 1, worker->numSyncs);
+    worker->start();
+
+    // The interval defaults when neither limit is given
+    RuntimeLogger::setDurability(DURABILITY_PERIODIC, 0, 0);
+    EXPECT_EQ(NanoLogConfig::DEFAULT_SYNC_INTERVAL_MS,
+              RuntimeLogger::getSyncIntervalMs());
+
+    // The flushes are left to the operating system in the other modes
+    RuntimeLogger::setDurability(DURABILITY_NONE, 10, 10);
+    EXPECT_EQ(0U, RuntimeLogger::getSyncIntervalMs());
+    worker = logger.workers.at(0);
+    worker->stop();
+    worker->bytesWrittenSinceSync = 1000;
+    EXPECT_FALSE(worker->periodicSyncDue());
+    worker->flushOutputFile();
+    EXPECT_EQ(0U, worker->numSyncs);
+    worker->bytesWrittenSinceSync = 0;
+    worker->start();
+
+    RuntimeLogger::setDurability(DURABILITY_PER_BUFFER, 0, 0);
+    EXPECT_STREQ("per-buffer", RuntimeLogger::getDurabilityName());
+}
+
+TEST_F(NanoLogTest, CompressionWorker_recordWritesCompleted) {
+    auto *worker = RuntimeLogger::nanoLogSingleton.workers.at(0);
+    worker->stop();
+    uint64_t numWrites = worker->writeLatencyDist[10];
+    uint32_t oldest = worker->oldestWriteInFlight;
+
+    // 600 µs falls into the [512, 1024) µs bucket
+    worker->cyclesAtWriteSubmit[oldest] =
+                        Cycles::rdtsc() - Cycles::fromNanoseconds(600000);
+    worker->recordWritesCompleted(1);
+    EXPECT_EQ(numWrites + 1, worker->writeLatencyDist[10]);
+    EXPECT_EQ((oldest + 1) % worker->cyclesAtWriteSubmit.size(),
+              worker->oldestWriteInFlight);
+    EXPECT_EQ(0U, worker->numWritesInFlight);
+    worker->start();
+}
+
+TEST_F(NanoLogTest, CompressionWorker_discardOldestLogMsgs) {
+    auto *worker = RuntimeLogger::nanoLogSingleton.workers.at(0);
+    worker->stop();
+    uint64_t logsDiscarded = worker->logsDiscarded;
+
+    // Fill 3/4 of the buffer with log messages
+    uint32_t entrySize = bufferSize/8;
+    for (int i = 0; i < 6; ++i) {
+        char *pos = sb->reserveSpaceInternal(entrySize);
+        reinterpret_cast<Log::UncompressedEntry*>(pos)->entrySize = entrySize;
+        sb->finishReservation(entrySize);
+    }
+
+    // The oldest ones are discarded until half of the buffer is left
+    uint64_t peekBytes = 0;
+    char *peekPosition = sb->peek(&peekBytes);
+    worker->discardOldestLogMsgs(sb, peekPosition, peekBytes);
+    EXPECT_EQ(sb->storage + 2*entrySize, sb->consumerPos);
+    EXPECT_EQ(logsDiscarded + 2, worker->logsDiscarded);
+
+    // Nothing more to discard
+    peekPosition = sb->peek(&peekBytes);
+    worker->discardOldestLogMsgs(sb, peekPosition, peekBytes);
+    EXPECT_EQ(sb->storage + 2*entrySize, sb->consumerPos);
+    worker->start();
+}
+
+TEST_F(NanoLogTest, crashFlush) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    const char *testFile = "/tmp/testCrashLog";
+    std::remove(testFile);
+
+    // Nothing to dump to until the handler is installed
+    EXPECT_EQ(0U, RuntimeLogger::crashFlush());
+
+    struct sigaction previousAction;
+    sigaction(SIGSEGV, nullptr, &previousAction);
+    RuntimeLogger::installCrashHandler(testFile);
+    EXPECT_STREQ(testFile, RuntimeLogger::getCrashLogFile());
+    ASSERT_NE(nullptr, logger.crashDictionary.load());
+    EXPECT_LE(1024U, logger.crashDictionary.load()->capacity());
+
+    auto *worker = logger.workers.at(0);
+    worker->stop();
+    worker->threadBuffers.push_back(sb);
+
+    // Two log messages followed by a malformed one that's left out
+    int fmtId =
+        __fmtId__Simple32log32message32with32032parameters__testHelper47client46cc__20__;
+    for (int i = 0; i < 3; ++i) {
+        char *pos = sb->reserveSpaceInternal(sizeof(Log::UncompressedEntry));
+        auto *ue = reinterpret_cast<Log::UncompressedEntry*>(pos);
+        ue->fmtId = fmtId;
+        ue->timestamp = Cycles::rdtsc();
+        ue->entrySize = (i < 2) ? sizeof(Log::UncompressedEntry) : 0;
+        sb->finishReservation(sizeof(Log::UncompressedEntry));
+    }
+
+    EXPECT_EQ(2U, RuntimeLogger::crashFlush());
+
+    // The messages are left for the compression thread
+    EXPECT_EQ(3*sizeof(Log::UncompressedEntry), sb->getBytesQueued());
+    worker->threadBuffers.pop_back();
+    worker->start();
+
+    Log::Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    FILE *out = fopen("/dev/null", "w");
+    EXPECT_EQ(2, dc.decompressUnordered(out));
+    fclose(out);
+
+    sigaction(SIGSEGV, &previousAction, nullptr);
+    for (int signo : {SIGBUS, SIGFPE, SIGILL, SIGABRT})
+        signal(signo, SIG_DFL);
+    close(logger.crashFd);
+    logger.crashFd = -1;
+    logger.crashLogFile.clear();
+    std::remove(testFile);
+}
+
+TEST_F(NanoLogTest, getMetrics) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    for (auto *worker : logger.workers)
+        worker->stop();
+    auto *worker = logger.workers.at(0);
+
+    NanoLog::Metrics before, after;
+    RuntimeLogger::getMetrics(&before);
+    EXPECT_EQ(logger.workers.size(), before.numCompressionThreads);
+    EXPECT_EQ(logger.workers.size()*(logger.numOutputBuffers - 1),
+              before.writeQueueDepth);
+    EXPECT_EQ(0U, before.writesInFlight);
+
+    // The workers' metrics are summed up and converted to nanoseconds
+    worker->logsProcessed += 5;
+    worker->cyclesSyncing += Cycles::fromNanoseconds(2000000);
+    ++worker->writeLatencyDist[3];
+    worker->retiredAllocations += 7;
+    RuntimeLogger::getMetrics(&after);
+    EXPECT_EQ(before.logsProcessed + 5, after.logsProcessed);
+    EXPECT_NEAR(2000000.0, double(after.syncNs - before.syncNs), 1000.0);
+    EXPECT_EQ(before.writeLatencyDist[3] + 1, after.writeLatencyDist[3]);
+    EXPECT_EQ(before.allocations + 7, after.allocations);
+
+    // Every StagingBuffer is reported, even if the array is too small
+    uint32_t numBuffers = after.numStagingBuffers;
+    std::vector<NanoLog::ThreadMetrics> threads(numBuffers + 1);
+    EXPECT_EQ(numBuffers,
+              RuntimeLogger::getThreadMetrics(threads.data(), numBuffers + 1));
+    EXPECT_EQ(numBuffers, RuntimeLogger::getThreadMetrics(nullptr, 0));
+    for (uint32_t i = 0; i < numBuffers; ++i)
+        EXPECT_LT(0U, threads[i].capacity);
+
+    for (auto *worker : logger.workers)
+        worker->start();
+}
+
+TEST_F(NanoLogTest, getLogSiteMetrics) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    for (auto *worker : logger.workers)
+        worker->stop();
+    auto *worker = logger.workers.at(0);
+
+    // Simulates the stats of a build with -DRECORD_LOG_SITE_STATS, starting
+    // from a clean slate if this is one
+    const uint32_t numStats = NanoLogConfig::MAX_LOG_SITE_STATS + 1;
+    std::vector<std::vector<uint64_t>> savedBytes;
+    std::vector<std::vector<RuntimeLogger::LogSiteStats>> savedStats;
+    for (auto *w : logger.workers) {
+        savedBytes.push_back(w->logSiteCompressedBytes);
+        savedStats.push_back(w->retiredLogSiteStats);
+        w->logSiteCompressedBytes.assign(numStats, 0);
+        w->retiredLogSiteStats.assign(numStats, {});
+        for (RuntimeLogger::StagingBuffer *buffer : w->threadBuffers) {
+            if (buffer->logSiteStats != nullptr)
+                std::fill(buffer->logSiteStats,
+                          buffer->logSiteStats + numStats,
+                          RuntimeLogger::LogSiteStats());
+        }
+    }
+
+    auto *buffer = new RuntimeLogger::StagingBuffer(97, 4096);
+    if (buffer->logSiteStats == nullptr)
+        buffer->logSiteStats = new RuntimeLogger::LogSiteStats[numStats]();
+    worker->threadBuffers.push_back(buffer);
+
+    buffer->recordLogSite(1, 100, Cycles::fromNanoseconds(1000), 0);
+    buffer->recordLogSite(1, 100, 0, Cycles::fromNanoseconds(500));
+    buffer->recordLogSite(numStats + 5, 10, 0, 0);
+    worker->retiredLogSiteStats[2].invocations = 1;
+    worker->retiredLogSiteStats[2].bytesStaged = 150;
+    worker->logSiteCompressedBytes[1] = 40;
+    worker->logSiteCompressedBytes[3] = 7;
+
+    // Ordered by the bytes staged; sites that only compressed bytes come last
+    NanoLog::LogSiteMetrics sites[5];
+    ASSERT_EQ(4U, RuntimeLogger::getLogSiteMetrics(sites, 5));
+    EXPECT_EQ(1U, sites[0].logId);
+    EXPECT_EQ(2U, sites[0].invocations);
+    EXPECT_EQ(200U, sites[0].bytesStaged);
+    EXPECT_EQ(40U, sites[0].compressedBytes);
+    EXPECT_NEAR(1000.0, double(sites[0].reserveNs), 10.0);
+    EXPECT_NEAR(500.0, double(sites[0].finishNs), 10.0);
+    EXPECT_STREQ(GeneratedFunctions::logId2Metadata[1].fileName,
+                 sites[0].filename);
+    EXPECT_EQ(GeneratedFunctions::logId2Metadata[1].lineNumber,
+              sites[0].line);
+    EXPECT_STREQ(GeneratedFunctions::logId2Metadata[1].fmtString,
+                 sites[0].format);
+
+    EXPECT_EQ(2U, sites[1].logId);
+    EXPECT_EQ(150U, sites[1].bytesStaged);
+
+    // Sites past the ones tracked individually are counted together
+    EXPECT_EQ(UINT32_MAX, sites[2].logId);
+    EXPECT_EQ(10U, sites[2].bytesStaged);
+    EXPECT_STREQ("", sites[2].filename);
+
+    EXPECT_EQ(3U, sites[3].logId);
+    EXPECT_EQ(0U, sites[3].invocations);
+    EXPECT_EQ(7U, sites[3].compressedBytes);
+
+    // Every site is counted, even if the array is too small
+    EXPECT_EQ(4U, RuntimeLogger::getLogSiteMetrics(sites, 1));
+    EXPECT_EQ(1U, sites[0].logId);
+
+    worker->threadBuffers.pop_back();
+    delete buffer;
+    for (size_t i = 0; i < logger.workers.size(); ++i) {
+        logger.workers[i]->logSiteCompressedBytes = savedBytes[i];
+        logger.workers[i]->retiredLogSiteStats = savedStats[i];
+    }
+
+    for (auto *worker : logger.workers)
+        worker->start();
+}
+
+TEST_F(NanoLogTest, createChannel) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    const char *testFile = "/tmp/NanoLogTest_channel";
+    std::remove(testFile);
+
+    NanoLog::Channel channel = RuntimeLogger::createChannel("test", testFile);
+    EXPECT_NE(NanoLog::DEFAULT_CHANNEL, channel);
+    EXPECT_EQ(channel, RuntimeLogger::createChannel("test", "/tmp/ignored"));
+    EXPECT_EQ(NanoLog::NOTICE, RuntimeLogger::getLogLevel(channel));
+    EXPECT_THROW(logger.getChannel(NanoLogConfig::MAX_LOG_CHANNELS),
+                 std::logic_error);
+    EXPECT_THROW(logger.getChannel(NanoLog::DEFAULT_CHANNEL),
+                 std::logic_error);
+
+    RuntimeLogger::setChannelDurability(channel, NanoLog::DURABILITY_NONE, 0, 0);
+    RuntimeLogger::setChannelLogLevel(channel, NanoLog::DEBUG);
+    RuntimeLogger::setChannelDropOnFull(channel, NanoLog::WARNING);
+    RuntimeLogger::LogChannel *logChannel = logger.getChannel(channel);
+    EXPECT_EQ(NanoLog::DURABILITY_NONE, logChannel->durability);
+    EXPECT_EQ(NanoLog::DEBUG, RuntimeLogger::getLogLevel(channel));
+    EXPECT_EQ(NanoLog::WARNING, logChannel->dropLogLevel);
+    EXPECT_NE(NanoLog::DEBUG, RuntimeLogger::getLogLevel());
+
+    // The channel's messages are output by its own worker to its own file
+    uint64_t defaultLogs = 0;
+    for (auto *worker : logger.workers)
+        defaultLogs += worker->logsProcessed;
+    std::thread producer([channel] {
+        uint32_t size = sizeof(Log::UncompressedEntry);
+        char *pos = RuntimeLogger::reserveAlloc(size, NanoLog::NOTICE,
+                                                channel);
+        auto *ue = reinterpret_cast<Log::UncompressedEntry*>(pos);
+        ue->fmtId =
+        __fmtId__Simple32log32message32with32032parameters__testHelper47client46cc__20__;
+        ue->timestamp = Cycles::rdtsc();
+        ue->entrySize = size;
+        RuntimeLogger::finishAlloc(size, channel);
+    });
+    producer.join();
+    RuntimeLogger::sync();
+
+    EXPECT_EQ(1U, logChannel->worker->logsProcessed);
+    uint64_t defaultLogsAfter = 0;
+    for (auto *worker : logger.workers)
+        defaultLogsAfter += worker->logsProcessed;
+    EXPECT_EQ(defaultLogs, defaultLogsAfter);
+
+    NanoLog::Metrics metrics;
+    RuntimeLogger::getMetrics(&metrics);
+    EXPECT_EQ(logger.workers.size() + 1, metrics.numCompressionThreads);
+
+    Log::Decoder dc;
+    ASSERT_TRUE(dc.open(testFile));
+    FILE *out = fopen("/dev/null", "w");
+    EXPECT_EQ(1, dc.decompressUnordered(out));
+    fclose(out);
+
+    logger.destroyChannels();
+    EXPECT_THROW(logger.getChannel(channel), std::logic_error);
+    EXPECT_EQ(RuntimeLogger::getLogLevel(),
+              RuntimeLogger::getLogLevel(channel));
+    std::remove(testFile);
+}
+
+TEST_F(NanoLogTest, getRotatedFileName) {
+    const char *testFile = "/tmp/NanoLogTest_getRotatedFileName";
+    struct tm localTime = {};
+    localTime.tm_year = 120;
+    localTime.tm_mon = 1;
+    localTime.tm_mday = 3;
+    localTime.tm_hour = 4;
+    localTime.tm_min = 5;
+    localTime.tm_sec = 6;
+    localTime.tm_isdst = -1;
+    time_t rotationTime = mktime(&localTime);
+
+    std::string rotatedName = std::string(testFile) + ".20200203-040506";
+    EXPECT_EQ(rotatedName,
+              RuntimeLogger::getRotatedFileName(testFile, rotationTime));
+
+    // Existing files are not clobbered
+    std::ofstream(rotatedName.c_str()) << "x";
+    std::ofstream((rotatedName + ".1").c_str()) << "x";
+    EXPECT_EQ(rotatedName + ".2",
+              RuntimeLogger::getRotatedFileName(testFile, rotationTime));
+
+    std::remove(rotatedName.c_str());
+    std::remove((rotatedName + ".1").c_str());
+}
+
+TEST_F(NanoLogTest, CompressionWorker_rotateOutputFile) {
+    const char *testFile = "/tmp/NanoLogTest_rotateOutputFile";
+    std::remove(testFile);
+
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    std::string originalLogFile = logger.logFile;
+    RuntimeLogger::setLogFile(testFile);
+
+    auto *worker = logger.workers.at(0);
+    worker->stop();
+    EXPECT_FALSE(worker->shouldRotateOutputFile());
+
+    // Either limit triggers the rotation
+    RuntimeLogger::setLogRotation(100, 0);
+    worker->outputFileOffset = 99;
+    EXPECT_FALSE(worker->shouldRotateOutputFile());
+    worker->outputFileOffset = 100;
+    EXPECT_TRUE(worker->shouldRotateOutputFile());
+
+    RuntimeLogger::setLogRotation(0, 1);
+    EXPECT_FALSE(worker->shouldRotateOutputFile());
+    worker->cyclesAtOutputFileStart -= Cycles::fromSeconds(1.1);
+    EXPECT_TRUE(worker->shouldRotateOutputFile());
+
+    ASSERT_EQ(11, write(worker->outputFd, "old content", 11));
+    off_t oldSize = lseek(worker->outputFd, 0, SEEK_END);
+    int oldFd = worker->outputFd;
+    std::string rotatedName = RuntimeLogger::getRotatedFileName(testFile,
+                                                            std::time(nullptr));
+
+    ASSERT_TRUE(worker->rotateOutputFile());
+    EXPECT_NE(oldFd, worker->outputFd);
+    EXPECT_EQ(1U, worker->numRotations);
+    EXPECT_EQ(0U, worker->outputFileOffset);
+    EXPECT_EQ(0U, worker->checkpointOffset);
+    EXPECT_TRUE(worker->retiredOutputFds.empty());
+    EXPECT_FALSE(worker->shouldRotateOutputFile());
+
+    // The old contents moved along with the index
+    struct stat st;
+    ASSERT_EQ(0, stat(rotatedName.c_str(), &st));
+    EXPECT_EQ(oldSize, st.st_size);
+    EXPECT_EQ(0, access((rotatedName + Log::INDEX_FILE_SUFFIX).c_str(), F_OK));
+    EXPECT_EQ(0, lseek(worker->outputFd, 0, SEEK_END));
+    EXPECT_EQ(0, access((std::string(testFile) +
+                        Log::INDEX_FILE_SUFFIX).c_str(), F_OK));
+
+    // Failures disable the rotation
+    logger.logFile = "/tmp/NanoLogTest_missingDir/log";
+    EXPECT_FALSE(worker->rotateOutputFile());
+    EXPECT_TRUE(worker->rotationFailed);
+    EXPECT_FALSE(worker->shouldRotateOutputFile());
+    logger.logFile = testFile;
+
+    RuntimeLogger::setLogRotation(0, 0);
+    worker->start();
+    RuntimeLogger::setLogFile(originalLogFile.c_str());
+
+    std::remove(rotatedName.c_str());
+    std::remove((rotatedName + Log::INDEX_FILE_SUFFIX).c_str());
+    std::remove(testFile);
+    std::remove((std::string(testFile) + Log::INDEX_FILE_SUFFIX).c_str());
+}
+
+TEST_F(NanoLogTest, StagingBuffer_capacity) {
+    RuntimeLogger::StagingBuffer small(2, 4096);
+    EXPECT_EQ(4096U, small.getCapacity());
+    EXPECT_EQ(4096U, small.minFreeSpace);
+    EXPECT_EQ(small.storage + 4096, small.endOfRecordedSpace);
+
+    // Fill up the end of the buffer and roll over to the front
+    char *pos = small.reserveProducerSpace(4000);
+    EXPECT_EQ(small.storage, pos);
+    small.finishReservation(4000);
+    small.consume(4000);
+    EXPECT_EQ(small.storage, small.reserveSpaceInternal(200, false));
+    EXPECT_EQ(small.storage + 4000, small.endOfRecordedSpace);
+
+    small.producerPos = small.consumerPos = small.storage;
+}
+
+TEST_F(NanoLogTest, StagingBuffer_allocateStorage) {
+    size_t mappedBytes = 0;
+    char *storage = RuntimeLogger::StagingBuffer::allocateStorage(10000,
+                                                                  &mappedBytes);
+    ASSERT_NE(nullptr, storage);
+    EXPECT_EQ(10000U, mappedBytes);
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(storage) % 4096);
+    for (int i = 0; i < 10000; ++i)
+        ASSERT_EQ(0, storage[i]);
+
+    storage[9999] = 'a';
+    RuntimeLogger::StagingBuffer::freeStorage(storage, mappedBytes);
+}
+
+TEST_F(NanoLogTest, mapBuffer_hugePages) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    logger.hugePages = NanoLog::HUGE_PAGES_2MB;
+
+    // Buffers smaller than half a huge page aren't rounded up
+    size_t bytes = 10000;
+    char *buffer = RuntimeLogger::mapBuffer(&bytes);
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_EQ(10000U, bytes);
+    RuntimeLogger::unmapBuffer(buffer, bytes);
+
+    // Larger ones use the reserved huge pages if there are any left, or
+    // transparent huge pages otherwise
+    bytes = 1500000;
+    buffer = RuntimeLogger::mapBuffer(&bytes);
+    ASSERT_NE(nullptr, buffer);
+    EXPECT_TRUE(bytes == 1500000U || bytes == (2U << 20));
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(buffer) % 4096);
+    buffer[1499999] = 'a';
+    RuntimeLogger::unmapBuffer(buffer, bytes);
+    logger.hugePages = NanoLog::HUGE_PAGES_NONE;
+
+    // The workers remap their output buffers
+    RuntimeLogger::setHugePages(NanoLog::HUGE_PAGES_TRANSPARENT);
+    EXPECT_STREQ("transparent", RuntimeLogger::getHugePagesName());
+    ASSERT_FALSE(logger.workers.empty());
+    EXPECT_EQ(logger.outputBufferSize,
+              logger.workers.at(0)->outputBufferMappedSize);
+    RuntimeLogger::setHugePages(NanoLog::HUGE_PAGES_NONE);
+    EXPECT_STREQ("off", RuntimeLogger::getHugePagesName());
+}
+
+TEST_F(NanoLogTest, CompressionWorker_addStagingBuffer) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+    for (auto *worker : logger.workers)
+        worker->stop();
+
+    RuntimeLogger::StagingBuffer *first =
+                                    new RuntimeLogger::StagingBuffer(98, 4096);
+    RuntimeLogger::StagingBuffer *second =
+                                    new RuntimeLogger::StagingBuffer(99, 4096);
+    auto *worker = logger.workers.at(0);
+    uint32_t numBuffers = worker->numThreadBuffers;
+    size_t numAdopted = worker->threadBuffers.size();
+
+    worker->addStagingBuffer(first);
+    worker->addStagingBuffer(second);
+    EXPECT_EQ(numBuffers + 2, worker->numThreadBuffers);
+    EXPECT_EQ(second, worker->newThreadBuffers.load());
+    EXPECT_EQ(first, second->nextNewBuffer);
+    EXPECT_EQ(numAdopted, worker->threadBuffers.size());
+
+    worker->adoptNewStagingBuffers();
+    EXPECT_EQ(nullptr, worker->newThreadBuffers.load());
+    EXPECT_EQ(nullptr, second->nextNewBuffer);
+    ASSERT_EQ(numAdopted + 2, worker->threadBuffers.size());
+    EXPECT_EQ(first, worker->threadBuffers.back());
+
+    // The compression thread deletes them once they're abandoned
+    first->shouldDeallocate = second->shouldDeallocate = true;
+    for (auto *worker : logger.workers)
+        worker->start();
+
+    uint64_t deadline = Cycles::rdtsc() + Cycles::fromSeconds(1);
+    while (worker->numThreadBuffers != numBuffers &&
+                    Cycles::rdtsc() < deadline);
+    EXPECT_EQ(numBuffers, worker->numThreadBuffers);
+}
+
+TEST_F(NanoLogTest, setBackgroundThreadAffinity) {
+    cpu_set_t cpus;
+    pthread_t thread = RuntimeLogger::nanoLogSingleton.workers.at(0)->
+                                            compressionThread.native_handle();
+
+    RuntimeLogger::setBackgroundThreadAffinity({0});
+    ASSERT_EQ(0, pthread_getaffinity_np(thread, sizeof(cpus), &cpus));
+    EXPECT_EQ(1, CPU_COUNT(&cpus));
+    EXPECT_TRUE(CPU_ISSET(0, &cpus));
+
+    // Invalid cores are rejected
+    RuntimeLogger::setBackgroundThreadAffinity({-1});
+    EXPECT_EQ(1U, RuntimeLogger::nanoLogSingleton.backgroundThreadCores.size());
+
+    RuntimeLogger::setBackgroundThreadAffinity({});
+    ASSERT_EQ(0, pthread_getaffinity_np(thread, sizeof(cpus), &cpus));
+    EXPECT_TRUE(CPU_EQUAL(&cpus,
+                          &RuntimeLogger::nanoLogSingleton.defaultAffinity));
+}
+
+TEST_F(NanoLogTest, setBackgroundThreadScheduling) {
+    int policy;
+    struct sched_param param;
+    pthread_t thread = RuntimeLogger::nanoLogSingleton.workers.at(0)->
+                                            compressionThread.native_handle();
+
+    RuntimeLogger::setBackgroundThreadScheduling(SCHED_BATCH, 10);
+    ASSERT_EQ(0, pthread_getschedparam(thread, &policy, &param));
+    EXPECT_EQ(SCHED_BATCH, policy);
+    EXPECT_EQ(0, param.sched_priority);
+
+    // Invalid policies are rejected
+    RuntimeLogger::setBackgroundThreadScheduling(12345, 0);
+    EXPECT_EQ(SCHED_BATCH,
+              RuntimeLogger::nanoLogSingleton.backgroundThreadPolicy);
+
+    RuntimeLogger::setBackgroundThreadScheduling(SCHED_OTHER, 0);
+    ASSERT_EQ(0, pthread_getschedparam(thread, &policy, &param));
+    EXPECT_EQ(SCHED_OTHER, policy);
+    RuntimeLogger::nanoLogSingleton.backgroundThreadPolicy = -1;
+}
+
+TEST_F(NanoLogTest, preallocate_resize) {
+    // The retired buffers are deleted by the compression thread, so only
+    // the values sampled before the buffers are replaced are checked.
+    RuntimeLogger::StagingBuffer *first = nullptr, *second = nullptr;
+    uint32_t firstCapacity = 0, secondCapacity = 0;
+    uint32_t firstId = 0, secondId = 0;
+
+    std::thread thread([&] {
+        RuntimeLogger::preallocate(8192);
+        first = RuntimeLogger::stagingBuffer;
+        firstCapacity = first->getCapacity();
+        firstId = first->getId();
+
+        // Same size is a no-op
+        RuntimeLogger::preallocate(8192);
+        EXPECT_EQ(first, RuntimeLogger::stagingBuffer);
+
+        RuntimeLogger::preallocate(1);
+        second = RuntimeLogger::stagingBuffer;
+        secondCapacity = second->getCapacity();
+        secondId = second->getId();
+    });
+    thread.join();
+
+    EXPECT_EQ(8192U, firstCapacity);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(NanoLogConfig::MIN_STAGING_BUFFER_SIZE, secondCapacity);
+    EXPECT_EQ(firstId, secondId);
+}
+
+TEST_F(NanoLogTest, StagingBuffer_reserveSpaceInternal_adaptiveGrowth) {
+    // Stop the compression so that the producer blocks
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->stop();
+    RuntimeLogger::setAdaptiveStagingBufferLimit(16384);
+
+    std::thread thread([] {
+        RuntimeLogger::preallocate(4096);
+        RuntimeLogger::StagingBuffer *first = RuntimeLogger::stagingBuffer;
+        RuntimeLogger::reserveAlloc(3000);
+        RuntimeLogger::finishAlloc(3000);
+
+        // Not enough space, so the producer should block and then grow
+        char *pos = RuntimeLogger::reserveAlloc(2000);
+        RuntimeLogger::StagingBuffer *second = RuntimeLogger::stagingBuffer;
+        RuntimeLogger::finishAlloc(2000);
+
+        EXPECT_NE(first, second);
+        EXPECT_EQ(second->storage, pos);
+        EXPECT_EQ(8192U, second->getCapacity());
+        EXPECT_EQ(4096U, second->baseCapacity);
+        EXPECT_EQ(second, first->next);
+        EXPECT_TRUE(first->shouldDeallocate);
+        EXPECT_EQ(1U, first->numWaitsForSpace);
+
+        // Discard the test data before the compression restarts
+        first->consume(3000);
+        second->consume(2000);
+    });
+    thread.join();
+
+    RuntimeLogger::setAdaptiveStagingBufferLimit(0);
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->start();
+}
+
+TEST_F(NanoLogTest, StagingBuffer_reserveSpaceOrDrop_wakeup) {
+    RuntimeLogger &logger = RuntimeLogger::nanoLogSingleton;
+
+    // Idle compression threads should eventually block
+    uint64_t deadline = Cycles::rdtsc() + Cycles::fromSeconds(1);
+    while (logger.numSleepingWorkers == 0 && Cycles::rdtsc() < deadline);
+    EXPECT_LT(0U, logger.numSleepingWorkers);
+
+    // Mimic a blocked worker so that the slow path is guaranteed to wake it
+    ++logger.numSleepingWorkers;
+    uint32_t seq = logger.wakeupSeq;
+    sb->minFreeSpace = 0;
+    EXPECT_EQ(sb->storage, sb->reserveProducerSpace(100));
+    EXPECT_NE(seq, logger.wakeupSeq);
+    --logger.numSleepingWorkers;
+
+    // The fast path shall not wake anyone up
+    seq = logger.wakeupSeq;
+    EXPECT_EQ(sb->storage, sb->reserveProducerSpace(100));
+    EXPECT_EQ(seq, logger.wakeupSeq);
+}
+
+TEST_F(NanoLogTest, StagingBuffer_reserveSpaceOrDrop) {
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->stop();
+    RuntimeLogger::setDropOnFull(DEBUG);
+    uint64_t droppedBefore =
+                    RuntimeLogger::nanoLogSingleton.numDroppedLogMessages;
+
+    std::thread thread([] {
+        RuntimeLogger::preallocate(4096);
+        RuntimeLogger::StagingBuffer *sb = RuntimeLogger::stagingBuffer;
+        RuntimeLogger::reserveAlloc(3000, NOTICE);
+        RuntimeLogger::finishAlloc(3000);
+
+        // Only the lower severity message is dropped
+        EXPECT_EQ(nullptr, RuntimeLogger::reserveAlloc(2000, DEBUG));
+        EXPECT_EQ(nullptr, RuntimeLogger::reserveAlloc(2000, DEBUG));
+        EXPECT_EQ(2U, sb->numPendingDrops);
+        EXPECT_EQ(2U, sb->numDroppedMessages);
+        EXPECT_EQ(0U, sb->minFreeSpace);
+
+        // Once there's space, a drop marker precedes the next message
+        sb->consume(3000);
+        size_t markerSize = sizeof(Log::UncompressedEntry) + sizeof(uint32_t);
+        char *pos = RuntimeLogger::reserveAlloc(100, DEBUG);
+        ASSERT_EQ(sb->storage + 3000 + markerSize, pos);
+        RuntimeLogger::finishAlloc(100);
+        EXPECT_EQ(0U, sb->numPendingDrops);
+
+        auto *ue = reinterpret_cast<Log::UncompressedEntry*>(
+                                                        sb->storage + 3000);
+        uint32_t numDropped;
+        std::memcpy(&numDropped, ue->argData, sizeof(uint32_t));
+        EXPECT_EQ(markerSize, ue->entrySize);
+        EXPECT_EQ(2U, numDropped);
+        EXPECT_STREQ("NanoLog dropped %u log message(s) because the "
+                     "StagingBuffer was full",
+                     RuntimeLogger::nanoLogSingleton.invocationSites[
+                                            ue->fmtId].formatString);
+
+        // Discard the test data before the compression restarts
+        sb->consume(markerSize + 100);
+    });
+    thread.join();
+
+    EXPECT_EQ(droppedBefore + 2,
+              RuntimeLogger::nanoLogSingleton.numDroppedLogMessages);
+
+    RuntimeLogger::setDropOnFull(NUM_LOG_LEVELS);
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->start();
+}
+
+TEST_F(NanoLogTest, RuntimeLogger_batch) {
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->stop();
+
+    std::thread thread([] {
+        RuntimeLogger::preallocate(4096);
+        RuntimeLogger::StagingBuffer *sb = RuntimeLogger::stagingBuffer;
+        uint64_t allocationsBefore = sb->numAllocations;
+
+        // The log messages are appended to one reservation and only
+        // published once the batch ends
+        RuntimeLogger::beginBatch(1000);
+        char *first = RuntimeLogger::reserveAlloc(100);
+        RuntimeLogger::finishAlloc(100);
+        char *second = RuntimeLogger::reserveAlloc(200);
+        RuntimeLogger::finishAlloc(200);
+        EXPECT_EQ(sb->storage, first);
+        EXPECT_EQ(sb->storage + 100, second);
+        EXPECT_EQ(sb->storage, sb->producerPos);
+
+        // Nested batches share the reservation
+        RuntimeLogger::beginBatch(10);
+        EXPECT_EQ(sb->storage + 300, RuntimeLogger::reserveAlloc(100));
+        RuntimeLogger::finishAlloc(100);
+        RuntimeLogger::endBatch();
+        EXPECT_EQ(sb->storage, sb->producerPos);
+
+        // A full reservation is published before the next one is made
+        EXPECT_EQ(sb->storage + 400, RuntimeLogger::reserveAlloc(700));
+        EXPECT_EQ(sb->storage + 400, sb->producerPos);
+        RuntimeLogger::finishAlloc(700);
+
+        RuntimeLogger::publishBatch();
+        EXPECT_EQ(sb->storage + 1100, sb->producerPos);
+        RuntimeLogger::endBatch();
+        EXPECT_EQ(sb->storage + 1100, sb->producerPos);
+        EXPECT_EQ(allocationsBefore + 4, sb->numAllocations);
+        EXPECT_EQ(0U, RuntimeLogger::batch.depth);
+
+        // Outside of a batch, the log messages are published one by one
+        RuntimeLogger::reserveAlloc(100);
+        RuntimeLogger::finishAlloc(100);
+        EXPECT_EQ(sb->storage + 1200, sb->producerPos);
+
+        // The batch size is capped by the StagingBuffer
+        RuntimeLogger::beginBatch(100000);
+        EXPECT_EQ(2048U, RuntimeLogger::batch.bytesHint);
+        RuntimeLogger::endBatch();
+
+        // Discard the test data before the compression restarts
+        sb->consume(1200);
+    });
+    thread.join();
+
+    for (auto *worker : RuntimeLogger::nanoLogSingleton.workers)
+        worker->start();
+}
+
 }; //namespace
\ No newline at end of file
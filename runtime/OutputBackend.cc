@@ -0,0 +1,399 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "OutputBackend.h"
+
+namespace NanoLogInternal {
+
+/**
+ * Creates an OutputBackend of a particular type. If the type is not supported
+ * by the system (i.e. io_uring on older kernels), a POSIX AIO backend is
+ * returned instead.
+ *
+ * \param type
+ *      Type of backend to create
+ * \param queueDepth
+ *      Maximum number of operations the backend should support in flight
+ *
+ * \return
+ *      A newly allocated backend that the caller shall delete
+ */
+OutputBackend *
+OutputBackend::create(OutputBackendType type, uint32_t queueDepth)
+{
+    if (queueDepth == 0)
+        queueDepth = 1;
+
+    if (type == IO_URING) {
+        IoUringBackend *backend = new IoUringBackend(queueDepth);
+        if (backend->isValid())
+            return backend;
+
+        delete backend;
+    }
+
+    return new PosixAioBackend(queueDepth);
+}
+
+/**
+ * Returns the human readable name of an OutputBackendType.
+ */
+const char *
+OutputBackend::getTypeName(OutputBackendType type)
+{
+    switch (type) {
+        case POSIX_AIO:
+            return "POSIX AIO";
+        case IO_URING:
+            return "io_uring";
+        default:
+            return "unknown";
+    }
+}
+
+// PosixAioBackend constructor
+PosixAioBackend::PosixAioBackend(uint32_t queueDepth)
+    : OutputBackend(queueDepth)
+    , aioCbs(queueDepth)
+    , head(0)
+{
+    for (struct aiocb &cb : aioCbs)
+        memset(&cb, 0, sizeof(cb));
+}
+
+// PosixAioBackend destructor
+PosixAioBackend::~PosixAioBackend()
+{
+    while (numOutstanding > 0)
+        reap(true);
+}
+
+// Documentation in OutputBackend.h
+bool
+PosixAioBackend::submitWrite(int fd, const char *buffer, size_t nbytes)
+{
+    if (numOutstanding >= queueDepth)
+        return false;
+
+    struct aiocb &cb = aioCbs[(head + numOutstanding) % queueDepth];
+    memset(&cb, 0, sizeof(cb));
+    cb.aio_fildes = fd;
+    cb.aio_buf = const_cast<char*>(buffer);
+    cb.aio_nbytes = nbytes;
+
+    if (aio_write(&cb) == -1) {
+        fprintf(stderr, "Error at aio_write(): %s\n", strerror(errno));
+        return false;
+    }
+
+    ++numOutstanding;
+    return true;
+}
+
+// Documentation in OutputBackend.h
+uint32_t
+PosixAioBackend::reap(bool blocking)
+{
+    uint32_t numReaped = 0;
+
+    while (numOutstanding > 0) {
+        struct aiocb &cb = aioCbs[head];
+
+        if (aio_error(&cb) == EINPROGRESS) {
+            if (!blocking || numReaped > 0)
+                break;
+
+            const struct aiocb *const aiocb_list[] = {&cb};
+            int err = aio_suspend(aiocb_list, 1, NULL);
+            if (err != 0 && errno != EINTR)
+                perror("LogCompressor's Posix AIO suspend operation failed");
+            continue;
+        }
+
+        int err = aio_error(&cb);
+        ssize_t ret = aio_return(&cb);
+
+        if (err != 0) {
+            fprintf(stderr, "LogCompressor's POSIX AIO failed"
+                    " with %d: %s\r\n", err, strerror(err));
+        } else if (ret < 0) {
+            perror("LogCompressor's Posix AIO Write failed");
+        }
+
+        head = (head + 1) % queueDepth;
+        --numOutstanding;
+        ++numReaped;
+    }
+
+    return numReaped;
+}
+
+/**
+ * IoUringBackend constructor; sets up the io_uring and maps its rings into
+ * memory. Check isValid() afterwards to determine whether setup succeeded.
+ */
+IoUringBackend::IoUringBackend(uint32_t queueDepth)
+    : OutputBackend(queueDepth)
+    , ringFd(-1)
+    , sqRing(MAP_FAILED)
+    , sqRingSize(0)
+    , cqRing(MAP_FAILED)
+    , cqRingSize(0)
+    , sqes(MAP_FAILED)
+    , sqesSize(0)
+    , sqHead(nullptr)
+    , sqTail(nullptr)
+    , sqMask(nullptr)
+    , sqArray(nullptr)
+    , cqHead(nullptr)
+    , cqTail(nullptr)
+    , cqMask(nullptr)
+    , cqes(nullptr)
+    , registeredBuffers()
+    , registeredBufferSize(0)
+    , nextSequence(0)
+    , oldestSequence(0)
+    , completed(queueDepth, false)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth,
+                                      &params));
+    if (fd < 0)
+        return;
+
+    sqRingSize = params.sq_off.array + params.sq_entries*sizeof(uint32_t);
+    cqRingSize = params.cq_off.cqes +
+                            params.cq_entries*sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    if (singleMmap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+            sqRing = MAP_FAILED;
+            close(fd);
+            return;
+        }
+    }
+
+    sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        munmap(sqRing, sqRingSize);
+        sqRing = cqRing = MAP_FAILED;
+        close(fd);
+        return;
+    }
+
+    char *sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    ringFd = fd;
+}
+
+// IoUringBackend destructor
+IoUringBackend::~IoUringBackend()
+{
+    if (ringFd < 0)
+        return;
+
+    while (numOutstanding > 0)
+        reap(true);
+
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+    close(ringFd);
+}
+
+/**
+ * Registers the buffers with the kernel so that writes from them can be
+ * performed with IORING_OP_WRITE_FIXED, which avoids mapping the pages on
+ * every write. Failures are benign; the backend will fall back to regular
+ * writes. See OutputBackend::registerBuffers() for the parameters.
+ */
+void
+IoUringBackend::registerBuffers(char * const *buffers, uint32_t numBuffers,
+                                size_t bufferSize)
+{
+    if (!registeredBuffers.empty()) {
+        syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS,
+                NULL, 0);
+        registeredBuffers.clear();
+    }
+
+    std::vector<struct iovec> iovecs(numBuffers);
+    for (uint32_t i = 0; i < numBuffers; ++i) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = bufferSize;
+    }
+
+    long ret = syscall(__NR_io_uring_register, ringFd,
+                       IORING_REGISTER_BUFFERS, iovecs.data(), numBuffers);
+    if (ret < 0)
+        return;
+
+    registeredBuffers.assign(buffers, buffers + numBuffers);
+    registeredBufferSize = bufferSize;
+}
+
+/**
+ * Returns the index of the registered buffer containing the byte range
+ * [buffer, buffer + nbytes) or -1 if there is none.
+ */
+int
+IoUringBackend::findRegisteredBuffer(const char *buffer, size_t nbytes)
+{
+    for (size_t i = 0; i < registeredBuffers.size(); ++i) {
+        const char *start = registeredBuffers[i];
+        if (buffer >= start &&
+                buffer + nbytes <= start + registeredBufferSize)
+            return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+// Documentation in OutputBackend.h
+bool
+IoUringBackend::submitWrite(int fd, const char *buffer, size_t nbytes)
+{
+    if (numOutstanding >= queueDepth)
+        return false;
+
+    uint32_t tail = *sqTail;
+    uint32_t index = tail & *sqMask;
+    struct io_uring_sqe *sqe =
+                        static_cast<struct io_uring_sqe*>(sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    int bufIndex = findRegisteredBuffer(buffer, nbytes);
+    sqe->opcode = (bufIndex >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->buf_index = static_cast<uint16_t>((bufIndex >= 0) ? bufIndex : 0);
+    sqe->flags = IOSQE_IO_DRAIN;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = static_cast<uint32_t>(nbytes);
+    sqe->off = static_cast<uint64_t>(-1); // Use (and update) the file offset
+    sqe->user_data = nextSequence;
+    sqArray[index] = index;
+
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    long ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        fprintf(stderr, "Error at io_uring_enter(): %s\n", strerror(errno));
+
+        // Retract the entry so it isn't picked up by a later submission
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    ++nextSequence;
+    ++numOutstanding;
+    return true;
+}
+
+// Documentation in OutputBackend.h
+uint32_t
+IoUringBackend::reap(bool blocking)
+{
+    uint32_t numReaped = 0;
+
+    while (numOutstanding > 0) {
+        uint32_t head = *cqHead;
+        uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe *cqe =
+                static_cast<struct io_uring_cqe*>(cqes) + (head & *cqMask);
+
+            if (cqe->res < 0) {
+                fprintf(stderr, "LogCompressor's io_uring write failed"
+                        " with %d: %s\r\n", -cqe->res, strerror(-cqe->res));
+            }
+
+            completed[cqe->user_data % queueDepth] = true;
+            ++head;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        // Only report completions in submission order
+        while (oldestSequence < nextSequence &&
+                    completed[oldestSequence % queueDepth]) {
+            completed[oldestSequence % queueDepth] = false;
+            ++oldestSequence;
+            --numOutstanding;
+            ++numReaped;
+        }
+
+        if (!blocking || numReaped > 0 || numOutstanding == 0)
+            break;
+
+        long ret = syscall(__NR_io_uring_enter, ringFd, 0, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            fprintf(stderr, "Error at io_uring_enter(): %s\n",
+                    strerror(errno));
+            break;
+        }
+    }
+
+    return numReaped;
+}
+
+}; // namespace NanoLogInternal
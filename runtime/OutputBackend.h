@@ -0,0 +1,231 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NANOLOG_OUTPUTBACKEND_H
+#define NANOLOG_OUTPUTBACKEND_H
+
+#include <aio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Common.h"
+#include "NanoLog.h"
+
+namespace NanoLogInternal {
+using namespace NanoLog;
+
+/**
+ * OutputBackend abstracts the asynchronous I/O mechanism the background
+ * compression threads use to persist the compressed log. Operations are
+ * submitted in order and, from the caller's point of view, complete in the
+ * order they were submitted. This allows the caller to recycle the buffer
+ * passed to the oldest outstanding operation as soon as it's reported as
+ * completed.
+ *
+ * Backends may have several operations in flight at once, up to the queue
+ * depth specified at construction.
+ */
+class OutputBackend {
+public:
+    virtual ~OutputBackend() {}
+
+    /**
+     * Hints to the backend which buffers will be passed to submitWrite() so
+     * that it may pin/register them with the kernel ahead of time. Backends
+     * that do not support this treat it as a no-op.
+     *
+     * \param buffers
+     *      Array of buffers that will be written from
+     * \param numBuffers
+     *      Number of buffers in the array
+     * \param bufferSize
+     *      Size of each buffer in bytes
+     */
+    virtual void registerBuffers(char * const *buffers, uint32_t numBuffers,
+                                 size_t bufferSize) {}
+
+    /**
+     * Asynchronously appends a buffer to a file. The buffer shall not be
+     * modified until the operation is reported complete by reap().
+     *
+     * \param fd
+     *      File descriptor to write to
+     * \param buffer
+     *      Data to write
+     * \param nbytes
+     *      Number of bytes to write
+     *
+     * \return
+     *      true if the operation was submitted; false if it failed to submit
+     *      (an error message will have been printed) or the queue is full.
+     */
+    virtual bool submitWrite(int fd, const char *buffer, size_t nbytes) = 0;
+
+    /**
+     * Reaps completed operations.
+     *
+     * \param blocking
+     *      If true and there are outstanding operations, wait until at least
+     *      one completes.
+     *
+     * \return
+     *      Number of operations (in submission order) that completed since
+     *      the last invocation.
+     */
+    virtual uint32_t reap(bool blocking) = 0;
+
+    /**
+     * Returns the number of submitted operations that have not been reaped.
+     */
+    inline uint32_t
+    getNumOutstanding() {
+        return numOutstanding;
+    }
+
+    /**
+     * Returns the maximum number of operations that can be in flight
+     */
+    inline uint32_t
+    getQueueDepth() {
+        return queueDepth;
+    }
+
+    /**
+     * Returns a human readable name of the backend (i.e. for printConfig())
+     */
+    virtual const char *getName() = 0;
+
+    static OutputBackend *create(OutputBackendType type, uint32_t queueDepth);
+
+    static const char *getTypeName(OutputBackendType type);
+
+PROTECTED:
+    explicit OutputBackend(uint32_t queueDepth)
+        : queueDepth(queueDepth)
+        , numOutstanding(0)
+    {}
+
+    // Maximum number of operations that can be in flight
+    uint32_t queueDepth;
+
+    // Number of operations submitted, but not yet reaped
+    uint32_t numOutstanding;
+
+    DISALLOW_COPY_AND_ASSIGN(OutputBackend);
+};
+
+/**
+ * OutputBackend implemented with glibc's POSIX AIO library. glibc services
+ * the requests with a pool of helper threads and requests to the same file
+ * descriptor are serviced in order.
+ */
+class PosixAioBackend : public OutputBackend {
+public:
+    explicit PosixAioBackend(uint32_t queueDepth);
+    ~PosixAioBackend();
+
+    bool submitWrite(int fd, const char *buffer, size_t nbytes);
+    uint32_t reap(bool blocking);
+    const char *getName() { return "POSIX AIO"; }
+
+PRIVATE:
+    // Circular queue of AIO control blocks for the outstanding operations;
+    // the oldest outstanding operation lives at index head.
+    std::vector<struct aiocb> aioCbs;
+
+    // Index in aioCbs of the oldest outstanding operation
+    uint32_t head;
+
+    DISALLOW_COPY_AND_ASSIGN(PosixAioBackend);
+};
+
+/**
+ * OutputBackend implemented directly on top of the Linux io_uring system
+ * calls. Writes are submitted without the help of any intermediate threads
+ * and can make use of buffers registered via registerBuffers().
+ *
+ * Writes are marked IOSQE_IO_DRAIN so that the kernel executes them in
+ * submission order, which is required for O_APPEND files.
+ */
+class IoUringBackend : public OutputBackend {
+public:
+    explicit IoUringBackend(uint32_t queueDepth);
+    ~IoUringBackend();
+
+    /**
+     * Returns true if the io_uring was successfully set up. If not, the
+     * backend is unusable and should be deleted.
+     */
+    bool isValid() { return ringFd >= 0; }
+
+    void registerBuffers(char * const *buffers, uint32_t numBuffers,
+                         size_t bufferSize);
+    bool submitWrite(int fd, const char *buffer, size_t nbytes);
+    uint32_t reap(bool blocking);
+    const char *getName() { return "io_uring"; }
+
+PRIVATE:
+    int findRegisteredBuffer(const char *buffer, size_t nbytes);
+
+    // File descriptor for the io_uring instance; -1 means setup failed
+    int ringFd;
+
+    // Memory mapped submission queue ring and its size
+    void *sqRing;
+    size_t sqRingSize;
+
+    // Memory mapped completion queue ring and its size. This may alias sqRing
+    // if the kernel supports IORING_FEAT_SINGLE_MMAP.
+    void *cqRing;
+    size_t cqRingSize;
+
+    // Memory mapped array of submission queue entries and its size
+    void *sqes;
+    size_t sqesSize;
+
+    // Pointers into the mapped rings (see io_uring_setup(2))
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t *sqMask;
+    uint32_t *sqArray;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t *cqMask;
+    void *cqes;
+
+    // Buffers registered with the kernel via registerBuffers()
+    std::vector<char*> registeredBuffers;
+
+    // Size of each of the registeredBuffers
+    size_t registeredBufferSize;
+
+    // Sequence number to assign to the next submitted operation
+    uint64_t nextSequence;
+
+    // Sequence number of the oldest operation that has not been reaped
+    uint64_t oldestSequence;
+
+    // Tracks operations that completed out of order, indexed by the
+    // operation's sequence number modulo the queue depth.
+    std::vector<bool> completed;
+
+    DISALLOW_COPY_AND_ASSIGN(IoUringBackend);
+};
+
+}; // namespace NanoLogInternal
+
+#endif /* NANOLOG_OUTPUTBACKEND_H */
@@ -0,0 +1,132 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "TestUtil.h"
+#include "OutputBackend.h"
+#include "Config.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace NanoLogInternal;
+
+class OutputBackendTest : public ::testing::TestWithParam<OutputBackendType> {
+protected:
+    const char *testFile;
+    int fd;
+
+    OutputBackendTest()
+        : testFile("outputBackendTestFile.bin")
+        , fd(-1)
+    {
+    }
+
+    virtual void SetUp() {
+        std::remove(testFile);
+        fd = open(testFile, NanoLogConfig::FILE_PARAMS, 0666);
+        ASSERT_LE(0, fd);
+    }
+
+    virtual void TearDown() {
+        if (fd >= 0)
+            close(fd);
+        std::remove(testFile);
+    }
+
+    std::string readTestFile() {
+        std::ifstream in(testFile, std::ifstream::binary);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+};
+
+TEST_P(OutputBackendTest, submitWrite_inOrder) {
+    OutputBackend *backend = OutputBackend::create(GetParam(), 4);
+    ASSERT_NE(nullptr, backend);
+    EXPECT_EQ(4U, backend->getQueueDepth());
+
+    char buffers[4][16];
+    for (int i = 0; i < 4; ++i)
+        snprintf(buffers[i], sizeof(buffers[i]), "write%d;", i);
+    char *bufferPtrs[] = {buffers[0], buffers[1], buffers[2], buffers[3]};
+    backend->registerBuffers(bufferPtrs, 2, sizeof(buffers[0]));
+
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(backend->submitWrite(fd, buffers[i], strlen(buffers[i])));
+
+    // Queue is full
+    EXPECT_FALSE(backend->submitWrite(fd, buffers[0], 1));
+    EXPECT_EQ(4U, backend->getNumOutstanding());
+
+    uint32_t numReaped = 0;
+    while (numReaped < 4)
+        numReaped += backend->reap(true);
+
+    EXPECT_EQ(4U, numReaped);
+    EXPECT_EQ(0U, backend->getNumOutstanding());
+    EXPECT_EQ(0U, backend->reap(true));
+    EXPECT_EQ("write0;write1;write2;write3;", readTestFile());
+
+    delete backend;
+}
+
+TEST_P(OutputBackendTest, reap_nonBlocking) {
+    OutputBackend *backend = OutputBackend::create(GetParam(), 1);
+    EXPECT_EQ(0U, backend->reap(false));
+
+    const char data[] = "abc";
+    EXPECT_TRUE(backend->submitWrite(fd, data, 3));
+    while (backend->reap(false) == 0);
+
+    EXPECT_EQ(0U, backend->getNumOutstanding());
+    EXPECT_EQ("abc", readTestFile());
+    delete backend;
+}
+
+TEST_P(OutputBackendTest, destructorWaitsForOutstanding) {
+    OutputBackend *backend = OutputBackend::create(GetParam(), 2);
+
+    const char data[] = "0123456789";
+    EXPECT_TRUE(backend->submitWrite(fd, data, 5));
+    EXPECT_TRUE(backend->submitWrite(fd, data + 5, 5));
+    delete backend;
+
+    EXPECT_EQ("0123456789", readTestFile());
+}
+
+INSTANTIATE_TEST_CASE_P(Backends, OutputBackendTest,
+                        ::testing::Values(POSIX_AIO, IO_URING));
+
+TEST(OutputBackendFactoryTest, getTypeName) {
+    EXPECT_STREQ("POSIX AIO", OutputBackend::getTypeName(POSIX_AIO));
+    EXPECT_STREQ("io_uring", OutputBackend::getTypeName(IO_URING));
+}
+
+TEST(OutputBackendFactoryTest, create) {
+    OutputBackend *backend = OutputBackend::create(POSIX_AIO, 0);
+    EXPECT_STREQ("POSIX AIO", backend->getName());
+    EXPECT_EQ(1U, backend->getQueueDepth());
+    delete backend;
+}
+
+}; // namespace
@@ -18,6 +18,9 @@
 #include <cstddef>
 #include <cstring>
 #include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Common.h"
 #include "Portability.h"
@@ -60,10 +63,10 @@
  * TODO(syang0) Consider a packing scheme that can encode the special code
  * directly in the stream itself
  *
- * TODO(syang0) A common use case for logs is to log metrics, which tend to be
- * monotonically increasing (i.e. time alive, number of hits, etc), so would it
- * make more sense to start encoding number deltas instead of just the smallest
- * value.
+ * A common use case for logs is to log metrics, which tend to be
+ * monotonically increasing (i.e. time alive, number of hits, etc), so the
+ * encoder can optionally pack() the difference between an integer and the
+ * value the same log site logged previously instead (see ArgumentHistory).
  */
 
 namespace BufferUtils {
@@ -79,6 +82,56 @@ struct TwoNibbles {
 };
 NANOLOG_PACK_POP
 
+/**
+ * Returns the fewest number of bytes (1-8) needed to represent an unsigned
+ * integer. The magnitudes of logged values tend to vary from one invocation
+ * to the next, so on GCC/Clang this is computed with a bit scan rather than a
+ * chain of comparisons that the branch predictor would often get wrong.
+ *
+ * \param val
+ *      Unsigned integer to measure
+ *
+ * \return
+ *      Number of low-order bytes needed to store the value
+ */
+inline int
+getNumBytesNeeded(uint64_t val)
+{
+#if defined(__GNUC__)
+    // The bitwise-or makes a 0 value take 1 byte and keeps clz defined
+    return (71 - __builtin_clzll(val | 1)) >> 3;
+#else
+    int numBytes = 1;
+    while (numBytes < 8 && val >= (1ULL << (8*numBytes)))
+        ++numBytes;
+    return numBytes;
+#endif
+}
+
+/**
+ * Stores the n-th nibble of a nibble stream that is being filled in order.
+ * Even nibbles overwrite their whole byte (clearing the odd nibble that
+ * follows) so that the stream doesn't need to be zeroed beforehand, and
+ * neither store needs the read-modify-write of a bit-field assignment.
+ *
+ * \param nibbles
+ *      Start of the nibble stream
+ * \param n
+ *      Index of the nibble to store; nibbles must be stored in increasing
+ *      order
+ * \param code
+ *      Special 4-bit value returned by pack()
+ */
+inline void
+setNibble(TwoNibbles *nibbles, int n, int code)
+{
+    uint8_t *byte = reinterpret_cast<uint8_t*>(nibbles) + n/2;
+    if (n & 0x1)
+        *byte = static_cast<uint8_t>(*byte | ((code & 0xf) << 4));
+    else
+        *byte = static_cast<uint8_t>(code & 0xf);
+}
+
 /**
  * Given an unsigned integer and a char array, find the fewest number of
  * bytes needed to represent the integer, copy that many bytes into the
@@ -96,29 +149,7 @@ template<typename T>
 inline typename std::enable_if<std::is_integral<T>::value &&
                                 !std::is_signed<T>::value, int>::type
 pack(char **buffer, T val) {
-    // Binary search for the smallest container. It is also worth noting that
-    // with -O3, the compiler will strip out extraneous if-statements based on T
-    // For example, if T is uint16_t, it would only leave the t < 1U<<8 check
-
-    //TODO(syang0) Is this too costly vs. a simple for loop?
-    int numBytes;
-    if (val < (1UL << 8)) {
-            numBytes = 1;
-    } else if (val < (1UL << 16)) {
-        numBytes = 2;
-    } else if (val < (1UL << 24)) {
-        numBytes = 3;
-    } else if (val < (1UL << 32)) {
-        numBytes = 4;
-    } else if (val < (1UL << 40)) {
-        numBytes = 5;
-    } else if (val < (1UL << 48)) {
-        numBytes = 6;
-    } else if (val < (1UL << 56)) {
-        numBytes = 7;
-    } else {
-        numBytes = 8;
-    }
+    int numBytes = getNumBytesNeeded(static_cast<uint64_t>(val));
 
     // Although we store the entire value here, we take advantage of the fact
     // that x86-64 is little-endian (storing the least significant bits first)
@@ -289,6 +320,24 @@ unpack(const char **in, uint8_t packNibble) {
     return result;
 }
 
+/**
+ * Returns the number of bytes used to store a value that was pack()-ed with
+ * a particular special code. This is computed without branches since the
+ * codes in a stream are rarely predictable.
+ *
+ * \param nibble
+ *      Special 4-bit code returned from pack()
+ *
+ * \return
+ *      Number of bytes the pack()-ed value occupies
+ */
+inline uint32_t
+getPackedSize(uint8_t nibble)
+{
+    return nibble + (uint32_t(nibble == 0) << 4)
+                  - (uint32_t(nibble > 0x8) << 3);
+}
+
 /**
  * Given a stream of nibbles, return the total number of bytes used to represent
  * the values encoded with the nibbles.
@@ -306,24 +355,12 @@ getSizeOfPackedValues(const TwoNibbles *nibbles, uint32_t numNibbles)
 {
     uint32_t size = 0;
     for (uint32_t i = 0; i < numNibbles/2; ++i) {
-        size += nibbles[i].first + nibbles[i].second;
-        if (nibbles[i].first == 0)
-            size += 16;
-        if (nibbles[i].first > 0x8)
-            size -= 8;
-        if (nibbles[i].second == 0)
-            size += 16;
-        if (nibbles[i].second > 0x8)
-            size -= 8;
+        size += getPackedSize(nibbles[i].first)
+                    + getPackedSize(nibbles[i].second);
     }
 
-    if (numNibbles & 0x1) {
-        size += nibbles[numNibbles / 2].first;
-        if (nibbles[numNibbles/2].first == 0)
-            size += 16;
-        if (nibbles[numNibbles/2].first > 0x8)
-            size -= 8;
-    }
+    if (numNibbles & 0x1)
+        size += getPackedSize(nibbles[numNibbles/2].first);
 
     return size;
 }
@@ -395,6 +432,24 @@ public:
         return ret;
     }
 
+    /**
+     * Skips over the next pack()-ed value in the stream without unpack()-ing
+     * it. This is useful when the type of the value is not of interest.
+     */
+    void skipNext() {
+        assert(currPackedValue < endOfValues);
+
+        uint8_t nibble = (onFirstNibble) ? nibblePosition->first
+                                         : nibblePosition->second;
+
+        currPackedValue += getPackedSize(nibble);
+
+        if (!onFirstNibble)
+            ++nibblePosition;
+
+        onFirstNibble = !onFirstNibble;
+    }
+
     /**
      * Returns a pointer to to the first byte beyond the last pack()-ed value
      *
@@ -406,6 +461,198 @@ public:
         return endOfValues;
     }
 };
+
+/**
+ * The arguments a log site logged most recently, which are used to encode
+ * its next log message more compactly. When this "delta encoding" is enabled,
+ * every integer argument is pack()-ed as the difference from the previous
+ * value of the same argument (in 64-bit two's complement arithmetic), and
+ * every string argument is preceded by a tag byte: 0 indicates that the
+ * null-terminated string follows and 1 to NUM_STRINGS that it's a repeat of
+ * one of the log site's recent strings, which is then omitted. Floating point
+ * arguments are stored verbatim.
+ *
+ * The encoder and decoder each keep an ArgumentHistory per log site and
+ * update them identically, starting from empty histories at the start of
+ * every BufferExtent so that extents can still be decoded independently.
+ */
+struct ArgumentHistory {
+    // Number of recently logged strings remembered per log site
+    static const uint8_t NUM_STRINGS = 4;
+
+    // Identifies the BufferExtent the history belongs to. A history from
+    // any other extent is stale and must be cleared before it's used.
+    uint64_t extent;
+
+    // Previous value of each integer argument, indexed by nibble position;
+    // the slots of floating point arguments are unused
+    std::vector<uint64_t> integers;
+
+    // The most recently logged strings in their raw form (i.e. without the
+    // null terminator) and the slot the next new string replaces
+    std::string strings[NUM_STRINGS];
+    uint8_t nextString;
+
+    ArgumentHistory()
+        : extent(-1)
+        , integers()
+        , strings()
+        , nextString(0)
+    {}
+
+    /**
+     * Prepares the history to encode or decode a log message, clearing it if
+     * it's left over from a different BufferExtent.
+     *
+     * \param currentExtent
+     *      Identifier of the BufferExtent being encoded or decoded
+     * \param numNibbles
+     *      Number of nibbles (i.e. non-string arguments) of the log site
+     */
+    void
+    begin(uint64_t currentExtent, int numNibbles)
+    {
+        if (extent == currentExtent)
+            return;
+
+        extent = currentExtent;
+        integers.assign(numNibbles, 0);
+        for (std::string &s : strings)
+            s.clear();
+        nextString = 0;
+    }
+
+    /**
+     * Returns the difference between an integer argument and its previous
+     * value, and remembers the new value.
+     *
+     * \param n
+     *      Nibble position of the argument
+     * \param value
+     *      The argument, sign or zero extended to 64 bits
+     */
+    uint64_t
+    encodeInteger(int n, uint64_t value)
+    {
+        uint64_t delta = value - integers[n];
+        integers[n] = value;
+        return delta;
+    }
+
+    /**
+     * Inverse of encodeInteger(); returns the integer argument that was
+     * encoded as a difference from the previous one and remembers it.
+     */
+    uint64_t
+    decodeInteger(int n, uint64_t delta)
+    {
+        integers[n] += delta;
+        return integers[n];
+    }
+
+    /**
+     * Returns the tag byte (1 to NUM_STRINGS) referring to a recent string with
+     * the given contents, or 0 after remembering the new string if there's
+     * none.
+     *
+     * \param str
+     *      Contents of the string, not including the null terminator
+     * \param length
+     *      Number of bytes in the string
+     */
+    uint8_t
+    encodeString(const char *str, uint32_t length)
+    {
+        for (uint8_t i = 0; i < NUM_STRINGS; ++i) {
+            if (strings[i].size() == length &&
+                    std::memcmp(strings[i].data(), str, length) == 0)
+                return static_cast<uint8_t>(i + 1);
+        }
+
+        addString(str, length);
+        return 0;
+    }
+
+    /**
+     * Remembers a new string, replacing the least recently added one.
+     *
+     * \param str
+     *      Contents of the string, not including the null terminator
+     * \param length
+     *      Number of bytes in the string
+     */
+    void
+    addString(const char *str, uint32_t length)
+    {
+        strings[nextString].assign(str, length);
+        nextString = static_cast<uint8_t>((nextString + 1) % NUM_STRINGS);
+    }
+};
+
+/**
+ * The strings logged via NanoLog::StaticStr that an encoder has encountered.
+ * They're identified by their address and numbered in the order they're
+ * first encountered; the log messages store the identifier in place of the
+ * string, which is written to the log's dictionary once (see
+ * Log::Encoder::encodeStaticStrings()).
+ */
+struct StaticStringTable {
+    // Identifier of each string encountered, keyed by its address
+    std::unordered_map<const char*, uint32_t> ids;
+
+    // The strings encountered, indexed by their identifier
+    std::vector<const char*> strings;
+
+    // Number of strings (from the start of strings) written to the log
+    uint32_t numPersisted;
+
+    StaticStringTable()
+        : ids()
+        , strings()
+        , numPersisted(0)
+    {}
+
+    /**
+     * Returns the identifier of a static string, assigning it the next one
+     * if it's encountered for the first time.
+     *
+     * \param str
+     *      Address of the string
+     */
+    uint32_t
+    getId(const char *str)
+    {
+        auto it = ids.find(str);
+        if (it != ids.end())
+            return it->second;
+
+        uint32_t id = static_cast<uint32_t>(strings.size());
+        ids.emplace(str, id);
+        strings.push_back(str);
+        return id;
+    }
+
+    /**
+     * Returns true if there are strings that have yet to be written to the
+     * log.
+     */
+    bool
+    hasUnpersisted() const
+    {
+        return numPersisted < strings.size();
+    }
+
+    /**
+     * Forgets all the strings, i.e. when a new log is started.
+     */
+    void
+    clear()
+    {
+        ids.clear();
+        strings.clear();
+        numPersisted = 0;
+    }
+};
 } /* BufferUtils */
 
 #endif /* PACKER_H */
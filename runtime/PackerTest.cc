@@ -250,6 +250,35 @@ TEST_F(PackerTest, packSignedIntegers) {
     EXPECT_EQ(buffer_space + 102 + 52 + 44, buffer);
 }
 
+TEST_F(PackerTest, getNumBytesNeeded) {
+    // Compare against the comparison ladder pack() originally used around
+    // every byte boundary so that the compressed format stays the same
+    auto ladder = [](uint64_t val) {
+        int numBytes = 8;
+        for (int i = 7; i >= 1; --i) {
+            if (val < (1ULL << (8*i)))
+                numBytes = i;
+        }
+        return numBytes;
+    };
+
+    EXPECT_EQ(1, getNumBytesNeeded(0));
+    EXPECT_EQ(8, getNumBytesNeeded(~0ULL));
+    for (int bit = 0; bit < 64; ++bit) {
+        uint64_t val = 1ULL << bit;
+        EXPECT_EQ(ladder(val - 1), getNumBytesNeeded(val - 1));
+        EXPECT_EQ(ladder(val), getNumBytesNeeded(val));
+        EXPECT_EQ(ladder(val + 1), getNumBytesNeeded(val + 1));
+    }
+
+    // The packed bytes are the low-order bytes of the value
+    uint64_t val = 0x0102030405ULL;
+    char *buffer = buffer_space;
+    EXPECT_EQ(5, pack(&buffer, val));
+    EXPECT_EQ(buffer_space + 5, buffer);
+    EXPECT_EQ(0, memcmp(buffer_space, &val, 5));
+}
+
 TEST_F(PackerTest, unpack_int) {
     // The majority of tests were performed in the pack test. This one will
     // now test the integration and only spot check
@@ -432,6 +461,38 @@ TEST_F(PackerTest, getSizeOfPackedValues) {
     EXPECT_EQ(84, getSizeOfPackedValues(nibbles, nibbleCntr));
 }
 
+TEST_F(PackerTest, getPackedSize) {
+    EXPECT_EQ(16U, getPackedSize(0));
+    for (uint8_t nibble = 1; nibble <= 8; ++nibble)
+        EXPECT_EQ(nibble, getPackedSize(nibble));
+    for (uint8_t nibble = 9; nibble <= 15; ++nibble)
+        EXPECT_EQ(nibble - 8U, getPackedSize(nibble));
+}
+
+TEST_F(PackerTest, setNibble) {
+    TwoNibbles expected[3];
+    memset(expected, 0, sizeof(expected));
+
+    // setNibble() doesn't require the nibbles to be zeroed beforehand
+    TwoNibbles *nibbles = reinterpret_cast<TwoNibbles*>(buffer_space);
+    memset(nibbles, 0xff, sizeof(expected) + 1);
+
+    int codes[] = {1, 9, 16, 15, 4};
+    for (int i = 0; i < 5; ++i) {
+        setNibble(nibbles, i, codes[i]);
+        if (i & 0x1)
+            expected[i/2].second = 0xf & codes[i];
+        else
+            expected[i/2].first = 0xf & codes[i];
+    }
+
+    // The last unused nibble is cleared and the bytes after it are untouched
+    EXPECT_EQ(0, memcmp(expected, nibbles, sizeof(expected)));
+    EXPECT_EQ('\xff', buffer_space[sizeof(expected)]);
+    EXPECT_EQ(4, nibbles[2].first);
+    EXPECT_EQ(0, nibbles[2].second);
+}
+
 TEST_F(PackerTest, nibbler) {
     BufferUtils::TwoNibbles nibbles[1000];
     char backing_buffer[1024];
@@ -495,6 +556,35 @@ TEST_F(PackerTest, nibbler) {
 
 }
 
+TEST_F(PackerTest, nibbler_skipNext) {
+    BufferUtils::TwoNibbles nibbles[1000];
+    char backing_buffer[1024];
+    char *buffer = backing_buffer;
+
+    int nibbleCntr = 0;
+    nibbles[nibbleCntr++/2].first  = pack(&buffer, (float)(0.1));
+    nibbles[nibbleCntr++/2].second = pack(&buffer, uint64_t(1UL<<40));
+    nibbles[nibbleCntr++/2].first  = pack(&buffer, int64_t(-(1<<16)));
+    nibbles[nibbleCntr++/2].second = pack(&buffer, (double)(0.2));
+    nibbles[nibbleCntr++/2].first  = pack(&buffer, int64_t(-(1<<8)));
+    nibbles[nibbleCntr++/2].second = pack(&buffer, uint64_t(7));
+
+    uint32_t packedBytes = buffer - backing_buffer;
+    uint32_t nibbleBytes = (nibbleCntr+1)/2;
+
+    memmove(backing_buffer + nibbleBytes, backing_buffer, packedBytes);
+    memcpy(backing_buffer, nibbles, nibbleBytes);
+
+    Nibbler nb(backing_buffer, nibbleCntr);
+    nb.skipNext();
+    EXPECT_EQ(1UL<<40, nb.getNext<uint64_t>());
+    nb.skipNext();
+    nb.skipNext();
+    EXPECT_EQ(int64_t(-(1<<8)), nb.getNext<int64_t>());
+    nb.skipNext();
+    EXPECT_EQ(nb.getEndOfPackedArguments(), nb.currPackedValue);
+}
+
 TEST_F(PackerTest, nibbler_assert) {
     BufferUtils::TwoNibbles nibbles[1000];
     char backing_buffer[1024];
@@ -520,4 +610,71 @@ TEST_F(PackerTest, nibbler_assert) {
     EXPECT_DEATH(nb.getNext<int>(), "");
 }
 
+TEST_F(PackerTest, ArgumentHistory) {
+    ArgumentHistory encoder, decoder;
+    encoder.begin(1, 2);
+    decoder.begin(1, 2);
+    ASSERT_EQ(2U, encoder.integers.size());
+
+    // Each slot is delta encoded against its own previous value
+    EXPECT_EQ(1000U, encoder.encodeInteger(0, 1000));
+    EXPECT_EQ(7U, encoder.encodeInteger(1, 7));
+    EXPECT_EQ(1U, encoder.encodeInteger(0, 1001));
+    EXPECT_EQ(uint64_t(-2), encoder.encodeInteger(1, 5));
+
+    // Negative deltas still pack into a single byte
+    EXPECT_EQ(1 + 8, pack(&buffer, static_cast<int64_t>(uint64_t(-2))));
+
+    EXPECT_EQ(1000U, decoder.decodeInteger(0, 1000));
+    EXPECT_EQ(7U, decoder.decodeInteger(1, 7));
+    EXPECT_EQ(1001U, decoder.decodeInteger(0, 1));
+    EXPECT_EQ(5U, decoder.decodeInteger(1, uint64_t(-2)));
+
+    // Strings are tagged with their position in the history once seen
+    EXPECT_EQ(0, encoder.encodeString("sym", 3));
+    EXPECT_EQ(1, encoder.encodeString("sym", 3));
+    EXPECT_EQ(0, encoder.encodeString("symbol", 6));
+    EXPECT_EQ(2, encoder.encodeString("symbol", 6));
+    EXPECT_EQ(1, encoder.encodeString("sym", 3));
+
+    // The oldest strings are replaced first
+    EXPECT_EQ(0, encoder.encodeString("a", 1));
+    EXPECT_EQ(0, encoder.encodeString("b", 1));
+    EXPECT_EQ(0, encoder.encodeString("c", 1));
+    EXPECT_EQ("c", encoder.strings[0]);
+    EXPECT_EQ(0, encoder.encodeString("sym", 3));
+    EXPECT_EQ(2, encoder.encodeString("sym", 3));
+
+    // The same extent keeps the history, a new one clears it
+    encoder.begin(1, 2);
+    EXPECT_EQ(1U, encoder.encodeInteger(0, 1002));
+    encoder.begin(2, 3);
+    ASSERT_EQ(3U, encoder.integers.size());
+    EXPECT_EQ(1003U, encoder.encodeInteger(0, 1003));
+    EXPECT_EQ(0, encoder.encodeString("sym", 3));
+    EXPECT_EQ(1, encoder.nextString);
+}
+
+TEST_F(PackerTest, StaticStringTable) {
+    // Strings are identified by their address
+    const char strings[] = "a\0a";
+    StaticStringTable table;
+    EXPECT_FALSE(table.hasUnpersisted());
+    EXPECT_EQ(0U, table.getId(strings));
+    EXPECT_EQ(1U, table.getId(strings + 2));
+    EXPECT_EQ(0U, table.getId(strings));
+    ASSERT_EQ(2U, table.strings.size());
+    EXPECT_EQ(strings + 2, table.strings[1]);
+
+    EXPECT_TRUE(table.hasUnpersisted());
+    table.numPersisted = 2;
+    EXPECT_FALSE(table.hasUnpersisted());
+    EXPECT_EQ(2U, table.getId("b"));
+    EXPECT_TRUE(table.hasUnpersisted());
+
+    table.clear();
+    EXPECT_FALSE(table.hasUnpersisted());
+    EXPECT_EQ(0U, table.getId(strings + 2));
+}
+
 }  // namespace
@@ -30,6 +30,9 @@
 //   other tests.
 // * Create a new entry for the test in the #tests table.
 
+// Benchmarks RuntimeLogger internals such as the StagingBuffer (see Common.h)
+#define EXPOSE_PRIVATES
+
 #include <chrono>
 #include <condition_variable>
 #include <cstdio>
@@ -49,6 +52,7 @@
 #include "Log.h"
 #include "PerfHelper.h"
 #include "Portability.h"
+#include "RuntimeLogger.h"
 #include "Util.h"
 #include "Fence.h"
 
@@ -405,6 +409,28 @@ double compressLinearSearch() {
     return Cycles::toSeconds(stop - start)/count;
 }
 
+double compressBitScan() {
+    const int count = 1000000;
+    uint64_t *buffer = static_cast<uint64_t*>(malloc(count*sizeof(uint64_t)));
+
+    srand(0);
+    for (int i = 0; i < count; i++) {
+        buffer[i] = 1UL << (rand()%64);
+    }
+
+    int sumOfBytes = 0;
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < count; ++i) {
+        sumOfBytes += BufferUtils::getNumBytesNeeded(buffer[i]);
+    }
+    uint64_t stop = Cycles::rdtsc();
+
+    discard(&sumOfBytes);
+
+    free(buffer);
+    return Cycles::toSeconds(stop - start)/count;
+}
+
 double delayInBenchmark() {
     int count = 1000000;
     uint64_t x = 0;
@@ -1203,6 +1229,53 @@ double uncompressedLogEntryIterationWithFence() {
     return Cycles::toSeconds(stop - start)/(arraySize);
 }
 
+// Consumer half of stagingBufferContended(); mimics a compression thread by
+// consuming everything it peeks until numBytes have been consumed.
+void stagingBufferConsumer(RuntimeLogger::StagingBuffer *sb,
+                           uint64_t numBytes,
+                           pthread_barrier_t *barrier)
+{
+    bindThreadToCpu(0);
+    pthread_barrier_wait(barrier);
+
+    uint64_t consumed = 0;
+    while (consumed < numBytes) {
+        uint64_t bytesAvailable;
+        sb->peek(&bytesAvailable);
+        if (bytesAvailable > 0) {
+            sb->consume(bytesAvailable);
+            consumed += bytesAvailable;
+        }
+    }
+}
+
+// Per message cost of staging log messages in a StagingBuffer while a
+// consumer thread on another core drains it, which includes the cache misses
+// on the producer's and consumer's positions.
+double stagingBufferContended()
+{
+    const uint64_t count = 10000000;
+    const uint32_t msgSize = 32;
+    RuntimeLogger::StagingBuffer sb(0);
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, 2);
+    std::thread consumer(stagingBufferConsumer, &sb, count*msgSize, &barrier);
+    pthread_barrier_wait(&barrier);
+
+    uint64_t start = Cycles::rdtsc();
+    for (uint64_t i = 0; i < count; ++i) {
+        char *pos = sb.reserveProducerSpace(msgSize);
+        *reinterpret_cast<uint64_t*>(pos) = i;
+        sb.finishReservation(msgSize);
+    }
+    consumer.join();
+    uint64_t stop = Cycles::rdtsc();
+
+    pthread_barrier_destroy(&barrier);
+    return Cycles::toSeconds(stop - start)/count;
+}
+
 // The following struct and table define each performance test in terms of
 // a string name and a function that implements the test.
 struct TestInfo {
@@ -1239,6 +1312,8 @@ TestInfo tests[] = {
      "Compress 1M uint64_t's via binary searching if-statements"},
     {"compressLinearSearch", compressLinearSearch,
      "Compress 1M uint64_t's via linear searching for-loop"},
+    {"compressBitScan", compressBitScan,
+     "Compress 1M uint64_t's via a leading zero count"},
     {"delayInBenchmark", delayInBenchmark,
      "Taking an addition, modulo, and rdtsc()"},
     {"div32", div32,
@@ -1327,6 +1402,8 @@ TestInfo tests[] = {
       "Per element cost of iterating through log entries"},
     {"LogEntryIterationFence", uncompressedLogEntryIterationWithFence,
       "Per element cost of iterating through log entries with lfences"},
+    {"stagingBufferContended", stagingBufferContended,
+      "Stage a 32B log message while another core consumes them"},
 
 };
 
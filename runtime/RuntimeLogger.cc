@@ -15,15 +15,26 @@
 
 
 #include <fcntl.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <iosfwd>
 #include <iostream>
 #include <locale>
+#include <new>
+#include <stdexcept>
 #include <sstream>
 #include <string>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <climits>
+
 #include "Cycles.h"         /* Cycles::rdtsc() */
+#include "GeneratedCode.h"
+#include "OutputBackend.h"
 #include "RuntimeLogger.h"
 #include "Config.h"
 #include "Util.h"
@@ -32,26 +43,216 @@ namespace NanoLogInternal {
 
 // Define the static members of RuntimeLogger here
 __thread RuntimeLogger::StagingBuffer *RuntimeLogger::stagingBuffer = nullptr;
+__thread RuntimeLogger::StagingBuffer *
+            RuntimeLogger::channelBuffers[NanoLogConfig::MAX_LOG_CHANNELS] = {};
 thread_local RuntimeLogger::StagingBufferDestroyer RuntimeLogger::sbc;
+__thread RuntimeLogger::BatchReservation RuntimeLogger::batch = {};
+__thread uint64_t RuntimeLogger::reserveAllocCycles = 0;
 RuntimeLogger RuntimeLogger::nanoLogSingleton;
 
+/**
+ * Compression function for the drop marker log message below; it's
+ * equivalent to the one NanoLogCpp17.h would generate for a single uint32_t.
+ */
+static void
+compressDropMarker(int numNibbles, const ParamType *paramTypes,
+                   char **input, char **output,
+                   BufferUtils::ArgumentHistory *history,
+                   BufferUtils::StaticStringTable *)
+{
+    uint32_t numDropped;
+    std::memcpy(&numDropped, *input, sizeof(uint32_t));
+    *input += sizeof(uint32_t);
+
+    auto *nibbles = reinterpret_cast<BufferUtils::TwoNibbles*>(*output);
+    *output += 1;
+    if (history) {
+        int64_t delta = static_cast<int64_t>(
+                                    history->encodeInteger(0, numDropped));
+        BufferUtils::setNibble(nibbles, 0, BufferUtils::pack(output, delta));
+    } else {
+        BufferUtils::setNibble(nibbles, 0,
+                               BufferUtils::pack(output, numDropped));
+    }
+}
+
+// Invocation site of the log message that marks where log messages were
+// dropped in a StagingBuffer (see setDropOnFull())
+static const ParamType dropMarkerParamTypes[] = {ParamType::NON_STRING};
+static const StaticLogInfo dropMarkerInfo(&compressDropMarker,
+                                          __FILE__,
+                                          __LINE__,
+                                          WARNING,
+                                          "NanoLog dropped %u log message(s) "
+                                          "because the StagingBuffer was full",
+                                          1,
+                                          1,
+                                          dropMarkerParamTypes);
+static int dropMarkerLogId = UNASSIGNED_LOGID;
+
+// Size of a drop marker log message in the StagingBuffer
+static const size_t DROP_MARKER_SIZE = sizeof(Log::UncompressedEntry)
+                                                        + sizeof(uint32_t);
+
+// Fatal signals that the crash handler dumps the StagingBuffers on (see
+// installCrashHandler()) and the actions installed for them beforehand
+static const int crashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static struct sigaction previousCrashActions[Util::arraySize(crashSignals)];
+
+/**
+ * Returns the bucket of a latency in the distributions of NanoLog::Metrics
+ *
+ * \param cycles
+ *      Latency in rdtsc() cycles
+ */
+static size_t
+getLatencyBucket(uint64_t cycles)
+{
+    uint64_t us = PerfUtils::Cycles::toMicroseconds(cycles);
+    if (us == 0)
+        return 0;
+
+    size_t bucket = 64 - __builtin_clzll(us);
+    return std::min<size_t>(bucket, NanoLog::Metrics::NUM_LATENCY_BUCKETS - 1);
+}
+
 // RuntimeLogger constructor
 RuntimeLogger::RuntimeLogger()
-        : threadBuffers()
+        : workers()
         , nextBufferId()
+        , orphanedBuffers()
+        , bufferMutex()
+        , sharedMemoryName()
+        , sharedMemoryRegistry(nullptr)
+        , sharedBufferRegions()
+        , logFile(NanoLogConfig::DEFAULT_LOG_FILE)
+        , currentLogLevel(NOTICE)
+        , outputBackendType(IO_URING)
+        , durability(DURABILITY_PER_BUFFER)
+        , syncIntervalMs(0)
+        , syncIntervalBytes(0)
+        , deltaEncoding(false)
+        , blockCompression(false)
+        , hugePages(HUGE_PAGES_NONE)
+        , rotationMaxBytes(0)
+        , rotationMaxSeconds(0)
+        , numOutputBuffers(NanoLogConfig::DEFAULT_NUM_OUTPUT_BUFFERS)
+        , outputBufferSize(NanoLogConfig::OUTPUT_BUFFER_SIZE)
+        , stagingBufferSize(NanoLogConfig::STAGING_BUFFER_SIZE)
+        , adaptiveStagingBufferLimit(0)
+        , dropLogLevel(NUM_LOG_LEVELS)
+        , numDroppedLogMessages(0)
+        , flightRecorder(false)
+        , crashLogFile()
+        , crashFd(-1)
+        , crashBuffer(nullptr)
+        , crashBufferSize(0)
+        , crashDictionary(nullptr)
+        , crashDictionaryMutex()
+        , crashFlushInProgress(false)
+        , backgroundThreadCores()
+        , defaultAffinity()
+        , backgroundThreadPolicy(-1)
+        , backgroundThreadPriority(0)
+        , wakeupSeq(0)
+        , numSleepingWorkers(0)
+        , invocationSites()
+        , logSiteRules()
+        , logSiteStates()
+        , logSiteMutex()
+        , channels()
+{
+    if (sched_getaffinity(0, sizeof(defaultAffinity), &defaultAffinity) != 0)
+        CPU_ZERO(&defaultAffinity);
+
+    std::vector<int> outputFds;
+    try {
+        outputFds = openOutputFiles(logFile,
+                                    NanoLogConfig::DEFAULT_COMPRESSION_THREADS,
+                                    durability);
+    } catch (std::ios_base::failure &e) {
+        fprintf(stderr, "NanoLog could not open the default file location "
+                "for the log file (\"%s\").\r\n Please check the permissions "
+                "or use NanoLog::setLogFile(const char* filename) to "
+                "specify a different log file.\r\n", logFile.c_str());
+        std::exit(-1);
+    }
+
+    createWorkers(outputFds);
+}
+
+// RuntimeLogger destructor
+RuntimeLogger::~RuntimeLogger() {
+    sync();
+
+    // A crash from here on finds nothing to dump
+    if (crashFd >= 0) {
+        for (size_t i = 0; i < Util::arraySize(crashSignals); ++i)
+            sigaction(crashSignals[i], &previousCrashActions[i], nullptr);
+        close(crashFd);
+        crashFd = -1;
+    }
+
+    destroyWorkers();
+    destroyChannels();
+
+    // The buffer regions outlive the process, so the external consumer can
+    // still drain them; it only needs to know that nothing more is coming.
+    if (sharedMemoryRegistry != nullptr)
+        sharedMemoryRegistry->closed.store(1, std::memory_order_release);
+}
+
+/**
+ * CompressionWorker constructor
+ *
+ * \param logger
+ *      RuntimeLogger that owns the worker
+ * \param workerId
+ *      Identifies the worker within the RuntimeLogger
+ * \param outputFd
+ *      File descriptor the worker shall output to. The worker takes ownership
+ *      of the descriptor and closes it upon destruction.
+ * \param channel
+ *      Log channel the worker outputs, or nullptr for the default log
+ *
+ * The worker's output buffer ring and OutputBackend are configured according
+ * to the RuntimeLogger's current settings.
+ */
+RuntimeLogger::CompressionWorker::CompressionWorker(RuntimeLogger *logger,
+                                                    uint32_t workerId,
+                                                    int outputFd,
+                                                    LogChannel *channel)
+        : logger(logger)
+        , id(workerId)
+        , channel(channel)
+        , threadBuffers()
         , bufferMutex()
+        , newThreadBuffers(nullptr)
+        , numThreadBuffers(0)
         , compressionThread()
-        , hasOutstandingOperation(false)
         , compressionThreadShouldExit(false)
         , syncStatus(SYNC_COMPLETED)
         , condMutex()
         , workAdded()
         , hintSyncCompleted()
-        , outputFd(-1)
-        , aioCb()
+        , outputFd(outputFd)
+        , indexFd(-1)
+        , outputFileOffset(0)
+        , checkpointOffset(0)
+        , cyclesAtOutputFileStart(PerfUtils::Cycles::rdtsc())
+        , retiredOutputFds()
+        , rotationFailed(false)
+        , bytesWrittenSinceSync(0)
+        , cyclesAtUnsyncedWrite(0)
+        , backend(nullptr)
+        , outputBuffers()
+        , outputBufferSize(logger->outputBufferSize)
+        , outputBufferMappedSize(0)
+        , compressingIndex(0)
         , compressingBuffer(nullptr)
-        , outputDoubleBuffer(nullptr)
-        , currentLogLevel(NOTICE)
+        , blockBuffers()
+        , blockBufferSize(0)
+        , blockBufferMappedSize(0)
         , cycleAtThreadStart(0)
         , cyclesAtLastAIOStart(0)
         , cyclesActive(0)
@@ -62,326 +263,2218 @@ RuntimeLogger::RuntimeLogger()
         , totalBytesRead(0)
         , totalBytesWritten(0)
         , padBytesWritten(0)
+        , totalBytesBlockCompressed(0)
+        , cyclesBlockCompressing(0)
         , logsProcessed(0)
         , numAioWritesCompleted(0)
+        , numRotations(0)
+        , numSyncs(0)
+        , cyclesSyncing(0)
+        , outputRingOccupancyDist()
+        , numOutputRingStalls(0)
+        , cyclesOutputRingStalled(0)
+        , numIdleWaits(0)
+        , cyclesIdleWaiting(0)
+        , logsDiscarded(0)
+        , writeLatencyDist()
+        , cyclesAtWriteSubmit()
+        , oldestWriteInFlight(0)
+        , numWritesInFlight(0)
+        , syncLatencyDist()
+        , retiredAllocations(0)
+        , retiredWaitsForSpace(0)
+        , retiredCyclesWaitingForSpace(0)
+        , retiredLogSiteStats()
+        , logSiteCompressedBytes()
         , coreId(-1)
-        , registrationMutex()
-        , invocationSites()
         , nextInvocationIndexToBePersisted(0)
 {
     for (size_t i = 0; i < Util::arraySize(stagingBufferPeekDist); ++i)
         stagingBufferPeekDist[i] = 0;
 
-    const char *filename = NanoLogConfig::DEFAULT_LOG_FILE;
-    outputFd = open(filename, NanoLogConfig::FILE_PARAMS, 0666);
-    if (outputFd < 0) {
-        fprintf(stderr, "NanoLog could not open the default file location "
-                "for the log file (\"%s\").\r\n Please check the permissions "
-                "or use NanoLog::setLogFile(const char* filename) to "
-                "specify a different log file.\r\n", filename);
-        std::exit(-1);
-    }
+    for (size_t i = 0; i < Util::arraySize(outputRingOccupancyDist); ++i)
+        outputRingOccupancyDist[i] = 0;
 
-    memset(&aioCb, 0, sizeof(aioCb));
+#ifdef RECORD_LOG_SITE_STATS
+    retiredLogSiteStats.resize(NanoLogConfig::MAX_LOG_SITE_STATS + 1);
+    logSiteCompressedBytes.resize(NanoLogConfig::MAX_LOG_SITE_STATS + 1);
+#endif
 
-    int err = posix_memalign(reinterpret_cast<void **>(&compressingBuffer),
-                             512, NanoLogConfig::OUTPUT_BUFFER_SIZE);
-    if (err) {
-        perror("The NanoLog system was not able to allocate enough memory "
-                       "to support its operations. Quitting...\r\n");
-        std::exit(-1);
+    // The mappings are page aligned, which satisfies O_DIRECT
+    for (uint32_t i = 0; i < logger->numOutputBuffers; ++i) {
+        outputBufferMappedSize = outputBufferSize;
+        outputBuffers.push_back(mapBuffer(&outputBufferMappedSize));
     }
+    compressingBuffer = outputBuffers[compressingIndex];
+    cyclesAtWriteSubmit.resize(outputBuffers.size());
 
-    err = posix_memalign(reinterpret_cast<void **>(&outputDoubleBuffer),
-                         512, NanoLogConfig::OUTPUT_BUFFER_SIZE);
-    if (err) {
-        perror("The NanoLog system was not able to allocate enough memory "
-                       "to support its operations. Quitting...\r\n");
-        std::exit(-1);
+    // A block holds a whole output buffer and, for the first one, the
+    // Checkpoint left uncompressed in front of it. It's rounded up for
+    // O_DIRECT padding.
+    if (logger->blockCompression) {
+        blockBufferSize = downCast<uint32_t>(sizeof(Log::Checkpoint)
+                        + Log::maxCompressedBlockSize(outputBufferSize));
+        blockBufferSize = (blockBufferSize + NanoLogConfig::DIRECT_IO_ALIGNMENT
+                        - 1) & ~(NanoLogConfig::DIRECT_IO_ALIGNMENT - 1);
+
+        for (uint32_t i = 0; i < logger->numOutputBuffers; ++i) {
+            blockBufferMappedSize = blockBufferSize;
+            blockBuffers.push_back(mapBuffer(&blockBufferMappedSize));
+        }
     }
 
-#ifndef BENCHMARK_DISCARD_ENTRIES_AT_STAGINGBUFFER
-    compressionThread = std::thread(&RuntimeLogger::compressionThreadMain, this);
-#endif
+    // All buffers except the one being compressed into can be in flight
+    backend = OutputBackend::create(logger->outputBackendType,
+                            downCast<uint32_t>(outputBuffers.size() - 1));
+
+    // The output buffers are registered with the backend by the compression
+    // thread so that they're faulted in on the thread's NUMA node.
+
+    openIndexFile();
 }
 
-// RuntimeLogger destructor
-RuntimeLogger::~RuntimeLogger() {
-    sync();
+// CompressionWorker destructor
+RuntimeLogger::CompressionWorker::~CompressionWorker() {
+    stop();
 
-    // Stop the compression thread
-    {
-        std::lock_guard<std::mutex> lock(nanoLogSingleton.condMutex);
-        nanoLogSingleton.compressionThreadShouldExit = true;
-        nanoLogSingleton.workAdded.notify_all();
+    if (backend) {
+        delete backend;
+        backend = nullptr;
     }
 
-    if (nanoLogSingleton.compressionThread.joinable())
-        nanoLogSingleton.compressionThread.join();
-
     // Free all the data structures
-    if (compressingBuffer) {
-        free(compressingBuffer);
-        compressingBuffer = nullptr;
-    }
+    for (char *buffer : outputBuffers)
+        unmapBuffer(buffer, outputBufferMappedSize);
+    outputBuffers.clear();
 
-    if (outputDoubleBuffer) {
-        free(outputDoubleBuffer);
-        outputDoubleBuffer = nullptr;
-    }
+    for (char *buffer : blockBuffers)
+        unmapBuffer(buffer, blockBufferMappedSize);
+    blockBuffers.clear();
+    compressingBuffer = nullptr;
+
+    // The I/O was drained by stop()
+    closeRetiredOutputFiles();
 
     if (outputFd > 0)
         close(outputFd);
 
+    if (indexFd >= 0)
+        close(indexFd);
+
     outputFd = 0;
+    indexFd = -1;
 }
 
-// Documentation in NanoLog.h
-std::string
-RuntimeLogger::getStats() {
-    std::ostringstream out;
-    char buffer[1024];
-    // Leaks abstraction, but basically flush so we get all the time
-    uint64_t start = PerfUtils::Cycles::rdtsc();
-    fdatasync(nanoLogSingleton.outputFd);
-    uint64_t stop = PerfUtils::Cycles::rdtsc();
-    nanoLogSingleton.cyclesDiskIO_upperBound += (stop - start);
+/**
+ * Positions the worker at the end of its output file and opens the index
+ * file that accompanies it. The index locates output buffers by offset;
+ * since the output file is only appended to by this worker, the offsets
+ * follow from its size. An empty output file means any existing index is
+ * stale. Block compressed logs are decompressed as a whole, so they're not
+ * indexed.
+ */
+void
+RuntimeLogger::CompressionWorker::openIndexFile()
+{
+    off_t fileSize = lseek(outputFd, 0, SEEK_END);
+    if (fileSize < 0)
+        return;
 
-    double outputTime =
-            PerfUtils::Cycles::toSeconds(nanoLogSingleton.cyclesDiskIO_upperBound);
-    double compressTime =
-            PerfUtils::Cycles::toSeconds(nanoLogSingleton.cyclesCompressing);
-    double workTime = outputTime + compressTime;
+    outputFileOffset = checkpointOffset = fileSize;
+    if (logger->blockCompression)
+        return;
 
-    double totalBytesWrittenDouble = static_cast<double>(
-            nanoLogSingleton.totalBytesWritten);
-    double totalBytesReadDouble = static_cast<double>(
-            nanoLogSingleton.totalBytesRead);
-    double padBytesWrittenDouble = static_cast<double>(
-            nanoLogSingleton.padBytesWritten);
-    double numEventsProcessedDouble = static_cast<double>(
-            nanoLogSingleton.logsProcessed);
+    std::string indexFile = getFileName() + Log::INDEX_FILE_SUFFIX;
+    int flags = O_WRONLY|O_CREAT|O_APPEND|((fileSize == 0) ? O_TRUNC : 0);
+    indexFd = open(indexFile.c_str(), flags, 0666);
+    if (indexFd < 0) {
+        fprintf(stderr, "NanoLog could not open the index file %s (%s); "
+                        "time range queries on the log will need to scan "
+                        "it in its entirety.\r\n",
+                        indexFile.c_str(), strerror(errno));
+    }
+}
 
-    snprintf(buffer, 1024,
-               "\r\nWrote %lu events (%0.2lf MB) in %0.3lf seconds "
-                   "(%0.3lf seconds spent compressing)\r\n",
-               nanoLogSingleton.logsProcessed,
-               totalBytesWrittenDouble / 1.0e6,
-               workTime,
-               compressTime);
-    out << buffer;
+/**
+ * Returns true if the worker's output file is due to be rotated according to
+ * the RuntimeLogger's rotation policy (see setLogRotation()).
+ */
+bool
+RuntimeLogger::CompressionWorker::shouldRotateOutputFile()
+{
+    if (rotationFailed)
+        return false;
 
-    snprintf(buffer, 1024,
-           "There were %u file flushes and the final sync time was %lf sec\r\n",
-           nanoLogSingleton.numAioWritesCompleted,
-           PerfUtils::Cycles::toSeconds(stop - start));
-    out << buffer;
+    uint64_t maxBytes = logger->rotationMaxBytes.load(
+                                                    std::memory_order_relaxed);
+    if (maxBytes > 0 && outputFileOffset >= maxBytes)
+        return true;
 
-    double secondsAwake =
-            PerfUtils::Cycles::toSeconds(nanoLogSingleton.cyclesActive);
-    double secondsThreadHasBeenAlive = PerfUtils::Cycles::toSeconds(
-            PerfUtils::Cycles::rdtsc() - nanoLogSingleton.cycleAtThreadStart);
-    snprintf(buffer, 1024,
-               "Compression Thread was active for %0.3lf out of %0.3lf seconds "
-                   "(%0.2lf %%)\r\n",
-               secondsAwake,
-               secondsThreadHasBeenAlive,
-               100.0 * secondsAwake / secondsThreadHasBeenAlive);
-    out << buffer;
+    uint32_t maxSeconds = logger->rotationMaxSeconds.load(
+                                                    std::memory_order_relaxed);
+    return maxSeconds > 0 && PerfUtils::Cycles::toSeconds(
+            PerfUtils::Cycles::rdtsc() - cyclesAtOutputFileStart) >= maxSeconds;
+}
 
-    snprintf(buffer, 1024,
-                "On average, that's\r\n\t%0.2lf MB/s or "
-                    "%0.2lf ns/byte w/ processing\r\n",
-               (totalBytesWrittenDouble / 1.0e6) / (workTime),
-               (workTime * 1.0e9) / totalBytesWrittenDouble);
-    out << buffer;
+/**
+ * Moves the worker's output file (and its index) aside under a timestamped
+ * name and starts outputting to a new file under the original name. Writes
+ * to the old file that are still in flight complete normally since the file
+ * handle follows the rename; the handle is closed once they're reaped. The
+ * caller is responsible for starting the new file off with a Checkpoint and
+ * the dictionary. If the rotation fails, the worker keeps outputting to the
+ * same file and no further rotations are attempted.
+ *
+ * 
+eturn
+ *      True if the worker now outputs to a new file
+ */
+bool
+RuntimeLogger::CompressionWorker::rotateOutputFile()
+{
+    std::string fileName = getFileName();
+    std::string rotatedName = getRotatedFileName(fileName, std::time(nullptr));
 
-    // Since we sleep at 1µs intervals and check for completion at wake up,
-    // it's possible the IO finished before we woke-up, thus enlarging the time.
-    snprintf(buffer, 1024,
-                "\t%0.2lf MB/s or %0.2lf ns/byte disk throughput (min)\r\n",
-                (totalBytesWrittenDouble / 1.0e6) / outputTime,
-                (outputTime * 1.0e9) / totalBytesWrittenDouble);
-    out << buffer;
+    int fd = -1;
+    if (rename(fileName.c_str(), rotatedName.c_str()) == 0)
+        fd = openOutputFile(fileName, getDurability());
 
-    snprintf(buffer, 1024,
-                "\t%0.2lf MB per flush with %0.1lf bytes/event\r\n",
-                (totalBytesWrittenDouble / 1.0e6) /
-                                         nanoLogSingleton.numAioWritesCompleted,
-                totalBytesWrittenDouble * 1.0 / numEventsProcessedDouble);
-    out << buffer;
+    if (fd < 0) {
+        fprintf(stderr, "NanoLog could not rotate the log file %s (%s); it "
+                        "will no longer be rotated.\r\n",
+                        fileName.c_str(), strerror(errno));
+        rotationFailed = true;
+        return false;
+    }
 
-    snprintf(buffer, 1024,
-                "\t%0.2lf ns/event in total\r\n"
-                   "\t%0.2lf ns/event compressing\r\n",
-                (workTime) * 1.0e9 / numEventsProcessedDouble,
-                compressTime * 1.0e9 / numEventsProcessedDouble);
-    out << buffer;
+    retiredOutputFds.push_back(outputFd);
+    if (backend->getNumOutstanding() == 0)
+        closeRetiredOutputFiles();
 
-    snprintf(buffer, 1024, "The compression ratio was %0.2lf-%0.2lfx "
-                   "(%lu bytes in, %lu bytes out, %lu pad bytes)\n",
-           1.0 * totalBytesReadDouble / (totalBytesWrittenDouble
-                                         + padBytesWrittenDouble),
-           1.0 * totalBytesReadDouble / totalBytesWrittenDouble,
-           nanoLogSingleton.totalBytesRead,
-           nanoLogSingleton.totalBytesWritten,
-           nanoLogSingleton.padBytesWritten);
-    out << buffer;
+    if (indexFd >= 0) {
+        std::string indexFile = fileName + Log::INDEX_FILE_SUFFIX;
+        std::string rotatedIndex = rotatedName + Log::INDEX_FILE_SUFFIX;
+        if (rename(indexFile.c_str(), rotatedIndex.c_str()) != 0)
+            unlink(indexFile.c_str());
 
-    return out.str();
+        close(indexFd);
+        indexFd = -1;
+    }
+
+    outputFd = fd;
+    openIndexFile();
+    cyclesAtOutputFileStart = PerfUtils::Cycles::rdtsc();
+    ++numRotations;
+    return true;
 }
 
 /**
- * Returns a string detailing the distribution of how long vs. how many times
- * the log producers had to wait for free space and how big vs. how many times
- * the consumer (background thread) read.
- *
- * Note: The distribution stats for the producer must be enabled via
- * -DRECORD_PRODUCER_STATS during compilation, otherwise only the consumer
- * stats will be printed.
+ * Closes the file handles of the rotated output files. This shall only be
+ * invoked when the backend has no writes outstanding.
  */
-std::string
-RuntimeLogger::getHistograms()
+void
+RuntimeLogger::CompressionWorker::closeRetiredOutputFiles()
 {
-    std::ostringstream out;
-    char buffer[1024];
-
-    snprintf(buffer, 1024, "Distribution of StagingBuffer.peek() sizes\r\n");
-    out << buffer;
-    size_t numIntervals =
-            Util::arraySize(nanoLogSingleton.stagingBufferPeekDist);
-    for (size_t i = 0; i < numIntervals; ++i) {
-        snprintf(buffer, 1024
-                , "\t%02lu - %02lu%%: %lu\r\n"
-                , i*100/numIntervals
-                , (i+1)*100/numIntervals
-                , nanoLogSingleton.stagingBufferPeekDist[i]);
-        out << buffer;
+    for (int fd : retiredOutputFds) {
+        if (getDurability() == DURABILITY_PERIODIC)
+            fdatasync(fd);
+        close(fd);
     }
+    retiredOutputFds.clear();
+}
 
-    {
-        std::unique_lock<std::mutex> lock(nanoLogSingleton.bufferMutex);
-        for (size_t i = 0; i < nanoLogSingleton.threadBuffers.size(); ++i) {
-            StagingBuffer *sb = nanoLogSingleton.threadBuffers.at(i);
-            if (sb) {
-                snprintf(buffer, 1024, "Thread %u:\r\n", sb->getId());
-                out << buffer;
+/**
+ * Returns true if the output file is due to be flushed in the
+ * DURABILITY_PERIODIC mode, that is the output written since the last flush
+ * exceeds the size limit or has been waiting for the time limit.
+ */
+bool
+RuntimeLogger::CompressionWorker::periodicSyncDue()
+{
+    if (getDurability() != DURABILITY_PERIODIC || bytesWrittenSinceSync == 0)
+        return false;
 
-                snprintf(buffer, 1024,
-                                 "\tAllocations   : %lu\r\n"
-                                 "\tTimes Blocked : %u\r\n",
-                         sb->numAllocations,
-                         sb->numTimesProducerBlocked);
-                out << buffer;
+    uint32_t syncIntervalMs = (channel != nullptr) ? channel->syncIntervalMs
+                                                   : logger->syncIntervalMs;
+    uint64_t syncIntervalBytes = (channel != nullptr)
+                                                ? channel->syncIntervalBytes
+                                                : logger->syncIntervalBytes;
 
-#ifdef RECORD_PRODUCER_STATS
-                uint64_t averageBlockNs = PerfUtils::Cycles::toNanoseconds(
-                        sb->cyclesProducerBlocked)/sb->numTimesProducerBlocked;
-                snprintf(buffer, 1024,
-                                 "\tAvgBlock (ns) : %lu\r\n"
-                                 "\tBlock Dist\r\n",
-                         averageBlockNs);
-                for (size_t i = 0; i < Util::arraySize(
-                        sb->cyclesProducerBlockedDist); ++i)
-                {
-                    snprintf(buffer, 1024
-                            , "\t\t%4lu - %4lu ns: %u\r\n"
-                            , i*10
-                            , (i+1)*10
-                            , sb->cyclesProducerBlockedDist[i]);
-                    out << buffer;
-                }
-#endif
-            }
-        }
-    }
+    if (syncIntervalBytes > 0 && bytesWrittenSinceSync >= syncIntervalBytes)
+        return true;
 
+    return syncIntervalMs > 0 &&
+            PerfUtils::Cycles::rdtsc() - cyclesAtUnsyncedWrite >=
+                PerfUtils::Cycles::fromNanoseconds(
+                                    uint64_t(syncIntervalMs)*1000000);
+}
 
-#ifndef RECORD_PRODUCER_STATS
-    out << "Note: Detailed Producer stats were compiled out. Enable "
-            "via -DRECORD_PRODUCER_STATS";
-#endif
+/**
+ * Flushes the output written so far to disk if the durability mode leaves
+ * it in the page cache (i.e. DURABILITY_PERIODIC). Writes still in flight
+ * are not guaranteed to be covered, so this should be invoked once they
+ * have completed.
+ */
+void
+RuntimeLogger::CompressionWorker::flushOutputFile()
+{
+    if (getDurability() != DURABILITY_PERIODIC || bytesWrittenSinceSync == 0)
+        return;
 
-    return out.str();
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    if (fdatasync(outputFd) != 0)
+        perror("NanoLog could not flush the log file to disk");
+
+    uint64_t cycles = PerfUtils::Cycles::rdtsc() - start;
+    cyclesSyncing += cycles;
+    ++syncLatencyDist[getLatencyBucket(cycles)];
+    ++numSyncs;
+    bytesWrittenSinceSync = 0;
 }
 
-// See documentation in NanoLog.h
+/**
+ * Discards the oldest log messages in a StagingBuffer in the flight recorder
+ * mode so that at most half of it stays in use; the producer can then keep
+ * logging without waiting on the worker.
+ *
+ * \param sb
+ *      StagingBuffer to discard log messages from
+ * \param peekPosition
+ *      Oldest log message in the StagingBuffer, as returned by sb->peek()
+ * \param peekBytes
+ *      Number of bytes available at peekPosition
+ */
 void
-RuntimeLogger::preallocate() {
-    nanoLogSingleton.ensureStagingBufferAllocated();
-    // I wonder if it'll be a good idea to update minFreeSpace as well since
-    // the user is already willing to invoke this up front cost.
+RuntimeLogger::CompressionWorker::discardOldestLogMsgs(StagingBuffer *sb,
+                                                       char *peekPosition,
+                                                       uint64_t peekBytes)
+{
+    uint64_t bytesQueued = sb->getBytesQueued();
+    uint64_t bytesToRetain = sb->getCapacity()/2;
+    uint64_t bytesDiscarded = 0;
+
+    while (bytesQueued - bytesDiscarded > bytesToRetain &&
+            bytesDiscarded < peekBytes) {
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                                peekPosition + bytesDiscarded);
+        bytesDiscarded += entry->entrySize;
+        ++logsDiscarded;
+    }
+
+    if (bytesDiscarded > 0)
+        sb->consume(bytesDiscarded);
 }
 
 /**
-* Internal helper function to wait for AIO completion.
-*/
+ * Records the latencies of output writes that the OutputBackend reported as
+ * completed; the oldest writes in flight are assumed to be the ones that
+ * completed.
+ *
+ * \param numCompleted
+ *      Number of writes reaped
+ */
 void
-RuntimeLogger::waitForAIO() {
-    if (hasOutstandingOperation) {
-        if (aio_error(&aioCb) == EINPROGRESS) {
-            const struct aiocb *const aiocb_list[] = {&aioCb};
-            int err = aio_suspend(aiocb_list, 1, NULL);
+RuntimeLogger::CompressionWorker::recordWritesCompleted(uint32_t numCompleted)
+{
+    uint64_t now = PerfUtils::Cycles::rdtsc();
+    for (uint32_t i = 0; i < numCompleted; ++i) {
+        uint64_t cycles = now - cyclesAtWriteSubmit[oldestWriteInFlight];
+        ++writeLatencyDist[getLatencyBucket(cycles)];
+        oldestWriteInFlight = downCast<uint32_t>(
+                    (oldestWriteInFlight + 1) % cyclesAtWriteSubmit.size());
+    }
 
-            if (err != 0)
-                perror("LogCompressor's Posix AIO suspend operation failed");
-        }
+    numWritesInFlight = backend->getNumOutstanding();
+}
 
-        int err = aio_error(&aioCb);
-        ssize_t ret = aio_return(&aioCb);
+/**
+ * Applies the CPU affinity and scheduling policy configured in the
+ * RuntimeLogger (see setBackgroundThreadAffinity() and
+ * setBackgroundThreadScheduling()) to the worker's compression thread. Errors
+ * are reported to stderr. The caller must hold the logger's bufferMutex.
+ *
+ * \param thread
+ *      Handle of the worker's compression thread
+ */
+void
+RuntimeLogger::CompressionWorker::applyThreadSettings(pthread_t thread) {
+    cpu_set_t cpus = logger->defaultAffinity;
+    if (!logger->backgroundThreadCores.empty()) {
+        CPU_ZERO(&cpus);
+        CPU_SET(logger->backgroundThreadCores[
+                    id % logger->backgroundThreadCores.size()], &cpus);
+    }
 
-        if (err != 0) {
-            fprintf(stderr, "LogCompressor's POSIX AIO failed with %d: %s\r\n",
-                    err, strerror(err));
-        } else if (ret < 0) {
-            perror("LogCompressor's Posix AIO Write operation failed");
+    // An empty set means the default affinity couldn't be determined
+    if (CPU_COUNT(&cpus) > 0) {
+        int err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if (err) {
+            fprintf(stderr, "NanoLog could not set the CPU affinity of "
+                    "compression thread %u: %s\r\n", id, strerror(err));
         }
-        ++numAioWritesCompleted;
-        hasOutstandingOperation = false;
+    }
 
-        if (syncStatus == WAITING_ON_AIO) {
-            syncStatus = SYNC_COMPLETED;
-            hintSyncCompleted.notify_one();
+    if (logger->backgroundThreadPolicy >= 0) {
+        struct sched_param param;
+        param.sched_priority = logger->backgroundThreadPriority;
+        int err = pthread_setschedparam(thread, logger->backgroundThreadPolicy,
+                                        &param);
+        if (err) {
+            fprintf(stderr, "NanoLog could not set the scheduling policy of "
+                    "compression thread %u: %s\r\n", id, strerror(err));
         }
     }
 }
 
 /**
-* Main compression thread that handles scanning through the StagingBuffers,
-* compressing log entries, and outputting a compressed log file.
-*/
+ * Launches the worker's background compression thread.
+ */
 void
-RuntimeLogger::compressionThreadMain() {
-    // Index of the last StagingBuffer checked for uncompressed log messages
-    size_t lastStagingBufferChecked = 0;
-
-    // Marks when the thread wakes up. This value should be used to calculate
-    // the number of cyclesActive right before blocking/sleeping and then updated
-    // to the latest rdtsc() when the thread re-awakens.
-    uint64_t cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
-    cycleAtThreadStart = cyclesAwakeStart;
-
-    // Manages the state associated with compressing log messages
-    Log::Encoder encoder(compressingBuffer, NanoLogConfig::OUTPUT_BUFFER_SIZE);
+RuntimeLogger::CompressionWorker::start() {
+    compressionThreadShouldExit = false;
+#ifndef BENCHMARK_DISCARD_ENTRIES_AT_STAGINGBUFFER
+    compressionThread = std::thread(&CompressionWorker::compressionThreadMain,
+                                    this);
+#endif
+}
 
-    // Indicates whether a compression operation failed or not due
-    // to insufficient space in the outputBuffer
-    bool outputBufferFull = false;
+/**
+ * Signals the worker's background compression thread to exit and waits for
+ * it to finish outputting the data it has already compressed. Log messages
+ * still in the StagingBuffers are not flushed; callers should sync() first.
+ */
+void
+RuntimeLogger::CompressionWorker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(condMutex);
+        compressionThreadShouldExit = true;
+        workAdded.notify_all();
+    }
+    logger->wakeupWorkers();
+
+    if (compressionThread.joinable())
+        compressionThread.join();
+}
+
+/**
+ * Returns the name of the file a particular worker outputs to. The first
+ * worker outputs to the base name while the others append their worker id
+ * (i.e. "compressedLog", "compressedLog.1", "compressedLog.2" ...).
+ *
+ * \param baseName
+ *      Log file name specified by the user
+ * \param workerId
+ *      Worker to get the file name for
+ */
+std::string
+RuntimeLogger::getOutputFileName(const std::string &baseName,
+                                 uint32_t workerId)
+{
+    if (workerId == 0)
+        return baseName;
+
+    return baseName + "." + std::to_string(workerId);
+}
+
+/**
+ * Returns the name of the file the worker outputs to (see
+ * RuntimeLogger::getOutputFileName()), which is the channel's log file for
+ * the worker of a log channel.
+ */
+std::string
+RuntimeLogger::CompressionWorker::getFileName()
+{
+    if (channel != nullptr)
+        return channel->logFile;
+
+    return RuntimeLogger::getOutputFileName(logger->logFile, id);
+}
+
+/**
+ * Returns the name an output file is moved to when it's rotated, which is the
+ * file name with the local time of the rotation appended (i.e.
+ * "compressedLog.20200101-120000"). If a file by that name already exists, a
+ * sequence number is appended as well (i.e. "compressedLog.20200101-120000.1").
+ *
+ * \param fileName
+ *      Name of the output file being rotated
+ * \param rotationTime
+ *      Time of the rotation
+ */
+std::string
+RuntimeLogger::getRotatedFileName(const std::string &fileName,
+                                  time_t rotationTime)
+{
+    struct tm localTime;
+    char timestamp[32];
+    localtime_r(&rotationTime, &localTime);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &localTime);
+
+    std::string rotatedName = fileName + "." + timestamp;
+    std::string candidate = rotatedName;
+    for (int i = 1; access(candidate.c_str(), F_OK) == 0; ++i)
+        candidate = rotatedName + "." + std::to_string(i);
+
+    return candidate;
+}
+
+/**
+ * Opens (or creates) an output file for appending with the flags of a
+ * durability mode.
+ *
+ * \param filename
+ *      Name of the output file
+ * \param durability
+ *      Durability mode the file will be written with
+ *
+ * \return
+ *      File descriptor for the file, or -1 on failure (see errno)
+ */
+int
+RuntimeLogger::openOutputFile(const std::string &filename,
+                              DurabilityMode durability)
+{
+    int flags = NanoLogConfig::FILE_PARAMS;
+    if (durability == DURABILITY_PER_BUFFER)
+        flags |= O_DSYNC;
+    else if (durability == DURABILITY_DIRECT)
+        flags |= O_DIRECT;
+
+    int fd = open(filename.c_str(), flags, 0666);
+    if (fd < 0 || durability != DURABILITY_DIRECT)
+        return fd;
+
+    // O_DIRECT writes must start at an aligned offset, so an existing log
+    // is padded out with zeros (which the decompressor skips over)
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    off_t bytesOver = fileSize % NanoLogConfig::DIRECT_IO_ALIGNMENT;
+    if (fileSize < 0 || (bytesOver != 0 && ftruncate(fd,
+                fileSize + NanoLogConfig::DIRECT_IO_ALIGNMENT - bytesOver))) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Opens the output files for a given number of workers. Either all of the
+ * files are opened or none of them are.
+ *
+ * \param baseName
+ *      Log file name specified by the user
+ * \param numFiles
+ *      Number of output files (i.e. workers) to open
+ * \param durability
+ *      Durability mode the files will be written with
+ *
+ * \return
+ *      File descriptors for the files in worker order
+ *
+ * \throw ios_base::failure
+ *      if any of the files cannot be opened or created
+ */
+std::vector<int>
+RuntimeLogger::openOutputFiles(const std::string &baseName, uint32_t numFiles,
+                               DurabilityMode durability)
+{
+    std::vector<int> fds;
+
+    for (uint32_t i = 0; i < numFiles; ++i) {
+        std::string filename = getOutputFileName(baseName, i);
+
+        // Check if it exists and is readable/writeable
+        std::string err;
+        if (access(filename.c_str(), F_OK) == 0 &&
+                access(filename.c_str(), R_OK | W_OK) != 0) {
+            err = "Unable to read/write from new log file: ";
+            err.append(filename);
+        } else {
+            int fd = openOutputFile(filename, durability);
+            if (fd >= 0) {
+                fds.push_back(fd);
+                continue;
+            }
+
+            err = "Unable to open file new log file: '";
+            err.append(filename);
+            err.append("': ");
+            err.append(strerror(errno));
+        }
+
+        for (int fd : fds)
+            close(fd);
+
+        throw std::ios_base::failure(err);
+    }
+
+    return fds;
+}
+
+/**
+ * Maps anonymous memory for a StagingBuffer or an output buffer, backed by
+ * the huge pages selected with setHugePages(). Reserved huge pages are only
+ * used for buffers of at least half a huge page; if there are none left, the
+ * buffer falls back to transparent huge pages. The memory is not faulted in.
+ *
+ * \param[in,out] bytes
+ *      Number of bytes to map; set to the number of bytes mapped, which is
+ *      rounded up to the huge page size, to pass to unmapBuffer()
+ *
+ * \return
+ *      The page aligned buffer
+ */
+char *
+RuntimeLogger::mapBuffer(size_t *bytes)
+{
+    HugePageMode mode = nanoLogSingleton.hugePages;
+    int hugeFlags = 0;
+    size_t hugePageSize = 0;
+    if (mode == HUGE_PAGES_2MB) {
+        hugeFlags = MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        hugePageSize = 1UL << 21;
+    } else if (mode == HUGE_PAGES_1GB) {
+        hugeFlags = MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+        hugePageSize = 1UL << 30;
+    }
+
+    if (hugePageSize > 0 && *bytes >= hugePageSize/2) {
+        size_t mapSize = (*bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+        void *mem = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | hugeFlags, -1, 0);
+        if (mem != MAP_FAILED) {
+            *bytes = mapSize;
+            return static_cast<char *>(mem);
+        }
+
+        static std::atomic_flag warned = ATOMIC_FLAG_INIT;
+        if (!warned.test_and_set()) {
+            fprintf(stderr, "NanoLog could not allocate %lu kB huge pages "
+                            "(%s); falling back to transparent huge pages. "
+                            "Please check /proc/sys/vm/nr_hugepages.\r\n",
+                            hugePageSize/1024, strerror(errno));
+        }
+    }
+
+    void *mem = mmap(nullptr, *bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("The NanoLog system was not able to allocate enough memory "
+                       "to support its operations. Quitting...\r\n");
+        std::exit(-1);
+    }
+
+    // Best effort; the kernel may not support or allow it
+    if (mode != HUGE_PAGES_NONE)
+        madvise(mem, *bytes, MADV_HUGEPAGE);
+
+    return static_cast<char *>(mem);
+}
+
+/**
+ * Unmaps a buffer mapped by mapBuffer().
+ *
+ * \param buffer
+ *      Buffer to unmap; may be nullptr
+ * \param bytes
+ *      Number of bytes mapped, as returned by mapBuffer()
+ */
+void
+RuntimeLogger::unmapBuffer(char *buffer, size_t bytes)
+{
+    if (buffer != nullptr)
+        munmap(buffer, bytes);
+}
+
+/**
+ * Creates and starts one CompressionWorker per output file descriptor and
+ * distributes the existing StagingBuffers amongst them. This should only be
+ * invoked when there are no workers.
+ *
+ * \param outputFds
+ *      Output file descriptors for the new workers; ownership is
+ *      transferred to the workers.
+ */
+void
+RuntimeLogger::createWorkers(const std::vector<int> &outputFds)
+{
+    assert(workers.empty());
+    assert(!outputFds.empty());
+
+    for (size_t i = 0; i < outputFds.size(); ++i) {
+        workers.push_back(new CompressionWorker(this,
+                                            downCast<uint32_t>(i),
+                                            outputFds[i]));
+    }
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for (StagingBuffer *sb : orphanedBuffers)
+        assignStagingBuffer(sb);
+    orphanedBuffers.clear();
+
+    for (CompressionWorker *worker : workers)
+        worker->start();
+}
+
+/**
+ * Stops and deletes all the CompressionWorkers. StagingBuffers owned by the
+ * workers are kept so that they can be redistributed by createWorkers().
+ * Callers should sync() beforehand to ensure all log messages are persisted.
+ */
+void
+RuntimeLogger::destroyWorkers()
+{
+    for (CompressionWorker *worker : workers)
+        worker->stop();
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for (CompressionWorker *worker : workers) {
+        worker->adoptNewStagingBuffers();
+        for (StagingBuffer *sb : worker->threadBuffers)
+            orphanedBuffers.push_back(sb);
+        worker->threadBuffers.clear();
+        delete worker;
+    }
+
+    workers.clear();
+}
+
+/**
+ * Assigns a StagingBuffer to the worker with the fewest StagingBuffers. The
+ * caller must hold the bufferMutex.
+ *
+ * \param sb
+ *      StagingBuffer to assign
+ */
+void
+RuntimeLogger::assignStagingBuffer(StagingBuffer *sb)
+{
+    if (workers.empty()) {
+        orphanedBuffers.push_back(sb);
+        return;
+    }
+
+    CompressionWorker *target = nullptr;
+    uint32_t targetLoad = 0;
+    for (CompressionWorker *worker : workers) {
+        uint32_t load = worker->numThreadBuffers.load();
+        if (target == nullptr || load < targetLoad) {
+            target = worker;
+            targetLoad = load;
+        }
+    }
+
+    target->addStagingBuffer(sb);
+}
+
+/**
+ * Wakes up all the CompressionWorkers blocked waiting for new log messages
+ * (see CompressionWorker::waitForWork()). Workers that are about to block
+ * will notice the wakeup and return immediately.
+ */
+void
+RuntimeLogger::wakeupWorkers()
+{
+    wakeupSeq.fetch_add(1);
+    syscall(SYS_futex, &wakeupSeq, FUTEX_WAKE_PRIVATE, INT_MAX,
+            nullptr, nullptr, 0);
+}
+
+// Documentation in NanoLog.h
+std::string
+RuntimeLogger::getStats() {
+    std::ostringstream out;
+    char buffer[1024];
+
+    // Aggregate the metrics across all the workers
+    uint64_t cyclesDiskIO_upperBound = 0;
+    uint64_t cyclesCompressing = 0;
+    uint64_t cyclesActive = 0;
+    uint64_t cyclesAlive = 0;
+    uint64_t totalBytesWritten = 0;
+    uint64_t totalBytesRead = 0;
+    uint64_t padBytesWritten = 0;
+    uint64_t totalBytesBlockCompressed = 0;
+    uint64_t cyclesBlockCompressing = 0;
+    uint64_t logsProcessed = 0;
+    uint32_t numAioWritesCompleted = 0;
+    uint32_t numOutputRingStalls = 0;
+    uint32_t numRotations = 0;
+    uint32_t numSyncs = 0;
+    uint64_t cyclesSyncing = 0;
+    uint64_t numIdleWaits = 0;
+    uint64_t cyclesIdleWaiting = 0;
+    uint64_t cyclesOutputRingStalled = 0;
+    uint64_t logsDiscarded = 0;
+    uint64_t syncCycles = 0;
+
+    std::vector<CompressionWorker*> workers = nanoLogSingleton.getAllWorkers();
+    for (CompressionWorker *worker : workers) {
+        // Leaks abstraction, but basically flush so we get all the time
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        fdatasync(worker->outputFd);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+        worker->cyclesDiskIO_upperBound += (stop - start);
+        syncCycles += (stop - start);
+
+        cyclesDiskIO_upperBound += worker->cyclesDiskIO_upperBound;
+        cyclesCompressing += worker->cyclesCompressing;
+        cyclesActive += worker->cyclesActive;
+        cyclesAlive += PerfUtils::Cycles::rdtsc() - worker->cycleAtThreadStart;
+        totalBytesWritten += worker->totalBytesWritten;
+        totalBytesRead += worker->totalBytesRead;
+        padBytesWritten += worker->padBytesWritten;
+        totalBytesBlockCompressed += worker->totalBytesBlockCompressed;
+        cyclesBlockCompressing += worker->cyclesBlockCompressing;
+        logsProcessed += worker->logsProcessed;
+        numAioWritesCompleted += worker->numAioWritesCompleted;
+        numOutputRingStalls += worker->numOutputRingStalls;
+        numRotations += worker->numRotations;
+        numSyncs += worker->numSyncs;
+        cyclesSyncing += worker->cyclesSyncing;
+        numIdleWaits += worker->numIdleWaits;
+        cyclesIdleWaiting += worker->cyclesIdleWaiting;
+        cyclesOutputRingStalled += worker->cyclesOutputRingStalled;
+        logsDiscarded += worker->logsDiscarded;
+    }
+
+    double outputTime =
+            PerfUtils::Cycles::toSeconds(cyclesDiskIO_upperBound);
+    double compressTime =
+            PerfUtils::Cycles::toSeconds(cyclesCompressing);
+    double workTime = outputTime + compressTime;
+
+    double totalBytesWrittenDouble = static_cast<double>(totalBytesWritten);
+    double totalBytesReadDouble = static_cast<double>(totalBytesRead);
+    double padBytesWrittenDouble = static_cast<double>(padBytesWritten);
+    double numEventsProcessedDouble = static_cast<double>(logsProcessed);
+
+    snprintf(buffer, 1024,
+               "\r\nWrote %lu events (%0.2lf MB) in %0.3lf seconds "
+                   "(%0.3lf seconds spent compressing)\r\n",
+               logsProcessed,
+               totalBytesWrittenDouble / 1.0e6,
+               workTime,
+               compressTime);
+    out << buffer;
+
+    snprintf(buffer, 1024,
+           "There were %u file flushes and the final sync time was %lf sec\r\n",
+           numAioWritesCompleted,
+           PerfUtils::Cycles::toSeconds(syncCycles));
+    out << buffer;
+
+    double secondsAwake = PerfUtils::Cycles::toSeconds(cyclesActive);
+    double secondsThreadHasBeenAlive = PerfUtils::Cycles::toSeconds(
+                                                                cyclesAlive);
+    snprintf(buffer, 1024,
+               "Compression Thread was active for %0.3lf out of %0.3lf seconds "
+                   "(%0.2lf %%)\r\n",
+               secondsAwake,
+               secondsThreadHasBeenAlive,
+               100.0 * secondsAwake / secondsThreadHasBeenAlive);
+    out << buffer;
+
+    if (workers.size() > 1) {
+        snprintf(buffer, 1024,
+                   "\t(times are summed across %lu compression threads)\r\n",
+                   workers.size());
+        out << buffer;
+    }
+
+    for (LogChannel *channel : nanoLogSingleton.channels) {
+        if (channel == nullptr)
+            continue;
+
+        snprintf(buffer, 1024,
+                   "Channel %s output %lu log messages (%lu bytes) to %s\r\n",
+                   channel->name.c_str(),
+                   uint64_t(channel->worker->logsProcessed),
+                   uint64_t(channel->worker->totalBytesWritten),
+                   channel->logFile.c_str());
+        out << buffer;
+    }
+
+    if (nanoLogSingleton.numDroppedLogMessages > 0) {
+        snprintf(buffer, 1024,
+                   "Dropped %lu log messages because StagingBuffers were "
+                       "full\r\n",
+                   nanoLogSingleton.numDroppedLogMessages.load());
+        out << buffer;
+    }
+
+    if (logsDiscarded > 0) {
+        snprintf(buffer, 1024,
+                   "The flight recorder discarded %lu log messages\r\n",
+                   logsDiscarded);
+        out << buffer;
+    }
+
+    snprintf(buffer, 1024,
+               "The output ring of %u buffers stalled compression %u times "
+                   "for %0.3lf seconds\r\n",
+               nanoLogSingleton.numOutputBuffers,
+               numOutputRingStalls,
+               PerfUtils::Cycles::toSeconds(cyclesOutputRingStalled));
+    out << buffer;
+
+    snprintf(buffer, 1024,
+               "The compression ran out of work and blocked %lu times "
+                   "for %0.3lf seconds\r\n",
+               numIdleWaits,
+               PerfUtils::Cycles::toSeconds(cyclesIdleWaiting));
+    out << buffer;
+
+    snprintf(buffer, 1024,
+                "On average, that's\r\n\t%0.2lf MB/s or "
+                    "%0.2lf ns/byte w/ processing\r\n",
+               (totalBytesWrittenDouble / 1.0e6) / (workTime),
+               (workTime * 1.0e9) / totalBytesWrittenDouble);
+    out << buffer;
+
+    // Since we sleep at 1µs intervals and check for completion at wake up,
+    // it's possible the IO finished before we woke-up, thus enlarging the time.
+    snprintf(buffer, 1024,
+                "\t%0.2lf MB/s or %0.2lf ns/byte disk throughput (min)\r\n",
+                (totalBytesWrittenDouble / 1.0e6) / outputTime,
+                (outputTime * 1.0e9) / totalBytesWrittenDouble);
+    out << buffer;
+
+    snprintf(buffer, 1024,
+                "\t%0.2lf MB per flush with %0.1lf bytes/event\r\n",
+                (totalBytesWrittenDouble / 1.0e6) / numAioWritesCompleted,
+                totalBytesWrittenDouble * 1.0 / numEventsProcessedDouble);
+    out << buffer;
+
+    snprintf(buffer, 1024,
+                "\t%0.2lf ns/event in total\r\n"
+                   "\t%0.2lf ns/event compressing\r\n",
+                (workTime) * 1.0e9 / numEventsProcessedDouble,
+                compressTime * 1.0e9 / numEventsProcessedDouble);
+    out << buffer;
+
+    snprintf(buffer, 1024, "The compression ratio was %0.2lf-%0.2lfx "
+                   "(%lu bytes in, %lu bytes out, %lu pad bytes)\n",
+           1.0 * totalBytesReadDouble / (totalBytesWrittenDouble
+                                         + padBytesWrittenDouble),
+           1.0 * totalBytesReadDouble / totalBytesWrittenDouble,
+           totalBytesRead,
+           totalBytesWritten,
+           padBytesWritten);
+    out << buffer;
+
+    if (totalBytesBlockCompressed > 0) {
+        snprintf(buffer, 1024, "Block compression shrank the output %0.2lfx "
+                    "(%lu bytes in) in %0.3lf seconds\r\n",
+                static_cast<double>(totalBytesBlockCompressed) /
+                        static_cast<double>(totalBytesWritten - padBytesWritten),
+                totalBytesBlockCompressed,
+                PerfUtils::Cycles::toSeconds(cyclesBlockCompressing));
+        out << buffer;
+    }
+
+    if (numSyncs > 0) {
+        snprintf(buffer, 1024, "The log files were flushed %u times for "
+                    "%0.3lf seconds\r\n",
+                 numSyncs, PerfUtils::Cycles::toSeconds(cyclesSyncing));
+        out << buffer;
+    }
+
+    if (numRotations > 0) {
+        snprintf(buffer, 1024, "The log files were rotated %u times\r\n",
+                 numRotations);
+        out << buffer;
+    }
+
+    return out.str();
+}
+
+/**
+ * Returns a string detailing the distribution of how long vs. how many times
+ * the log producers had to wait for free space and how big vs. how many times
+ * the consumer (background thread) read.
+ *
+ * Note: The distribution stats for the producer must be enabled via
+ * -DRECORD_PRODUCER_STATS during compilation, otherwise only the consumer
+ * stats will be printed.
+ */
+std::string
+RuntimeLogger::getHistograms()
+{
+    std::ostringstream out;
+    char buffer[1024];
+
+    uint64_t stagingBufferPeekDist[20] = {};
+    size_t numIntervals = Util::arraySize(stagingBufferPeekDist);
+    std::vector<CompressionWorker*> workers = nanoLogSingleton.getAllWorkers();
+    for (CompressionWorker *worker : workers) {
+        for (size_t i = 0; i < numIntervals; ++i)
+            stagingBufferPeekDist[i] += worker->stagingBufferPeekDist[i];
+    }
+
+    snprintf(buffer, 1024, "Distribution of StagingBuffer.peek() sizes\r\n");
+    out << buffer;
+    for (size_t i = 0; i < numIntervals; ++i) {
+        snprintf(buffer, 1024
+                , "\t%02lu - %02lu%%: %lu\r\n"
+                , i*100/numIntervals
+                , (i+1)*100/numIntervals
+                , stagingBufferPeekDist[i]);
+        out << buffer;
+    }
+
+    uint64_t outputRingOccupancyDist[10] = {};
+    size_t numRingIntervals = Util::arraySize(outputRingOccupancyDist);
+    for (CompressionWorker *worker : workers) {
+        for (size_t i = 0; i < numRingIntervals; ++i)
+            outputRingOccupancyDist[i] += worker->outputRingOccupancyDist[i];
+    }
+
+    snprintf(buffer, 1024, "Distribution of output buffers in flight "
+                           "(%% of %u buffer ring)\r\n",
+                           nanoLogSingleton.numOutputBuffers);
+    out << buffer;
+    for (size_t i = 0; i < numRingIntervals; ++i) {
+        snprintf(buffer, 1024
+                , "\t%02lu - %02lu%%: %lu\r\n"
+                , i*100/numRingIntervals
+                , (i+1)*100/numRingIntervals
+                , outputRingOccupancyDist[i]);
+        out << buffer;
+    }
+
+    for (CompressionWorker *worker : workers) {
+        std::unique_lock<std::mutex> lock(worker->bufferMutex);
+        for (size_t i = 0; i < worker->threadBuffers.size(); ++i) {
+            StagingBuffer *sb = worker->threadBuffers.at(i);
+            if (sb) {
+                snprintf(buffer, 1024, "Thread %u:\r\n", sb->getId());
+                out << buffer;
+
+                snprintf(buffer, 1024,
+                                 "\tCapacity      : %u bytes\r\n"
+                                 "\tAllocations   : %lu\r\n"
+                                 "\tTimes Blocked : %u\r\n"
+                                 "\tDropped       : %lu\r\n",
+                         sb->getCapacity(),
+                         uint64_t(sb->numAllocations),
+                         sb->numTimesProducerBlocked,
+                         uint64_t(sb->numDroppedMessages));
+                out << buffer;
+
+#ifdef RECORD_PRODUCER_STATS
+                uint64_t averageBlockNs = PerfUtils::Cycles::toNanoseconds(
+                        sb->cyclesProducerBlocked)/sb->numTimesProducerBlocked;
+                snprintf(buffer, 1024,
+                                 "\tAvgBlock (ns) : %lu\r\n"
+                                 "\tBlock Dist\r\n",
+                         averageBlockNs);
+                for (size_t i = 0; i < Util::arraySize(
+                        sb->cyclesProducerBlockedDist); ++i)
+                {
+                    snprintf(buffer, 1024
+                            , "\t\t%4lu - %4lu ns: %u\r\n"
+                            , i*10
+                            , (i+1)*10
+                            , sb->cyclesProducerBlockedDist[i]);
+                    out << buffer;
+                }
+#endif
+            }
+        }
+    }
+
+
+#ifdef RECORD_LOG_SITE_STATS
+    NanoLog::LogSiteMetrics sites[10];
+    uint32_t numSites = std::min<uint32_t>(
+            getLogSiteMetrics(sites, Util::arraySize(sites)),
+            Util::arraySize(sites));
+    out << "Top log sites by StagingBuffer bytes\r\n";
+    for (uint32_t i = 0; i < numSites; ++i) {
+        const NanoLog::LogSiteMetrics &m = sites[i];
+        snprintf(buffer, 1024,
+                         "\t%s:%u '%s'\r\n"
+                         "\t\tInvocations   : %lu\r\n"
+                         "\t\tStaged        : %lu bytes\r\n"
+                         "\t\tCompressed    : %lu bytes\r\n"
+                         "\t\tReserve (ns)  : %lu\r\n"
+                         "\t\tFinish (ns)   : %lu\r\n",
+                 m.filename, m.line, m.format, m.invocations, m.bytesStaged,
+                 m.compressedBytes, m.reserveNs, m.finishNs);
+        out << buffer;
+    }
+#endif
+
+#ifndef RECORD_PRODUCER_STATS
+    out << "Note: Detailed Producer stats were compiled out. Enable "
+            "via -DRECORD_PRODUCER_STATS";
+#endif
+
+#ifndef RECORD_LOG_SITE_STATS
+    out << "\r\nNote: Log site stats were compiled out. Enable "
+            "via -DRECORD_LOG_SITE_STATS";
+#endif
+
+    return out.str();
+}
+
+// Documentation in NanoLog.h
+void
+RuntimeLogger::getMetrics(NanoLog::Metrics *metrics)
+{
+    *metrics = NanoLog::Metrics();
+
+    std::lock_guard<std::mutex> lock(nanoLogSingleton.bufferMutex);
+    std::vector<CompressionWorker*> workers = nanoLogSingleton.getAllWorkers();
+    metrics->numCompressionThreads = downCast<uint32_t>(workers.size());
+    metrics->droppedMessages = nanoLogSingleton.numDroppedLogMessages.load();
+
+    for (CompressionWorker *worker : workers) {
+        metrics->logsProcessed += worker->logsProcessed;
+        metrics->bytesRead += worker->totalBytesRead;
+        metrics->bytesWritten += worker->totalBytesWritten;
+        metrics->padBytesWritten += worker->padBytesWritten;
+        metrics->logsDiscarded += worker->logsDiscarded;
+
+        metrics->activeNs += worker->cyclesActive;
+        metrics->compressingNs += worker->cyclesCompressing;
+        metrics->outputRingStalls += worker->numOutputRingStalls;
+        metrics->outputRingStalledNs += worker->cyclesOutputRingStalled;
+        metrics->idleWaits += worker->numIdleWaits;
+        metrics->idleWaitNs += worker->cyclesIdleWaiting;
+
+        metrics->writesCompleted += worker->numAioWritesCompleted;
+        metrics->writesInFlight += worker->numWritesInFlight;
+        metrics->writeQueueDepth += downCast<uint32_t>(
+                                    worker->cyclesAtWriteSubmit.size() - 1);
+        for (uint32_t i = 0; i < NanoLog::Metrics::NUM_LATENCY_BUCKETS; ++i) {
+            metrics->writeLatencyDist[i] += worker->writeLatencyDist[i];
+            metrics->syncLatencyDist[i] += worker->syncLatencyDist[i];
+        }
+
+        metrics->syncs += worker->numSyncs;
+        metrics->syncNs += worker->cyclesSyncing;
+        metrics->rotations += worker->numRotations;
+
+        for (size_t i = 0; i < Util::arraySize(metrics->stagingBufferPeekDist);
+                                                                        ++i) {
+            metrics->stagingBufferPeekDist[i] +=
+                                            worker->stagingBufferPeekDist[i];
+        }
+
+        for (size_t i = 0;
+                i < Util::arraySize(metrics->outputRingOccupancyDist); ++i) {
+            metrics->outputRingOccupancyDist[i] +=
+                                            worker->outputRingOccupancyDist[i];
+        }
+
+        std::lock_guard<std::mutex> workerLock(worker->bufferMutex);
+        metrics->allocations += worker->retiredAllocations;
+        metrics->producerWaits += worker->retiredWaitsForSpace;
+        metrics->producerWaitNs += worker->retiredCyclesWaitingForSpace;
+
+        for (StagingBuffer *sb : worker->threadBuffers) {
+            ++metrics->numStagingBuffers;
+            metrics->allocations += sb->numAllocations;
+            metrics->producerWaits += sb->numWaitsForSpace;
+            metrics->producerWaitNs += sb->cyclesWaitingForSpace;
+        }
+    }
+
+    // The times were summed up in cycles
+    uint64_t *times[] = {
+            &metrics->producerWaitNs, &metrics->activeNs,
+            &metrics->compressingNs, &metrics->outputRingStalledNs,
+            &metrics->idleWaitNs, &metrics->syncNs
+    };
+    for (uint64_t *time : times)
+        *time = PerfUtils::Cycles::toNanoseconds(*time);
+}
+
+// Documentation in NanoLog.h
+uint32_t
+RuntimeLogger::getThreadMetrics(NanoLog::ThreadMetrics *metrics,
+                                uint32_t maxThreads)
+{
+    uint32_t numThreads = 0;
+
+    std::lock_guard<std::mutex> lock(nanoLogSingleton.bufferMutex);
+    for (CompressionWorker *worker : nanoLogSingleton.getAllWorkers()) {
+        std::lock_guard<std::mutex> workerLock(worker->bufferMutex);
+        for (StagingBuffer *sb : worker->threadBuffers) {
+            if (numThreads < maxThreads) {
+                NanoLog::ThreadMetrics &m = metrics[numThreads];
+                m.id = sb->getId();
+                m.capacity = sb->getCapacity();
+                m.allocations = sb->numAllocations;
+                m.droppedMessages = sb->numDroppedMessages;
+                m.waits = sb->numWaitsForSpace;
+                m.waitNs = PerfUtils::Cycles::toNanoseconds(
+                                                    sb->cyclesWaitingForSpace);
+            }
+            ++numThreads;
+        }
+    }
+
+    return numThreads;
+}
+
+/**
+ * Adds the costs of the log invocation sites in a StagingBuffer to totals.
+ *
+ * \param[in/out] totals
+ *      Totals indexed by log identifier; grown to fit if empty
+ * \param stats
+ *      Costs to add (see StagingBuffer::logSiteStats); ignored if nullptr
+ */
+void
+RuntimeLogger::addLogSiteStats(std::vector<LogSiteStats> &totals,
+                               const LogSiteStats *stats)
+{
+    if (stats == nullptr)
+        return;
+
+    totals.resize(NanoLogConfig::MAX_LOG_SITE_STATS + 1);
+    for (size_t i = 0; i < totals.size(); ++i) {
+        totals[i].invocations += stats[i].invocations;
+        totals[i].bytesStaged += stats[i].bytesStaged;
+        totals[i].reserveCycles += stats[i].reserveCycles;
+        totals[i].finishCycles += stats[i].finishCycles;
+    }
+}
+
+// Documentation in NanoLog.h
+uint32_t
+RuntimeLogger::getLogSiteMetrics(NanoLog::LogSiteMetrics *metrics,
+                                 uint32_t maxSites)
+{
+    std::vector<LogSiteStats> stats;
+    std::vector<uint64_t> compressedBytes;
+    {
+        std::lock_guard<std::mutex> lock(nanoLogSingleton.bufferMutex);
+        for (CompressionWorker *worker : nanoLogSingleton.getAllWorkers()) {
+            const std::vector<uint64_t> &workerBytes =
+                                            worker->logSiteCompressedBytes;
+            if (compressedBytes.size() < workerBytes.size())
+                compressedBytes.resize(workerBytes.size());
+            for (size_t i = 0; i < workerBytes.size(); ++i)
+                compressedBytes[i] += workerBytes[i];
+
+            std::lock_guard<std::mutex> workerLock(worker->bufferMutex);
+            if (!worker->retiredLogSiteStats.empty())
+                addLogSiteStats(stats, worker->retiredLogSiteStats.data());
+            for (StagingBuffer *sb : worker->threadBuffers)
+                addLogSiteStats(stats, sb->logSiteStats);
+        }
+    }
+
+    std::vector<NanoLog::LogSiteMetrics> sites;
+    for (uint32_t i = 0; i < std::max(stats.size(), compressedBytes.size());
+                                                                        ++i) {
+        NanoLog::LogSiteMetrics m = {};
+        if (i < stats.size()) {
+            m.invocations = stats[i].invocations;
+            m.bytesStaged = stats[i].bytesStaged;
+            m.reserveNs = PerfUtils::Cycles::toNanoseconds(
+                                                    stats[i].reserveCycles);
+            m.finishNs = PerfUtils::Cycles::toNanoseconds(
+                                                    stats[i].finishCycles);
+        }
+        if (i < compressedBytes.size())
+            m.compressedBytes = compressedBytes[i];
+        if (m.invocations == 0 && m.compressedBytes == 0)
+            continue;
+
+        m.logId = (i < NanoLogConfig::MAX_LOG_SITE_STATS) ? i : UINT32_MAX;
+        m.filename = m.format = "";
+#ifdef PREPROCESSOR_NANOLOG
+        if (i < GeneratedFunctions::numLogIds) {
+            const GeneratedFunctions::LogMetadata &info =
+                                        GeneratedFunctions::logId2Metadata[i];
+            m.filename = info.fileName;
+            m.line = info.lineNumber;
+            m.format = info.fmtString;
+        }
+#else
+        if (m.logId < nanoLogSingleton.invocationSites.size()) {
+            const StaticLogInfo &info = nanoLogSingleton.invocationSites[i];
+            m.filename = info.filename;
+            m.line = info.lineNum;
+            m.format = info.formatString;
+        }
+#endif
+        sites.push_back(m);
+    }
+
+    std::stable_sort(sites.begin(), sites.end(),
+            [](const NanoLog::LogSiteMetrics &a,
+               const NanoLog::LogSiteMetrics &b) {
+                if (a.bytesStaged != b.bytesStaged)
+                    return a.bytesStaged > b.bytesStaged;
+                return a.compressedBytes > b.compressedBytes;
+            });
+
+    for (uint32_t i = 0; i < sites.size() && i < maxSites; ++i)
+        metrics[i] = sites[i];
+
+    return downCast<uint32_t>(sites.size());
+}
+
+// See documentation in NanoLog.h
+void
+RuntimeLogger::preallocate() {
+    nanoLogSingleton.ensureStagingBufferAllocated();
+    // I wonder if it'll be a good idea to update minFreeSpace as well since
+    // the user is already willing to invoke this up front cost.
+}
+
+// See documentation in NanoLog.h
+void
+RuntimeLogger::preallocate(size_t bytes) {
+    uint32_t capacity = nanoLogSingleton.clampStagingBufferSize(bytes);
+    if (stagingBuffer == nullptr || stagingBuffer->getCapacity() != capacity)
+        nanoLogSingleton.allocateStagingBuffer(capacity);
+}
+
+/**
+ * Starts a NanoLog::Batch for the current thread; see NanoLog.h.
+ *
+ * \param bytesHint
+ *      Number of bytes to reserve for the batch's log messages at a time
+ */
+void
+RuntimeLogger::beginBatch(size_t bytesHint)
+{
+    if (batch.depth++ > 0)
+        return;
+
+    nanoLogSingleton.ensureStagingBufferAllocated();
+    batch.bytesHint = std::min<size_t>(std::max<size_t>(bytesHint, 1),
+                                       stagingBuffer->getCapacity()/2);
+}
+
+/**
+ * Ends a NanoLog::Batch for the current thread and publishes its log messages
+ * if it's the outermost one.
+ */
+void
+RuntimeLogger::endBatch()
+{
+    assert(batch.depth > 0);
+    if (batch.depth == 1)
+        publishBatch();
+    --batch.depth;
+}
+
+/**
+ * Makes the log messages appended to the current thread's batch reservation
+ * visible to the compression thread and releases the reservation's unused
+ * space. This is a no-op outside of a batch.
+ */
+void
+RuntimeLogger::publishBatch()
+{
+    if (batch.start == nullptr)
+        return;
+
+    // The reservation itself was counted as one allocation
+    stagingBuffer->numAllocations += batch.numMessages;
+    --stagingBuffer->numAllocations;
+
+    size_t nbytes = batch.pos - batch.start;
+    if (nbytes > 0)
+        stagingBuffer->finishReservation(nbytes);
+
+    batch.start = batch.pos = batch.end = nullptr;
+    batch.numMessages = 0;
+}
+
+/**
+ * Slow path of reserveAlloc() within a batch: publishes the full reservation
+ * and reserves the next one, large enough for at least nbytes.
+ *
+ * \param nbytes
+ *      Number of bytes the log message to be appended needs
+ * \param severity
+ *      LogLevel of the log message; determines whether to drop it rather
+ *      than block (see setDropOnFull())
+ *
+ * \return
+ *      Pointer to at least nbytes of space, or nullptr if the log message
+ *      should be dropped
+ */
+char *
+RuntimeLogger::reserveBatchSpace(size_t nbytes, LogLevel severity)
+{
+    publishBatch();
+
+    // Reserving also publishes pending drop markers and may replace the
+    // thread's StagingBuffer in the adaptive mode.
+    size_t bytes = std::max(nbytes, batch.bytesHint);
+    char *space = stagingBuffer->reserveProducerSpace(bytes, severity);
+    if (space == nullptr)
+        return nullptr;
+
+    batch.start = batch.pos = space;
+    batch.end = space + bytes;
+    return space;
+}
+
+/**
+ * Allocates a StagingBuffer for the current thread. If the thread already has
+ * one, the new buffer replaces it: the old buffer is marked for deletion and
+ * chained to the new one so that the compression thread drains the old buffer
+ * before moving on to the new one, keeping the thread's log messages in order.
+ *
+ * \param capacity
+ *      Size of the new StagingBuffer in bytes
+ */
+void
+RuntimeLogger::allocateStagingBuffer(uint32_t capacity)
+{
+    // A batch's reservation has to be published in the buffer it was made in
+    publishBatch();
+
+    StagingBuffer *oldBuffer = stagingBuffer;
+    uint32_t bufferId = (oldBuffer == nullptr) ? 0 : oldBuffer->getId();
+
+    // The external consumer orders replaced buffers by their region indexes
+    // rather than by next, so only shouldDeallocate needs to be set.
+    if (sharedMemoryRegistry != nullptr) {
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        if (oldBuffer == nullptr)
+            bufferId = nextBufferId++;
+
+        stagingBuffer = createSharedStagingBuffer(bufferId, capacity,
+                                                  oldBuffer);
+        if (oldBuffer != nullptr)
+            oldBuffer->shouldDeallocate = true;
+        return;
+    }
+
+    // Unlocked for the expensive StagingBuffer allocation
+    StagingBuffer *sb = new StagingBuffer(bufferId, capacity);
+
+    if (oldBuffer == nullptr) {
+        std::lock_guard<std::mutex> guard(bufferMutex);
+        sb->id = nextBufferId++;
+        stagingBuffer = sb;
+        assignStagingBuffer(sb);
+        return;
+    }
+
+    // The consumer checks shouldDeallocate before following next, so next
+    // must be visible first.
+    oldBuffer->next = sb;
+    __atomic_store_n(&oldBuffer->shouldDeallocate, true, __ATOMIC_RELEASE);
+    stagingBuffer = sb;
+}
+
+/**
+ * Allocates the current thread's StagingBuffer for a log channel and assigns
+ * it to the channel's worker. The log messages logged to a channel that
+ * doesn't exist go to the default log instead.
+ *
+ * \param channel
+ *      Log channel to allocate the StagingBuffer for
+ */
+void
+RuntimeLogger::allocateChannelBuffer(uint32_t channel)
+{
+    // Unlocked for the expensive StagingBuffer allocation
+    StagingBuffer *sb = new StagingBuffer(0, stagingBufferSize);
+
+    std::lock_guard<std::mutex> guard(bufferMutex);
+    sb->id = nextBufferId++;
+    sb->channel = channels[channel];
+    channelBuffers[channel] = sb;
+
+    if (sb->channel == nullptr)
+        assignStagingBuffer(sb);
+    else
+        sb->channel->worker->addStagingBuffer(sb);
+}
+
+/**
+ * Allocates a StagingBuffer in a new shared memory buffer region and
+ * publishes it to the external consumer (see SharedStagingBuffer.h). Regions
+ * of StagingBuffers that have since been abandoned and drained are unmapped
+ * along the way. The caller must hold the bufferMutex.
+ *
+ * \param bufferId
+ *      Id of the new StagingBuffer
+ * \param capacity
+ *      Size of the new StagingBuffer in bytes
+ * \param oldBuffer
+ *      StagingBuffer the new one replaces for the current thread, or nullptr
+ *
+ * \return
+ *      The new StagingBuffer
+ */
+RuntimeLogger::StagingBuffer *
+RuntimeLogger::createSharedStagingBuffer(uint32_t bufferId,
+                                         uint32_t capacity,
+                                         StagingBuffer *oldBuffer)
+{
+    using namespace SharedStagingBuffer;
+
+    uint32_t replaces = NO_BUFFER;
+    for (size_t i = 0; i < sharedBufferRegions.size(); ) {
+        SharedBufferRegion &shared = sharedBufferRegions[i];
+        if (shared.sb == oldBuffer) {
+            replaces = shared.index;
+        } else if (shared.sb->checkCanDelete()) {
+            unmapRegion(shared.region, shared.size);
+            sharedBufferRegions.erase(sharedBufferRegions.begin() + i);
+            continue;
+        }
+        ++i;
+    }
+
+    const size_t pageSize = HEADER_SIZE;
+    size_t storageOffset = (HEADER_SIZE + sizeof(StagingBuffer) +
+                            pageSize - 1) & ~(pageSize - 1);
+    size_t regionSize = storageOffset + capacity;
+    uint32_t index = sharedMemoryRegistry->numBuffers.load();
+    char *region = createRegion(getBufferName(sharedMemoryName, index),
+                                regionSize);
+    if (region == nullptr) {
+        perror("The NanoLog system was not able to allocate a StagingBuffer "
+               "in shared memory. Quitting...\r\n");
+        std::exit(-1);
+    }
+
+    char *storage = region + storageOffset;
+    StagingBuffer *sb = new(region + HEADER_SIZE) StagingBuffer(bufferId,
+                                                                capacity,
+                                                                storage);
+
+    BufferHeader *header = reinterpret_cast<BufferHeader*>(region);
+    header->magic = BUFFER_MAGIC;
+    header->version = LAYOUT_VERSION;
+    header->bufferId = bufferId;
+    header->capacity = capacity;
+    header->replaces = replaces;
+    header->regionSize = regionSize;
+    header->storageOffset = storageOffset;
+    header->storageAddress = reinterpret_cast<uint64_t>(storage);
+    header->producerPosOffset =
+            reinterpret_cast<char*>(&sb->producerPos) - region;
+    header->endOfRecordedSpaceOffset =
+            reinterpret_cast<char*>(&sb->endOfRecordedSpace) - region;
+    header->consumerPosOffset =
+            reinterpret_cast<char*>(const_cast<char**>(&sb->consumerPos)) -
+            region;
+    header->shouldDeallocateOffset =
+            reinterpret_cast<char*>(&sb->shouldDeallocate) - region;
+
+    sharedBufferRegions.push_back({sb, index, region, regionSize});
+    sharedMemoryRegistry->numBuffers.store(index + 1,
+                                           std::memory_order_release);
+    return sb;
+}
+
+/**
+ * Replaces the current thread's StagingBuffer with one of a different size on
+ * behalf of the adaptive mode and reserves space in the new buffer. The
+ * thread's original size is carried over so that the buffer can be shrunk
+ * back to it later.
+ *
+ * The caller must not touch the old StagingBuffer afterwards since the
+ * compression thread may delete it at any time.
+ *
+ * \param capacity
+ *      Size of the new StagingBuffer in bytes
+ * \param nbytes
+ *      Number of contiguous bytes to reserve in the new StagingBuffer
+ *
+ * \return
+ *      A pointer into the new StagingBuffer that can be written to by the
+ *      producer for at least nbytes.
+ */
+char *
+RuntimeLogger::resizeStagingBuffer(uint32_t capacity, size_t nbytes)
+{
+    uint32_t baseCapacity = stagingBuffer->baseCapacity;
+    allocateStagingBuffer(capacity);
+    stagingBuffer->baseCapacity = baseCapacity;
+    return stagingBuffer->reserveProducerSpace(nbytes);
+}
+
+/**
+ * Clamps a requested StagingBuffer size to the range supported by the
+ * current configuration, [NanoLogConfig::MIN_STAGING_BUFFER_SIZE,
+ * output buffer size].
+ *
+ * \param bytes
+ *      Requested StagingBuffer size in bytes
+ *
+ * \return
+ *      StagingBuffer size to use
+ */
+uint32_t
+RuntimeLogger::clampStagingBufferSize(size_t bytes)
+{
+    size_t size = std::max<size_t>(NanoLogConfig::MIN_STAGING_BUFFER_SIZE,
+                                   std::min<size_t>(bytes, outputBufferSize));
+    return downCast<uint32_t>(size);
+}
+
+/**
+* Sets the size of the StagingBuffers allocated for logging threads that have
+* not allocated one yet. Existing StagingBuffers are unaffected; threads may
+* resize their own via preallocate(size_t). This function is thread safe.
+*
+* \param bytes
+*      StagingBuffer size in bytes; values are clamped to
+*      [NanoLogConfig::MIN_STAGING_BUFFER_SIZE, output buffer size]
+*/
+void
+RuntimeLogger::setStagingBufferSize(size_t bytes) {
+    nanoLogSingleton.stagingBufferSize =
+                                nanoLogSingleton.clampStagingBufferSize(bytes);
+}
+
+/**
+* Sets the LogLevel at which log messages are dropped rather than blocking the
+* logging thread when its StagingBuffer is full. Messages at the level or of
+* lower severity (i.e. DEBUG is lower than NOTICE) are dropped. The number of
+* messages dropped is reported in getStats() and via a marker log message in
+* the log. This function is thread safe.
+*
+* Note that this only applies to the C++17 NANO_LOG since the Preprocessor
+* NanoLog generated code never drops log messages.
+*
+* \param level
+*      LogLevel at which log messages start to be dropped; ERROR drops all
+*      log messages and NUM_LOG_LEVELS drops none (default).
+*/
+void
+RuntimeLogger::setDropOnFull(LogLevel level) {
+    if (level < ERROR)
+        level = ERROR;
+    else if (level > NUM_LOG_LEVELS)
+        level = NUM_LOG_LEVELS;
+    nanoLogSingleton.dropLogLevel = level;
+}
+
+/**
+* Switches the flight recorder mode on or off (see NanoLog::setFlightRecorder()).
+* The workers pick up the change on their next pass through the
+* StagingBuffers. This function is thread safe.
+*
+* \param enable
+*      True to retain the log messages in memory until a sync(); false to
+*      output them as usual (default)
+*/
+void
+RuntimeLogger::setFlightRecorder(bool enable) {
+    nanoLogSingleton.flightRecorder = enable;
+    if (!enable)
+        nanoLogSingleton.wakeupWorkers();
+}
+
+/**
+* Installs handlers for the fatal signals (SIGSEGV, SIGBUS, SIGFPE, SIGILL and
+* SIGABRT) that dump the unconsumed log messages to a crash log before the
+* process dies (see NanoLog::installCrashHandler()). The memory the dump needs
+* is allocated here, so it should be invoked after the output buffer size is
+* configured. An exception is thrown if the crash log cannot be opened.
+*
+* \param filename
+*      File to append the dumps to; nullptr for the log file name with
+*      ".crash" appended
+*/
+void
+RuntimeLogger::installCrashHandler(const char *filename) {
+    nanoLogSingleton.installCrashHandler_internal(filename);
+}
+
+/**
+* Dumps the log messages that the compression threads have not consumed yet
+* to the crash log (see NanoLog::crashFlush()). This function is
+* async-signal-safe and a no-op if installCrashHandler() wasn't invoked.
+*
+* \return
+*      Number of log messages dumped
+*/
+uint64_t
+RuntimeLogger::crashFlush() {
+    return nanoLogSingleton.crashFlush_internal();
+}
+
+/**
+ * See installCrashHandler()
+ */
+void
+RuntimeLogger::installCrashHandler_internal(const char *filename)
+{
+    std::string name = (filename != nullptr) ? filename : logFile + ".crash";
+    int fd = open(name.c_str(), NanoLogConfig::FILE_PARAMS, 0666);
+    if (fd < 0) {
+        std::string err = "Unable to open the crash log file: '";
+        err.append(name);
+        err.append("': ");
+        err.append(strerror(errno));
+        throw std::ios_base::failure(err);
+    }
+
+    growCrashDictionary(invocationSites.size());
+
+    if (crashBufferSize != outputBufferSize) {
+        delete[] crashBuffer;
+        crashBuffer = new char[outputBufferSize];
+        crashBufferSize = outputBufferSize;
+    }
+
+    bool installed = (crashFd >= 0);
+    if (installed)
+        close(crashFd);
+    crashFd = fd;
+    crashLogFile = name;
+
+    if (installed)
+        return;
+
+    // The other fatal signals are blocked while the handler runs, so a fault
+    // in the dump terminates the process rather than re-entering it.
+    struct sigaction action = {};
+    action.sa_handler = crashSignalHandler;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (int signo : crashSignals)
+        sigaddset(&action.sa_mask, signo);
+
+    for (size_t i = 0; i < Util::arraySize(crashSignals); ++i)
+        sigaction(crashSignals[i], &action, &previousCrashActions[i]);
+}
+
+/**
+ * See crashFlush()
+ */
+uint64_t
+RuntimeLogger::crashFlush_internal()
+{
+    if (crashFd < 0)
+        return 0;
+
+    // Threads that crash while another one is dumping wait for it to finish
+    // rather than let the process die halfway through the dump
+    bool expected = false;
+    if (!crashFlushInProgress.compare_exchange_strong(expected, true)) {
+        const struct timespec pollInterval = {0, 1000000};
+        while (crashFlushInProgress.load())
+            nanosleep(&pollInterval, nullptr);
+        return 0;
+    }
+
+    int savedErrno = errno;
+
+    // Snapshot the invocation sites within the capacity reserved beforehand
+    std::vector<StaticLogInfo> *dictionary = crashDictionary.load();
+    dictionary->clear();
+    size_t numSites = std::min<size_t>(invocationSites.size(),
+                                       dictionary->capacity());
+    for (uint32_t i = 0; i < numSites; ++i)
+        dictionary->push_back(invocationSites[i]);
+
+    // Each dump is a log of its own that starts with a Checkpoint followed by
+    // the dictionary, so the decompressor reads it like any other log file.
+    Log::Encoder encoder(crashBuffer, crashBufferSize);
+    uint32_t numPersisted = 0;
+    if (!dictionary->empty())
+        encoder.encodeNewDictionaryEntries(numPersisted, *dictionary);
+    while (numPersisted < dictionary->size()) {
+        uint32_t lastPersisted = numPersisted;
+        writeCrashLog(encoder);
+        encoder.encodeNewDictionaryEntries(numPersisted, *dictionary);
+        if (numPersisted == lastPersisted)
+            break;
+    }
+
+    while (dictionary->size() > numPersisted)
+        dictionary->pop_back();
+
+    // The workers of the log channels follow the ones of the default log;
+    // the vectors can't be allocated in a signal handler
+    uint64_t numLogsDumped = 0;
+    uint32_t numWorkers = downCast<uint32_t>(workers.size());
+    for (uint32_t i = 0; i < numWorkers + NanoLogConfig::MAX_LOG_CHANNELS;
+                                                                        ++i) {
+        CompressionWorker *worker = nullptr;
+        if (i < numWorkers)
+            worker = workers[i];
+        else if (channels[i - numWorkers] != nullptr)
+            worker = channels[i - numWorkers]->worker;
+
+        if (worker == nullptr)
+            continue;
+
+        // The compression threads only hold their bufferMutex briefly, so a
+        // lock that can't be acquired was held by the crashed thread and
+        // the worker's StagingBuffers can't be traversed safely.
+        bool locked = worker->bufferMutex.try_lock();
+        for (int i = 0; !locked && i < 100; ++i) {
+            const struct timespec retryInterval = {0, 1000000};
+            nanosleep(&retryInterval, nullptr);
+            locked = worker->bufferMutex.try_lock();
+        }
+
+        if (!locked)
+            continue;
+
+        for (StagingBuffer *sb : worker->threadBuffers)
+            numLogsDumped += dumpStagingBuffer(encoder, sb, *dictionary);
+
+        for (StagingBuffer *sb = worker->newThreadBuffers.load();
+                                        sb != nullptr; sb = sb->nextNewBuffer)
+            numLogsDumped += dumpStagingBuffer(encoder, sb, *dictionary);
+
+        worker->bufferMutex.unlock();
+    }
+
+    writeCrashLog(encoder);
+
+    errno = savedErrno;
+    crashFlushInProgress = false;
+    return numLogsDumped;
+}
+
+/**
+ * Handler of the fatal signals installed by installCrashHandler(). It dumps
+ * the unconsumed log messages and then hands the signal to the action that
+ * was installed before, which terminates the process by default.
+ *
+ * \param signo
+ *      Signal received
+ */
+void
+RuntimeLogger::crashSignalHandler(int signo)
+{
+    nanoLogSingleton.crashFlush_internal();
+
+    for (size_t i = 0; i < Util::arraySize(crashSignals); ++i) {
+        if (crashSignals[i] == signo)
+            sigaction(signo, &previousCrashActions[i], nullptr);
+    }
+
+    // The signal is blocked until the handler returns, so the previous
+    // action receives it then
+    raise(signo);
+}
+
+/**
+ * Ensures that the dictionary copy used by crashFlush() can hold a number of
+ * invocation sites without allocating. A larger copy is swapped in if needed.
+ * This function is thread safe.
+ *
+ * \param numEntries
+ *      Number of invocation sites to accommodate
+ */
+void
+RuntimeLogger::growCrashDictionary(uint32_t numEntries)
+{
+    std::lock_guard<std::mutex> lock(crashDictionaryMutex);
+    std::vector<StaticLogInfo> *dictionary = crashDictionary.load();
+    if (dictionary != nullptr && dictionary->capacity() >= numEntries)
+        return;
+
+    auto *grown = new std::vector<StaticLogInfo>();
+    grown->reserve(std::max<size_t>(1024, 2*size_t(numEntries)));
+    crashDictionary.store(grown);
+}
+
+/**
+ * Encodes the log messages in a StagingBuffer (and the StagingBuffers that
+ * replaced it) that have not been consumed yet for crashFlush(). The messages
+ * are left in place for the compression thread.
+ *
+ * \param encoder
+ *      Encoder of the crash dump
+ * \param sb
+ *      StagingBuffer to encode the log messages of
+ * \param dictionary
+ *      Invocation sites in the crash dump (C++17 NanoLog)
+ *
+ * \return
+ *      Number of log messages encoded
+ */
+uint64_t
+RuntimeLogger::dumpStagingBuffer(Log::Encoder &encoder, StagingBuffer *sb,
+                                 const std::vector<StaticLogInfo> &dictionary)
+{
+    uint64_t numLogs = 0;
+
+    // next is only valid once shouldDeallocate is set
+    for (; sb != nullptr; sb = __atomic_load_n(&sb->shouldDeallocate,
+                                            __ATOMIC_ACQUIRE) ? sb->next
+                                                              : nullptr) {
+        // The acquire prevents reading a new producerPos but old endOf...
+        char *producerPos = __atomic_load_n(&sb->producerPos,
+                                            __ATOMIC_ACQUIRE);
+        char *consumerPos = __atomic_load_n(&sb->consumerPos,
+                                            __ATOMIC_ACQUIRE);
+
+        if (producerPos < consumerPos) {
+            numLogs += dumpLogMsgs(encoder, sb->getId(), consumerPos,
+                                   sb->endOfRecordedSpace - consumerPos,
+                                   dictionary);
+            consumerPos = sb->storage;
+        }
+
+        numLogs += dumpLogMsgs(encoder, sb->getId(), consumerPos,
+                               producerPos - consumerPos, dictionary);
+    }
+
+    return numLogs;
+}
+
+/**
+ * Encodes a contiguous range of uncompressed log messages for crashFlush(),
+ * writing out the crash dump's buffer as it fills up. The range is checked
+ * first since the producer may be reusing space that the compression thread
+ * consumed in the meantime; only the well-formed log messages up to the first
+ * malformed one are encoded.
+ *
+ * \param encoder
+ *      Encoder of the crash dump
+ * \param bufferId
+ *      Id of the StagingBuffer that the log messages are from
+ * \param from
+ *      Start of the uncompressed log messages
+ * \param nbytes
+ *      Number of bytes in the range
+ * \param dictionary
+ *      Invocation sites in the crash dump (C++17 NanoLog)
+ *
+ * \return
+ *      Number of log messages encoded
+ */
+uint64_t
+RuntimeLogger::dumpLogMsgs(Log::Encoder &encoder, uint32_t bufferId,
+                           char *from, uint64_t nbytes,
+                           const std::vector<StaticLogInfo> &dictionary)
+{
+#ifdef PREPROCESSOR_NANOLOG
+    uint64_t numLogIds = GeneratedFunctions::numLogIds;
+#else
+    uint64_t numLogIds = dictionary.size();
+#endif
+
+    uint64_t validBytes = 0;
+    while (nbytes - validBytes >= sizeof(Log::UncompressedEntry)) {
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                                            from + validBytes);
+        if (entry->entrySize < sizeof(Log::UncompressedEntry) ||
+                entry->entrySize > nbytes - validBytes ||
+                entry->fmtId >= numLogIds)
+            break;
+
+        validBytes += entry->entrySize;
+    }
+
+    uint64_t numLogs = 0;
+    bool bufferEmpty = false;
+    while (validBytes > 0) {
+#ifdef PREPROCESSOR_NANOLOG
+        long bytesRead = encoder.encodeLogMsgs(from, validBytes, bufferId,
+                                               false, &numLogs);
+#else
+        long bytesRead = encoder.encodeLogMsgs(from, validBytes, bufferId,
+                                               false, dictionary, &numLogs);
+#endif
+
+        if (bytesRead == 0) {
+            // Give up on a log message that doesn't even fit an empty buffer
+            if (bufferEmpty)
+                break;
+
+            writeCrashLog(encoder);
+            bufferEmpty = true;
+            continue;
+        }
+
+        bufferEmpty = false;
+        from += bytesRead;
+        validBytes -= bytesRead;
+    }
+
+    return numLogs;
+}
+
+/**
+ * Writes the crash dump encoded so far to the crash log with plain write(2)s
+ * and resets the Encoder to the start of its (same) buffer.
+ *
+ * \param encoder
+ *      Encoder of the crash dump
+ */
+void
+RuntimeLogger::writeCrashLog(Log::Encoder &encoder)
+{
+    char *buffer = nullptr;
+    size_t length = 0;
+    encoder.swapBuffer(crashBuffer, crashBufferSize, &buffer, &length);
+
+    for (size_t written = 0; written < length; ) {
+        ssize_t ret = write(crashFd, buffer + written, length - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return;
+        written += ret;
+    }
+}
+
+/**
+* Pins the background compression threads to a set of cores. The i-th
+* compression thread is pinned to coreIds[i % coreIds.size()]; an empty
+* vector restores the CPU affinity the process started with. This function is
+* thread safe and applies to the running threads as well as the ones created
+* later by setCompressionThreads().
+*
+* \param coreIds
+*      Cores to pin the background compression threads to
+*/
+void
+RuntimeLogger::setBackgroundThreadAffinity(const std::vector<int> &coreIds) {
+    for (int core : coreIds) {
+        if (core < 0 || core >= CPU_SETSIZE) {
+            fprintf(stderr, "NanoLog cannot pin the compression threads to "
+                    "invalid core %d\r\n", core);
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(nanoLogSingleton.bufferMutex);
+    nanoLogSingleton.backgroundThreadCores = coreIds;
+    for (CompressionWorker *worker : nanoLogSingleton.getAllWorkers()) {
+        if (worker->compressionThread.joinable())
+            worker->applyThreadSettings(
+                                    worker->compressionThread.native_handle());
+    }
+}
+
+/**
+* Sets the scheduling policy and priority of the background compression
+* threads (see sched_setscheduler(2)). This function is thread safe and
+* applies to the running threads as well as the ones created later.
+*
+* \param policy
+*      Scheduling policy (i.e. SCHED_OTHER, SCHED_BATCH, SCHED_FIFO)
+* \param priority
+*      Static priority for realtime policies; 0 for the others
+*/
+void
+RuntimeLogger::setBackgroundThreadScheduling(int policy, int priority) {
+    int minPriority = sched_get_priority_min(policy);
+    int maxPriority = sched_get_priority_max(policy);
+    if (minPriority < 0 || maxPriority < 0) {
+        fprintf(stderr, "NanoLog cannot set the compression threads to "
+                "invalid scheduling policy %d\r\n", policy);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(nanoLogSingleton.bufferMutex);
+    nanoLogSingleton.backgroundThreadPolicy = policy;
+    nanoLogSingleton.backgroundThreadPriority =
+                        std::max(minPriority, std::min(maxPriority, priority));
+    for (CompressionWorker *worker : nanoLogSingleton.getAllWorkers()) {
+        if (worker->compressionThread.joinable())
+            worker->applyThreadSettings(
+                                    worker->compressionThread.native_handle());
+    }
+}
+
+/**
+* Enables the adaptive StagingBuffer mode in which a thread's StagingBuffer is
+* doubled in size (up to maxBytes) whenever its producer has been blocked for
+* more than NanoLogConfig::ADAPTIVE_GROWTH_BLOCKED_US waiting for space. Once
+* the producer has not been blocked for NanoLogConfig::ADAPTIVE_SHRINK_QUIET_MS,
+* the buffer is returned to its original size the next time the producer
+* runs out of free space. The buffers are never resized under the producer;
+* instead a new buffer is chained after the old one (see
+* allocateStagingBuffer()). This function is thread safe.
+*
+* \param maxBytes
+*      Maximum size a StagingBuffer may grow to; it's capped at the output
+*      buffer size. A value of 0 disables the adaptive mode (default).
+*/
+void
+RuntimeLogger::setAdaptiveStagingBufferLimit(size_t maxBytes) {
+    nanoLogSingleton.adaptiveStagingBufferLimit = (maxBytes == 0) ? 0 :
+                             nanoLogSingleton.clampStagingBufferSize(maxBytes);
+}
+
+/**
+ * Assigns a StagingBuffer to the worker without blocking its compression
+ * thread; the thread adopts it on its next pass through the StagingBuffers.
+ * This function is thread safe.
+ *
+ * \param sb
+ *      StagingBuffer to assign
+ */
+void
+RuntimeLogger::CompressionWorker::addStagingBuffer(StagingBuffer *sb) {
+    numThreadBuffers.fetch_add(1);
+
+    StagingBuffer *head = newThreadBuffers.load(std::memory_order_relaxed);
+    do {
+        sb->nextNewBuffer = head;
+    } while (!newThreadBuffers.compare_exchange_weak(head, sb,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+/**
+ * Moves the StagingBuffers added via addStagingBuffer() into threadBuffers.
+ * This must be invoked by the compression thread or while it's stopped.
+ */
+void
+RuntimeLogger::CompressionWorker::adoptNewStagingBuffers() {
+    StagingBuffer *sb = newThreadBuffers.exchange(nullptr,
+                                                  std::memory_order_acquire);
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    while (sb != nullptr) {
+        StagingBuffer *next = sb->nextNewBuffer;
+        sb->nextNewBuffer = nullptr;
+        threadBuffers.push_back(sb);
+        sb = next;
+    }
+}
+
+/**
+ * Returns true if any of the StagingBuffers owned by the worker contains log
+ * messages that have not been consumed yet, or if there are new StagingBuffers
+ * to adopt. This must be invoked by the compression thread.
+ */
+bool
+RuntimeLogger::CompressionWorker::hasUnconsumedData() {
+    if (newThreadBuffers.load() != nullptr)
+        return true;
+
+    for (StagingBuffer *sb : threadBuffers) {
+        if (sb->getBytesQueued() > 0)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Blocks the background compression thread until a producer or a sync() or
+ * stop() wakes it up via RuntimeLogger::wakeupWorkers(), or until
+ * IDLE_WAIT_TIMEOUT_US elapses.
+ *
+ * \param expectedSeq
+ *      Value of RuntimeLogger::wakeupSeq sampled before the caller last
+ *      checked for work; the function returns immediately if it has changed.
+ */
+void
+RuntimeLogger::CompressionWorker::waitForWork(uint32_t expectedSeq) {
+    logger->numSleepingWorkers.fetch_add(1);
+
+    // Producers check numSleepingWorkers in their slow path after publishing
+    // their previous log messages, so either they will wake this thread or
+    // the check below will find their log messages.
+    if (!hasUnconsumedData()) {
+        struct timespec timeout;
+        timeout.tv_sec = NanoLogConfig::IDLE_WAIT_TIMEOUT_US / 1000000;
+        timeout.tv_nsec = (NanoLogConfig::IDLE_WAIT_TIMEOUT_US % 1000000)*1000;
+
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        syscall(SYS_futex, &logger->wakeupSeq, FUTEX_WAIT_PRIVATE,
+                expectedSeq, &timeout, nullptr, 0);
+        cyclesIdleWaiting += PerfUtils::Cycles::rdtsc() - start;
+        ++numIdleWaits;
+    }
+
+    logger->numSleepingWorkers.fetch_sub(1);
+}
+
+/**
+* Main compression thread that handles scanning through the StagingBuffers
+* owned by the worker, compressing log entries, and outputting a compressed
+* log file.
+*/
+void
+RuntimeLogger::CompressionWorker::compressionThreadMain() {
+    // Index of the last StagingBuffer checked for uncompressed log messages
+    size_t lastStagingBufferChecked = 0;
+
+    // Marks when the thread wakes up. This value should be used to calculate
+    // the number of cyclesActive right before blocking/sleeping and then updated
+    // to the latest rdtsc() when the thread re-awakens.
+    uint64_t cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
+    cycleAtThreadStart = cyclesAwakeStart;
+
+    // Apply the affinity before anything is allocated or faulted in so that
+    // the pages land on the NUMA node of the thread
+    {
+        std::lock_guard<std::mutex> lock(logger->bufferMutex);
+        applyThreadSettings(pthread_self());
+    }
+
+    // Register the buffers that are actually written from
+    if (blockBuffers.empty()) {
+        backend->registerBuffers(outputBuffers.data(),
+                                 downCast<uint32_t>(outputBuffers.size()),
+                                 outputBufferSize);
+    } else {
+        backend->registerBuffers(blockBuffers.data(),
+                                 downCast<uint32_t>(blockBuffers.size()),
+                                 blockBufferSize);
+    }
+
+    // Manages the state associated with compressing log messages
+#ifdef PREPROCESSOR_NANOLOG
+    // The functions generated by the preprocessor can't delta encode
+    bool deltaEncoding = false;
+#else
+    bool deltaEncoding = logger->deltaEncoding;
+#endif
+    Log::Encoder encoder(compressingBuffer, outputBufferSize, false, false,
+                         deltaEncoding, !blockBuffers.empty());
+    if (!logSiteCompressedBytes.empty())
+        encoder.setCompressedBytesPerLogId(logSiteCompressedBytes.data());
+
+    // Indicates that the next output buffer starts with the Encoder's
+    // Checkpoint, which is written out ahead of the first CompressedBlock
+    bool checkpointPending = true;
+
+    // Indicates whether a compression operation failed or not due
+    // to insufficient space in the outputBuffer
+    bool outputBufferFull = false;
 
     // Indicates that in scanning the StagingBuffers, we have passed the
     // zero-th index, but have not yet encoded that in he compressed output
     bool wrapAround = false;
 
     // Keeps a shadow mapping of the log identifiers to static information
-    // to allow the logging threads to register in parallel with compression
-    // lookup
+    // that has been persisted to the output. Only entries in this mapping
+    // may be encoded since the decompressor requires the dictionary entry to
+    // precede the log messages that use it.
     std::vector<StaticLogInfo> shadowStaticInfo;
 
+    // rdtsc() of when the thread last ran out of work (0 if it has work) and
+    // the number of cycles it should spin for before blocking in waitForWork()
+    uint64_t cycleIdleStart = 0;
+    const uint64_t cyclesIdleSpin = PerfUtils::Cycles::fromNanoseconds(
+                                            NanoLogConfig::IDLE_SPIN_US*1000);
+
+    // Number of cycles between the clock syncs written to the log
+    const uint64_t cyclesPerClockSync = PerfUtils::Cycles::fromSeconds(
+                                    NanoLogConfig::CLOCK_SYNC_INTERVAL_SECONDS);
+
     // Each iteration of this loop scans for uncompressed log messages in the
     // thread buffers, compresses as much as possible, and outputs it to a file.
     // The loop will run so long as it's not shutdown or there's outstanding I/O
     while (!compressionThreadShouldExit || encoder.getEncodedBytes() > 0
-                                        || hasOutstandingOperation)
+                                        || backend->getNumOutstanding() > 0)
     {
         coreId = sched_getcpu();
 
@@ -394,25 +2487,45 @@ RuntimeLogger::compressionThreadMain() {
         uint64_t start = PerfUtils::Cycles::rdtsc();
         // Step 1: Find buffers with entries and compress them
         {
-            std::unique_lock<std::mutex> lock(bufferMutex);
+            // Pick up the StagingBuffers of the threads that started logging
+            // since the last pass
+            if (newThreadBuffers.load(std::memory_order_relaxed) != nullptr)
+                adoptNewStagingBuffers();
+
             size_t i = lastStagingBufferChecked;
 
             // Output new dictionary entries, if necessary
-            if (nextInvocationIndexToBePersisted < invocationSites.size())
+            uint32_t numInvocationSites = logger->invocationSites.size();
+            if (nextInvocationIndexToBePersisted < numInvocationSites)
             {
-                std::unique_lock<std::mutex> lock (registrationMutex);
+                // Update our shadow copy with the newly published entries
+                for (uint32_t i = downCast<uint32_t>(shadowStaticInfo.size());
+                                                i < numInvocationSites; ++i)
+                {
+                    shadowStaticInfo.push_back(logger->invocationSites[i]);
+                }
+
                 encoder.encodeNewDictionaryEntries(
                                                nextInvocationIndexToBePersisted,
-                                               invocationSites);
+                                               shadowStaticInfo);
 
-                // update our shadow copy
-                for (uint64_t i = shadowStaticInfo.size();
-                                    i < nextInvocationIndexToBePersisted; ++i)
-                {
-                    shadowStaticInfo.push_back(invocationSites.at(i));
-                }
+                // Only expose the persisted entries to the encoder
+                while (shadowStaticInfo.size() >
+                                            nextInvocationIndexToBePersisted)
+                    shadowStaticInfo.pop_back();
             }
 
+            // Refresh the correlation of rdtsc() with the wall time for the
+            // log messages that follow
+            if (start - encoder.getLastClockSync() > cyclesPerClockSync)
+                encoder.encodeClockSync();
+
+            // The flight recorder retains the log messages of the default
+            // log in the StagingBuffers until a sync() asks for them
+            bool recording = channel == nullptr &&
+                             logger->flightRecorder.load() &&
+                             syncStatus == SYNC_COMPLETED;
+
             // Scan through the threadBuffers looking for log messages to
             // compress while the output buffer is not full.
             while (!outputBufferFull && !threadBuffers.empty())
@@ -421,19 +2534,20 @@ RuntimeLogger::compressionThreadMain() {
                 StagingBuffer *sb = threadBuffers[i];
                 char *peekPosition = sb->peek(&peekBytes);
 
-                // If there's work, unlock to perform it
-                if (peekBytes > 0) {
+                if (peekBytes > 0 && recording) {
+                    discardOldestLogMsgs(sb, peekPosition, peekBytes);
+                } else if (peekBytes > 0) {
                     uint64_t start = PerfUtils::Cycles::rdtsc();
-                    lock.unlock();
 
                     // Record metrics on the peek size
                     size_t sizeOfDist = Util::arraySize(stagingBufferPeekDist);
                     size_t distIndex = (sizeOfDist*peekBytes)/
-                                            NanoLogConfig::STAGING_BUFFER_SIZE;
+                                                        sb->getCapacity();
                     ++(stagingBufferPeekDist[distIndex]);
 
 
                     // Encode the data in RELEASE_THRESHOLD chunks
+                    uint64_t numLogsEncoded = 0;
                     uint32_t remaining = downCast<uint32_t>(peekBytes);
                     while (remaining > 0) {
                         long bytesToEncode = std::min(
@@ -445,7 +2559,7 @@ RuntimeLogger::compressionThreadMain() {
                                 bytesToEncode,
                                 sb->getId(),
                                 wrapAround,
-                                &logsProcessed);
+                                &numLogsEncoded);
 #else
                         long bytesRead = encoder.encodeLogMsgs(
                                 peekPosition + (peekBytes - remaining),
@@ -453,7 +2567,7 @@ RuntimeLogger::compressionThreadMain() {
                                 sb->getId(),
                                 wrapAround,
                                 shadowStaticInfo,
-                                &logsProcessed);
+                                &numLogsEncoded);
 #endif
 
 
@@ -469,14 +2583,34 @@ RuntimeLogger::compressionThreadMain() {
                         totalBytesRead += bytesRead;
                         bytesConsumedThisIteration += bytesRead;
                     }
+                    logsProcessed += numLogsEncoded;
                     cyclesCompressing += PerfUtils::Cycles::rdtsc() - start;
-                    lock.lock();
                 } else {
                     // If there's no work, check if we're supposed to delete
                     // the stagingBuffer
                     if (sb->checkCanDelete()) {
+                        // Other readers of threadBuffers (i.e. getStats())
+                        // may be looking at the buffer
+                        std::lock_guard<std::mutex> lock(bufferMutex);
+
+                        // Keep its producer metrics in the totals
+                        retiredAllocations += sb->numAllocations;
+                        retiredWaitsForSpace += sb->numWaitsForSpace;
+                        retiredCyclesWaitingForSpace +=
+                                                    sb->cyclesWaitingForSpace;
+                        addLogSiteStats(retiredLogSiteStats,
+                                        sb->logSiteStats);
+
+                        // Swap in the buffer that replaced this one, if any
+                        StagingBuffer *next = sb->next;
                         delete sb;
 
+                        if (next != nullptr) {
+                            threadBuffers[i] = next;
+                            continue;
+                        }
+
+                        numThreadBuffers.fetch_sub(1);
                         threadBuffers.erase(threadBuffers.begin() + i);
                         if (threadBuffers.empty()) {
                             lastStagingBufferChecked = i = 0;
@@ -507,10 +2641,20 @@ RuntimeLogger::compressionThreadMain() {
             cyclesScanningAndCompressing += PerfUtils::Cycles::rdtsc() - start;
         }
 
+        // Batch the flushes of the DURABILITY_PERIODIC mode. They're only
+        // performed with no writes in flight so that they cover all the
+        // output so far; writes to the page cache complete quickly.
+        if (backend->getNumOutstanding() == 0 && periodicSyncDue())
+            flushOutputFile();
+
         // If there's no data to output, go to sleep.
         if (encoder.getEncodedBytes() == 0) {
             std::unique_lock<std::mutex> lock(condMutex);
 
+            // Sampled before checking for sync()/stop() requests so that a
+            // request made after the check also aborts the waitForWork().
+            uint32_t seq = logger->wakeupSeq.load();
+
             // If a sync was requested, we should make at least 1 more
             // pass to make sure we got everything up to the sync point.
             if (syncStatus == SYNC_REQUESTED) {
@@ -519,178 +2663,960 @@ RuntimeLogger::compressionThreadMain() {
             }
 
             if (syncStatus == PERFORMING_SECOND_PASS) {
-                syncStatus = (hasOutstandingOperation) ? WAITING_ON_AIO
-                                                      : SYNC_COMPLETED;
+                if (backend->getNumOutstanding() > 0) {
+                    syncStatus = WAITING_ON_AIO;
+                } else {
+                    flushOutputFile();
+                    syncStatus = SYNC_COMPLETED;
+                }
+            }
+
+            if (syncStatus == SYNC_COMPLETED) {
+                hintSyncCompleted.notify_all();
+            }
+
+            // Stay awake while there's output I/O to reap; otherwise spin
+            // for a bit and then block until a producer wakes us up.
+            uint64_t now = PerfUtils::Cycles::rdtsc();
+            if (backend->getNumOutstanding() > 0) {
+                cyclesActive += now - cyclesAwakeStart;
+                workAdded.wait_for(lock, std::chrono::microseconds(
+                        NanoLogConfig::POLL_INTERVAL_NO_WORK_US));
+                cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
+            } else if (cycleIdleStart == 0) {
+                cycleIdleStart = now;
+            } else if (now - cycleIdleStart >= cyclesIdleSpin &&
+                        !compressionThreadShouldExit) {
+                lock.unlock();
+                cyclesActive += now - cyclesAwakeStart;
+                waitForWork(seq);
+                cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
+
+                // Spin again if we were woken up rather than timed out since
+                // the producer's log message may not be published yet.
+                if (logger->wakeupSeq.load() != seq)
+                    cycleIdleStart = cyclesAwakeStart;
+            }
+        } else {
+            cycleIdleStart = 0;
+        }
+
+        if (backend->getNumOutstanding() > 0) {
+            uint32_t numCompleted = backend->reap(false);
+            bool ringFull = backend->getNumOutstanding() >=
+                                                    backend->getQueueDepth();
+
+            if (outputBufferFull && ringFull) {
+                // If the output buffer is full and all the other buffers
+                // in the ring are in flight, wait for a completion
+                uint64_t stallStart = PerfUtils::Cycles::rdtsc();
+                cyclesActive += stallStart - cyclesAwakeStart;
+                numCompleted += backend->reap(true);
+                cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
+                cyclesOutputRingStalled += cyclesAwakeStart - stallStart;
+                ++numOutputRingStalls;
+            } else if (numCompleted == 0 && !outputBufferFull) {
+                // If there's no new data, go to sleep.
+                if (bytesConsumedThisIteration == 0 &&
+                    NanoLogConfig::POLL_INTERVAL_DURING_IO_US > 0)
+                {
+                    std::unique_lock<std::mutex> lock(condMutex);
+                    cyclesActive += PerfUtils::Cycles::rdtsc() -
+                                   cyclesAwakeStart;
+                    workAdded.wait_for(lock, std::chrono::microseconds(
+                            NanoLogConfig::POLL_INTERVAL_DURING_IO_US));
+                    cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
+                }
+
+                numCompleted = backend->reap(false);
+            }
+
+            if (numCompleted > 0) {
+                // Finishing up the IO
+                recordWritesCompleted(numCompleted);
+                numAioWritesCompleted += numCompleted;
+                cyclesDiskIO_upperBound += (start - cyclesAtLastAIOStart);
+                cyclesAtLastAIOStart = start;
+
+                if (!retiredOutputFds.empty() &&
+                        backend->getNumOutstanding() == 0)
+                    closeRetiredOutputFiles();
+
+                // We've completed all the I/O, check if we need to notify
+                if (syncStatus == WAITING_ON_AIO &&
+                        backend->getNumOutstanding() == 0) {
+                    std::unique_lock<std::mutex> lock(condMutex);
+                    if (syncStatus == WAITING_ON_AIO) {
+                        flushOutputFile();
+                        syncStatus = SYNC_COMPLETED;
+                        hintSyncCompleted.notify_all();
+                    }
+                }
+            }
+
+            // While the disk is busy, keep batching log messages into the
+            // current buffer until it fills up.
+            if (backend->getNumOutstanding() > 0 && !outputBufferFull)
+                continue;
+        }
+
+        // If we reach this point in the code, it means that either all I/O
+        // operations have completed or the current buffer is full and there's
+        // a free buffer in the ring. We'll check if we need to start a new
+        // write.
+        ssize_t bytesToWrite = encoder.getEncodedBytes();
+        if (bytesToWrite == 0)
+            continue;
+
+        // Compress the output buffer as a whole into its block buffer
+        char *writeBuffer = compressingBuffer;
+        if (!blockBuffers.empty()) {
+            uint64_t start = PerfUtils::Cycles::rdtsc();
+            char *blockBuffer = blockBuffers[compressingIndex];
+            size_t checkpointBytes = 0;
+            if (checkpointPending) {
+                checkpointBytes = sizeof(Log::Checkpoint);
+                std::memcpy(blockBuffer, compressingBuffer, checkpointBytes);
+            }
+
+            size_t blockBytes = 0;
+            if (size_t(bytesToWrite) > checkpointBytes) {
+                blockBytes = Log::compressBlock(
+                                    compressingBuffer + checkpointBytes,
+                                    bytesToWrite - checkpointBytes,
+                                    blockBuffer + checkpointBytes);
+            }
+
+            totalBytesBlockCompressed += bytesToWrite;
+            bytesToWrite = checkpointBytes + blockBytes;
+            writeBuffer = blockBuffer;
+            cyclesBlockCompressing += PerfUtils::Cycles::rdtsc() - start;
+        }
+        checkpointPending = false;
+
+        // Pad the output if necessary
+        if (getDurability() == DURABILITY_DIRECT) {
+            const ssize_t alignment = NanoLogConfig::DIRECT_IO_ALIGNMENT;
+            ssize_t bytesOver = bytesToWrite % alignment;
+
+            if (bytesOver != 0) {
+                memset(writeBuffer + bytesToWrite, 0, alignment - bytesOver);
+                bytesToWrite = bytesToWrite + alignment - bytesOver;
+                padBytesWritten += (alignment - bytesOver);
+            }
+        }
+
+        totalBytesWritten += bytesToWrite;
+
+        uint32_t numOutstanding = backend->getNumOutstanding();
+        uint64_t submitCycles = PerfUtils::Cycles::rdtsc();
+        if (numOutstanding == 0)
+            cyclesAtLastAIOStart = submitCycles;
+        cyclesAtWriteSubmit[(oldestWriteInFlight + numOutstanding)
+                            % cyclesAtWriteSubmit.size()] = submitCycles;
+        backend->submitWrite(outputFd, writeBuffer, bytesToWrite);
+        numWritesInFlight = backend->getNumOutstanding();
+
+        if (bytesWrittenSinceSync == 0)
+            cyclesAtUnsyncedWrite = PerfUtils::Cycles::rdtsc();
+        bytesWrittenSinceSync += bytesToWrite;
+
+        // Record where the buffer lands in the output for time range queries
+        if (indexFd >= 0) {
+            Log::IndexEntry ie;
+            ie.checkpointOffset = checkpointOffset;
+            ie.offset = outputFileOffset;
+            ie.length = downCast<uint32_t>(bytesToWrite);
+            ie.hasMetadata = encoder.hasEncodedMetadata();
+            encoder.getEncodedTimestampRange(&ie.minTimestamp,
+                                             &ie.maxTimestamp);
+            encoder.getEncodedLogIds(ie.logIds);
+            ie.numWrapArounds = encoder.getEncodedWrapArounds();
+
+            if (write(indexFd, &ie, sizeof(ie)) != sizeof(ie)) {
+                perror("NanoLog could not write to the index file; it will "
+                       "no longer be maintained");
+                close(indexFd);
+                indexFd = -1;
             }
+        }
+        outputFileOffset += bytesToWrite;
+
+        size_t sizeOfDist = Util::arraySize(outputRingOccupancyDist);
+        size_t distIndex = std::min(sizeOfDist - 1,
+                                    (sizeOfDist*backend->getNumOutstanding())/
+                                                        outputBuffers.size());
+        ++(outputRingOccupancyDist[distIndex]);
+
+        // Rotate to the next buffer in the ring
+        compressingIndex = downCast<uint32_t>(
+                                (compressingIndex + 1) % outputBuffers.size());
+        compressingBuffer = outputBuffers[compressingIndex];
+        encoder.swapBuffer(compressingBuffer, outputBufferSize);
+        outputBufferFull = false;
+
+        // Rotating between output buffers means that the new file can start
+        // with a fresh Checkpoint and a replay of the whole dictionary, which
+        // makes it decodable on its own. The producers never wait on it.
+        if (shouldRotateOutputFile() && rotateOutputFile()) {
+            encoder.startNewLog();
+            checkpointPending = true;
+            nextInvocationIndexToBePersisted = 0;
+            shadowStaticInfo.clear();
+        }
+    }
+
+    cycleAtThreadStart = 0;
+    cyclesActive += PerfUtils::Cycles::rdtsc() - cyclesAwakeStart;
+}
+
+/**
+ * Syncs and replaces the CompressionWorkers with new ones configured with the
+ * current settings. This function is *not* thread safe.
+ *
+ * \param outputFds
+ *      Output file descriptors for the new workers (see createWorkers())
+ */
+void
+RuntimeLogger::restartWorkers(const std::vector<int> &outputFds) {
+    sync();
+    destroyWorkers();
+
+    // The workers of the log channels pick up the new settings as well
+    for (LogChannel *channel : channels) {
+        if (channel == nullptr)
+            continue;
+
+        int fd = openOutputFile(channel->logFile, channel->durability);
+        if (fd < 0) {
+            fprintf(stderr, "NanoLog could not reopen the log file %s of "
+                            "channel %s (%s); it keeps its previous "
+                            "settings.\r\n", channel->logFile.c_str(),
+                            channel->name.c_str(), strerror(errno));
+            continue;
+        }
+
+        restartChannelWorker(channel, fd);
+    }
+
+    // The external consumer of the shared memory sink owns the output
+    if (sharedMemoryRegistry != nullptr) {
+        for (int fd : outputFds)
+            close(fd);
+        return;
+    }
+
+    createWorkers(outputFds);
+}
+
+// Documentation in NanoLog.h
+void
+RuntimeLogger::setLogFile_internal(const char *filename) {
+    // Try to open the files before touching the workers
+    std::vector<int> newFds = openOutputFiles(filename,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+
+    // Everything seems okay, restart the workers on the new files. The
+    // dictionary is implicitly reset since new workers start persisting the
+    // dictionary from the beginning.
+    logFile = filename;
+    restartWorkers(newFds);
+}
+
+/**
+ * Internal implementation of setCompressionThreads(); see below.
+ */
+void
+RuntimeLogger::setCompressionThreads_internal(uint32_t numThreads) {
+    numThreads = std::max(1U, std::min(numThreads,
+                                NanoLogConfig::MAX_COMPRESSION_THREADS));
+    if (numThreads == workers.size() || sharedMemoryRegistry != nullptr)
+        return;
+
+    restartWorkers(openOutputFiles(logFile, numThreads, durability));
+}
+
+/**
+ * Internal implementation of setNumOutputBuffers(); see below.
+ */
+void
+RuntimeLogger::setNumOutputBuffers_internal(uint32_t numBuffers) {
+    numBuffers = std::max(2U, numBuffers);
+    if (numBuffers == numOutputBuffers)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    numOutputBuffers = numBuffers;
+    restartWorkers(newFds);
+}
+
+/**
+* Set where the NanoLog should output its compressed log. If a previous
+* log file was specified, NanoLog will attempt to sync() the remaining log
+* entries before swapping files. For best practices, the output file shall
+* be set before the first invocation to log by the main thread as this
+* function is *not* thread safe.
+*
+* By default, the NanoLog will output to /tmp/compressedLog
+*
+* \param filename
+*      File for NanoLog to output the compress log
+*
+* \throw is_base::failure
+*      if the file cannot be opened or crated
+*/
+void
+RuntimeLogger::setLogFile(const char *filename) {
+    nanoLogSingleton.setLogFile_internal(filename);
+}
+
+/**
+* Sets the number of background threads used to compress and output the log
+* messages. Each thread owns a disjoint subset of the logging threads'
+* StagingBuffers and outputs to its own file; the first thread outputs to the
+* log file and the i-th additional thread outputs to the log file name with
+* ".i" appended. Each file can be decompressed independently. Like
+* setLogFile(), this function is *not* thread safe and shall be invoked before
+* the first invocation to log.
+*
+* \param numThreads
+*      Number of compression threads to use; values are clamped to
+*      [1, NanoLogConfig::MAX_COMPRESSION_THREADS]
+*
+* \throw is_base::failure
+*      if the additional log files cannot be opened or created
+*/
+void
+RuntimeLogger::setCompressionThreads(uint32_t numThreads) {
+    nanoLogSingleton.setCompressionThreads_internal(numThreads);
+}
+
+/**
+* Sets the number of output buffers in each compression thread's output ring.
+* One buffer is compressed into while the others may be in flight to the disk,
+* which allows the compression to run ahead of slow or high-latency storage.
+* The memory footprint is the number of buffers times the output buffer size
+* (see setOutputBufferSize()) per compression thread. Like setLogFile(),
+* this function is *not* thread safe.
+*
+* \param numBuffers
+*      Number of output buffers per compression thread (at least 2)
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setNumOutputBuffers(uint32_t numBuffers) {
+    nanoLogSingleton.setNumOutputBuffers_internal(numBuffers);
+}
+
+/**
+ * Internal implementation of setOutputBackend(); see below.
+ */
+void
+RuntimeLogger::setOutputBackend_internal(OutputBackendType type) {
+    if (type == outputBackendType)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    outputBackendType = type;
+    restartWorkers(newFds);
+}
+
+/**
+* Selects the mechanism the background compression threads use to write the
+* compressed log. If the mechanism is not supported by the system (i.e.
+* io_uring on older kernels), POSIX AIO is used instead. Like setLogFile(),
+* this function is *not* thread safe.
+*
+* \param type
+*      Type of output backend to use
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setOutputBackend(OutputBackendType type) {
+    nanoLogSingleton.setOutputBackend_internal(type);
+}
+
+/**
+ * Internal implementation of setHugePages(); see below.
+ */
+void
+RuntimeLogger::setHugePages_internal(HugePageMode mode) {
+    if (mode == hugePages)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    hugePages = mode;
+    restartWorkers(newFds);
+}
+
+/**
+* Selects the page size backing the StagingBuffers allocated from now on and
+* the output buffers. The workers are restarted to remap their output
+* buffers. Like setLogFile(), this function is *not* thread safe.
+*
+* \param mode
+*      Page size to back the buffers with
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setHugePages(HugePageMode mode) {
+    nanoLogSingleton.setHugePages_internal(mode);
+}
+
+/**
+* Returns the name of the page size backing the buffers (see setHugePages()).
+*/
+const char *
+RuntimeLogger::getHugePagesName() {
+    switch (nanoLogSingleton.hugePages) {
+        case HUGE_PAGES_NONE:
+            return "off";
+        case HUGE_PAGES_TRANSPARENT:
+            return "transparent";
+        case HUGE_PAGES_2MB:
+            return "2 MB";
+        case HUGE_PAGES_1GB:
+            return "1 GB";
+    }
+
+    return "unknown";
+}
+
+/**
+ * Internal implementation of setDurability(); see below.
+ */
+void
+RuntimeLogger::setDurability_internal(DurabilityMode mode,
+                                      uint32_t syncIntervalMs,
+                                      uint64_t syncIntervalBytes)
+{
+    if (mode == DURABILITY_PERIODIC && syncIntervalMs == 0 &&
+            syncIntervalBytes == 0)
+        syncIntervalMs = NanoLogConfig::DEFAULT_SYNC_INTERVAL_MS;
+
+    if (mode != DURABILITY_PERIODIC)
+        syncIntervalMs = syncIntervalBytes = 0;
+
+    if (mode == durability && syncIntervalMs == this->syncIntervalMs &&
+            syncIntervalBytes == this->syncIntervalBytes)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            mode);
+    durability = mode;
+    this->syncIntervalMs = syncIntervalMs;
+    this->syncIntervalBytes = syncIntervalBytes;
+    restartWorkers(newFds);
+}
+
+/**
+* Selects when the background compression threads make the compressed log
+* durable (see DurabilityMode). The log files are reopened with the flags of
+* the new mode. Like setLogFile(), this function is *not* thread safe.
+*
+* \param mode
+*      When to make the log durable
+* \param syncIntervalMs
+*      Time limit between the flushes of DURABILITY_PERIODIC; 0 for none
+* \param syncIntervalBytes
+*      Output limit between the flushes of DURABILITY_PERIODIC; 0 for none
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setDurability(DurabilityMode mode, uint32_t syncIntervalMs,
+                             uint64_t syncIntervalBytes)
+{
+    nanoLogSingleton.setDurability_internal(mode, syncIntervalMs,
+                                            syncIntervalBytes);
+}
+
+/**
+* Returns the name of the durability mode of the log (see setDurability()).
+*/
+const char *
+RuntimeLogger::getDurabilityName() {
+    switch (nanoLogSingleton.durability) {
+        case DURABILITY_NONE:
+            return "none";
+        case DURABILITY_PERIODIC:
+            return "periodic";
+        case DURABILITY_PER_BUFFER:
+            return "per-buffer";
+        case DURABILITY_DIRECT:
+            return "direct";
+    }
+
+    return "unknown";
+}
+
+/**
+ * Returns the workers of the default log followed by the ones of the log
+ * channels. Like the workers, the channels are not modified concurrently
+ * with the callers.
+ */
+std::vector<RuntimeLogger::CompressionWorker*>
+RuntimeLogger::getAllWorkers()
+{
+    std::vector<CompressionWorker*> allWorkers = workers;
+    for (LogChannel *channel : channels) {
+        if (channel != nullptr)
+            allWorkers.push_back(channel->worker);
+    }
+
+    return allWorkers;
+}
+
+/**
+ * Returns a log channel created by createChannel().
+ *
+ * \param channel
+ *      Identifier of the channel
+ *
+ * \throw logic_error
+ *      if the channel doesn't exist
+ */
+RuntimeLogger::LogChannel *
+RuntimeLogger::getChannel(uint32_t channel)
+{
+    if (channel >= NanoLogConfig::MAX_LOG_CHANNELS ||
+            channels[channel] == nullptr)
+        throw std::logic_error("The log channel " + std::to_string(channel) +
+                               " does not exist");
+
+    return channels[channel];
+}
+
+/**
+ * Syncs and replaces the CompressionWorker of a log channel with a new one
+ * configured with the current settings. The StagingBuffers of the channel
+ * are handed over to the new worker. This function is *not* thread safe.
+ *
+ * \param channel
+ *      Log channel to restart the worker of
+ * \param outputFd
+ *      Output file descriptor for the new worker; ownership is transferred
+ *      to the worker.
+ */
+void
+RuntimeLogger::restartChannelWorker(LogChannel *channel, int outputFd)
+{
+    sync();
+
+    CompressionWorker *oldWorker = channel->worker;
+    oldWorker->stop();
+
+    CompressionWorker *worker = new CompressionWorker(this, oldWorker->id,
+                                                      outputFd, channel);
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        oldWorker->adoptNewStagingBuffers();
+        for (StagingBuffer *sb : oldWorker->threadBuffers)
+            worker->addStagingBuffer(sb);
+        oldWorker->threadBuffers.clear();
+        channel->worker = worker;
+    }
+
+    delete oldWorker;
+    worker->start();
+}
+
+/**
+ * Stops and deletes the log channels. The StagingBuffers of the channels
+ * that are still owned by a thread are left behind since the thread may
+ * keep logging to them. Callers should sync() beforehand to ensure all log
+ * messages are persisted.
+ */
+void
+RuntimeLogger::destroyChannels()
+{
+    for (LogChannel *channel : channels) {
+        if (channel != nullptr)
+            channel->worker->stop();
+    }
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for (LogChannel *&channel : channels) {
+        if (channel == nullptr)
+            continue;
+
+        CompressionWorker *worker = channel->worker;
+        worker->adoptNewStagingBuffers();
+        for (StagingBuffer *sb : worker->threadBuffers) {
+            if (sb->checkCanDelete())
+                delete sb;
+        }
+        worker->threadBuffers.clear();
+
+        delete worker;
+        delete channel;
+        channel = nullptr;
+    }
+}
+
+/**
+* Creates a log channel with a file, a compression thread and settings of its
+* own (see NanoLog::createChannel()). Like setLogFile(), this function is
+* *not* thread safe.
+*
+* \param name
+*      Name of the channel; the existing channel is returned for a name
+*      that's been used before
+* \param filename
+*      File to output the channel's compressed log to
+*
+* \return
+*      Identifier of the channel
+*
+* \throw logic_error
+*      if there are NanoLogConfig::MAX_LOG_CHANNELS channels already
+* \throw is_base::failure
+*      if the file cannot be opened or created
+*/
+uint32_t
+RuntimeLogger::createChannel(const char *name, const char *filename)
+{
+    RuntimeLogger &logger = nanoLogSingleton;
+
+    uint32_t id = 0;
+    for (uint32_t i = 1; i < NanoLogConfig::MAX_LOG_CHANNELS; ++i) {
+        if (logger.channels[i] == nullptr) {
+            if (id == 0)
+                id = i;
+        } else if (logger.channels[i]->name == name) {
+            return i;
+        }
+    }
+
+    if (id == 0)
+        throw std::logic_error("NanoLog supports at most " +
+                        std::to_string(NanoLogConfig::MAX_LOG_CHANNELS - 1) +
+                        " log channels");
+
+    LogChannel *channel = new LogChannel();
+    channel->name = name;
+    channel->logFile = filename;
+    channel->durability = DURABILITY_PER_BUFFER;
+    channel->syncIntervalMs = 0;
+    channel->syncIntervalBytes = 0;
+    channel->logLevel = NOTICE;
+    channel->dropLogLevel = NUM_LOG_LEVELS;
+
+    std::vector<int> fds;
+    try {
+        fds = openOutputFiles(filename, 1, channel->durability);
+    } catch (...) {
+        delete channel;
+        throw;
+    }
+
+    // The worker ids of the channels follow the ones of the default log
+    channel->worker = new CompressionWorker(&logger,
+                            NanoLogConfig::MAX_COMPRESSION_THREADS + id - 1,
+                            fds.at(0), channel);
+    {
+        std::lock_guard<std::mutex> lock(logger.bufferMutex);
+        logger.channels[id] = channel;
+    }
+    channel->worker->start();
 
-            if (syncStatus == SYNC_COMPLETED) {
-                hintSyncCompleted.notify_one();
-            }
+    return id;
+}
 
-            cyclesActive += PerfUtils::Cycles::rdtsc() - cyclesAwakeStart;
-            workAdded.wait_for(lock, std::chrono::microseconds(
-                    NanoLogConfig::POLL_INTERVAL_NO_WORK_US));
+/**
+* Selects when the compressed log of a log channel is made durable (see
+* setDurability()). The channel's log file is reopened with the flags of the
+* new mode. Like setLogFile(), this function is *not* thread safe.
+*
+* \param channel
+*      Identifier of the channel
+* \param mode
+*      When to make the channel's log durable
+* \param syncIntervalMs
+*      Time limit between the flushes of DURABILITY_PERIODIC; 0 for none
+* \param syncIntervalBytes
+*      Output limit between the flushes of DURABILITY_PERIODIC; 0 for none
+*
+* \throw logic_error
+*      if the channel doesn't exist
+* \throw is_base::failure
+*      if the channel's log file cannot be reopened
+*/
+void
+RuntimeLogger::setChannelDurability(uint32_t channel, DurabilityMode mode,
+                                    uint32_t syncIntervalMs,
+                                    uint64_t syncIntervalBytes)
+{
+    LogChannel *logChannel = nanoLogSingleton.getChannel(channel);
 
-            cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
-        }
+    if (mode == DURABILITY_PERIODIC && syncIntervalMs == 0 &&
+            syncIntervalBytes == 0)
+        syncIntervalMs = NanoLogConfig::DEFAULT_SYNC_INTERVAL_MS;
 
-        if (hasOutstandingOperation) {
-            if (aio_error(&aioCb) == EINPROGRESS) {
-                const struct aiocb *const aiocb_list[] = {&aioCb};
-                if (outputBufferFull) {
-                    // If the output buffer is full and we're not done,
-                    // wait for completion
-                    cyclesActive += PerfUtils::Cycles::rdtsc() - cyclesAwakeStart;
-                    int err = aio_suspend(aiocb_list, 1, NULL);
-                    cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
-                    if (err != 0)
-                        perror("LogCompressor's Posix AIO "
-                                       "suspend operation failed");
-                } else {
-                    // If there's no new data, go to sleep.
-                    if (bytesConsumedThisIteration == 0 &&
-                        NanoLogConfig::POLL_INTERVAL_DURING_IO_US > 0)
-                    {
-                        std::unique_lock<std::mutex> lock(condMutex);
-                        cyclesActive += PerfUtils::Cycles::rdtsc() -
-                                       cyclesAwakeStart;
-                        workAdded.wait_for(lock, std::chrono::microseconds(
-                                NanoLogConfig::POLL_INTERVAL_DURING_IO_US));
-                        cyclesAwakeStart = PerfUtils::Cycles::rdtsc();
-                    }
+    if (mode != DURABILITY_PERIODIC)
+        syncIntervalMs = syncIntervalBytes = 0;
 
-                    if (aio_error(&aioCb) == EINPROGRESS)
-                        continue;
-                }
-            }
+    if (mode == logChannel->durability &&
+            syncIntervalMs == logChannel->syncIntervalMs &&
+            syncIntervalBytes == logChannel->syncIntervalBytes)
+        return;
 
-            // Finishing up the IO
-            int err = aio_error(&aioCb);
-            ssize_t ret = aio_return(&aioCb);
+    std::vector<int> newFds = openOutputFiles(logChannel->logFile, 1, mode);
 
-            if (err != 0) {
-                fprintf(stderr, "LogCompressor's POSIX AIO failed"
-                        " with %d: %s\r\n", err, strerror(err));
-            } else if (ret < 0) {
-                perror("LogCompressor's Posix AIO Write failed");
-            }
-            ++numAioWritesCompleted;
-            hasOutstandingOperation = false;
-            cyclesDiskIO_upperBound += (start - cyclesAtLastAIOStart);
-
-            // We've completed an AIO, check if we need to notify
-            if (syncStatus == WAITING_ON_AIO) {
-                std::unique_lock<std::mutex> lock(nanoLogSingleton.condMutex);
-                if (syncStatus == WAITING_ON_AIO) {
-                    syncStatus = SYNC_COMPLETED;
-                    hintSyncCompleted.notify_one();
-                }
-            }
-        }
+    // The old worker flushes its output with the old settings
+    nanoLogSingleton.sync();
+    logChannel->durability = mode;
+    logChannel->syncIntervalMs = syncIntervalMs;
+    logChannel->syncIntervalBytes = syncIntervalBytes;
+    nanoLogSingleton.restartChannelWorker(logChannel, newFds.at(0));
+}
 
-        // If we reach this point in the code, it means that all AIO operations
-        // have completed and the double buffer is now free. We'll check if
-        // we need to start a new AIO.
-        ssize_t bytesToWrite = encoder.getEncodedBytes();
-        if (bytesToWrite == 0)
-            continue;
+/**
+* Sets the minimum severity of the log messages logged to a log channel.
+* This function is thread safe.
+*
+* \param channel
+*      Identifier of the channel
+* \param logLevel
+*      New log level of the channel
+*
+* \throw logic_error
+*      if the channel doesn't exist
+*/
+void
+RuntimeLogger::setChannelLogLevel(uint32_t channel, LogLevel logLevel)
+{
+    if (logLevel < 0)
+        logLevel = static_cast<LogLevel>(0);
+    else if (logLevel >= NUM_LOG_LEVELS)
+        logLevel = static_cast<LogLevel>(NUM_LOG_LEVELS - 1);
 
-        // Pad the output if necessary
-        if (NanoLogConfig::FILE_PARAMS & O_DIRECT) {
-            ssize_t bytesOver = bytesToWrite % 512;
+    nanoLogSingleton.getChannel(channel)->logLevel = logLevel;
+}
 
-            if (bytesOver != 0) {
-                memset(compressingBuffer, 0, 512 - bytesOver);
-                bytesToWrite = bytesToWrite + 512 - bytesOver;
-                padBytesWritten += (512 - bytesOver);
-            }
-        }
+/**
+* Sets the LogLevel at which the log messages logged to a log channel are
+* dropped rather than blocking on a full StagingBuffer (see setDropOnFull()).
+* This function is thread safe.
+*
+* \param channel
+*      Identifier of the channel
+* \param level
+*      LogLevel at which log messages start to be dropped; ERROR drops all
+*      log messages and NUM_LOG_LEVELS drops none (default).
+*
+* \throw logic_error
+*      if the channel doesn't exist
+*/
+void
+RuntimeLogger::setChannelDropOnFull(uint32_t channel, LogLevel level)
+{
+    if (level < ERROR)
+        level = ERROR;
+    else if (level > NUM_LOG_LEVELS)
+        level = NUM_LOG_LEVELS;
 
-        aioCb.aio_fildes = outputFd;
-        aioCb.aio_buf = compressingBuffer;
-        aioCb.aio_nbytes = bytesToWrite;
-        totalBytesWritten += bytesToWrite;
+    nanoLogSingleton.getChannel(channel)->dropLogLevel = level;
+}
 
-        cyclesAtLastAIOStart = PerfUtils::Cycles::rdtsc();
-        if (aio_write(&aioCb) == -1)
-            fprintf(stderr, "Error at aio_write(): %s\n", strerror(errno));
+/**
+ * Internal implementation of setDeltaEncoding(); see below.
+ */
+void
+RuntimeLogger::setDeltaEncoding_internal(bool enable) {
+    if (enable == deltaEncoding)
+        return;
 
-        hasOutstandingOperation = true;
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    deltaEncoding = enable;
+    restartWorkers(newFds);
+}
 
-        // Swap buffers
-        encoder.swapBuffer(outputDoubleBuffer,
-                           NanoLogConfig::OUTPUT_BUFFER_SIZE);
-        std::swap(outputDoubleBuffer, compressingBuffer);
-        outputBufferFull = false;
-    }
+/**
+* Enables or disables the delta encoding of log message arguments (see
+* NanoLog::setDeltaEncoding()). Since the encoding is recorded at the start of
+* each log file, the log files are reopened. Like setLogFile(), this function
+* is *not* thread safe.
+*
+* \param enable
+*      True to delta encode the arguments; false to store them on their own
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setDeltaEncoding(bool enable) {
+    nanoLogSingleton.setDeltaEncoding_internal(enable);
+}
 
-    cycleAtThreadStart = 0;
-    cyclesActive += PerfUtils::Cycles::rdtsc() - cyclesAwakeStart;
+/**
+ * Internal implementation of setBlockCompression(); see below.
+ */
+void
+RuntimeLogger::setBlockCompression_internal(bool enable) {
+    if (enable == blockCompression)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    blockCompression = enable;
+    restartWorkers(newFds);
 }
 
-// Documentation in NanoLog.h
+/**
+* Enables or disables the compression of whole output buffers before they're
+* written out (see NanoLog::setBlockCompression()). Since the setting is
+* recorded at the start of each log file, the log files are reopened. Like
+* setLogFile(), this function is *not* thread safe.
+*
+* \param enable
+*      True to block compress the output; false to write it out as is
+*
+* \throw is_base::failure
+*      if the log files cannot be reopened
+*/
 void
-RuntimeLogger::setLogFile_internal(const char *filename) {
-    // Check if it exists and is readable/writeable
-    if (access(filename, F_OK) == 0 && access(filename, R_OK | W_OK) != 0) {
-        std::string err = "Unable to read/write from new log file: ";
-        err.append(filename);
-        throw std::ios_base::failure(err);
-    }
+RuntimeLogger::setBlockCompression(bool enable) {
+    nanoLogSingleton.setBlockCompression_internal(enable);
+}
 
-    // Try to open the file
-    int newFd = open(filename, NanoLogConfig::FILE_PARAMS, 0666);
-    if (newFd < 0) {
-        std::string err = "Unable to open file new log file: '";
-        err.append(filename);
-        err.append("': ");
-        err.append(strerror(errno));
-        throw std::ios_base::failure(err);
-    }
+/**
+* Sets the policy for rotating the log files (see
+* CompressionWorker::rotateOutputFile()). The workers pick up the new policy
+* the next time they output a buffer, so unlike setLogFile(), this function
+* doesn't restart them and may be invoked at any time.
+*
+* \param maxBytes
+*      Size in bytes at which a log file is rotated; 0 for no size limit
+* \param maxSeconds
+*      Number of seconds after which a log file is rotated; 0 for no age limit
+*/
+void
+RuntimeLogger::setLogRotation(uint64_t maxBytes, uint32_t maxSeconds) {
+    nanoLogSingleton.rotationMaxBytes = maxBytes;
+    nanoLogSingleton.rotationMaxSeconds = maxSeconds;
+}
 
-    // Everything seems okay, stop the background thread and change files
-    sync();
+/**
+ * Internal implementation of setSharedMemorySink(); see below.
+ */
+void
+RuntimeLogger::setSharedMemorySink_internal(const char *name) {
+#ifndef PREPROCESSOR_NANOLOG
+    throw std::logic_error("The shared memory sink requires the Preprocessor "
+                           "version of NanoLog");
+#endif
 
-    // Stop the compression thread completely
     {
-        std::lock_guard<std::mutex> lock(nanoLogSingleton.condMutex);
-        compressionThreadShouldExit = true;
-        workAdded.notify_all();
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if (sharedMemoryRegistry != nullptr)
+            throw std::logic_error("The shared memory sink is already set");
+
+        if (nextBufferId != 0)
+            throw std::logic_error("The shared memory sink must be set "
+                                   "before the first log message");
     }
 
-    if (compressionThread.joinable())
-        compressionThread.join();
+    // Try to create the registry before touching the workers
+    std::string registryName = SharedStagingBuffer::getRegistryName(name);
+    SharedStagingBuffer::Registry *registry =
+            SharedStagingBuffer::createRegistry(registryName);
 
-    if (outputFd > 0)
-        close(outputFd);
-    outputFd = newFd;
+    sync();
+    destroyWorkers();
 
-    // Relaunch thread
-    nextInvocationIndexToBePersisted = 0; // Reset the dictionary
-    compressionThreadShouldExit = false;
-#ifndef BENCHMARK_DISCARD_ENTRIES_AT_STAGINGBUFFER
-    compressionThread = std::thread(&RuntimeLogger::compressionThreadMain, this);
-#endif
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    sharedMemoryName = registryName;
+    sharedMemoryRegistry = registry;
 }
 
 /**
-* Set where the NanoLog should output its compressed log. If a previous
-* log file was specified, NanoLog will attempt to sync() the remaining log
-* entries before swapping files. For best practices, the output file shall
-* be set before the first invocation to log by the main thread as this
-* function is *not* thread safe.
+* Publishes the StagingBuffers in POSIX shared memory for an external process
+* to compress and output (i.e. the sidecar) and stops the compression
+* threads. See SharedStagingBuffer.h for the layout of the shared memory.
 *
-* By default, the NanoLog will output to /tmp/compressedLog
-*
-* \param filename
-*      File for NanoLog to output the compress log
+* \param name
+*      Name of the shared memory sink; the leading '/' is optional
 *
+* \throw logic_error
+*      if invoked after the first log message or with the C++17 version of
+*      NanoLog, the compression functions of which aren't available to other
+*      processes
 * \throw is_base::failure
-*      if the file cannot be opened or crated
+*      if the shared memory cannot be created
 */
 void
-RuntimeLogger::setLogFile(const char *filename) {
-    nanoLogSingleton.setLogFile_internal(filename);
+RuntimeLogger::setSharedMemorySink(const char *name) {
+    nanoLogSingleton.setSharedMemorySink_internal(name);
+}
+
+/**
+* Returns the name of the output backend used by the background compression
+* threads.
+*/
+const char *
+RuntimeLogger::getOutputBackendName() {
+    if (nanoLogSingleton.workers.empty())
+        return "none";
+    return nanoLogSingleton.workers.at(0)->backend->getName();
+}
+
+/**
+ * Internal implementation of setOutputBufferSize(); see below.
+ */
+void
+RuntimeLogger::setOutputBufferSize_internal(size_t bytes) {
+    bytes = std::max<size_t>(NanoLogConfig::MIN_OUTPUT_BUFFER_SIZE,
+                std::min<size_t>(bytes, NanoLogConfig::MAX_OUTPUT_BUFFER_SIZE));
+    bytes -= bytes % NanoLogConfig::OUTPUT_BUFFER_ALIGNMENT;
+    if (bytes == outputBufferSize)
+        return;
+
+    std::vector<int> newFds = openOutputFiles(logFile,
+                                            downCast<uint32_t>(workers.size()),
+                                            durability);
+    outputBufferSize = downCast<uint32_t>(bytes);
+    stagingBufferSize = std::min(stagingBufferSize, outputBufferSize);
+    restartWorkers(newFds);
+}
+
+/**
+* Sets the size of each output buffer in the compression threads' output
+* rings. The default StagingBuffer size is lowered to match if it is larger
+* than the new size. StagingBuffers that were already allocated are not
+* resized, so the output buffer should not be set smaller than any of them.
+* Like setLogFile(), this function is *not* thread safe.
+*
+* \param bytes
+*      Output buffer size in bytes; values are clamped to
+*      [NanoLogConfig::MIN_OUTPUT_BUFFER_SIZE,
+*      NanoLogConfig::MAX_OUTPUT_BUFFER_SIZE] and rounded down to
+*      a multiple of NanoLogConfig::OUTPUT_BUFFER_ALIGNMENT
+*
+* 	hrow is_base::failure
+*      if the log files cannot be reopened
+*/
+void
+RuntimeLogger::setOutputBufferSize(size_t bytes) {
+    nanoLogSingleton.setOutputBufferSize_internal(bytes);
 }
 
 /**
@@ -709,6 +3635,177 @@ RuntimeLogger::setLogLevel(LogLevel logLevel) {
     nanoLogSingleton.currentLogLevel = logLevel;
 }
 
+/**
+* Returns true if a log site rule applies to a log invocation site
+*
+* \param rule
+*      Rule to match against
+* \param logId
+*      Log identifier of the invocation site
+* \param info
+*      Static log information of the invocation site
+*/
+bool
+RuntimeLogger::matchesLogSiteRule(const LogSiteRule &rule, int logId,
+                                  const StaticLogInfo &info) {
+    switch (rule.type) {
+        case LogSiteRule::BY_ID:
+            return rule.logId == logId;
+
+        case LogSiteRule::BY_FILE: {
+            // The pattern may omit leading directories of the file name
+            size_t length = strlen(info.filename);
+            if (length < rule.pattern.size())
+                return false;
+
+            const char *suffix = info.filename + length - rule.pattern.size();
+            return rule.pattern == suffix &&
+                   (suffix == info.filename || suffix[-1] == '/');
+        }
+
+        case LogSiteRule::BY_SUBSTRING:
+            return strstr(info.formatString, rule.pattern.c_str()) != nullptr;
+    }
+
+    return false;
+}
+
+/**
+* Initializes the runtime enable flag of a newly registered log invocation
+* site from the log site rules set so far and tracks it so that later rules
+* can update it.
+*
+* \param logId
+*      Log identifier assigned to the invocation site
+* \param siteState
+*      Runtime enable flag of the invocation site
+*/
+void
+RuntimeLogger::registerLogSiteState(int logId, uint8_t *siteState) {
+    std::lock_guard<std::mutex> lock(logSiteMutex);
+    const StaticLogInfo &info = invocationSites[logId];
+
+    uint8_t state = LOG_SITE_DEFAULT;
+    for (const LogSiteRule &rule : logSiteRules) {
+        if (matchesLogSiteRule(rule, logId, info))
+            state = rule.enabled ? LOG_SITE_ENABLED : LOG_SITE_DISABLED;
+    }
+
+    if (logSiteStates.size() <= static_cast<size_t>(logId))
+        logSiteStates.resize(logId + 1, nullptr);
+    logSiteStates[logId] = siteState;
+    __atomic_store_n(siteState, state, __ATOMIC_RELAXED);
+}
+
+/**
+* Internal implementation of the setLogSite*Enabled*() functions; records a
+* log site rule and applies it to the invocation sites registered so far.
+*
+* \param rule
+*      Rule to add
+*
+* \return
+*      Number of registered invocation sites the rule applies to
+*/
+uint32_t
+RuntimeLogger::addLogSiteRule_internal(const LogSiteRule &rule) {
+    std::lock_guard<std::mutex> lock(logSiteMutex);
+    logSiteRules.push_back(rule);
+
+    uint32_t numMatched = 0;
+    uint8_t state = rule.enabled ? LOG_SITE_ENABLED : LOG_SITE_DISABLED;
+    for (size_t id = 0; id < logSiteStates.size(); ++id) {
+        int logId = static_cast<int>(id);
+        if (logSiteStates[id] == nullptr ||
+                !matchesLogSiteRule(rule, logId, invocationSites[logId]))
+            continue;
+
+        __atomic_store_n(logSiteStates[id], state, __ATOMIC_RELAXED);
+        ++numMatched;
+    }
+
+    return numMatched;
+}
+
+/**
+* Enables or disables a C++17 NANO_LOG invocation site regardless of the log
+* level; see NanoLog::setLogSiteEnabled().
+*
+* \param logId
+*      Log identifier (format id) of the invocation site
+* \param enabled
+*      true to always log the site, false to never log it
+*
+* \return
+*      Number of registered invocation sites affected
+*/
+uint32_t
+RuntimeLogger::setLogSiteEnabled(int logId, bool enabled) {
+    LogSiteRule rule{LogSiteRule::BY_ID, logId, "", enabled};
+    return nanoLogSingleton.addLogSiteRule_internal(rule);
+}
+
+/**
+* Enables or disables the C++17 NANO_LOG invocation sites of a file regardless
+* of the log level; see NanoLog::setLogSitesEnabledInFile().
+*
+* \param filename
+*      Name of the file or a suffix of it that starts after a '/'
+* \param enabled
+*      true to always log the sites, false to never log them
+*
+* \return
+*      Number of registered invocation sites affected
+*/
+uint32_t
+RuntimeLogger::setLogSitesEnabledInFile(const char *filename, bool enabled) {
+    LogSiteRule rule{LogSiteRule::BY_FILE, UNASSIGNED_LOGID, filename, enabled};
+    return nanoLogSingleton.addLogSiteRule_internal(rule);
+}
+
+/**
+* Enables or disables the C++17 NANO_LOG invocation sites whose format string
+* contains a substring regardless of the log level; see
+* NanoLog::setLogSitesEnabledContaining().
+*
+* \param substring
+*      Substring of the format strings to match
+* \param enabled
+*      true to always log the sites, false to never log them
+*
+* \return
+*      Number of registered invocation sites affected
+*/
+uint32_t
+RuntimeLogger::setLogSitesEnabledContaining(const char *substring,
+                                            bool enabled) {
+    LogSiteRule rule{LogSiteRule::BY_SUBSTRING, UNASSIGNED_LOGID, substring,
+                     enabled};
+    return nanoLogSingleton.addLogSiteRule_internal(rule);
+}
+
+/**
+* Internal implementation of resetLogSites(); see below.
+*/
+void
+RuntimeLogger::resetLogSites_internal() {
+    std::lock_guard<std::mutex> lock(logSiteMutex);
+    logSiteRules.clear();
+    for (uint8_t *siteState : logSiteStates) {
+        if (siteState != nullptr)
+            __atomic_store_n(siteState, LOG_SITE_DEFAULT, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+* Discards all log site rules so that the C++17 NANO_LOG invocation sites
+* follow the log level again.
+*/
+void
+RuntimeLogger::resetLogSites() {
+    nanoLogSingleton.resetLogSites_internal();
+}
+
 /**
 * Blocks until the NanoLog system is able to persist to disk the
 * pending log messages that occurred before this invocation. Note that this
@@ -722,10 +3819,21 @@ RuntimeLogger::sync() {
     return;
 #endif
 
-    std::unique_lock<std::mutex> lock(nanoLogSingleton.condMutex);
-    nanoLogSingleton.syncStatus = SYNC_REQUESTED;
-    nanoLogSingleton.workAdded.notify_all();
-    nanoLogSingleton.hintSyncCompleted.wait(lock);
+    std::vector<CompressionWorker*> workers =
+                                        nanoLogSingleton.getAllWorkers();
+    for (CompressionWorker *worker : workers) {
+        std::unique_lock<std::mutex> lock(worker->condMutex);
+        worker->syncStatus = CompressionWorker::SYNC_REQUESTED;
+        worker->workAdded.notify_all();
+    }
+    nanoLogSingleton.wakeupWorkers();
+
+    for (CompressionWorker *worker : workers) {
+        std::unique_lock<std::mutex> lock(worker->condMutex);
+        worker->hintSyncCompleted.wait(lock, [worker] {
+            return worker->syncStatus == CompressionWorker::SYNC_COMPLETED;
+        });
+    }
 }
 
 /**
@@ -746,16 +3854,37 @@ RuntimeLogger::sync() {
 *
 * \return
 *      A pointer into storage[] that can be written to by the producer for
-*      at least nbytes.
+*      at least nbytes. In the adaptive mode, the pointer may instead
+*      point into a resized StagingBuffer that replaced this one as the
+*      thread's stagingBuffer.
 */
 char *
 RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking) {
-    const char *endOfBuffer = storage + NanoLogConfig::STAGING_BUFFER_SIZE;
+    const char *endOfBuffer = storage + capacity;
 
 #ifdef RECORD_PRODUCER_STATS
     uint64_t start = PerfUtils::Cycles::rdtsc();
 #endif
 
+    // Only the thread's own StagingBuffer can be resized
+    uint32_t adaptiveLimit = nanoLogSingleton.adaptiveStagingBufferLimit;
+    bool adaptive = adaptiveLimit > 0 && blocking && this == stagingBuffer;
+    uint64_t adaptiveStart = 0;
+    bool blocked = false;
+
+    if (adaptive) {
+        adaptiveStart = PerfUtils::Cycles::rdtsc();
+        uint64_t quietCycles = PerfUtils::Cycles::fromNanoseconds(
+                        NanoLogConfig::ADAPTIVE_SHRINK_QUIET_MS*1000000UL);
+        if (capacity > baseCapacity &&
+                adaptiveStart - lastCycleBlocked > quietCycles) {
+            return nanoLogSingleton.resizeStagingBuffer(baseCapacity, nbytes);
+        }
+    }
+
+    // rdtsc() when the producer started waiting for the consumer, if it had to
+    uint64_t waitStart = 0;
+
     // There's a subtle point here, all the checks for remaining
     // space are strictly < or >, not <= or => because if we allow
     // the record and print positions to overlap, we can't tell
@@ -763,8 +3892,10 @@ RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking)
     // Doing this check here ensures that == means completely empty.
     while (minFreeSpace <= nbytes) {
         // Since consumerPos can be updated in a different thread, we
-        // save a consistent copy of it here to do calculations on
-        char *cachedConsumerPos = consumerPos;
+        // save a consistent copy of it here to do calculations on. The
+        // acquire ensures the consumer is done reading the space it freed.
+        char *cachedConsumerPos = __atomic_load_n(&consumerPos,
+                                                  __ATOMIC_ACQUIRE);
 
         if (cachedConsumerPos <= producerPos) {
             minFreeSpace = endOfBuffer - producerPos;
@@ -778,9 +3909,9 @@ RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking)
             // Prevent the roll over if it overlaps the two positions because
             // that would imply the buffer is completely empty when it's not.
             if (cachedConsumerPos != storage) {
-                // prevents producerPos from updating before endOfRecordedSpace
-                Fence::sfence();
-                producerPos = storage;
+                // The release prevents producerPos from updating before
+                // endOfRecordedSpace
+                __atomic_store_n(&producerPos, storage, __ATOMIC_RELEASE);
                 minFreeSpace = cachedConsumerPos - producerPos;
             }
         } else {
@@ -796,6 +3927,35 @@ RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking)
         // Needed to prevent infinite loops in tests
         if (!blocking && minFreeSpace <= nbytes)
             return nullptr;
+
+        if (waitStart == 0 && minFreeSpace <= nbytes)
+            waitStart = PerfUtils::Cycles::rdtsc();
+
+        if (adaptive && minFreeSpace <= nbytes) {
+            uint64_t now = PerfUtils::Cycles::rdtsc();
+            uint64_t growthCycles = PerfUtils::Cycles::fromNanoseconds(
+                        NanoLogConfig::ADAPTIVE_GROWTH_BLOCKED_US*1000UL);
+            uint32_t newCapacity = std::min(adaptiveLimit, 2*capacity);
+
+            blocked = true;
+            lastCycleBlocked = now;
+            if (cyclesBlockedInSegment + (now - adaptiveStart) > growthCycles
+                    && newCapacity > capacity) {
+                ++numTimesProducerBlocked;
+                cyclesWaitingForSpace += now - waitStart;
+                ++numWaitsForSpace;
+                return nanoLogSingleton.resizeStagingBuffer(newCapacity,
+                                                            nbytes);
+            }
+        }
+    }
+
+    if (blocked)
+        cyclesBlockedInSegment += PerfUtils::Cycles::rdtsc() - adaptiveStart;
+
+    if (waitStart != 0) {
+        cyclesWaitingForSpace += PerfUtils::Cycles::rdtsc() - waitStart;
+        ++numWaitsForSpace;
     }
 
 #ifdef RECORD_PRODUCER_STATS
@@ -811,6 +3971,131 @@ RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking)
     return producerPos;
 }
 
+/**
+* Slow path of reserveProducerSpace that reserves space for a log message,
+* dropping the message instead of blocking if its severity calls for it and
+* there's not enough space. After messages are dropped, a marker log message
+* with the number of messages dropped is inserted in front of the next log
+* message that makes it into the buffer, so that the gap shows up in the
+* decompressed log.
+*
+* \param nbytes
+*      Number of contiguous bytes to reserve.
+* \param severity
+*      LogLevel of the log message to reserve space for
+*
+* \return
+*      Pointer to at least nbytes of contiguous space, or nullptr if the log
+*      message was dropped.
+*/
+char *
+RuntimeLogger::StagingBuffer::reserveSpaceOrDrop(size_t nbytes,
+                                                 LogLevel severity) {
+    LogLevel dropLogLevel = (channel != nullptr) ? channel->dropLogLevel
+                                                 : nanoLogSingleton.dropLogLevel;
+    bool blocking = severity < dropLogLevel;
+    size_t markerBytes = (numPendingDrops > 0) ? DROP_MARKER_SIZE : 0;
+    uint32_t numDropped = numPendingDrops;
+
+    // A resize in the adaptive mode replaces the thread's stagingBuffer, so
+    // this buffer shall not be touched after a successful reservation.
+    bool isThreadLocal = (this == stagingBuffer);
+
+    // Wake up the compression threads if they ran out of work and blocked.
+    // The fence orders the check after the publication of the previous log
+    // messages (see CompressionWorker::waitForWork()).
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (nanoLogSingleton.numSleepingWorkers.load(
+                                            std::memory_order_relaxed) > 0)
+        nanoLogSingleton.wakeupWorkers();
+
+    char *ret = reserveSpaceInternal(nbytes + markerBytes, blocking);
+    if (ret == nullptr) {
+        ++numPendingDrops;
+        ++numDroppedMessages;
+        nanoLogSingleton.numDroppedLogMessages.fetch_add(1,
+                                                    std::memory_order_relaxed);
+
+        // Force the next reservation through the slow path so that the
+        // drop marker is written as soon as there's space.
+        minFreeSpace = 0;
+        return nullptr;
+    }
+
+    // Return to the slow path once a fraction of the buffer has been filled
+    // so that a blocked compression thread is woken up in a timely manner.
+    StagingBuffer *sb = isThreadLocal ? stagingBuffer : this;
+    sb->minFreeSpace = std::min<uint64_t>(sb->minFreeSpace,
+            nbytes + markerBytes +
+            sb->capacity / NanoLogConfig::WAKEUP_THRESHOLD_DIVISOR);
+
+    if (markerBytes == 0)
+        return ret;
+
+    sb->numPendingDrops = 0;
+
+    if (dropMarkerLogId < 0)
+        nanoLogSingleton.registerInvocationSite_internal(dropMarkerLogId,
+                                                         dropMarkerInfo);
+
+    auto *ue = new(ret) Log::UncompressedEntry();
+    ue->fmtId = dropMarkerLogId;
+    ue->timestamp = PerfUtils::Cycles::rdtsc();
+    ue->entrySize = downCast<uint32_t>(DROP_MARKER_SIZE);
+    std::memcpy(ue->argData, &numDropped, sizeof(uint32_t));
+
+    sb->finishReservation(DROP_MARKER_SIZE);
+    return ret + DROP_MARKER_SIZE;
+}
+
+/**
+* Allocates the zeroed storage for a StagingBuffer on the NUMA node of the
+* calling (producer) thread. The memory is freshly mapped and faulted in by the
+* caller so that it's placed by first-touch, and mbind() is used to keep it
+* local even if the process runs with a different memory policy (i.e.
+* numactl --interleave). The storage is backed by huge pages if they're
+* enabled (see setHugePages()).
+*
+* \param bytes
+*      Number of bytes to allocate
+* \param[out] mappedBytes
+*      Number of bytes mapped for the storage, to pass to freeStorage()
+* \return
+*      The storage; to be freed with freeStorage()
+*/
+char *
+RuntimeLogger::StagingBuffer::allocateStorage(size_t bytes,
+                                              size_t *mappedBytes) {
+    *mappedBytes = bytes;
+    char *mem = mapBuffer(mappedBytes);
+
+    // Best effort; if mbind() is unavailable, first-touch still applies
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 &&
+            node < 8*sizeof(unsigned long) - 1) {
+        unsigned long nodeMask = 1UL << node;
+        syscall(SYS_mbind, mem, *mappedBytes, MPOL_PREFERRED, &nodeMask,
+                8*sizeof(nodeMask), 0);
+    }
+
+    // Fault in the pages up front
+    std::memset(mem, 0, bytes);
+    return mem;
+}
+
+/**
+* Frees storage allocated by allocateStorage().
+*
+* \param storage
+*      Storage to free
+* \param bytes
+*      Number of bytes that were mapped (see allocateStorage())
+*/
+void
+RuntimeLogger::StagingBuffer::freeStorage(char *storage, size_t bytes) {
+    unmapBuffer(storage, bytes);
+}
+
 /**
 * Peek at the data available for consumption within the stagingBuffer.
 * The consumer should also invoke consume() to release space back
@@ -825,22 +4110,39 @@ RuntimeLogger::StagingBuffer::reserveSpaceInternal(size_t nbytes, bool blocking)
 */
 char *
 RuntimeLogger::StagingBuffer::peek(uint64_t *bytesAvailable) {
-    // Save a consistent copy of producerPos
-    char *cachedProducerPos = producerPos;
+    // Save a consistent copy of producerPos; the acquire prevents reading a
+    // new producerPos but old endOf...
+    char *cachedProducerPos = __atomic_load_n(&producerPos, __ATOMIC_ACQUIRE);
 
     if (cachedProducerPos < consumerPos) {
-        Fence::lfence(); // Prevent reading new producerPos but old endOf...
         *bytesAvailable = endOfRecordedSpace - consumerPos;
 
         if (*bytesAvailable > 0)
             return consumerPos;
 
         // Roll over
-        consumerPos = storage;
+        __atomic_store_n(&consumerPos, storage, __ATOMIC_RELEASE);
     }
 
     *bytesAvailable = cachedProducerPos - consumerPos;
     return consumerPos;
 }
 
+/**
+* Returns the number of bytes published by the producer that have not been
+* consumed yet, including those beyond a roll over that peek() doesn't
+* return yet. Like peek(), this may only be invoked by the consumer.
+*/
+uint64_t
+RuntimeLogger::StagingBuffer::getBytesQueued() {
+    // Save a consistent copy of producerPos; the acquire prevents reading a
+    // new producerPos but old endOf...
+    char *cachedProducerPos = __atomic_load_n(&producerPos, __ATOMIC_ACQUIRE);
+
+    if (cachedProducerPos >= consumerPos)
+        return cachedProducerPos - consumerPos;
+
+    return (endOfRecordedSpace - consumerPos) + (cachedProducerPos - storage);
+}
+
 }; // namespace NanoLog Internal
\ No newline at end of file
@@ -16,9 +16,14 @@
 #ifndef RUNTIME_NANOLOG_H
 #define RUNTIME_NANOLOG_H
 
-#include <aio.h>
+#include <pthread.h>
+#include <sched.h>
+
 #include <cassert>
+#include <ctime>
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <string>
@@ -27,14 +32,17 @@
 
 #include "Config.h"
 #include "Common.h"
-#include "Fence.h"
 #include "Log.h"
 #include "NanoLog.h"
+#include "SharedStagingBuffer.h"
 #include "Util.h"
 
 namespace NanoLogInternal {
 using namespace NanoLog;
 
+// Forward Declarations
+class OutputBackend;
+
 /**
  * RuntimeLogger provides runtime support to the C++ code generated by the
  * Preprocessor component.
@@ -49,19 +57,29 @@ using namespace NanoLog;
          * See function below.
          */
         inline void
-        registerInvocationSite_internal(int &logId, StaticLogInfo info) {
-            // TODO(syang0) Make this into a spin lock
-            std::lock_guard<std::mutex>
-                                    lock(nanoLogSingleton.registrationMutex);
-
-            if (logId != UNASSIGNED_LOGID)
+        registerInvocationSite_internal(int &logId, StaticLogInfo info,
+                                        uint8_t *siteState = nullptr) {
+            // Claim the right to register the invocation site. Threads that
+            // lose the race wait for the winner to publish the identifier.
+            int expected = UNASSIGNED_LOGID;
+            if (!__atomic_compare_exchange_n(&logId, &expected,
+                                             REGISTERING_LOGID, false,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE)) {
+                while (__atomic_load_n(&logId, __ATOMIC_ACQUIRE) < 0)
+                    std::this_thread::yield();
                 return;
+            }
 
-            logId = static_cast<int32_t>(invocationSites.size());
-            invocationSites.push_back(info);
+            int id = static_cast<int32_t>(invocationSites.append(info));
+            if (siteState != nullptr)
+                registerLogSiteState(id, siteState);
+            if (crashDictionary.load(std::memory_order_relaxed) != nullptr)
+                growCrashDictionary(id + 1);
+            __atomic_store_n(&logId, id, __ATOMIC_RELEASE);
 
 #ifdef ENABLE_DEBUG_PRINTING
-            printf("Registered '%s' as id=%d\r\n", info.formatString, logId);
+            printf("Registered '%s' as id=%d\r\n", info.formatString, id);
             printf("\tisParamString [%p] = ", info.isArgString);
             for (int i = 0; i < info.numParams; ++i)
                 printf("%d ", info.isArgString[i]);
@@ -77,13 +95,21 @@ using namespace NanoLog;
          *      Static log info to associate and persist
          *
          * \param[in/out] logId
-         *       Unique log identifier to be assigned. A value other than -1
+         *       Unique log identifier to be assigned. A non-negative value
          *       indicates that the id has already been assigned and this
-         *       function becomes a no-op.
+         *       function becomes a no-op. If another thread is concurrently
+         *       registering the same site, this function waits for it to
+         *       finish.
+         * \param siteState
+         *       Runtime enable flag of the invocation site (a LogSiteState),
+         *       which is initialized before logId is assigned and updated by
+         *       NanoLog::setLogSiteEnabled() and friends; may be nullptr.
          */
         static inline void
-        registerInvocationSite(StaticLogInfo info, int &logId) {
-            nanoLogSingleton.registerInvocationSite_internal(logId, info);
+        registerInvocationSite(StaticLogInfo info, int &logId,
+                               uint8_t *siteState = nullptr) {
+            nanoLogSingleton.registerInvocationSite_internal(logId, info,
+                                                             siteState);
         }
 
         /**
@@ -93,21 +119,31 @@ using namespace NanoLog;
          * to the compression thread and this function shall not be invoked
          * again until the corresponding finishAlloc() is invoked first.
          *
-         * Note this will block of the buffer is full.
+         * Note this will block of the buffer is full, unless the log message
+         * is at a level that should be dropped instead (see setDropOnFull()).
          *
          * \param nbytes
          *      number of bytes to allocate in the
+         * \param severity
+         *      LogLevel of the log message; the default is never dropped
+         * \param channel
+         *      Log channel to log the message to (see createChannel())
          *
          * \return
-         *      pointer to the allocated space
+         *      pointer to the allocated space, or nullptr if the log message
+         *      was dropped
          */
         static inline char *
-        reserveAlloc(size_t nbytes) {
-            if (stagingBuffer == nullptr)
-                nanoLogSingleton.ensureStagingBufferAllocated();
-
-            // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
-            return stagingBuffer->reserveProducerSpace(nbytes);
+        reserveAlloc(size_t nbytes, LogLevel severity = SILENT_LOG_LEVEL,
+                     uint32_t channel = NanoLog::DEFAULT_CHANNEL) {
+#ifdef RECORD_LOG_SITE_STATS
+            uint64_t start = PerfUtils::Cycles::rdtsc();
+            char *writePos = reserveAllocInternal(nbytes, severity, channel);
+            reserveAllocCycles = PerfUtils::Cycles::rdtsc() - start;
+            return writePos;
+#else
+            return reserveAllocInternal(nbytes, severity, channel);
+#endif
         }
 
         /**
@@ -116,15 +152,43 @@ using namespace NanoLog;
          *
          * \param nbytes
          *      Number of bytes to make visible
+         * \param channel
+         *      Log channel the bytes were reserveAlloc()-ed in
          */
         static inline void
-        finishAlloc(size_t nbytes) {
-            stagingBuffer->finishReservation(nbytes);
+        finishAlloc(size_t nbytes,
+                    uint32_t channel = NanoLog::DEFAULT_CHANNEL) {
+#ifdef RECORD_LOG_SITE_STATS
+            uint64_t start = PerfUtils::Cycles::rdtsc();
+            bool batched = (batch.depth > 0 &&
+                            channel == NanoLog::DEFAULT_CHANNEL);
+            StagingBuffer *sb = (channel == NanoLog::DEFAULT_CHANNEL)
+                                    ? stagingBuffer : channelBuffers[channel];
+            char *writePos = batched ? batch.pos : sb->producerPos;
+            uint32_t fmtId = reinterpret_cast<Log::UncompressedEntry*>(
+                                                            writePos)->fmtId;
+
+            finishAllocInternal(nbytes, channel);
+            sb->recordLogSite(fmtId, nbytes, reserveAllocCycles,
+                              PerfUtils::Cycles::rdtsc() - start);
+#else
+            finishAllocInternal(nbytes, channel);
+#endif
         }
 
+        static void beginBatch(size_t bytesHint);
+        static void endBatch();
+        static void publishBatch();
+
         static std::string getStats();
         static std::string getHistograms();
+        static void getMetrics(NanoLog::Metrics *metrics);
+        static uint32_t getThreadMetrics(NanoLog::ThreadMetrics *metrics,
+                                         uint32_t maxThreads);
+        static uint32_t getLogSiteMetrics(NanoLog::LogSiteMetrics *metrics,
+                                          uint32_t maxSites);
         static void preallocate();
+        static void preallocate(size_t bytes);
         static void setLogFile(const char *filename);
         static void setLogLevel(LogLevel logLevel);
         static void sync();
@@ -133,18 +197,217 @@ using namespace NanoLog;
             return nanoLogSingleton.currentLogLevel;
         }
 
+        static inline LogLevel getLogLevel(uint32_t channel) {
+            LogChannel *logChannel = (channel < NanoLogConfig::MAX_LOG_CHANNELS)
+                                ? nanoLogSingleton.channels[channel] : nullptr;
+            return (logChannel == nullptr) ? nanoLogSingleton.currentLogLevel
+                                           : logChannel->logLevel;
+        }
+
+        static uint32_t createChannel(const char *name, const char *filename);
+        static void setChannelDurability(uint32_t channel, DurabilityMode mode,
+                                         uint32_t syncIntervalMs,
+                                         uint64_t syncIntervalBytes);
+        static void setChannelLogLevel(uint32_t channel, LogLevel logLevel);
+        static void setChannelDropOnFull(uint32_t channel, LogLevel level);
+
         static inline int getCoreIdOfBackgroundThread() {
-            return nanoLogSingleton.coreId;
+            if (nanoLogSingleton.workers.empty())
+                return -1;
+            return nanoLogSingleton.workers.at(0)->coreId;
+        }
+
+        static void setCompressionThreads(uint32_t numThreads);
+        static void setNumOutputBuffers(uint32_t numBuffers);
+
+        static inline uint32_t getNumOutputBuffers() {
+            return nanoLogSingleton.numOutputBuffers;
+        }
+
+        static inline uint32_t getNumCompressionThreads() {
+            return downCast<uint32_t>(nanoLogSingleton.workers.size());
+        }
+
+        static void setOutputBackend(OutputBackendType type);
+        static const char *getOutputBackendName();
+        static void setDurability(DurabilityMode mode, uint32_t syncIntervalMs,
+                                  uint64_t syncIntervalBytes);
+        static const char *getDurabilityName();
+
+        static inline DurabilityMode getDurability() {
+            return nanoLogSingleton.durability;
+        }
+
+        static void setHugePages(HugePageMode mode);
+        static const char *getHugePagesName();
+
+        static inline HugePageMode getHugePages() {
+            return nanoLogSingleton.hugePages;
+        }
+
+        static inline uint32_t getSyncIntervalMs() {
+            return nanoLogSingleton.syncIntervalMs;
+        }
+
+        static inline uint64_t getSyncIntervalBytes() {
+            return nanoLogSingleton.syncIntervalBytes;
+        }
+
+        static void setDeltaEncoding(bool enable);
+
+        static inline bool getDeltaEncoding() {
+            return nanoLogSingleton.deltaEncoding;
+        }
+
+        static void setBlockCompression(bool enable);
+
+        static inline bool getBlockCompression() {
+            return nanoLogSingleton.blockCompression;
         }
+
+        static void setLogRotation(uint64_t maxBytes, uint32_t maxSeconds);
+
+        static inline uint64_t getLogRotationMaxBytes() {
+            return nanoLogSingleton.rotationMaxBytes.load();
+        }
+
+        static inline uint32_t getLogRotationMaxSeconds() {
+            return nanoLogSingleton.rotationMaxSeconds.load();
+        }
+
+        static void setSharedMemorySink(const char *name);
+
+        static inline const char *getSharedMemorySinkName() {
+            return nanoLogSingleton.sharedMemoryName.c_str();
+        }
+
+        static uint32_t setLogSiteEnabled(int logId, bool enabled);
+        static uint32_t setLogSitesEnabledInFile(const char *filename,
+                                                 bool enabled);
+        static uint32_t setLogSitesEnabledContaining(const char *substring,
+                                                     bool enabled);
+        static void resetLogSites();
+
+        static void setStagingBufferSize(size_t bytes);
+        static void setOutputBufferSize(size_t bytes);
+        static void setAdaptiveStagingBufferLimit(size_t maxBytes);
+        static void setDropOnFull(LogLevel level);
+        static void setFlightRecorder(bool enable);
+
+        static inline bool getFlightRecorder() {
+            return nanoLogSingleton.flightRecorder.load();
+        }
+
+        static void installCrashHandler(const char *filename);
+        static uint64_t crashFlush();
+
+        static inline const char *getCrashLogFile() {
+            return nanoLogSingleton.crashLogFile.c_str();
+        }
+
+        static void setBackgroundThreadAffinity(
+                                        const std::vector<int> &coreIds);
+        static void setBackgroundThreadScheduling(int policy, int priority);
+
+        static inline uint32_t getStagingBufferSize() {
+            return nanoLogSingleton.stagingBufferSize;
+        }
+
+        static inline uint32_t getOutputBufferSize() {
+            return nanoLogSingleton.outputBufferSize;
+        }
+
     PRIVATE:
 
         // Forward Declarations
         class StagingBuffer;
         class StagingBufferDestroyer;
+        class CompressionWorker;
 
         // Storage for staging uncompressed log statements for compression
         static __thread StagingBuffer *stagingBuffer;
 
+        // The thread's StagingBuffers of the log channels indexed by channel
+        // (see createChannel()); the default channel's is stagingBuffer.
+        static __thread StagingBuffer *
+                                channelBuffers[NanoLogConfig::MAX_LOG_CHANNELS];
+
+        /**
+         * Space reserved in the thread's StagingBuffer for the log messages
+         * of a NanoLog::Batch. The log messages are appended at pos and the
+         * reservation is published as a whole.
+         */
+        struct BatchReservation {
+            // Start, append position and end of the reservation; all
+            // nullptr if nothing is reserved
+            char *start;
+            char *pos;
+            char *end;
+
+            // Number of bytes to reserve at a time
+            size_t bytesHint;
+
+            // Number of nested NanoLog::Batch'es in scope; 0 outside of a
+            // batch
+            uint32_t depth;
+
+            // Number of log messages appended since the last publication
+            uint32_t numMessages;
+        };
+
+        // The current thread's NanoLog::Batch state
+        static __thread BatchReservation batch;
+
+        static char *reserveBatchSpace(size_t nbytes, LogLevel severity);
+
+        // Implementation of reserveAlloc() (see above)
+        static inline char *
+        reserveAllocInternal(size_t nbytes, LogLevel severity,
+                             uint32_t channel) {
+            // Batches only apply to the default channel
+            if (channel != NanoLog::DEFAULT_CHANNEL) {
+                assert(channel < NanoLogConfig::MAX_LOG_CHANNELS);
+                if (channelBuffers[channel] == nullptr)
+                    nanoLogSingleton.allocateChannelBuffer(channel);
+                return channelBuffers[channel]->reserveProducerSpace(nbytes,
+                                                                     severity);
+            }
+
+            if (batch.depth > 0) {
+                if (nbytes <= static_cast<size_t>(batch.end - batch.pos))
+                    return batch.pos;
+                return reserveBatchSpace(nbytes, severity);
+            }
+
+            if (stagingBuffer == nullptr)
+                nanoLogSingleton.ensureStagingBufferAllocated();
+
+            // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
+            return stagingBuffer->reserveProducerSpace(nbytes, severity);
+        }
+
+        // Implementation of finishAlloc() (see above)
+        static inline void
+        finishAllocInternal(size_t nbytes, uint32_t channel) {
+            if (channel != NanoLog::DEFAULT_CHANNEL) {
+                channelBuffers[channel]->finishReservation(nbytes);
+                return;
+            }
+
+            if (batch.depth > 0) {
+                batch.pos += nbytes;
+                ++batch.numMessages;
+                return;
+            }
+
+            stagingBuffer->finishReservation(nbytes);
+        }
+
+        // Cycles the current thread spent in its last reserveAlloc(), which
+        // finishAlloc() attributes to the log invocation site with
+        // -DRECORD_LOG_SITE_STATS
+        static __thread uint64_t reserveAllocCycles;
+
         // Destroys the __thread StagingBuffer upon its own destruction, which
         // is synchronized with thread death
         static thread_local StagingBufferDestroyer sbc;
@@ -157,11 +420,104 @@ using namespace NanoLog;
 
         ~RuntimeLogger();
 
-        void compressionThreadMain();
-
         void setLogFile_internal(const char *filename);
 
-        void waitForAIO();
+        void setCompressionThreads_internal(uint32_t numThreads);
+
+        void setNumOutputBuffers_internal(uint32_t numBuffers);
+
+        void setOutputBackend_internal(OutputBackendType type);
+
+        void setHugePages_internal(HugePageMode mode);
+
+        void setDurability_internal(DurabilityMode mode,
+                                    uint32_t syncIntervalMs,
+                                    uint64_t syncIntervalBytes);
+
+        void setDeltaEncoding_internal(bool enable);
+
+        void setBlockCompression_internal(bool enable);
+
+        void setOutputBufferSize_internal(size_t bytes);
+
+        void setSharedMemorySink_internal(const char *name);
+
+        void installCrashHandler_internal(const char *filename);
+
+        uint64_t crashFlush_internal();
+
+        static void crashSignalHandler(int signo);
+
+        void growCrashDictionary(uint32_t numEntries);
+
+        uint64_t dumpStagingBuffer(Log::Encoder &encoder, StagingBuffer *sb,
+                            const std::vector<StaticLogInfo> &dictionary);
+
+        uint64_t dumpLogMsgs(Log::Encoder &encoder, uint32_t bufferId,
+                             char *from, uint64_t nbytes,
+                             const std::vector<StaticLogInfo> &dictionary);
+
+        void writeCrashLog(Log::Encoder &encoder);
+
+        struct LogSiteRule;
+
+        void registerLogSiteState(int logId, uint8_t *siteState);
+
+        uint32_t addLogSiteRule_internal(const LogSiteRule &rule);
+
+        void resetLogSites_internal();
+
+        static bool matchesLogSiteRule(const LogSiteRule &rule, int logId,
+                                       const StaticLogInfo &info);
+
+        uint32_t clampStagingBufferSize(size_t bytes);
+
+        void restartWorkers(const std::vector<int> &outputFds);
+
+        static std::string getOutputFileName(const std::string &baseName,
+                                             uint32_t workerId);
+
+        static std::string getRotatedFileName(const std::string &fileName,
+                                              time_t rotationTime);
+
+        static int openOutputFile(const std::string &filename,
+                                  DurabilityMode durability);
+
+        static std::vector<int> openOutputFiles(const std::string &baseName,
+                                                uint32_t numFiles,
+                                                DurabilityMode durability);
+
+        static char *mapBuffer(size_t *bytes);
+
+        static void unmapBuffer(char *buffer, size_t bytes);
+
+        void createWorkers(const std::vector<int> &outputFds);
+
+        void destroyWorkers();
+
+        void assignStagingBuffer(StagingBuffer *sb);
+
+        void wakeupWorkers();
+
+        void allocateStagingBuffer(uint32_t capacity);
+
+        void allocateChannelBuffer(uint32_t channel);
+
+        struct LogChannel;
+
+        LogChannel *getChannel(uint32_t channel);
+
+        void restartChannelWorker(LogChannel *channel, int outputFd);
+
+        void destroyChannels();
+
+        std::vector<CompressionWorker*> getAllWorkers();
+
+        StagingBuffer *createSharedStagingBuffer(uint32_t bufferId,
+                                                 uint32_t capacity,
+                                                 StagingBuffer *oldBuffer);
+
+        char *resizeStagingBuffer(uint32_t capacity, size_t nbytes);
 
         /**
          * Allocates thread-local structures if they weren't already allocated.
@@ -171,138 +527,377 @@ using namespace NanoLog;
          */
         inline void
         ensureStagingBufferAllocated() {
-            if (stagingBuffer == nullptr) {
-                std::unique_lock<std::mutex> guard(bufferMutex);
-                uint32_t bufferId = nextBufferId++;
-
-                // Unlocked for the expensive StagingBuffer allocation
-                guard.unlock();
-                stagingBuffer = new StagingBuffer(bufferId);
-                guard.lock();
-
-                threadBuffers.push_back(stagingBuffer);
-            }
+            if (stagingBuffer == nullptr)
+                allocateStagingBuffer(stagingBufferSize);
         }
 
-        // Globally the thread-local stagingBuffers
-        std::vector<StagingBuffer *> threadBuffers;
+        // Background workers that compress and output the log messages. Each
+        // worker owns a disjoint subset of the thread-local StagingBuffers and
+        // outputs to its own file. There is always at least one worker,
+        // unless the StagingBuffers are consumed by an external process
+        // (see setSharedMemorySink()).
+        std::vector<CompressionWorker*> workers;
 
         // Stores the id for the next StagingBuffer to be allocated. The ids are
         // unique for this execution for each StagingBuffer allocation.
         uint32_t nextBufferId = 1;
 
-        // Protects reads and writes to threadBuffers
+        // StagingBuffers that are not assigned to a worker. This is only
+        // non-empty while the workers are being reconfigured.
+        std::vector<StagingBuffer *> orphanedBuffers;
+
+        // Protects reads and writes to workers, orphanedBuffers,
+        // nextBufferId and sharedBufferRegions
         std::mutex bufferMutex;
 
-        // Background thread that polls the various staging buffers, compresses
-        // the staged log messages, and outputs it to a file.
-        std::thread compressionThread;
+        // POSIX shared memory name of the registry the StagingBuffers are
+        // published to for an external consumer, and its mapping (see
+        // SharedStagingBuffer.h). Empty and nullptr when the StagingBuffers
+        // are consumed by the workers.
+        std::string sharedMemoryName;
+        SharedStagingBuffer::Registry *sharedMemoryRegistry;
+
+        /**
+         * A StagingBuffer allocated in a shared memory buffer region
+         */
+        struct SharedBufferRegion {
+            // StagingBuffer constructed within the region
+            StagingBuffer *sb;
+
+            // Index of the region in the registry
+            uint32_t index;
+
+            // Mapping of the region and its size
+            char *region;
+            size_t size;
+        };
+
+        // Buffer regions that are still mapped in this process. They're
+        // unmapped once their StagingBuffer is abandoned and drained.
+        std::vector<SharedBufferRegion> sharedBufferRegions;
+
+        // Name of the log file that the first worker outputs to. Additional
+        // workers output to files with the worker id appended to this name.
+        std::string logFile;
+
+        // Minimum log level that RuntimeLogger will accept. Anything lower will
+        // be dropped.
+        LogLevel currentLogLevel;
+
+        // Type of OutputBackend the workers use to output the compressed log
+        OutputBackendType outputBackendType;
+
+        // Determines when the workers make their output durable on disk
+        DurabilityMode durability;
+
+        // For DURABILITY_PERIODIC, the workers flush their output files once
+        // this much time has passed or this many bytes have been written
+        // since the last flush; 0 disables the respective limit.
+        uint32_t syncIntervalMs;
+        uint64_t syncIntervalBytes;
+
+        // Indicates that the workers delta encode the arguments of log
+        // messages against the previous message from the same log site
+        bool deltaEncoding;
+
+        // Indicates that the workers compress their output buffers as a
+        // whole before writing them out (see Log::CompressedBlock)
+        bool blockCompression;
+
+        // Page size backing the StagingBuffers and output buffers allocated
+        // from now on (see mapBuffer())
+        HugePageMode hugePages;
+
+        // The workers rotate their output files once they reach
+        // rotationMaxBytes or have been output to for rotationMaxSeconds;
+        // 0 disables the respective policy. Unlike the other settings, the
+        // workers read these as they run, so they can change at any time.
+        std::atomic<uint64_t> rotationMaxBytes;
+        std::atomic<uint32_t> rotationMaxSeconds;
+
+        // Number of output buffers in each worker's output buffer ring
+        uint32_t numOutputBuffers;
+
+        // Size of each output buffer in the workers' output buffer rings
+        uint32_t outputBufferSize;
+
+        // Size of the StagingBuffers allocated for threads that have not
+        // specified their own size via preallocate(size_t)
+        uint32_t stagingBufferSize;
+
+        // Maximum size a StagingBuffer may grow to when its producer is
+        // blocked for too long; 0 disables the adaptive growth.
+        uint32_t adaptiveStagingBufferLimit;
+
+        // Log messages at this LogLevel or lower severity (i.e. numerically
+        // greater) are dropped rather than blocking when the StagingBuffer is
+        // full. NUM_LOG_LEVELS means that nothing is dropped.
+        LogLevel dropLogLevel;
+
+        // Total number of log messages dropped across all StagingBuffers
+        std::atomic<uint64_t> numDroppedLogMessages;
+
+        // Indicates that the workers retain the most recent log messages in
+        // the StagingBuffers instead of outputting them until a sync() (see
+        // setFlightRecorder()). The workers read it as they run.
+        std::atomic<bool> flightRecorder;
+
+        // File the crash handler dumps the unconsumed log messages to (see
+        // installCrashHandler()), or empty if it's not installed, and the
+        // descriptor it's kept open under (-1 if none)
+        std::string crashLogFile;
+        int crashFd;
+
+        // Output buffer for crashFlush(), allocated up front since memory
+        // can't be allocated in a signal handler
+        char *crashBuffer;
+        uint32_t crashBufferSize;
+
+        // Copy of invocationSites for the Encoder in crashFlush(), reserved
+        // ahead of the registrations (see growCrashDictionary()) so that
+        // filling it doesn't allocate. Replaced vectors are leaked since a
+        // crashFlush() may still be reading them. Growth is serialized by
+        // crashDictionaryMutex.
+        std::atomic<std::vector<StaticLogInfo> *> crashDictionary;
+        std::mutex crashDictionaryMutex;
+
+        // Indicates that a thread is in crashFlush(); other threads that
+        // crash meanwhile wait for it rather than dump concurrently
+        std::atomic<bool> crashFlushInProgress;
+
+        // Cores the background compression threads are pinned to; worker i
+        // runs on backgroundThreadCores[i % size()]. Empty means unpinned.
+        // Protected by bufferMutex.
+        std::vector<int> backgroundThreadCores;
+
+        // CPU affinity of the process at startup; restored when unpinned
+        cpu_set_t defaultAffinity;
+
+        // Scheduling policy and priority for the background compression
+        // threads; a policy of -1 means the threads inherit the policy of the
+        // thread that created them. Protected by bufferMutex.
+        int backgroundThreadPolicy;
+        int backgroundThreadPriority;
+
+        // Futex word that idle CompressionWorkers block on; it's incremented
+        // by wakeupWorkers() so that a worker can detect wakeups that occur
+        // between sampling it and blocking.
+        std::atomic<uint32_t> wakeupSeq;
+
+        // Number of CompressionWorkers blocked (or about to block) on
+        // wakeupSeq. Producers only issue the wakeup system call if non-zero.
+        std::atomic<uint32_t> numSleepingWorkers;
 
-        // Indicates there's an operation in aioCb that should be waited on
-        bool hasOutstandingOperation;
+        /**
+         * Append-only array of StaticLogInfo that allows the logging threads
+         * to register new invocation sites without taking a lock and the
+         * compression thread to read the registered entries without copying
+         * or locking. Entries are stored in fixed-size chunks that are never
+         * moved once allocated, so references to them remain valid for the
+         * lifetime of the table.
+         *
+         * Entries become visible to readers strictly in index order; size()
+         * only counts entries that have been fully constructed.
+         */
+        class InvocationSiteTable {
+        public:
+            InvocationSiteTable()
+                : numReserved(0)
+                , numPublished(0)
+                , chunks()
+            {
+                for (size_t i = 0; i < MAX_CHUNKS; ++i)
+                    chunks[i].store(nullptr, std::memory_order_relaxed);
+            }
 
-        // Flag signaling the compressionThread to stop running. This is
-        // typically only set in testing or when the application is exiting.
-        bool compressionThreadShouldExit;
+            ~InvocationSiteTable() {
+                for (size_t i = 0; i < MAX_CHUNKS; ++i)
+                    free(chunks[i].load(std::memory_order_relaxed));
+            }
 
-        // Marks the progress of flushing all log messages to disk after a user
-        // invokes the sync() API. To complete the operation, the background
-        // thread has to make two passes through the staging buffers and wait
-        // on the AIO to complete before waking up the user thread.
-        enum {
-            SYNC_REQUESTED,         // User invoked a sync() operation
-            PERFORMING_SECOND_PASS, // Background thread is making a second pass
-            WAITING_ON_AIO,         // Background thread is waiting on AIO
-            SYNC_COMPLETED          // Operation complete/no requests
-        } syncStatus;
+            /**
+             * Stores a copy of the static log information in the table and
+             * makes it visible to readers.
+             *
+             * \param info
+             *      Static log information to store
+             *
+             * \return
+             *      Index assigned to the entry
+             */
+            uint32_t
+            append(const StaticLogInfo &info) {
+                uint32_t index = numReserved.fetch_add(1,
+                                                    std::memory_order_relaxed);
+                uint32_t chunkIndex = index / ENTRIES_PER_CHUNK;
+                if (chunkIndex >= MAX_CHUNKS) {
+                    fprintf(stderr, "NanoLog Error: Exceeded the maximum "
+                                    "number of log invocation sites (%u)\r\n",
+                                    MAX_CHUNKS*ENTRIES_PER_CHUNK);
+                    std::exit(-1);
+                }
 
-        // Protects the condition variables below
-        std::mutex condMutex;
+                StaticLogInfo *chunk = chunks[chunkIndex].load(
+                                                    std::memory_order_acquire);
+                if (chunk == nullptr) {
+                    auto *newChunk = static_cast<StaticLogInfo*>(
+                            malloc(ENTRIES_PER_CHUNK*sizeof(StaticLogInfo)));
+                    if (newChunk == nullptr) {
+                        perror("NanoLog could not allocate space for the "
+                               "invocation site dictionary");
+                        std::exit(-1);
+                    }
+
+                    if (chunks[chunkIndex].compare_exchange_strong(chunk,
+                                        newChunk, std::memory_order_acq_rel))
+                        chunk = newChunk;
+                    else
+                        free(newChunk);
+                }
 
-        // Signal for when the compression thread should wakeup
-        std::condition_variable workAdded;
+                new (&chunk[index % ENTRIES_PER_CHUNK]) StaticLogInfo(info);
 
-        // Signaled when the background thread completes a sync() operation and
-        // the user thread should wake up.
-        std::condition_variable hintSyncCompleted;
+                // Publish in order so that readers never see holes
+                uint32_t expected = index;
+                while (!numPublished.compare_exchange_weak(expected, index + 1,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed))
+                {
+                    expected = index;
+                    std::this_thread::yield();
+                }
 
-        // File handle for the output file; should only be opened once at the
-        // construction of the LogCompressor
-        int outputFd;
+                return index;
+            }
 
-        // POSIX AIO structure used to communicate async IO requests
-        struct aiocb aioCb;
+            /**
+             * Returns the number of entries that are safe to read
+             */
+            inline uint32_t
+            size() const {
+                return numPublished.load(std::memory_order_acquire);
+            }
 
-        // Used to stage the compressed log messages before passing it on to the
-        // POSIX AIO library.
+            /**
+             * Returns the entry at a particular index; the index must be less
+             * than a value previously returned by size().
+             */
+            inline const StaticLogInfo&
+            operator[](uint32_t index) const {
+                return chunks[index / ENTRIES_PER_CHUNK].load(
+                            std::memory_order_relaxed)[index%ENTRIES_PER_CHUNK];
+            }
 
-        // Dynamically allocated buffer to stage compressed log message before
-        // handing it over to the POSIX AIO library for output.
-        char *compressingBuffer;
+        PRIVATE:
+            // Number of StaticLogInfo's allocated together in one chunk
+            static constexpr uint32_t ENTRIES_PER_CHUNK = 1024;
 
-        // Dynamically allocated double buffer that is swapped with the
-        // compressingBuffer when the latter is passed to the POSIX AIO library.
-        char *outputDoubleBuffer;
+            // Maximum number of chunks, which bounds the number of invocation
+            // sites that can be registered to 4 million.
+            static constexpr uint32_t MAX_CHUNKS = 4096;
 
-        // Minimum log level that RuntimeLogger will accept. Anything lower will
-        // be dropped.
-        LogLevel currentLogLevel;
+            // Number of indices handed out to registering threads
+            std::atomic<uint32_t> numReserved;
 
-        // Marks the rdtsc() when the current compression thread first started
-        // running. A value of 0 indicates the compression thread is not running
-        uint64_t cycleAtThreadStart;
+            // Number of entries that have been stored and are safe to read
+            std::atomic<uint32_t> numPublished;
 
-        // Marks the rdtsc() when the last I/O operation started
-        uint64_t cyclesAtLastAIOStart;
+            // Lazily allocated storage for the entries
+            std::atomic<StaticLogInfo*> chunks[MAX_CHUNKS];
 
-        // Metric: Number of cycles compression thread is doing work
-        uint64_t cyclesActive;
+            DISALLOW_COPY_AND_ASSIGN(InvocationSiteTable);
+        };
 
-        // Metric: Amount of time spent compressing the dynamic log data
-        uint64_t cyclesCompressing;
+        // Maps unique identifiers to log invocation sites encountered thus far
+        // by the non-preprocessor version of NanoLog
+        InvocationSiteTable invocationSites;
 
-        // Metric: Stores the distribution of StagingBuffer peek sizes in 5%
-        // increments relative to the full size. This distribution should show
-        // how well the background thread keeps up with the logging threads.
-        uint64_t stagingBufferPeekDist[20];
+        /**
+         * Explicitly enables or disables the log invocation sites that match
+         * it (see NanoLog::setLogSiteEnabled() and friends).
+         */
+        struct LogSiteRule {
+            // What the rule matches the invocation sites by
+            enum Type { BY_ID, BY_FILE, BY_SUBSTRING } type;
 
-        // Metric: Amount of time spent scanning the buffers for work and
-        // compressing events found.
-        uint64_t cyclesScanningAndCompressing;
+            // For BY_ID, the log identifier of the site
+            int logId;
 
-        // Metric: Upper bound on the amount of time spent on fsync() and disk
-        // writes. It is an upper bound since the code polls for the async IO
-        uint64_t cyclesDiskIO_upperBound;
+            // For BY_FILE, the file name (suffix) and for BY_SUBSTRING, the
+            // substring of the format string
+            std::string pattern;
 
-        // Metric: Number of bytes read in from the staging buffers
-        uint64_t totalBytesRead;
+            // Whether the matching sites are enabled or disabled
+            bool enabled;
+        };
 
-        // Metric: Number of bytes written to the output file (includes padding)
-        uint64_t totalBytesWritten;
+        // Rules set at runtime in the order they were set; later rules take
+        // precedence. Protected by logSiteMutex.
+        std::vector<LogSiteRule> logSiteRules;
 
-        // Metric: Number of pad bytes written to round the file to the nearest
-        // 512B
-        uint64_t padBytesWritten;
+        // Runtime enable flags (LogSiteStates) of the registered invocation
+        // sites indexed by log identifier; nullptr for the internal sites
+        // that can't be disabled. Protected by logSiteMutex.
+        std::vector<uint8_t*> logSiteStates;
 
-        // Metric: Number of log statements compressed and outputted.
-        uint64_t logsProcessed;
+        // Protects the log site rules and states
+        std::mutex logSiteMutex;
 
-        // Metric: Number of times an AIO write was completed.
-        uint32_t numAioWritesCompleted;
+        /**
+         * A log with its own output file, durability, log level and drop
+         * policy that log messages are routed to with NANO_LOG_TO() (see
+         * createChannel()). The settings not kept here are the
+         * RuntimeLogger's.
+         */
+        struct LogChannel {
+            // Name given to createChannel()
+            std::string name;
 
-        // Stores the last coreId that the background thread ran in.
-        int coreId;
+            // File the channel's compressed log is output to
+            std::string logFile;
 
-        // Used to control access to invocationSites
-        std::mutex registrationMutex;
+            // When the channel's log is made durable (see setDurability())
+            DurabilityMode durability;
+            uint32_t syncIntervalMs;
+            uint64_t syncIntervalBytes;
 
-        // Maps unique identifiers to log invocation sites encountered thus far
-        // by the non-preprocessor version of NanoLog
-        std::vector<StaticLogInfo> invocationSites;
+            // Minimum severity of the log messages logged to the channel
+            LogLevel logLevel;
+
+            // Log messages at this LogLevel or lower severity are dropped
+            // rather than blocking when the thread's StagingBuffer of the
+            // channel is full (see setDropOnFull())
+            LogLevel dropLogLevel;
+
+            // Compresses and outputs the StagingBuffers of the channel
+            CompressionWorker *worker;
+        };
+
+        // The log channels created by createChannel() indexed by channel;
+        // nullptr for the default channel and the free slots. Modified
+        // while holding the bufferMutex.
+        LogChannel *channels[NanoLogConfig::MAX_LOG_CHANNELS];
+
+        /**
+         * Producer-side costs of a log invocation site in a StagingBuffer,
+         * recorded by finishAlloc() with -DRECORD_LOG_SITE_STATS (see
+         * NanoLog::getLogSiteMetrics()).
+         */
+        struct LogSiteStats {
+            // Number of log messages staged
+            uint64_t invocations;
+
+            // Bytes the log messages occupied in the StagingBuffer
+            uint64_t bytesStaged;
 
-        // Indicates the index of the next invocationSite that needs to be
-        // persisted to disk.
-        uint32_t nextInvocationIndexToBePersisted;
+            // Cycles spent in reserveAlloc() (including the time blocked on
+            // a full StagingBuffer) and finishAlloc()
+            uint64_t reserveCycles;
+            uint64_t finishCycles;
+        };
+
+        static void addLogSiteStats(std::vector<LogSiteStats> &totals,
+                                    const LogSiteStats *stats);
 
         /**
          * Implements a circular FIFO producer/consumer byte queue that is used
@@ -326,12 +921,17 @@ using namespace NanoLog;
              *
              * \param nbytes
              *      Number of bytes to allocate
+             * \param severity
+             *      LogLevel of the log message to be stored; determines
+             *      whether to drop it rather than block (see setDropOnFull())
              *
              * \return
-             *      Pointer to at least nbytes of contiguous space
+             *      Pointer to at least nbytes of contiguous space, or nullptr
+             *      if the log message should be dropped
              */
             inline char *
-            reserveProducerSpace(size_t nbytes) {
+            reserveProducerSpace(size_t nbytes,
+                                 LogLevel severity = SILENT_LOG_LEVEL) {
                 ++numAllocations;
 
                 // Fast in-line path
@@ -339,7 +939,7 @@ using namespace NanoLog;
                     return producerPos;
 
                 // Slow allocation
-                return reserveSpaceInternal(nbytes);
+                return reserveSpaceOrDrop(nbytes, severity);
             }
 
             /**
@@ -352,15 +952,45 @@ using namespace NanoLog;
             inline void
             finishReservation(size_t nbytes) {
                 assert(nbytes < minFreeSpace);
-                assert(producerPos + nbytes <
-                       storage + NanoLogConfig::STAGING_BUFFER_SIZE);
+                assert(producerPos + nbytes < storage + capacity);
 
-                Fence::sfence(); // Ensures producer finishes writes before bump
+                // The release ensures the producer's writes are visible before
+                // the bump
                 minFreeSpace -= nbytes;
-                producerPos += nbytes;
+                __atomic_store_n(&producerPos, producerPos + nbytes,
+                                 __ATOMIC_RELEASE);
+            }
+
+            /**
+             * Attributes the costs of staging a log message to its log
+             * invocation site. Log identifiers past the ones tracked
+             * individually are counted together in the last LogSiteStats.
+             *
+             * \param fmtId
+             *      Log identifier of the log message
+             * \param nbytes
+             *      Bytes the log message occupies in the StagingBuffer
+             * \param reserveCycles
+             *      Cycles spent in reserveAlloc() for the log message
+             * \param finishCycles
+             *      Cycles spent in finishAlloc() for the log message
+             */
+            inline void
+            recordLogSite(uint32_t fmtId, size_t nbytes,
+                          uint64_t reserveCycles, uint64_t finishCycles) {
+                if (logSiteStats == nullptr)
+                    return;
+
+                LogSiteStats &stats = logSiteStats[std::min(fmtId,
+                                        NanoLogConfig::MAX_LOG_SITE_STATS)];
+                ++stats.invocations;
+                stats.bytesStaged += nbytes;
+                stats.reserveCycles += reserveCycles;
+                stats.finishCycles += finishCycles;
             }
 
             char *peek(uint64_t *bytesAvailable);
+            uint64_t getBytesQueued();
 
             /**
              * Consumes the next nbytes in the StagingBuffer and frees it back
@@ -372,8 +1002,10 @@ using namespace NanoLog;
              */
             inline void
             consume(uint64_t nbytes) {
-                Fence::lfence(); // Make sure consumer reads finish before bump
-                consumerPos += nbytes;
+                // The release ensures the consumer's reads finish before the
+                // bump
+                __atomic_store_n(&consumerPos, consumerPos + nbytes,
+                                 __ATOMIC_RELEASE);
             }
 
             /**
@@ -385,7 +1017,9 @@ using namespace NanoLog;
              */
             bool
             checkCanDelete() {
-                return shouldDeallocate && consumerPos == producerPos;
+                return __atomic_load_n(&shouldDeallocate, __ATOMIC_ACQUIRE) &&
+                       __atomic_load_n(&consumerPos, __ATOMIC_ACQUIRE) ==
+                       __atomic_load_n(&producerPos, __ATOMIC_ACQUIRE);
             }
 
 
@@ -393,21 +1027,48 @@ using namespace NanoLog;
                 return id;
             }
 
-            StagingBuffer(uint32_t bufferId)
-                    : producerPos(storage)
-                    , endOfRecordedSpace(storage
-                                           + NanoLogConfig::STAGING_BUFFER_SIZE)
-                    , minFreeSpace(NanoLogConfig::STAGING_BUFFER_SIZE)
+            /**
+             * Returns the number of bytes in the circular queue
+             */
+            uint32_t getCapacity() {
+                return capacity;
+            }
+
+            StagingBuffer(uint32_t bufferId,
+                          uint32_t capacity=NanoLogConfig::STAGING_BUFFER_SIZE,
+                          char *sharedStorage=nullptr)
+                    : producerPos(nullptr)
+                    , endOfRecordedSpace(nullptr)
+                    , minFreeSpace(capacity)
+                    , numAllocations(0)
                     , cyclesProducerBlocked(0)
                     , numTimesProducerBlocked(0)
-                    , numAllocations(0)
+                    , numPendingDrops(0)
+                    , numDroppedMessages(0)
+                    , numWaitsForSpace(0)
+                    , cyclesWaitingForSpace(0)
+                    , baseCapacity(capacity)
+                    , channel(nullptr)
+                    , cyclesBlockedInSegment(0)
+                    , lastCycleBlocked(PerfUtils::Cycles::rdtsc())
                     , cyclesProducerBlockedDist()
                     , cyclesIn10Ns(PerfUtils::Cycles::fromNanoseconds(10))
-                    , cacheLineSpacer()
-                    , consumerPos(storage)
+                    , logSiteStats(nullptr)
+                    , consumerPos(nullptr)
                     , shouldDeallocate(false)
+                    , next(nullptr)
+                    , nextNewBuffer(nullptr)
                     , id(bufferId)
-                    , storage() {
+                    , capacity(capacity)
+                    , storage(nullptr)
+                    , storageBytes(0) {
+                // StagingBuffers in shared memory are never deleted; their
+                // regions are unmapped as a whole instead
+                storage = (sharedStorage != nullptr) ? sharedStorage
+                                    : allocateStorage(capacity, &storageBytes);
+                producerPos = consumerPos = storage;
+                endOfRecordedSpace = storage + capacity;
+
                 // Empty function, but causes the C++ runtime to instantiate the
                 // sbc thread_local (see documentation in function).
                 sbc.stagingBufferCreated();
@@ -417,26 +1078,48 @@ using namespace NanoLog;
                 {
                     cyclesProducerBlockedDist[i] = 0;
                 }
+
+#ifdef RECORD_LOG_SITE_STATS
+                logSiteStats = new LogSiteStats[
+                                    NanoLogConfig::MAX_LOG_SITE_STATS + 1]();
+#endif
             }
 
             ~StagingBuffer() {
+                delete[] logSiteStats;
+                freeStorage(storage, storageBytes);
             }
 
         PRIVATE:
 
             char *reserveSpaceInternal(size_t nbytes, bool blocking = true);
 
-            // Position within storage[] where the producer may place new data
-            char *producerPos;
+            char *reserveSpaceOrDrop(size_t nbytes, LogLevel severity);
+            static char *allocateStorage(size_t bytes, size_t *mappedBytes);
+            static void freeStorage(char *storage, size_t bytes);
+
+            // The variables are grouped by the thread that updates them into
+            // separate cache lines: the producer's (first), the consumer's and
+            // the ones that rarely change (last). The fast path of the
+            // producer only touches the first cache line.
+
+            // Position within storage[] where the producer may place new data.
+            // Published to the consumer with a release store.
+            alignas(Util::BYTES_PER_CACHE_LINE) char *producerPos;
 
             // Marks the end of valid data for the consumer. Set by the producer
             // on a roll-over
             char *endOfRecordedSpace;
 
             // Lower bound on the number of bytes the producer can allocate w/o
-            // rolling over the producerPos or stalling behind the consumer
+            // rolling over the producerPos or stalling behind the consumer.
+            // This serves as the producer's cached copy of the consumerPos,
+            // which is only read again once this runs out.
             uint64_t minFreeSpace;
 
+            // Number of alloc()'s performed
+            Util::RelaxedCounter<uint64_t> numAllocations;
+
             // Number of cycles producer was blocked while waiting for space to
             // free up in the StagingBuffer for an allocation.
             uint64_t cyclesProducerBlocked;
@@ -445,8 +1128,36 @@ using namespace NanoLog;
             // to free up in the StagingBuffer for an allocation
             uint32_t numTimesProducerBlocked;
 
-            // Number of alloc()'s performed
-            uint64_t numAllocations;
+            // Number of log messages dropped since the last drop marker was
+            // written to the buffer
+            uint32_t numPendingDrops;
+
+            // Total number of log messages dropped in this buffer
+            Util::RelaxedCounter<uint64_t> numDroppedMessages;
+
+            // Number of times the producer actually had to wait for the
+            // consumer to free up space, and the cycles spent waiting. Unlike
+            // the RECORD_PRODUCER_STATS metrics above, these are always kept
+            // since they're only updated once the producer is stalled anyway.
+            Util::RelaxedCounter<uint64_t> numWaitsForSpace;
+            Util::RelaxedCounter<uint64_t> cyclesWaitingForSpace;
+
+            // Size the owning thread's StagingBuffer returns to when it has
+            // been grown by the adaptive mode and the producer goes quiet
+            uint32_t baseCapacity;
+
+            // Log channel the StagingBuffer stages the log messages of, or
+            // nullptr for the default channel (see createChannel())
+            LogChannel *channel;
+
+            // Number of cycles the producer was blocked in this buffer; used
+            // to decide when to grow it in the adaptive mode
+            uint64_t cyclesBlockedInSegment;
+
+            // rdtsc() of the last time the producer was blocked (or the
+            // buffer's creation); used to decide when to shrink it in the
+            // adaptive mode
+            uint64_t lastCycleBlocked;
 
             // Distribution of the number of times Producer was blocked
             // allocating space in 10ns increments. The last slot includes
@@ -458,34 +1169,353 @@ using namespace NanoLog;
             // cyclesProducerBlockedDist distribution.
             uint64_t cyclesIn10Ns;
 
-            // An extra cache-line to separate the variables that are primarily
-            // updated/read by the producer (above) from the ones by the
-            // consumer(below)
-            char cacheLineSpacer[2*Util::BYTES_PER_CACHE_LINE];
+            // Costs of the log invocation sites indexed by log identifier,
+            // with the ones past NanoLogConfig::MAX_LOG_SITE_STATS counted in
+            // the last entry; nullptr unless compiled with
+            // -DRECORD_LOG_SITE_STATS.
+            LogSiteStats *logSiteStats;
 
             // Position within the storage buffer where the consumer will consume
-            // the next bytes from. This value is only updated by the consumer.
-            char* volatile consumerPos;
+            // the next bytes from. This value is only updated by the consumer
+            // and published to the producer with a release store.
+            alignas(Util::BYTES_PER_CACHE_LINE) char *consumerPos;
 
             // Indicates that the thread owning this StagingBuffer has been
             // destructed (i.e. no more messages will be logged to it) and thus
             // should be cleaned up once the buffer has been emptied by the
             // compression thread.
-            bool shouldDeallocate;
+            alignas(Util::BYTES_PER_CACHE_LINE) bool shouldDeallocate;
+
+            // StagingBuffer that replaced this one for the owning thread (i.e.
+            // a resize via preallocate(size_t)), or nullptr if none. Once
+            // this buffer is emptied, the compression thread swaps in the next
+            // buffer in its place so that the thread's log messages are still
+            // compressed in order. Set by the producer before shouldDeallocate.
+            StagingBuffer *next;
+
+            // Links the StagingBuffers registered with a CompressionWorker
+            // that it has not adopted into its threadBuffers yet (see
+            // CompressionWorker::newThreadBuffers).
+            StagingBuffer *nextNewBuffer;
 
             // Uniquely identifies this StagingBuffer for this execution. It's
             // similar to ThreadId, but is only assigned to threads that NANO_LOG).
+            // Buffers chained via next share the same id.
             uint32_t id;
 
+            // Number of bytes in storage
+            uint32_t capacity;
+
             // Backing store used to implement the circular queue
-            char storage[NanoLogConfig::STAGING_BUFFER_SIZE];
+            char *storage;
+
+            // Number of bytes mapped for storage (see mapBuffer()), or 0 if
+            // it's in shared memory
+            size_t storageBytes;
 
             friend RuntimeLogger;
+            friend CompressionWorker;
             friend StagingBufferDestroyer;
 
             DISALLOW_COPY_AND_ASSIGN(StagingBuffer);
         };
 
+        /**
+         * A CompressionWorker runs one background thread that polls a subset
+         * of the StagingBuffers, compresses the staged log messages, and
+         * outputs them to the worker's own log file. Running multiple workers
+         * allows compression throughput to scale with the number of logging
+         * threads; each output file is a self-contained NanoLog log with its
+         * own Checkpoint and dictionary.
+         */
+        class CompressionWorker {
+        public:
+            CompressionWorker(RuntimeLogger *logger, uint32_t workerId,
+                              int outputFd, LogChannel *channel = nullptr);
+            ~CompressionWorker();
+
+            void start();
+            void stop();
+
+        PRIVATE:
+            void compressionThreadMain();
+            bool hasUnconsumedData();
+            void addStagingBuffer(StagingBuffer *sb);
+            void adoptNewStagingBuffers();
+            void applyThreadSettings(pthread_t thread);
+            void waitForWork(uint32_t expectedSeq);
+            void openIndexFile();
+            bool shouldRotateOutputFile();
+            bool rotateOutputFile();
+            void closeRetiredOutputFiles();
+            bool periodicSyncDue();
+            void flushOutputFile();
+            void recordWritesCompleted(uint32_t numCompleted);
+            void discardOldestLogMsgs(StagingBuffer *sb, char *peekPosition,
+                                      uint64_t peekBytes);
+            std::string getFileName();
+
+            // Durability mode of the log the worker outputs
+            DurabilityMode getDurability() {
+                return (channel != nullptr) ? channel->durability
+                                            : logger->durability;
+            }
+
+            // RuntimeLogger that owns this worker
+            RuntimeLogger *logger;
+
+            // Identifies this worker within the RuntimeLogger (0 is the first)
+            uint32_t id;
+
+            // Log channel the worker outputs, or nullptr if it's one of the
+            // workers of the default log
+            LogChannel *channel;
+
+            // The thread-local StagingBuffers assigned to this worker. Only
+            // the compression thread modifies it, so it iterates it without
+            // locking; other threads must hold bufferMutex to read it.
+            std::vector<StagingBuffer *> threadBuffers;
+
+            // Serializes modifications of threadBuffers (and the deletion of
+            // StagingBuffers) by the compression thread with other readers
+            std::mutex bufferMutex;
+
+            // Lock-free stack of StagingBuffers assigned to this worker since
+            // the compression thread last adopted them into threadBuffers;
+            // linked via StagingBuffer::nextNewBuffer.
+            std::atomic<StagingBuffer *> newThreadBuffers;
+
+            // Number of StagingBuffers assigned to this worker (including the
+            // ones not adopted yet); used to balance the assignment
+            std::atomic<uint32_t> numThreadBuffers;
+
+            // Background thread that polls the various staging buffers,
+            // compresses the staged log messages, and outputs it to a file.
+            std::thread compressionThread;
+
+            // Flag signaling the compressionThread to stop running. This is
+            // typically only set in testing or when the application is exiting.
+            bool compressionThreadShouldExit;
+
+            // Marks the progress of flushing all log messages to disk after a
+            // user invokes the sync() API. To complete the operation, the
+            // background thread has to make two passes through the staging
+            // buffers and wait on the AIO to complete before waking up the
+            // user thread.
+            enum {
+                SYNC_REQUESTED,         // User invoked a sync() operation
+                PERFORMING_SECOND_PASS, // Background thread is making a second pass
+                WAITING_ON_AIO,         // Background thread is waiting on I/O
+                SYNC_COMPLETED          // Operation complete/no requests
+            } syncStatus;
+
+            // Protects the condition variables below
+            std::mutex condMutex;
+
+            // Signal for when the compression thread should wakeup
+            std::condition_variable workAdded;
+
+            // Signaled when the background thread completes a sync() operation
+            // and the user thread should wake up.
+            std::condition_variable hintSyncCompleted;
+
+            // File handle for the output file; owned by the worker
+            int outputFd;
+
+            // File handle for the index file accompanying the output file
+            // (see Log::IndexEntry), or -1 if the index is not maintained
+            int indexFd;
+
+            // Offset in the output file at which the next output buffer
+            // will be written
+            uint64_t outputFileOffset;
+
+            // Offset in the output file of the Checkpoint the worker's
+            // Encoder starts its output with
+            uint64_t checkpointOffset;
+
+            // rdtsc() of when the worker started outputting to outputFd
+            uint64_t cyclesAtOutputFileStart;
+
+            // File handles of rotated output files that may still have
+            // writes in flight; they're closed once the backend is idle
+            std::vector<int> retiredOutputFds;
+
+            // Set when rotating the output file failed, in which case the
+            // worker keeps outputting to the same file from then on
+            bool rotationFailed;
+
+            // Bytes submitted for output since the output file was last
+            // flushed by flushOutputFile()
+            uint64_t bytesWrittenSinceSync;
+
+            // rdtsc() of the first write submitted since the output file was
+            // last flushed by flushOutputFile()
+            uint64_t cyclesAtUnsyncedWrite;
+
+            // Asynchronous I/O mechanism used to write out the compressed log
+            OutputBackend *backend;
+
+            // Ring of dynamically allocated buffers used to stage compressed
+            // log messages before handing them over to the OutputBackend for
+            // output. One buffer is compressed into while the others can be
+            // in flight to the disk, in ring order.
+            std::vector<char*> outputBuffers;
+
+            // Size of each of the outputBuffers
+            uint32_t outputBufferSize;
+
+            // Number of bytes mapped for each of the outputBuffers, which is
+            // rounded up to the page size (see mapBuffer())
+            size_t outputBufferMappedSize;
+
+            // Index in outputBuffers of the compressingBuffer
+            uint32_t compressingIndex;
+
+            // Buffer in outputBuffers currently being compressed into
+            char *compressingBuffer;
+
+            // When block compression is enabled, the output buffers are
+            // compressed into the buffer with the same index here before
+            // they're written out, so that it's left intact while in flight.
+            // Empty if block compression is disabled.
+            std::vector<char*> blockBuffers;
+
+            // Size of each of the blockBuffers
+            uint32_t blockBufferSize;
+
+            // Number of bytes mapped for each of the blockBuffers
+            size_t blockBufferMappedSize;
+
+            // Marks the rdtsc() when the current compression thread first
+            // started running. A value of 0 indicates the compression thread
+            // is not running
+            uint64_t cycleAtThreadStart;
+
+            // Marks the rdtsc() when the last I/O operation started
+            uint64_t cyclesAtLastAIOStart;
+
+            // Metric: Number of cycles compression thread is doing work
+            Util::RelaxedCounter<uint64_t> cyclesActive;
+
+            // Metric: Amount of time spent compressing the dynamic log data
+            Util::RelaxedCounter<uint64_t> cyclesCompressing;
+
+            // Metric: Stores the distribution of StagingBuffer peek sizes in 5%
+            // increments relative to the full size. This distribution should
+            // show how well the background thread keeps up with the logging
+            // threads.
+            Util::RelaxedCounter<uint64_t> stagingBufferPeekDist[20];
+
+            // Metric: Amount of time spent scanning the buffers for work and
+            // compressing events found.
+            uint64_t cyclesScanningAndCompressing;
+
+            // Metric: Upper bound on the amount of time spent on fsync() and
+            // disk writes. It is an upper bound since the code polls for the
+            // async IO
+            Util::RelaxedCounter<uint64_t> cyclesDiskIO_upperBound;
+
+            // Metric: Number of bytes read in from the staging buffers
+            Util::RelaxedCounter<uint64_t> totalBytesRead;
+
+            // Metric: Number of bytes written to the output file (includes
+            // padding)
+            Util::RelaxedCounter<uint64_t> totalBytesWritten;
+
+            // Metric: Number of pad bytes written to round the file to the
+            // nearest 512B
+            Util::RelaxedCounter<uint64_t> padBytesWritten;
+
+            // Metric: Number of bytes that were block compressed (i.e. the
+            // size of the output before block compression)
+            Util::RelaxedCounter<uint64_t> totalBytesBlockCompressed;
+
+            // Metric: Amount of time spent block compressing output buffers
+            Util::RelaxedCounter<uint64_t> cyclesBlockCompressing;
+
+            // Metric: Number of log statements compressed and outputted.
+            Util::RelaxedCounter<uint64_t> logsProcessed;
+
+            // Metric: Number of times an output write was completed.
+            Util::RelaxedCounter<uint32_t> numAioWritesCompleted;
+
+            // Metric: Number of times the output file was rotated
+            Util::RelaxedCounter<uint32_t> numRotations;
+
+            // Metric: Number of times the output file was flushed by
+            // flushOutputFile() and the cycles spent doing so
+            Util::RelaxedCounter<uint32_t> numSyncs;
+            Util::RelaxedCounter<uint64_t> cyclesSyncing;
+
+            // Metric: Distribution of the number of output buffers in flight
+            // (as a fraction of the ring size in 10% increments) sampled
+            // whenever a new output buffer is submitted. This shows how far
+            // ahead of the disk the compression is running.
+            Util::RelaxedCounter<uint64_t> outputRingOccupancyDist[10];
+
+            // Metric: Number of times the compression had to stall because
+            // all the output buffers in the ring were in flight
+            Util::RelaxedCounter<uint32_t> numOutputRingStalls;
+
+            // Metric: Cycles spent stalled waiting for a free output buffer
+            Util::RelaxedCounter<uint64_t> cyclesOutputRingStalled;
+
+            // Metric: Number of times the background thread blocked on the
+            // futex because it ran out of work
+            Util::RelaxedCounter<uint64_t> numIdleWaits;
+
+            // Metric: Cycles spent blocked on the futex
+            Util::RelaxedCounter<uint64_t> cyclesIdleWaiting;
+
+            // Metric: Number of log messages discarded without being output
+            // in the flight recorder mode
+            Util::RelaxedCounter<uint64_t> logsDiscarded;
+
+            // Metric: Distribution of the latencies of the output writes from
+            // submission to completion in the buckets of NanoLog::Metrics.
+            // The writes are assumed to complete in the order they were
+            // submitted, which holds for appends to a single file.
+            Util::RelaxedCounter<uint64_t>
+                    writeLatencyDist[NanoLog::Metrics::NUM_LATENCY_BUCKETS];
+
+            // rdtsc() of the submission of each write in flight, in a ring
+            // that starts at oldestWriteInFlight. Used for writeLatencyDist.
+            std::vector<uint64_t> cyclesAtWriteSubmit;
+            uint32_t oldestWriteInFlight;
+
+            // Metric: Number of output writes currently in flight
+            Util::RelaxedCounter<uint32_t> numWritesInFlight;
+
+            // Metric: Distribution of the latencies of flushOutputFile()
+            Util::RelaxedCounter<uint64_t>
+                    syncLatencyDist[NanoLog::Metrics::NUM_LATENCY_BUCKETS];
+
+            // Metric: Producer metrics of the StagingBuffers that have been
+            // deleted, so that the totals reported by getMetrics() don't drop
+            // when a thread exits. Protected by bufferMutex.
+            uint64_t retiredAllocations;
+            uint64_t retiredWaitsForSpace;
+            uint64_t retiredCyclesWaitingForSpace;
+            std::vector<LogSiteStats> retiredLogSiteStats;
+
+            // Metric: Compressed bytes output per log identifier, with the
+            // ones past NanoLogConfig::MAX_LOG_SITE_STATS counted in the last
+            // entry; empty unless compiled with -DRECORD_LOG_SITE_STATS.
+            std::vector<uint64_t> logSiteCompressedBytes;
+
+            // Stores the last coreId that the background thread ran in.
+            int coreId;
+
+            // Indicates the index of the next invocationSite that needs to be
+            // persisted to this worker's output file.
+            uint32_t nextInvocationIndexToBePersisted;
+
+            friend RuntimeLogger;
+
+            DISALLOW_COPY_AND_ASSIGN(CompressionWorker);
+        };
+
         // This class is intended to be instantiated as a C++ thread_local to
         // synchronize marking the thread local stagingBuffer for deletion with
         // thread death.
@@ -510,9 +1540,22 @@ using namespace NanoLog;
             void stagingBufferCreated() {}
 
             virtual ~StagingBufferDestroyer() {
-                if (stagingBuffer != nullptr) {
-                    stagingBuffer->shouldDeallocate = true;
-                    stagingBuffer = nullptr;
+                release(stagingBuffer);
+                for (StagingBuffer *&sb : channelBuffers)
+                    release(sb);
+            }
+
+        PRIVATE:
+            // Marks one of the thread's StagingBuffers for deletion
+            static void release(StagingBuffer *&sb) {
+                // Record any log messages dropped since the last marker
+                if (sb != nullptr && sb->numPendingDrops)
+                    sb->reserveSpaceOrDrop(0, SILENT_LOG_LEVEL);
+
+                if (sb != nullptr) {
+                    __atomic_store_n(&sb->shouldDeallocate, true,
+                                     __ATOMIC_RELEASE);
+                    sb = nullptr;
                 }
             }
         };
@@ -0,0 +1,368 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ios>
+
+#include "Fence.h"
+#include "SharedStagingBuffer.h"
+
+namespace NanoLogInternal {
+namespace SharedStagingBuffer {
+
+/**
+ * Returns the POSIX shared memory name of the registry for a sink name; the
+ * leading '/' is optional in the sink name.
+ *
+ * \param sinkName
+ *      Name of the shared memory sink
+ */
+std::string
+getRegistryName(const char *sinkName)
+{
+    std::string name(sinkName);
+    if (name.empty() || name[0] != '/')
+        name.insert(0, "/");
+    return name;
+}
+
+/**
+ * Returns the POSIX shared memory name of a buffer region
+ *
+ * \param registryName
+ *      Name of the registry the buffer region is published in
+ * \param index
+ *      Index of the buffer region in the registry
+ */
+std::string
+getBufferName(const std::string &registryName, uint32_t index)
+{
+    return registryName + "." + std::to_string(index);
+}
+
+/**
+ * Creates a shared memory region and maps it read/write. Any region of the
+ * same name (i.e. from a previous execution) is unlinked first so that
+ * processes which still have it mapped are unaffected. The pages are faulted
+ * in up front like the private StagingBuffer storage.
+ *
+ * \param name
+ *      POSIX shared memory name of the region
+ * \param bytes
+ *      Size of the region
+ *
+ * \return
+ *      The zero-filled region, or nullptr if it couldn't be created (errno
+ *      is set)
+ */
+char *
+createRegion(const std::string &name, size_t bytes)
+{
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return nullptr;
+
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+        mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    int err = errno;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        errno = err;
+        return nullptr;
+    }
+
+    std::memset(mem, 0, bytes);
+    return static_cast<char *>(mem);
+}
+
+/**
+ * Unmaps a region mapped by createRegion() or one of the readers. The region
+ * itself persists until it's unlinked.
+ *
+ * \param region
+ *      Start of the mapping
+ * \param bytes
+ *      Size of the mapping
+ */
+void
+unmapRegion(void *region, size_t bytes)
+{
+    if (region != nullptr)
+        munmap(region, bytes);
+}
+
+/**
+ * Creates and initializes the registry of a shared memory sink
+ *
+ * \param registryName
+ *      POSIX shared memory name of the registry (see getRegistryName())
+ *
+ * \return
+ *      The mapped registry
+ *
+ * \throw ios_base::failure
+ *      if the registry cannot be created
+ */
+Registry *
+createRegistry(const std::string &registryName)
+{
+    char *region = createRegion(registryName, sizeof(Registry));
+    if (region == nullptr) {
+        std::string err = "Unable to create the shared memory sink '";
+        err.append(registryName);
+        err.append("': ");
+        err.append(strerror(errno));
+        throw std::ios_base::failure(err);
+    }
+
+    Registry *registry = new(region) Registry();
+    registry->magic = REGISTRY_MAGIC;
+    registry->version = LAYOUT_VERSION;
+    registry->pid = static_cast<uint32_t>(getpid());
+    registry->numBuffers = 0;
+    registry->closed = 0;
+    return registry;
+}
+
+/**
+ * Maps an existing shared memory region
+ *
+ * \param name
+ *      POSIX shared memory name of the region
+ * \param[out] bytes
+ *      Size of the region
+ *
+ * \return
+ *      The mapped region, or nullptr if it doesn't exist or can't be mapped
+ */
+static char *
+mapRegion(const std::string &name, size_t *bytes)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        *bytes = static_cast<size_t>(st.st_size);
+        mem = mmap(nullptr, *bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+    return (mem == MAP_FAILED) ? nullptr : static_cast<char *>(mem);
+}
+
+BufferReader::BufferReader()
+    : region(nullptr)
+    , regionSize(0)
+    , header(nullptr)
+    , storage(nullptr)
+{
+}
+
+BufferReader::~BufferReader()
+{
+    unmapRegion(region, regionSize);
+}
+
+/**
+ * Maps a buffer region published by the application and validates its
+ * header. This may only be invoked once per BufferReader.
+ *
+ * \param registryName
+ *      POSIX shared memory name of the registry
+ * \param index
+ *      Index of the buffer region in the registry
+ *
+ * \return
+ *      true if the buffer region is ready to be consumed
+ */
+bool
+BufferReader::open(const std::string &registryName, uint32_t index)
+{
+    region = mapRegion(getBufferName(registryName, index), &regionSize);
+    if (region == nullptr)
+        return false;
+
+    header = reinterpret_cast<BufferHeader*>(region);
+    uint64_t fieldsEnd = header->storageOffset + header->capacity;
+    if (regionSize < HEADER_SIZE ||
+            header->magic != BUFFER_MAGIC ||
+            header->version != LAYOUT_VERSION ||
+            header->regionSize != regionSize ||
+            fieldsEnd > regionSize ||
+            header->producerPosOffset + sizeof(char*) > regionSize ||
+            header->endOfRecordedSpaceOffset + sizeof(char*) > regionSize ||
+            header->consumerPosOffset + sizeof(char*) > regionSize ||
+            header->shouldDeallocateOffset >= regionSize) {
+        unmapRegion(region, regionSize);
+        region = nullptr;
+        header = nullptr;
+        return false;
+    }
+
+    storage = region + header->storageOffset;
+    return true;
+}
+
+/**
+ * Reads one of the StagingBuffer's position pointers and translates it from
+ * the application's address space to this process'.
+ *
+ * \param offset
+ *      Offset of the pointer within the region
+ */
+char *
+BufferReader::load(uint64_t offset)
+{
+    uint64_t address = *reinterpret_cast<volatile uint64_t*>(region + offset);
+    return storage + (address - header->storageAddress);
+}
+
+/**
+ * Peek at the data available for consumption within the StagingBuffer; see
+ * StagingBuffer::peek() in RuntimeLogger.h.
+ *
+ * \param[out] bytesAvailable
+ *      Number of bytes consumable
+ *
+ * \return
+ *      Pointer to the consumable space
+ */
+char *
+BufferReader::peek(uint64_t *bytesAvailable)
+{
+    // Save a consistent copy of producerPos
+    char *producerPos = load(header->producerPosOffset);
+    char *consumerPos = load(header->consumerPosOffset);
+
+    if (producerPos < consumerPos) {
+        Fence::lfence(); // Prevent reading new producerPos but old endOf...
+        char *endOfRecordedSpace = load(header->endOfRecordedSpaceOffset);
+        *bytesAvailable = endOfRecordedSpace - consumerPos;
+
+        if (*bytesAvailable > 0)
+            return consumerPos;
+
+        // Roll over
+        consumerPos = storage;
+        *reinterpret_cast<volatile uint64_t*>(region +
+                header->consumerPosOffset) = header->storageAddress;
+    }
+
+    *bytesAvailable = producerPos - consumerPos;
+    return consumerPos;
+}
+
+/**
+ * Releases the next nbytes of the StagingBuffer back to the producer; nbytes
+ * must be at most what's returned by peek().
+ *
+ * \param nbytes
+ *      Number of bytes to return back to the producer
+ */
+void
+BufferReader::consume(uint64_t nbytes)
+{
+    Fence::lfence(); // Make sure consumer reads finish before bump
+    volatile uint64_t *consumerPos = reinterpret_cast<volatile uint64_t*>(
+                                            region + header->consumerPosOffset);
+    *consumerPos = *consumerPos + nbytes;
+}
+
+/**
+ * Returns true if the application won't log to the buffer anymore and all of
+ * its log messages have been consumed, at which point the region can be
+ * unlinked.
+ */
+bool
+BufferReader::isAbandoned()
+{
+    bool shouldDeallocate =
+            *reinterpret_cast<volatile bool*>(region +
+                                              header->shouldDeallocateOffset);
+    Fence::lfence();
+    return shouldDeallocate && load(header->consumerPosOffset) ==
+                               load(header->producerPosOffset);
+}
+
+RegistryReader::RegistryReader()
+    : registry(nullptr)
+    , name()
+{
+}
+
+RegistryReader::~RegistryReader()
+{
+    unmapRegion(registry, sizeof(Registry));
+}
+
+/**
+ * Maps the registry of a shared memory sink. This may only be invoked once
+ * per RegistryReader.
+ *
+ * \param sinkName
+ *      Name of the shared memory sink the application logs to
+ *
+ * \return
+ *      true if the registry exists and is of a compatible layout
+ */
+bool
+RegistryReader::open(const char *sinkName)
+{
+    size_t bytes = 0;
+    name = getRegistryName(sinkName);
+    char *region = mapRegion(name, &bytes);
+    if (region == nullptr)
+        return false;
+
+    registry = reinterpret_cast<Registry*>(region);
+    if (bytes != sizeof(Registry) || registry->magic != REGISTRY_MAGIC ||
+            registry->version != LAYOUT_VERSION) {
+        unmapRegion(region, bytes);
+        registry = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Returns true if the application has shut down (or died), i.e. no more
+ * buffer regions or log messages will be added.
+ */
+bool
+RegistryReader::isClosed()
+{
+    if (registry->closed.load(std::memory_order_acquire))
+        return true;
+
+    return kill(static_cast<pid_t>(registry->pid), 0) != 0 && errno == ESRCH;
+}
+
+}; // namespace SharedStagingBuffer
+}; // namespace NanoLogInternal
@@ -0,0 +1,214 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NANOLOG_SHAREDSTAGINGBUFFER_H
+#define NANOLOG_SHAREDSTAGINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Common.h"
+
+namespace NanoLogInternal {
+
+/**
+ * Describes how the StagingBuffers are laid out in POSIX shared memory when
+ * they're consumed by an external process (see NanoLog::setSharedMemorySink())
+ * rather than by the application's own compression threads.
+ *
+ * The application publishes a registry region under the sink's name (i.e.
+ * "/nanolog") and one region per StagingBuffer under the sink's name with
+ * the buffer's index appended (i.e. "/nanolog.3"). A buffer region starts
+ * with a BufferHeader page, followed by the StagingBuffer object itself and
+ * finally by its storage. The producer keeps logging through the unmodified
+ * StagingBuffer, so its positions are pointers in the application's address
+ * space; the header records where they are in the region and where the
+ * storage was mapped in the application so that a consumer can translate
+ * them to its own mapping.
+ *
+ * The consumer follows the StagingBuffer's single consumer protocol: it
+ * reads the log messages between its consumer position and the producer's
+ * position and releases them back to the producer by advancing the consumer
+ * position. Buffer regions are never reused; the consumer unlinks them once
+ * they're drained and the producer has abandoned them.
+ */
+namespace SharedStagingBuffer {
+
+// Identifies the regions and the version of their layout
+static const uint32_t REGISTRY_MAGIC = 0x474c4e52;  // "RNLG"
+static const uint32_t BUFFER_MAGIC = 0x474c4e42;    // "BNLG"
+static const uint32_t LAYOUT_VERSION = 1;
+
+// Bytes reserved for the BufferHeader at the start of a buffer region; the
+// StagingBuffer object and its storage follow at page aligned offsets
+static const size_t HEADER_SIZE = 4096;
+
+// BufferHeader::replaces value of buffers that didn't replace another one
+static const uint32_t NO_BUFFER = UINT32_MAX;
+
+/**
+ * Layout of the registry region through which the consumer discovers the
+ * StagingBuffers.
+ */
+struct Registry {
+    // REGISTRY_MAGIC and LAYOUT_VERSION
+    uint32_t magic;
+    uint32_t version;
+
+    // Process id of the application
+    uint32_t pid;
+
+    // Number of buffer regions published so far; region i is named after
+    // the registry with ".i" appended
+    std::atomic<uint32_t> numBuffers;
+
+    // Set by the application once it has shut down; no more log messages
+    // will be added to the buffers afterwards
+    std::atomic<uint32_t> closed;
+};
+
+/**
+ * Layout of the first page of a buffer region. It's written by the
+ * application before the region is published and never changes afterwards.
+ */
+struct BufferHeader {
+    // BUFFER_MAGIC and LAYOUT_VERSION
+    uint32_t magic;
+    uint32_t version;
+
+    // StagingBuffer id to encode the log messages with; buffers that
+    // replaced one another for the same thread share the id
+    uint32_t bufferId;
+
+    // Number of bytes in the storage
+    uint32_t capacity;
+
+    // Index of the buffer region this one replaced for the same thread
+    // (NO_BUFFER if none). The replaced buffer has to be drained first to
+    // keep the thread's log messages in order.
+    uint32_t replaces;
+    uint32_t unused;
+
+    // Size of the region in bytes
+    uint64_t regionSize;
+
+    // Offset of the storage within the region and its address in the
+    // application
+    uint64_t storageOffset;
+    uint64_t storageAddress;
+
+    // Offsets within the region of the StagingBuffer's char* producerPos,
+    // char* endOfRecordedSpace, char* consumerPos and bool shouldDeallocate
+    uint64_t producerPosOffset;
+    uint64_t endOfRecordedSpaceOffset;
+    uint64_t consumerPosOffset;
+    uint64_t shouldDeallocateOffset;
+};
+
+std::string getRegistryName(const char *sinkName);
+std::string getBufferName(const std::string &registryName, uint32_t index);
+Registry *createRegistry(const std::string &registryName);
+char *createRegion(const std::string &name, size_t bytes);
+void unmapRegion(void *region, size_t bytes);
+
+/**
+ * Consumer side of a StagingBuffer published in shared memory. It mirrors the
+ * peek() and consume() operations of the StagingBuffer for a process other
+ * than the application.
+ */
+class BufferReader {
+PUBLIC:
+    BufferReader();
+    ~BufferReader();
+
+    bool open(const std::string &registryName, uint32_t index);
+    char *peek(uint64_t *bytesAvailable);
+    void consume(uint64_t nbytes);
+    bool isAbandoned();
+
+    /**
+     * Returns the StagingBuffer id to encode the buffer's log messages with
+     */
+    uint32_t getId() {
+        return header->bufferId;
+    }
+
+    /**
+     * Returns the index of the buffer region this one replaced, or NO_BUFFER
+     */
+    uint32_t getReplaces() {
+        return header->replaces;
+    }
+
+PRIVATE:
+    char *load(uint64_t offset);
+
+    // Mapping of the buffer region; nullptr if it's not open
+    char *region;
+
+    // Number of bytes mapped
+    size_t regionSize;
+
+    // Start of the region, the header of which describes its layout
+    BufferHeader *header;
+
+    // Start of the StagingBuffer's storage in this process
+    char *storage;
+
+    DISALLOW_COPY_AND_ASSIGN(BufferReader);
+};
+
+/**
+ * Consumer side of the registry; used to discover new buffer regions and
+ * find out when the application has shut down.
+ */
+class RegistryReader {
+PUBLIC:
+    RegistryReader();
+    ~RegistryReader();
+
+    bool open(const char *sinkName);
+    bool isClosed();
+
+    /**
+     * Returns the number of buffer regions published so far
+     */
+    uint32_t getNumBuffers() {
+        return registry->numBuffers.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns the shared memory name of the registry
+     */
+    const std::string &getName() {
+        return name;
+    }
+
+PRIVATE:
+    // Mapping of the registry region; nullptr if it's not open
+    Registry *registry;
+
+    // Shared memory name of the registry
+    std::string name;
+
+    DISALLOW_COPY_AND_ASSIGN(RegistryReader);
+};
+
+}; // namespace SharedStagingBuffer
+}; // namespace NanoLogInternal
+
+#endif // NANOLOG_SHAREDSTAGINGBUFFER_H
@@ -0,0 +1,197 @@
+/* Copyright (c) 2020 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "TestUtil.h"
+#include "RuntimeLogger.h"
+#include "SharedStagingBuffer.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+using namespace NanoLogInternal;
+using namespace NanoLogInternal::SharedStagingBuffer;
+
+typedef RuntimeLogger::StagingBuffer StagingBuffer;
+
+class SharedStagingBufferTest : public ::testing::Test {
+protected:
+    RuntimeLogger &logger;
+    std::string registryName;
+
+    SharedStagingBufferTest()
+        : logger(RuntimeLogger::nanoLogSingleton)
+        , registryName("/nanoLogTest." + std::to_string(getpid()))
+    {
+    }
+
+    // Publishes the StagingBuffers created via createSharedStagingBuffer() to
+    // a registry without reconfiguring the singleton's workers.
+    virtual void SetUp() {
+        logger.sharedMemoryName = registryName;
+        logger.sharedMemoryRegistry = createRegistry(registryName);
+    }
+
+    virtual void TearDown() {
+        uint32_t numBuffers = logger.sharedMemoryRegistry->numBuffers;
+        for (RuntimeLogger::SharedBufferRegion &shared :
+                                                logger.sharedBufferRegions)
+            unmapRegion(shared.region, shared.size);
+        logger.sharedBufferRegions.clear();
+
+        for (uint32_t i = 0; i < numBuffers; ++i)
+            shm_unlink(getBufferName(registryName, i).c_str());
+        unmapRegion(logger.sharedMemoryRegistry, sizeof(Registry));
+        shm_unlink(registryName.c_str());
+
+        logger.sharedMemoryName.clear();
+        logger.sharedMemoryRegistry = nullptr;
+    }
+
+    StagingBuffer *createBuffer(uint32_t id, uint32_t capacity,
+                                StagingBuffer *oldBuffer = nullptr) {
+        std::lock_guard<std::mutex> lock(logger.bufferMutex);
+        return logger.createSharedStagingBuffer(id, capacity, oldBuffer);
+    }
+
+    // Copies a string into the StagingBuffer like a log statement would
+    bool produce(StagingBuffer *sb, const std::string &data) {
+        char *space = sb->reserveSpaceInternal(data.size(), false);
+        if (space == nullptr)
+            return false;
+
+        std::memcpy(space, data.data(), data.size());
+        sb->finishReservation(data.size());
+        return true;
+    }
+
+    std::string peekString(BufferReader &reader) {
+        uint64_t bytesAvailable = 0;
+        char *data = reader.peek(&bytesAvailable);
+        return std::string(data, bytesAvailable);
+    }
+};
+
+TEST_F(SharedStagingBufferTest, getNames) {
+    EXPECT_EQ("/nanolog", getRegistryName("nanolog"));
+    EXPECT_EQ("/nanolog", getRegistryName("/nanolog"));
+    EXPECT_EQ("/nanolog.12", getBufferName("/nanolog", 12));
+}
+
+TEST_F(SharedStagingBufferTest, RegistryReader) {
+    RegistryReader missing;
+    EXPECT_FALSE(missing.open("nanoLogTestMissingSink"));
+
+    RegistryReader reader;
+    ASSERT_TRUE(reader.open(registryName.c_str() + 1));
+    EXPECT_EQ(registryName, reader.getName());
+    EXPECT_EQ(0U, reader.getNumBuffers());
+    EXPECT_FALSE(reader.isClosed());
+
+    createBuffer(3, 4096);
+    EXPECT_EQ(1U, reader.getNumBuffers());
+
+    logger.sharedMemoryRegistry->closed = 1;
+    EXPECT_TRUE(reader.isClosed());
+
+    // Incompatible layouts are rejected
+    RegistryReader stale;
+    logger.sharedMemoryRegistry->version = LAYOUT_VERSION + 1;
+    EXPECT_FALSE(stale.open(registryName.c_str()));
+    logger.sharedMemoryRegistry->version = LAYOUT_VERSION;
+}
+
+TEST_F(SharedStagingBufferTest, createSharedStagingBuffer) {
+    StagingBuffer *sb = createBuffer(3, 4096);
+    ASSERT_EQ(1U, logger.sharedBufferRegions.size());
+    RuntimeLogger::SharedBufferRegion &shared = logger.sharedBufferRegions[0];
+    EXPECT_EQ(sb, shared.sb);
+    EXPECT_EQ(0U, shared.index);
+
+    BufferHeader *header = reinterpret_cast<BufferHeader*>(shared.region);
+    EXPECT_EQ(BUFFER_MAGIC, header->magic);
+    EXPECT_EQ(3U, header->bufferId);
+    EXPECT_EQ(4096U, header->capacity);
+    EXPECT_EQ(NO_BUFFER, header->replaces);
+    EXPECT_EQ(shared.size, header->regionSize);
+    EXPECT_EQ(0U, header->storageOffset % HEADER_SIZE);
+    EXPECT_EQ(shared.region + header->storageOffset, sb->storage);
+    EXPECT_EQ(reinterpret_cast<uint64_t>(sb->storage),
+              header->storageAddress);
+    EXPECT_EQ(shared.region + header->consumerPosOffset,
+              reinterpret_cast<char*>(const_cast<char**>(&sb->consumerPos)));
+
+    // A replacement records the buffer it replaced
+    StagingBuffer *next = createBuffer(3, 8192, sb);
+    header = reinterpret_cast<BufferHeader*>(
+                                    logger.sharedBufferRegions[1].region);
+    EXPECT_EQ(next, logger.sharedBufferRegions[1].sb);
+    EXPECT_EQ(0U, header->replaces);
+    EXPECT_EQ(8192U, header->capacity);
+
+    // Abandoned buffers are unmapped once they're drained
+    produce(sb, "abc");
+    sb->shouldDeallocate = true;
+    createBuffer(4, 4096);
+    EXPECT_EQ(3U, logger.sharedBufferRegions.size());
+
+    sb->consume(3);
+    createBuffer(5, 4096);
+    ASSERT_EQ(3U, logger.sharedBufferRegions.size());
+    EXPECT_EQ(1U, logger.sharedBufferRegions[0].index);
+    EXPECT_EQ(4U, logger.sharedMemoryRegistry->numBuffers);
+}
+
+TEST_F(SharedStagingBufferTest, BufferReader) {
+    StagingBuffer *sb = createBuffer(3, 64);
+
+    BufferReader missing;
+    EXPECT_FALSE(missing.open(registryName, 1));
+
+    BufferReader reader;
+    ASSERT_TRUE(reader.open(registryName, 0));
+    EXPECT_EQ(3U, reader.getId());
+    EXPECT_EQ(NO_BUFFER, reader.getReplaces());
+    EXPECT_EQ("", peekString(reader));
+
+    ASSERT_TRUE(produce(sb, std::string(40, 'a')));
+    EXPECT_EQ(std::string(40, 'a'), peekString(reader));
+
+    // Consumption frees up space for the producer in the application
+    EXPECT_FALSE(produce(sb, std::string(30, 'b')));
+    reader.consume(40);
+    EXPECT_EQ(sb->storage + 40, sb->consumerPos);
+    EXPECT_EQ("", peekString(reader));
+
+    // The producer rolls over, which the reader follows
+    ASSERT_TRUE(produce(sb, std::string(30, 'b')));
+    EXPECT_EQ(sb->storage, sb->producerPos - 30);
+    EXPECT_EQ(std::string(30, 'b'), peekString(reader));
+    EXPECT_EQ(sb->storage, sb->consumerPos);
+
+    EXPECT_FALSE(reader.isAbandoned());
+    sb->shouldDeallocate = true;
+    EXPECT_FALSE(reader.isAbandoned());
+    reader.consume(30);
+    EXPECT_TRUE(reader.isAbandoned());
+    EXPECT_TRUE(sb->checkCanDelete());
+}
+
+}  // namespace
@@ -26,6 +26,7 @@
 #include <cstdio>
 #include <cstdlib>
 
+#include <atomic>
 #include <string>
 #include <stdexcept>
 
@@ -184,6 +185,51 @@ static const uint32_t BYTES_PER_CACHE_LINE = 64;
 template<class T, size_t N>
 constexpr size_t arraySize(T (&)[N]) { return N; }
 
+/**
+ * A metric that is only updated by one thread but may be read by any other
+ * thread at any time (e.g. by NanoLog::getMetrics()). All accesses are relaxed
+ * atomics, so an update compiles to the same loads and stores as on a plain
+ * integer while the readers are guaranteed to see untorn values.
+ */
+template<typename T>
+class RelaxedCounter {
+public:
+    RelaxedCounter(T initialValue = 0)
+        : value(initialValue)
+    {}
+
+    FORCE_INLINE
+    operator T() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    FORCE_INLINE RelaxedCounter &
+    operator=(T newValue) {
+        value.store(newValue, std::memory_order_relaxed);
+        return *this;
+    }
+
+    FORCE_INLINE RelaxedCounter &
+    operator+=(T delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta,
+                    std::memory_order_relaxed);
+        return *this;
+    }
+
+    FORCE_INLINE RelaxedCounter &
+    operator++() {
+        return *this += 1;
+    }
+
+    FORCE_INLINE RelaxedCounter &
+    operator--() {
+        return *this += static_cast<T>(-1);
+    }
+
+private:
+    std::atomic<T> value;
+};
+
 } // end Util
 
 } // end PerfUtils